@@ -23,6 +23,21 @@ struct mpool;                   /* opaque mpool handle */
 struct mpool_mdc;               /* opaque MDC (metadata container) handle */
 struct mpool_mcache_map;        /* opaque mcache map handle */
 struct mpool_mlog;              /* opaque mlog handle */
+struct mpool_sos;               /* opaque small object store handle */
+struct mpool_stripe_grp;        /* opaque stripe group handle */
+struct mpool_stripe;            /* opaque striped mblock handle */
+struct mpool_dedup;             /* opaque dedup layer handle */
+struct mpool_dedup_wr;          /* opaque dedup writer handle */
+struct mpool_cmb;               /* opaque compressed mblock reader handle */
+struct mpool_cmb_wr;            /* opaque compressed mblock writer handle */
+struct mpool_chlog;             /* opaque chained log handle */
+struct mpool_catalog;           /* opaque named object catalog handle */
+struct mpool_mlspare;           /* opaque spare mlog pool handle */
+struct mpool_sst;               /* opaque sorted table reader handle */
+struct mpool_sst_wr;            /* opaque sorted table builder handle */
+struct mpool_sst_iter;          /* opaque sorted table iterator */
+struct mpool_iobuf_pool;        /* opaque I/O buffer pool handle */
+struct mpool_mbstream;          /* opaque mblock stream handle */
 struct iovec;
 
 #define MPOOL_RUNDIR_ROOT       "/var/run/mpool"
@@ -118,6 +133,8 @@ mpool_list(
  * @ei:     error detail
  *
  * Discovers associated block devices and attempts cohesive activate.
+ * Writeback throttling is turned off on the devices, and their whole
+ * block queue tuning profiles are applied if @flags has MP_FLAGS_DEVTUNE.
  */
 uint64_t
 mpool_activate(
@@ -165,6 +182,11 @@ mpool_rename(
  * If the O_EXCL flag is given on first open then all subsequent calls to
  * @mpool_open() will fail with -EBUSY.  Similarly, if the mpool is open in
  * shared mode then specifying the O_EXCL flag will fail with -EBUSY.
+ *
+ * A handle opened for writing records the mblocks and mlogs it allocates
+ * until they are committed, aborted or deleted.  Objects recorded by
+ * handles that were closed, or whose process is gone, are aborted by a
+ * background thread of the next handle opened for writing.
  */
 /* MTF_MOCK */
 uint64_t
@@ -177,6 +199,10 @@ mpool_open(
 /**
  * mpool_close() - Close an mpool
  * @mp:       mpool handle
+ *
+ * Mblocks and mlogs allocated through @mp must be committed or aborted
+ * first: those still uncommitted are considered orphaned once @mp is
+ * closed, see mpool_open().
  */
 /* MTF_MOCK */
 uint64_t mpool_close(struct mpool *mp);
@@ -276,6 +302,45 @@ mpool_devprops_get(
 	const char         *devname,
 	struct mp_devprops *dprops);
 
+/**
+ * struct mpool_devtune - block queue settings of a device
+ * @mdt_sched:          I/O scheduler (queue/scheduler)
+ * @mdt_nr_requests:    queue/nr_requests
+ * @mdt_read_ahead_kb:  queue/read_ahead_kb
+ * @mdt_max_sectors_kb: queue/max_sectors_kb
+ * @mdt_rq_affinity:    queue/rq_affinity
+ * @mdt_wbt_lat_usec:   queue/wbt_lat_usec, 0 disables writeback throttling
+ *
+ * An empty scheduler name or a negative value means "not set".
+ */
+struct mpool_devtune {
+	char       mdt_sched[16];
+	int64_t    mdt_nr_requests;
+	int64_t    mdt_read_ahead_kb;
+	int64_t    mdt_max_sectors_kb;
+	int64_t    mdt_rq_affinity;
+	int64_t    mdt_wbt_lat_usec;
+};
+
+/**
+ * mpool_devtune_get() - Get the block queue tuning state of a device
+ * @devname: device name
+ * @applied: settings applied when its mpool was activated (output)
+ * @saved:   previous settings, restored at deactivation (output)
+ *
+ * Activating an mpool with MP_FLAGS_DEVTUNE applies the tuning profile of
+ * each device's class from the device table, as overridden by
+ * /etc/mpool/devtune.conf; without it, only writeback throttling is.  This
+ * complements mpool_devprops_get(), whose properties come from the kernel.
+ *
+ * Return: ENOENT if the device's queue is not tuned by an active mpool
+ */
+uint64_t
+mpool_devtune_get(
+	const char             *devname,
+	struct mpool_devtune   *applied,
+	struct mpool_devtune   *saved);
+
 /*
  * Mpool Data Manager APIs
  */
@@ -553,6 +618,50 @@ mpool_mlog_seek_read_data_next(
 	size_t              len,
 	size_t             *rdlen);
 
+/**
+ * mpool_mlog_read_data_init_tail() - Initializes the reverse read cursor to
+ * the end of log
+ * @mp:        mpool handle
+ * @mlh:       mlog handle
+ *
+ * The reverse cursor is independent of the one used by
+ * mpool_mlog_read_data_next(), and does not see records appended after it
+ * was initialized.
+ *
+ * Return:
+ *   %0 on success, <%0 on error
+ */
+uint64_t
+mpool_mlog_read_data_init_tail(
+	struct mpool       *mp,
+	struct mpool_mlog  *mlh);
+
+/**
+ * mpool_mlog_read_data_prev() - Reads the record preceding the reverse read
+ * cursor, i.e., returns records from the newest to the oldest
+ * @mp:        mpool handle
+ * @mlh:       mlog handle
+ * @data:      buffer to read data into
+ * @len:       buffer len
+ * @rdlen:     data in bytes of the returned record, 0 at start of log (output)
+ *
+ * Log blocks are read from media in 1 MiB windows walking backward, so
+ * finding the last few records of a log does not cost a full scan.
+ *
+ * Return:
+ *   %0 on success, <%0 on error
+ *   If merr_errno() of the return value is EOVERFLOW, then the receive buffer
+ *   "data" is too small and must be resized according to the value returned
+ *   in "rdlen".
+ */
+uint64_t
+mpool_mlog_read_data_prev(
+	struct mpool       *mp,
+	struct mpool_mlog  *mlh,
+	void               *data,
+	size_t              len,
+	size_t             *rdlen);
+
 /**
  * mpool_mlog_flush() - Flushes/syncs an mlog
  * @mp:        mpool handle
@@ -629,6 +738,62 @@ mpool_mlog_getprops(
 	struct mpool_mlog      *mlh,
 	struct mlog_props      *props);
 
+/**
+ * mpool_mlog_keyfn_t - Return the ordering key of an mlog data record
+ * @iov:  record data, as passed to the append call
+ * @len:  record length
+ * @arg:  argument given to mpool_mlog_keyidx_enable()
+ */
+typedef uint64_t
+mpool_mlog_keyfn_t(
+	const struct iovec *iov,
+	size_t              len,
+	void               *arg);
+
+/**
+ * mpool_mlog_keyidx_enable() - Maintain a sparse key index over an mlog
+ * @mp:        mpool handle
+ * @mlh:       mlog handle, must be open
+ * @keyfn:     key extractor, or NULL to disable the index
+ * @arg:       argument passed to @keyfn
+ * @stride:    log blocks between index entries (0 for default)
+ *
+ * For mlogs whose data records are appended in non-decreasing key order.
+ * Records appended through @mlh are indexed as they are appended; others
+ * are indexed lazily by mpool_mlog_seek_key().  The index is saved under
+ * the mpool rundir and reused by later sessions.
+ *
+ * Return:
+ *   %0 on success, <%0 on error
+ */
+uint64_t
+mpool_mlog_keyidx_enable(
+	struct mpool           *mp,
+	struct mpool_mlog      *mlh,
+	mpool_mlog_keyfn_t     *keyfn,
+	void                   *arg,
+	uint32_t                stride);
+
+/**
+ * mpool_mlog_seek_key() - Position the read cursor at a key
+ * @mp:        mpool handle
+ * @mlh:       mlog handle with a key index
+ * @key:       key to seek to
+ *
+ * The next mpool_mlog_read_data_next() returns the first data record with
+ * a key >= @key, or end of log.  Binary searches the index and then reads
+ * at most one stride's worth of records.
+ *
+ * Return:
+ *   %0 on success, <%0 on error
+ *   EINVAL if the records were found to be out of key order.
+ */
+uint64_t
+mpool_mlog_seek_key(
+	struct mpool       *mp,
+	struct mpool_mlog  *mlh,
+	uint64_t            key);
+
 /*
  * MDC (Metadata Container) APIs
  */
@@ -826,6 +991,37 @@ uint64_t
 mpool_mdc_cend(
 	struct mpool_mdc   *mdc);
 
+/**
+ * mpool_mdc_snapshot_t - append the records of an MDC snapshot
+ * @arg:  argument passed to mpool_mdc_compact()
+ *
+ * Appends, with mpool_mdc_append(), the records that describe the current
+ * state of the client.
+ */
+typedef mpool_err_t
+mpool_mdc_snapshot_t(
+	void               *arg);
+
+/**
+ * mpool_mdc_compact() - Compact an MDC into a snapshot
+ * @mdc:      MDC handle
+ * @snapshot: appends the snapshot records
+ * @arg:      argument passed to @snapshot
+ *
+ * Runs @snapshot between a compaction start and end marker on the inactive
+ * mlog.  Unlike with mpool_mdc_cstart() and mpool_mdc_cend(), a failure
+ * at any step abandons the compaction rather than closing @mdc: appends
+ * resume on the previously active mlog, whose records are left intact, and
+ * the error is returned.  The caller must not append anything other than
+ * the snapshot while the compaction is in progress.
+ */
+/* MTF_MOCK */
+uint64_t
+mpool_mdc_compact(
+	struct mpool_mdc       *mdc,
+	mpool_mdc_snapshot_t   *snapshot,
+	void                   *arg);
+
 /**
  * mpool_mdc_usage() - Return estimate of active mlog usage
  * @mdc:      MDC handle
@@ -1000,6 +1196,30 @@ mpool_mblock_write(
 	struct iovec     *iov,
 	int               iov_cnt);
 
+/**
+ * mpool_mblock_write_from_fd() - write file contents to an mblock
+ * @mp:   mpool
+ * @mbh:  mblock handle
+ * @fd:   source file descriptor
+ * @off:  source offset, ignored if @fd is not seekable
+ * @len:  number of bytes to write
+ *
+ * Page-aligned source ranges of regular files are mapped and handed to the
+ * write directly, without a copy through a user buffer.  Other sources are
+ * read into a bounce buffer.  A trailing partial page is zero padded, so
+ * the mblock grows by @len rounded up to the page size.
+ *
+ * Return:
+ *   %0 on success, <%0 on error; ENODATA if @fd ends before @len bytes
+ */
+uint64_t
+mpool_mblock_write_from_fd(
+	struct mpool     *mp,
+	uint64_t          mbh,
+	int               fd,
+	off_t             off,
+	size_t            len);
+
 /**
  * mpool_mblock_write_async() - write data to an mblock asynchronously
  * @mp:              mpool
@@ -1064,6 +1284,32 @@ mpool_mblock_read(
 
 /************* mcache stuff **********************************************/
 
+/**
+ * mpool_mblock_send() - send a range of an mblock to a file descriptor
+ * @mp:   mpool
+ * @mbh:  mblock handle, must be committed
+ * @off:  mblock offset
+ * @len:  number of bytes to send
+ * @fd:   destination, e.g., a socket or a pipe
+ *
+ * The range is written to @fd straight from an mcache map of the mblock,
+ * which is kept for later sends until the mblock is deleted or the map is
+ * needed for another mblock.  The data is thus copied once, into @fd, and
+ * never referenced by @fd after the call returns.  Without an mcache map,
+ * the range is read through a bounce buffer.  There are no alignment
+ * requirements on @off or @len.
+ *
+ * Return:
+ *   %0 on success, <%0 on error
+ */
+uint64_t
+mpool_mblock_send(
+	struct mpool     *mp,
+	uint64_t          mbh,
+	size_t            off,
+	size_t            len,
+	int               fd);
+
 /**
  * mpool_mcache_madvise() - Give advice about use of memory
  * @map:        mcache map handle
@@ -1200,6 +1446,54 @@ mpool_mcache_mmap(
 	enum mpc_vma_advice         advice,
 	struct mpool_mcache_map    **mapp);
 
+/**
+ * struct mpool_mcache_ra_stats - adaptive readahead statistics of a map
+ * @mrs_seq:      accesses that extended a sequential run
+ * @mrs_rand:     accesses that did not
+ * @mrs_ahead:    pages advised MADV_WILLNEED ahead of sequential readers
+ * @mrs_switches: switches between MADV_RANDOM and MADV_NORMAL
+ * @mrs_random:   map is currently advised MADV_RANDOM
+ */
+struct mpool_mcache_ra_stats {
+	uint64_t   mrs_seq;
+	uint64_t   mrs_rand;
+	uint64_t   mrs_ahead;
+	uint64_t   mrs_switches;
+	uint32_t   mrs_random;
+	uint32_t   mrs_rsvd;
+};
+
+/**
+ * mpool_mcache_access() - Report an access made through the base address
+ * @map:    mcache map handle
+ * @mbidx:  mcache map mblock index
+ * @offset: byte offset into the mblock
+ * @length: number of bytes accessed
+ *
+ * Maps other than MPC_VMA_PINNED ones adapt their readahead to the access
+ * pattern seen by mpool_mcache_getpages() and mpool_mcache_getpagesv().
+ * Maps created with the default advice, MPC_VMA_COLD, are also switched
+ * to MADV_RANDOM while accesses are mostly random.
+ * Callers that use mpool_mcache_getbase() instead report their accesses
+ * here to get the same treatment.
+ */
+void
+mpool_mcache_access(
+	struct mpool_mcache_map    *map,
+	uint                        mbidx,
+	size_t                      offset,
+	size_t                      length);
+
+/**
+ * mpool_mcache_ra_stats() - Get the adaptive readahead statistics of a map
+ * @map:   mcache map handle
+ * @stats: statistics (output), all zero if the map does not adapt
+ */
+uint64_t
+mpool_mcache_ra_stats(
+	struct mpool_mcache_map        *map,
+	struct mpool_mcache_ra_stats   *stats);
+
 /**
  * mpool_mcache_munmap() - munmap an mcache mmap
  */
@@ -1208,6 +1502,1513 @@ uint64_t
 mpool_mcache_munmap(
 	struct mpool_mcache_map   *map);
 
+/************* small object store ****************************************/
+
+/**
+ * struct mpool_sos_params - small object store tunables
+ * @sp_mclassp:     media class from which segment mblocks are allocated
+ * @sp_garbage_pct: compact sealed segments with at least this much garbage
+ * @sp_compact_ms:  background compaction interval, 0 disables the compactor
+ */
+struct mpool_sos_params {
+	uint8_t    sp_mclassp;
+	uint8_t    sp_garbage_pct;
+	uint8_t    sp_rsvd1[2];
+	uint32_t   sp_compact_ms;
+};
+
+/**
+ * mpool_sos_open() - Open a small object store
+ * @mp:      mpool handle
+ * @logid1:  MDC OID 1
+ * @logid2:  MDC OID 2
+ * @params:  tunables, or NULL for defaults
+ * @sosp:    small object store handle (output)
+ *
+ * The store packs many small objects into large mblocks ("segments") and
+ * keeps its index in the given MDC, which must have been allocated and
+ * committed by the caller.  The index is rebuilt from the MDC on open.
+ */
+uint64_t
+mpool_sos_open(
+	struct mpool                   *mp,
+	uint64_t                        logid1,
+	uint64_t                        logid2,
+	const struct mpool_sos_params  *params,
+	struct mpool_sos              **sosp);
+
+/**
+ * mpool_sos_close() - Sync and close a small object store
+ * @sos: small object store handle
+ */
+uint64_t
+mpool_sos_close(
+	struct mpool_sos   *sos);
+
+/**
+ * mpool_sos_put() - Insert or replace an object
+ * @sos:  small object store handle
+ * @key:  object key
+ * @data: object data
+ * @len:  object length
+ *
+ * The object is durable only after a subsequent mpool_sos_sync() or
+ * mpool_sos_close(), or once its segment fills up.
+ */
+uint64_t
+mpool_sos_put(
+	struct mpool_sos   *sos,
+	uint64_t            key,
+	const void         *data,
+	size_t              len);
+
+/**
+ * mpool_sos_get() - Read an object
+ * @sos:   small object store handle
+ * @key:   object key
+ * @buf:   buffer to receive the object
+ * @bufsz: size of buf
+ * @len:   object length (output)
+ *
+ * Return:
+ *   ENOENT if the key does not exist.  EOVERFLOW if "buf" is too small, in
+ *   which case the required size is returned in "len".
+ */
+uint64_t
+mpool_sos_get(
+	struct mpool_sos   *sos,
+	uint64_t            key,
+	void               *buf,
+	size_t              bufsz,
+	size_t             *len);
+
+/**
+ * mpool_sos_delete() - Delete an object
+ * @sos: small object store handle
+ * @key: object key
+ */
+uint64_t
+mpool_sos_delete(
+	struct mpool_sos   *sos,
+	uint64_t            key);
+
+/**
+ * mpool_sos_sync() - Make all prior puts and deletes durable
+ * @sos: small object store handle
+ */
+uint64_t
+mpool_sos_sync(
+	struct mpool_sos   *sos);
+
+/**
+ * mpool_sos_compact() - Run one compaction pass in the caller's context
+ * @sos: small object store handle
+ */
+uint64_t
+mpool_sos_compact(
+	struct mpool_sos   *sos);
+
+/************* striped mblocks *******************************************/
+
+#define MPOOL_STRIPE_WIDTH_MAX  16
+
+/**
+ * struct mpool_stripe_props - striped mblock properties
+ * @stp_width:     number of member mblocks
+ * @stp_unitsz:    stripe unit size in bytes
+ * @stp_len:       logical bytes written
+ * @stp_committed: true if all members have been committed
+ */
+struct mpool_stripe_props {
+	uint32_t   stp_width;
+	uint32_t   stp_unitsz;
+	uint64_t   stp_len;
+	uint8_t    stp_committed;
+	uint8_t    stp_rsvd1[7];
+};
+
+/**
+ * mpool_stripe_grp_open() - Open a group of mpools for striping
+ * @mpnamev: vector of mpool names
+ * @mpc:     number of mpools, at most MPOOL_STRIPE_WIDTH_MAX
+ * @flags:   open flags, see mpool_open()
+ * @unitsz:  stripe unit in bytes, a multiple of PAGE_SIZE (0 for default)
+ * @grpp:    stripe group handle (output)
+ * @ei:      error detail
+ *
+ * The order of @mpnamev defines the layout of every striped mblock in the
+ * group, so it must be the same each time the group is opened.  The group
+ * owns @mpc - 1 I/O threads that issue the member I/Os of striped reads and
+ * writes, they exit in mpool_stripe_grp_close().
+ */
+uint64_t
+mpool_stripe_grp_open(
+	const char                    **mpnamev,
+	uint32_t                        mpc,
+	uint32_t                        flags,
+	uint32_t                        unitsz,
+	struct mpool_stripe_grp       **grpp,
+	struct mpool_devrpt            *ei);
+
+/**
+ * mpool_stripe_grp_close() - Close all mpools in a stripe group
+ * @grp: stripe group handle
+ */
+uint64_t
+mpool_stripe_grp_close(
+	struct mpool_stripe_grp    *grp);
+
+/**
+ * mpool_stripe_grp_mpool() - Get the handle of a member mpool
+ * @grp: stripe group handle
+ * @idx: member index
+ * @mpp: mpool handle (output)
+ */
+uint64_t
+mpool_stripe_grp_mpool(
+	struct mpool_stripe_grp    *grp,
+	uint32_t                    idx,
+	struct mpool              **mpp);
+
+/**
+ * mpool_stripe_alloc() - Allocate a striped mblock, one mblock per member
+ * @grp:     stripe group handle
+ * @mclassp: media class
+ * @stp:     striped mblock handle (output)
+ */
+uint64_t
+mpool_stripe_alloc(
+	struct mpool_stripe_grp    *grp,
+	enum mp_media_classp        mclassp,
+	struct mpool_stripe       **stp);
+
+/**
+ * mpool_stripe_find() - Get a handle for an existing striped mblock
+ * @grp:    stripe group handle
+ * @objidv: member mblock IDs, as returned by mpool_stripe_objids()
+ * @objidc: number of member mblock IDs
+ * @stp:    striped mblock handle (output)
+ */
+uint64_t
+mpool_stripe_find(
+	struct mpool_stripe_grp    *grp,
+	const uint64_t             *objidv,
+	uint32_t                    objidc,
+	struct mpool_stripe       **stp);
+
+/**
+ * mpool_stripe_objids() - Get the member mblock IDs of a striped mblock
+ * @st:     striped mblock handle
+ * @objidv: vector of at least stripe width entries (output)
+ * @objidc: number of entries in @objidv
+ *
+ * The application must persist these IDs to find the striped mblock later.
+ */
+uint64_t
+mpool_stripe_objids(
+	struct mpool_stripe    *st,
+	uint64_t               *objidv,
+	uint32_t                objidc);
+
+/**
+ * mpool_stripe_getprops() - Get properties of a striped mblock
+ * @st:    striped mblock handle
+ * @props: properties (output)
+ */
+uint64_t
+mpool_stripe_getprops(
+	struct mpool_stripe            *st,
+	struct mpool_stripe_props      *props);
+
+/**
+ * mpool_stripe_write() - Append data to a striped mblock
+ * @st:      striped mblock handle
+ * @iov:     iovec containing data to be written
+ * @iovc:    iovec count
+ *
+ * The base and length of each iovec must be PAGE_SIZE aligned.  Member
+ * writes are issued concurrently.
+ */
+uint64_t
+mpool_stripe_write(
+	struct mpool_stripe    *st,
+	const struct iovec     *iov,
+	int                     iovc);
+
+/**
+ * mpool_stripe_read() - Read data from a committed striped mblock
+ * @st:      striped mblock handle
+ * @iov:     iovec for output data
+ * @iovc:    iovec count
+ * @offset:  PAGE aligned logical offset
+ *
+ * The base and length of each iovec must be PAGE_SIZE aligned.  Member
+ * reads are issued concurrently.
+ */
+uint64_t
+mpool_stripe_read(
+	struct mpool_stripe    *st,
+	const struct iovec     *iov,
+	int                     iovc,
+	uint64_t                offset);
+
+/**
+ * mpool_stripe_commit() - Commit all members of a striped mblock
+ * @st: striped mblock handle
+ *
+ * If any member fails to commit, all members are deleted or aborted and
+ * the striped mblock must be released with mpool_stripe_abort().
+ *
+ * Members are committed one after the other, so commit is not atomic
+ * across a crash: some members may be committed and others not.  Since
+ * uncommitted mblocks do not survive a crash, mpool_stripe_find() then
+ * fails.  An application that records the member IDs before commit must
+ * delete the members it can still find when it sees such a failure, and
+ * mark the striped mblock committed in its own metadata only after this
+ * call succeeds.
+ */
+uint64_t
+mpool_stripe_commit(
+	struct mpool_stripe    *st);
+
+/**
+ * mpool_stripe_abort() - Abort an uncommitted striped mblock
+ * @st: striped mblock handle, freed on return
+ */
+uint64_t
+mpool_stripe_abort(
+	struct mpool_stripe    *st);
+
+/**
+ * mpool_stripe_delete() - Delete all members of a committed striped mblock
+ * @st: striped mblock handle, freed on return
+ */
+uint64_t
+mpool_stripe_delete(
+	struct mpool_stripe    *st);
+
+/**
+ * mpool_stripe_put() - Release a striped mblock handle
+ * @st: striped mblock handle, freed on return
+ */
+uint64_t
+mpool_stripe_put(
+	struct mpool_stripe    *st);
+
+/************* mblock deduplication **************************************/
+
+/**
+ * struct mpool_dedup_params - dedup layer tunables
+ * @dp_stagesz: writers stage up to this many bytes in memory so that
+ *              duplicate content is never written (0 for default)
+ */
+struct mpool_dedup_params {
+	uint32_t   dp_stagesz;
+	uint32_t   dp_rsvd1;
+};
+
+/**
+ * mpool_dedup_open() - Open a dedup layer
+ * @mp:     mpool handle
+ * @logid1: MDC OID 1
+ * @logid2: MDC OID 2
+ * @params: tunables, or NULL for defaults
+ * @ddp:    dedup handle (output)
+ *
+ * The fingerprint index and reference counts live in the given MDC, which
+ * must have been allocated and committed by the caller.  Mblocks left
+ * behind by a crash in mpool_dedup_commit() are deleted.
+ */
+uint64_t
+mpool_dedup_open(
+	struct mpool                       *mp,
+	uint64_t                            logid1,
+	uint64_t                            logid2,
+	const struct mpool_dedup_params    *params,
+	struct mpool_dedup                **ddp);
+
+/**
+ * mpool_dedup_close() - Close a dedup layer
+ * @dd: dedup handle
+ */
+uint64_t
+mpool_dedup_close(
+	struct mpool_dedup *dd);
+
+/**
+ * mpool_dedup_alloc() - Start writing a deduplicated mblock
+ * @dd:      dedup handle
+ * @mclassp: media class
+ * @wrp:     writer handle (output)
+ */
+uint64_t
+mpool_dedup_alloc(
+	struct mpool_dedup     *dd,
+	enum mp_media_classp    mclassp,
+	struct mpool_dedup_wr **wrp);
+
+/**
+ * mpool_dedup_write() - Append data through a dedup writer
+ * @wr:   writer handle
+ * @iov:  iovec containing data to be written
+ * @iovc: iovec count
+ *
+ * Each iovec length must be a multiple of PAGE_SIZE.
+ */
+uint64_t
+mpool_dedup_write(
+	struct mpool_dedup_wr  *wr,
+	const struct iovec     *iov,
+	int                     iovc);
+
+/**
+ * mpool_dedup_commit() - Commit a deduplicated mblock
+ * @wr:   writer handle, freed on success
+ * @mbid: mblock ID (output)
+ *
+ * If an mblock with identical content already exists, its reference count
+ * is incremented and its ID is returned.  Otherwise a new mblock is
+ * committed.  On failure the writer must be released with
+ * mpool_dedup_abort().
+ */
+uint64_t
+mpool_dedup_commit(
+	struct mpool_dedup_wr  *wr,
+	uint64_t               *mbid);
+
+/**
+ * mpool_dedup_abort() - Discard a dedup writer
+ * @wr: writer handle, freed on return
+ */
+uint64_t
+mpool_dedup_abort(
+	struct mpool_dedup_wr  *wr);
+
+/**
+ * mpool_dedup_addref() - Take an additional reference on a dedup mblock
+ * @dd:   dedup handle
+ * @mbid: mblock ID
+ */
+uint64_t
+mpool_dedup_addref(
+	struct mpool_dedup *dd,
+	uint64_t            mbid);
+
+/**
+ * mpool_dedup_delete() - Drop a reference on a dedup mblock
+ * @dd:   dedup handle
+ * @mbid: mblock ID
+ *
+ * The mblock is deleted when its last reference is dropped.
+ */
+uint64_t
+mpool_dedup_delete(
+	struct mpool_dedup *dd,
+	uint64_t            mbid);
+
+/**
+ * mpool_dedup_refcnt() - Get the reference count of a dedup mblock
+ * @dd:     dedup handle
+ * @mbid:   mblock ID
+ * @refcnt: reference count (output)
+ */
+uint64_t
+mpool_dedup_refcnt(
+	struct mpool_dedup *dd,
+	uint64_t            mbid,
+	uint32_t           *refcnt);
+
+/************* compressed mblocks *****************************************/
+
+/**
+ * struct mpool_cmb_params - compressed mblock writer tunables
+ * @cp_framesz: uncompressed frame size, a multiple of PAGE_SIZE
+ *              (0 for default)
+ * @cp_threads: number of threads compressing frames in parallel,
+ *              including the writer's caller (0 for default).  The
+ *              writer keeps its threads until it is committed or aborted.
+ */
+struct mpool_cmb_params {
+	uint32_t   cp_framesz;
+	uint32_t   cp_threads;
+};
+
+/**
+ * struct mpool_cmb_props - compressed mblock properties
+ * @cmp_rawlen:       uncompressed length
+ * @cmp_storedlen:    bytes used in the mblock, including index and trailer
+ * @cmp_framesz:      uncompressed frame size
+ * @cmp_nframes:      number of frames
+ * @cmp_cache_hits:   reader frame cache hits
+ * @cmp_cache_misses: reader frame cache misses
+ * @cmp_mapped:       frames are decompressed from an mcache map of the
+ *                    mblock rather than read through a bounce buffer
+ */
+struct mpool_cmb_props {
+	uint64_t   cmp_rawlen;
+	uint64_t   cmp_storedlen;
+	uint32_t   cmp_framesz;
+	uint32_t   cmp_nframes;
+	uint64_t   cmp_cache_hits;
+	uint64_t   cmp_cache_misses;
+	uint8_t    cmp_mapped;
+	uint8_t    cmp_rsvd1[7];
+};
+
+/**
+ * mpool_cmb_alloc() - Allocate an mblock and start writing compressed data
+ * @mp:      mpool handle
+ * @mclassp: media class
+ * @params:  tunables, or NULL for defaults
+ * @wrp:     writer handle (output)
+ */
+uint64_t
+mpool_cmb_alloc(
+	struct mpool                   *mp,
+	enum mp_media_classp            mclassp,
+	const struct mpool_cmb_params  *params,
+	struct mpool_cmb_wr           **wrp);
+
+/**
+ * mpool_cmb_write() - Append data to a compressed mblock
+ * @wr:   writer handle
+ * @data: data to write
+ * @len:  length of data, no alignment required
+ */
+uint64_t
+mpool_cmb_write(
+	struct mpool_cmb_wr    *wr,
+	const void             *data,
+	size_t                  len);
+
+/**
+ * mpool_cmb_commit() - Write the frame index and commit the mblock
+ * @wr:   writer handle, freed on success
+ * @mbid: mblock ID (output)
+ *
+ * On failure the writer must be released with mpool_cmb_abort().
+ */
+uint64_t
+mpool_cmb_commit(
+	struct mpool_cmb_wr    *wr,
+	uint64_t               *mbid);
+
+/**
+ * mpool_cmb_abort() - Abort a compressed mblock writer
+ * @wr: writer handle, freed on return
+ */
+uint64_t
+mpool_cmb_abort(
+	struct mpool_cmb_wr    *wr);
+
+/**
+ * mpool_cmb_open() - Open a committed compressed mblock for reading
+ * @mp:           mpool handle
+ * @mbid:         mblock ID
+ * @cache_frames: number of decompressed frames to cache (0 for default)
+ * @cmbp:         reader handle (output)
+ *
+ * The reader maps the mblock with mcache if it can and decompresses
+ * frames from the map, so random reads go through the page cache like
+ * those of uncompressed mblocks.  Otherwise frames are read with
+ * mpool_mblock_read().
+ */
+uint64_t
+mpool_cmb_open(
+	struct mpool       *mp,
+	uint64_t            mbid,
+	uint32_t            cache_frames,
+	struct mpool_cmb  **cmbp);
+
+/**
+ * mpool_cmb_close() - Close a compressed mblock reader
+ * @cmb: reader handle
+ */
+uint64_t
+mpool_cmb_close(
+	struct mpool_cmb   *cmb);
+
+/**
+ * mpool_cmb_read() - Read uncompressed data from a compressed mblock
+ * @cmb:   reader handle
+ * @buf:   buffer to receive data
+ * @len:   number of bytes to read
+ * @off:   uncompressed offset, no alignment required
+ * @rdlen: number of bytes read (output), short at end of data
+ *
+ * Only the frames that the range touches are read and decompressed.
+ */
+uint64_t
+mpool_cmb_read(
+	struct mpool_cmb   *cmb,
+	void               *buf,
+	size_t              len,
+	uint64_t            off,
+	size_t             *rdlen);
+
+/**
+ * mpool_cmb_getprops() - Get properties of a compressed mblock reader
+ * @cmb:   reader handle
+ * @props: properties (output)
+ */
+uint64_t
+mpool_cmb_getprops(
+	struct mpool_cmb           *cmb,
+	struct mpool_cmb_props     *props);
+
+/************* chained logs ***********************************************/
+
+/**
+ * struct mpool_chlog_params - chained log tunables
+ * @chp_captgt:  capacity target of each link mlog in bytes (0 for default)
+ * @chp_mclassp: media class of the link mlogs
+ * @chp_spares:  spare mlog pool to take new links from and to retire
+ *               dropped links to, or NULL
+ */
+struct mpool_chlog_params {
+	uint64_t                   chp_captgt;
+	uint8_t                    chp_mclassp;
+	uint8_t                    chp_rsvd[7];
+	struct mpool_mlspare      *chp_spares;
+};
+
+/**
+ * struct mpool_chlog_props - chained log properties
+ * @clp_headseq: sequence number of the first link
+ * @clp_tailseq: sequence number of the active link
+ * @clp_rdseq:   sequence number of the link the reader is on
+ * @clp_nlinks:  number of links from the head through the active link
+ * @clp_nspares: number of pre-allocated empty links past the active link
+ */
+struct mpool_chlog_props {
+	uint64_t   clp_headseq;
+	uint64_t   clp_tailseq;
+	uint64_t   clp_rdseq;
+	uint32_t   clp_nlinks;
+	uint32_t   clp_nspares;
+};
+
+/**
+ * mpool_chlog_open() - Open or create a chained log
+ * @mp:     mpool handle
+ * @logid1: MDC mlog ID 1, recording the chain
+ * @logid2: MDC mlog ID 2
+ * @params: tunables, or NULL for defaults
+ * @chp:    chained log handle (output)
+ *
+ * The MDC must have been allocated and committed by the caller.  An empty
+ * MDC creates a new chain.
+ */
+uint64_t
+mpool_chlog_open(
+	struct mpool                       *mp,
+	uint64_t                            logid1,
+	uint64_t                            logid2,
+	const struct mpool_chlog_params    *params,
+	struct mpool_chlog                **chp);
+
+/**
+ * mpool_chlog_close() - Flush and close a chained log
+ * @ch: chained log handle
+ */
+uint64_t
+mpool_chlog_close(
+	struct mpool_chlog *ch);
+
+/**
+ * mpool_chlog_append() - Append a record to a chained log
+ * @ch:   chained log handle
+ * @data: record
+ * @len:  record length
+ * @sync: defer return until the record is on media
+ *
+ * Rolls over to the next link when the active one is full.  Fails with
+ * EFBIG only if the record does not fit in an empty link.
+ */
+uint64_t
+mpool_chlog_append(
+	struct mpool_chlog *ch,
+	void               *data,
+	size_t              len,
+	bool                sync);
+
+/**
+ * mpool_chlog_flush() - Flush the active link to media
+ * @ch: chained log handle
+ */
+uint64_t
+mpool_chlog_flush(
+	struct mpool_chlog *ch);
+
+/**
+ * mpool_chlog_read_init() - Position the reader at the head of the chain
+ * @ch: chained log handle
+ */
+uint64_t
+mpool_chlog_read_init(
+	struct mpool_chlog *ch);
+
+/**
+ * mpool_chlog_read_next() - Read the next record, crossing links as needed
+ * @ch:    chained log handle
+ * @data:  buffer to receive the record
+ * @len:   buffer length
+ * @rdlen: record length (output), 0 at the end of the chain
+ *
+ * If merr_errno() of the return value is EOVERFLOW, then the receive buffer
+ * "data" is too small and must be resized according to the value returned
+ * in "rdlen".
+ */
+uint64_t
+mpool_chlog_read_next(
+	struct mpool_chlog *ch,
+	void               *data,
+	size_t              len,
+	size_t             *rdlen);
+
+/**
+ * mpool_chlog_trunc() - Drop links from the head of the chain
+ * @ch:  chained log handle
+ * @seq: drop links with a sequence number below @seq
+ *
+ * Dropped links are retired to the spare pool if the chain has one, and
+ * deleted otherwise.  The active link is never dropped.  A reader on a
+ * dropped link restarts at the new head.
+ */
+uint64_t
+mpool_chlog_trunc(
+	struct mpool_chlog *ch,
+	uint64_t            seq);
+
+/**
+ * mpool_chlog_getprops() - Get properties of a chained log
+ * @ch:    chained log handle
+ * @props: properties (output)
+ */
+uint64_t
+mpool_chlog_getprops(
+	struct mpool_chlog         *ch,
+	struct mpool_chlog_props   *props);
+
+/************* named object catalog ***************************************/
+
+#define MPOOL_CATALOG_NAME_MAX  (255)
+#define MPOOL_CATALOG_META_MAX  (1024)
+
+/**
+ * enum mpool_catalog_op_type - catalog update types
+ * @MPOOL_CATALOG_PUT: map a name to an object ID and metadata
+ * @MPOOL_CATALOG_DEL: remove a name, a no-op if it is not present
+ */
+enum mpool_catalog_op_type {
+	MPOOL_CATALOG_PUT = 1,
+	MPOOL_CATALOG_DEL = 2,
+};
+
+/**
+ * struct mpool_catalog_op - one update of a batch
+ * @cop_name:    NUL terminated name, at most MPOOL_CATALOG_NAME_MAX bytes
+ * @cop_meta:    user metadata (PUT)
+ * @cop_objid:   object ID (PUT)
+ * @cop_metalen: user metadata length, at most MPOOL_CATALOG_META_MAX (PUT)
+ * @cop_type:    enum mpool_catalog_op_type
+ */
+struct mpool_catalog_op {
+	const char *cop_name;
+	const void *cop_meta;
+	uint64_t    cop_objid;
+	uint32_t    cop_metalen;
+	uint8_t     cop_type;
+	uint8_t     cop_rsvd[3];
+};
+
+/**
+ * struct mpool_catalog_props - catalog properties
+ * @cgp_count:  number of names
+ * @cgp_livesz: size of a snapshot of the catalog in bytes
+ * @cgp_usage:  bytes used in the MDC
+ */
+struct mpool_catalog_props {
+	uint64_t   cgp_count;
+	uint64_t   cgp_livesz;
+	uint64_t   cgp_usage;
+};
+
+/**
+ * mpool_catalog_cb_t - catalog iteration callback
+ *
+ * Return non-zero to stop the iteration.  Must not update the catalog.
+ */
+typedef int
+mpool_catalog_cb_t(
+	void               *arg,
+	const char         *name,
+	uint64_t            objid,
+	const void         *meta,
+	size_t              metalen);
+
+/**
+ * mpool_catalog_open() - Open or create a named object catalog
+ * @mp:     mpool handle
+ * @logid1: MDC mlog ID 1, holding the catalog
+ * @logid2: MDC mlog ID 2
+ * @catp:   catalog handle (output)
+ *
+ * The MDC must have been allocated and committed by the caller.  The
+ * in-memory index is rebuilt by replaying the MDC.
+ */
+uint64_t
+mpool_catalog_open(
+	struct mpool           *mp,
+	uint64_t                logid1,
+	uint64_t                logid2,
+	struct mpool_catalog  **catp);
+
+/**
+ * mpool_catalog_close() - Close a catalog
+ * @cat: catalog handle
+ */
+uint64_t
+mpool_catalog_close(
+	struct mpool_catalog   *cat);
+
+/**
+ * mpool_catalog_update() - Apply a batch of updates atomically
+ * @cat: catalog handle
+ * @opv: updates, applied in order
+ * @opc: number of updates
+ *
+ * The batch is persisted as a single MDC record before returning, and is
+ * either replayed in full or not at all.  The MDC is compacted as needed.
+ */
+uint64_t
+mpool_catalog_update(
+	struct mpool_catalog           *cat,
+	const struct mpool_catalog_op  *opv,
+	uint32_t                        opc);
+
+/**
+ * mpool_catalog_put() - Map a name to an object ID and metadata
+ * @cat:     catalog handle
+ * @name:    NUL terminated name
+ * @objid:   object ID
+ * @meta:    user metadata, may be NULL if @metalen is 0
+ * @metalen: user metadata length
+ */
+uint64_t
+mpool_catalog_put(
+	struct mpool_catalog   *cat,
+	const char             *name,
+	uint64_t                objid,
+	const void             *meta,
+	size_t                  metalen);
+
+/**
+ * mpool_catalog_delete() - Remove a name
+ * @cat:  catalog handle
+ * @name: NUL terminated name
+ *
+ * Return: ENOENT if the name is not in the catalog
+ */
+uint64_t
+mpool_catalog_delete(
+	struct mpool_catalog   *cat,
+	const char             *name);
+
+/**
+ * mpool_catalog_get() - Look up a name
+ * @cat:     catalog handle
+ * @name:    NUL terminated name
+ * @objid:   object ID (output), may be NULL
+ * @meta:    buffer to receive the user metadata, may be NULL
+ * @metamax: size of @meta
+ * @metalen: user metadata length (output), may be NULL
+ *
+ * Served from memory.  If merr_errno() of the return value is EOVERFLOW,
+ * then @meta is too small to hold the metadata whose length is returned
+ * in @metalen.
+ */
+uint64_t
+mpool_catalog_get(
+	struct mpool_catalog   *cat,
+	const char             *name,
+	uint64_t               *objid,
+	void                   *meta,
+	size_t                  metamax,
+	size_t                 *metalen);
+
+/**
+ * mpool_catalog_foreach() - Call @cb for every name, in no particular order
+ * @cat: catalog handle
+ * @cb:  callback
+ * @arg: argument passed to @cb
+ */
+uint64_t
+mpool_catalog_foreach(
+	struct mpool_catalog   *cat,
+	mpool_catalog_cb_t     *cb,
+	void                   *arg);
+
+/**
+ * mpool_catalog_getprops() - Get properties of a catalog
+ * @cat:   catalog handle
+ * @props: properties (output)
+ */
+uint64_t
+mpool_catalog_getprops(
+	struct mpool_catalog           *cat,
+	struct mpool_catalog_props     *props);
+
+/************* spare mlog pools *******************************************/
+
+/**
+ * struct mpool_mlspare_params - spare mlog pool tunables
+ * @msp_captgt:  capacity target of each spare mlog in bytes (0 for default)
+ * @msp_target:  number of ready spares to maintain (0 for default)
+ * @msp_mclassp: media class of the spare mlogs
+ */
+struct mpool_mlspare_params {
+	uint64_t   msp_captgt;
+	uint32_t   msp_target;
+	uint8_t    msp_mclassp;
+	uint8_t    msp_rsvd[3];
+};
+
+/**
+ * struct mpool_mlspare_props - spare mlog pool properties
+ * @msp_nready: committed, erased mlogs ready to be handed out
+ * @msp_ndirty: retired mlogs waiting to be erased
+ * @msp_nbad:   mlogs the pool failed to erase, retried at the next open
+ * @msp_nmiss:  requests that found no ready spare and allocated inline
+ */
+struct mpool_mlspare_props {
+	uint32_t   msp_nready;
+	uint32_t   msp_ndirty;
+	uint32_t   msp_nbad;
+	uint32_t   msp_rsvd;
+	uint64_t   msp_nmiss;
+};
+
+/**
+ * mpool_mlspare_open() - Open or create a pool of spare mlogs
+ * @mp:     mpool handle
+ * @logid1: MDC mlog ID 1, recording the pool members
+ * @logid2: MDC mlog ID 2
+ * @params: tunables, or NULL for defaults
+ * @spp:    spare pool handle (output)
+ *
+ * The MDC must have been allocated and committed by the caller.  A
+ * background thread keeps the pool filled and erases retired mlogs, so
+ * that mpool_mlspare_get() normally completes without allocating or
+ * erasing anything.
+ */
+uint64_t
+mpool_mlspare_open(
+	struct mpool                       *mp,
+	uint64_t                            logid1,
+	uint64_t                            logid2,
+	const struct mpool_mlspare_params  *params,
+	struct mpool_mlspare              **spp);
+
+/**
+ * mpool_mlspare_close() - Stop the background thread and close the pool
+ * @sp: spare pool handle
+ *
+ * Pool members persist and are picked up again by the next open.
+ */
+uint64_t
+mpool_mlspare_close(
+	struct mpool_mlspare   *sp);
+
+/**
+ * mpool_mlspare_get() - Take a committed, empty mlog from the pool
+ * @sp:    spare pool handle
+ * @props: properties of the mlog (output)
+ * @mlh:   mlog handle (output), holding one reference
+ *
+ * The mlog is not open.  It belongs to the caller once this returns; a
+ * crash before the caller records its object ID leaks the mlog.  Falls
+ * back to allocating an mlog inline if no spare is ready.
+ */
+uint64_t
+mpool_mlspare_get(
+	struct mpool_mlspare   *sp,
+	struct mlog_props      *props,
+	struct mpool_mlog     **mlh);
+
+/**
+ * mpool_mlspare_retire() - Hand an mlog back to the pool for reuse
+ * @sp:  spare pool handle
+ * @mlh: mlog handle, must be closed
+ *
+ * The pool takes over the caller's reference and erases the mlog in the
+ * background.  Callers must record that they no longer use the mlog
+ * before retiring it.
+ */
+uint64_t
+mpool_mlspare_retire(
+	struct mpool_mlspare   *sp,
+	struct mpool_mlog      *mlh);
+
+/**
+ * mpool_mlspare_reclaim() - Retire an mlog again after a crash
+ * @sp:  spare pool handle
+ * @mlh: mlog handle, must be closed
+ * @gen: generation of the mlog while the caller used it
+ *
+ * For callers replaying a retire that a crash may have interrupted.  Fails
+ * with EEXIST if the mlog is still a pool member, and with ESTALE if it was
+ * erased since @gen and may have been handed out again.  The caller keeps
+ * its reference on failure, as with mpool_mlspare_retire().
+ */
+uint64_t
+mpool_mlspare_reclaim(
+	struct mpool_mlspare   *sp,
+	struct mpool_mlog      *mlh,
+	uint64_t                gen);
+
+/**
+ * mpool_mlspare_getprops() - Get properties of a spare mlog pool
+ * @sp:    spare pool handle
+ * @props: properties (output)
+ */
+uint64_t
+mpool_mlspare_getprops(
+	struct mpool_mlspare           *sp,
+	struct mpool_mlspare_props     *props);
+
+/************* export/import **********************************************/
+
+/**
+ * struct mpool_xport_params - export/import tunables
+ * @xp_threads:  parallel object readers (export) or writers (import)
+ * @xp_chunksz:  archive chunk and I/O size in bytes, a multiple of the page
+ *               size
+ * @xp_batch:    imported objects recorded per catalog update
+ * @xp_compress: compress object data in the archive (export)
+ *
+ * Zero selects the default for any field.
+ */
+struct mpool_xport_params {
+	uint32_t   xp_threads;
+	uint32_t   xp_chunksz;
+	uint32_t   xp_batch;
+	uint8_t    xp_compress;
+	uint8_t    xp_rsvd[3];
+};
+
+/**
+ * struct mpool_xport_stats - export/import statistics
+ * @xs_mblocks:  mblocks transferred
+ * @xs_mlogs:    mlogs transferred
+ * @xs_rawbytes: object data bytes transferred
+ * @xs_arbytes:  archive bytes written or read
+ */
+struct mpool_xport_stats {
+	uint64_t   xs_mblocks;
+	uint64_t   xs_mlogs;
+	uint64_t   xs_rawbytes;
+	uint64_t   xs_arbytes;
+};
+
+/**
+ * mpool_xport_map_cb_t - import callback, one call per imported object
+ * @arg:   argument passed to mpool_import()
+ * @name:  catalog name of the object
+ * @oldid: object ID in the exported mpool
+ * @newid: object ID in the importing mpool
+ */
+typedef void
+mpool_xport_map_cb_t(
+	void               *arg,
+	const char         *name,
+	uint64_t            oldid,
+	uint64_t            newid);
+
+/**
+ * mpool_export() - Write the objects named in a catalog to an archive
+ * @mp:     mpool handle
+ * @cat:    catalog naming the objects to export
+ * @fd:     file descriptor to write the archive to, need not be seekable
+ * @params: tunables, or NULL for defaults
+ * @stats:  statistics (output), may be NULL
+ *
+ * Every committed mblock and mlog named in @cat is exported along with its
+ * name and metadata.  The mlogs of an MDC are exported with their
+ * compaction markers.  Objects must not be modified during the export.
+ */
+uint64_t
+mpool_export(
+	struct mpool                       *mp,
+	struct mpool_catalog               *cat,
+	int                                 fd,
+	const struct mpool_xport_params    *params,
+	struct mpool_xport_stats           *stats);
+
+/**
+ * mpool_import() - Recreate the objects of an archive
+ * @mp:     mpool handle
+ * @cat:    catalog to record the imported objects in
+ * @fd:     file descriptor to read the archive from, need not be seekable
+ * @params: tunables, or NULL for defaults
+ * @cb:     called with the old and new object ID of each object, may be
+ *          NULL; calls are never concurrent
+ * @arg:    argument passed to @cb
+ * @stats:  statistics (output), may be NULL
+ *
+ * Objects get new object IDs and are recorded in @cat under their exported
+ * names.  Object IDs stored inside object data are not rewritten; @cb
+ * provides the mapping to do so.  On failure, objects already recorded in
+ * @cat are complete and the rest are removed.
+ */
+uint64_t
+mpool_import(
+	struct mpool                       *mp,
+	struct mpool_catalog               *cat,
+	int                                 fd,
+	const struct mpool_xport_params    *params,
+	mpool_xport_map_cb_t               *cb,
+	void                               *arg,
+	struct mpool_xport_stats           *stats);
+
+/************* sorted tables *********************************************/
+
+/**
+ * struct mpool_sst_params - sorted table builder tunables
+ * @sp_blksz:      target data block size, a multiple of PAGE_SIZE
+ *                 (0 for default)
+ * @sp_restart:    records per restart group (0 for default)
+ * @sp_bloom_bits: bloom filter bits per key, up to 32 (0 for no filter)
+ * @sp_mclassp:    media class of the table's mblocks
+ */
+struct mpool_sst_params {
+	uint32_t   sp_blksz;
+	uint16_t   sp_restart;
+	uint8_t    sp_bloom_bits;
+	uint8_t    sp_mclassp;
+};
+
+/**
+ * struct mpool_sst_props - sorted table properties
+ * @ssp_nrecs:           number of records
+ * @ssp_nblocks:         number of data blocks
+ * @ssp_nmblocks:        number of mblocks
+ * @ssp_idxlen:          fence index length in bytes
+ * @ssp_bloomlen:        bloom filter length in bytes
+ * @ssp_gets:            lookups through this reader
+ * @ssp_bloom_negatives: lookups answered by the bloom filter alone
+ */
+struct mpool_sst_props {
+	uint64_t   ssp_nrecs;
+	uint32_t   ssp_nblocks;
+	uint32_t   ssp_nmblocks;
+	uint32_t   ssp_idxlen;
+	uint32_t   ssp_bloomlen;
+	uint64_t   ssp_gets;
+	uint64_t   ssp_bloom_negatives;
+};
+
+/**
+ * mpool_sst_create() - Start building a sorted table
+ * @mp:     mpool handle
+ * @params: tunables, or NULL for defaults
+ * @wrp:    builder handle (output)
+ */
+uint64_t
+mpool_sst_create(
+	struct mpool                   *mp,
+	const struct mpool_sst_params  *params,
+	struct mpool_sst_wr           **wrp);
+
+/**
+ * mpool_sst_add() - Add a record to a sorted table
+ * @wr:   builder handle
+ * @key:  key, 1 to 1024 bytes
+ * @klen: key length
+ * @val:  value
+ * @vlen: value length, up to 1 MiB
+ *
+ * Keys must be added in strictly increasing memcmp() order.
+ */
+uint64_t
+mpool_sst_add(
+	struct mpool_sst_wr    *wr,
+	const void             *key,
+	size_t                  klen,
+	const void             *val,
+	size_t                  vlen);
+
+/**
+ * mpool_sst_commit() - Write the index and commit the table's mblocks
+ * @wr:     builder handle, freed on success
+ * @mbidvp: mblock IDs of the table (output), to be released with free()
+ * @mbidcp: number of mblock IDs (output)
+ *
+ * The table is opened by passing the mblock IDs, in order, to
+ * mpool_sst_open().  On failure the builder must be released with
+ * mpool_sst_abort().
+ */
+uint64_t
+mpool_sst_commit(
+	struct mpool_sst_wr    *wr,
+	uint64_t              **mbidvp,
+	uint32_t               *mbidcp);
+
+/**
+ * mpool_sst_abort() - Abort a sorted table builder and delete its mblocks
+ * @wr: builder handle, freed on return
+ */
+uint64_t
+mpool_sst_abort(
+	struct mpool_sst_wr    *wr);
+
+/**
+ * mpool_sst_open() - Map a sorted table for lookups
+ * @mp:     mpool handle
+ * @mbidc:  number of mblock IDs
+ * @mbidv:  mblock IDs returned by mpool_sst_commit()
+ * @advice: mcache advice for the table's map
+ * @sstp:   reader handle (output)
+ *
+ * A reader may be shared by any number of threads.
+ */
+uint64_t
+mpool_sst_open(
+	struct mpool           *mp,
+	uint32_t                mbidc,
+	uint64_t               *mbidv,
+	enum mpc_vma_advice     advice,
+	struct mpool_sst      **sstp);
+
+/**
+ * mpool_sst_close() - Unmap a sorted table
+ * @sst: reader handle
+ *
+ * Values returned by the reader and its iterators become invalid.
+ */
+uint64_t
+mpool_sst_close(
+	struct mpool_sst   *sst);
+
+/**
+ * mpool_sst_get() - Look up a key in a sorted table
+ * @sst:   reader handle
+ * @key:   key
+ * @klen:  key length
+ * @valp:  value (output), pointing into the table's mcache map
+ * @vlenp: value length (output)
+ *
+ * Return: ENOENT if the key is not in the table
+ */
+uint64_t
+mpool_sst_get(
+	struct mpool_sst   *sst,
+	const void         *key,
+	size_t              klen,
+	const void        **valp,
+	size_t             *vlenp);
+
+/**
+ * mpool_sst_iter_create() - Create an iterator over a sorted table
+ * @sst:     reader handle
+ * @seek:    first key of interest, or NULL to start at the first record
+ * @seeklen: length of @seek
+ * @itp:     iterator handle (output)
+ *
+ * The iterator starts at the first record whose key is >= @seek.
+ */
+uint64_t
+mpool_sst_iter_create(
+	struct mpool_sst           *sst,
+	const void                 *seek,
+	size_t                      seeklen,
+	struct mpool_sst_iter     **itp);
+
+/**
+ * mpool_sst_iter_next() - Return the next record of an iterator
+ * @it:    iterator handle
+ * @keyp:  key (output), valid until the next call on @it
+ * @klenp: key length (output)
+ * @valp:  value (output), pointing into the table's mcache map
+ * @vlenp: value length (output)
+ * @eofp:  set if there are no more records
+ */
+uint64_t
+mpool_sst_iter_next(
+	struct mpool_sst_iter  *it,
+	const void            **keyp,
+	size_t                 *klenp,
+	const void            **valp,
+	size_t                 *vlenp,
+	bool                   *eofp);
+
+/**
+ * mpool_sst_iter_destroy() - Destroy a sorted table iterator
+ * @it: iterator handle
+ */
+uint64_t
+mpool_sst_iter_destroy(
+	struct mpool_sst_iter  *it);
+
+/**
+ * mpool_sst_getprops() - Get properties of a sorted table reader
+ * @sst:   reader handle
+ * @props: properties (output)
+ */
+uint64_t
+mpool_sst_getprops(
+	struct mpool_sst           *sst,
+	struct mpool_sst_props     *props);
+
+/************* I/O buffer pools ******************************************/
+
+#define MPOOL_IOBUF_HUGE        (0x1)   /* back buffers with huge pages */
+#define MPOOL_IOBUF_MLOCK       (0x2)   /* lock buffers in memory */
+
+/**
+ * struct mpool_iobuf_params - I/O buffer pool tunables
+ * @ibp_maxsz:    largest pooled buffer, a power of two from PAGE_SIZE
+ *                to 64MiB (0 for 1MiB); larger requests are mapped on demand
+ * @ibp_flags:    MPOOL_IOBUF_* flags
+ * @ibp_cache:    per-CPU cached buffers per size class, up to 64
+ *                (0 for default)
+ * @ibp_rsvd:     reserved, must be zero
+ * @ibp_prealloc: bytes of buffers to populate each size class with at
+ *                creation
+ */
+struct mpool_iobuf_params {
+	uint32_t   ibp_maxsz;
+	uint32_t   ibp_flags;
+	uint32_t   ibp_cache;
+	uint32_t   ibp_rsvd;
+	uint64_t   ibp_prealloc;
+};
+
+/**
+ * struct mpool_iobuf_stats - I/O buffer pool statistics
+ * @ibs_allocs:      buffer allocations
+ * @ibs_cache_hits:  allocations served from a per-CPU cache
+ * @ibs_oversize:    allocations larger than the largest size class
+ * @ibs_mapped:      bytes mapped for pooled buffers
+ * @ibs_huge:        bytes of @ibs_mapped backed by hugetlbfs pages
+ * @ibs_locked:      bytes of @ibs_mapped locked in memory
+ * @ibs_mlock_fails: mappings that could not be locked
+ * @ibs_free:        bytes on the size class free lists
+ */
+struct mpool_iobuf_stats {
+	uint64_t   ibs_allocs;
+	uint64_t   ibs_cache_hits;
+	uint64_t   ibs_oversize;
+	uint64_t   ibs_mapped;
+	uint64_t   ibs_huge;
+	uint64_t   ibs_locked;
+	uint64_t   ibs_mlock_fails;
+	uint64_t   ibs_free;
+};
+
+/**
+ * mpool_iobuf_pool_create() - Create an I/O buffer pool
+ * @mp:     mpool whose internal bounce buffers the pool also serves, or NULL
+ * @params: tunables, or NULL for defaults
+ * @poolp:  pool handle (output)
+ *
+ * An mpool can have at most one pool attached, which must be destroyed
+ * before the mpool is closed.
+ */
+uint64_t
+mpool_iobuf_pool_create(
+	struct mpool                       *mp,
+	const struct mpool_iobuf_params    *params,
+	struct mpool_iobuf_pool           **poolp);
+
+/**
+ * mpool_iobuf_pool_destroy() - Destroy an I/O buffer pool
+ * @pool: pool handle
+ *
+ * All buffers must have been freed.  Waits for the bounce buffers the
+ * library took from @pool for its mpool's I/O to be returned.
+ */
+uint64_t
+mpool_iobuf_pool_destroy(
+	struct mpool_iobuf_pool    *pool);
+
+/**
+ * mpool_iobuf_alloc() - Allocate a page aligned I/O buffer
+ * @pool: pool handle
+ * @len:  buffer length
+ * @bufp: buffer (output)
+ *
+ * The buffer contents are undefined.
+ */
+uint64_t
+mpool_iobuf_alloc(
+	struct mpool_iobuf_pool    *pool,
+	size_t                      len,
+	void                      **bufp);
+
+/**
+ * mpool_iobuf_free() - Return an I/O buffer to its pool
+ * @pool: pool handle
+ * @buf:  buffer from mpool_iobuf_alloc()
+ * @len:  length passed to mpool_iobuf_alloc()
+ */
+void
+mpool_iobuf_free(
+	struct mpool_iobuf_pool    *pool,
+	void                       *buf,
+	size_t                      len);
+
+/**
+ * mpool_iobuf_pool_stats() - Get I/O buffer pool statistics
+ * @pool:  pool handle
+ * @stats: statistics (output)
+ */
+uint64_t
+mpool_iobuf_pool_stats(
+	struct mpool_iobuf_pool        *pool,
+	struct mpool_iobuf_stats       *stats);
+
+/************* mblock streams ********************************************/
+
+/**
+ * struct mpool_mbstream_params - mblock stream tunables
+ * @msp_segsz:   segment size cap in bytes (0 for the mblock capacity)
+ * @msp_wbufsz:  write buffer size, a multiple of PAGE_SIZE up to 32MiB
+ *               (0 for 1MiB); data reaches media in writes of this size
+ * @msp_mclassp: media class of the segment mblocks
+ */
+struct mpool_mbstream_params {
+	uint64_t   msp_segsz;
+	uint32_t   msp_wbufsz;
+	uint8_t    msp_mclassp;
+	uint8_t    msp_rsvd[3];
+};
+
+/**
+ * struct mpool_mbstream_props - mblock stream properties
+ * @mbp_headseq: sequence number of the first sealed segment
+ * @mbp_tailseq: sequence number of the active segment
+ * @mbp_rdseq:   sequence number of the segment the reader is on
+ * @mbp_nsegs:   number of sealed segments
+ * @mbp_segcap:  usable segment capacity, 0 if no segment was allocated yet
+ * @mbp_pending: bytes appended to the active segment, which is not sealed
+ */
+struct mpool_mbstream_props {
+	uint64_t   mbp_headseq;
+	uint64_t   mbp_tailseq;
+	uint64_t   mbp_rdseq;
+	uint64_t   mbp_nsegs;
+	uint64_t   mbp_segcap;
+	uint64_t   mbp_pending;
+};
+
+/**
+ * mpool_mbstream_open() - Open or create an mblock stream
+ * @mp:     mpool handle
+ * @logid1: MDC mlog ID 1, recording the segments
+ * @logid2: MDC mlog ID 2
+ * @params: tunables, or NULL for defaults
+ * @msp:    mblock stream handle (output)
+ *
+ * An mblock stream carries bulk log data in large aligned writes to a
+ * sequence of mblocks ("segments").  The MDC must have been allocated and
+ * committed by the caller.  An empty MDC creates a new stream.
+ */
+uint64_t
+mpool_mbstream_open(
+	struct mpool                           *mp,
+	uint64_t                                logid1,
+	uint64_t                                logid2,
+	const struct mpool_mbstream_params     *params,
+	struct mpool_mbstream                 **msp);
+
+/**
+ * mpool_mbstream_close() - Seal the active segment and close the stream
+ * @ms: mblock stream handle
+ */
+uint64_t
+mpool_mbstream_close(
+	struct mpool_mbstream  *ms);
+
+/**
+ * mpool_mbstream_append() - Append a record to an mblock stream
+ * @ms:   mblock stream handle
+ * @data: record
+ * @len:  record length
+ * @sync: make the records appended so far durable before returning
+ *
+ * Records are buffered and become durable, and visible to readers, once
+ * synced or once their segment is sealed because it is full.  A sync
+ * journals the new records in the MDC and keeps the segment open, unless
+ * the segment has about 1MiB of journaled records already, in which case
+ * it is sealed.  Fails with EFBIG if the record does not fit in an empty
+ * segment.  If a write fails, the records appended since the last sync
+ * are discarded.
+ */
+uint64_t
+mpool_mbstream_append(
+	struct mpool_mbstream  *ms,
+	const void             *data,
+	size_t                  len,
+	bool                    sync);
+
+/**
+ * mpool_mbstream_sync() - Make the records appended so far durable
+ * @ms: mblock stream handle
+ *
+ * Synced records survive a crash; they are rewritten to a new segment by
+ * the next open of the stream.
+ */
+uint64_t
+mpool_mbstream_sync(
+	struct mpool_mbstream  *ms);
+
+/**
+ * mpool_mbstream_read_init() - Position the reader at the head of the stream
+ * @ms: mblock stream handle
+ */
+uint64_t
+mpool_mbstream_read_init(
+	struct mpool_mbstream  *ms);
+
+/**
+ * mpool_mbstream_read_next() - Get the next durable record of the stream
+ * @ms:    mblock stream handle
+ * @datap: record (output), valid until the next call on @ms
+ * @lenp:  record length (output)
+ *
+ * Records are returned in place from an mcache map of the segment where
+ * possible.  At the end of the stream @datap is set to NULL.  A record
+ * that fails its frame check is reported with EBADMSG.
+ */
+uint64_t
+mpool_mbstream_read_next(
+	struct mpool_mbstream  *ms,
+	const void            **datap,
+	size_t                 *lenp);
+
+/**
+ * mpool_mbstream_trunc() - Delete segments from the head of the stream
+ * @ms:  mblock stream handle
+ * @seq: delete sealed segments with a sequence number below @seq
+ *
+ * A reader on a deleted segment restarts at the new head.
+ */
+uint64_t
+mpool_mbstream_trunc(
+	struct mpool_mbstream  *ms,
+	uint64_t                seq);
+
+/**
+ * mpool_mbstream_getprops() - Get properties of an mblock stream
+ * @ms:    mblock stream handle
+ * @props: properties (output)
+ */
+uint64_t
+mpool_mbstream_getprops(
+	struct mpool_mbstream          *ms,
+	struct mpool_mbstream_props    *props);
+
 #if defined(HSE_UNIT_TEST_MODE) && HSE_UNIT_TEST_MODE == 1
 #include "mpool_ut.h"
 #endif /* HSE_UNIT_TEST_MODE */
@@ -88,11 +88,15 @@ typedef uuid_t uuid_le;
  *	mpool activate to write back the mpool metadata to the latest version
  *	used by the binary activating the mpool.
  * @MP_FLAGS_RESIZE: Resize mpool
+ * @MP_FLAGS_DEVTUNE: apply the block queue tuning profiles of the devices'
+ *	classes at activation.  Handled in user space, never passed to the
+ *	kernel.
  */
 enum mp_mgmt_flags {
 	MP_FLAGS_FORCE,
 	MP_FLAGS_PERMIT_META_CONV,
 	MP_FLAGS_RESIZE,
+	MP_FLAGS_DEVTUNE,
 };
 
 /**
@@ -426,10 +430,13 @@ struct mblock_props_ex {
  * @MLOG_OF_COMPACT_SEM: Enforce compaction semantics
  * @MLOG_OF_SKIP_SER:    Appends and reads are guaranteed to be serialized
  *                       outside of the mlog API
+ * @MLOG_OF_RDONLY:      No appends or erase; the open may trust log state
+ *                       validated by another process on this host
  */
 enum mlog_open_flags {
 	MLOG_OF_COMPACT_SEM = 0x1,
 	MLOG_OF_SKIP_SER    = 0x2,
+	MLOG_OF_RDONLY      = 0x4,
 };
 
 /*
@@ -108,6 +108,9 @@ flags_set_common(
 	if (co.co_resize)
 		*flags |= (1u << MP_FLAGS_RESIZE);
 
+	if (co.co_tune)
+		*flags |= (1u << MP_FLAGS_DEVTUNE);
+
 	*flags |= (1u << MP_FLAGS_PERMIT_META_CONV);
 }
 
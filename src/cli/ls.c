@@ -456,6 +456,88 @@ mpool_ls_list_tab(
 		statstr);
 }
 
+/**
+ * mpool_ls_list_pairs() - Emit one line of name="value" pairs per mpool
+ *
+ * Space is always reported in bytes.  Meant for monitoring agents that
+ * poll frequently and parse the output.
+ */
+static void
+mpool_ls_list_pairs(
+	struct mpioc_prop  *props,
+	char               *obuf,
+	size_t              obufsz,
+	size_t             *obufoff)
+{
+	const struct mpool_xprops  *xprops;
+	const struct mpool_params  *params;
+	const struct mp_usage      *usage;
+
+	char    uuidstr[MPOOL_UUID_SIZE * 3];
+	char    statstr[32];
+	u32     status;
+
+	xprops = &props->pr_xprops;
+	params = &xprops->ppx_params;
+	usage = &props->pr_usage;
+
+	uuid_unparse(params->mp_poolid, uuidstr);
+
+	snprintf_append(obuf, obufsz, obufoff,
+			"name=\"%s\" uuid=\"%s\" active=\"%d\"",
+			params->mp_name, uuidstr, params->mp_stat != MP_UNDEF);
+
+	if (params->mp_stat == MP_UNDEF) {
+		snprintf_append(obuf, obufsz, obufoff, "\n");
+		return;
+	}
+
+	status = params->mp_stat;
+	show_status(statstr, sizeof(statstr), &status, 0);
+
+	snprintf_append(obuf, obufsz, obufoff,
+			" total=\"%lu\" usable=\"%lu\" used=\"%lu\""
+			" avail=\"%lu\" label=\"%s\" health=\"%s\"\n",
+			(ulong)usage->mpu_total, (ulong)usage->mpu_usable,
+			(ulong)usage->mpu_used, (ulong)usage->mpu_fusable,
+			params->mp_label, statstr);
+}
+
+/**
+ * mpool_ls_need_scan() - Check whether inactive mpools must be discovered
+ *
+ * Discovery probes every block device in the system, so skip it if the
+ * caller asked only for active mpools or named mpools that are all active.
+ */
+static bool
+mpool_ls_need_scan(
+	int                 argc,
+	char              **argv,
+	bool                active,
+	struct mpioc_prop  *propv,
+	int                 propc)
+{
+	int i, j;
+
+	if (active)
+		return false;
+
+	if (argc < 1)
+		return true;
+
+	for (i = 0; i < argc; ++i) {
+		for (j = 0; j < propc; ++j)
+			if (!strcmp(argv[i],
+				    propv[j].pr_xprops.ppx_params.mp_name))
+				break;
+
+		if (j >= propc)
+			return true;
+	}
+
+	return false;
+}
+
 uint64_t
 mpool_ls_list(
 	int                     argc,
@@ -465,6 +547,8 @@ mpool_ls_list(
 	bool                    headers,
 	bool                    parsable,
 	bool                    yaml,
+	bool                    pairs,
+	bool                    active,
 	char                   *obuf,
 	size_t                  obufsz,
 	struct mpool_devrpt    *ei)
@@ -476,6 +560,7 @@ mpool_ls_list(
 	int     noffline, nappended, nmatched;
 	bool    argmatchv[argc];
 	size_t  obufoff = 0;
+	int     propmax = 1024;
 	int     entryc;
 	int     labwidth = 6;
 	int     mpwidth = 6;
@@ -496,17 +581,13 @@ mpool_ls_list(
 	entryv = NULL;
 	entryc = 0;
 
-	err = imp_entries_get(NULL, NULL, NULL, NULL, &entryv, &entryc);
-	if (err)
-		return err;
-
-	propv = calloc(entryc + 1024, sizeof(*propv));
+	propv = calloc(propmax, sizeof(*propv));
 	if (!propv)
 		return merr(ENOMEM);
 
 	memset(&ls, 0, sizeof(ls));
 	ls.ls_listv = propv;
-	ls.ls_listc = entryc + 1024;
+	ls.ls_listc = propmax;
 	ls.ls_cmd = MPIOC_LIST_CMD_PROP_LIST;
 	ls.ls_cmn.mc_msg = ei ? ei->mdr_msg : NULL;
 
@@ -529,6 +610,30 @@ mpool_ls_list(
 
 	close(fd);
 
+	/* Active mpools are fully described by the control device.  Only
+	 * inactive ones need the (expensive) device discovery.
+	 */
+	if (mpool_ls_need_scan(argc, argv, active, propv, ls.ls_listc)) {
+		err = imp_entries_get(NULL, NULL, NULL, NULL, &entryv, &entryc);
+		if (err) {
+			free(propv);
+			return err;
+		}
+
+		if (entryc >= propmax) {
+			props = realloc(propv, (entryc + 1024) * sizeof(*propv));
+			if (!props) {
+				free(propv);
+				free(entryv);
+				return merr(ENOMEM);
+			}
+
+			propv = props;
+			memset(propv + propmax, 0,
+			       (entryc + 1024 - propmax) * sizeof(*propv));
+		}
+	}
+
 	for (i = 0; i < argc; ++i)
 		argmatchv[i] = false;
 
@@ -630,6 +735,8 @@ mpool_ls_list(
 
 		if (yaml)
 			mpool_ls_list_yaml(props, verbosity, &yc);
+		else if (pairs)
+			mpool_ls_list_pairs(props, obuf, obufsz, &obufoff);
 		else
 			mpool_ls_list_tab(props, verbosity,
 					  &headers, parsable,
@@ -667,7 +774,8 @@ mpool_list_help(
 
 		.example =
 		"%*s %s\n"
-		"%*s %s -Y mp1 mp2 mp3\n",
+		"%*s %s -Y mp1 mp2 mp3\n"
+		"%*s %s -AP\n",
 	};
 
 	mpool_generic_verb_help(v, &h, terse, NULL, 0);
@@ -699,6 +807,7 @@ mpool_list_func(
 	err = mpool_ls_list(argc, argv, flags,
 			    co.co_verbose, !co.co_noheadings,
 			    co.co_nosuffix, co.co_yaml,
+			    co.co_pairs, co.co_active,
 			    buf, MPOOL_LIST_BUFSZ, &ei);
 
 	if (err)
@@ -20,6 +20,8 @@ mpool_ls_list(
 	bool                    headers,
 	bool                    parsable,
 	bool                    yaml,
+	bool                    pairs,
+	bool                    active,
 	char                   *obuf,
 	size_t                  obufsz,
 	struct mpool_devrpt    *ei);
@@ -21,6 +21,8 @@
 
 const struct xoption
 xoptionv[] = {
+	{ 'A', "active",     NULL, "Only active mpools, skip device scan",
+	  &co.co_active, },
 	{ 'a', "activate",    "d", "Activate all mpools",
 	  &co.co_activate, },
 	{ 'D', "discard",    NULL, "Issue TRIM/DISCARD",
@@ -39,12 +41,16 @@ xoptionv[] = {
 	  &co.co_noresolve, },
 	{ 'n', "dry-run",    NULL, "dry run",
 	  &co.co_dry_run, },
+	{ 'P', "pairs",       "Y", "Output in name=\"value\" pairs",
+	  &co.co_pairs, },
 	{ 'p', "nosuffix",   NULL, "Print numbers in machine readable format",
 	  &co.co_nosuffix, },
 	{ 'r', "resize",     NULL, "Resize mpool",
 	  &co.co_resize, },
 	{ 'T', "mutest",     NULL, "Enable mutest mode",
 	  &co.co_mutest, .opthidden = true, },
+	{ 't', "tune",       NULL, "Apply block queue tuning profiles",
+	  &co.co_tune, },
 	{ 'v', "verbose",    NULL, "Increase verbosity",
 	  &co.co_verbose, },
 	{ 'Y', "yaml",       NULL, "Output in yaml",
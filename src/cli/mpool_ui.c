@@ -7,6 +7,7 @@
 
 #include <util/platform.h>
 #include <util/string.h>
+#include <util/minmax.h>
 
 #include <mpool/mpool.h>
 
@@ -28,7 +29,9 @@
 
 #include <sysexits.h>
 #include <assert.h>
+#include <fcntl.h>
 #include <pwd.h>
+#include <sys/stat.h>
 
 static const char *fmt_insufficient =
 	"%s: insufficient arguments for mandatory parameters, use -h for help\n";
@@ -648,6 +651,7 @@ mpool_scan_func(
 		err = mpool_ls_list(argc, argv, flags,
 				    co.co_verbose, !co.co_noheadings,
 				    co.co_nosuffix, co.co_yaml,
+				    false, false,
 				    buf, MPOOL_LIST_BUFSZ, &ei);
 
 		if (err)
@@ -707,7 +711,10 @@ mpool_scan_func(
 			continue;
 
 		if (co.co_activate)
-			err = mpool_activate(allv[i].mp_name, NULL, 0, NULL);
+			err = mpool_activate(allv[i].mp_name, NULL,
+					     co.co_tune ?
+					     (1u << MP_FLAGS_DEVTUNE) : 0,
+					     NULL);
 		else
 			err = mpool_deactivate(allv[i].mp_name, 0, NULL);
 
@@ -761,7 +768,8 @@ mpool_activate_help(
 
 		.example =
 		"%*s %s mp1\n"
-		"%*s %s c02c1dd6-f4a2-4d41-a4ef-3459cad90dbe\n",
+		"%*s %s c02c1dd6-f4a2-4d41-a4ef-3459cad90dbe\n"
+		"%*s %s -t mp1\n",
 	};
 
 	mpool_params_defaults(&act_params);
@@ -1212,6 +1220,429 @@ mpool_rename_func(
 	return err;
 }
 
+/**
+ * mpool export/import
+ */
+struct xport_opts {
+	u64     catlog1;
+	u64     catlog2;
+	u32     threads;
+	u32     chunksz;
+	u32     batch;
+	bool    compress;
+};
+
+static struct xport_opts xport_opts;
+
+static struct param_inst
+export_paramsv[] = {
+	PARAM_INST_U64(xport_opts.catlog1, "catlog1",
+		       "Catalog MDC mlog ID 1 (required)"),
+	PARAM_INST_U64(xport_opts.catlog2, "catlog2",
+		       "Catalog MDC mlog ID 2 (required)"),
+	PARAM_INST_U32(xport_opts.threads, "threads",
+		       "Number of object readers"),
+	PARAM_INST_U32_SIZE(xport_opts.chunksz, "chunksz",
+			    "Archive chunk size, a multiple of the page size"),
+	PARAM_INST_BOOL(xport_opts.compress, "compress",
+			"Compress the archive chunks"),
+	PARAM_INST_END
+};
+
+static struct param_inst
+import_paramsv[] = {
+	PARAM_INST_U64(xport_opts.catlog1, "catlog1",
+		       "Catalog MDC mlog ID 1 (required)"),
+	PARAM_INST_U64(xport_opts.catlog2, "catlog2",
+		       "Catalog MDC mlog ID 2 (required)"),
+	PARAM_INST_U32(xport_opts.threads, "threads",
+		       "Number of object writers"),
+	PARAM_INST_U32(xport_opts.batch, "batch",
+		       "Catalog updates per batch"),
+	PARAM_INST_END
+};
+
+static void
+mpool_xport_map_cb(
+	void           *arg,
+	const char     *name,
+	uint64_t        oldid,
+	uint64_t        newid)
+{
+	fprintf(co.co_fp, "%s 0x%lx -> 0x%lx\n",
+		name, (ulong)oldid, (ulong)newid);
+}
+
+/**
+ * mpool_xport_common() - Run an export or import between an mpool and a file
+ * @argc:    argument count, after the verb
+ * @argv:    arguments, after the verb
+ * @paramsv: verb parameters
+ * @export:  export if true, import otherwise
+ */
+static merr_t
+mpool_xport_common(
+	int                 argc,
+	char              **argv,
+	struct param_inst  *paramsv,
+	bool                export)
+{
+	struct mpool_xport_params   params = { };
+	struct mpool_xport_stats    stats = { };
+	struct mpool_devrpt         ei = { };
+	struct mpool_catalog       *cat;
+	struct mpool               *ds;
+	const char                 *mpname, *path, *verb;
+
+	char    errbuf[NFUI_ERRBUFSZ];
+	int     argind = 0;
+	merr_t  err;
+	int     fd;
+
+	memset(&xport_opts, 0, sizeof(xport_opts));
+
+	err = process_params(argc, argv, paramsv, &argind, 0);
+	if (err) {
+		mpool_strinfo(err, errbuf, sizeof(errbuf));
+		fprintf(co.co_fp, "%s: unable to convert `%s': %s\n",
+			progname, argv[argind], errbuf);
+		return err;
+	}
+
+	argc -= argind;
+	argv += argind;
+
+	if (argc < 2) {
+		fprintf(co.co_fp, fmt_insufficient, progname);
+		return merr(EINVAL);
+	} else if (argc > 2) {
+		fprintf(co.co_fp, fmt_extraneous, progname, argv[2]);
+		return merr(EINVAL);
+	}
+
+	mpname = argv[0];
+	path = argv[1];
+	verb = export ? "export mpool" : "import into mpool";
+
+	if (!xport_opts.catlog1 || !xport_opts.catlog2) {
+		fprintf(co.co_fp, "%s: catlog1 and catlog2 are required\n",
+			progname);
+		return merr(EINVAL);
+	}
+
+	if (co.co_dry_run)
+		return 0;
+
+	if (!strcmp(path, "-"))
+		fd = export ? STDOUT_FILENO : STDIN_FILENO;
+	else if (export)
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	else
+		fd = open(path, O_RDONLY);
+
+	if (fd == -1) {
+		err = merr(errno);
+		fprintf(co.co_fp, "%s: unable to open %s: %s\n",
+			progname, path, strerror(errno));
+		return err;
+	}
+
+	err = mpool_open(mpname, O_RDWR, &ds, &ei);
+	if (err) {
+		emit_err(co.co_fp, err, errbuf, sizeof(errbuf),
+			 verb, mpname, &ei);
+		goto errout;
+	}
+
+	err = mpool_catalog_open(ds, xport_opts.catlog1, xport_opts.catlog2,
+				 &cat);
+	if (err) {
+		emit_err(co.co_fp, err, errbuf, sizeof(errbuf),
+			 "open catalog of mpool", mpname, &ei);
+		mpool_close(ds);
+		goto errout;
+	}
+
+	params.xp_threads = xport_opts.threads;
+	params.xp_chunksz = xport_opts.chunksz;
+	params.xp_batch = xport_opts.batch;
+	params.xp_compress = xport_opts.compress;
+
+	if (export)
+		err = mpool_export(ds, cat, fd, &params, &stats);
+	else
+		err = mpool_import(ds, cat, fd, &params,
+				   co.co_verbose ? mpool_xport_map_cb : NULL,
+				   NULL, &stats);
+
+	if (err)
+		emit_err(co.co_fp, err, errbuf, sizeof(errbuf),
+			 verb, mpname, &ei);
+	else if (co.co_verbose)
+		fprintf(co.co_fp,
+			"%s %s: %lu mblocks, %lu mlogs, %lu bytes, %lu archive bytes\n",
+			export ? "exported" : "imported", mpname,
+			(ulong)stats.xs_mblocks, (ulong)stats.xs_mlogs,
+			(ulong)stats.xs_rawbytes, (ulong)stats.xs_arbytes);
+
+	mpool_catalog_close(cat);
+	mpool_close(ds);
+
+errout:
+	if (fd != STDOUT_FILENO && fd != STDIN_FILENO && close(fd) && !err)
+		err = merr(errno);
+
+	return err;
+}
+
+void
+mpool_export_help(
+	struct verb_s   *v,
+	bool             terse)
+{
+	struct help_s  h = {
+		.token = "export",
+		.shelp = "Export the objects of an mpool catalog",
+		.lhelp = "Write the objects named in the catalog of <mpname> "
+			"to an archive <file>, or to stdout if <file> is `-'",
+		.usage = "<mpname> <file>",
+
+		.example =
+		"%*s %s mp1 mp1.mpx catlog1=0x1d catlog2=0x1e\n"
+		"%*s %s mp1 - catlog1=0x1d catlog2=0x1e compress=1\n",
+	};
+
+	mpool_generic_verb_help(v, &h, terse, export_paramsv, 0);
+}
+
+merr_t
+mpool_export_func(
+	struct verb_s   *v,
+	int              argc,
+	char           **argv)
+{
+	return mpool_xport_common(argc, argv, export_paramsv, true);
+}
+
+void
+mpool_import_help(
+	struct verb_s   *v,
+	bool             terse)
+{
+	struct help_s  h = {
+		.token = "import",
+		.shelp = "Import objects into an mpool catalog",
+		.lhelp = "Recreate the objects of an archive <file>, or of stdin "
+			"if <file> is `-', in <mpname> and name them in its "
+			"catalog",
+		.usage = "<mpname> <file>",
+
+		.example =
+		"%*s %s mp2 mp1.mpx catlog1=0x1d catlog2=0x1e\n"
+		"%*s %s mp2 - catlog1=0x1d catlog2=0x1e threads=8\n",
+	};
+
+	mpool_generic_verb_help(v, &h, terse, import_paramsv, 0);
+}
+
+merr_t
+mpool_import_func(
+	struct verb_s   *v,
+	int              argc,
+	char           **argv)
+{
+	return mpool_xport_common(argc, argv, import_paramsv, false);
+}
+
+/**
+ * mpool load <mpool> <file>...
+ */
+static struct {
+	u64     catlog1;
+	u64     catlog2;
+} load_opts;
+
+static struct param_inst
+load_paramsv[] = {
+	PARAM_INST_U64(load_opts.catlog1, "catlog1",
+		       "Catalog MDC mlog ID 1, to name the mblocks"),
+	PARAM_INST_U64(load_opts.catlog2, "catlog2",
+		       "Catalog MDC mlog ID 2, to name the mblocks"),
+	PARAM_INST_END
+};
+
+/**
+ * mpool_load_file() - Load a file into as many mblocks as it takes
+ * @ds:   mpool handle
+ * @cat:  catalog to name the mblocks in, may be NULL
+ * @path: file to load
+ */
+static merr_t
+mpool_load_file(
+	struct mpool           *ds,
+	struct mpool_catalog   *cat,
+	const char             *path)
+{
+	struct mblock_props props;
+	struct stat         st;
+
+	char    name[MPOOL_CATALOG_NAME_MAX + 1];
+	char    errbuf[NFUI_ERRBUFSZ];
+	u64     mbh, off, len;
+	merr_t  err = 0;
+	u32     seg;
+	int     fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st)) {
+		err = merr(errno);
+		goto errout;
+	}
+
+	if (!S_ISREG(st.st_mode)) {
+		err = merr(EINVAL);
+		goto errout;
+	}
+
+	for (off = 0, seg = 0; !err && off < st.st_size; off += len, seg++) {
+		err = mpool_mblock_alloc(ds, MP_MED_CAPACITY, false, &mbh,
+					 &props);
+		if (err)
+			break;
+
+		len = min_t(u64, st.st_size - off, props.mpr_alloc_cap);
+
+		err = mpool_mblock_write_from_fd(ds, mbh, fd, off, len);
+		if (!err)
+			err = mpool_mblock_commit(ds, mbh);
+		if (err) {
+			mpool_mblock_abort(ds, mbh);
+			break;
+		}
+
+		if (off + len < st.st_size || seg > 0)
+			snprintf(name, sizeof(name), "%s.%u", basename(path), seg);
+		else
+			strlcpy(name, basename(path), sizeof(name));
+
+		if (cat) {
+			err = mpool_catalog_put(cat, name, props.mpr_objid,
+						NULL, 0);
+			if (err) {
+				mpool_mblock_delete(ds, mbh);
+				break;
+			}
+		}
+
+		fprintf(co.co_fp, "%s 0x%lx %lu\n",
+			name, (ulong)props.mpr_objid, (ulong)len);
+	}
+
+errout:
+	if (err) {
+		mpool_strinfo(err, errbuf, sizeof(errbuf));
+		fprintf(co.co_fp, "%s: unable to load %s: %s\n",
+			progname, path, errbuf);
+	}
+
+	if (fd != -1)
+		close(fd);
+
+	return err;
+}
+
+void
+mpool_load_help(
+	struct verb_s   *v,
+	bool             terse)
+{
+	struct help_s  h = {
+		.token = "load",
+		.shelp = "Load files into mblocks",
+		.lhelp = "Load each <file> into one or more committed mblocks of "
+			"<mpname>, and print their names and object IDs",
+		.usage = "<mpname> <file>...",
+
+		.example =
+		"%*s %s mp1 /data/ref/*.bin\n"
+		"%*s %s mp1 ref.bin catlog1=0x1d catlog2=0x1e\n",
+	};
+
+	mpool_generic_verb_help(v, &h, terse, load_paramsv, 0);
+}
+
+merr_t
+mpool_load_func(
+	struct verb_s   *v,
+	int              argc,
+	char           **argv)
+{
+	struct mpool_devrpt     ei = { };
+	struct mpool_catalog   *cat = NULL;
+	struct mpool           *ds;
+	const char             *mpname;
+
+	char    errbuf[NFUI_ERRBUFSZ];
+	int     argind = 0, i;
+	merr_t  err;
+
+	memset(&load_opts, 0, sizeof(load_opts));
+
+	err = process_params(argc, argv, load_paramsv, &argind, 0);
+	if (err) {
+		mpool_strinfo(err, errbuf, sizeof(errbuf));
+		fprintf(co.co_fp, "%s: unable to convert `%s': %s\n",
+			progname, argv[argind], errbuf);
+		return err;
+	}
+
+	argc -= argind;
+	argv += argind;
+
+	if (argc < 2) {
+		fprintf(co.co_fp, fmt_insufficient, progname);
+		return merr(EINVAL);
+	}
+
+	if (!load_opts.catlog1 != !load_opts.catlog2) {
+		fprintf(co.co_fp, "%s: catlog1 and catlog2 go together\n",
+			progname);
+		return merr(EINVAL);
+	}
+
+	mpname = argv[0];
+
+	if (co.co_dry_run)
+		return 0;
+
+	err = mpool_open(mpname, O_RDWR, &ds, &ei);
+	if (err) {
+		emit_err(co.co_fp, err, errbuf, sizeof(errbuf),
+			 "load into mpool", mpname, &ei);
+		return err;
+	}
+
+	if (load_opts.catlog1) {
+		err = mpool_catalog_open(ds, load_opts.catlog1,
+					 load_opts.catlog2, &cat);
+		if (err) {
+			emit_err(co.co_fp, err, errbuf, sizeof(errbuf),
+				 "open catalog of mpool", mpname, &ei);
+			mpool_close(ds);
+			return err;
+		}
+	}
+
+	for (i = 1; i < argc && !err; i++)
+		err = mpool_load_file(ds, cat, argv[i]);
+
+	if (cat)
+		mpool_catalog_close(cat);
+	mpool_close(ds);
+
+	return err;
+}
+
 /**
  * mpool version
  */
@@ -1327,15 +1758,18 @@ mpool_usage(void)
 
 static struct verb_s
 mpool_verb[] = {
-	{ "activate",   "hrTv",     mpool_activate_func, mpool_activate_help, },
+	{ "activate",   "hrTtv",    mpool_activate_func, mpool_activate_help, },
 	{ "add",        "DfhTv",    mpool_add_func,      mpool_add_help, },
 	{ "create",     "DfhTv",    mpool_create_func,   mpool_create_help, },
 	{ "deactivate", "hTv",    mpool_deactivate_func, mpool_deactivate_help,},
 	{ "destroy",    "fhTv",     mpool_destroy_func,  mpool_destroy_help, },
+	{ "export",     "hTv",      mpool_export_func,   mpool_export_help, },
 	{ "get",        "HhNTv",    mpool_get_func,      mpool_get_help, },
-	{ "list",       "HhNpTvY",  mpool_list_func,     mpool_list_help, },
+	{ "import",     "hTv",      mpool_import_func,   mpool_import_help, },
+	{ "list",       "AHhNPpTvY", mpool_list_func,     mpool_list_help, },
+	{ "load",       "hTv",      mpool_load_func,     mpool_load_help, },
 	{ "rename",     "fhTv",     mpool_rename_func,   mpool_rename_help,},
-	{ "scan",       "adHhNTvY", mpool_scan_func,     mpool_scan_help, },
+	{ "scan",       "adHhNTtvY", mpool_scan_func,    mpool_scan_help, },
 	{ "set",        "hTv",      mpool_set_func,      mpool_set_help, },
 	{ "version",    "hTv",      mpool_version_func,  mpool_version_help, },
 	{ "test",       "adhiusTv", mpool_test_func,     mpool_test_help,
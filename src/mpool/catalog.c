@@ -0,0 +1,1052 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Named object catalog design pattern module.
+ *
+ * The catalog maps names to an object ID plus a small amount of opaque
+ * user metadata.  It is served from an in-memory open addressing hash
+ * index, rebuilt at open by replaying a caller supplied MDC.
+ *
+ * Each MDC record is a batch of PUT and DEL operations that is applied
+ * atomically, both at update time and at replay.  The MDC is compacted by
+ * writing a snapshot of all live entries, packed into large records, once
+ * it has grown to several times the size of such a snapshot or has run
+ * out of room.
+ *
+ * Lookups take the index lock shared.  Updates are serialized by a
+ * separate mutex and hold the index lock exclusive only while applying an
+ * already persisted batch or swapping in a grown table; everything that
+ * can fail is done beforehand.
+ *
+ * Like mdc.c, this module is layered entirely on the public mpool API.
+ */
+
+#include <string.h>
+
+#include <util/alloc.h>
+#include <util/minmax.h>
+#include <util/mutex.h>
+#include <util/rwsem.h>
+#include <util/omf.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+#include "logging.h"
+
+#define CAT_MAGIC               ((u32)0x43415431)       /* "CAT1" */
+#define CAT_TAB_MIN             (1u << 10)
+#define CAT_RECSZ               (64 * 1024)
+#define CAT_MDC_COMPACT_MIN     (1024 * 1024)
+#define CAT_MDC_COMPACT_RATIO   (4)
+
+#define CAT_SLOT_TOMB           ((struct cat_ent *)1)
+
+/**
+ * struct cat_rec_omf - catalog MDC record header, followed by the ops
+ * @pcr_magic: CAT_MAGIC
+ * @pcr_opc:   number of ops in the record
+ */
+struct cat_rec_omf {
+	__le32  pcr_magic;
+	__le32  pcr_opc;
+} __packed;
+
+OMF_SETGET(struct cat_rec_omf, pcr_magic, 32)
+OMF_SETGET(struct cat_rec_omf, pcr_opc, 32)
+
+/**
+ * struct cat_op_omf - catalog op, followed by the name and the metadata
+ * @pco_type:    enum mpool_catalog_op_type
+ * @pco_namelen: name length, excluding the NUL terminator (not stored)
+ * @pco_metalen: metadata length
+ * @pco_objid:   object ID (PUT)
+ */
+struct cat_op_omf {
+	u8      pco_type;
+	u8      pco_rsvd1;
+	__le16  pco_namelen;
+	__le16  pco_metalen;
+	__le16  pco_rsvd2;
+	__le64  pco_objid;
+} __packed;
+
+OMF_SETGET(struct cat_op_omf, pco_type, 8)
+OMF_SETGET(struct cat_op_omf, pco_namelen, 16)
+OMF_SETGET(struct cat_op_omf, pco_metalen, 16)
+OMF_SETGET(struct cat_op_omf, pco_objid, 64)
+
+/**
+ * struct cat_op - decoded op
+ */
+struct cat_op {
+	u8          co_type;
+	u16         co_namelen;
+	u16         co_metalen;
+	u64         co_objid;
+	const char *co_name;
+	const void *co_meta;
+};
+
+/**
+ * struct cat_ent - catalog entry, the NUL terminated name and the metadata
+ * follow in ce_data
+ */
+struct cat_ent {
+	u64     ce_hash;
+	u64     ce_objid;
+	u16     ce_namelen;
+	u16     ce_metalen;
+	char    ce_data[];
+};
+
+struct cat_slot {
+	u64                 cs_hash;
+	struct cat_ent     *cs_ent;
+};
+
+/**
+ * struct mpool_catalog - named object catalog handle
+ * @cg_wlock:  serializes updates and compaction
+ * @cg_ilock:  protects the index
+ * @cg_mp:     mpool handle
+ * @cg_mdc:    MDC holding the catalog
+ * @cg_slotv:  index slots, NULL (empty), CAT_SLOT_TOMB or an entry
+ * @cg_sz:     number of slots (power of 2)
+ * @cg_cnt:    number of entries
+ * @cg_tomb:   number of tombstones
+ * @cg_livesz: size of a snapshot of the entries, in op bytes
+ * @cg_snapsz: MDC usage right after the last compaction
+ * @cg_wbuf:   record encoding buffer
+ * @cg_wbufsz: size of @cg_wbuf
+ */
+struct mpool_catalog {
+	struct mutex            cg_wlock;
+	struct rw_semaphore     cg_ilock;
+	struct mpool           *cg_mp;
+	struct mpool_mdc       *cg_mdc;
+
+	struct cat_slot        *cg_slotv;
+	u32                     cg_sz;
+	u32                     cg_cnt;
+	u32                     cg_tomb;
+
+	size_t                  cg_livesz;
+	size_t                  cg_snapsz;
+
+	char                   *cg_wbuf;
+	size_t                  cg_wbufsz;
+};
+
+static inline size_t
+cat_opsz(size_t namelen, size_t metalen)
+{
+	return sizeof(struct cat_op_omf) + namelen + metalen;
+}
+
+static inline size_t
+cat_ent_opsz(const struct cat_ent *ent)
+{
+	return cat_opsz(ent->ce_namelen, ent->ce_metalen);
+}
+
+/**
+ * cat_hash() - 64-bit FNV-1a, with a final mix for the low bits
+ */
+static u64
+cat_hash(const char *name, size_t len)
+{
+	u64 h = 0xcbf29ce484222325ull;
+
+	while (len-- > 0) {
+		h ^= (u8)*name++;
+		h *= 0x100000001b3ull;
+	}
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+
+	return h;
+}
+
+static struct cat_ent *
+cat_ent_alloc(const struct cat_op *op, u64 hash)
+{
+	struct cat_ent *ent;
+
+	ent = kmalloc(sizeof(*ent) + op->co_namelen + 1 + op->co_metalen,
+		      GFP_KERNEL);
+	if (!ent)
+		return NULL;
+
+	ent->ce_hash = hash;
+	ent->ce_objid = op->co_objid;
+	ent->ce_namelen = op->co_namelen;
+	ent->ce_metalen = op->co_metalen;
+
+	memcpy(ent->ce_data, op->co_name, op->co_namelen);
+	ent->ce_data[op->co_namelen] = '\0';
+
+	if (op->co_metalen > 0)
+		memcpy(ent->ce_data + op->co_namelen + 1, op->co_meta,
+		       op->co_metalen);
+
+	return ent;
+}
+
+/**
+ * cat_tab_find() - Find the slot holding @name
+ *
+ * Return: the slot, or NULL if there is none
+ */
+static struct cat_slot *
+cat_tab_find(
+	struct mpool_catalog   *cat,
+	const char             *name,
+	size_t                  namelen,
+	u64                     hash)
+{
+	struct cat_slot    *slot;
+	u32                 mask = cat->cg_sz - 1, i;
+
+	for (i = hash & mask; ; i = (i + 1) & mask) {
+		slot = cat->cg_slotv + i;
+
+		if (!slot->cs_ent)
+			return NULL;
+
+		if (slot->cs_ent != CAT_SLOT_TOMB && slot->cs_hash == hash &&
+		    slot->cs_ent->ce_namelen == namelen &&
+		    !memcmp(slot->cs_ent->ce_data, name, namelen))
+			return slot;
+	}
+}
+
+static struct cat_slot *
+cat_tab_free_slot(struct cat_slot *slotv, u32 sz, u64 hash)
+{
+	u32 mask = sz - 1, i;
+
+	for (i = hash & mask; ; i = (i + 1) & mask)
+		if (!slotv[i].cs_ent || slotv[i].cs_ent == CAT_SLOT_TOMB)
+			return slotv + i;
+}
+
+/**
+ * cat_tab_reserve() - Make room for @n more entries without rehashing
+ *
+ * The caller holds cg_wlock, so the index cannot change underneath.  The
+ * new table is built without cg_ilock and only swapped in under it, as
+ * lookups may be walking the old one.
+ */
+static merr_t
+cat_tab_reserve(struct mpool_catalog *cat, u32 n)
+{
+	struct cat_slot    *slotv, *oslotv, *slot;
+	u32                 sz = cat->cg_sz, i;
+
+	if ((cat->cg_cnt + cat->cg_tomb + n) * 4 < sz * 3)
+		return 0;
+
+	while ((cat->cg_cnt + n) * 2 >= sz)
+		sz *= 2;
+
+	slotv = kcalloc(sz, sizeof(*slotv), GFP_KERNEL);
+	if (!slotv)
+		return merr(ENOMEM);
+
+	for (i = 0; i < cat->cg_sz; i++) {
+		slot = cat->cg_slotv + i;
+		if (!slot->cs_ent || slot->cs_ent == CAT_SLOT_TOMB)
+			continue;
+
+		*cat_tab_free_slot(slotv, sz, slot->cs_hash) = *slot;
+	}
+
+	down_write(&cat->cg_ilock);
+	oslotv = cat->cg_slotv;
+	cat->cg_slotv = slotv;
+	cat->cg_sz = sz;
+	cat->cg_tomb = 0;
+	up_write(&cat->cg_ilock);
+
+	kfree(oslotv);
+
+	return 0;
+}
+
+/**
+ * cat_tab_put() - Insert or replace an entry; cannot fail once reserved
+ */
+static void
+cat_tab_put(struct mpool_catalog *cat, struct cat_ent *ent)
+{
+	struct cat_slot *slot;
+
+	slot = cat_tab_find(cat, ent->ce_data, ent->ce_namelen, ent->ce_hash);
+	if (slot) {
+		cat->cg_livesz -= cat_ent_opsz(slot->cs_ent);
+		kfree(slot->cs_ent);
+	} else {
+		slot = cat_tab_free_slot(cat->cg_slotv, cat->cg_sz,
+					 ent->ce_hash);
+		if (slot->cs_ent == CAT_SLOT_TOMB)
+			cat->cg_tomb--;
+		cat->cg_cnt++;
+	}
+
+	slot->cs_hash = ent->ce_hash;
+	slot->cs_ent = ent;
+	cat->cg_livesz += cat_ent_opsz(ent);
+}
+
+static void
+cat_tab_del(
+	struct mpool_catalog   *cat,
+	const char             *name,
+	size_t                  namelen,
+	u64                     hash)
+{
+	struct cat_slot *slot;
+
+	slot = cat_tab_find(cat, name, namelen, hash);
+	if (!slot)
+		return;
+
+	cat->cg_livesz -= cat_ent_opsz(slot->cs_ent);
+	kfree(slot->cs_ent);
+
+	slot->cs_ent = CAT_SLOT_TOMB;
+	cat->cg_cnt--;
+	cat->cg_tomb++;
+}
+
+/**
+ * cat_apply() - Apply a batch of ops to the index
+ * @entv: preallocated entries for the PUT ops, consumed
+ *
+ * The caller must have reserved room for @opc entries.
+ */
+static void
+cat_apply(
+	struct mpool_catalog   *cat,
+	const struct cat_op    *opv,
+	u32                     opc,
+	struct cat_ent        **entv)
+{
+	u32 i;
+
+	for (i = 0; i < opc; i++) {
+		if (opv[i].co_type == MPOOL_CATALOG_PUT) {
+			cat_tab_put(cat, entv[i]);
+			entv[i] = NULL;
+		} else {
+			cat_tab_del(cat, opv[i].co_name, opv[i].co_namelen,
+				    cat_hash(opv[i].co_name,
+					     opv[i].co_namelen));
+		}
+	}
+}
+
+/**
+ * cat_prepare() - Allocate everything needed to apply a batch of ops
+ */
+static merr_t
+cat_prepare(
+	struct mpool_catalog   *cat,
+	const struct cat_op    *opv,
+	u32                     opc,
+	struct cat_ent        **entv)
+{
+	u32 i;
+
+	for (i = 0; i < opc; i++) {
+		entv[i] = NULL;
+
+		if (opv[i].co_type != MPOOL_CATALOG_PUT)
+			continue;
+
+		entv[i] = cat_ent_alloc(opv + i, cat_hash(opv[i].co_name,
+							  opv[i].co_namelen));
+		if (!entv[i])
+			goto errout;
+	}
+
+	if (cat_tab_reserve(cat, opc) == 0)
+		return 0;
+
+errout:
+	while (i-- > 0)
+		kfree(entv[i]);
+
+	return merr(ENOMEM);
+}
+
+static merr_t
+cat_wbuf_reserve(struct mpool_catalog *cat, size_t len)
+{
+	char   *buf;
+	size_t  sz;
+
+	if (len <= cat->cg_wbufsz)
+		return 0;
+
+	sz = max_t(size_t, len, cat->cg_wbufsz * 2);
+
+	buf = kmalloc(sz, GFP_KERNEL);
+	if (!buf)
+		return merr(ENOMEM);
+
+	kfree(cat->cg_wbuf);
+	cat->cg_wbuf = buf;
+	cat->cg_wbufsz = sz;
+
+	return 0;
+}
+
+static size_t
+cat_op_encode(char *buf, const struct cat_op *op)
+{
+	struct cat_op_omf *omf = (struct cat_op_omf *)buf;
+
+	memset(omf, 0, sizeof(*omf));
+	omf_set_pco_type(omf, op->co_type);
+	omf_set_pco_namelen(omf, op->co_namelen);
+	omf_set_pco_metalen(omf, op->co_metalen);
+	omf_set_pco_objid(omf, op->co_objid);
+
+	buf += sizeof(*omf);
+	memcpy(buf, op->co_name, op->co_namelen);
+	if (op->co_metalen > 0)
+		memcpy(buf + op->co_namelen, op->co_meta, op->co_metalen);
+
+	return cat_opsz(op->co_namelen, op->co_metalen);
+}
+
+static void
+cat_rec_encode(char *buf, u32 opc)
+{
+	struct cat_rec_omf *rec = (struct cat_rec_omf *)buf;
+
+	omf_set_pcr_magic(rec, CAT_MAGIC);
+	omf_set_pcr_opc(rec, opc);
+}
+
+/**
+ * cat_rec_decode() - Decode and validate the ops of an MDC record
+ * @opv: decoded ops (output), allocated by the callee
+ */
+static merr_t
+cat_rec_decode(
+	const char     *buf,
+	size_t          len,
+	struct cat_op **opvp,
+	u32            *opcp)
+{
+	const struct cat_rec_omf   *rec;
+	const struct cat_op_omf    *omf;
+	struct cat_op              *opv, *op;
+	size_t                      off;
+	u32                         opc, i;
+
+	rec = (const struct cat_rec_omf *)buf;
+
+	if (len < sizeof(*rec) || omf_pcr_magic(rec) != CAT_MAGIC)
+		return merr(EBADMSG);
+
+	opc = omf_pcr_opc(rec);
+	if (opc > len / sizeof(*omf))
+		return merr(EBADMSG);
+
+	opv = kcalloc(max_t(u32, opc, 1), sizeof(*opv), GFP_KERNEL);
+	if (!opv)
+		return merr(ENOMEM);
+
+	off = sizeof(*rec);
+
+	for (i = 0; i < opc; i++) {
+		op = opv + i;
+		omf = (const struct cat_op_omf *)(buf + off);
+
+		if (off + sizeof(*omf) > len)
+			goto errout;
+
+		op->co_type = omf_pco_type(omf);
+		op->co_namelen = omf_pco_namelen(omf);
+		op->co_metalen = omf_pco_metalen(omf);
+		op->co_objid = omf_pco_objid(omf);
+
+		if ((op->co_type != MPOOL_CATALOG_PUT &&
+		     op->co_type != MPOOL_CATALOG_DEL) ||
+		    op->co_namelen == 0 ||
+		    off + cat_opsz(op->co_namelen, op->co_metalen) > len)
+			goto errout;
+
+		op->co_name = buf + off + sizeof(*omf);
+		op->co_meta = op->co_name + op->co_namelen;
+
+		off += cat_opsz(op->co_namelen, op->co_metalen);
+	}
+
+	if (off != len)
+		goto errout;
+
+	*opvp = opv;
+	*opcp = opc;
+
+	return 0;
+
+errout:
+	kfree(opv);
+
+	return merr(EBADMSG);
+}
+
+/**
+ * cat_mdc_snapshot() - Append the index as batches of PUT operations
+ */
+static merr_t
+cat_mdc_snapshot(void *arg)
+{
+	struct mpool_catalog   *cat = arg;
+	struct cat_ent         *ent;
+	struct cat_op           op;
+	size_t                  off;
+	merr_t                  err;
+	u32                     opc, i;
+
+	off = sizeof(struct cat_rec_omf);
+	opc = 0;
+
+	for (i = 0; i < cat->cg_sz; i++) {
+		ent = cat->cg_slotv[i].cs_ent;
+		if (!ent || ent == CAT_SLOT_TOMB)
+			continue;
+
+		if (opc > 0 && off + cat_ent_opsz(ent) > CAT_RECSZ) {
+			cat_rec_encode(cat->cg_wbuf, opc);
+
+			err = mpool_mdc_append(cat->cg_mdc, cat->cg_wbuf, off,
+					       false);
+			if (err)
+				return err;
+
+			off = sizeof(struct cat_rec_omf);
+			opc = 0;
+		}
+
+		op.co_type = MPOOL_CATALOG_PUT;
+		op.co_namelen = ent->ce_namelen;
+		op.co_metalen = ent->ce_metalen;
+		op.co_objid = ent->ce_objid;
+		op.co_name = ent->ce_data;
+		op.co_meta = ent->ce_data + ent->ce_namelen + 1;
+
+		off += cat_op_encode(cat->cg_wbuf + off, &op);
+		opc++;
+	}
+
+	if (opc > 0) {
+		cat_rec_encode(cat->cg_wbuf, opc);
+
+		err = mpool_mdc_append(cat->cg_mdc, cat->cg_wbuf, off, false);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/**
+ * cat_mdc_compact() - Rewrite the MDC as a snapshot of the index
+ * @force: compact regardless of the MDC usage, e.g., when it is full
+ */
+static merr_t
+cat_mdc_compact(struct mpool_catalog *cat, bool force)
+{
+	size_t  usage;
+	merr_t  err;
+
+	if (!force) {
+		err = mpool_mdc_usage(cat->cg_mdc, &usage);
+		if (err)
+			return err;
+
+		if (usage < CAT_MDC_COMPACT_MIN ||
+		    usage < CAT_MDC_COMPACT_RATIO *
+		    max(cat->cg_livesz, cat->cg_snapsz))
+			return 0;
+	}
+
+	err = cat_wbuf_reserve(cat, CAT_RECSZ);
+	if (err)
+		return err;
+
+	err = mpool_mdc_compact(cat->cg_mdc, cat_mdc_snapshot, cat);
+	if (err)
+		return err;
+
+	err = mpool_mdc_usage(cat->cg_mdc, &cat->cg_snapsz);
+	if (err)
+		cat->cg_snapsz = cat->cg_livesz;
+
+	return 0;
+}
+
+static merr_t
+cat_replay(struct mpool_catalog *cat)
+{
+	struct cat_ent    **entv;
+	struct cat_op      *opv = NULL;
+	size_t              rdlen;
+	merr_t              err;
+	u32                 opc = 0;
+
+	err = mpool_mdc_rewind(cat->cg_mdc);
+	if (err)
+		return err;
+
+	while (true) {
+		err = mpool_mdc_read(cat->cg_mdc, cat->cg_wbuf,
+				     cat->cg_wbufsz, &rdlen);
+		if (merr_errno(err) == EOVERFLOW) {
+			err = cat_wbuf_reserve(cat, rdlen);
+			if (err)
+				return err;
+			continue;
+		}
+
+		if (err)
+			return err;
+
+		if (rdlen == 0)
+			break;
+
+		err = cat_rec_decode(cat->cg_wbuf, rdlen, &opv, &opc);
+		if (err)
+			return err;
+
+		entv = kcalloc(max_t(u32, opc, 1), sizeof(*entv), GFP_KERNEL);
+		if (!entv) {
+			kfree(opv);
+			return merr(ENOMEM);
+		}
+
+		err = cat_prepare(cat, opv, opc, entv);
+		if (!err)
+			cat_apply(cat, opv, opc, entv);
+
+		kfree(entv);
+		kfree(opv);
+
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/**
+ * cat_append() - Persist a batch of ops as a single MDC record
+ */
+static merr_t
+cat_append(
+	struct mpool_catalog   *cat,
+	const struct cat_op    *opv,
+	u32                     opc)
+{
+	merr_t  err;
+	size_t  len;
+	u32     i;
+
+	len = sizeof(struct cat_rec_omf);
+	for (i = 0; i < opc; i++)
+		len += cat_opsz(opv[i].co_namelen, opv[i].co_metalen);
+
+	err = cat_wbuf_reserve(cat, len);
+	if (err)
+		return err;
+
+	cat_rec_encode(cat->cg_wbuf, opc);
+
+	len = sizeof(struct cat_rec_omf);
+	for (i = 0; i < opc; i++)
+		len += cat_op_encode(cat->cg_wbuf + len, opv + i);
+
+	return mpool_mdc_append(cat->cg_mdc, cat->cg_wbuf, len, true);
+}
+
+/**
+ * cat_update() - Persist and apply a batch of ops
+ */
+static merr_t
+cat_update(
+	struct mpool_catalog   *cat,
+	const struct cat_op    *opv,
+	u32                     opc)
+{
+	struct cat_ent    **entv;
+	merr_t              err;
+	u32                 i;
+
+	entv = kcalloc(opc, sizeof(*entv), GFP_KERNEL);
+	if (!entv)
+		return merr(ENOMEM);
+
+	err = cat_prepare(cat, opv, opc, entv);
+	if (err)
+		goto out;
+
+	err = cat_append(cat, opv, opc);
+	if (merr_errno(err) == EFBIG) {
+		/* Make room with a snapshot, which precedes this batch */
+		err = cat_mdc_compact(cat, true);
+		if (!err)
+			err = cat_append(cat, opv, opc);
+	}
+
+	if (err) {
+		for (i = 0; i < opc; i++)
+			kfree(entv[i]);
+		goto out;
+	}
+
+	down_write(&cat->cg_ilock);
+	cat_apply(cat, opv, opc, entv);
+	up_write(&cat->cg_ilock);
+
+	err = cat_mdc_compact(cat, false);
+	if (err) {
+		/* The update itself is durable */
+		mp_pr_err("catalog compaction failed", err);
+		err = 0;
+	}
+
+out:
+	kfree(entv);
+
+	return err;
+}
+
+static merr_t
+cat_op_import(struct cat_op *op, const struct mpool_catalog_op *uop)
+{
+	size_t namelen;
+
+	if (!uop->cop_name || (!uop->cop_meta && uop->cop_metalen > 0))
+		return merr(EINVAL);
+
+	if (uop->cop_type != MPOOL_CATALOG_PUT &&
+	    uop->cop_type != MPOOL_CATALOG_DEL)
+		return merr(EINVAL);
+
+	namelen = strnlen(uop->cop_name, MPOOL_CATALOG_NAME_MAX + 1);
+	if (namelen == 0 || namelen > MPOOL_CATALOG_NAME_MAX ||
+	    uop->cop_metalen > MPOOL_CATALOG_META_MAX)
+		return merr(EINVAL);
+
+	op->co_type = uop->cop_type;
+	op->co_namelen = namelen;
+	op->co_objid = uop->cop_objid;
+	op->co_name = uop->cop_name;
+
+	op->co_metalen = 0;
+	op->co_meta = NULL;
+
+	if (op->co_type == MPOOL_CATALOG_PUT) {
+		op->co_metalen = uop->cop_metalen;
+		op->co_meta = uop->cop_meta;
+	}
+
+	return 0;
+}
+
+uint64_t
+mpool_catalog_open(
+	struct mpool           *mp,
+	uint64_t                logid1,
+	uint64_t                logid2,
+	struct mpool_catalog  **catp)
+{
+	struct mpool_catalog   *cat;
+	merr_t                  err;
+
+	if (!mp || !catp)
+		return merr(EINVAL);
+
+	*catp = NULL;
+
+	cat = kzalloc(sizeof(*cat), GFP_KERNEL);
+	if (!cat)
+		return merr(ENOMEM);
+
+	mutex_init(&cat->cg_wlock);
+	init_rwsem(&cat->cg_ilock);
+
+	cat->cg_mp = mp;
+
+	cat->cg_slotv = kcalloc(CAT_TAB_MIN, sizeof(*cat->cg_slotv),
+				GFP_KERNEL);
+	if (!cat->cg_slotv) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	cat->cg_sz = CAT_TAB_MIN;
+
+	err = cat_wbuf_reserve(cat, CAT_RECSZ);
+	if (err)
+		goto errout;
+
+	err = mpool_mdc_open(mp, logid1, logid2, 0, &cat->cg_mdc);
+	if (err)
+		goto errout;
+
+	err = cat_replay(cat);
+	if (err) {
+		mp_pr_err("catalog logid 0x%lx 0x%lx replay failed",
+			  err, (ulong)logid1, (ulong)logid2);
+		goto errout;
+	}
+
+	err = mpool_mdc_usage(cat->cg_mdc, &cat->cg_snapsz);
+	if (err)
+		goto errout;
+
+	*catp = cat;
+
+	return 0;
+
+errout:
+	mpool_catalog_close(cat);
+
+	return err;
+}
+
+uint64_t
+mpool_catalog_close(struct mpool_catalog *cat)
+{
+	struct cat_ent *ent;
+	merr_t          err = 0;
+	u32             i;
+
+	if (!cat)
+		return merr(EINVAL);
+
+	if (cat->cg_mdc)
+		err = mpool_mdc_close(cat->cg_mdc);
+
+	for (i = 0; i < cat->cg_sz; i++) {
+		ent = cat->cg_slotv[i].cs_ent;
+		if (ent && ent != CAT_SLOT_TOMB)
+			kfree(ent);
+	}
+
+	kfree(cat->cg_slotv);
+	kfree(cat->cg_wbuf);
+	mutex_destroy(&cat->cg_wlock);
+	kfree(cat);
+
+	return err;
+}
+
+uint64_t
+mpool_catalog_update(
+	struct mpool_catalog           *cat,
+	const struct mpool_catalog_op  *opv,
+	uint32_t                        opc)
+{
+	struct cat_op  *iopv;
+	merr_t          err;
+	u32             i;
+
+	if (!cat || (!opv && opc > 0))
+		return merr(EINVAL);
+
+	if (opc == 0)
+		return 0;
+
+	iopv = kcalloc(opc, sizeof(*iopv), GFP_KERNEL);
+	if (!iopv)
+		return merr(ENOMEM);
+
+	for (i = 0; i < opc; i++) {
+		err = cat_op_import(iopv + i, opv + i);
+		if (err)
+			goto out;
+	}
+
+	mutex_lock(&cat->cg_wlock);
+	err = cat_update(cat, iopv, opc);
+	mutex_unlock(&cat->cg_wlock);
+
+out:
+	kfree(iopv);
+
+	return err;
+}
+
+uint64_t
+mpool_catalog_put(
+	struct mpool_catalog   *cat,
+	const char             *name,
+	uint64_t                objid,
+	const void             *meta,
+	size_t                  metalen)
+{
+	struct mpool_catalog_op op;
+
+	if (metalen > MPOOL_CATALOG_META_MAX)
+		return merr(EINVAL);
+
+	memset(&op, 0, sizeof(op));
+	op.cop_type = MPOOL_CATALOG_PUT;
+	op.cop_name = name;
+	op.cop_objid = objid;
+	op.cop_meta = meta;
+	op.cop_metalen = metalen;
+
+	return mpool_catalog_update(cat, &op, 1);
+}
+
+uint64_t
+mpool_catalog_delete(
+	struct mpool_catalog   *cat,
+	const char             *name)
+{
+	struct mpool_catalog_op op;
+	struct cat_op           iop;
+	merr_t                  err;
+
+	if (!cat)
+		return merr(EINVAL);
+
+	memset(&op, 0, sizeof(op));
+	op.cop_type = MPOOL_CATALOG_DEL;
+	op.cop_name = name;
+
+	err = cat_op_import(&iop, &op);
+	if (err)
+		return err;
+
+	mutex_lock(&cat->cg_wlock);
+
+	/* The index only changes under cg_wlock */
+	if (!cat_tab_find(cat, iop.co_name, iop.co_namelen,
+			  cat_hash(iop.co_name, iop.co_namelen)))
+		err = merr(ENOENT);
+	else
+		err = cat_update(cat, &iop, 1);
+
+	mutex_unlock(&cat->cg_wlock);
+
+	return err;
+}
+
+uint64_t
+mpool_catalog_get(
+	struct mpool_catalog   *cat,
+	const char             *name,
+	uint64_t               *objid,
+	void                   *meta,
+	size_t                  metamax,
+	size_t                 *metalen)
+{
+	struct cat_slot    *slot;
+	struct cat_ent     *ent;
+	merr_t              err = 0;
+	size_t              namelen;
+
+	if (!cat || !name)
+		return merr(EINVAL);
+
+	namelen = strnlen(name, MPOOL_CATALOG_NAME_MAX + 1);
+	if (namelen == 0 || namelen > MPOOL_CATALOG_NAME_MAX)
+		return merr(EINVAL);
+
+	down_read(&cat->cg_ilock);
+
+	slot = cat_tab_find(cat, name, namelen, cat_hash(name, namelen));
+	if (!slot) {
+		err = merr(ENOENT);
+		goto out;
+	}
+
+	ent = slot->cs_ent;
+
+	if (objid)
+		*objid = ent->ce_objid;
+
+	if (metalen)
+		*metalen = ent->ce_metalen;
+
+	if (meta) {
+		if (metamax < ent->ce_metalen) {
+			err = merr(EOVERFLOW);
+			goto out;
+		}
+
+		memcpy(meta, ent->ce_data + ent->ce_namelen + 1,
+		       ent->ce_metalen);
+	}
+
+out:
+	up_read(&cat->cg_ilock);
+
+	return err;
+}
+
+uint64_t
+mpool_catalog_foreach(
+	struct mpool_catalog   *cat,
+	mpool_catalog_cb_t     *cb,
+	void                   *arg)
+{
+	struct cat_ent *ent;
+	u32             i;
+
+	if (!cat || !cb)
+		return merr(EINVAL);
+
+	down_read(&cat->cg_ilock);
+
+	for (i = 0; i < cat->cg_sz; i++) {
+		ent = cat->cg_slotv[i].cs_ent;
+		if (!ent || ent == CAT_SLOT_TOMB)
+			continue;
+
+		if (cb(arg, ent->ce_data, ent->ce_objid,
+		       ent->ce_data + ent->ce_namelen + 1, ent->ce_metalen))
+			break;
+	}
+
+	up_read(&cat->cg_ilock);
+
+	return 0;
+}
+
+uint64_t
+mpool_catalog_getprops(
+	struct mpool_catalog           *cat,
+	struct mpool_catalog_props     *props)
+{
+	size_t usage;
+	merr_t err;
+
+	if (!cat || !props)
+		return merr(EINVAL);
+
+	memset(props, 0, sizeof(*props));
+
+	mutex_lock(&cat->cg_wlock);
+	props->cgp_count = cat->cg_cnt;
+	props->cgp_livesz = cat->cg_livesz;
+	err = mpool_mdc_usage(cat->cg_mdc, &usage);
+	props->cgp_usage = usage;
+	mutex_unlock(&cat->cg_wlock);
+
+	return err;
+}
@@ -0,0 +1,943 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Chained log design pattern module.
+ *
+ * A chained log is an unbounded sequence of records spread over a chain of
+ * mlogs ("links").  Records are appended to the active link; when it can no
+ * longer hold the next record, a pre-allocated successor link takes over
+ * instead of the append failing with EFBIG.  Each link starts with a small
+ * header carrying its sequence number and the object ID of its predecessor.
+ *
+ * The chain itself is recorded in a caller supplied MDC:
+ *
+ *   ADD(seq, objid, gen) - link seq was allocated
+ *   TRUNC(headseq)       - links below headseq were dropped
+ *
+ * Links past the active one are empty spares.  Readers iterate over all
+ * links from the head; truncation drops whole links from the head.  With
+ * a spare pool, new links are taken from it and dropped links are retired
+ * to it, so that neither allocation nor erase is on the append path.
+ *
+ * Like mdc.c, this module is layered on the public mpool API, plus
+ * mpool_mlog_append_dmax() to learn how much room the active link has left.
+ */
+
+#include <string.h>
+
+#include <util/alloc.h>
+#include <util/minmax.h>
+#include <util/mutex.h>
+#include <util/omf.h>
+
+#include <mpool/mpool.h>
+#include <mpctl/imlog.h>
+
+#include "mpool_err.h"
+#include "logging.h"
+
+#define CHLOG_MAGIC             ((u32)0x43484c31)       /* "CHL1" */
+#define CHLOG_VERSION           (1)
+#define CHLOG_CAPTGT_DFLT       (8 * 1024 * 1024)
+#define CHLOG_LINKS_MIN         (8)
+#define CHLOG_MDC_COMPACT_MIN   (1024 * 1024)
+#define CHLOG_MDC_COMPACT_RATIO (4)
+
+/*
+ * MDC record types
+ */
+enum chlog_rec_type {
+	CHLOG_REC_ADD   = 1,
+	CHLOG_REC_TRUNC = 2,
+};
+
+/**
+ * struct chlog_rec_omf - chained log MDC record
+ * @pcr_type:  enum chlog_rec_type
+ * @pcr_seq:   link sequence number (ADD) or new head sequence (TRUNC)
+ * @pcr_objid: link mlog object ID (ADD)
+ * @pcr_gen:   link mlog generation (ADD)
+ */
+struct chlog_rec_omf {
+	u8      pcr_type;
+	u8      pcr_rsvd[7];
+	__le64  pcr_seq;
+	__le64  pcr_objid;
+	__le64  pcr_gen;
+} __packed;
+
+OMF_SETGET(struct chlog_rec_omf, pcr_type, 8)
+OMF_SETGET(struct chlog_rec_omf, pcr_seq, 64)
+OMF_SETGET(struct chlog_rec_omf, pcr_objid, 64)
+OMF_SETGET(struct chlog_rec_omf, pcr_gen, 64)
+
+/**
+ * struct chlog_hdr_omf - first record of every link
+ * @pch_magic:   CHLOG_MAGIC
+ * @pch_version: CHLOG_VERSION
+ * @pch_seq:     link sequence number
+ * @pch_prev:    object ID of the preceding link, 0 for the first link
+ */
+struct chlog_hdr_omf {
+	__le32  pch_magic;
+	__le32  pch_version;
+	__le64  pch_seq;
+	__le64  pch_prev;
+} __packed;
+
+OMF_SETGET(struct chlog_hdr_omf, pch_magic, 32)
+OMF_SETGET(struct chlog_hdr_omf, pch_version, 32)
+OMF_SETGET(struct chlog_hdr_omf, pch_seq, 64)
+OMF_SETGET(struct chlog_hdr_omf, pch_prev, 64)
+
+/**
+ * struct chlog_link - in-memory link descriptor
+ * @cl_seq:   sequence number
+ * @cl_objid: mlog object ID
+ * @cl_gen:   mlog generation when the link was allocated
+ * @cl_mlh:   mlog handle if open (holds one reference), else NULL
+ */
+struct chlog_link {
+	u64                 cl_seq;
+	u64                 cl_objid;
+	u64                 cl_gen;
+	struct mpool_mlog  *cl_mlh;
+};
+
+/**
+ * struct mpool_chlog - chained log handle
+ * @ch_lock:    protects everything below
+ * @ch_mp:      mpool handle
+ * @ch_mdc:     MDC recording the chain
+ * @ch_params:  tunables
+ * @ch_linkv:   links, head first
+ * @ch_linkc:   number of links
+ * @ch_linkmax: size of @ch_linkv
+ * @ch_aidx:    index of the active link
+ * @ch_ridx:    index of the link the reader is on
+ * @ch_rinit:   reader cursor of @ch_ridx is positioned past the header
+ * @ch_recmax:  largest record a fresh link can take, 0 if not yet known
+ * @ch_snapsz:  MDC usage right after the last snapshot
+ */
+struct mpool_chlog {
+	struct mutex                ch_lock;
+	struct mpool               *ch_mp;
+	struct mpool_mdc           *ch_mdc;
+	struct mpool_chlog_params   ch_params;
+
+	struct chlog_link          *ch_linkv;
+	u32                         ch_linkc;
+	u32                         ch_linkmax;
+	u32                         ch_aidx;
+
+	u32                         ch_ridx;
+	bool                        ch_rinit;
+
+	s64                         ch_recmax;
+	size_t                      ch_snapsz;
+};
+
+static merr_t
+chlog_rec_append(
+	struct mpool_chlog     *ch,
+	enum chlog_rec_type     type,
+	u64                     seq,
+	u64                     objid,
+	u64                     gen,
+	bool                    sync)
+{
+	struct chlog_rec_omf rec;
+
+	memset(&rec, 0, sizeof(rec));
+	omf_set_pcr_type(&rec, type);
+	omf_set_pcr_seq(&rec, seq);
+	omf_set_pcr_objid(&rec, objid);
+	omf_set_pcr_gen(&rec, gen);
+
+	return mpool_mdc_append(ch->ch_mdc, &rec, sizeof(rec), sync);
+}
+
+static struct chlog_link *
+chlog_link_add(struct mpool_chlog *ch, u64 seq, u64 objid, u64 gen)
+{
+	struct chlog_link  *link;
+	u32                 linkmax;
+
+	if (ch->ch_linkc >= ch->ch_linkmax) {
+		linkmax = max_t(u32, CHLOG_LINKS_MIN, ch->ch_linkmax * 2);
+
+		link = kcalloc(linkmax, sizeof(*link), GFP_KERNEL);
+		if (!link)
+			return NULL;
+
+		if (ch->ch_linkv)
+			memcpy(link, ch->ch_linkv,
+			       ch->ch_linkc * sizeof(*link));
+		kfree(ch->ch_linkv);
+
+		ch->ch_linkv = link;
+		ch->ch_linkmax = linkmax;
+	}
+
+	link = ch->ch_linkv + ch->ch_linkc++;
+	link->cl_seq = seq;
+	link->cl_objid = objid;
+	link->cl_gen = gen;
+	link->cl_mlh = NULL;
+
+	return link;
+}
+
+static merr_t
+chlog_link_open(struct mpool_chlog *ch, struct chlog_link *link)
+{
+	struct mlog_props   props;
+	merr_t              err;
+	u64                 gen;
+
+	if (link->cl_mlh)
+		return 0;
+
+	err = mpool_mlog_find_get(ch->ch_mp, link->cl_objid, &props,
+				  &link->cl_mlh);
+	if (err)
+		return err;
+
+	err = mpool_mlog_open(ch->ch_mp, link->cl_mlh, 0, &gen);
+	if (err) {
+		mpool_mlog_put(ch->ch_mp, link->cl_mlh);
+		link->cl_mlh = NULL;
+	}
+
+	return err;
+}
+
+static void
+chlog_link_close(struct mpool_chlog *ch, struct chlog_link *link)
+{
+	if (!link->cl_mlh)
+		return;
+
+	mpool_mlog_close(ch->ch_mp, link->cl_mlh);
+	mpool_mlog_put(ch->ch_mp, link->cl_mlh);
+	link->cl_mlh = NULL;
+}
+
+/**
+ * chlog_link_drop() - Retire a dropped link's mlog to the pool, or delete it
+ * @replay: redoing a truncation, which a crash may have interrupted
+ *
+ * A link that is already gone is not an error.  Without a spare pool, or
+ * if the pool fails to take it, the mlog is deleted.  A replayed link may
+ * have been retired, erased and handed out again already, so it is only
+ * reclaimed if its generation is unchanged and never deleted.
+ */
+static merr_t
+chlog_link_drop(struct mpool_chlog *ch, struct chlog_link *link, bool replay)
+{
+	struct mpool_mlspare   *sp = ch->ch_params.chp_spares;
+	struct mlog_props       props;
+	merr_t                  err;
+
+	if (link->cl_mlh) {
+		mpool_mlog_close(ch->ch_mp, link->cl_mlh);
+	} else {
+		err = mpool_mlog_find_get(ch->ch_mp, link->cl_objid, &props,
+					  &link->cl_mlh);
+		if (err)
+			return merr_errno(err) == ENOENT ? 0 : err;
+	}
+
+	if (sp) {
+		if (replay)
+			err = mpool_mlspare_reclaim(sp, link->cl_mlh,
+						    link->cl_gen);
+		else
+			err = mpool_mlspare_retire(sp, link->cl_mlh);
+
+		if (!err) {
+			link->cl_mlh = NULL;
+			return 0;
+		}
+
+		if (replay) {
+			mpool_mlog_put(ch->ch_mp, link->cl_mlh);
+			link->cl_mlh = NULL;
+
+			/* Retired, or even handed out again, before a crash */
+			if (merr_errno(err) == EEXIST ||
+			    merr_errno(err) == ESTALE)
+				return 0;
+
+			return err;
+		}
+
+		mp_pr_err("chlog link %lu objid 0x%lx retire failed",
+			  err, (ulong)link->cl_seq, (ulong)link->cl_objid);
+	}
+
+	err = mpool_mlog_delete(ch->ch_mp, link->cl_mlh);
+	if (err)
+		mpool_mlog_put(ch->ch_mp, link->cl_mlh);
+
+	link->cl_mlh = NULL;
+
+	return err;
+}
+
+/**
+ * chlog_link_new() - Allocate an empty spare link at the tail of the chain
+ *
+ * The link is committed before its ADD record is synced, so a crash in
+ * between leaves an unreferenced mlog rather than a dangling ADD.  With a
+ * spare pool the link is taken ready made, keeping mlog allocation off the
+ * append path.
+ */
+static merr_t
+chlog_link_new(struct mpool_chlog *ch)
+{
+	struct mlog_capacity    cap;
+	struct mlog_props       props;
+	struct chlog_link      *link;
+	struct mpool_mlog      *mlh;
+	merr_t                  err;
+	u64                     seq, gen;
+
+	seq = ch->ch_linkc ? ch->ch_linkv[ch->ch_linkc - 1].cl_seq + 1 : 0;
+
+	if (ch->ch_params.chp_spares) {
+		err = mpool_mlspare_get(ch->ch_params.chp_spares, &props, &mlh);
+		if (err)
+			return err;
+	} else {
+		memset(&cap, 0, sizeof(cap));
+		cap.lcp_captgt = ch->ch_params.chp_captgt;
+
+		err = mpool_mlog_alloc(ch->ch_mp, &cap,
+				       ch->ch_params.chp_mclassp, &props, &mlh);
+		if (err)
+			return err;
+
+		err = mpool_mlog_commit(ch->ch_mp, mlh);
+		if (err) {
+			mpool_mlog_abort(ch->ch_mp, mlh);
+			return err;
+		}
+	}
+
+	link = chlog_link_add(ch, seq, props.lpr_objid, props.lpr_gen);
+	if (!link) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	err = chlog_rec_append(ch, CHLOG_REC_ADD, seq, props.lpr_objid,
+			       props.lpr_gen, true);
+	if (err) {
+		ch->ch_linkc--;
+		goto errout;
+	}
+
+	err = mpool_mlog_open(ch->ch_mp, mlh, 0, &gen);
+	if (err) {
+		/* The ADD is durable, keep the link and open it lazily */
+		mpool_mlog_put(ch->ch_mp, mlh);
+		return err;
+	}
+
+	link->cl_mlh = mlh;
+
+	return 0;
+
+errout:
+	if (!ch->ch_params.chp_spares ||
+	    mpool_mlspare_retire(ch->ch_params.chp_spares, mlh))
+		mpool_mlog_delete(ch->ch_mp, mlh);
+
+	return err;
+}
+
+/**
+ * chlog_link_activate() - Write the header of link @idx and make it active
+ */
+static merr_t
+chlog_link_activate(struct mpool_chlog *ch, u32 idx)
+{
+	struct chlog_hdr_omf    hdr;
+	struct chlog_link      *link;
+	merr_t                  err;
+	s64                     dmax;
+
+	link = ch->ch_linkv + idx;
+
+	err = chlog_link_open(ch, link);
+	if (err)
+		return err;
+
+	memset(&hdr, 0, sizeof(hdr));
+	omf_set_pch_magic(&hdr, CHLOG_MAGIC);
+	omf_set_pch_version(&hdr, CHLOG_VERSION);
+	omf_set_pch_seq(&hdr, link->cl_seq);
+	omf_set_pch_prev(&hdr, idx > 0 ? ch->ch_linkv[idx - 1].cl_objid : 0);
+
+	err = mpool_mlog_append_data(ch->ch_mp, link->cl_mlh, &hdr,
+				     sizeof(hdr), 1);
+	if (err)
+		return err;
+
+	ch->ch_aidx = idx;
+
+	err = mpool_mlog_append_dmax(ch->ch_mp, link->cl_mlh, &dmax);
+	if (!err && dmax > 0)
+		ch->ch_recmax = dmax;
+
+	return 0;
+}
+
+static merr_t
+chlog_mdc_snapshot(void *arg)
+{
+	struct mpool_chlog *ch = arg;
+	struct chlog_link  *link;
+	merr_t              err;
+	u32                 i;
+
+	err = chlog_rec_append(ch, CHLOG_REC_TRUNC, ch->ch_linkv[0].cl_seq,
+			       0, 0, false);
+	if (err)
+		return err;
+
+	for (i = 0; i < ch->ch_linkc; i++) {
+		link = ch->ch_linkv + i;
+
+		err = chlog_rec_append(ch, CHLOG_REC_ADD, link->cl_seq,
+				       link->cl_objid, link->cl_gen, false);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+static merr_t
+chlog_mdc_compact(struct mpool_chlog *ch)
+{
+	size_t  usage, snapsz;
+	merr_t  err;
+
+	err = mpool_mdc_usage(ch->ch_mdc, &usage);
+	if (err)
+		return err;
+
+	snapsz = (ch->ch_linkc + 1) * sizeof(struct chlog_rec_omf);
+
+	if (usage < CHLOG_MDC_COMPACT_MIN ||
+	    usage < CHLOG_MDC_COMPACT_RATIO * max(snapsz, ch->ch_snapsz))
+		return 0;
+
+	err = mpool_mdc_compact(ch->ch_mdc, chlog_mdc_snapshot, ch);
+	if (err)
+		return err;
+
+	err = mpool_mdc_usage(ch->ch_mdc, &ch->ch_snapsz);
+	if (err)
+		ch->ch_snapsz = snapsz;
+
+	return 0;
+}
+
+/**
+ * chlog_roll() - Switch appends over to the next link
+ *
+ * A new spare is allocated only once the last one has been consumed, so a
+ * failure to allocate one leaves the chain usable up to the active link.
+ * The MDC is compacted before the switch, so that a failure to compact it
+ * fails the append with the chain unchanged rather than letting the MDC
+ * grow without bound.
+ */
+static merr_t
+chlog_roll(struct mpool_chlog *ch)
+{
+	struct chlog_link  *old;
+	merr_t              err;
+	u32                 aidx;
+
+	if (ch->ch_aidx + 1 >= ch->ch_linkc) {
+		err = chlog_link_new(ch);
+		if (err)
+			return err;
+	}
+
+	err = chlog_mdc_compact(ch);
+	if (err)
+		return err;
+
+	aidx = ch->ch_aidx;
+	old = ch->ch_linkv + aidx;
+
+	err = mpool_mlog_flush(ch->ch_mp, old->cl_mlh);
+	if (err)
+		return err;
+
+	err = chlog_link_activate(ch, aidx + 1);
+	if (err)
+		return err;
+
+	/* The reader may still be draining the old link */
+	if (ch->ch_ridx != aidx)
+		chlog_link_close(ch, old);
+
+	if (ch->ch_aidx + 1 >= ch->ch_linkc) {
+		/* Retried by the next roll */
+		err = chlog_link_new(ch);
+		if (err)
+			mp_pr_err("chlog spare link alloc failed", err);
+	}
+
+	return 0;
+}
+
+/**
+ * chlog_replay() - Rebuild the chain from the MDC
+ */
+static merr_t
+chlog_replay(struct mpool_chlog *ch)
+{
+	struct chlog_rec_omf    rec;
+	struct chlog_link      *link;
+	size_t                  rdlen;
+	merr_t                  err;
+	u64                     seq;
+	u32                     n;
+
+	err = mpool_mdc_rewind(ch->ch_mdc);
+	if (err)
+		return err;
+
+	while (true) {
+		err = mpool_mdc_read(ch->ch_mdc, &rec, sizeof(rec), &rdlen);
+		if (err)
+			return err;
+
+		if (rdlen == 0)
+			break;
+
+		if (rdlen != sizeof(rec))
+			return merr(EBADMSG);
+
+		seq = omf_pcr_seq(&rec);
+
+		switch (omf_pcr_type(&rec)) {
+		case CHLOG_REC_ADD:
+			if (ch->ch_linkc > 0 &&
+			    seq != ch->ch_linkv[ch->ch_linkc - 1].cl_seq + 1)
+				return merr(EBADMSG);
+
+			link = chlog_link_add(ch, seq, omf_pcr_objid(&rec),
+					      omf_pcr_gen(&rec));
+			if (!link)
+				return merr(ENOMEM);
+			break;
+
+		case CHLOG_REC_TRUNC:
+			/* Finish dropping links a crash may have left behind */
+			for (n = 0; n < ch->ch_linkc; n++) {
+				link = ch->ch_linkv + n;
+				if (link->cl_seq >= seq)
+					break;
+
+				err = chlog_link_drop(ch, link, true);
+				if (err)
+					return err;
+			}
+
+			ch->ch_linkc -= n;
+			memmove(ch->ch_linkv, ch->ch_linkv + n,
+				ch->ch_linkc * sizeof(*link));
+			break;
+
+		default:
+			return merr(EBADMSG);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * chlog_recover() - Find the active link after replay
+ *
+ * The active link is the last non-empty one; any empty links after it are
+ * spares.  A chain without a written link activates its first one.  Only
+ * the active link is left open, the others are opened again on demand.
+ */
+static merr_t
+chlog_recover(struct mpool_chlog *ch)
+{
+	struct chlog_link  *link;
+	merr_t              err;
+	bool                empty;
+	u32                 i;
+
+	if (ch->ch_linkc == 0) {
+		err = chlog_link_new(ch);
+		if (err)
+			return err;
+	}
+
+	for (i = ch->ch_linkc; i > 0; i--) {
+		link = ch->ch_linkv + i - 1;
+
+		err = chlog_link_open(ch, link);
+		if (err)
+			return err;
+
+		err = mpool_mlog_empty(ch->ch_mp, link->cl_mlh, &empty);
+		if (err)
+			return err;
+
+		if (!empty) {
+			ch->ch_aidx = i - 1;
+			break;
+		}
+	}
+
+	if (i == 0) {
+		err = chlog_link_activate(ch, 0);
+		if (err)
+			return err;
+	}
+
+	for (i = 0; i < ch->ch_linkc; i++)
+		if (i != ch->ch_aidx)
+			chlog_link_close(ch, ch->ch_linkv + i);
+
+	if (ch->ch_aidx + 1 >= ch->ch_linkc)
+		return chlog_link_new(ch);
+
+	return 0;
+}
+
+uint64_t
+mpool_chlog_open(
+	struct mpool                       *mp,
+	uint64_t                            logid1,
+	uint64_t                            logid2,
+	const struct mpool_chlog_params    *params,
+	struct mpool_chlog                **chp)
+{
+	struct mpool_chlog *ch;
+	merr_t              err;
+	u32                 i;
+
+	if (!mp || !chp)
+		return merr(EINVAL);
+
+	*chp = NULL;
+
+	ch = kzalloc(sizeof(*ch), GFP_KERNEL);
+	if (!ch)
+		return merr(ENOMEM);
+
+	mutex_init(&ch->ch_lock);
+
+	ch->ch_mp = mp;
+
+	if (params) {
+		ch->ch_params = *params;
+	} else {
+		ch->ch_params.chp_mclassp = MP_MED_CAPACITY;
+	}
+
+	if (ch->ch_params.chp_captgt == 0)
+		ch->ch_params.chp_captgt = CHLOG_CAPTGT_DFLT;
+
+	err = mpool_mdc_open(mp, logid1, logid2, 0, &ch->ch_mdc);
+	if (err)
+		goto errout;
+
+	err = chlog_replay(ch);
+	if (!err)
+		err = chlog_recover(ch);
+	if (err) {
+		mp_pr_err("chlog logid 0x%lx 0x%lx replay failed",
+			  err, (ulong)logid1, (ulong)logid2);
+		goto errout;
+	}
+
+	*chp = ch;
+
+	return 0;
+
+errout:
+	for (i = 0; i < ch->ch_linkc; i++)
+		chlog_link_close(ch, ch->ch_linkv + i);
+	if (ch->ch_mdc)
+		mpool_mdc_close(ch->ch_mdc);
+	mutex_destroy(&ch->ch_lock);
+	kfree(ch->ch_linkv);
+	kfree(ch);
+
+	return err;
+}
+
+uint64_t
+mpool_chlog_close(struct mpool_chlog *ch)
+{
+	merr_t  err, err2;
+	u32     i;
+
+	if (!ch)
+		return merr(EINVAL);
+
+	err = mpool_mlog_flush(ch->ch_mp, ch->ch_linkv[ch->ch_aidx].cl_mlh);
+
+	for (i = 0; i < ch->ch_linkc; i++)
+		chlog_link_close(ch, ch->ch_linkv + i);
+
+	err2 = mpool_mdc_close(ch->ch_mdc);
+	if (!err)
+		err = err2;
+
+	mutex_destroy(&ch->ch_lock);
+	kfree(ch->ch_linkv);
+	kfree(ch);
+
+	return err;
+}
+
+uint64_t
+mpool_chlog_append(
+	struct mpool_chlog *ch,
+	void               *data,
+	size_t              len,
+	bool                sync)
+{
+	struct chlog_link  *link;
+	merr_t              err;
+	s64                 dmax;
+	int                 tries;
+
+	if (!ch || (!data && len > 0))
+		return merr(EINVAL);
+
+	mutex_lock(&ch->ch_lock);
+
+	if (ch->ch_recmax > 0 && len > ch->ch_recmax) {
+		err = merr(EFBIG);
+		goto out;
+	}
+
+	for (tries = 0; tries < 2; tries++) {
+		link = ch->ch_linkv + ch->ch_aidx;
+
+		err = mpool_mlog_append_dmax(ch->ch_mp, link->cl_mlh, &dmax);
+		if (err)
+			break;
+
+		if (dmax < 0 || len > dmax) {
+			err = chlog_roll(ch);
+			if (err)
+				break;
+			link = ch->ch_linkv + ch->ch_aidx;
+		}
+
+		err = mpool_mlog_append_data(ch->ch_mp, link->cl_mlh, data,
+					     len, sync);
+		if (merr_errno(err) != EFBIG)
+			break;
+
+		/* Too big even for a fresh link */
+		if (ch->ch_recmax > 0 && len > ch->ch_recmax)
+			break;
+	}
+
+out:
+	mutex_unlock(&ch->ch_lock);
+
+	return err;
+}
+
+uint64_t
+mpool_chlog_flush(struct mpool_chlog *ch)
+{
+	merr_t err;
+
+	if (!ch)
+		return merr(EINVAL);
+
+	mutex_lock(&ch->ch_lock);
+	err = mpool_mlog_flush(ch->ch_mp, ch->ch_linkv[ch->ch_aidx].cl_mlh);
+	mutex_unlock(&ch->ch_lock);
+
+	return err;
+}
+
+uint64_t
+mpool_chlog_read_init(struct mpool_chlog *ch)
+{
+	if (!ch)
+		return merr(EINVAL);
+
+	mutex_lock(&ch->ch_lock);
+	if (ch->ch_ridx < ch->ch_aidx)
+		chlog_link_close(ch, ch->ch_linkv + ch->ch_ridx);
+	ch->ch_ridx = 0;
+	ch->ch_rinit = false;
+	mutex_unlock(&ch->ch_lock);
+
+	return 0;
+}
+
+/**
+ * chlog_read_hdr() - Position the reader past the header of its link
+ */
+static merr_t
+chlog_read_hdr(struct mpool_chlog *ch, struct chlog_link *link)
+{
+	struct chlog_hdr_omf    hdr;
+	merr_t                  err;
+	size_t                  rdlen;
+
+	err = chlog_link_open(ch, link);
+	if (err)
+		return err;
+
+	err = mpool_mlog_read_data_init(ch->ch_mp, link->cl_mlh);
+	if (err)
+		return err;
+
+	err = mpool_mlog_read_data_next(ch->ch_mp, link->cl_mlh, &hdr,
+					sizeof(hdr), &rdlen);
+	if (err)
+		return err;
+
+	if (rdlen != sizeof(hdr) || omf_pch_magic(&hdr) != CHLOG_MAGIC ||
+	    omf_pch_version(&hdr) != CHLOG_VERSION ||
+	    omf_pch_seq(&hdr) != link->cl_seq) {
+		err = merr(EBADMSG);
+		mp_pr_err("chlog link %lu objid 0x%lx bad header",
+			  err, (ulong)link->cl_seq, (ulong)link->cl_objid);
+		return err;
+	}
+
+	ch->ch_rinit = true;
+
+	return 0;
+}
+
+uint64_t
+mpool_chlog_read_next(
+	struct mpool_chlog *ch,
+	void               *data,
+	size_t              len,
+	size_t             *rdlen)
+{
+	struct chlog_link  *link;
+	merr_t              err;
+
+	if (!ch || !rdlen)
+		return merr(EINVAL);
+
+	*rdlen = 0;
+
+	mutex_lock(&ch->ch_lock);
+
+	while (true) {
+		link = ch->ch_linkv + ch->ch_ridx;
+
+		if (!ch->ch_rinit) {
+			err = chlog_read_hdr(ch, link);
+			if (err)
+				break;
+		}
+
+		err = mpool_mlog_read_data_next(ch->ch_mp, link->cl_mlh, data,
+						len, rdlen);
+		if (err || *rdlen > 0 || ch->ch_ridx >= ch->ch_aidx)
+			break;
+
+		/* End of a full link, move on to its successor */
+		chlog_link_close(ch, link);
+		ch->ch_ridx++;
+		ch->ch_rinit = false;
+	}
+
+	mutex_unlock(&ch->ch_lock);
+
+	return err;
+}
+
+uint64_t
+mpool_chlog_trunc(struct mpool_chlog *ch, uint64_t seq)
+{
+	struct chlog_link  *link;
+	merr_t              err = 0;
+	u32                 n;
+
+	if (!ch)
+		return merr(EINVAL);
+
+	mutex_lock(&ch->ch_lock);
+
+	/* Never drop the active link */
+	for (n = 0; n < ch->ch_aidx; n++)
+		if (ch->ch_linkv[n].cl_seq >= seq)
+			break;
+
+	if (n == 0)
+		goto out;
+
+	err = chlog_rec_append(ch, CHLOG_REC_TRUNC, ch->ch_linkv[n].cl_seq,
+			       0, 0, true);
+	if (err)
+		goto out;
+
+	for (link = ch->ch_linkv; link < ch->ch_linkv + n; link++) {
+		err = chlog_link_drop(ch, link, false);
+		if (err)
+			mp_pr_err("chlog link %lu objid 0x%lx drop failed",
+				  err, (ulong)link->cl_seq,
+				  (ulong)link->cl_objid);
+	}
+
+	ch->ch_linkc -= n;
+	ch->ch_aidx -= n;
+	memmove(ch->ch_linkv, ch->ch_linkv + n,
+		ch->ch_linkc * sizeof(*link));
+
+	if (ch->ch_ridx >= n) {
+		ch->ch_ridx -= n;
+	} else {
+		ch->ch_ridx = 0;
+		ch->ch_rinit = false;
+	}
+
+	err = chlog_mdc_compact(ch);
+
+out:
+	mutex_unlock(&ch->ch_lock);
+
+	return err;
+}
+
+uint64_t
+mpool_chlog_getprops(
+	struct mpool_chlog         *ch,
+	struct mpool_chlog_props   *props)
+{
+	if (!ch || !props)
+		return merr(EINVAL);
+
+	mutex_lock(&ch->ch_lock);
+	props->clp_headseq = ch->ch_linkv[0].cl_seq;
+	props->clp_tailseq = ch->ch_linkv[ch->ch_aidx].cl_seq;
+	props->clp_rdseq = ch->ch_linkv[ch->ch_ridx].cl_seq;
+	props->clp_nlinks = ch->ch_aidx + 1;
+	props->clp_nspares = ch->ch_linkc - ch->ch_aidx - 1;
+	mutex_unlock(&ch->ch_lock);
+
+	return 0;
+}
@@ -0,0 +1,1169 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Compressed mblock design pattern module.
+ *
+ * A compressed mblock holds a byte stream cut into fixed size frames, each
+ * compressed independently with a small LZ77 codec and packed back to back.
+ * A frame index and a trailer follow the frames; the trailer occupies the
+ * end of the last page so a reader can locate everything from the mblock
+ * write length alone:
+ *
+ *   [frame 0][frame 1]...[frame N-1][index][zero pad][trailer]
+ *
+ * Writers compress batches of frames in parallel on threads they own for
+ * their lifetime.  Readers decompress only the frames a range touches,
+ * straight from an mcache map of the mblock where one is available, and
+ * keep recently used frames in a small per-reader cache.
+ *
+ * Like mdc.c, this module is layered entirely on the public mpool API.
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include <util/alloc.h>
+#include <util/page.h>
+#include <util/minmax.h>
+#include <util/mutex.h>
+#include <util/omf.h>
+
+#include <mpool/mpool.h>
+#include <mpctl/icmb.h>
+
+#include "mpool_err.h"
+#include "logging.h"
+
+#define CMB_MAGIC               ((u32)0x434d4231)       /* "CMB1" */
+#define CMB_VERSION             (1)
+#define CMB_FRAMESZ_DFLT        (64 * 1024)
+#define CMB_FRAMESZ_MAX         (16 * 1024 * 1024)
+#define CMB_THREADS_DFLT        (4)
+#define CMB_THREADS_MAX         (64)
+#define CMB_BATCH_PER_THREAD    (4)
+#define CMB_CACHE_DFLT          (16)
+#define CMB_WBUFSZ              (1024 * 1024)
+
+#define CMB_FRAME_RAW           (0x1)
+
+#define CMB_LZ_MINMATCH         (4)
+#define CMB_LZ_LASTLITS         (8)
+#define CMB_LZ_HASHBITS         (12)
+#define CMB_LZ_MAXOFF           (65535)
+
+/**
+ * struct cmb_frame_omf - frame index entry
+ * @pcf_off:   byte offset of the frame in the mblock
+ * @pcf_csz:   stored (compressed) size
+ * @pcf_flags: CMB_FRAME_RAW if the frame is stored uncompressed
+ */
+struct cmb_frame_omf {
+	__le64  pcf_off;
+	__le32  pcf_csz;
+	__le32  pcf_flags;
+} __packed;
+
+OMF_SETGET(struct cmb_frame_omf, pcf_off, 64)
+OMF_SETGET(struct cmb_frame_omf, pcf_csz, 32)
+OMF_SETGET(struct cmb_frame_omf, pcf_flags, 32)
+
+/**
+ * struct cmb_trailer_omf - compressed mblock trailer
+ * @pct_magic:   CMB_MAGIC
+ * @pct_version: CMB_VERSION
+ * @pct_framesz: uncompressed frame size
+ * @pct_nframes: number of frames
+ * @pct_rawlen:  uncompressed length of the stream
+ * @pct_idxoff:  byte offset of the frame index
+ */
+struct cmb_trailer_omf {
+	__le32  pct_magic;
+	__le32  pct_version;
+	__le32  pct_framesz;
+	__le32  pct_nframes;
+	__le64  pct_rawlen;
+	__le64  pct_idxoff;
+} __packed;
+
+OMF_SETGET(struct cmb_trailer_omf, pct_magic, 32)
+OMF_SETGET(struct cmb_trailer_omf, pct_version, 32)
+OMF_SETGET(struct cmb_trailer_omf, pct_framesz, 32)
+OMF_SETGET(struct cmb_trailer_omf, pct_nframes, 32)
+OMF_SETGET(struct cmb_trailer_omf, pct_rawlen, 64)
+OMF_SETGET(struct cmb_trailer_omf, pct_idxoff, 64)
+
+struct cmb_frame {
+	u64     cf_off;
+	u32     cf_csz;
+	u32     cf_flags;
+};
+
+struct mpool_cmb_wr;
+
+/**
+ * struct cmb_worker - compression thread of a writer
+ * @cj_wr:    writer
+ * @cj_first: index of the first frame of each batch it compresses
+ */
+struct cmb_worker {
+	struct mpool_cmb_wr    *cj_wr;
+	u32                     cj_first;
+};
+
+/**
+ * struct mpool_cmb_wr - compressed mblock writer
+ * @cw_mp:      mpool handle
+ * @cw_mbid:    mblock being written
+ * @cw_framesz: uncompressed frame size
+ * @cw_nthreads: compression threads per batch, including the caller
+ * @cw_lock:    protects the batch state below
+ * @cw_workcv:  wakes up the compression threads
+ * @cw_donecv:  signaled when the last thread is done with a batch
+ * @cw_tidv:    compression threads, @cw_nthreads - 1 at most
+ * @cw_workv:   per-thread arguments
+ * @cw_tidc:    number of compression threads running
+ * @cw_batch:   batch sequence number
+ * @cw_nframes: frames in the current batch
+ * @cw_pending: threads not yet done with the current batch
+ * @cw_stop:    compression threads should exit
+ * @cw_cszv:    compressed size of each frame of the batch, 0 if raw
+ * @cw_raw:     uncompressed staging for one batch of frames
+ * @cw_rawlen:  bytes in cw_raw
+ * @cw_rawmax:  capacity of cw_raw (a whole number of frames)
+ * @cw_outv:    per-frame compression output
+ * @cw_wbuf:    page-aligned write buffer
+ * @cw_wlen:    bytes in cw_wbuf
+ * @cw_off:     mblock offset of cw_wbuf[0]
+ * @cw_framev:  frame index
+ * @cw_framec:  number of frames
+ * @cw_framemax: capacity of cw_framev
+ * @cw_total:   uncompressed bytes written
+ */
+struct mpool_cmb_wr {
+	struct mpool   *cw_mp;
+	u64             cw_mbid;
+	u32             cw_framesz;
+	u32             cw_nthreads;
+
+	struct mutex        cw_lock;
+	pthread_cond_t      cw_workcv;
+	pthread_cond_t      cw_donecv;
+	pthread_t           cw_tidv[CMB_THREADS_MAX];
+	struct cmb_worker   cw_workv[CMB_THREADS_MAX];
+	u32                 cw_tidc;
+	u32                 cw_batch;
+	u32                 cw_nframes;
+	u32                 cw_pending;
+	bool                cw_stop;
+	u32                 cw_cszv[CMB_THREADS_MAX * CMB_BATCH_PER_THREAD];
+
+	char           *cw_raw;
+	size_t          cw_rawlen;
+	size_t          cw_rawmax;
+	char           *cw_outv;
+
+	char           *cw_wbuf;
+	size_t          cw_wlen;
+	u64             cw_off;
+
+	struct cmb_frame *cw_framev;
+	u32             cw_framec;
+	u32             cw_framemax;
+
+	u64             cw_total;
+};
+
+struct cmb_cslot {
+	u32     cs_frame;
+	u32     cs_len;
+	u64     cs_tick;
+	char   *cs_buf;
+};
+
+/**
+ * struct mpool_cmb - compressed mblock reader
+ * @cmb_lock:    serializes reads (protects the cache and cmb_rbuf)
+ * @cmb_mp:      mpool handle
+ * @cmb_mbid:    mblock ID
+ * @cmb_wlen:    mblock write length
+ * @cmb_framesz: uncompressed frame size
+ * @cmb_rawlen:  uncompressed stream length
+ * @cmb_framev:  frame index
+ * @cmb_framec:  number of frames
+ * @cmb_map:     mcache map of the mblock, NULL if it could not be mapped
+ * @cmb_base:    base address of the mapped mblock
+ * @cmb_rbuf:    bounce buffer for compressed frames, used when unmapped
+ * @cmb_slotv:   decompressed frame cache
+ * @cmb_slotc:   number of cache slots
+ * @cmb_tick:    LRU clock
+ */
+struct mpool_cmb {
+	struct mutex        cmb_lock;
+	struct mpool       *cmb_mp;
+	u64                 cmb_mbid;
+	u64                 cmb_wlen;
+	u32                 cmb_framesz;
+	u64                 cmb_rawlen;
+	struct cmb_frame   *cmb_framev;
+	u32                 cmb_framec;
+	struct mpool_mcache_map *cmb_map;
+	const char         *cmb_base;
+	char               *cmb_rbuf;
+	struct cmb_cslot   *cmb_slotv;
+	u32                 cmb_slotc;
+	u64                 cmb_tick;
+	u64                 cmb_hits;
+	u64                 cmb_misses;
+};
+
+/*
+ * LZ77 codec.  Sequences are encoded as
+ *
+ *   token (literal len:4 | match len - 4:4), [literal len ext], literals,
+ *   offset (le16), [match len ext]
+ *
+ * and the last sequence carries literals only.  Lengths of 15 or more are
+ * continued in following bytes, each 255 meaning "add 255 and continue".
+ */
+
+static inline u32
+cmb_load32(const u8 *p)
+{
+	u32 v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+static inline u32
+cmb_lz_hash(u32 v)
+{
+	return (v * 2654435761u) >> (32 - CMB_LZ_HASHBITS);
+}
+
+static inline u8 *
+cmb_lz_putlen(u8 *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+
+	return op;
+}
+
+static u8 *
+cmb_lz_emit(
+	u8         *op,
+	u8         *oend,
+	const u8   *lit,
+	size_t      litlen,
+	size_t      off,
+	size_t      mlen)
+{
+	u8     *token;
+	size_t  need;
+
+	need = 1 + litlen + litlen / 255 + 1 + (off ? 2 + mlen / 255 + 1 : 0);
+	if (need > oend - op)
+		return NULL;
+
+	token = op++;
+	*token = min_t(size_t, litlen, 15) << 4;
+	if (litlen >= 15)
+		op = cmb_lz_putlen(op, litlen - 15);
+
+	memcpy(op, lit, litlen);
+	op += litlen;
+
+	if (!off)
+		return op;
+
+	*op++ = off & 0xff;
+	*op++ = off >> 8;
+
+	mlen -= CMB_LZ_MINMATCH;
+	*token |= min_t(size_t, mlen, 15);
+	if (mlen >= 15)
+		op = cmb_lz_putlen(op, mlen - 15);
+
+	return op;
+}
+
+size_t
+cmb_lz_compress(const void *srcp, size_t srclen, void *dstp, size_t dstcap)
+{
+	u32         htab[1u << CMB_LZ_HASHBITS];
+	const u8   *src = srcp, *ip, *anchor, *ref, *mlimit, *end;
+	u8         *op = dstp, *oend = op + dstcap;
+	size_t      step;
+	u32         h;
+
+	memset(htab, 0, sizeof(htab));
+
+	end = src + srclen;
+	ip = anchor = src;
+
+	if (srclen > CMB_LZ_LASTLITS + CMB_LZ_MINMATCH) {
+		mlimit = end - CMB_LZ_LASTLITS;
+
+		while (ip + CMB_LZ_MINMATCH <= mlimit) {
+			const u8 *mp, *rp;
+
+			h = cmb_lz_hash(cmb_load32(ip));
+			ref = htab[h] ? src + htab[h] - 1 : NULL;
+			htab[h] = ip - src + 1;
+
+			if (!ref || ip - ref > CMB_LZ_MAXOFF ||
+			    cmb_load32(ref) != cmb_load32(ip)) {
+				/* Skip faster through incompressible data */
+				step = 1 + ((ip - anchor) >> 6);
+				ip += step;
+				continue;
+			}
+
+			mp = ip + CMB_LZ_MINMATCH;
+			rp = ref + CMB_LZ_MINMATCH;
+			while (mp < mlimit && *mp == *rp) {
+				mp++;
+				rp++;
+			}
+
+			op = cmb_lz_emit(op, oend, anchor, ip - anchor,
+					 ip - ref, mp - ip);
+			if (!op)
+				return 0;
+
+			ip = anchor = mp;
+		}
+	}
+
+	op = cmb_lz_emit(op, oend, anchor, end - anchor, 0, 0);
+	if (!op)
+		return 0;
+
+	return op - (u8 *)dstp;
+}
+
+ssize_t
+cmb_lz_decompress(const void *srcp, size_t srclen, void *dstp, size_t dstcap)
+{
+	const u8   *ip = srcp, *iend = ip + srclen;
+	u8         *dst = dstp, *op = dst, *oend = dst + dstcap;
+	size_t      litlen, mlen, off;
+	u8          token, b;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		litlen = token >> 4;
+		if (litlen == 15) {
+			do {
+				if (ip >= iend)
+					return -1;
+				b = *ip++;
+				litlen += b;
+			} while (b == 255);
+		}
+
+		if (litlen > iend - ip || litlen > oend - op)
+			return -1;
+
+		memcpy(op, ip, litlen);
+		ip += litlen;
+		op += litlen;
+
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		if (off == 0 || off > op - dst)
+			return -1;
+
+		mlen = token & 15;
+		if (mlen == 15) {
+			do {
+				if (ip >= iend)
+					return -1;
+				b = *ip++;
+				mlen += b;
+			} while (b == 255);
+		}
+		mlen += CMB_LZ_MINMATCH;
+
+		if (mlen > oend - op)
+			return -1;
+
+		/* Overlapping copy is how runs are encoded */
+		while (mlen-- > 0) {
+			*op = *(op - off);
+			op++;
+		}
+	}
+
+	return op - dst;
+}
+
+/*
+ * Writer
+ */
+
+static merr_t
+cmb_wr_flush(struct mpool_cmb_wr *wr, bool final)
+{
+	struct iovec    iov;
+	merr_t          err;
+	size_t          len;
+
+	len = final ? ALIGN(wr->cw_wlen, PAGE_SIZE) : wr->cw_wlen & PAGE_MASK;
+	if (len == 0)
+		return 0;
+
+	if (final)
+		memset(wr->cw_wbuf + wr->cw_wlen, 0, len - wr->cw_wlen);
+
+	iov.iov_base = wr->cw_wbuf;
+	iov.iov_len = len;
+
+	err = mpool_mblock_write(wr->cw_mp, wr->cw_mbid, &iov, 1);
+	if (err)
+		return err;
+
+	wr->cw_off += len;
+
+	if (!final)
+		memmove(wr->cw_wbuf, wr->cw_wbuf + len, wr->cw_wlen - len);
+	wr->cw_wlen = final ? 0 : wr->cw_wlen - len;
+
+	return 0;
+}
+
+static merr_t
+cmb_wr_append(struct mpool_cmb_wr *wr, const void *data, size_t len)
+{
+	merr_t  err;
+	size_t  cc;
+
+	while (len > 0) {
+		cc = min_t(size_t, len, CMB_WBUFSZ - wr->cw_wlen);
+
+		memcpy(wr->cw_wbuf + wr->cw_wlen, data, cc);
+		wr->cw_wlen += cc;
+		data = (const char *)data + cc;
+		len -= cc;
+
+		if (wr->cw_wlen >= CMB_WBUFSZ) {
+			err = cmb_wr_flush(wr, false);
+			if (err)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * cmb_compress_frames() - Compress every @stride-th frame of the batch
+ * from frame @first
+ */
+static void
+cmb_compress_frames(
+	struct mpool_cmb_wr    *wr,
+	u32                     first,
+	u32                     stride,
+	u32                     nframes)
+{
+	size_t  off, len;
+	u32     i;
+
+	for (i = first; i < nframes; i += stride) {
+		off = (size_t)i * wr->cw_framesz;
+		len = min_t(size_t, wr->cw_rawlen - off, wr->cw_framesz);
+
+		wr->cw_cszv[i] = cmb_lz_compress(wr->cw_raw + off, len,
+						 wr->cw_outv + off, len - 1);
+	}
+}
+
+/**
+ * cmb_worker() - Compress this thread's share of each batch until the
+ * writer is freed
+ */
+static void *
+cmb_worker(void *arg)
+{
+	struct cmb_worker      *job = arg;
+	struct mpool_cmb_wr    *wr = job->cj_wr;
+	u32                     batch = 0, stride, nframes;
+
+	mutex_lock(&wr->cw_lock);
+	while (true) {
+		if (wr->cw_stop)
+			break;
+
+		if (wr->cw_batch == batch) {
+			pthread_cond_wait(&wr->cw_workcv,
+					  &wr->cw_lock.pth_mutex);
+			continue;
+		}
+
+		batch = wr->cw_batch;
+		stride = wr->cw_tidc + 1;
+		nframes = wr->cw_nframes;
+		mutex_unlock(&wr->cw_lock);
+
+		cmb_compress_frames(wr, job->cj_first, stride, nframes);
+
+		mutex_lock(&wr->cw_lock);
+		if (--wr->cw_pending == 0)
+			pthread_cond_signal(&wr->cw_donecv);
+	}
+	mutex_unlock(&wr->cw_lock);
+
+	return NULL;
+}
+
+/**
+ * cmb_wr_batch() - Compress the staged frames and append them
+ *
+ * Frames are distributed round-robin over the writer's compression
+ * threads and the caller, which compresses the first share.
+ */
+static merr_t
+cmb_wr_batch(struct mpool_cmb_wr *wr)
+{
+	struct cmb_frame *frame;
+	merr_t          err;
+	size_t          off, len;
+	u32             nframes, i;
+	const char     *src;
+
+	if (wr->cw_rawlen == 0)
+		return 0;
+
+	nframes = (wr->cw_rawlen + wr->cw_framesz - 1) / wr->cw_framesz;
+
+	if (wr->cw_framec + nframes > wr->cw_framemax) {
+		u32 framemax = max_t(u32, wr->cw_framemax * 2, 256);
+
+		while (framemax < wr->cw_framec + nframes)
+			framemax *= 2;
+
+		frame = realloc(wr->cw_framev, framemax * sizeof(*frame));
+		if (!frame)
+			return merr(ENOMEM);
+
+		wr->cw_framev = frame;
+		wr->cw_framemax = framemax;
+	}
+
+	if (wr->cw_tidc > 0 && nframes > 1) {
+		mutex_lock(&wr->cw_lock);
+		wr->cw_nframes = nframes;
+		wr->cw_pending = wr->cw_tidc;
+		wr->cw_batch++;
+		pthread_cond_broadcast(&wr->cw_workcv);
+		mutex_unlock(&wr->cw_lock);
+
+		cmb_compress_frames(wr, 0, wr->cw_tidc + 1, nframes);
+
+		mutex_lock(&wr->cw_lock);
+		while (wr->cw_pending > 0)
+			pthread_cond_wait(&wr->cw_donecv,
+					  &wr->cw_lock.pth_mutex);
+		mutex_unlock(&wr->cw_lock);
+	} else {
+		cmb_compress_frames(wr, 0, 1, nframes);
+	}
+
+	for (i = 0; i < nframes; i++) {
+		off = (size_t)i * wr->cw_framesz;
+		len = min_t(size_t, wr->cw_rawlen - off, wr->cw_framesz);
+
+		frame = wr->cw_framev + wr->cw_framec + i;
+		frame->cf_off = wr->cw_off + wr->cw_wlen;
+		frame->cf_flags = 0;
+
+		if (wr->cw_cszv[i] > 0) {
+			src = wr->cw_outv + off;
+			frame->cf_csz = wr->cw_cszv[i];
+		} else {
+			src = wr->cw_raw + off;
+			frame->cf_csz = len;
+			frame->cf_flags = CMB_FRAME_RAW;
+		}
+
+		err = cmb_wr_append(wr, src, frame->cf_csz);
+		if (err)
+			return err;
+	}
+
+	wr->cw_framec += nframes;
+	wr->cw_rawlen = 0;
+
+	return 0;
+}
+
+static void
+cmb_wr_free(struct mpool_cmb_wr *wr)
+{
+	u32 i;
+
+	mutex_lock(&wr->cw_lock);
+	wr->cw_stop = true;
+	pthread_cond_broadcast(&wr->cw_workcv);
+	mutex_unlock(&wr->cw_lock);
+
+	for (i = 0; i < wr->cw_tidc; i++)
+		pthread_join(wr->cw_tidv[i], NULL);
+
+	pthread_cond_destroy(&wr->cw_donecv);
+	pthread_cond_destroy(&wr->cw_workcv);
+	mutex_destroy(&wr->cw_lock);
+
+	free(wr->cw_raw);
+	free(wr->cw_outv);
+	free(wr->cw_wbuf);
+	kfree(wr->cw_framev);
+	kfree(wr);
+}
+
+uint64_t
+mpool_cmb_alloc(
+	struct mpool                   *mp,
+	enum mp_media_classp            mclassp,
+	const struct mpool_cmb_params  *params,
+	struct mpool_cmb_wr           **wrp)
+{
+	struct mpool_cmb_wr    *wr;
+	merr_t                  err;
+	u32                     framesz, nthreads, i;
+
+	if (!mp || !wrp)
+		return merr(EINVAL);
+
+	framesz = params ? params->cp_framesz : 0;
+	nthreads = params ? params->cp_threads : 0;
+
+	if (framesz == 0)
+		framesz = CMB_FRAMESZ_DFLT;
+	if (nthreads == 0)
+		nthreads = CMB_THREADS_DFLT;
+
+	if (framesz > CMB_FRAMESZ_MAX || !PAGE_ALIGNED(framesz) ||
+	    nthreads > CMB_THREADS_MAX)
+		return merr(EINVAL);
+
+	wr = kzalloc(sizeof(*wr), GFP_KERNEL);
+	if (!wr)
+		return merr(ENOMEM);
+
+	wr->cw_mp = mp;
+	wr->cw_framesz = framesz;
+	wr->cw_nthreads = nthreads;
+	wr->cw_rawmax = (size_t)framesz * nthreads * CMB_BATCH_PER_THREAD;
+
+	mutex_init(&wr->cw_lock);
+	pthread_cond_init(&wr->cw_workcv, NULL);
+	pthread_cond_init(&wr->cw_donecv, NULL);
+
+	wr->cw_raw = aligned_alloc(PAGE_SIZE, wr->cw_rawmax);
+	wr->cw_outv = aligned_alloc(PAGE_SIZE, wr->cw_rawmax);
+	wr->cw_wbuf = aligned_alloc(PAGE_SIZE, CMB_WBUFSZ + PAGE_SIZE);
+	if (!wr->cw_raw || !wr->cw_outv || !wr->cw_wbuf) {
+		cmb_wr_free(wr);
+		return merr(ENOMEM);
+	}
+
+	err = mpool_mblock_alloc(mp, mclassp, false, &wr->cw_mbid, NULL);
+	if (err) {
+		cmb_wr_free(wr);
+		return err;
+	}
+
+	/* With fewer threads than asked for, the caller does more work */
+	for (i = 1; i < nthreads; i++) {
+		struct cmb_worker *job = wr->cw_workv + wr->cw_tidc;
+
+		job->cj_wr = wr;
+		job->cj_first = wr->cw_tidc + 1;
+
+		if (pthread_create(wr->cw_tidv + wr->cw_tidc, NULL,
+				   cmb_worker, job))
+			break;
+		wr->cw_tidc++;
+	}
+
+	*wrp = wr;
+
+	return 0;
+}
+
+uint64_t
+mpool_cmb_write(
+	struct mpool_cmb_wr    *wr,
+	const void             *data,
+	size_t                  len)
+{
+	merr_t  err;
+	size_t  cc;
+
+	if (!wr || (!data && len > 0))
+		return merr(EINVAL);
+
+	while (len > 0) {
+		cc = min_t(size_t, len, wr->cw_rawmax - wr->cw_rawlen);
+
+		memcpy(wr->cw_raw + wr->cw_rawlen, data, cc);
+		wr->cw_rawlen += cc;
+		wr->cw_total += cc;
+		data = (const char *)data + cc;
+		len -= cc;
+
+		if (wr->cw_rawlen == wr->cw_rawmax) {
+			err = cmb_wr_batch(wr);
+			if (err)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
+uint64_t
+mpool_cmb_commit(
+	struct mpool_cmb_wr    *wr,
+	uint64_t               *mbidp)
+{
+	struct cmb_trailer_omf  trl;
+	struct cmb_frame_omf    fomf;
+	merr_t                  err;
+	u64                     idxoff;
+	size_t                  pad;
+	u32                     i;
+
+	if (!wr || !mbidp)
+		return merr(EINVAL);
+
+	err = cmb_wr_batch(wr);
+	if (err)
+		return err;
+
+	idxoff = wr->cw_off + wr->cw_wlen;
+
+	for (i = 0; i < wr->cw_framec && !err; i++) {
+		omf_set_pcf_off(&fomf, wr->cw_framev[i].cf_off);
+		omf_set_pcf_csz(&fomf, wr->cw_framev[i].cf_csz);
+		omf_set_pcf_flags(&fomf, wr->cw_framev[i].cf_flags);
+
+		err = cmb_wr_append(wr, &fomf, sizeof(fomf));
+	}
+	if (err)
+		return err;
+
+	/* Place the trailer at the very end of the last page */
+	pad = ALIGN(wr->cw_wlen + sizeof(trl), PAGE_SIZE) -
+		(wr->cw_wlen + sizeof(trl));
+	while (pad > 0 && !err) {
+		static const char zero[256];
+		size_t cc = min_t(size_t, pad, sizeof(zero));
+
+		err = cmb_wr_append(wr, zero, cc);
+		pad -= cc;
+	}
+	if (err)
+		return err;
+
+	memset(&trl, 0, sizeof(trl));
+	omf_set_pct_magic(&trl, CMB_MAGIC);
+	omf_set_pct_version(&trl, CMB_VERSION);
+	omf_set_pct_framesz(&trl, wr->cw_framesz);
+	omf_set_pct_nframes(&trl, wr->cw_framec);
+	omf_set_pct_rawlen(&trl, wr->cw_total);
+	omf_set_pct_idxoff(&trl, idxoff);
+
+	err = cmb_wr_append(wr, &trl, sizeof(trl));
+	if (!err)
+		err = cmb_wr_flush(wr, true);
+	if (!err)
+		err = mpool_mblock_commit(wr->cw_mp, wr->cw_mbid);
+	if (err)
+		return err;
+
+	*mbidp = wr->cw_mbid;
+
+	cmb_wr_free(wr);
+
+	return 0;
+}
+
+uint64_t
+mpool_cmb_abort(
+	struct mpool_cmb_wr    *wr)
+{
+	merr_t err;
+
+	if (!wr)
+		return merr(EINVAL);
+
+	err = mpool_mblock_abort(wr->cw_mp, wr->cw_mbid);
+
+	cmb_wr_free(wr);
+
+	return err;
+}
+
+/*
+ * Reader
+ */
+
+static merr_t
+cmb_read_range(struct mpool_cmb *cmb, u64 off, size_t len, void *buf)
+{
+	struct iovec    iov;
+	merr_t          err;
+	u64             start, end;
+
+	start = off & PAGE_MASK;
+	end = ALIGN(off + len, PAGE_SIZE);
+
+	iov.iov_base = cmb->cmb_rbuf;
+	iov.iov_len = end - start;
+
+	err = mpool_mblock_read(cmb->cmb_mp, cmb->cmb_mbid, &iov, 1, start);
+	if (err)
+		return err;
+
+	if (buf)
+		memcpy(buf, cmb->cmb_rbuf + (off - start), len);
+
+	return 0;
+}
+
+/**
+ * cmb_frame_get() - Return the decompressed contents of a frame
+ *
+ * Serves from the cache if possible, otherwise evicts the least recently
+ * used slot.
+ */
+static merr_t
+cmb_frame_get(struct mpool_cmb *cmb, u32 fidx, struct cmb_cslot **slotp)
+{
+	struct cmb_frame   *frame = cmb->cmb_framev + fidx;
+	struct cmb_cslot   *slot, *victim;
+	merr_t              err;
+	ssize_t             len;
+	u64                 rawlen;
+	char               *src;
+	u32                 i;
+
+	victim = cmb->cmb_slotv;
+
+	for (i = 0; i < cmb->cmb_slotc; i++) {
+		slot = cmb->cmb_slotv + i;
+
+		if (slot->cs_frame == fidx) {
+			slot->cs_tick = ++cmb->cmb_tick;
+			cmb->cmb_hits++;
+			*slotp = slot;
+			return 0;
+		}
+
+		if (slot->cs_tick < victim->cs_tick)
+			victim = slot;
+	}
+
+	cmb->cmb_misses++;
+
+	rawlen = min_t(u64, cmb->cmb_rawlen - (u64)fidx * cmb->cmb_framesz,
+		       cmb->cmb_framesz);
+
+	if (cmb->cmb_base) {
+		src = (char *)cmb->cmb_base + frame->cf_off;
+		mpool_mcache_access(cmb->cmb_map, 0, frame->cf_off,
+				    frame->cf_csz);
+	} else {
+		err = cmb_read_range(cmb, frame->cf_off, frame->cf_csz, NULL);
+		if (err)
+			return err;
+
+		src = cmb->cmb_rbuf + (frame->cf_off & ~PAGE_MASK);
+	}
+
+	victim->cs_frame = U32_MAX;
+
+	if (frame->cf_flags & CMB_FRAME_RAW) {
+		len = min_t(size_t, frame->cf_csz, cmb->cmb_framesz);
+		memcpy(victim->cs_buf, src, len);
+	} else {
+		len = cmb_lz_decompress(src, frame->cf_csz, victim->cs_buf,
+					cmb->cmb_framesz);
+	}
+
+	if (len != rawlen) {
+		err = merr(EBADMSG);
+		mp_pr_err("cmb mblock 0x%lx frame %u: corrupt, len %ld exp %lu",
+			  err, (ulong)cmb->cmb_mbid, fidx, (long)len,
+			  (ulong)rawlen);
+		return err;
+	}
+
+	victim->cs_frame = fidx;
+	victim->cs_len = len;
+	victim->cs_tick = ++cmb->cmb_tick;
+
+	*slotp = victim;
+
+	return 0;
+}
+
+static void
+cmb_free(struct mpool_cmb *cmb)
+{
+	u32 i;
+
+	if (cmb->cmb_slotv)
+		for (i = 0; i < cmb->cmb_slotc; i++)
+			free(cmb->cmb_slotv[i].cs_buf);
+
+	if (cmb->cmb_map)
+		mpool_mcache_munmap(cmb->cmb_map);
+
+	kfree(cmb->cmb_slotv);
+	kfree(cmb->cmb_framev);
+	free(cmb->cmb_rbuf);
+	mutex_destroy(&cmb->cmb_lock);
+	kfree(cmb);
+}
+
+uint64_t
+mpool_cmb_open(
+	struct mpool       *mp,
+	uint64_t            mbid,
+	uint32_t            cache_frames,
+	struct mpool_cmb  **cmbp)
+{
+	struct cmb_trailer_omf  trl;
+	struct cmb_frame_omf   *fomf;
+	struct mblock_props     props;
+	struct mpool_cmb       *cmb;
+	merr_t                  err;
+	size_t                  idxsz;
+	char                   *idxbuf = NULL;
+	u32                     i;
+
+	if (!mp || !cmbp)
+		return merr(EINVAL);
+
+	err = mpool_mblock_getprops(mp, mbid, &props);
+	if (err)
+		return err;
+
+	if (!props.mpr_iscommitted || props.mpr_write_len < PAGE_SIZE)
+		return merr(EINVAL);
+
+	cmb = kzalloc(sizeof(*cmb), GFP_KERNEL);
+	if (!cmb)
+		return merr(ENOMEM);
+
+	mutex_init(&cmb->cmb_lock);
+	cmb->cmb_mp = mp;
+	cmb->cmb_mbid = mbid;
+	cmb->cmb_wlen = props.mpr_write_len;
+
+	cmb->cmb_rbuf = aligned_alloc(PAGE_SIZE, PAGE_SIZE * 2);
+	if (!cmb->cmb_rbuf) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	err = cmb_read_range(cmb, cmb->cmb_wlen - sizeof(trl), sizeof(trl),
+			     &trl);
+	if (err)
+		goto errout;
+
+	if (omf_pct_magic(&trl) != CMB_MAGIC ||
+	    omf_pct_version(&trl) != CMB_VERSION) {
+		err = merr(EBADMSG);
+		goto errout;
+	}
+
+	cmb->cmb_framesz = omf_pct_framesz(&trl);
+	cmb->cmb_framec = omf_pct_nframes(&trl);
+	cmb->cmb_rawlen = omf_pct_rawlen(&trl);
+
+	idxsz = (size_t)cmb->cmb_framec * sizeof(*fomf);
+
+	if (cmb->cmb_framesz == 0 || cmb->cmb_framesz > CMB_FRAMESZ_MAX ||
+	    omf_pct_idxoff(&trl) + idxsz > cmb->cmb_wlen ||
+	    cmb->cmb_rawlen > (u64)cmb->cmb_framec * cmb->cmb_framesz) {
+		err = merr(EBADMSG);
+		goto errout;
+	}
+
+	/* The bounce buffer must hold the index and any stored frame */
+	free(cmb->cmb_rbuf);
+	cmb->cmb_rbuf = aligned_alloc(PAGE_SIZE,
+			ALIGN(max_t(size_t, idxsz, cmb->cmb_framesz),
+			      PAGE_SIZE) + PAGE_SIZE);
+	idxbuf = malloc(idxsz + 1);
+	cmb->cmb_framev = kcalloc(cmb->cmb_framec + 1,
+				  sizeof(*cmb->cmb_framev), GFP_KERNEL);
+	if (!cmb->cmb_rbuf || !idxbuf || !cmb->cmb_framev) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	if (idxsz > 0) {
+		err = cmb_read_range(cmb, omf_pct_idxoff(&trl), idxsz, idxbuf);
+		if (err)
+			goto errout;
+	}
+
+	fomf = (void *)idxbuf;
+	for (i = 0; i < cmb->cmb_framec; i++, fomf++) {
+		struct cmb_frame *frame = cmb->cmb_framev + i;
+
+		frame->cf_off = omf_pcf_off(fomf);
+		frame->cf_csz = omf_pcf_csz(fomf);
+		frame->cf_flags = omf_pcf_flags(fomf);
+
+		if (frame->cf_off + frame->cf_csz > omf_pct_idxoff(&trl) ||
+		    frame->cf_csz > cmb->cmb_framesz) {
+			err = merr(EBADMSG);
+			goto errout;
+		}
+	}
+
+	cmb->cmb_slotc = cache_frames ?: CMB_CACHE_DFLT;
+	cmb->cmb_slotv = kcalloc(cmb->cmb_slotc, sizeof(*cmb->cmb_slotv),
+				 GFP_KERNEL);
+	if (!cmb->cmb_slotv) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	for (i = 0; i < cmb->cmb_slotc; i++) {
+		cmb->cmb_slotv[i].cs_frame = U32_MAX;
+		cmb->cmb_slotv[i].cs_buf = malloc(cmb->cmb_framesz);
+		if (!cmb->cmb_slotv[i].cs_buf) {
+			err = merr(ENOMEM);
+			goto errout;
+		}
+	}
+
+	free(idxbuf);
+
+	/*
+	 * Decompress frames straight from the page cache where the mblock
+	 * can be mapped, so that random reads cost no bounce buffer copy and
+	 * benefit from mcache readahead adapting to the access pattern.
+	 */
+	if (!mpool_mcache_mmap(mp, 1, &mbid, MPC_VMA_COLD, &cmb->cmb_map)) {
+		cmb->cmb_base = mpool_mcache_getbase(cmb->cmb_map, 0);
+		if (!cmb->cmb_base) {
+			mpool_mcache_munmap(cmb->cmb_map);
+			cmb->cmb_map = NULL;
+		}
+	}
+
+	*cmbp = cmb;
+
+	return 0;
+
+errout:
+	if (merr_errno(err) == EBADMSG)
+		mp_pr_err("cmb mblock 0x%lx: bad trailer or index",
+			  err, (ulong)mbid);
+	free(idxbuf);
+	cmb_free(cmb);
+
+	return err;
+}
+
+uint64_t
+mpool_cmb_close(
+	struct mpool_cmb   *cmb)
+{
+	if (!cmb)
+		return merr(EINVAL);
+
+	cmb_free(cmb);
+
+	return 0;
+}
+
+uint64_t
+mpool_cmb_read(
+	struct mpool_cmb   *cmb,
+	void               *buf,
+	size_t              len,
+	uint64_t            off,
+	size_t             *rdlen)
+{
+	struct cmb_cslot   *slot = NULL;
+	merr_t              err = 0;
+	size_t              done, cc, foff;
+	u32                 fidx;
+
+	if (!cmb || (!buf && len > 0) || !rdlen)
+		return merr(EINVAL);
+
+	*rdlen = 0;
+
+	if (off >= cmb->cmb_rawlen)
+		return 0;
+
+	len = min_t(u64, len, cmb->cmb_rawlen - off);
+
+	mutex_lock(&cmb->cmb_lock);
+	for (done = 0; done < len; done += cc) {
+		fidx = (off + done) / cmb->cmb_framesz;
+		foff = (off + done) % cmb->cmb_framesz;
+
+		err = cmb_frame_get(cmb, fidx, &slot);
+		if (err)
+			break;
+
+		cc = min_t(size_t, len - done, slot->cs_len - foff);
+		memcpy((char *)buf + done, slot->cs_buf + foff, cc);
+	}
+	mutex_unlock(&cmb->cmb_lock);
+
+	*rdlen = done;
+
+	return err;
+}
+
+uint64_t
+mpool_cmb_getprops(
+	struct mpool_cmb           *cmb,
+	struct mpool_cmb_props     *props)
+{
+	if (!cmb || !props)
+		return merr(EINVAL);
+
+	memset(props, 0, sizeof(*props));
+
+	mutex_lock(&cmb->cmb_lock);
+	props->cmp_rawlen = cmb->cmb_rawlen;
+	props->cmp_storedlen = cmb->cmb_wlen;
+	props->cmp_framesz = cmb->cmb_framesz;
+	props->cmp_nframes = cmb->cmb_framec;
+	props->cmp_cache_hits = cmb->cmb_hits;
+	props->cmp_cache_misses = cmb->cmb_misses;
+	props->cmp_mapped = !!cmb->cmb_map;
+	mutex_unlock(&cmb->cmb_lock);
+
+	return 0;
+}
@@ -0,0 +1,1289 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Mblock deduplication design pattern module.
+ *
+ * Mblocks written through a dedup writer are fingerprinted with a fast
+ * 128-bit content hash as the data is written.  Small mblocks are staged in
+ * memory and never written if their content already exists; larger ones
+ * are spilled to a real mblock and dropped at commit if they turn out to be
+ * duplicates.  A fingerprint match is always confirmed by comparing the
+ * content before the existing mblock is shared.
+ *
+ * The fingerprint index and per-mblock reference counts are persisted in an
+ * MDC.  Each state change is a single record carrying the absolute refcount,
+ * so replay is a simple last-writer-wins pass.  The MDC is compacted by
+ * rewriting one record per indexed mblock.  A spill mblock is journaled as
+ * pending before it is committed, and deleted at open if a crash left it
+ * neither indexed nor released.
+ *
+ * Like mdc.c, this module is layered entirely on the public mpool API.
+ */
+
+#include <string.h>
+#include <sys/uio.h>
+
+#include <util/alloc.h>
+#include <util/page.h>
+#include <util/minmax.h>
+#include <util/mutex.h>
+#include <util/omf.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+#include "logging.h"
+
+#define DD_TAB_MIN              (1u << 10)
+#define DD_ENT_INVALID          ((u32)-1)
+#define DD_CMPBUFSZ             (1024 * 1024)
+#define DD_STAGESZ_DFLT         (4 * 1024 * 1024)
+#define DD_MDC_COMPACT_MIN      (1024 * 1024)
+#define DD_MDC_COMPACT_RATIO    (4)
+
+#define DD_REC_PENDING          (0x1)
+
+#define DD_SEED0                (0x9e3779b97f4a7c15ull)
+#define DD_SEED1                (0xc2b2ae3d27d4eb4full)
+#define DD_PRIME1               (0x9e3779b185ebca87ull)
+#define DD_PRIME2               (0xc2b2ae3d27d4eb4full)
+#define DD_PRIME3               (0x165667b19e3779f9ull)
+#define DD_PRIME4               (0x85ebca77c2b2ae63ull)
+
+/**
+ * struct dd_rec_omf - dedup index MDC record
+ * @pdr_fp0:    content fingerprint, low half
+ * @pdr_fp1:    content fingerprint, high half
+ * @pdr_mbid:   mblock ID
+ * @pdr_len:    content length in bytes
+ * @pdr_refcnt: absolute reference count, 0 means the mblock was deleted
+ * @pdr_flags:  DD_REC_PENDING: @pdr_mbid is a spill mblock being committed,
+ *              a later record for it indexes or releases it
+ */
+struct dd_rec_omf {
+	__le64  pdr_fp0;
+	__le64  pdr_fp1;
+	__le64  pdr_mbid;
+	__le64  pdr_len;
+	__le32  pdr_refcnt;
+	__le32  pdr_flags;
+} __packed;
+
+OMF_SETGET(struct dd_rec_omf, pdr_fp0, 64)
+OMF_SETGET(struct dd_rec_omf, pdr_fp1, 64)
+OMF_SETGET(struct dd_rec_omf, pdr_mbid, 64)
+OMF_SETGET(struct dd_rec_omf, pdr_len, 64)
+OMF_SETGET(struct dd_rec_omf, pdr_refcnt, 32)
+OMF_SETGET(struct dd_rec_omf, pdr_flags, 32)
+
+/**
+ * struct dd_ent - indexed mblock
+ */
+struct dd_ent {
+	u64     de_fp[2];
+	u64     de_mbid;
+	u64     de_len;
+	u32     de_refcnt;
+};
+
+enum dd_slot_state {
+	DD_SLOT_EMPTY = 0,
+	DD_SLOT_USED,
+	DD_SLOT_TOMB,
+};
+
+struct dd_slot {
+	u64     ds_key;
+	u32     ds_ent;
+	u8      ds_state;
+};
+
+/**
+ * struct dd_tab - multimap from a 64-bit key to entry indices
+ *
+ * Open addressing with linear probing.  Keys need not be unique, the
+ * (key, entry) pair is.
+ */
+struct dd_tab {
+	struct dd_slot *dt_slotv;
+	u32             dt_sz;
+	u32             dt_cnt;
+	u32             dt_tomb;
+};
+
+/**
+ * struct mpool_dedup - dedup layer handle
+ * @dd_lock:   serializes commits, deletes and index access
+ * @dd_mp:     mpool handle
+ * @dd_mdc:    MDC holding the fingerprint index
+ * @dd_params: tunables
+ * @dd_entv:   indexed mblocks, densely packed
+ * @dd_entc:   number of entries in use
+ * @dd_entmax: capacity of dd_entv
+ * @dd_fptab:  fingerprint (low half) -> entry
+ * @dd_mbtab:  mblock ID -> entry
+ * @dd_pendv:  spill mblocks journaled as pending, not yet indexed or released
+ * @dd_pendc:  number of entries in use
+ * @dd_pendmax: capacity of dd_pendv
+ * @dd_snapsz: MDC usage right after the last compaction
+ */
+struct mpool_dedup {
+	struct mutex                dd_lock;
+	struct mpool               *dd_mp;
+	struct mpool_mdc           *dd_mdc;
+	struct mpool_dedup_params   dd_params;
+
+	struct dd_ent              *dd_entv;
+	u32                         dd_entc;
+	u32                         dd_entmax;
+
+	struct dd_tab               dd_fptab;
+	struct dd_tab               dd_mbtab;
+
+	u64                        *dd_pendv;
+	u32                         dd_pendc;
+	u32                         dd_pendmax;
+
+	size_t                      dd_snapsz;
+};
+
+/**
+ * struct mpool_dedup_wr - dedup writer
+ * @dw_dd:      dedup layer handle
+ * @dw_mclassp: media class
+ * @dw_stage:   staging buffer
+ * @dw_len:     bytes written so far
+ * @dw_mbid:    spill mblock, 0 while everything fits in dw_stage
+ * @dw_h:       running content hash
+ * @dw_pending: dw_mbid is journaled as pending
+ */
+struct mpool_dedup_wr {
+	struct mpool_dedup     *dw_dd;
+	enum mp_media_classp    dw_mclassp;
+	char                   *dw_stage;
+	u64                     dw_len;
+	u64                     dw_mbid;
+	u64                     dw_h[2];
+	bool                    dw_pending;
+};
+
+static inline u64
+dd_rotl64(u64 x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline u64
+dd_mix(u64 h)
+{
+	h ^= h >> 33;
+	h *= DD_PRIME2;
+	h ^= h >> 29;
+	h *= DD_PRIME3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+/**
+ * dd_hash_page() - Fold one page of content into the running hash
+ *
+ * Two independent multiply/rotate lanes give a 128-bit fingerprint.
+ */
+static void
+dd_hash_page(const void *page, u64 *h)
+{
+	const u64  *p = page;
+	u64         a = h[0], b = h[1], w;
+	int         i;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(*p); i++) {
+		w = p[i];
+		a = dd_rotl64(a ^ (w * DD_PRIME1), 31) * DD_PRIME2;
+		b = dd_rotl64(b + (w * DD_PRIME3), 27) * DD_PRIME4 + w;
+	}
+
+	h[0] = a;
+	h[1] = b;
+}
+
+static u64
+dd_hash_key(u64 key)
+{
+	return dd_mix(key);
+}
+
+static merr_t
+dd_tab_init(struct dd_tab *tab, u32 sz)
+{
+	tab->dt_slotv = kcalloc(sz, sizeof(*tab->dt_slotv), GFP_KERNEL);
+	if (!tab->dt_slotv)
+		return merr(ENOMEM);
+
+	tab->dt_sz = sz;
+	tab->dt_cnt = 0;
+	tab->dt_tomb = 0;
+
+	return 0;
+}
+
+static struct dd_slot *
+dd_tab_free_slot(struct dd_slot *slotv, u32 sz, u64 key)
+{
+	u32 mask = sz - 1, i;
+
+	for (i = dd_hash_key(key) & mask; ; i = (i + 1) & mask)
+		if (slotv[i].ds_state != DD_SLOT_USED)
+			return slotv + i;
+}
+
+static merr_t
+dd_tab_insert(struct dd_tab *tab, u64 key, u32 ent)
+{
+	struct dd_slot *slot;
+
+	if ((tab->dt_cnt + tab->dt_tomb + 1) * 4 >= tab->dt_sz * 3) {
+		struct dd_slot *slotv;
+		u32             sz = tab->dt_sz, i;
+
+		if ((tab->dt_cnt + 1) * 2 >= sz)
+			sz *= 2;
+
+		slotv = kcalloc(sz, sizeof(*slotv), GFP_KERNEL);
+		if (!slotv)
+			return merr(ENOMEM);
+
+		for (i = 0; i < tab->dt_sz; i++) {
+			if (tab->dt_slotv[i].ds_state != DD_SLOT_USED)
+				continue;
+
+			slot = dd_tab_free_slot(slotv, sz,
+						tab->dt_slotv[i].ds_key);
+			*slot = tab->dt_slotv[i];
+		}
+
+		kfree(tab->dt_slotv);
+		tab->dt_slotv = slotv;
+		tab->dt_sz = sz;
+		tab->dt_tomb = 0;
+	}
+
+	slot = dd_tab_free_slot(tab->dt_slotv, tab->dt_sz, key);
+	if (slot->ds_state == DD_SLOT_TOMB)
+		tab->dt_tomb--;
+
+	slot->ds_key = key;
+	slot->ds_ent = ent;
+	slot->ds_state = DD_SLOT_USED;
+	tab->dt_cnt++;
+
+	return 0;
+}
+
+/**
+ * dd_tab_next() - Iterate the entries stored under a key
+ * @tab: table
+ * @key: key
+ * @pos: iteration cursor, initialize to DD_ENT_INVALID
+ *
+ * Return: the next matching slot, or NULL when there are no more
+ */
+static struct dd_slot *
+dd_tab_next(struct dd_tab *tab, u64 key, u32 *pos)
+{
+	struct dd_slot *slot;
+	u32             mask = tab->dt_sz - 1, i;
+
+	i = (*pos == DD_ENT_INVALID) ? dd_hash_key(key) & mask :
+		(*pos + 1) & mask;
+
+	for (; ; i = (i + 1) & mask) {
+		slot = tab->dt_slotv + i;
+
+		if (slot->ds_state == DD_SLOT_EMPTY)
+			return NULL;
+
+		if (slot->ds_state == DD_SLOT_USED && slot->ds_key == key) {
+			*pos = i;
+			return slot;
+		}
+	}
+}
+
+static struct dd_slot *
+dd_tab_find(struct dd_tab *tab, u64 key, u32 ent)
+{
+	struct dd_slot *slot;
+	u32             pos = DD_ENT_INVALID;
+
+	while ((slot = dd_tab_next(tab, key, &pos)))
+		if (slot->ds_ent == ent)
+			return slot;
+
+	return NULL;
+}
+
+static void
+dd_tab_remove(struct dd_tab *tab, u64 key, u32 ent)
+{
+	struct dd_slot *slot;
+
+	slot = dd_tab_find(tab, key, ent);
+	if (!slot)
+		return;
+
+	slot->ds_state = DD_SLOT_TOMB;
+	tab->dt_cnt--;
+	tab->dt_tomb++;
+}
+
+static struct dd_ent *
+dd_ent_find(struct mpool_dedup *dd, u64 mbid)
+{
+	struct dd_slot *slot;
+	u32             pos = DD_ENT_INVALID;
+
+	slot = dd_tab_next(&dd->dd_mbtab, mbid, &pos);
+
+	return slot ? dd->dd_entv + slot->ds_ent : NULL;
+}
+
+static merr_t
+dd_ent_add(struct mpool_dedup *dd, const u64 *fp, u64 mbid, u64 len, u32 refcnt)
+{
+	struct dd_ent  *ent;
+	merr_t          err;
+	u32             idx;
+
+	if (dd->dd_entc == dd->dd_entmax) {
+		u32 entmax = max_t(u32, dd->dd_entmax * 2, DD_TAB_MIN);
+
+		ent = realloc(dd->dd_entv, entmax * sizeof(*ent));
+		if (!ent)
+			return merr(ENOMEM);
+
+		dd->dd_entv = ent;
+		dd->dd_entmax = entmax;
+	}
+
+	idx = dd->dd_entc;
+
+	err = dd_tab_insert(&dd->dd_fptab, fp[0], idx);
+	if (err)
+		return err;
+
+	err = dd_tab_insert(&dd->dd_mbtab, mbid, idx);
+	if (err) {
+		dd_tab_remove(&dd->dd_fptab, fp[0], idx);
+		return err;
+	}
+
+	ent = dd->dd_entv + idx;
+	ent->de_fp[0] = fp[0];
+	ent->de_fp[1] = fp[1];
+	ent->de_mbid = mbid;
+	ent->de_len = len;
+	ent->de_refcnt = refcnt;
+
+	dd->dd_entc++;
+
+	return 0;
+}
+
+/**
+ * dd_ent_remove() - Drop an entry, moving the last entry into its place
+ */
+static void
+dd_ent_remove(struct mpool_dedup *dd, struct dd_ent *ent)
+{
+	struct dd_ent  *last;
+	struct dd_slot *slot;
+	u32             idx, lidx;
+
+	idx = ent - dd->dd_entv;
+	lidx = dd->dd_entc - 1;
+	last = dd->dd_entv + lidx;
+
+	dd_tab_remove(&dd->dd_fptab, ent->de_fp[0], idx);
+	dd_tab_remove(&dd->dd_mbtab, ent->de_mbid, idx);
+
+	if (idx != lidx) {
+		slot = dd_tab_find(&dd->dd_fptab, last->de_fp[0], lidx);
+		if (slot)
+			slot->ds_ent = idx;
+
+		slot = dd_tab_find(&dd->dd_mbtab, last->de_mbid, lidx);
+		if (slot)
+			slot->ds_ent = idx;
+
+		*ent = *last;
+	}
+
+	dd->dd_entc--;
+}
+
+static merr_t
+dd_pend_add(struct mpool_dedup *dd, u64 mbid)
+{
+	u64    *pendv;
+	u32     pendmax;
+
+	if (dd->dd_pendc == dd->dd_pendmax) {
+		pendmax = max_t(u32, dd->dd_pendmax * 2, 16);
+
+		pendv = realloc(dd->dd_pendv, pendmax * sizeof(*pendv));
+		if (!pendv)
+			return merr(ENOMEM);
+
+		dd->dd_pendv = pendv;
+		dd->dd_pendmax = pendmax;
+	}
+
+	dd->dd_pendv[dd->dd_pendc++] = mbid;
+
+	return 0;
+}
+
+static void
+dd_pend_remove(struct mpool_dedup *dd, u64 mbid)
+{
+	u32 i;
+
+	for (i = 0; i < dd->dd_pendc; i++) {
+		if (dd->dd_pendv[i] == mbid) {
+			dd->dd_pendv[i] = dd->dd_pendv[--dd->dd_pendc];
+			return;
+		}
+	}
+}
+
+static merr_t
+dd_rec_append(
+	struct mpool_dedup     *dd,
+	const struct dd_ent    *ent,
+	u32                     flags,
+	bool                    sync)
+{
+	struct dd_rec_omf rec;
+
+	memset(&rec, 0, sizeof(rec));
+	omf_set_pdr_fp0(&rec, ent->de_fp[0]);
+	omf_set_pdr_fp1(&rec, ent->de_fp[1]);
+	omf_set_pdr_mbid(&rec, ent->de_mbid);
+	omf_set_pdr_len(&rec, ent->de_len);
+	omf_set_pdr_refcnt(&rec, ent->de_refcnt);
+	omf_set_pdr_flags(&rec, flags);
+
+	return mpool_mdc_append(dd->dd_mdc, &rec, sizeof(rec), sync);
+}
+
+/**
+ * dd_pend_append() - Journal a spill mblock as pending, or release it
+ */
+static merr_t
+dd_pend_append(struct mpool_dedup *dd, u64 mbid, bool pending, bool sync)
+{
+	struct dd_ent ent;
+
+	memset(&ent, 0, sizeof(ent));
+	ent.de_mbid = mbid;
+
+	return dd_rec_append(dd, &ent, pending ? DD_REC_PENDING : 0, sync);
+}
+
+static merr_t
+dd_mdc_snapshot(void *arg)
+{
+	struct mpool_dedup *dd = arg;
+	merr_t              err;
+	u32                 i;
+
+	for (i = 0; i < dd->dd_entc; i++) {
+		err = dd_rec_append(dd, dd->dd_entv + i, 0, false);
+		if (err)
+			return err;
+	}
+
+	for (i = 0; i < dd->dd_pendc; i++) {
+		err = dd_pend_append(dd, dd->dd_pendv[i], true, false);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+static merr_t
+dd_mdc_compact(struct mpool_dedup *dd)
+{
+	size_t  usage, snapsz;
+	merr_t  err;
+
+	err = mpool_mdc_usage(dd->dd_mdc, &usage);
+	if (err)
+		return err;
+
+	snapsz = (dd->dd_entc + dd->dd_pendc) * sizeof(struct dd_rec_omf);
+
+	if (usage < DD_MDC_COMPACT_MIN ||
+	    usage < DD_MDC_COMPACT_RATIO * max(snapsz, dd->dd_snapsz))
+		return 0;
+
+	err = mpool_mdc_compact(dd->dd_mdc, dd_mdc_snapshot, dd);
+	if (err)
+		return err;
+
+	err = mpool_mdc_usage(dd->dd_mdc, &dd->dd_snapsz);
+	if (err)
+		dd->dd_snapsz = snapsz;
+
+	return 0;
+}
+
+static merr_t
+dd_replay(struct mpool_dedup *dd)
+{
+	struct dd_rec_omf   rec;
+	struct dd_ent      *ent;
+	size_t              rdlen;
+	merr_t              err;
+	u64                 fp[2], mbid;
+	u32                 refcnt;
+
+	err = mpool_mdc_rewind(dd->dd_mdc);
+	if (err)
+		return err;
+
+	while (true) {
+		err = mpool_mdc_read(dd->dd_mdc, &rec, sizeof(rec), &rdlen);
+		if (err)
+			return err;
+
+		if (rdlen == 0)
+			break;
+
+		if (rdlen != sizeof(rec))
+			return merr(EBADMSG);
+
+		mbid = omf_pdr_mbid(&rec);
+		refcnt = omf_pdr_refcnt(&rec);
+
+		if (omf_pdr_flags(&rec) & DD_REC_PENDING) {
+			err = dd_pend_add(dd, mbid);
+			if (err)
+				return err;
+			continue;
+		}
+
+		dd_pend_remove(dd, mbid);
+
+		ent = dd_ent_find(dd, mbid);
+		if (ent) {
+			if (refcnt > 0)
+				ent->de_refcnt = refcnt;
+			else
+				dd_ent_remove(dd, ent);
+			continue;
+		}
+
+		if (refcnt == 0)
+			continue;
+
+		fp[0] = omf_pdr_fp0(&rec);
+		fp[1] = omf_pdr_fp1(&rec);
+
+		err = dd_ent_add(dd, fp, mbid, omf_pdr_len(&rec), refcnt);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/**
+ * dd_reclaim() - Delete the spill mblocks a crash left pending
+ *
+ * Such an mblock was committed but neither indexed nor released, so
+ * nothing references it.
+ */
+static merr_t
+dd_reclaim(struct mpool_dedup *dd)
+{
+	struct mblock_props props;
+	merr_t              err;
+	u64                 mbid, mbh;
+
+	while (dd->dd_pendc > 0) {
+		mbid = dd->dd_pendv[dd->dd_pendc - 1];
+
+		err = mpool_mblock_find(dd->dd_mp, mbid, &mbh, &props);
+		if (!err)
+			err = props.mpr_iscommitted ?
+				mpool_mblock_delete(dd->dd_mp, mbh) :
+				mpool_mblock_abort(dd->dd_mp, mbh);
+		if (err && merr_errno(err) != ENOENT)
+			return err;
+
+		err = dd_pend_append(dd, mbid, false, dd->dd_pendc == 1);
+		if (err)
+			return err;
+
+		mse_log(MPOOL_INFO "dedup reclaimed spill mblock 0x%lx",
+			(ulong)mbid);
+
+		dd->dd_pendc--;
+	}
+
+	return 0;
+}
+
+/**
+ * dd_same_content() - Confirm a fingerprint match byte for byte
+ * @dd:   dedup handle
+ * @wr:   writer whose content is being committed
+ * @mbid: candidate mblock
+ *
+ * Compares against the staging buffer, or against the (already committed)
+ * spill mblock.
+ */
+static merr_t
+dd_same_content(
+	struct mpool_dedup     *dd,
+	struct mpool_dedup_wr  *wr,
+	u64                     mbid,
+	bool                   *same)
+{
+	struct iovec    iov;
+	merr_t          err = 0;
+	char           *buf, *buf2 = NULL;
+	u64             off, len;
+
+	*same = false;
+
+	buf = aligned_alloc(PAGE_SIZE, DD_CMPBUFSZ);
+	if (!buf)
+		return merr(ENOMEM);
+
+	if (wr->dw_mbid) {
+		buf2 = aligned_alloc(PAGE_SIZE, DD_CMPBUFSZ);
+		if (!buf2) {
+			err = merr(ENOMEM);
+			goto errout;
+		}
+	}
+
+	for (off = 0; off < wr->dw_len; off += len) {
+		len = min_t(u64, wr->dw_len - off, DD_CMPBUFSZ);
+
+		iov.iov_base = buf;
+		iov.iov_len = len;
+
+		err = mpool_mblock_read(dd->dd_mp, mbid, &iov, 1, off);
+		if (err)
+			goto errout;
+
+		if (buf2) {
+			iov.iov_base = buf2;
+
+			err = mpool_mblock_read(dd->dd_mp, wr->dw_mbid, &iov, 1,
+						off);
+			if (err)
+				goto errout;
+		}
+
+		if (memcmp(buf, buf2 ?: wr->dw_stage + off, len))
+			goto errout;
+	}
+
+	*same = true;
+
+errout:
+	free(buf2);
+	free(buf);
+
+	return err;
+}
+
+/**
+ * dd_spill() - Move staged content to a real mblock
+ */
+static merr_t
+dd_spill(struct mpool_dedup_wr *wr)
+{
+	struct mpool_dedup *dd = wr->dw_dd;
+	struct iovec        iov;
+	merr_t              err;
+	u64                 mbid;
+
+	err = mpool_mblock_alloc(dd->dd_mp, wr->dw_mclassp, false, &mbid, NULL);
+	if (err)
+		return err;
+
+	if (wr->dw_len > 0) {
+		iov.iov_base = wr->dw_stage;
+		iov.iov_len = wr->dw_len;
+
+		err = mpool_mblock_write(dd->dd_mp, mbid, &iov, 1);
+		if (err) {
+			mpool_mblock_abort(dd->dd_mp, mbid);
+			return err;
+		}
+	}
+
+	wr->dw_mbid = mbid;
+
+	return 0;
+}
+
+/**
+ * dd_spill_commit() - Commit the spill mblock, journaling it first
+ *
+ * The pending record lets dd_reclaim() delete the mblock should the process
+ * die before it is indexed or released.
+ */
+static merr_t
+dd_spill_commit(struct mpool_dedup_wr *wr)
+{
+	struct mpool_dedup *dd = wr->dw_dd;
+	merr_t              err;
+
+	mutex_lock(&dd->dd_lock);
+	err = dd_pend_add(dd, wr->dw_mbid);
+	if (!err) {
+		err = dd_pend_append(dd, wr->dw_mbid, true, true);
+		if (err)
+			dd_pend_remove(dd, wr->dw_mbid);
+	}
+	mutex_unlock(&dd->dd_lock);
+
+	if (err)
+		return err;
+
+	wr->dw_pending = true;
+
+	return mpool_mblock_commit(dd->dd_mp, wr->dw_mbid);
+}
+
+/**
+ * dd_spill_release() - Record that a pending spill mblock was deleted
+ *
+ * Called once the mblock is gone.  On failure it stays pending and is looked
+ * up again at the next open.
+ */
+static void
+dd_spill_release(struct mpool_dedup_wr *wr)
+{
+	struct mpool_dedup *dd = wr->dw_dd;
+	merr_t              err;
+
+	mutex_lock(&dd->dd_lock);
+	err = dd_pend_append(dd, wr->dw_mbid, false, false);
+	if (!err)
+		dd_pend_remove(dd, wr->dw_mbid);
+	mutex_unlock(&dd->dd_lock);
+
+	wr->dw_pending = false;
+}
+
+/**
+ * dd_candidates() - List the indexed mblocks whose fingerprint matches @new
+ *
+ * On success the caller frees *@mbidvp.
+ */
+static merr_t
+dd_candidates(
+	struct mpool_dedup     *dd,
+	const struct dd_ent    *new,
+	u64                   **mbidvp,
+	u32                    *mbidcp)
+{
+	struct dd_slot *slot;
+	struct dd_ent  *ent;
+	merr_t          err = 0;
+	u64            *mbidv = NULL, *tmp;
+	u32             pos = DD_ENT_INVALID, mbidc = 0, mbidmax = 0;
+
+	mutex_lock(&dd->dd_lock);
+	while ((slot = dd_tab_next(&dd->dd_fptab, new->de_fp[0], &pos))) {
+		ent = dd->dd_entv + slot->ds_ent;
+
+		if (ent->de_fp[1] != new->de_fp[1] || ent->de_len != new->de_len)
+			continue;
+
+		if (mbidc == mbidmax) {
+			mbidmax = max_t(u32, mbidmax * 2, 4);
+
+			tmp = realloc(mbidv, mbidmax * sizeof(*mbidv));
+			if (!tmp) {
+				err = merr(ENOMEM);
+				break;
+			}
+			mbidv = tmp;
+		}
+
+		mbidv[mbidc++] = ent->de_mbid;
+	}
+	mutex_unlock(&dd->dd_lock);
+
+	if (err) {
+		free(mbidv);
+		return err;
+	}
+
+	*mbidvp = mbidv;
+	*mbidcp = mbidc;
+
+	return 0;
+}
+
+/**
+ * dd_link() - Take a reference on candidate @mbid if it is still indexed
+ *             with the fingerprint of @new
+ *
+ * Return: ENOENT if the candidate went away while its content was compared
+ */
+static merr_t
+dd_link(struct mpool_dedup *dd, const struct dd_ent *new, u64 mbid)
+{
+	struct dd_ent  *ent;
+	merr_t          err;
+
+	mutex_lock(&dd->dd_lock);
+	ent = dd_ent_find(dd, mbid);
+	if (!ent || ent->de_fp[0] != new->de_fp[0] ||
+	    ent->de_fp[1] != new->de_fp[1] || ent->de_len != new->de_len) {
+		mutex_unlock(&dd->dd_lock);
+		return merr(ENOENT);
+	}
+
+	ent->de_refcnt++;
+
+	err = dd_rec_append(dd, ent, 0, true);
+	if (err)
+		ent->de_refcnt--;
+	mutex_unlock(&dd->dd_lock);
+
+	return err;
+}
+
+uint64_t
+mpool_dedup_open(
+	struct mpool                       *mp,
+	uint64_t                            logid1,
+	uint64_t                            logid2,
+	const struct mpool_dedup_params    *params,
+	struct mpool_dedup                **ddp)
+{
+	struct mpool_dedup *dd;
+	merr_t              err;
+
+	if (!mp || !ddp)
+		return merr(EINVAL);
+
+	*ddp = NULL;
+
+	dd = kzalloc(sizeof(*dd), GFP_KERNEL);
+	if (!dd)
+		return merr(ENOMEM);
+
+	mutex_init(&dd->dd_lock);
+	dd->dd_mp = mp;
+
+	if (params)
+		dd->dd_params = *params;
+
+	if (dd->dd_params.dp_stagesz == 0)
+		dd->dd_params.dp_stagesz = DD_STAGESZ_DFLT;
+
+	if (!PAGE_ALIGNED(dd->dd_params.dp_stagesz)) {
+		err = merr(EINVAL);
+		goto errout;
+	}
+
+	err = dd_tab_init(&dd->dd_fptab, DD_TAB_MIN);
+	if (!err)
+		err = dd_tab_init(&dd->dd_mbtab, DD_TAB_MIN);
+	if (err)
+		goto errout;
+
+	err = mpool_mdc_open(mp, logid1, logid2, 0, &dd->dd_mdc);
+	if (err)
+		goto errout;
+
+	err = dd_replay(dd);
+	if (err) {
+		mp_pr_err("dedup logid 0x%lx 0x%lx replay failed",
+			  err, (ulong)logid1, (ulong)logid2);
+		goto errout;
+	}
+
+	err = dd_reclaim(dd);
+	if (err) {
+		mp_pr_err("dedup logid 0x%lx 0x%lx spill reclaim failed",
+			  err, (ulong)logid1, (ulong)logid2);
+		goto errout;
+	}
+
+	*ddp = dd;
+
+	return 0;
+
+errout:
+	if (dd->dd_mdc)
+		mpool_mdc_close(dd->dd_mdc);
+	kfree(dd->dd_fptab.dt_slotv);
+	kfree(dd->dd_mbtab.dt_slotv);
+	kfree(dd->dd_entv);
+	free(dd->dd_pendv);
+	mutex_destroy(&dd->dd_lock);
+	kfree(dd);
+
+	return err;
+}
+
+uint64_t
+mpool_dedup_close(
+	struct mpool_dedup *dd)
+{
+	merr_t err;
+
+	if (!dd)
+		return merr(EINVAL);
+
+	err = mpool_mdc_close(dd->dd_mdc);
+
+	kfree(dd->dd_fptab.dt_slotv);
+	kfree(dd->dd_mbtab.dt_slotv);
+	kfree(dd->dd_entv);
+	free(dd->dd_pendv);
+	mutex_destroy(&dd->dd_lock);
+	kfree(dd);
+
+	return err;
+}
+
+uint64_t
+mpool_dedup_alloc(
+	struct mpool_dedup     *dd,
+	enum mp_media_classp    mclassp,
+	struct mpool_dedup_wr **wrp)
+{
+	struct mpool_dedup_wr *wr;
+
+	if (!dd || !wrp)
+		return merr(EINVAL);
+
+	wr = kzalloc(sizeof(*wr), GFP_KERNEL);
+	if (!wr)
+		return merr(ENOMEM);
+
+	wr->dw_stage = aligned_alloc(PAGE_SIZE, dd->dd_params.dp_stagesz);
+	if (!wr->dw_stage) {
+		kfree(wr);
+		return merr(ENOMEM);
+	}
+
+	wr->dw_dd = dd;
+	wr->dw_mclassp = mclassp;
+	wr->dw_h[0] = DD_SEED0;
+	wr->dw_h[1] = DD_SEED1;
+
+	*wrp = wr;
+
+	return 0;
+}
+
+uint64_t
+mpool_dedup_write(
+	struct mpool_dedup_wr  *wr,
+	const struct iovec     *iov,
+	int                     iovc)
+{
+	struct mpool_dedup *dd;
+	merr_t              err;
+	size_t              off;
+	int                 i;
+
+	if (!wr || !iov || iovc <= 0)
+		return merr(EINVAL);
+
+	dd = wr->dw_dd;
+
+	for (i = 0; i < iovc; i++)
+		if (!PAGE_ALIGNED(iov[i].iov_len))
+			return merr(EINVAL);
+
+	for (i = 0; i < iovc; i++) {
+		if (!wr->dw_mbid &&
+		    wr->dw_len + iov[i].iov_len > dd->dd_params.dp_stagesz) {
+			err = dd_spill(wr);
+			if (err)
+				return err;
+		}
+
+		if (wr->dw_mbid) {
+			err = mpool_mblock_write(dd->dd_mp, wr->dw_mbid,
+						 (struct iovec *)iov + i, 1);
+			if (err)
+				return err;
+		} else {
+			memcpy(wr->dw_stage + wr->dw_len, iov[i].iov_base,
+			       iov[i].iov_len);
+		}
+
+		for (off = 0; off < iov[i].iov_len; off += PAGE_SIZE)
+			dd_hash_page((char *)iov[i].iov_base + off, wr->dw_h);
+
+		wr->dw_len += iov[i].iov_len;
+	}
+
+	return 0;
+}
+
+static void
+dd_wr_free(struct mpool_dedup_wr *wr)
+{
+	free(wr->dw_stage);
+	kfree(wr);
+}
+
+uint64_t
+mpool_dedup_commit(
+	struct mpool_dedup_wr  *wr,
+	uint64_t               *mbidp)
+{
+	struct mpool_dedup *dd;
+	struct dd_ent       new;
+	merr_t              err;
+	u64                *candv;
+	u32                 candc, i;
+	bool                same;
+
+	if (!wr || !mbidp)
+		return merr(EINVAL);
+
+	dd = wr->dw_dd;
+
+	memset(&new, 0, sizeof(new));
+	new.de_fp[0] = dd_mix(wr->dw_h[0] ^ wr->dw_len);
+	new.de_fp[1] = dd_mix(wr->dw_h[1] + wr->dw_len);
+	new.de_len = wr->dw_len;
+	new.de_refcnt = 1;
+
+	/* A spill mblock must be committed before it can be read back */
+	if (wr->dw_mbid) {
+		err = dd_spill_commit(wr);
+		if (err)
+			return err;
+	}
+
+	err = dd_candidates(dd, &new, &candv, &candc);
+	if (err)
+		return err;
+
+	/*
+	 * Candidates are compared without dd_lock held, so one may be deleted
+	 * meanwhile.  dd_link() only shares it if it is still indexed.
+	 */
+	for (i = 0; i < candc; i++) {
+		err = dd_same_content(dd, wr, candv[i], &same);
+		if (err) {
+			/* A failed read is fatal only if the candidate is live */
+			mutex_lock(&dd->dd_lock);
+			if (dd_ent_find(dd, candv[i])) {
+				mutex_unlock(&dd->dd_lock);
+				break;
+			}
+			mutex_unlock(&dd->dd_lock);
+
+			err = 0;
+			continue;
+		}
+
+		if (!same)
+			continue;
+
+		err = dd_link(dd, &new, candv[i]);
+		if (err) {
+			if (merr_errno(err) != ENOENT)
+				break;
+
+			err = 0;
+			continue;
+		}
+
+		*mbidp = candv[i];
+		free(candv);
+
+		if (wr->dw_mbid) {
+			mpool_mblock_delete(dd->dd_mp, wr->dw_mbid);
+			dd_spill_release(wr);
+		}
+		dd_wr_free(wr);
+
+		return 0;
+	}
+
+	free(candv);
+
+	if (err)
+		return err;
+
+	if (!wr->dw_mbid) {
+		err = dd_spill(wr);
+		if (!err)
+			err = dd_spill_commit(wr);
+		if (err)
+			return err;
+	}
+
+	new.de_mbid = wr->dw_mbid;
+
+	mutex_lock(&dd->dd_lock);
+	err = dd_rec_append(dd, &new, 0, true);
+	if (!err)
+		err = dd_ent_add(dd, new.de_fp, new.de_mbid, new.de_len, 1);
+	if (err) {
+		mutex_unlock(&dd->dd_lock);
+
+		/* The writer stays valid; the caller must still abort it */
+		return err;
+	}
+
+	dd_pend_remove(dd, new.de_mbid);
+
+	err = dd_mdc_compact(dd);
+	if (err)
+		mp_pr_err("dedup mdc compaction failed", err);
+
+	*mbidp = new.de_mbid;
+	mutex_unlock(&dd->dd_lock);
+
+	dd_wr_free(wr);
+
+	return 0;
+}
+
+uint64_t
+mpool_dedup_abort(
+	struct mpool_dedup_wr  *wr)
+{
+	struct mblock_props     props;
+	struct mpool           *mp;
+	merr_t                  err = 0;
+
+	if (!wr)
+		return merr(EINVAL);
+
+	mp = wr->dw_dd->dd_mp;
+
+	if (wr->dw_mbid) {
+		err = mpool_mblock_getprops(mp, wr->dw_mbid, &props);
+		if (!err)
+			err = props.mpr_iscommitted ?
+				mpool_mblock_delete(mp, wr->dw_mbid) :
+				mpool_mblock_abort(mp, wr->dw_mbid);
+		if (!err && wr->dw_pending)
+			dd_spill_release(wr);
+	}
+
+	dd_wr_free(wr);
+
+	return err;
+}
+
+uint64_t
+mpool_dedup_addref(
+	struct mpool_dedup *dd,
+	uint64_t            mbid)
+{
+	struct dd_ent  *ent;
+	merr_t          err;
+
+	if (!dd)
+		return merr(EINVAL);
+
+	mutex_lock(&dd->dd_lock);
+	ent = dd_ent_find(dd, mbid);
+	if (!ent) {
+		mutex_unlock(&dd->dd_lock);
+		return merr(ENOENT);
+	}
+
+	ent->de_refcnt++;
+
+	err = dd_rec_append(dd, ent, 0, true);
+	if (err)
+		ent->de_refcnt--;
+	mutex_unlock(&dd->dd_lock);
+
+	return err;
+}
+
+uint64_t
+mpool_dedup_delete(
+	struct mpool_dedup *dd,
+	uint64_t            mbid)
+{
+	struct dd_ent  *ent;
+	merr_t          err;
+
+	if (!dd)
+		return merr(EINVAL);
+
+	mutex_lock(&dd->dd_lock);
+	ent = dd_ent_find(dd, mbid);
+	if (!ent) {
+		mutex_unlock(&dd->dd_lock);
+		return merr(ENOENT);
+	}
+
+	ent->de_refcnt--;
+
+	err = dd_rec_append(dd, ent, 0, true);
+	if (err) {
+		ent->de_refcnt++;
+		mutex_unlock(&dd->dd_lock);
+		return err;
+	}
+
+	if (ent->de_refcnt > 0) {
+		mutex_unlock(&dd->dd_lock);
+		return 0;
+	}
+
+	dd_ent_remove(dd, ent);
+	mutex_unlock(&dd->dd_lock);
+
+	/*
+	 * The index no longer references the mblock.  If the delete fails
+	 * the mblock is leaked, never double referenced.
+	 */
+	err = mpool_mblock_delete(dd->dd_mp, mbid);
+	if (err)
+		mp_pr_err("dedup mblock 0x%lx delete failed", err, (ulong)mbid);
+
+	return err;
+}
+
+uint64_t
+mpool_dedup_refcnt(
+	struct mpool_dedup *dd,
+	uint64_t            mbid,
+	uint32_t           *refcnt)
+{
+	struct dd_ent *ent;
+
+	if (!dd || !refcnt)
+		return merr(EINVAL);
+
+	mutex_lock(&dd->dd_lock);
+	ent = dd_ent_find(dd, mbid);
+	if (ent)
+		*refcnt = ent->de_refcnt;
+	mutex_unlock(&dd->dd_lock);
+
+	return ent ? 0 : merr(ENOENT);
+}
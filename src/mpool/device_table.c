@@ -14,6 +14,12 @@
 
 #include <device_table.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <linux/version.h>
 #include <mpool_blkid/blkid.h>
 
@@ -24,24 +30,87 @@
 
 #define MODEL_SZ      1024 /* Max size for the device model string */
 
+#define DEVINFO_CACHE_FILE      MPOOL_RUNDIR_ROOT "/devinfo.cache"
+#define DEVTUNE_CONF_FILE       "/etc/mpool/devtune.conf"
+#define DEVINFO_CACHE_MAX       (64)
+#define UDEV_DATA_DIR           "/run/udev/data"
+
+#define DEVINFO_CACHE_MAGIC     (0x64766332)    /* "dvc2" */
+
+#define DC_DEVPATH      (0x01)
+#define DC_PROP         (0x02)
+
+/**
+ * struct devinfo_cache_ent - cached mpool_devinfo() and imp_dev_get_prop()
+ *	results of a device
+ * @dc_rdev:    device number of @dc_name
+ * @dc_sec:     mtime of the device's udev database entry
+ * @dc_nsec:    mtime of the device's udev database entry
+ * @dc_magic:   DEVINFO_CACHE_MAGIC
+ * @dc_flags:   DC_DEVPATH if @dc_devpath is valid, DC_PROP if @dc_prop is
+ * @dc_name:    device name as passed to mpool_devinfo()/imp_dev_get_prop()
+ * @dc_devpath: resolved device path
+ * @dc_prop:    device properties
+ */
+struct devinfo_cache_ent {
+	u64             dc_rdev;
+	s64             dc_sec;
+	s64             dc_nsec;
+	u32             dc_magic;
+	u32             dc_flags;
+	char            dc_name[104];
+	char            dc_devpath[128];
+	struct pd_prop  dc_prop;
+};
+
+static bool
+devinfo_stamp(
+	const char                 *name,
+	struct devinfo_cache_ent   *key);
+
+static bool
+devinfo_cache_lookup(
+	const struct devinfo_cache_ent *key,
+	u32                             flag,
+	struct devinfo_cache_ent       *ent);
+
+static void
+devinfo_cache_update(const struct devinfo_cache_ent *upd);
+
 static devp_get_t devtab_get_prop_file;
 static devp_get_t devtab_get_prop_blk_micron;
 static devp_get_t devtab_get_prop_generic_blk;
 
+/*
+ * Block queue tuning profiles, see struct mpool_devtune.  Writeback
+ * throttling is disabled on all block devices as mpool does its own
+ * write pacing; the other settings are applied only on request, see
+ * MP_FLAGS_DEVTUNE.
+ */
+#define DEVTUNE(_sched, _nr, _ra, _maxsec, _rqaff, _wbt) \
+	{ (_sched), (_nr), (_ra), (_maxsec), (_rqaff), (_wbt) }
+
+#define DEVTUNE_NONE            DEVTUNE("", -1, -1, -1, -1, -1)
+#define DEVTUNE_SSD             DEVTUNE("none", 1023, -1, -1, 2, 0)
+#define DEVTUNE_HDD             DEVTUNE("mq-deadline", 256, 1024, -1, -1, 0)
+#define DEVTUNE_NVDIMM          DEVTUNE("none", -1, 0, -1, 2, 0)
+#define DEVTUNE_WBT_OFF         DEVTUNE("", -1, -1, -1, -1, 0)
+
 static struct dev_table_ent dev_table[] = {
-	{MODEL_FILE, MP_PD_DEV_TYPE_FILE, devtab_get_prop_file},
+	{MODEL_FILE, MP_PD_DEV_TYPE_FILE, devtab_get_prop_file,
+		DEVTUNE_NONE},
 	{MODEL_GENERIC_SSD, MP_PD_DEV_TYPE_BLOCK_STD,
-		devtab_get_prop_generic_blk},
+		devtab_get_prop_generic_blk, DEVTUNE_SSD},
 	{MODEL_GENERIC_HDD, MP_PD_DEV_TYPE_BLOCK_STD,
-		devtab_get_prop_generic_blk},
+		devtab_get_prop_generic_blk, DEVTUNE_HDD},
 	{MODEL_GENERIC_NVDIMM_SECTOR, MP_PD_DEV_TYPE_BLOCK_NVDIMM,
-		devtab_get_prop_generic_blk},
+		devtab_get_prop_generic_blk, DEVTUNE_NVDIMM},
 	{MODEL_MICRON_SSD, MP_PD_DEV_TYPE_BLOCK_STD,
-		devtab_get_prop_blk_micron},
+		devtab_get_prop_blk_micron, DEVTUNE_SSD},
 	{MODEL_GENERIC_TEST, MP_PD_DEV_TYPE_BLOCK_STD,
-		devtab_get_prop_generic_blk},
+		devtab_get_prop_generic_blk, DEVTUNE_WBT_OFF},
 	{MODEL_VIRTUAL_DEV, MP_PD_DEV_TYPE_BLOCK_STD,
-		devtab_get_prop_generic_blk},
+		devtab_get_prop_generic_blk, DEVTUNE_WBT_OFF},
 };
 
 /**
@@ -585,28 +654,27 @@ is_micron_ssd(
 }
 
 /**
- * dev_get_prop() - get the device (PD) properties.
+ * dev_find_ent() - find the device table entry of a device.
  * @dpath: device path e.g. "/dev/nvme1n1"
- * @ppath: partition path e.g. "/dev/nvme1n1p1"
- * @pd_prop:
+ * @sysfs_dpath: path of the device in sysfs: /sys/block/<device name>
+ * @model: (output) model string, MODEL_SZ bytes
+ * @phys_if: (output) physical interface, DEVICE_PHYS_IF_UNKNOWN if the
+ *	device table has an entry specifically for the model.
+ * @entp: (output) device table entry
  */
 static merr_t
-dev_get_prop(
-	const char     *dpath,
-	const char     *ppath,
-	struct pd_prop *pd_prop)
+dev_find_ent(
+	const char            *dpath,
+	char                  *sysfs_dpath,
+	char                  *model,
+	enum device_phys_if   *phys_if,
+	struct dev_table_ent **entp)
 {
 	struct dev_table_ent *dev_ent;
-	enum device_phys_if   phys_if = DEVICE_PHYS_IF_UNKNOWN;
 	merr_t                err;
-	char                  sysfs_dpath[PATH_MAX]; /* /sys/block/<dev_name> */
-	char                  model[MODEL_SZ];
 	u64                   hdd;
 
-	/* Get "/sys/block/<device name>" in sysfs_dpath. */
-	err = sysfs_get_dpath(dpath, sysfs_dpath, sizeof(sysfs_dpath));
-	if (err)
-		return err;
+	*phys_if = DEVICE_PHYS_IF_UNKNOWN;
 
 	/*
 	 * Get the model string.
@@ -618,15 +686,15 @@ dev_get_prop(
 	 */
 	if (isTestDevice(dpath)) {
 		strcpy(model, "");
-		phys_if = DEVICE_PHYS_IF_TEST;
+		*phys_if = DEVICE_PHYS_IF_TEST;
 		hdd = 0;
 	} else if (isDeviceMapper(dpath)) {
 		strlcpy(model, MODEL_VIRTUAL_DEV, MODEL_SZ);
-		phys_if = DEVICE_PHYS_IF_VIRTUAL;
+		*phys_if = DEVICE_PHYS_IF_VIRTUAL;
 		hdd = 0;
 	} else {
 		err = sysfs_get_val_str(sysfs_dpath, "/device/model", 0, model,
-			sizeof(model));
+			MODEL_SZ);
 		if (err && (merr_errno(err) != ENOENT))
 			return err;
 
@@ -638,10 +706,8 @@ dev_get_prop(
 				 * The device table contains an entry
 				 * specifically for this model. Use it.
 				 */
-				err = dev_ent->dev_prop_get(dpath, ppath,
-							    sysfs_dpath, model,
-							    dev_ent, pd_prop);
-				return err;
+				*entp = dev_ent;
+				return 0;
 			}
 		} else
 			/* No "model" file in sysfs. */
@@ -650,8 +716,8 @@ dev_get_prop(
 		/*
 		 * Get the type of physical interface the device is using.
 		 */
-		err = sysfs_device_phys_if(sysfs_dpath, dpath, &phys_if);
-		if (phys_if == DEVICE_PHYS_IF_UNKNOWN) {
+		err = sysfs_device_phys_if(sysfs_dpath, dpath, phys_if);
+		if (*phys_if == DEVICE_PHYS_IF_UNKNOWN) {
 			err = merr(ENOENT);
 			mpool_elog(MPOOL_DEBUG
 				   "Getting device %s physical interface failed, @@e",
@@ -675,13 +741,13 @@ dev_get_prop(
 	 */
 	if (hdd)
 		dev_ent = devtab_find_ent(MODEL_GENERIC_HDD);
-	else if (phys_if == DEVICE_PHYS_IF_NVDIMM)
+	else if (*phys_if == DEVICE_PHYS_IF_NVDIMM)
 		dev_ent = devtab_find_ent(MODEL_GENERIC_NVDIMM_SECTOR);
-	else if (phys_if == DEVICE_PHYS_IF_TEST)
+	else if (*phys_if == DEVICE_PHYS_IF_TEST)
 		dev_ent = devtab_find_ent(MODEL_GENERIC_TEST);
 	else if (is_micron_ssd(model, MODEL_SZ))
 		dev_ent = devtab_find_ent(MODEL_MICRON_SSD);
-	else if (phys_if == DEVICE_PHYS_IF_VIRTUAL)
+	else if (*phys_if == DEVICE_PHYS_IF_VIRTUAL)
 		dev_ent = devtab_find_ent(MODEL_VIRTUAL_DEV);
 	else
 		dev_ent = devtab_find_ent(MODEL_GENERIC_SSD);
@@ -694,6 +760,38 @@ dev_get_prop(
 		return err;
 	}
 
+	*entp = dev_ent;
+
+	return 0;
+}
+
+/**
+ * dev_get_prop() - get the device (PD) properties.
+ * @dpath: device path e.g. "/dev/nvme1n1"
+ * @ppath: partition path e.g. "/dev/nvme1n1p1"
+ * @pd_prop:
+ */
+static merr_t
+dev_get_prop(
+	const char     *dpath,
+	const char     *ppath,
+	struct pd_prop *pd_prop)
+{
+	struct dev_table_ent *dev_ent;
+	enum device_phys_if   phys_if;
+	merr_t                err;
+	char                  sysfs_dpath[PATH_MAX]; /* /sys/block/<dev_name> */
+	char                  model[MODEL_SZ];
+
+	/* Get "/sys/block/<device name>" in sysfs_dpath. */
+	err = sysfs_get_dpath(dpath, sysfs_dpath, sizeof(sysfs_dpath));
+	if (err)
+		return err;
+
+	err = dev_find_ent(dpath, sysfs_dpath, model, &phys_if, &dev_ent);
+	if (err)
+		return err;
+
 	err = dev_ent->dev_prop_get(dpath, ppath, sysfs_dpath,
 				    model, dev_ent, pd_prop);
 	pd_prop->pdp_phys_if = phys_if;
@@ -706,13 +804,15 @@ imp_dev_get_prop(
 	const char     *path,
 	struct pd_prop *pd_prop)
 {
-	struct dev_table_ent   *dev_ent;
-	struct stat	        st;
+	struct devinfo_cache_ent    key, ent;
+	struct dev_table_ent       *dev_ent;
+	struct stat	            st;
 
 	char   errbuf[128];
 	merr_t err;
 	int    rc;
 	char   dpath[PATH_MAX];
+	bool   cacheable;
 
 	rc = stat(path, &st);
 	if (rc) {
@@ -740,6 +840,13 @@ imp_dev_get_prop(
 		return err;
 	}
 
+	/* Skip the sysfs reads if udev has not touched the device since */
+	cacheable = devinfo_stamp(path, &key);
+	if (cacheable && devinfo_cache_lookup(&key, DC_PROP, &ent)) {
+		*pd_prop = ent.dc_prop;
+		return 0;
+	}
+
 	err = partname_to_diskname(dpath, path, sizeof(dpath));
 	if (err) {
 		mpool_elog(MPOOL_ERR
@@ -759,6 +866,12 @@ imp_dev_get_prop(
 		return err;
 	}
 
+	if (cacheable) {
+		key.dc_flags = DC_PROP;
+		key.dc_prop = *pd_prop;
+		devinfo_cache_update(&key);
+	}
+
 	return err;
 }
 
@@ -795,42 +908,527 @@ out:
 	return err;
 }
 
-merr_t
-sysfs_pd_disable_wbt(
-	const char *path)
+/*
+ * Block queue tuning.
+ *
+ * The settings a profile changes are read before they are first applied
+ * and kept, along with what was applied, in a per-disk state file under
+ * MPOOL_RUNDIR_ROOT so that deactivation (typically another process) can
+ * restore them.  The state counts the tunings of the disk since several
+ * of its partitions may be activated, in one or more mpools.
+ */
+
+/**
+ * struct devtune_attr - numeric queue setting
+ * @da_name: sysfs file under queue/, also the DEVTUNE_CONF_FILE keyword
+ * @da_off:  offset of the setting in struct mpool_devtune
+ */
+struct devtune_attr {
+	const char *da_name;
+	size_t      da_off;
+};
+
+/* Applied in this order, after the scheduler which may reset them */
+static const struct devtune_attr devtune_attrv[] = {
+	{ "nr_requests", offsetof(struct mpool_devtune, mdt_nr_requests) },
+	{ "read_ahead_kb", offsetof(struct mpool_devtune, mdt_read_ahead_kb) },
+	{ "max_sectors_kb",
+	  offsetof(struct mpool_devtune, mdt_max_sectors_kb) },
+	{ "rq_affinity", offsetof(struct mpool_devtune, mdt_rq_affinity) },
+	{ "wbt_lat_usec", offsetof(struct mpool_devtune, mdt_wbt_lat_usec) },
+};
+
+#define DEVTUNE_STATE_MAGIC     ((u32)0x44545331)       /* "DTS1" */
+
+/**
+ * struct devtune_state - per-disk tuning state file contents
+ * @ds_magic:   DEVTUNE_STATE_MAGIC
+ * @ds_refs:    number of tunings not yet undone
+ * @ds_applied: settings applied
+ * @ds_saved:   settings to restore
+ */
+struct devtune_state {
+	u32                     ds_magic;
+	u32                     ds_refs;
+	struct mpool_devtune    ds_applied;
+	struct mpool_devtune    ds_saved;
+};
+
+static pthread_once_t devtune_conf_once = PTHREAD_ONCE_INIT;
+
+static inline s64 *
+devtune_val(struct mpool_devtune *dt, const struct devtune_attr *attr)
+{
+	return (s64 *)((char *)dt + attr->da_off);
+}
+
+static void
+devtune_unset(struct mpool_devtune *dt)
+{
+	int i;
+
+	memset(dt, 0, sizeof(*dt));
+
+	for (i = 0; i < NELEM(devtune_attrv); i++)
+		*devtune_val(dt, devtune_attrv + i) = -1;
+}
+
+/**
+ * devtune_conf_parse() - apply one DEVTUNE_CONF_FILE line to the table
+ *
+ * Lines read "<model> <setting>=<value> ...", where the settings are
+ * "scheduler" and the devtune_attrv[] names, and a value of "-" leaves
+ * the setting alone.
+ */
+static void
+devtune_conf_parse(char *line, int lineno)
 {
-	char    sysfs_path[NAME_MAX + 1];
-	char    dpath[PATH_MAX];
+	struct mpool_devtune   *dt;
+	struct dev_table_ent   *ent;
+	char                   *tok, *val, *end, *save;
+	s64                     num;
+	int                     i;
+
+	tok = strtok_r(line, " \t\n", &save);
+	if (!tok || tok[0] == '#')
+		return;
+
+	ent = devtab_find_ent(tok);
+	if (!ent) {
+		mse_log(MPOOL_WARNING "%s:%d: unknown device model %s",
+			DEVTUNE_CONF_FILE, lineno, tok);
+		return;
+	}
+
+	dt = &ent->dev_tune;
+
+	while ((tok = strtok_r(NULL, " \t\n", &save))) {
+		val = strchr(tok, '=');
+		if (!val)
+			goto invalid;
+		*val++ = '\000';
+
+		if (!strcmp(tok, "scheduler")) {
+			if (strlen(val) >= sizeof(dt->mdt_sched))
+				goto invalid;
+			strlcpy(dt->mdt_sched, strcmp(val, "-") ? val : "",
+				sizeof(dt->mdt_sched));
+			continue;
+		}
+
+		for (i = 0; i < NELEM(devtune_attrv); i++)
+			if (!strcmp(tok, devtune_attrv[i].da_name))
+				break;
+		if (i >= NELEM(devtune_attrv))
+			goto invalid;
+
+		if (!strcmp(val, "-")) {
+			num = -1;
+		} else {
+			errno = 0;
+			num = strtoll(val, &end, 0);
+			if (errno || end == val || *end || num < 0)
+				goto invalid;
+		}
+
+		*devtune_val(dt, devtune_attrv + i) = num;
+		continue;
+
+invalid:
+		mse_log(MPOOL_WARNING "%s:%d: invalid setting %s",
+			DEVTUNE_CONF_FILE, lineno, tok);
+	}
+}
+
+static void
+devtune_conf_load(void)
+{
+	char    line[512];
 	FILE   *fp;
-	char   *dname;
-	merr_t  err;
-	int     n;
+	int     lineno = 0;
 
-	err = partname_to_diskname(dpath, path, sizeof(dpath));
+	fp = fopen(DEVTUNE_CONF_FILE, "r");
+	if (!fp)
+		return;
+
+	while (fgets(line, sizeof(line), fp))
+		devtune_conf_parse(line, ++lineno);
+
+	fclose(fp);
+}
+
+/**
+ * devtune_resolve() - get the sysfs path and state file of a PD's disk
+ */
+static merr_t
+devtune_resolve(
+	const char *ppath,
+	char       *dpath,
+	char       *sysfs_dpath,
+	char       *statepath)
+{
+	struct stat st;
+	merr_t      err;
+	int         n;
+
+	if (stat(ppath, &st))
+		return merr(errno);
+
+	/* File backed PDs have no queue to tune */
+	if (!S_ISBLK(st.st_mode))
+		return merr(ENOTBLK);
+
+	err = partname_to_diskname(dpath, ppath, PATH_MAX);
 	if (err)
 		return err;
 
-	/* This needs to be the device mapper name for lv. */
-	dname = strrchr(dpath, '/');
+	err = sysfs_get_dpath(dpath, sysfs_dpath, PATH_MAX);
+	if (err)
+		return err;
 
-	/* Sysfs file path */
-	n = snprintf(sysfs_path, sizeof(sysfs_path),
-		     "/sys/block%s/queue/wbt_lat_usec", dname);
-	if (n >= sizeof(sysfs_path))
+	n = snprintf(statepath, PATH_MAX, "%s/devtune.%s", MPOOL_RUNDIR_ROOT,
+		     strrchr(sysfs_dpath, '/') + 1);
+	if (n >= PATH_MAX)
 		return merr(ENAMETOOLONG);
 
-	/* This sysfs may not exist for some linux versions,
-	 * so don't return an error in that case...
-	 */
-	fp = fopen(sysfs_path, "wb");
+	return 0;
+}
+
+/**
+ * devtune_state_lock() - open and lock the tuning state file of a disk
+ * @statepath: state file path
+ * @flags:     open flags, the lock is shared for O_RDONLY
+ * @fdp:       (output) locked file descriptor, close() to unlock
+ *
+ * The file is removed by the last sysfs_pd_untune() of the disk, so a lock
+ * obtained on a file unlinked meanwhile is retried on the current one.
+ */
+static merr_t
+devtune_state_lock(const char *statepath, int flags, int *fdp)
+{
+	struct stat st;
+	merr_t      err;
+	int         fd, op;
+
+	if ((flags & O_CREAT) && mkdir(MPOOL_RUNDIR_ROOT, 0755) &&
+	    errno != EEXIST)
+		return merr(errno);
+
+	op = (flags & O_ACCMODE) == O_RDONLY ? LOCK_SH : LOCK_EX;
+
+	while (true) {
+		fd = open(statepath, flags | O_CLOEXEC, 0644);
+		if (fd == -1)
+			return merr(errno);
+
+		if (flock(fd, op)) {
+			err = merr(errno);
+			close(fd);
+			return err;
+		}
+
+		if (fstat(fd, &st)) {
+			err = merr(errno);
+			close(fd);
+			return err;
+		}
+
+		if (st.st_nlink > 0)
+			break;
+
+		close(fd);
+	}
+
+	*fdp = fd;
+
+	return 0;
+}
+
+static bool
+devtune_state_read(int fd, struct devtune_state *ds)
+{
+	return pread(fd, ds, sizeof(*ds), 0) == sizeof(*ds) &&
+		ds->ds_magic == DEVTUNE_STATE_MAGIC && ds->ds_refs > 0;
+}
+
+static merr_t
+devtune_state_write(int fd, const struct devtune_state *ds)
+{
+	if (pwrite(fd, ds, sizeof(*ds), 0) != sizeof(*ds))
+		return merr(errno ?: EIO);
+
+	return 0;
+}
+
+static merr_t
+devtune_write(char *sysfs_dpath, const char *name, const char *val)
+{
+	char    path[PATH_MAX];
+	merr_t  err = 0;
+	FILE   *fp;
+
+	snprintf(path, sizeof(path), "%s/queue/%s", sysfs_dpath, name);
+
+	fp = fopen(path, "w");
 	if (!fp)
+		return merr(errno);
+
+	if (fputs(val, fp) == EOF)
+		err = merr(errno ?: EIO);
+
+	/* sysfs reports a rejected value when the buffer is flushed */
+	if (fclose(fp) == EOF && !err)
+		err = merr(errno ?: EIO);
+
+	return err;
+}
+
+/**
+ * devtune_apply() - write the set settings of @dt to a disk's queue
+ * @sysfs_dpath: /sys/block/<device name>
+ * @dt:          settings to write
+ * @old:         (output) previous values of the settings written, or NULL
+ *
+ * Settings that cannot be written are logged and unset in @dt.
+ */
+static void
+devtune_apply(
+	char                   *sysfs_dpath,
+	struct mpool_devtune   *dt,
+	struct mpool_devtune   *old)
+{
+	char    val[64], *p, *q;
+	u64     cur;
+	merr_t  err;
+	s64    *v;
+	int     i;
+
+	if (dt->mdt_sched[0]) {
+		if (old) {
+			err = sysfs_get_val_str(sysfs_dpath, "/queue/scheduler",
+						0, val, sizeof(val));
+
+			/* The current scheduler is the one in brackets */
+			p = err ? NULL : strchr(val, '[');
+			q = p ? strchr(p, ']') : NULL;
+			if (q) {
+				*q = '\000';
+				strlcpy(old->mdt_sched, p + 1,
+					sizeof(old->mdt_sched));
+			}
+		}
+
+		err = devtune_write(sysfs_dpath, "scheduler", dt->mdt_sched);
+		if (err) {
+			mpool_elog(MPOOL_WARNING
+				   "Setting scheduler %s on %s failed, @@e",
+				   err, dt->mdt_sched, sysfs_dpath);
+			dt->mdt_sched[0] = '\000';
+			if (old)
+				old->mdt_sched[0] = '\000';
+		}
+	}
+
+	for (i = 0; i < NELEM(devtune_attrv); i++) {
+		v = devtune_val(dt, devtune_attrv + i);
+		if (*v < 0)
+			continue;
+
+		snprintf(val, sizeof(val), "/queue/%s", devtune_attrv[i].da_name);
+
+		/* This sysfs may not exist for some linux versions */
+		if (old) {
+			err = sysfs_get_val_u64(sysfs_dpath, val, 0, &cur);
+			if (err) {
+				*v = -1;
+				continue;
+			}
+			*devtune_val(old, devtune_attrv + i) = cur;
+		}
+
+		snprintf(val, sizeof(val), "%ld", (long)*v);
+
+		err = devtune_write(sysfs_dpath, devtune_attrv[i].da_name, val);
+		if (err) {
+			mpool_elog(MPOOL_WARNING "Setting %s %s on %s failed, @@e",
+				   err, devtune_attrv[i].da_name, val,
+				   sysfs_dpath);
+			*v = -1;
+			if (old)
+				*devtune_val(old, devtune_attrv + i) = -1;
+		}
+	}
+}
+
+/**
+ * devtune_merge() - set the settings of @dst that are unset, from @src
+ */
+static void
+devtune_merge(struct mpool_devtune *dst, struct mpool_devtune *src)
+{
+	s64    *v;
+	int     i;
+
+	if (!dst->mdt_sched[0])
+		strlcpy(dst->mdt_sched, src->mdt_sched, sizeof(dst->mdt_sched));
+
+	for (i = 0; i < NELEM(devtune_attrv); i++) {
+		v = devtune_val(dst, devtune_attrv + i);
+		if (*v < 0)
+			*v = *devtune_val(src, devtune_attrv + i);
+	}
+}
+
+merr_t
+sysfs_pd_tune(
+	const char *ppath,
+	bool        profile)
+{
+	struct dev_table_ent   *ent;
+	struct devtune_state    ds;
+	struct mpool_devtune    dt, old;
+	enum device_phys_if     phys_if;
+	char                    dpath[PATH_MAX];
+	char                    sysfs_dpath[PATH_MAX];
+	char                    statepath[PATH_MAX];
+	char                    model[MODEL_SZ];
+	merr_t                  err;
+	bool                    first;
+	int                     fd;
+
+	err = devtune_resolve(ppath, dpath, sysfs_dpath, statepath);
+	if (err)
+		return merr_errno(err) == ENOTBLK ? 0 : err;
+
+	err = dev_find_ent(dpath, sysfs_dpath, model, &phys_if, &ent);
+	if (err)
+		return err;
+
+	pthread_once(&devtune_conf_once, devtune_conf_load);
+
+	err = devtune_state_lock(statepath, O_RDWR | O_CREAT, &fd);
+	if (err)
+		return err;
+
+	if (profile) {
+		dt = ent->dev_tune;
+	} else {
+		devtune_unset(&dt);
+		dt.mdt_wbt_lat_usec = ent->dev_tune.mdt_wbt_lat_usec;
+	}
+
+	first = !devtune_state_read(fd, &ds);
+	if (!first) {
+		/*
+		 * Already tuned, the saved settings are the original ones.
+		 * Save those of settings not applied by earlier tunings.
+		 */
+		devtune_unset(&old);
+		devtune_apply(sysfs_dpath, &dt, &old);
+		devtune_merge(&ds.ds_saved, &old);
+		devtune_merge(&ds.ds_applied, &dt);
+		ds.ds_refs++;
+	} else {
+		memset(&ds, 0, sizeof(ds));
+		ds.ds_magic = DEVTUNE_STATE_MAGIC;
+		ds.ds_refs = 1;
+		devtune_unset(&ds.ds_saved);
+
+		devtune_apply(sysfs_dpath, &dt, &ds.ds_saved);
+		ds.ds_applied = dt;
+	}
+
+	err = devtune_state_write(fd, &ds);
+	if (err) {
+		/* Without a record the settings could never be restored */
+		if (first) {
+			devtune_apply(sysfs_dpath, &ds.ds_saved, NULL);
+			unlink(statepath);
+		}
+		close(fd);
+		return err;
+	}
+
+	close(fd);
+
+	mse_log(MPOOL_INFO "Applied %s %s on %s", ent->dev_model,
+		profile ? "tuning profile" : "writeback throttling setting",
+		dpath);
+
+	return 0;
+}
+
+merr_t
+sysfs_pd_untune(
+	const char *ppath)
+{
+	struct devtune_state    ds;
+	char                    dpath[PATH_MAX];
+	char                    sysfs_dpath[PATH_MAX];
+	char                    statepath[PATH_MAX];
+	merr_t                  err;
+	int                     fd;
+
+	err = devtune_resolve(ppath, dpath, sysfs_dpath, statepath);
+	if (err)
+		return merr_errno(err) == ENOTBLK ? 0 : err;
+
+	err = devtune_state_lock(statepath, O_RDWR, &fd);
+	if (err)
+		return merr_errno(err) == ENOENT ? 0 : err;
+
+	if (!devtune_state_read(fd, &ds)) {
+		close(fd);
 		return 0;
+	}
 
-	/* Write a zero into the file to turn off write throtting */
-	fprintf(fp, "0");
-	fclose(fp);
+	if (--ds.ds_refs > 0) {
+		err = devtune_state_write(fd, &ds);
+		close(fd);
+		return err;
+	}
+
+	devtune_apply(sysfs_dpath, &ds.ds_saved, NULL);
+	unlink(statepath);
+	close(fd);
+
+	mse_log(MPOOL_INFO "Restored queue settings on %s", dpath);
+
+	return 0;
+}
+
+merr_t
+sysfs_pd_tune_get(
+	const char             *ppath,
+	struct mpool_devtune   *applied,
+	struct mpool_devtune   *saved)
+{
+	struct devtune_state    ds;
+	char                    dpath[PATH_MAX];
+	char                    sysfs_dpath[PATH_MAX];
+	char                    statepath[PATH_MAX];
+	merr_t                  err;
+	bool                    valid;
+	int                     fd;
+
+	err = devtune_resolve(ppath, dpath, sysfs_dpath, statepath);
+	if (err)
+		return merr_errno(err) == ENOTBLK ? merr(ENOENT) : err;
+
+	err = devtune_state_lock(statepath, O_RDONLY, &fd);
+	if (err)
+		return err;
+
+	valid = devtune_state_read(fd, &ds);
+	close(fd);
 
-	mse_log(MPOOL_INFO "Turned off write throttling on %s", dpath);
+	if (!valid)
+		return merr(ENOENT);
+
+	if (applied)
+		*applied = ds.ds_applied;
+	if (saved)
+		*saved = ds.ds_saved;
 
 	return 0;
 }
@@ -876,8 +1474,8 @@ partname_to_diskname(
 	return 0;
 }
 
-merr_t
-mpool_devinfo(
+static merr_t
+devinfo_resolve(
 	const char  *name,
 	char        *devpath,
 	size_t       devpathsz)
@@ -928,3 +1526,204 @@ mpool_devinfo(
 
 	return 0;
 }
+
+/**
+ * devinfo_stamp() - Identify the current incarnation of a block device
+ * @name: device name
+ * @key:  cache key (output)
+ *
+ * udev rewrites its database entry of a device on every event for it, so
+ * a cached result is valid as long as neither the device number nor the
+ * mtime of that entry has changed.  Without udev nothing is cached.
+ */
+static bool
+devinfo_stamp(
+	const char                 *name,
+	struct devinfo_cache_ent   *key)
+{
+	struct stat st;
+	char        path[PATH_MAX];
+
+	memset(key, 0, sizeof(*key));
+
+	if (strlcpy(key->dc_name, name, sizeof(key->dc_name)) >=
+	    sizeof(key->dc_name))
+		return false;
+
+	if (stat(name, &st) || !S_ISBLK(st.st_mode))
+		return false;
+
+	key->dc_rdev = st.st_rdev;
+	key->dc_magic = DEVINFO_CACHE_MAGIC;
+
+	snprintf(path, sizeof(path), "%s/b%u:%u", UDEV_DATA_DIR,
+		 major(st.st_rdev), minor(st.st_rdev));
+
+	if (stat(path, &st))
+		return false;
+
+	key->dc_sec = st.st_mtim.tv_sec;
+	key->dc_nsec = st.st_mtim.tv_nsec;
+
+	return true;
+}
+
+static bool
+devinfo_stamp_match(
+	const struct devinfo_cache_ent *ent,
+	const struct devinfo_cache_ent *key)
+{
+	return ent->dc_rdev == key->dc_rdev && ent->dc_sec == key->dc_sec &&
+		ent->dc_nsec == key->dc_nsec;
+}
+
+/**
+ * devinfo_cache_read() - Read the cache, dropping entries of another format
+ */
+static int
+devinfo_cache_read(struct devinfo_cache_ent *entv)
+{
+	ssize_t cc;
+	int     fd, entc, i, n;
+
+	fd = open(DEVINFO_CACHE_FILE, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return 0;
+
+	cc = read(fd, entv, DEVINFO_CACHE_MAX * sizeof(*entv));
+	close(fd);
+
+	entc = (cc > 0) ? cc / sizeof(*entv) : 0;
+
+	for (i = n = 0; i < entc; ++i)
+		if (entv[i].dc_magic == DEVINFO_CACHE_MAGIC)
+			entv[n++] = entv[i];
+
+	return n;
+}
+
+/**
+ * devinfo_cache_lookup() - Find the valid cache entry of a device
+ * @key:  stamp of the device, from devinfo_stamp()
+ * @flag: DC_DEVPATH or DC_PROP, the result needed
+ * @ent:  cache entry (output)
+ */
+static bool
+devinfo_cache_lookup(
+	const struct devinfo_cache_ent *key,
+	u32                             flag,
+	struct devinfo_cache_ent       *ent)
+{
+	struct devinfo_cache_ent    entv[DEVINFO_CACHE_MAX];
+	int                         entc, i;
+
+	entc = devinfo_cache_read(entv);
+
+	for (i = 0; i < entc; ++i) {
+		if (strncmp(entv[i].dc_name, key->dc_name,
+			    sizeof(entv[i].dc_name)))
+			continue;
+
+		if (!devinfo_stamp_match(entv + i, key) ||
+		    !(entv[i].dc_flags & flag))
+			return false;
+
+		*ent = entv[i];
+		ent->dc_devpath[sizeof(ent->dc_devpath) - 1] = '\000';
+
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * devinfo_cache_update() - Add results to the cache entry of a device
+ * @upd: stamp of the device and the results flagged in upd->dc_flags
+ *
+ * Results of the same incarnation of the device already in the cache
+ * are kept, others are dropped.  The cache file is replaced atomically,
+ * concurrent updaters may lose each other's entries which merely costs
+ * a miss.  Failures are ignored.
+ */
+static void
+devinfo_cache_update(const struct devinfo_cache_ent *upd)
+{
+	struct devinfo_cache_ent    entv[DEVINFO_CACHE_MAX];
+	struct devinfo_cache_ent    ent = *upd;
+	char                        tmp[PATH_MAX];
+	ssize_t                     len;
+	int                         entc, fd, i;
+
+	entc = devinfo_cache_read(entv);
+
+	for (i = 0; i < entc; ++i) {
+		if (strncmp(entv[i].dc_name, ent.dc_name,
+			    sizeof(entv[i].dc_name)))
+			continue;
+
+		if (devinfo_stamp_match(entv + i, &ent)) {
+			if (!(ent.dc_flags & DC_DEVPATH) &&
+			    (entv[i].dc_flags & DC_DEVPATH))
+				memcpy(ent.dc_devpath, entv[i].dc_devpath,
+				       sizeof(ent.dc_devpath));
+			if (!(ent.dc_flags & DC_PROP) &&
+			    (entv[i].dc_flags & DC_PROP))
+				ent.dc_prop = entv[i].dc_prop;
+			ent.dc_flags |= entv[i].dc_flags;
+		}
+
+		memmove(entv + i, entv + i + 1, (entc - i - 1) * sizeof(*entv));
+		--entc;
+		break;
+	}
+
+	/* Evict the oldest entry */
+	if (entc >= DEVINFO_CACHE_MAX) {
+		memmove(entv, entv + 1, (entc - 1) * sizeof(*entv));
+		--entc;
+	}
+
+	entv[entc++] = ent;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", DEVINFO_CACHE_FILE, getpid());
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return;
+
+	len = entc * sizeof(*entv);
+	if (write(fd, entv, len) != len || rename(tmp, DEVINFO_CACHE_FILE))
+		unlink(tmp);
+
+	close(fd);
+}
+
+merr_t
+mpool_devinfo(
+	const char  *name,
+	char        *devpath,
+	size_t       devpathsz)
+{
+	struct devinfo_cache_ent    key, ent;
+	merr_t                      err;
+	bool                        cacheable;
+
+	cacheable = devinfo_stamp(name, &key);
+
+	if (cacheable && devinfo_cache_lookup(&key, DC_DEVPATH, &ent) &&
+	    strlcpy(devpath, ent.dc_devpath, devpathsz) < devpathsz)
+		return 0;
+
+	err = devinfo_resolve(name, devpath, devpathsz);
+	if (err || !cacheable)
+		return err;
+
+	if (strlcpy(key.dc_devpath, devpath, sizeof(key.dc_devpath)) <
+	    sizeof(key.dc_devpath)) {
+		key.dc_flags = DC_DEVPATH;
+		devinfo_cache_update(&key);
+	}
+
+	return 0;
+}
@@ -6,6 +6,7 @@
 #ifndef MPOOL_DEVICE_TABLE_H
 #define MPOOL_DEVICE_TABLE_H
 
+#include <mpool/mpool.h>
 #include <mpctl/pd_props.h>
 
 #include "mpctl.h"
@@ -46,11 +47,14 @@ typedef merr_t (devp_get_t)(
  *   or one of the generic values "Generic-SSD", "Generic-HDD", "File"
  * @devtype:      enum mp_pd_devtype
  * @dev_prop_get: function to get the properties of the device.
+ * @dev_tune:     block queue tuning profile applied at activation, may be
+ *   overridden per model in DEVTUNE_CONF_FILE.
  */
 struct dev_table_ent {
-	char		   *dev_model;
-	enum mp_pd_devtype  devtype;
-	devp_get_t	   *dev_prop_get;
+	char		     *dev_model;
+	enum mp_pd_devtype    devtype;
+	devp_get_t	     *dev_prop_get;
+	struct mpool_devtune  dev_tune;
 };
 
 /**
@@ -102,13 +106,47 @@ sysfs_get_dpath(
 	size_t	    sysfs_dpath_sz);
 
 /**
- * sysfs_pd_disable_wbt() - disable PD write throttling
+ * sysfs_pd_tune() - apply the tuning profile of a PD's class to its queue
+ * @ppath:   partition path. e.g. /dev/nvme0n1p1, /dev/sdb1
+ * @profile: apply the whole profile, else only its writeback throttling
+ *	setting
+ *
+ * The previous settings are saved under MPOOL_RUNDIR_ROOT for
+ * sysfs_pd_untune(), along with a count of the active mpools sharing the
+ * disk; the state file is flocked across the update.  Settings the kernel
+ * does not support or rejects are skipped.  Tuning is best effort, callers
+ * log an error and proceed with the current queue settings.
+ */
+merr_t
+sysfs_pd_tune(
+	const char            *ppath,
+	bool                   profile);
+
+/**
+ * sysfs_pd_untune() - restore the queue settings saved by sysfs_pd_tune()
  * @ppath: partition path. e.g. /dev/nvme0n1p1, /dev/sdb1
+ *
+ * Settings are only restored once every sysfs_pd_tune() of the disk has
+ * been undone, as partitions of one disk may belong to different mpools.
  */
 merr_t
-sysfs_pd_disable_wbt(
+sysfs_pd_untune(
 	const char            *ppath);
 
+/**
+ * sysfs_pd_tune_get() - get the tuning state of a PD
+ * @ppath:   partition path. e.g. /dev/nvme0n1p1, /dev/sdb1
+ * @applied: (output) settings applied by sysfs_pd_tune()
+ * @saved:   (output) settings to be restored by sysfs_pd_untune()
+ *
+ * Return: ENOENT if the PD's queue is not tuned.
+ */
+merr_t
+sysfs_pd_tune_get(
+	const char            *ppath,
+	struct mpool_devtune  *applied,
+	struct mpool_devtune  *saved);
+
 /**
  * partname_to_diskname() -
  * @diskname: (output) Path of whole disk
@@ -121,10 +159,13 @@ partname_to_diskname(
 	size_t      diskname_len);
 
 /**
- * mpool_devinfo() -
- * @name:
- * @devpath:
- * @devpathsz:
+ * mpool_devinfo() - Resolve the device path to display for a device
+ * @name:      device name
+ * @devpath:   (output) device path, e.g. /dev/<vg>/<lv> for dm devices
+ * @devpathsz: size of @devpath
+ *
+ * Results are cached under MPOOL_RUNDIR_ROOT and invalidated whenever udev
+ * processes an event for the device.
  */
 merr_t
 mpool_devinfo(
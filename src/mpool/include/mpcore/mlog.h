@@ -40,6 +40,34 @@ struct mpool_obj_layout;
  * -EBUSY = log is in erasing state; wait or retry erase
  */
 
+/**
+ * struct mlog_tail - mlog state rebuilt by validating its contents at open
+ * @mt_wsoff:   next sector offset to write
+ * @mt_pfsetid: previous flush set ID
+ * @mt_cfsetid: current flush set ID
+ * @mt_cstart:  valid compaction start marker found
+ * @mt_cend:    valid compaction end marker found
+ * @mt_valid:   the fields above are populated
+ */
+struct mlog_tail {
+	s64     mt_wsoff;
+	u32     mt_pfsetid;
+	u32     mt_cfsetid;
+	u8      mt_cstart;
+	u8      mt_cend;
+	bool    mt_valid;
+};
+
+/**
+ * struct mlog_rdpos - position between records in an mlog
+ * @lrp_soff: log block (sector) offset
+ * @lrp_roff: byte offset within the log block, 0 for its first record
+ */
+struct mlog_rdpos {
+	s64     lrp_soff;
+	u32     lrp_roff;
+};
+
 /**
  * mlog_open()
  *
@@ -60,6 +88,28 @@ mlog_open(
 	u8                          flags,
 	u64                        *gen);
 
+/**
+ * mlog_open_tail()
+ *
+ * Same as mlog_open(), but if @tail is valid its state is trusted in place
+ * of validating the log contents.  Otherwise, if the contents are validated,
+ * @tail is populated with the resulting state and marked valid.
+ * @mp:
+ * @mlh:
+ * @flags:
+ * @tail:  validated state (input/output)
+ * @gen:   output
+ *
+ * Returns: 0 if successful, mpool_err_t otherwise
+ */
+mpool_err_t
+mlog_open_tail(
+	struct mpool_descriptor    *mp,
+	struct mlog_descriptor     *mlh,
+	u8                          flags,
+	struct mlog_tail           *tail,
+	u64                        *gen);
+
 mpool_err_t mlog_close(struct mpool_descriptor *mp, struct mlog_descriptor *mlh);
 
 mpool_err_t mlog_flush(struct mpool_descriptor *mp, struct mlog_descriptor *mlh);
@@ -79,6 +129,12 @@ mlog_len(
 	struct mlog_descriptor     *mlh,
 	u64                        *len);
 
+mpool_err_t
+mlog_dmax(
+	struct mpool_descriptor    *mp,
+	struct mlog_descriptor     *mlh,
+	s64                        *dmax);
+
 mpool_err_t
 mlog_append_cstart(struct mpool_descriptor *mp, struct mlog_descriptor *mlh);
 
@@ -134,6 +190,56 @@ mlog_seek_read_data_next(
 	u64                         buflen,
 	u64                        *rdlen);
 
+mpool_err_t
+mlog_read_data_init_tail(
+	struct mpool_descriptor    *mp,
+	struct mlog_descriptor     *mlh);
+
+/**
+ * mlog_read_data_prev()
+ * @mp:
+ * @mlh:
+ * @buf:
+ * @buflen:
+ * @rdlen:
+ *
+ * Returns:
+ *   If merr_errno(return value) is EOVERFLOW, then "buf" is too small to
+ *   hold the read data. Can be retried with a bigger receive buffer whose
+ *   size is returned in rdlen.
+ */
+mpool_err_t
+mlog_read_data_prev(
+	struct mpool_descriptor    *mp,
+	struct mlog_descriptor     *mlh,
+	char                       *buf,
+	u64                         buflen,
+	u64                        *rdlen);
+
+mpool_err_t
+mlog_append_pos(
+	struct mpool_descriptor    *mp,
+	struct mlog_descriptor     *mlh,
+	struct mlog_rdpos          *pos);
+
+mpool_err_t
+mlog_tail_get(
+	struct mpool_descriptor    *mp,
+	struct mlog_descriptor     *mlh,
+	struct mlog_tail           *tail);
+
+mpool_err_t
+mlog_read_pos(
+	struct mpool_descriptor    *mp,
+	struct mlog_descriptor     *mlh,
+	struct mlog_rdpos          *pos);
+
+mpool_err_t
+mlog_read_seek(
+	struct mpool_descriptor    *mp,
+	struct mlog_descriptor     *mlh,
+	const struct mlog_rdpos    *pos);
+
 /*
  * Used for user-space mlogs support
  */
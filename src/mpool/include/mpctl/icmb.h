@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_MPOOL_ICMB_PRIV_H
+#define MPOOL_MPOOL_ICMB_PRIV_H
+
+#include <util/inttypes.h>
+
+#include <sys/types.h>
+
+/**
+ * cmb_lz_compress() - Compress a buffer with the compressed mblock codec
+ * @srcp:   input
+ * @srclen: input length
+ * @dstp:   output
+ * @dstcap: output capacity
+ *
+ * Return: compressed size, or 0 if the output would not be smaller than
+ * @dstcap.
+ */
+size_t
+cmb_lz_compress(
+	const void *srcp,
+	size_t      srclen,
+	void       *dstp,
+	size_t      dstcap);
+
+/**
+ * cmb_lz_decompress() - Decompress a buffer
+ * @srcp:   input
+ * @srclen: input length
+ * @dstp:   output
+ * @dstcap: output capacity
+ *
+ * Return: decompressed size, or -1 if the input is malformed
+ */
+ssize_t
+cmb_lz_decompress(
+	const void *srcp,
+	size_t      srclen,
+	void       *dstp,
+	size_t      dstcap);
+
+#endif /* MPOOL_MPOOL_ICMB_PRIV_H */
@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_MPOOL_IINTENT_PRIV_H
+#define MPOOL_MPOOL_IINTENT_PRIV_H
+
+#include <util/inttypes.h>
+
+#define INTENT_FILE_PFX         "intent."
+
+struct mpool;
+struct intent_jnl;
+struct intent_reclaim;
+
+/*
+ * Types of objects recorded in an intent journal
+ */
+enum intent_otype {
+	INTENT_MBLOCK = 1,
+	INTENT_MLOG   = 2,
+};
+
+/**
+ * intent_jnl_open() - Create the intent journal of an mpool handle
+ * @ds: mpool handle, opened for writing
+ *
+ * The journal is a file in the mpool rundir, locked for as long as the
+ * handle is open.  Returns NULL if it cannot be created, in which case
+ * callers simply do without it.
+ */
+struct intent_jnl *
+intent_jnl_open(struct mpool *ds);
+
+/**
+ * intent_jnl_close() - Close an intent journal
+ * @ij: journal, may be NULL
+ *
+ * An empty journal is removed.  Otherwise the journal is unlocked with its
+ * objects still recorded, and they are aborted by the next reclaim of the
+ * mpool even if this process is still running: an object must be
+ * committed or aborted before the handle that allocated it is closed.
+ */
+void
+intent_jnl_close(struct intent_jnl *ij);
+
+/**
+ * intent_jnl_add() - Record an allocated, uncommitted object
+ * @ij:    journal, may be NULL
+ * @objid: object ID
+ * @type:  object type
+ */
+void
+intent_jnl_add(
+	struct intent_jnl  *ij,
+	u64                 objid,
+	enum intent_otype   type);
+
+/**
+ * intent_jnl_del() - Forget an object once committed, aborted or deleted
+ * @ij:    journal, may be NULL
+ * @objid: object ID, need not be recorded
+ */
+void
+intent_jnl_del(
+	struct intent_jnl  *ij,
+	u64                 objid);
+
+/**
+ * intent_reclaim_start() - Start aborting orphaned objects in the background
+ * @ds: mpool handle, opened for writing
+ *
+ * Collects the objects recorded in all journals of the mpool whose owners
+ * are gone and aborts those still uncommitted, in parallel.  Returns NULL
+ * if the reclaim thread cannot be started, the next opener retries.
+ */
+struct intent_reclaim *
+intent_reclaim_start(struct mpool *ds);
+
+/**
+ * intent_reclaim_stop() - Stop a reclaim and wait for it
+ * @ir: reclaim, may be NULL
+ *
+ * Journals not fully processed are left for the next opener.
+ *
+ * Return: number of objects aborted
+ */
+u32
+intent_reclaim_stop(struct intent_reclaim *ir);
+
+#endif /* MPOOL_MPOOL_IINTENT_PRIV_H */
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_MPOOL_IMCRA_PRIV_H
+#define MPOOL_MPOOL_IMCRA_PRIV_H
+
+#include <util/inttypes.h>
+
+#include "mpool_err.h"
+
+struct mcache_ra;
+struct mpool_mcache_ra_stats;
+
+/**
+ * mcra_create() - Create the readahead controller of an mcache map
+ * @base:   map base address
+ * @bktsz:  map bucket size, i.e., the distance between mblocks
+ * @mbidc:  number of mblocks in the map
+ * @adapt:  may switch the whole map between MADV_RANDOM and MADV_NORMAL
+ * @rap:    controller (output)
+ */
+merr_t
+mcra_create(
+	void               *base,
+	size_t              bktsz,
+	uint                mbidc,
+	bool                adapt,
+	struct mcache_ra  **rap);
+
+/**
+ * mcra_destroy() - Free a readahead controller
+ * @ra: controller, may be NULL
+ */
+void
+mcra_destroy(struct mcache_ra *ra);
+
+/**
+ * mcra_access() - Record an access and read ahead if it extends a run
+ * @ra:    controller, may be NULL
+ * @mbidx: mcache map mblock index
+ * @pgnum: first page accessed
+ * @pgcnt: number of pages accessed
+ */
+void
+mcra_access(
+	struct mcache_ra   *ra,
+	uint                mbidx,
+	size_t              pgnum,
+	size_t              pgcnt);
+
+/**
+ * mcra_stats() - Get readahead statistics
+ * @ra:    controller, may be NULL
+ * @stats: statistics (output)
+ */
+void
+mcra_stats(
+	struct mcache_ra               *ra,
+	struct mpool_mcache_ra_stats   *stats);
+
+#endif /* MPOOL_MPOOL_IMCRA_PRIV_H */
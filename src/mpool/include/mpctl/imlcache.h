@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_MPOOL_IMLCACHE_PRIV_H
+#define MPOOL_MPOOL_IMLCACHE_PRIV_H
+
+#include <util/inttypes.h>
+
+#define MLCACHE_FILE            "mlog.cache"
+#define MLCACHE_VER_BUSY        ((u64)-1)
+
+struct mlcache;
+struct mlog_tail;
+
+/**
+ * mlcache_open() - Map the mlog tail cache of an mpool
+ * @mpname: mpool name
+ *
+ * The cache is a file in the mpool rundir shared by all processes on the
+ * host.  Returns NULL if it cannot be mapped, in which case callers simply
+ * do without it.
+ */
+struct mlcache *
+mlcache_open(const char *mpname);
+
+/**
+ * mlcache_close() - Unmap an mlog tail cache
+ * @mlc: cache handle, may be NULL
+ */
+void
+mlcache_close(struct mlcache *mlc);
+
+/**
+ * mlcache_lookup() - Look up the validated tail of an mlog
+ * @mlc:   cache handle
+ * @objid: mlog object ID
+ * @gen:   mlog generation
+ * @tail:  validated state (output)
+ *
+ * Return: true if @tail was populated with state that no write has
+ * invalidated since it was published.
+ */
+bool
+mlcache_lookup(
+	struct mlcache     *mlc,
+	u64                 objid,
+	u64                 gen,
+	struct mlog_tail   *tail);
+
+/**
+ * mlcache_wver() - Sample the write version before validating an mlog
+ * @mlc:   cache handle
+ * @objid: mlog object ID
+ *
+ * Return: version to pass to mlcache_publish(), or MLCACHE_VER_BUSY if
+ * writes are in flight.
+ */
+u64
+mlcache_wver(
+	struct mlcache *mlc,
+	u64             objid);
+
+/**
+ * mlcache_publish() - Publish the validated tail of an mlog
+ * @mlc:   cache handle
+ * @objid: mlog object ID
+ * @gen:   mlog generation
+ * @wver:  version sampled by mlcache_wver() before validation
+ * @tail:  validated state
+ *
+ * Nothing is published if a write started since @wver was sampled.
+ */
+void
+mlcache_publish(
+	struct mlcache             *mlc,
+	u64                         objid,
+	u64                         gen,
+	u64                         wver,
+	const struct mlog_tail     *tail);
+
+/**
+ * mlcache_wstart() - Note that a write to an mlog is starting
+ * @mlc:   cache handle, may be NULL
+ * @objid: mlog object ID
+ */
+void
+mlcache_wstart(
+	struct mlcache *mlc,
+	u64             objid);
+
+/**
+ * mlcache_wend() - Note that a write to an mlog has completed
+ * @mlc:   cache handle, may be NULL
+ * @objid: mlog object ID
+ * @wrote: the write changed the mlog on media
+ *
+ * Published tails stay valid across writes that only buffered data.
+ */
+void
+mlcache_wend(
+	struct mlcache *mlc,
+	u64             objid,
+	bool            wrote);
+
+#endif /* MPOOL_MPOOL_IMLCACHE_PRIV_H */
@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_MPOOL_IMLKIDX_PRIV_H
+#define MPOOL_MPOOL_IMLKIDX_PRIV_H
+
+#include <util/inttypes.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+
+#define MLKIDX_STRIDE_DFLT      (16)
+
+struct mpool;
+struct mpool_mlog;
+struct mlog_kidx;
+struct mlog_rdpos;
+struct iovec;
+
+/*
+ * All of the functions below must be called with the mlog handle lock
+ * held (or with serialization guaranteed by an MLOG_OF_SKIP_SER client).
+ */
+
+/**
+ * mlkidx_create() - Create the sparse key index of an mlog
+ * @ds:     dataset handle
+ * @mlh:    mlog handle, must be open
+ * @keyfn:  key extractor
+ * @arg:    argument passed to @keyfn
+ * @stride: minimum distance in log blocks between index entries
+ * @kxp:    key index (output)
+ *
+ * A copy persisted under the mpool rundir by an earlier session is loaded
+ * if it matches the mlog generation.
+ */
+merr_t
+mlkidx_create(
+	struct mpool           *ds,
+	struct mpool_mlog      *mlh,
+	mpool_mlog_keyfn_t     *keyfn,
+	void                   *arg,
+	u32                     stride,
+	struct mlog_kidx      **kxp);
+
+/**
+ * mlkidx_destroy() - Free a key index
+ * @kx: key index, may be NULL
+ */
+void
+mlkidx_destroy(struct mlog_kidx *kx);
+
+/**
+ * mlkidx_append() - Index a record just appended at @pos
+ * @ds:   dataset handle
+ * @mlh:  mlog handle
+ * @kx:   key index
+ * @pos:  append position before the record was appended
+ * @iov:  record data
+ * @len:  record length
+ */
+void
+mlkidx_append(
+	struct mpool               *ds,
+	struct mpool_mlog          *mlh,
+	struct mlog_kidx           *kx,
+	const struct mlog_rdpos    *pos,
+	const struct iovec         *iov,
+	size_t                      len);
+
+/**
+ * mlkidx_seek() - Position the read cursor at the first record >= @key
+ * @ds:  dataset handle
+ * @mlh: mlog handle
+ * @kx:  key index
+ * @key: key to seek to
+ *
+ * Records not yet indexed are indexed first.  Return EINVAL if records
+ * were found out of key order.
+ */
+merr_t
+mlkidx_seek(
+	struct mpool       *ds,
+	struct mpool_mlog  *mlh,
+	struct mlog_kidx   *kx,
+	u64                 key);
+
+/**
+ * mlkidx_reset() - Drop all index entries, e.g., after an erase
+ * @kx:  key index
+ * @gen: new mlog generation
+ */
+void
+mlkidx_reset(
+	struct mlog_kidx   *kx,
+	u64                 gen);
+
+/**
+ * mlkidx_persist() - Save the index under the mpool rundir
+ * @ds:  dataset handle
+ * @mlh: mlog handle
+ * @kx:  key index
+ */
+void
+mlkidx_persist(
+	struct mpool       *ds,
+	struct mpool_mlog  *mlh,
+	struct mlog_kidx   *kx);
+
+#endif /* MPOOL_MPOOL_IMLKIDX_PRIV_H */
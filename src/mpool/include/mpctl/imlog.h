@@ -61,6 +61,22 @@ mpool_mlog_append_cend(
 	struct mpool       *ds,
 	struct mpool_mlog  *mlh);
 
+/**
+ * mpool_mlog_append_dmax() - Return the largest record that can be appended
+ *
+ * @ds:    dataset handle
+ * @mlh:   mlog handle
+ * @dmax:  max data record length in bytes, -1 if the log is full (output)
+ *
+ * Return:
+ *   %0 on success, <%0 on error
+ */
+merr_t
+mpool_mlog_append_dmax(
+	struct mpool       *ds,
+	struct mpool_mlog  *mlh,
+	s64                *dmax);
+
 /**
  * mpool_mlog_gen() - Return mlog generation number
  *
@@ -26,6 +26,11 @@
 #define MAX_MEM_INGEST_ASYNCIO_DS     (2 << 20)
 
 struct mpool_devrpt;
+struct mlcache;
+struct mlog_kidx;
+struct mpool_iobuf_pool;
+struct mpool_mcache_map;
+struct intent_jnl;
 enum mp_status;
 
 /**
@@ -63,6 +68,7 @@ enum ds_throttle_queue {
  * @ml_dsfd:   dataset fd
  * @ml_idx:    Index where this handle is stored in dataset lookup map
  * @ml_flags:  Mlog flags
+ * @ml_kidx:   Sparse key index, if enabled
  *
  * Ordering:
  *     mlog handle lock (ml_lock)
@@ -78,6 +84,7 @@ struct mpool_mlog {
 	int                         ml_dsfd;
 	u16                         ml_idx;
 	u8                          ml_flags;
+	struct mlog_kidx           *ml_kidx;
 };
 
 /*
@@ -94,6 +101,25 @@ struct mp_mloghmap {
 	int                 mlm_refcnt;
 };
 
+/* Number of mcache maps kept for mpool_mblock_send() */
+#define MAX_SEND_MAPS      8
+
+/*
+ * struct mp_sendmap:
+ * mcache map of one mblock, kept for reuse by mpool_mblock_send()
+ *
+ * @sm_mbh:    mblock handle, 0 once the mblock is being deleted
+ * @sm_map:    mcache map, NULL if the slot is free
+ * @sm_refcnt: sends using the map
+ * @sm_used:   value of ds_sendclk at the last use
+ */
+struct mp_sendmap {
+	u64                         sm_mbh;
+	struct mpool_mcache_map    *sm_map;
+	u32                         sm_refcnt;
+	u64                         sm_used;
+};
+
 /**
  * struct mpool:
  * @ds_mlmap:  fixed size map from object ID to mlog handle
@@ -105,6 +131,14 @@ struct mp_mloghmap {
  * @ds_mltot:  total occupied slots in ds_mlmap
  * @ds_maxmem_asyncio: configure max memory async io consume.
  * @ds_maxcsmd_asyncio: current consumption async io.
+ * @ds_mlcache: shared mlog tail cache, NULL if unavailable
+ * @ds_iobuf:   I/O buffer pool for bounce buffers, NULL if none attached
+ * @ds_iobuf_users: bounce buffers of @ds_iobuf in use, under @ds_lock
+ * @ds_iobuf_cv: signaled when @ds_iobuf_users drops to zero
+ * @ds_intent:  journal of uncommitted objects, NULL if unavailable
+ * @ds_reclaim: background reclaim of orphaned objects, NULL if none
+ * @ds_sendmap: mcache maps kept for mpool_mblock_send(), under @ds_lock
+ * @ds_sendclk: number of mpool_mblock_send() map lookups, under @ds_lock
  * @ds_lock:
  */
 struct mpool {
@@ -117,6 +151,14 @@ struct mpool {
 	u16                  ds_mltot;
 	u64                  ds_maxmem_asyncio[DS_MAX_THQ];
 	atomic64_t           ds_memcsmd_asyncio[DS_MAX_THQ];
+	struct mlcache      *ds_mlcache;
+	struct mpool_iobuf_pool *ds_iobuf;
+	u32                  ds_iobuf_users;
+	pthread_cond_t       ds_iobuf_cv;
+	struct intent_jnl   *ds_intent;
+	struct intent_reclaim *ds_reclaim;
+	struct mp_sendmap    ds_sendmap[MAX_SEND_MAPS];
+	u64                  ds_sendclk;
 	struct mutex         ds_lock;
 };
 
@@ -16,6 +16,10 @@
  *
  * @path:
  * @pd_prop:
+ *
+ * Properties of block devices are cached along with mpool_devinfo()
+ * results and read again from sysfs only after udev processed an event
+ * for the device.
  */
 mpool_err_t
 imp_dev_get_prop(
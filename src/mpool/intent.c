@@ -0,0 +1,806 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Intent journals for orphan reclamation.
+ *
+ * An mblock or mlog that is allocated but never committed, aborted or
+ * deleted, typically because its process crashed, lingers until the mpool
+ * is deactivated.  To reclaim such orphans without making applications
+ * enumerate them, every handle opened for writing records its uncommitted
+ * objects in a journal file in the mpool rundir:
+ *
+ *   intent.<pid>.<n> - header followed by slots of (objid, type)
+ *
+ * The file is mapped shared, so recording an object is a couple of stores
+ * under the journal lock and survives the process.  It need not survive
+ * the host, since uncommitted objects do not survive deactivation either.
+ * The owner holds an exclusive flock on its journal, so a journal that can
+ * be locked by anyone else belongs to a handle that is closed or a process
+ * that is gone.  A journal is set up under a temporary name that only
+ * reclaimers acting for a dead creator touch, and is locked before it is
+ * published under its final name.
+ *
+ * mpool_open() starts a background thread that collects the objects of all
+ * such journals and aborts those still uncommitted, spread over several
+ * threads, before removing the journals.  Objects that were committed or
+ * deleted after being recorded are left alone.  mpool_close() stops the
+ * thread early if need be; unfinished journals are left for the next open.
+ */
+
+#include <util/platform.h>
+#include <util/alloc.h>
+#include <util/atomic.h>
+#include <util/minmax.h>
+#include <util/mutex.h>
+#include <util/string.h>
+
+#include <mpool/mpool.h>
+#include <mpctl/impool.h>
+#include <mpctl/iintent.h>
+
+#include "mpool_err.h"
+#include "logging.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INTENT_MAGIC            ((u32)0x4d504931)       /* "MPI1" */
+#define INTENT_VERSION          (1)
+#define INTENT_NSLOTS_MIN       (1024)
+#define INTENT_NSLOTS_MAX       (1024 * 1024)
+#define INTENT_THREADS_MAX      (8)
+#define INTENT_THREAD_OBJS      (64)    /* orphans per reclaim thread */
+
+/**
+ * struct intent_hdr - journal file header
+ * @ih_magic:   INTENT_MAGIC, written last at initialization
+ * @ih_version: INTENT_VERSION
+ * @ih_slotsz:  sizeof(struct intent_slot)
+ */
+struct intent_hdr {
+	u32     ih_magic;
+	u32     ih_version;
+	u32     ih_slotsz;
+	u32     ih_rsvd;
+};
+
+/**
+ * struct intent_slot - journal slot
+ * @is_objid: object ID, 0 if the slot is free
+ * @is_type:  enum intent_otype
+ */
+struct intent_slot {
+	u64     is_objid;
+	u32     is_type;
+	u32     is_rsvd;
+};
+
+/**
+ * struct intent_jnl - intent journal of an mpool handle
+ * @ij_lock:   protects everything below
+ * @ij_fd:     journal file, flocked
+ * @ij_base:   journal mapping
+ * @ij_len:    length of @ij_base
+ * @ij_slotv:  slots
+ * @ij_nslots: number of slots
+ * @ij_freev:  free slot indexes
+ * @ij_nfree:  number of entries in @ij_freev
+ * @ij_hashv:  objid hash of the used slots, slot index + 1 or 0 if empty
+ * @ij_hmask:  size of @ij_hashv - 1
+ * @ij_full:   journal could not grow, objects are no longer recorded
+ * @ij_path:   journal file path
+ */
+struct intent_jnl {
+	struct mutex            ij_lock;
+	int                     ij_fd;
+	void                   *ij_base;
+	size_t                  ij_len;
+	struct intent_slot     *ij_slotv;
+	u32                     ij_nslots;
+	u32                    *ij_freev;
+	u32                     ij_nfree;
+	u32                    *ij_hashv;
+	u32                     ij_hmask;
+	bool                    ij_full;
+	char                    ij_path[PATH_MAX];
+};
+
+/**
+ * struct intent_orphan - object collected from a dead journal
+ * @io_objid: object ID
+ * @io_type:  enum intent_otype
+ * @io_jidx:  index of the journal it came from
+ */
+struct intent_orphan {
+	u64     io_objid;
+	u32     io_type;
+	u32     io_jidx;
+};
+
+/**
+ * struct intent_dead - dead journal being reclaimed
+ * @id_fd:   journal file, flocked
+ * @id_err:  some of its orphans could not be reclaimed
+ * @id_name: file name in the rundir
+ */
+struct intent_dead {
+	int     id_fd;
+	bool    id_err;
+	char    id_name[NAME_MAX + 1];
+};
+
+/**
+ * struct intent_reclaim - background reclaim of an mpool handle
+ * @ir_ds:      mpool handle
+ * @ir_tid:     reclaim thread
+ * @ir_stop:    set by intent_reclaim_stop() to give up early
+ * @ir_aborted: number of orphans aborted
+ */
+struct intent_reclaim {
+	struct mpool   *ir_ds;
+	pthread_t       ir_tid;
+	atomic_t        ir_stop;
+	u32             ir_aborted;
+};
+
+/**
+ * struct intent_work - share of the orphans aborted by one thread
+ */
+struct intent_work {
+	struct mpool           *iw_ds;
+	const atomic_t         *iw_stop;
+	struct intent_orphan   *iw_orphanv;
+	u32                     iw_orphanc;
+	struct intent_dead     *iw_deadv;
+	u32                     iw_aborted;
+	pthread_t               iw_tid;
+	bool                    iw_thread;
+};
+
+static atomic_t intent_jnl_seq;
+
+static inline u32
+intent_hash(u64 objid)
+{
+	return (objid * 0x9e3779b97f4a7c15ull) >> 32;
+}
+
+static inline size_t
+intent_len(u32 nslots)
+{
+	return sizeof(struct intent_hdr) + nslots * sizeof(struct intent_slot);
+}
+
+static void
+intent_hash_insert(struct intent_jnl *ij, u32 idx)
+{
+	u32 h = intent_hash(ij->ij_slotv[idx].is_objid) & ij->ij_hmask;
+
+	while (ij->ij_hashv[h])
+		h = (h + 1) & ij->ij_hmask;
+
+	ij->ij_hashv[h] = idx + 1;
+}
+
+/**
+ * intent_hash_remove() - Remove @objid from the hash
+ *
+ * Return: its slot index, or -1 if not found.  Linear probing with
+ * backward shift deletion, so lookups never cross tombstones.
+ */
+static s64
+intent_hash_remove(struct intent_jnl *ij, u64 objid)
+{
+	u32 mask = ij->ij_hmask;
+	u32 h, i, j, k, idx;
+
+	h = intent_hash(objid) & mask;
+
+	while (ij->ij_hashv[h] &&
+	       ij->ij_slotv[ij->ij_hashv[h] - 1].is_objid != objid)
+		h = (h + 1) & mask;
+
+	if (!ij->ij_hashv[h])
+		return -1;
+
+	idx = ij->ij_hashv[h] - 1;
+
+	for (i = j = h; ; ) {
+		j = (j + 1) & mask;
+		if (!ij->ij_hashv[j])
+			break;
+
+		k = intent_hash(ij->ij_slotv[ij->ij_hashv[j] - 1].is_objid) &
+			mask;
+
+		/* Move the entry at j back unless its home lies in (i, j] */
+		if ((j > i && (k <= i || k > j)) ||
+		    (j < i && k <= i && k > j)) {
+			ij->ij_hashv[i] = ij->ij_hashv[j];
+			i = j;
+		}
+	}
+
+	ij->ij_hashv[i] = 0;
+
+	return idx;
+}
+
+/**
+ * intent_jnl_grow() - Double the number of slots
+ *
+ * Also used to set up a new journal, with @ij_nslots 0.
+ */
+static merr_t
+intent_jnl_grow(struct intent_jnl *ij)
+{
+	u32    *freev, *hashv;
+	void   *base;
+	size_t  len;
+	merr_t  err;
+	u32     nslots, i;
+
+	nslots = ij->ij_nslots ? ij->ij_nslots * 2 : INTENT_NSLOTS_MIN;
+	if (nslots > INTENT_NSLOTS_MAX)
+		return merr(ENOSPC);
+
+	len = intent_len(nslots);
+
+	freev = malloc(nslots * sizeof(*freev));
+	hashv = calloc(nslots * 2, sizeof(*hashv));
+	if (!freev || !hashv) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	if (ftruncate(ij->ij_fd, len)) {
+		err = merr(errno);
+		goto errout;
+	}
+
+	base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    ij->ij_fd, 0);
+	if (base == MAP_FAILED) {
+		err = merr(errno);
+		goto errout;
+	}
+
+	if (ij->ij_base)
+		munmap(ij->ij_base, ij->ij_len);
+
+	ij->ij_base = base;
+	ij->ij_len = len;
+	ij->ij_slotv = base + sizeof(struct intent_hdr);
+
+	/* Hand out the new slots lowest first */
+	for (i = nslots; i > ij->ij_nslots; i--)
+		freev[ij->ij_nfree++] = i - 1;
+
+	free(ij->ij_hashv);
+	ij->ij_hashv = hashv;
+	ij->ij_hmask = nslots * 2 - 1;
+
+	for (i = 0; i < ij->ij_nslots; i++)
+		if (ij->ij_slotv[i].is_objid)
+			intent_hash_insert(ij, i);
+
+	free(ij->ij_freev);
+	ij->ij_freev = freev;
+	ij->ij_nslots = nslots;
+
+	return 0;
+
+errout:
+	free(freev);
+	free(hashv);
+
+	return err;
+}
+
+struct intent_jnl *
+intent_jnl_open(struct mpool *ds)
+{
+	struct intent_jnl  *ij;
+	struct intent_hdr  *hdr;
+	struct stat         st;
+
+	char    dir[PATH_MAX], tmp[PATH_MAX];
+	merr_t  err;
+	int     n;
+
+	snprintf(dir, sizeof(dir), "%s/%s", MPOOL_RUNDIR_ROOT, ds->ds_mpname);
+
+	if (stat(dir, &st) || !S_ISDIR(st.st_mode))
+		return NULL;
+
+	ij = calloc(1, sizeof(*ij));
+	if (!ij)
+		return NULL;
+
+	n = atomic_inc_return(&intent_jnl_seq);
+
+	/* Lock the journal before it becomes visible to reclaimers */
+	snprintf(tmp, sizeof(tmp), "%s/%s/.%s%d.%d", MPOOL_RUNDIR_ROOT,
+		 ds->ds_mpname, INTENT_FILE_PFX, getpid(), n);
+	snprintf(ij->ij_path, sizeof(ij->ij_path), "%s/%s/%s%d.%d",
+		 MPOOL_RUNDIR_ROOT, ds->ds_mpname, INTENT_FILE_PFX, getpid(), n);
+
+	ij->ij_fd = open(tmp, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+			 st.st_mode & 0666);
+	if (ij->ij_fd == -1) {
+		free(ij);
+		return NULL;
+	}
+
+	if (flock(ij->ij_fd, LOCK_EX | LOCK_NB))
+		goto errout;
+
+	err = intent_jnl_grow(ij);
+	if (err)
+		goto errout;
+
+	hdr = ij->ij_base;
+	hdr->ih_version = INTENT_VERSION;
+	hdr->ih_slotsz = sizeof(struct intent_slot);
+	__atomic_store_n(&hdr->ih_magic, INTENT_MAGIC, __ATOMIC_RELEASE);
+
+	if (rename(tmp, ij->ij_path))
+		goto errout;
+
+	mutex_init(&ij->ij_lock);
+
+	return ij;
+
+errout:
+	if (ij->ij_base)
+		munmap(ij->ij_base, ij->ij_len);
+	free(ij->ij_freev);
+	free(ij->ij_hashv);
+	unlink(tmp);
+	close(ij->ij_fd);
+	free(ij);
+
+	return NULL;
+}
+
+void
+intent_jnl_close(struct intent_jnl *ij)
+{
+	if (!ij)
+		return;
+
+	/* Unlink while still locked, so no reclaimer sees a stale journal */
+	if (ij->ij_nfree == ij->ij_nslots && !ij->ij_full)
+		unlink(ij->ij_path);
+
+	munmap(ij->ij_base, ij->ij_len);
+	close(ij->ij_fd);
+
+	mutex_destroy(&ij->ij_lock);
+	free(ij->ij_freev);
+	free(ij->ij_hashv);
+	free(ij);
+}
+
+void
+intent_jnl_add(
+	struct intent_jnl  *ij,
+	u64                 objid,
+	enum intent_otype   type)
+{
+	struct intent_slot *slot;
+	merr_t              err;
+	u32                 idx;
+
+	if (!ij || !objid)
+		return;
+
+	mutex_lock(&ij->ij_lock);
+
+	if (ij->ij_nfree == 0) {
+		err = intent_jnl_grow(ij);
+		if (err) {
+			if (!ij->ij_full)
+				mp_pr_err("intent journal %s full", err,
+					  ij->ij_path);
+			ij->ij_full = true;
+			goto out;
+		}
+	}
+
+	idx = ij->ij_freev[--ij->ij_nfree];
+	slot = ij->ij_slotv + idx;
+
+	slot->is_type = type;
+	__atomic_store_n(&slot->is_objid, objid, __ATOMIC_RELEASE);
+
+	intent_hash_insert(ij, idx);
+
+out:
+	mutex_unlock(&ij->ij_lock);
+}
+
+void
+intent_jnl_del(
+	struct intent_jnl  *ij,
+	u64                 objid)
+{
+	s64 idx;
+
+	if (!ij || !objid)
+		return;
+
+	mutex_lock(&ij->ij_lock);
+
+	idx = intent_hash_remove(ij, objid);
+	if (idx >= 0) {
+		__atomic_store_n(&ij->ij_slotv[idx].is_objid, 0,
+				 __ATOMIC_RELEASE);
+		ij->ij_slotv[idx].is_type = 0;
+		ij->ij_freev[ij->ij_nfree++] = idx;
+	}
+
+	mutex_unlock(&ij->ij_lock);
+}
+
+/**
+ * intent_orphan_abort() - Abort an orphan if it is still uncommitted
+ *
+ * Return: 0 if the orphan is gone, with @aborted set if it was aborted
+ * here, or an error.
+ */
+static merr_t
+intent_orphan_abort(
+	struct mpool               *ds,
+	const struct intent_orphan *io,
+	bool                       *aborted)
+{
+	struct mpioc_mblock_id  mbi = { .mi_objid = io->io_objid };
+	struct mpioc_mlog_id    mli = { .mi_objid = io->io_objid };
+	struct mpioc_mblock     mb = { .mb_objid = io->io_objid };
+	struct mpioc_mlog       ml = { .ml_objid = io->io_objid };
+	merr_t                  err;
+
+	*aborted = false;
+
+	switch (io->io_type) {
+	case INTENT_MBLOCK:
+		err = mpool_ioctl(ds->ds_fd, MPIOC_MB_FIND_GET, &mb);
+		if (!err && !mb.mb_props.mbx_props.mpr_iscommitted)
+			err = mpool_ioctl(ds->ds_fd, MPIOC_MB_ABORT, &mbi);
+		else if (!err)
+			return 0;
+		break;
+
+	case INTENT_MLOG:
+		err = mpool_ioctl(ds->ds_fd, MPIOC_MLOG_RESOLVE, &ml);
+		if (!err && !ml.ml_props.lpx_props.lpr_iscommitted)
+			err = mpool_ioctl(ds->ds_fd, MPIOC_MLOG_ABORT, &mli);
+		else if (!err)
+			return 0;
+		break;
+
+	default:
+		return 0;
+	}
+
+	if (merr_errno(err) == ENOENT)
+		return 0;
+
+	*aborted = !err;
+
+	return err;
+}
+
+static void *
+intent_reclaim_run(void *arg)
+{
+	struct intent_work     *iw = arg;
+	struct intent_orphan   *io;
+	merr_t                  err;
+	bool                    aborted;
+	u32                     i;
+
+	for (i = 0; i < iw->iw_orphanc; i++) {
+		io = iw->iw_orphanv + i;
+
+		/* Keep the journal for the next opener */
+		if (atomic_read(iw->iw_stop)) {
+			iw->iw_deadv[io->io_jidx].id_err = true;
+			continue;
+		}
+
+		err = intent_orphan_abort(iw->iw_ds, io, &aborted);
+		if (err) {
+			mp_pr_err("orphan objid 0x%lx abort failed", err,
+				  (ulong)io->io_objid);
+			iw->iw_deadv[io->io_jidx].id_err = true;
+			continue;
+		}
+
+		iw->iw_aborted += aborted;
+	}
+
+	return NULL;
+}
+
+/**
+ * intent_collect() - Add the objects of a dead journal to @orphanv
+ */
+static merr_t
+intent_collect(
+	int                     fd,
+	u32                     jidx,
+	struct intent_orphan  **orphanv,
+	u32                    *orphanc,
+	u32                    *orphanmax)
+{
+	const struct intent_slot   *slot;
+	const struct intent_hdr    *hdr;
+	struct intent_orphan       *v;
+	struct stat                 st;
+
+	void   *base;
+	merr_t  err = 0;
+	u32     nslots, max, i;
+
+	if (fstat(fd, &st))
+		return merr(errno);
+
+	if (st.st_size < intent_len(0))
+		return 0;
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+		return merr(errno);
+
+	hdr = base;
+	if (hdr->ih_magic != INTENT_MAGIC ||
+	    hdr->ih_version != INTENT_VERSION ||
+	    hdr->ih_slotsz != sizeof(*slot))
+		goto out;
+
+	nslots = (st.st_size - sizeof(*hdr)) / sizeof(*slot);
+	slot = base + sizeof(*hdr);
+
+	for (i = 0; i < nslots; i++, slot++) {
+		if (!slot->is_objid)
+			continue;
+
+		if (*orphanc == *orphanmax) {
+			max = max_t(u32, *orphanmax * 2, INTENT_NSLOTS_MIN);
+
+			v = realloc(*orphanv, max * sizeof(*v));
+			if (!v) {
+				err = merr(ENOMEM);
+				break;
+			}
+
+			*orphanv = v;
+			*orphanmax = max;
+		}
+
+		v = *orphanv + (*orphanc)++;
+		v->io_objid = slot->is_objid;
+		v->io_type = slot->is_type;
+		v->io_jidx = jidx;
+	}
+
+out:
+	munmap(base, st.st_size);
+
+	return err;
+}
+
+/**
+ * intent_tmp_orphaned() - Tell if the creator of a journal being set up
+ *                         is gone
+ * @name: temporary journal name, "." INTENT_FILE_PFX "<pid>.<n>"
+ *
+ * The creator locks the journal right after creating it, so it must not be
+ * locked by a reclaimer in between.
+ */
+static bool
+intent_tmp_orphaned(const char *name)
+{
+	const char *pidstr = name + 1 + strlen(INTENT_FILE_PFX);
+	char       *end;
+	long        pid;
+
+	pid = strtol(pidstr, &end, 10);
+	if (end == pidstr || *end != '.' || pid <= 0)
+		return true;
+
+	return kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+static u32
+intent_reclaim_scan(struct mpool *ds, const atomic_t *stop)
+{
+	struct intent_orphan   *orphanv = NULL;
+	struct intent_dead     *deadv = NULL, *dv;
+	struct intent_work     *workv = NULL;
+	struct dirent          *d;
+
+	char    dir[PATH_MAX];
+	u32     orphanc = 0, orphanmax = 0, deadc = 0, deadmax = 0;
+	u32     nthreads, aborted = 0, per, i;
+	merr_t  err = 0;
+	DIR    *dirp;
+	int     dfd, fd;
+
+	snprintf(dir, sizeof(dir), "%s/%s", MPOOL_RUNDIR_ROOT, ds->ds_mpname);
+
+	dirp = opendir(dir);
+	if (!dirp)
+		return 0;
+
+	dfd = dirfd(dirp);
+
+	while (!atomic_read(stop) && (d = readdir(dirp))) {
+		bool tmp = d->d_name[0] == '.';
+
+		if (strncmp(d->d_name + tmp, INTENT_FILE_PFX,
+			    strlen(INTENT_FILE_PFX)))
+			continue;
+
+		if (tmp && !intent_tmp_orphaned(d->d_name))
+			continue;
+
+		fd = openat(dfd, d->d_name, O_RDWR | O_CLOEXEC);
+		if (fd == -1)
+			continue;
+
+		/* A journal that can be locked has lost its owner */
+		if (flock(fd, LOCK_EX | LOCK_NB)) {
+			close(fd);
+			continue;
+		}
+
+		/* Never published, so nothing was recorded in it */
+		if (tmp) {
+			unlinkat(dfd, d->d_name, 0);
+			close(fd);
+			continue;
+		}
+
+		if (deadc == deadmax) {
+			deadmax = max_t(u32, deadmax * 2, 16);
+
+			dv = realloc(deadv, deadmax * sizeof(*dv));
+			if (!dv) {
+				close(fd);
+				break;
+			}
+
+			deadv = dv;
+		}
+
+		dv = deadv + deadc;
+		dv->id_fd = fd;
+		dv->id_err = false;
+		strlcpy(dv->id_name, d->d_name, sizeof(dv->id_name));
+
+		err = intent_collect(fd, deadc, &orphanv, &orphanc, &orphanmax);
+		dv->id_err = !!err;
+		deadc++;
+
+		if (err)
+			break;
+	}
+
+	if (orphanc == 0)
+		goto out;
+
+	nthreads = clamp_t(u32, orphanc / INTENT_THREAD_OBJS, 1,
+			   INTENT_THREADS_MAX);
+
+	workv = calloc(nthreads, sizeof(*workv));
+	if (!workv) {
+		for (i = 0; i < deadc; i++)
+			deadv[i].id_err = true;
+		goto out;
+	}
+
+	per = (orphanc + nthreads - 1) / nthreads;
+
+	for (i = 0; i < nthreads; i++) {
+		workv[i].iw_ds = ds;
+		workv[i].iw_stop = stop;
+		workv[i].iw_orphanv = orphanv + i * per;
+		workv[i].iw_orphanc = min_t(u32, per, orphanc - min_t(u32,
+						orphanc, i * per));
+		workv[i].iw_deadv = deadv;
+
+		if (i == 0 || workv[i].iw_orphanc == 0)
+			continue;
+
+		if (!pthread_create(&workv[i].iw_tid, NULL, intent_reclaim_run,
+				    workv + i))
+			workv[i].iw_thread = true;
+		else
+			intent_reclaim_run(workv + i);
+	}
+
+	intent_reclaim_run(workv);
+
+	for (i = 0; i < nthreads; i++) {
+		if (workv[i].iw_thread)
+			pthread_join(workv[i].iw_tid, NULL);
+
+		aborted += workv[i].iw_aborted;
+	}
+
+	mse_log(MPOOL_INFO
+		"mpool %s: aborted %u of %u orphaned objects from %u journals",
+		ds->ds_mpname, aborted, orphanc, deadc);
+
+out:
+	/* Journals with orphans left are retried by the next opener */
+	for (i = 0; i < deadc; i++) {
+		if (!deadv[i].id_err)
+			unlinkat(dfd, deadv[i].id_name, 0);
+		close(deadv[i].id_fd);
+	}
+
+	closedir(dirp);
+	free(workv);
+	free(deadv);
+	free(orphanv);
+
+	return aborted;
+}
+
+static void *
+intent_reclaim_main(void *arg)
+{
+	struct intent_reclaim *ir = arg;
+
+	ir->ir_aborted = intent_reclaim_scan(ir->ir_ds, &ir->ir_stop);
+
+	return NULL;
+}
+
+struct intent_reclaim *
+intent_reclaim_start(struct mpool *ds)
+{
+	struct intent_reclaim *ir;
+
+	ir = calloc(1, sizeof(*ir));
+	if (!ir)
+		return NULL;
+
+	ir->ir_ds = ds;
+
+	if (pthread_create(&ir->ir_tid, NULL, intent_reclaim_main, ir)) {
+		free(ir);
+		return NULL;
+	}
+
+	return ir;
+}
+
+u32
+intent_reclaim_stop(struct intent_reclaim *ir)
+{
+	u32 aborted;
+
+	if (!ir)
+		return 0;
+
+	atomic_set(&ir->ir_stop, 1);
+	pthread_join(ir->ir_tid, NULL);
+
+	aborted = ir->ir_aborted;
+	free(ir);
+
+	return aborted;
+}
@@ -0,0 +1,568 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+/*
+ * Registered I/O buffer pools.
+ *
+ * A pool hands out page-aligned buffers in power-of-two size classes from
+ * PAGE_SIZE up to a configurable maximum.  Buffers are carved from slabs
+ * that are faulted in when mapped, optionally backed by huge pages
+ * (hugetlbfs if pages are reserved, transparent huge pages otherwise) and
+ * optionally mlocked, so mblock I/O on them pays neither allocator nor
+ * page fault costs and the kernel pins the same pages over and over.
+ *
+ * Freed buffers go to a small cache of the CPU the caller runs on, and
+ * from there to per-class free lists.  Buffers are never returned to the
+ * system before the pool is destroyed.
+ *
+ * A pool created with an mpool handle also serves the bounce buffers the
+ * library needs for that mpool's I/O.
+ */
+
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sysinfo.h>
+
+#include <util/platform.h>
+#include <util/alloc.h>
+#include <util/atomic.h>
+#include <util/log2.h>
+#include <util/minmax.h>
+#include <util/mutex.h>
+#include <util/page.h>
+
+#include <mpool/mpool.h>
+#include <mpctl/impool.h>
+
+#include "mpool_err.h"
+#include "logging.h"
+
+#define IOBUF_MAXSZ_DFLT        (1024 * 1024)
+#define IOBUF_MAXSZ_MAX         (64 * 1024 * 1024)
+#define IOBUF_CLASS_MAX         (16)
+#define IOBUF_SLABSZ            (2 * 1024 * 1024)
+#define IOBUF_CACHE_DFLT        (8)
+#define IOBUF_CACHE_MAX         (64)
+#define IOBUF_SHARDS_MAX        (64)
+#define IOBUF_CLSZ              (64)
+
+/**
+ * struct iobuf_class - free buffers of one size class
+ * @ic_lock:  protects the free list
+ * @ic_free:  free buffers, linked through their first word
+ * @ic_nfree: number of buffers on @ic_free
+ */
+struct iobuf_class {
+	struct mutex    ic_lock;
+	void           *ic_free;
+	u64             ic_nfree;
+};
+
+/**
+ * struct iobuf_cache - per-CPU cache of free buffers
+ * @ca_lock: protects the cache, uncontended unless threads migrate
+ * @ca_cnt:  number of cached buffers per class
+ * @ca_bufv: cached buffers, pi_cachesz per class
+ */
+struct iobuf_cache {
+	struct mutex    ca_lock;
+	u32             ca_cnt[IOBUF_CLASS_MAX];
+	void          **ca_bufv;
+} __aligned(IOBUF_CLSZ);
+
+struct iobuf_slab {
+	void   *is_addr;
+	size_t  is_len;
+};
+
+/**
+ * struct mpool_iobuf_pool - I/O buffer pool
+ * @pi_mp:       mpool whose bounce buffers the pool serves, or NULL
+ * @pi_flags:    MPOOL_IOBUF_* flags
+ * @pi_nclass:   number of size classes
+ * @pi_cachesz:  per-CPU cache depth per class
+ * @pi_nshards:  number of per-CPU caches
+ * @pi_classv:   size classes
+ * @pi_cachev:   per-CPU caches
+ * @pi_slablock: protects the slab list
+ * @pi_slabv:    slabs mapped by the pool
+ * @pi_slabc:    number of slabs
+ * @pi_slabmax:  capacity of @pi_slabv
+ */
+struct mpool_iobuf_pool {
+	struct mpool           *pi_mp;
+	u32                     pi_flags;
+	u32                     pi_nclass;
+	u32                     pi_cachesz;
+	u32                     pi_nshards;
+	struct iobuf_class      pi_classv[IOBUF_CLASS_MAX];
+	struct iobuf_cache     *pi_cachev;
+
+	struct mutex            pi_slablock;
+	struct iobuf_slab      *pi_slabv;
+	u32                     pi_slabc;
+	u32                     pi_slabmax;
+
+	atomic64_t              pi_allocs;
+	atomic64_t              pi_cache_hits;
+	atomic64_t              pi_oversize;
+	atomic64_t              pi_mapped;
+	atomic64_t              pi_huge;
+	atomic64_t              pi_locked;
+	atomic64_t              pi_mlock_fails;
+};
+
+static inline u32
+iobuf_class(size_t len)
+{
+	return len <= PAGE_SIZE ? 0 : ilog2(roundup_pow_of_two(len)) -
+		PAGE_SHIFT;
+}
+
+static inline size_t
+iobuf_classsz(u32 cls)
+{
+	return (size_t)PAGE_SIZE << cls;
+}
+
+/**
+ * iobuf_map() - Map and fault in memory for buffers
+ * @pool:    buffer pool
+ * @len:     length, a multiple of PAGE_SIZE
+ * @hugetlb: set if the memory is backed by hugetlbfs pages (output)
+ * @locked:  set if the memory is locked (output)
+ *
+ * hugetlbfs pages are used if any are reserved, otherwise the region is
+ * aligned to and advised for transparent huge pages.  Memory that cannot
+ * be locked is still used.
+ */
+static void *
+iobuf_map(
+	struct mpool_iobuf_pool    *pool,
+	size_t                      len,
+	bool                       *hugetlb,
+	bool                       *locked)
+{
+	const int   prot = PROT_READ | PROT_WRITE;
+	const int   flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	char       *mem = MAP_FAILED, *addr;
+	size_t      maplen, off;
+
+	*hugetlb = *locked = false;
+
+	if ((pool->pi_flags & MPOOL_IOBUF_HUGE) &&
+	    IS_ALIGNED(len, IOBUF_SLABSZ)) {
+		mem = mmap(NULL, len, prot, flags | MAP_HUGETLB | MAP_POPULATE,
+			   -1, 0);
+		*hugetlb = mem != MAP_FAILED;
+	}
+
+	if (mem == MAP_FAILED) {
+		maplen = len + IOBUF_SLABSZ;
+
+		addr = mmap(NULL, maplen, prot, flags, -1, 0);
+		if (addr == MAP_FAILED)
+			return NULL;
+
+		/* Trim to a huge page aligned region */
+		mem = (char *)ALIGN((uintptr_t)addr, IOBUF_SLABSZ);
+		off = mem - addr;
+		if (off > 0)
+			munmap(addr, off);
+		munmap(mem + len, maplen - off - len);
+
+		if (pool->pi_flags & MPOOL_IOBUF_HUGE)
+			madvise(mem, len, MADV_HUGEPAGE);
+
+		for (off = 0; off < len; off += PAGE_SIZE)
+			mem[off] = 0;
+	}
+
+	if (pool->pi_flags & MPOOL_IOBUF_MLOCK) {
+		*locked = !mlock(mem, len);
+		if (!*locked)
+			atomic64_inc(&pool->pi_mlock_fails);
+	}
+
+	return mem;
+}
+
+static merr_t
+iobuf_slab_add(struct mpool_iobuf_pool *pool, void *addr, size_t len)
+{
+	struct iobuf_slab  *slabv;
+	u32                 slabmax;
+
+	mutex_lock(&pool->pi_slablock);
+
+	if (pool->pi_slabc == pool->pi_slabmax) {
+		slabmax = max_t(u32, pool->pi_slabmax * 2, 16);
+
+		slabv = realloc(pool->pi_slabv, slabmax * sizeof(*slabv));
+		if (!slabv) {
+			mutex_unlock(&pool->pi_slablock);
+			return merr(ENOMEM);
+		}
+
+		pool->pi_slabv = slabv;
+		pool->pi_slabmax = slabmax;
+	}
+
+	pool->pi_slabv[pool->pi_slabc].is_addr = addr;
+	pool->pi_slabv[pool->pi_slabc].is_len = len;
+	pool->pi_slabc++;
+
+	mutex_unlock(&pool->pi_slablock);
+
+	return 0;
+}
+
+/**
+ * iobuf_grow() - Add a slab of buffers to a size class
+ *
+ * Called with the class lock held.
+ */
+static merr_t
+iobuf_grow(struct mpool_iobuf_pool *pool, u32 cls)
+{
+	struct iobuf_class *ic = pool->pi_classv + cls;
+	size_t              bufsz = iobuf_classsz(cls);
+	size_t              len = max_t(size_t, bufsz, IOBUF_SLABSZ);
+	merr_t              err;
+	bool                hugetlb, locked;
+	char               *mem;
+	size_t              off;
+
+	mem = iobuf_map(pool, len, &hugetlb, &locked);
+	if (!mem)
+		return merr(ENOMEM);
+
+	err = iobuf_slab_add(pool, mem, len);
+	if (err) {
+		munmap(mem, len);
+		return err;
+	}
+
+	atomic64_add(len, &pool->pi_mapped);
+	if (hugetlb)
+		atomic64_add(len, &pool->pi_huge);
+	if (locked)
+		atomic64_add(len, &pool->pi_locked);
+
+	for (off = 0; off < len; off += bufsz) {
+		*(void **)(mem + off) = ic->ic_free;
+		ic->ic_free = mem + off;
+		ic->ic_nfree++;
+	}
+
+	return 0;
+}
+
+static inline struct iobuf_cache *
+iobuf_cache(struct mpool_iobuf_pool *pool)
+{
+	int cpu = sched_getcpu();
+
+	if (cpu < 0)
+		cpu = 0;
+
+	return pool->pi_cachev + cpu % pool->pi_nshards;
+}
+
+uint64_t
+mpool_iobuf_alloc(
+	struct mpool_iobuf_pool    *pool,
+	size_t                      len,
+	void                      **bufp)
+{
+	struct iobuf_cache *ca;
+	struct iobuf_class *ic;
+	merr_t              err;
+	bool                hugetlb, locked;
+	void               *buf;
+	u32                 cls;
+
+	if (!pool || len == 0 || !bufp)
+		return merr(EINVAL);
+
+	*bufp = NULL;
+
+	atomic64_inc(&pool->pi_allocs);
+
+	cls = iobuf_class(len);
+
+	if (cls >= pool->pi_nclass) {
+		/* Oversize buffers are mapped and unmapped on demand */
+		buf = iobuf_map(pool, ALIGN(len, PAGE_SIZE), &hugetlb, &locked);
+		if (!buf)
+			return merr(ENOMEM);
+
+		atomic64_inc(&pool->pi_oversize);
+		*bufp = buf;
+
+		return 0;
+	}
+
+	ca = iobuf_cache(pool);
+
+	mutex_lock(&ca->ca_lock);
+	if (ca->ca_cnt[cls] > 0) {
+		buf = ca->ca_bufv[cls * pool->pi_cachesz + --ca->ca_cnt[cls]];
+		mutex_unlock(&ca->ca_lock);
+
+		atomic64_inc(&pool->pi_cache_hits);
+		*bufp = buf;
+
+		return 0;
+	}
+	mutex_unlock(&ca->ca_lock);
+
+	ic = pool->pi_classv + cls;
+
+	mutex_lock(&ic->ic_lock);
+	if (!ic->ic_free) {
+		err = iobuf_grow(pool, cls);
+		if (err) {
+			mutex_unlock(&ic->ic_lock);
+			return err;
+		}
+	}
+
+	buf = ic->ic_free;
+	ic->ic_free = *(void **)buf;
+	ic->ic_nfree--;
+	mutex_unlock(&ic->ic_lock);
+
+	*bufp = buf;
+
+	return 0;
+}
+
+void
+mpool_iobuf_free(
+	struct mpool_iobuf_pool    *pool,
+	void                       *buf,
+	size_t                      len)
+{
+	struct iobuf_cache *ca;
+	struct iobuf_class *ic;
+	u32                 cls;
+
+	if (!pool || !buf || len == 0)
+		return;
+
+	cls = iobuf_class(len);
+
+	if (cls >= pool->pi_nclass) {
+		len = ALIGN(len, PAGE_SIZE);
+
+		if (pool->pi_flags & MPOOL_IOBUF_MLOCK)
+			munlock(buf, len);
+		munmap(buf, len);
+		return;
+	}
+
+	ca = iobuf_cache(pool);
+
+	mutex_lock(&ca->ca_lock);
+	if (ca->ca_cnt[cls] < pool->pi_cachesz) {
+		ca->ca_bufv[cls * pool->pi_cachesz + ca->ca_cnt[cls]++] = buf;
+		mutex_unlock(&ca->ca_lock);
+		return;
+	}
+	mutex_unlock(&ca->ca_lock);
+
+	ic = pool->pi_classv + cls;
+
+	mutex_lock(&ic->ic_lock);
+	*(void **)buf = ic->ic_free;
+	ic->ic_free = buf;
+	ic->ic_nfree++;
+	mutex_unlock(&ic->ic_lock);
+}
+
+static void
+iobuf_pool_free(struct mpool_iobuf_pool *pool)
+{
+	u32 i;
+
+	for (i = 0; i < pool->pi_slabc; i++)
+		munmap(pool->pi_slabv[i].is_addr, pool->pi_slabv[i].is_len);
+
+	if (pool->pi_cachev) {
+		for (i = 0; i < pool->pi_nshards; i++) {
+			mutex_destroy(&pool->pi_cachev[i].ca_lock);
+			free(pool->pi_cachev[i].ca_bufv);
+		}
+		free(pool->pi_cachev);
+	}
+
+	for (i = 0; i < IOBUF_CLASS_MAX; i++)
+		mutex_destroy(&pool->pi_classv[i].ic_lock);
+
+	mutex_destroy(&pool->pi_slablock);
+	free(pool->pi_slabv);
+	kfree(pool);
+}
+
+uint64_t
+mpool_iobuf_pool_create(
+	struct mpool                       *mp,
+	const struct mpool_iobuf_params    *params,
+	struct mpool_iobuf_pool           **poolp)
+{
+	struct mpool_iobuf_pool    *pool;
+	merr_t                      err = 0;
+	size_t                      maxsz, prealloc, bufsz;
+	u32                         cachesz, flags, i;
+
+	if (!poolp)
+		return merr(EINVAL);
+
+	*poolp = NULL;
+
+	maxsz = params ? params->ibp_maxsz : 0;
+	cachesz = params ? params->ibp_cache : 0;
+	flags = params ? params->ibp_flags : 0;
+	prealloc = params ? params->ibp_prealloc : 0;
+
+	if (maxsz == 0)
+		maxsz = IOBUF_MAXSZ_DFLT;
+	if (cachesz == 0)
+		cachesz = IOBUF_CACHE_DFLT;
+
+	if ((params && params->ibp_rsvd) ||
+	    maxsz < PAGE_SIZE || maxsz > IOBUF_MAXSZ_MAX ||
+	    !is_power_of_2(maxsz) || cachesz > IOBUF_CACHE_MAX ||
+	    (flags & ~(MPOOL_IOBUF_HUGE | MPOOL_IOBUF_MLOCK)))
+		return merr(EINVAL);
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return merr(ENOMEM);
+
+	pool->pi_flags = flags;
+	pool->pi_nclass = iobuf_class(maxsz) + 1;
+	pool->pi_cachesz = cachesz;
+	pool->pi_nshards = clamp_t(int, get_nprocs_conf(), 1, IOBUF_SHARDS_MAX);
+
+	mutex_init(&pool->pi_slablock);
+	for (i = 0; i < IOBUF_CLASS_MAX; i++)
+		mutex_init(&pool->pi_classv[i].ic_lock);
+
+	atomic64_set(&pool->pi_allocs, 0);
+	atomic64_set(&pool->pi_cache_hits, 0);
+	atomic64_set(&pool->pi_oversize, 0);
+	atomic64_set(&pool->pi_mapped, 0);
+	atomic64_set(&pool->pi_huge, 0);
+	atomic64_set(&pool->pi_locked, 0);
+	atomic64_set(&pool->pi_mlock_fails, 0);
+
+	pool->pi_cachev = aligned_alloc(IOBUF_CLSZ, pool->pi_nshards *
+					sizeof(*pool->pi_cachev));
+	if (!pool->pi_cachev) {
+		pool->pi_nshards = 0;
+		iobuf_pool_free(pool);
+		return merr(ENOMEM);
+	}
+
+	memset(pool->pi_cachev, 0, pool->pi_nshards * sizeof(*pool->pi_cachev));
+
+	for (i = 0; i < pool->pi_nshards; i++) {
+		mutex_init(&pool->pi_cachev[i].ca_lock);
+		pool->pi_cachev[i].ca_bufv = calloc(pool->pi_nclass * cachesz,
+						    sizeof(void *));
+		if (!pool->pi_cachev[i].ca_bufv)
+			err = merr(ENOMEM);
+	}
+
+	/* Populate each class with at least @prealloc bytes of buffers */
+	for (i = 0; !err && i < pool->pi_nclass; i++) {
+		bufsz = iobuf_classsz(i);
+
+		while (!err && pool->pi_classv[i].ic_nfree * bufsz < prealloc)
+			err = iobuf_grow(pool, i);
+	}
+
+	if (!err && mp) {
+		mutex_lock(&mp->ds_lock);
+		if (mp->ds_iobuf)
+			err = merr(EBUSY);
+		else
+			mp->ds_iobuf = pool;
+		mutex_unlock(&mp->ds_lock);
+
+		pool->pi_mp = err ? NULL : mp;
+	}
+
+	if (err) {
+		iobuf_pool_free(pool);
+		return err;
+	}
+
+	*poolp = pool;
+
+	return 0;
+}
+
+uint64_t
+mpool_iobuf_pool_destroy(
+	struct mpool_iobuf_pool    *pool)
+{
+	struct mpool *mp;
+
+	if (!pool)
+		return merr(EINVAL);
+
+	/* Wait for the bounce buffers still out to come back */
+	mp = pool->pi_mp;
+	if (mp) {
+		mutex_lock(&mp->ds_lock);
+		if (mp->ds_iobuf == pool)
+			mp->ds_iobuf = NULL;
+		while (mp->ds_iobuf_users > 0)
+			pthread_cond_wait(&mp->ds_iobuf_cv,
+					  &mp->ds_lock.pth_mutex);
+		mutex_unlock(&mp->ds_lock);
+	}
+
+	iobuf_pool_free(pool);
+
+	return 0;
+}
+
+uint64_t
+mpool_iobuf_pool_stats(
+	struct mpool_iobuf_pool        *pool,
+	struct mpool_iobuf_stats       *stats)
+{
+	u32 i;
+
+	if (!pool || !stats)
+		return merr(EINVAL);
+
+	memset(stats, 0, sizeof(*stats));
+
+	stats->ibs_allocs = atomic64_read(&pool->pi_allocs);
+	stats->ibs_cache_hits = atomic64_read(&pool->pi_cache_hits);
+	stats->ibs_oversize = atomic64_read(&pool->pi_oversize);
+	stats->ibs_mapped = atomic64_read(&pool->pi_mapped);
+	stats->ibs_huge = atomic64_read(&pool->pi_huge);
+	stats->ibs_locked = atomic64_read(&pool->pi_locked);
+	stats->ibs_mlock_fails = atomic64_read(&pool->pi_mlock_fails);
+
+	for (i = 0; i < pool->pi_nclass; i++) {
+		mutex_lock(&pool->pi_classv[i].ic_lock);
+		stats->ibs_free += pool->pi_classv[i].ic_nfree *
+			iobuf_classsz(i);
+		mutex_unlock(&pool->pi_classv[i].ic_lock);
+	}
+
+	return 0;
+}
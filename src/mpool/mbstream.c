@@ -0,0 +1,1269 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Mblock stream design pattern module.
+ *
+ * An mblock stream is an unbounded sequence of records for bulk log data,
+ * spread over a sequence of mblocks ("segments").  Unlike a chained log,
+ * records carry no per-sector framing: they are packed back to back into a
+ * large page aligned write buffer, which is written to the active segment
+ * each time it fills up.  Each record is preceded by an 8 byte frame:
+ *
+ *   len   - record length, with MBS_FRAME_REC set
+ *   csum  - check of the segment sequence number, the frame offset, the
+ *           length and the record data
+ *
+ * Frames are 8 byte aligned.  A zero frame, or the end of the mblock,
+ * ends a segment.
+ *
+ * A segment is sealed (flushed, committed and recorded) when full or when
+ * the stream is closed.  The sealed segments are recorded in a caller
+ * supplied MDC:
+ *
+ *   ADD(seq, objid)       - segment seq was sealed
+ *   TRUNC(headseq)        - segments below headseq were dropped
+ *   TAIL(seq, off, data)  - records synced into the open segment seq
+ *
+ * An mblock is only recoverable once committed, so a sync journals the
+ * bytes appended to the open segment since the previous sync as TAIL
+ * records instead of sealing it.  The journaled prefix of the segment
+ * (its high-water offset) is also kept in memory, to serve readers and to
+ * rebuild the segment in a new mblock after a crash.  Once a segment has
+ * more than MBS_JNL_MAX bytes journaled, or bytes that were not journaled
+ * already went to the mblock, a sync seals it instead.
+ *
+ * Readers iterate over the sealed segments through mcache maps, falling
+ * back to large reads where mblocks cannot be mapped, and then over the
+ * journaled records of the open segment, getting all records in place.
+ * Truncation deletes whole segments from the head.
+ */
+
+#include <string.h>
+
+#include <util/alloc.h>
+#include <util/minmax.h>
+#include <util/mutex.h>
+#include <util/omf.h>
+#include <util/page.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+#include "logging.h"
+
+#define MBS_WBUFSZ_DFLT         (1024 * 1024)
+#define MBS_WBUFSZ_MAX          (32 * 1024 * 1024)
+#define MBS_FRAME_REC           ((u32)0x80000000)
+#define MBS_SEGS_MIN            (8)
+#define MBS_MDC_COMPACT_MIN     (1024 * 1024)
+#define MBS_MDC_COMPACT_RATIO   (4)
+#define MBS_JNL_MAX             (1024 * 1024)
+#define MBS_TAILREC_MAX         (64 * 1024)
+#define MBS_RECSZ_MAX           (sizeof(struct mbs_tail_omf) + MBS_TAILREC_MAX)
+
+/*
+ * MDC record types
+ */
+enum mbs_rec_type {
+	MBS_REC_ADD   = 1,
+	MBS_REC_TRUNC = 2,
+	MBS_REC_TAIL  = 3,
+};
+
+/**
+ * struct mbs_rec_omf - mblock stream MDC record
+ * @pmr_type:  enum mbs_rec_type
+ * @pmr_seq:   segment sequence number (ADD) or new head sequence (TRUNC)
+ * @pmr_objid: segment mblock object ID (ADD)
+ */
+struct mbs_rec_omf {
+	u8      pmr_type;
+	u8      pmr_rsvd[7];
+	__le64  pmr_seq;
+	__le64  pmr_objid;
+} __packed;
+
+OMF_SETGET(struct mbs_rec_omf, pmr_type, 8)
+OMF_SETGET(struct mbs_rec_omf, pmr_seq, 64)
+OMF_SETGET(struct mbs_rec_omf, pmr_objid, 64)
+
+/**
+ * struct mbs_tail_omf - mblock stream TAIL record, followed by the data
+ * @pmt_type: MBS_REC_TAIL
+ * @pmt_seq:  sequence number of the open segment
+ * @pmt_off:  segment offset of the data
+ */
+struct mbs_tail_omf {
+	u8      pmt_type;
+	u8      pmt_rsvd[7];
+	__le64  pmt_seq;
+	__le64  pmt_off;
+} __packed;
+
+OMF_SETGET(struct mbs_tail_omf, pmt_type, 8)
+OMF_SETGET(struct mbs_tail_omf, pmt_seq, 64)
+OMF_SETGET(struct mbs_tail_omf, pmt_off, 64)
+
+/**
+ * struct mbs_frame_omf - record frame
+ * @pmf_len:  record length ORed with MBS_FRAME_REC
+ * @pmf_csum: frame check, see mbs_csum()
+ */
+struct mbs_frame_omf {
+	__le32  pmf_len;
+	__le32  pmf_csum;
+} __packed;
+
+OMF_SETGET(struct mbs_frame_omf, pmf_len, 32)
+OMF_SETGET(struct mbs_frame_omf, pmf_csum, 32)
+
+/**
+ * struct mbs_seg - sealed segment
+ * @sg_seq:   sequence number
+ * @sg_objid: mblock object ID
+ */
+struct mbs_seg {
+	u64     sg_seq;
+	u64     sg_objid;
+};
+
+/**
+ * struct mpool_mbstream - mblock stream handle
+ * @ms_lock:    protects everything below
+ * @ms_mp:      mpool handle
+ * @ms_mdc:     MDC recording the sealed segments
+ * @ms_params:  tunables
+ * @ms_segv:    sealed segments, head first
+ * @ms_segc:    number of sealed segments
+ * @ms_segmax:  size of @ms_segv
+ * @ms_nextseq: sequence number of the active segment
+ * @ms_active:  an active segment is allocated
+ * @ms_mbh:     active segment mblock handle
+ * @ms_objid:   active segment mblock object ID
+ * @ms_segcap:  usable capacity of a segment, 0 if not yet known
+ * @ms_segoff:  bytes written to the active segment
+ * @ms_wbuf:    write buffer
+ * @ms_wlen:    bytes in @ms_wbuf
+ * @ms_tbuf:    journaled prefix of the open segment
+ * @ms_tbufsz:  size of @ms_tbuf
+ * @ms_hwm:     bytes of the open segment journaled in the MDC
+ * @ms_recbuf:  MDC record buffer, MBS_RECSZ_MAX bytes
+ * @ms_ridx:    index of the segment the reader is on
+ * @ms_rinit:   reader is set up on @ms_ridx
+ * @ms_roff:    reader offset in its segment
+ * @ms_rlen:    length of the reader's segment
+ * @ms_rmbh:    mblock handle of the reader's segment
+ * @ms_rmap:    mcache map of the reader's segment, or NULL
+ * @ms_rbase:   base address of @ms_rmap
+ * @ms_rbuf:    read buffer, if the segment is not mapped
+ * @ms_rbufsz:  size of @ms_rbuf
+ * @ms_rbufoff: segment offset of the data in @ms_rbuf
+ * @ms_rbuflen: bytes of data in @ms_rbuf
+ * @ms_snapsz:  MDC usage right after the last snapshot
+ */
+struct mpool_mbstream {
+	struct mutex                    ms_lock;
+	struct mpool                   *ms_mp;
+	struct mpool_mdc               *ms_mdc;
+	struct mpool_mbstream_params    ms_params;
+
+	struct mbs_seg                 *ms_segv;
+	u32                             ms_segc;
+	u32                             ms_segmax;
+	u64                             ms_nextseq;
+
+	bool                            ms_active;
+	u64                             ms_mbh;
+	u64                             ms_objid;
+	size_t                          ms_segcap;
+	size_t                          ms_segoff;
+	char                           *ms_wbuf;
+	size_t                          ms_wlen;
+	char                           *ms_tbuf;
+	size_t                          ms_tbufsz;
+	size_t                          ms_hwm;
+	char                           *ms_recbuf;
+
+	u32                             ms_ridx;
+	bool                            ms_rinit;
+	size_t                          ms_roff;
+	size_t                          ms_rlen;
+	u64                             ms_rmbh;
+	struct mpool_mcache_map        *ms_rmap;
+	const char                     *ms_rbase;
+	char                           *ms_rbuf;
+	size_t                          ms_rbufsz;
+	size_t                          ms_rbufoff;
+	size_t                          ms_rbuflen;
+
+	size_t                          ms_snapsz;
+};
+
+static inline size_t
+mbs_framesz(size_t len)
+{
+	return ALIGN(sizeof(struct mbs_frame_omf) + len, 8);
+}
+
+/**
+ * mbs_csum() - Frame check, 64-bit FNV-1a over words folded to 32 bits
+ *
+ * Seeding with the segment sequence number and the frame offset catches
+ * frames written to the wrong place as well as torn ones.
+ */
+static u32
+mbs_csum(u64 seq, size_t off, const void *data, size_t len)
+{
+	const u8   *p = data;
+	u64         h = 0xcbf29ce484222325ull;
+	u64         w;
+
+	h = (h ^ seq) * 0x100000001b3ull;
+	h = (h ^ off) * 0x100000001b3ull;
+	h = (h ^ len) * 0x100000001b3ull;
+
+	for (; len >= sizeof(w); len -= sizeof(w), p += sizeof(w)) {
+		memcpy(&w, p, sizeof(w));
+		h = (h ^ w) * 0x100000001b3ull;
+	}
+
+	while (len-- > 0)
+		h = (h ^ *p++) * 0x100000001b3ull;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+
+	return (u32)(h ^ (h >> 32));
+}
+
+static merr_t
+mbs_rec_append(
+	struct mpool_mbstream  *ms,
+	enum mbs_rec_type       type,
+	u64                     seq,
+	u64                     objid,
+	bool                    sync)
+{
+	struct mbs_rec_omf rec;
+
+	memset(&rec, 0, sizeof(rec));
+	omf_set_pmr_type(&rec, type);
+	omf_set_pmr_seq(&rec, seq);
+	omf_set_pmr_objid(&rec, objid);
+
+	return mpool_mdc_append(ms->ms_mdc, &rec, sizeof(rec), sync);
+}
+
+/**
+ * mbs_tail_append() - Journal @len bytes at @off of the open segment
+ */
+static merr_t
+mbs_tail_append(
+	struct mpool_mbstream  *ms,
+	size_t                  off,
+	size_t                  len,
+	bool                    sync)
+{
+	struct mbs_tail_omf *rec = (struct mbs_tail_omf *)ms->ms_recbuf;
+
+	memset(rec, 0, sizeof(*rec));
+	omf_set_pmt_type(rec, MBS_REC_TAIL);
+	omf_set_pmt_seq(rec, ms->ms_nextseq);
+	omf_set_pmt_off(rec, off);
+	memcpy(rec + 1, ms->ms_tbuf + off, len);
+
+	return mpool_mdc_append(ms->ms_mdc, rec, sizeof(*rec) + len, sync);
+}
+
+static merr_t
+mbs_tbuf_reserve(struct mpool_mbstream *ms, size_t len)
+{
+	char   *buf;
+	size_t  sz;
+
+	if (len <= ms->ms_tbufsz)
+		return 0;
+
+	sz = max_t(size_t, len, ms->ms_tbufsz * 2);
+	sz = max_t(size_t, sz, MBS_TAILREC_MAX);
+
+	buf = kmalloc(sz, GFP_KERNEL);
+	if (!buf)
+		return merr(ENOMEM);
+
+	if (ms->ms_hwm > 0)
+		memcpy(buf, ms->ms_tbuf, ms->ms_hwm);
+	kfree(ms->ms_tbuf);
+
+	ms->ms_tbuf = buf;
+	ms->ms_tbufsz = sz;
+
+	return 0;
+}
+
+/**
+ * mbs_seg_reserve() - Make room for one more segment in @ms_segv
+ */
+static merr_t
+mbs_seg_reserve(struct mpool_mbstream *ms)
+{
+	struct mbs_seg *segv;
+	u32             segmax;
+
+	if (ms->ms_segc < ms->ms_segmax)
+		return 0;
+
+	segmax = max_t(u32, MBS_SEGS_MIN, ms->ms_segmax * 2);
+
+	segv = kcalloc(segmax, sizeof(*segv), GFP_KERNEL);
+	if (!segv)
+		return merr(ENOMEM);
+
+	if (ms->ms_segv)
+		memcpy(segv, ms->ms_segv, ms->ms_segc * sizeof(*segv));
+	kfree(ms->ms_segv);
+
+	ms->ms_segv = segv;
+	ms->ms_segmax = segmax;
+
+	return 0;
+}
+
+static struct mbs_seg *
+mbs_seg_add(struct mpool_mbstream *ms, u64 seq, u64 objid)
+{
+	struct mbs_seg *seg;
+
+	if (mbs_seg_reserve(ms))
+		return NULL;
+
+	seg = ms->ms_segv + ms->ms_segc++;
+	seg->sg_seq = seq;
+	seg->sg_objid = objid;
+
+	return seg;
+}
+
+/**
+ * mbs_seg_delete() - Delete a segment's mblock
+ *
+ * A segment that is already gone (e.g., a truncation interrupted by a
+ * crash and replayed) is not an error.
+ */
+static merr_t
+mbs_seg_delete(struct mpool_mbstream *ms, struct mbs_seg *seg)
+{
+	struct mblock_props props;
+	merr_t              err;
+	u64                 mbh;
+
+	err = mpool_mblock_find(ms->ms_mp, seg->sg_objid, &mbh, &props);
+	if (err)
+		return merr_errno(err) == ENOENT ? 0 : err;
+
+	return mpool_mblock_delete(ms->ms_mp, mbh);
+}
+
+/**
+ * mbs_seg_abort() - Drop the active segment and its unjournaled records
+ */
+static void
+mbs_seg_abort(struct mpool_mbstream *ms)
+{
+	if (!ms->ms_active)
+		return;
+
+	mpool_mblock_abort(ms->ms_mp, ms->ms_mbh);
+	ms->ms_active = false;
+	ms->ms_segoff = 0;
+	ms->ms_wlen = 0;
+}
+
+static merr_t
+mbs_wbuf_write(struct mpool_mbstream *ms, size_t len)
+{
+	struct iovec    iov;
+	merr_t          err;
+
+	iov.iov_base = ms->ms_wbuf;
+	iov.iov_len = len;
+
+	err = mpool_mblock_write(ms->ms_mp, ms->ms_mbh, &iov, 1);
+	if (err)
+		return err;
+
+	ms->ms_segoff += len;
+	ms->ms_wlen = 0;
+
+	return 0;
+}
+
+/**
+ * mbs_wbuf_put() - Copy @len bytes of @src (zeros if NULL) to the stream
+ */
+static merr_t
+mbs_wbuf_put(struct mpool_mbstream *ms, const void *src, size_t len)
+{
+	size_t  cc;
+	merr_t  err;
+
+	while (len > 0) {
+		cc = min_t(size_t, len, ms->ms_params.msp_wbufsz - ms->ms_wlen);
+
+		if (src) {
+			memcpy(ms->ms_wbuf + ms->ms_wlen, src, cc);
+			src += cc;
+		} else {
+			memset(ms->ms_wbuf + ms->ms_wlen, 0, cc);
+		}
+
+		ms->ms_wlen += cc;
+		len -= cc;
+
+		if (ms->ms_wlen == ms->ms_params.msp_wbufsz) {
+			err = mbs_wbuf_write(ms, ms->ms_wlen);
+			if (err)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * mbs_seg_new() - Allocate the active segment
+ *
+ * Records journaled for the segment, e.g., by a process that crashed
+ * before sealing it, are rewritten to the new mblock.
+ */
+static merr_t
+mbs_seg_new(struct mpool_mbstream *ms)
+{
+	struct mblock_props props;
+	merr_t              err;
+	size_t              cap;
+
+	err = mpool_mblock_alloc(ms->ms_mp, ms->ms_params.msp_mclassp, false,
+				 &ms->ms_mbh, &props);
+	if (err)
+		return err;
+
+	cap = props.mpr_alloc_cap;
+	if (ms->ms_params.msp_segsz > 0)
+		cap = min_t(size_t, cap, ms->ms_params.msp_segsz);
+	cap &= ~((size_t)PAGE_SIZE - 1);
+
+	if (cap == 0 || cap < ms->ms_hwm) {
+		mpool_mblock_abort(ms->ms_mp, ms->ms_mbh);
+		return merr(cap ? EFBIG : EINVAL);
+	}
+
+	ms->ms_active = true;
+	ms->ms_objid = props.mpr_objid;
+	ms->ms_segcap = cap;
+	ms->ms_segoff = 0;
+	ms->ms_wlen = 0;
+
+	if (ms->ms_hwm > 0) {
+		err = mbs_wbuf_put(ms, ms->ms_tbuf, ms->ms_hwm);
+		if (err) {
+			mbs_seg_abort(ms);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * mbs_mdc_snapshot() - Append the segment list and the journaled tail
+ */
+static merr_t
+mbs_mdc_snapshot(void *arg)
+{
+	struct mpool_mbstream  *ms = arg;
+	struct mbs_seg         *seg;
+	size_t                  off, len;
+	merr_t                  err;
+	u32                     i;
+
+	err = mbs_rec_append(ms, MBS_REC_TRUNC, ms->ms_segc ?
+			     ms->ms_segv[0].sg_seq : ms->ms_nextseq, 0, false);
+	if (err)
+		return err;
+
+	for (i = 0; i < ms->ms_segc; i++) {
+		seg = ms->ms_segv + i;
+
+		err = mbs_rec_append(ms, MBS_REC_ADD, seg->sg_seq,
+				     seg->sg_objid, false);
+		if (err)
+			return err;
+	}
+
+	for (off = 0; off < ms->ms_hwm; off += len) {
+		len = min_t(size_t, ms->ms_hwm - off, MBS_TAILREC_MAX);
+
+		err = mbs_tail_append(ms, off, len, false);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/**
+ * mbs_mdc_compact() - Rewrite the MDC as a snapshot of the stream
+ * @force: compact regardless of the MDC usage, e.g., when it is full
+ */
+static merr_t
+mbs_mdc_compact(struct mpool_mbstream *ms, bool force)
+{
+	size_t  usage, snapsz;
+	merr_t  err;
+
+	snapsz = (ms->ms_segc + 1) * sizeof(struct mbs_rec_omf) + ms->ms_hwm +
+		(ms->ms_hwm + MBS_TAILREC_MAX - 1) / MBS_TAILREC_MAX *
+		sizeof(struct mbs_tail_omf);
+
+	if (!force) {
+		err = mpool_mdc_usage(ms->ms_mdc, &usage);
+		if (err)
+			return err;
+
+		if (usage < MBS_MDC_COMPACT_MIN ||
+		    usage < MBS_MDC_COMPACT_RATIO * max(snapsz, ms->ms_snapsz))
+			return 0;
+	}
+
+	err = mpool_mdc_compact(ms->ms_mdc, mbs_mdc_snapshot, ms);
+	if (err)
+		return err;
+
+	err = mpool_mdc_usage(ms->ms_mdc, &ms->ms_snapsz);
+	if (err)
+		ms->ms_snapsz = snapsz;
+
+	return 0;
+}
+
+/**
+ * mbs_seal() - Flush, commit and record the active segment
+ *
+ * The mblock is committed before its ADD record is synced, so a crash in
+ * between leaves an unreferenced mblock rather than a dangling ADD.  On
+ * failure the active segment is dropped along with its unjournaled
+ * records; the journaled ones are rewritten to the next segment.
+ */
+static merr_t
+mbs_seal(struct mpool_mbstream *ms)
+{
+	merr_t  err;
+	size_t  len;
+	u64     seq;
+
+	if (!ms->ms_active) {
+		if (ms->ms_hwm == 0)
+			return 0;
+
+		err = mbs_seg_new(ms);
+		if (err)
+			goto errout;
+	}
+
+	if (ms->ms_segoff + ms->ms_wlen == 0) {
+		mbs_seg_abort(ms);
+		return 0;
+	}
+
+	/* Zero padding ends the segment */
+	if (ms->ms_wlen > 0) {
+		len = ALIGN(ms->ms_wlen, PAGE_SIZE);
+		memset(ms->ms_wbuf + ms->ms_wlen, 0, len - ms->ms_wlen);
+
+		err = mbs_wbuf_write(ms, len);
+		if (err)
+			goto errout;
+	}
+
+	err = mpool_mblock_commit(ms->ms_mp, ms->ms_mbh);
+	if (err)
+		goto errout;
+
+	seq = ms->ms_nextseq;
+
+	/* Once the ADD is durable, recording the segment cannot fail */
+	err = mbs_seg_reserve(ms);
+	if (!err) {
+		err = mbs_rec_append(ms, MBS_REC_ADD, seq, ms->ms_objid, true);
+		if (merr_errno(err) == EFBIG) {
+			/* Make room with a snapshot, which precedes the ADD */
+			err = mbs_mdc_compact(ms, true);
+			if (!err)
+				err = mbs_rec_append(ms, MBS_REC_ADD, seq,
+						     ms->ms_objid, true);
+		}
+	}
+
+	ms->ms_active = false;
+
+	if (err) {
+		mpool_mblock_delete(ms->ms_mp, ms->ms_mbh);
+		return err;
+	}
+
+	mbs_seg_add(ms, seq, ms->ms_objid);
+	ms->ms_nextseq++;
+	ms->ms_hwm = 0;
+
+	mbs_mdc_compact(ms, false);
+
+	return 0;
+
+errout:
+	mp_pr_err("mbstream segment %lu seal failed", err,
+		  (ulong)ms->ms_nextseq);
+	mbs_seg_abort(ms);
+
+	return err;
+}
+
+/**
+ * mbs_sync() - Make the records appended to the active segment durable
+ *
+ * The bytes appended since the last sync are journaled and the segment
+ * stays open.  The segment is sealed instead if that would take its
+ * journal past MBS_JNL_MAX, if some of those bytes already went to the
+ * mblock (journaling only ever copies from the write buffer), or if the
+ * MDC is out of room.
+ */
+static merr_t
+mbs_sync(struct mpool_mbstream *ms)
+{
+	size_t  end, off, len;
+	merr_t  err = 0;
+
+	if (!ms->ms_active)
+		return 0;
+
+	end = ms->ms_segoff + ms->ms_wlen;
+	if (end == ms->ms_hwm)
+		return 0;
+
+	if (end > MBS_JNL_MAX || ms->ms_hwm < ms->ms_segoff)
+		return mbs_seal(ms);
+
+	err = mbs_tbuf_reserve(ms, end);
+	if (err)
+		return mbs_seal(ms);
+
+	memcpy(ms->ms_tbuf + ms->ms_hwm,
+	       ms->ms_wbuf + ms->ms_hwm - ms->ms_segoff, end - ms->ms_hwm);
+
+	for (off = ms->ms_hwm; off < end; off += len) {
+		len = min_t(size_t, end - off, MBS_TAILREC_MAX);
+
+		err = mbs_tail_append(ms, off, len, off + len == end);
+		if (err)
+			break;
+	}
+
+	if (err)
+		return merr_errno(err) == EFBIG ? mbs_seal(ms) : err;
+
+	ms->ms_hwm = end;
+
+	return 0;
+}
+
+/**
+ * mbs_replay_tail() - Replay a TAIL record into the journaled prefix
+ *
+ * A sync that failed part way may be retried from its start, so a record
+ * can overlap the prefix; the later record wins.
+ */
+static merr_t
+mbs_replay_tail(struct mpool_mbstream *ms, size_t rdlen)
+{
+	struct mbs_tail_omf    *rec = (struct mbs_tail_omf *)ms->ms_recbuf;
+	size_t                  off, len;
+	merr_t                  err;
+
+	len = rdlen - sizeof(*rec);
+	off = omf_pmt_off(rec);
+
+	if (omf_pmt_seq(rec) != ms->ms_nextseq || off > ms->ms_hwm ||
+	    off + len > MBS_JNL_MAX)
+		return merr(EBADMSG);
+
+	err = mbs_tbuf_reserve(ms, off + len);
+	if (err)
+		return err;
+
+	memcpy(ms->ms_tbuf + off, rec + 1, len);
+	ms->ms_hwm = off + len;
+
+	return 0;
+}
+
+/**
+ * mbs_replay() - Rebuild the segment list and the open segment's journal
+ */
+static merr_t
+mbs_replay(struct mpool_mbstream *ms)
+{
+	struct mbs_rec_omf *rec = (struct mbs_rec_omf *)ms->ms_recbuf;
+	struct mbs_seg     *seg;
+	size_t              rdlen;
+	merr_t              err;
+	u64                 seq;
+	u32                 n;
+
+	err = mpool_mdc_rewind(ms->ms_mdc);
+	if (err)
+		return err;
+
+	while (true) {
+		err = mpool_mdc_read(ms->ms_mdc, ms->ms_recbuf, MBS_RECSZ_MAX,
+				     &rdlen);
+		if (err)
+			return err;
+
+		if (rdlen == 0)
+			break;
+
+		if (omf_pmr_type(rec) == MBS_REC_TAIL) {
+			if (rdlen < sizeof(struct mbs_tail_omf))
+				return merr(EBADMSG);
+
+			err = mbs_replay_tail(ms, rdlen);
+			if (err)
+				return err;
+			continue;
+		}
+
+		if (rdlen != sizeof(*rec))
+			return merr(EBADMSG);
+
+		seq = omf_pmr_seq(rec);
+
+		switch (omf_pmr_type(rec)) {
+		case MBS_REC_ADD:
+			if (seq < ms->ms_nextseq)
+				return merr(EBADMSG);
+
+			seg = mbs_seg_add(ms, seq, omf_pmr_objid(rec));
+			if (!seg)
+				return merr(ENOMEM);
+
+			/* The journal of the open segment is superseded */
+			ms->ms_nextseq = seq + 1;
+			ms->ms_hwm = 0;
+			break;
+
+		case MBS_REC_TRUNC:
+			/* Finish deleting segments a crash may have left */
+			for (n = 0; n < ms->ms_segc; n++) {
+				seg = ms->ms_segv + n;
+				if (seg->sg_seq >= seq)
+					break;
+
+				err = mbs_seg_delete(ms, seg);
+				if (err)
+					return err;
+			}
+
+			if (n > 0) {
+				ms->ms_segc -= n;
+				memmove(ms->ms_segv, ms->ms_segv + n,
+					ms->ms_segc * sizeof(*seg));
+			}
+
+			if (seq > ms->ms_nextseq) {
+				ms->ms_nextseq = seq;
+				ms->ms_hwm = 0;
+			}
+			break;
+
+		default:
+			return merr(EBADMSG);
+		}
+	}
+
+	return 0;
+}
+
+uint64_t
+mpool_mbstream_open(
+	struct mpool                           *mp,
+	uint64_t                                logid1,
+	uint64_t                                logid2,
+	const struct mpool_mbstream_params     *params,
+	struct mpool_mbstream                 **msp)
+{
+	struct mpool_mbstream  *ms;
+	merr_t                  err;
+	u32                     wbufsz;
+
+	if (!mp || !msp)
+		return merr(EINVAL);
+
+	*msp = NULL;
+
+	wbufsz = params ? params->msp_wbufsz : 0;
+	if (wbufsz == 0)
+		wbufsz = MBS_WBUFSZ_DFLT;
+
+	if (wbufsz > MBS_WBUFSZ_MAX || !PAGE_ALIGNED(wbufsz))
+		return merr(EINVAL);
+
+	ms = kzalloc(sizeof(*ms), GFP_KERNEL);
+	if (!ms)
+		return merr(ENOMEM);
+
+	mutex_init(&ms->ms_lock);
+
+	ms->ms_mp = mp;
+
+	if (params) {
+		ms->ms_params = *params;
+	} else {
+		ms->ms_params.msp_mclassp = MP_MED_CAPACITY;
+	}
+
+	ms->ms_params.msp_wbufsz = wbufsz;
+
+	ms->ms_wbuf = aligned_alloc(PAGE_SIZE, wbufsz);
+	ms->ms_recbuf = kmalloc(MBS_RECSZ_MAX, GFP_KERNEL);
+	if (!ms->ms_wbuf || !ms->ms_recbuf) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	err = mpool_mdc_open(mp, logid1, logid2, 0, &ms->ms_mdc);
+	if (err)
+		goto errout;
+
+	err = mbs_replay(ms);
+	if (err) {
+		mp_pr_err("mbstream logid 0x%lx 0x%lx replay failed",
+			  err, (ulong)logid1, (ulong)logid2);
+		goto errout;
+	}
+
+	*msp = ms;
+
+	return 0;
+
+errout:
+	if (ms->ms_mdc)
+		mpool_mdc_close(ms->ms_mdc);
+	mutex_destroy(&ms->ms_lock);
+	free(ms->ms_wbuf);
+	kfree(ms->ms_recbuf);
+	kfree(ms->ms_tbuf);
+	kfree(ms->ms_segv);
+	kfree(ms);
+
+	return err;
+}
+
+static void
+mbs_read_close(struct mpool_mbstream *ms)
+{
+	if (ms->ms_rmap)
+		mpool_mcache_munmap(ms->ms_rmap);
+
+	ms->ms_rmap = NULL;
+	ms->ms_rbase = NULL;
+	ms->ms_rbuflen = 0;
+	ms->ms_rinit = false;
+}
+
+uint64_t
+mpool_mbstream_close(struct mpool_mbstream *ms)
+{
+	merr_t  err, err2;
+
+	if (!ms)
+		return merr(EINVAL);
+
+	err = mbs_seal(ms);
+
+	mbs_read_close(ms);
+
+	err2 = mpool_mdc_close(ms->ms_mdc);
+	if (!err)
+		err = err2;
+
+	mutex_destroy(&ms->ms_lock);
+	free(ms->ms_wbuf);
+	free(ms->ms_rbuf);
+	kfree(ms->ms_recbuf);
+	kfree(ms->ms_tbuf);
+	kfree(ms->ms_segv);
+	kfree(ms);
+
+	return err;
+}
+
+uint64_t
+mpool_mbstream_append(
+	struct mpool_mbstream  *ms,
+	const void             *data,
+	size_t                  len,
+	bool                    sync)
+{
+	struct mbs_frame_omf    frame;
+	size_t                  framesz, off;
+	merr_t                  err = 0;
+
+	if (!ms || (!data && len > 0) || len >= MBS_FRAME_REC)
+		return merr(EINVAL);
+
+	framesz = mbs_framesz(len);
+
+	mutex_lock(&ms->ms_lock);
+
+	if (ms->ms_segcap > 0 && framesz > ms->ms_segcap) {
+		err = merr(EFBIG);
+		goto out;
+	}
+
+	if (!ms->ms_active) {
+		err = mbs_seg_new(ms);
+		if (err)
+			goto out;
+	}
+
+	if (ms->ms_segoff + ms->ms_wlen + framesz > ms->ms_segcap) {
+		err = mbs_seal(ms);
+		if (!err)
+			err = mbs_seg_new(ms);
+		if (err)
+			goto out;
+	}
+
+	if (framesz > ms->ms_segcap) {
+		err = merr(EFBIG);
+		goto out;
+	}
+
+	off = ms->ms_segoff + ms->ms_wlen;
+
+	omf_set_pmf_len(&frame, len | MBS_FRAME_REC);
+	omf_set_pmf_csum(&frame, mbs_csum(ms->ms_nextseq, off, data, len));
+
+	err = mbs_wbuf_put(ms, &frame, sizeof(frame));
+	if (!err)
+		err = mbs_wbuf_put(ms, data, len);
+	if (!err)
+		err = mbs_wbuf_put(ms, NULL, framesz - sizeof(frame) - len);
+	if (err) {
+		mp_pr_err("mbstream segment %lu write failed", err,
+			  (ulong)ms->ms_nextseq);
+		mbs_seg_abort(ms);
+		goto out;
+	}
+
+	if (sync)
+		err = mbs_sync(ms);
+
+out:
+	mutex_unlock(&ms->ms_lock);
+
+	return err;
+}
+
+uint64_t
+mpool_mbstream_sync(struct mpool_mbstream *ms)
+{
+	merr_t err;
+
+	if (!ms)
+		return merr(EINVAL);
+
+	mutex_lock(&ms->ms_lock);
+	err = mbs_sync(ms);
+	mutex_unlock(&ms->ms_lock);
+
+	return err;
+}
+
+uint64_t
+mpool_mbstream_read_init(struct mpool_mbstream *ms)
+{
+	if (!ms)
+		return merr(EINVAL);
+
+	mutex_lock(&ms->ms_lock);
+	mbs_read_close(ms);
+	ms->ms_ridx = 0;
+	ms->ms_roff = 0;
+	mutex_unlock(&ms->ms_lock);
+
+	return 0;
+}
+
+/**
+ * mbs_read_open() - Set the reader up on segment @ms_ridx
+ *
+ * Segments are mapped through mcache so records can be handed out in
+ * place; those that cannot be mapped are read in large chunks instead.
+ * The reader offset is kept, as the segment may have been sealed while
+ * the reader was on its journaled records.
+ */
+static merr_t
+mbs_read_open(struct mpool_mbstream *ms)
+{
+	struct mblock_props props;
+	struct mbs_seg     *seg = ms->ms_segv + ms->ms_ridx;
+	merr_t              err;
+
+	err = mpool_mblock_find(ms->ms_mp, seg->sg_objid, &ms->ms_rmbh, &props);
+	if (err)
+		return err;
+
+	ms->ms_rlen = props.mpr_write_len;
+	ms->ms_rbuflen = 0;
+
+	err = mpool_mcache_mmap(ms->ms_mp, 1, &ms->ms_rmbh, MPC_VMA_COLD,
+				&ms->ms_rmap);
+	if (!err) {
+		ms->ms_rbase = mpool_mcache_getbase(ms->ms_rmap, 0);
+		if (!ms->ms_rbase) {
+			mpool_mcache_munmap(ms->ms_rmap);
+			ms->ms_rmap = NULL;
+		}
+	}
+
+	ms->ms_rinit = true;
+
+	return 0;
+}
+
+/**
+ * mbs_read_ptr() - Get a pointer to @len bytes at @off in the reader's segment
+ */
+static const void *
+mbs_read_ptr(struct mpool_mbstream *ms, size_t off, size_t len, merr_t *errp)
+{
+	struct iovec    iov;
+	size_t          start, bufsz;
+	merr_t          err;
+
+	if (ms->ms_ridx >= ms->ms_segc)
+		return ms->ms_tbuf + off;
+
+	if (ms->ms_rbase) {
+		mpool_mcache_access(ms->ms_rmap, 0, off, len);
+		return ms->ms_rbase + off;
+	}
+
+	if (off >= ms->ms_rbufoff &&
+	    off + len <= ms->ms_rbufoff + ms->ms_rbuflen)
+		return ms->ms_rbuf + off - ms->ms_rbufoff;
+
+	start = off & ~((size_t)PAGE_SIZE - 1);
+	bufsz = max_t(size_t, ALIGN(off + len, PAGE_SIZE) - start,
+		      ms->ms_params.msp_wbufsz);
+
+	if (bufsz > ms->ms_rbufsz) {
+		free(ms->ms_rbuf);
+		ms->ms_rbufsz = 0;
+		ms->ms_rbuflen = 0;
+
+		ms->ms_rbuf = aligned_alloc(PAGE_SIZE, bufsz);
+		if (!ms->ms_rbuf) {
+			*errp = merr(ENOMEM);
+			return NULL;
+		}
+
+		ms->ms_rbufsz = bufsz;
+	}
+
+	iov.iov_base = ms->ms_rbuf;
+	iov.iov_len = min_t(size_t, ms->ms_rbufsz,
+			    ALIGN(ms->ms_rlen, PAGE_SIZE) - start);
+
+	err = mpool_mblock_read(ms->ms_mp, ms->ms_rmbh, &iov, 1, start);
+	if (err) {
+		ms->ms_rbuflen = 0;
+		*errp = err;
+		return NULL;
+	}
+
+	ms->ms_rbufoff = start;
+	ms->ms_rbuflen = iov.iov_len;
+
+	return ms->ms_rbuf + off - start;
+}
+
+uint64_t
+mpool_mbstream_read_next(
+	struct mpool_mbstream  *ms,
+	const void            **datap,
+	size_t                 *lenp)
+{
+	const struct mbs_frame_omf *frame;
+	const void                 *data = NULL;
+	merr_t                      err = 0;
+	size_t                      len, end;
+	u64                         seq;
+	u32                         csum;
+
+	if (!ms || !datap || !lenp)
+		return merr(EINVAL);
+
+	*datap = NULL;
+	*lenp = 0;
+
+	mutex_lock(&ms->ms_lock);
+
+	while (true) {
+		if (ms->ms_ridx < ms->ms_segc) {
+			if (!ms->ms_rinit) {
+				err = mbs_read_open(ms);
+				if (err)
+					break;
+			}
+
+			seq = ms->ms_segv[ms->ms_ridx].sg_seq;
+			end = ms->ms_rlen;
+		} else {
+			/* Synced records of the open segment */
+			seq = ms->ms_nextseq;
+			end = ms->ms_hwm;
+		}
+
+		if (ms->ms_roff + sizeof(*frame) > end)
+			goto next;
+
+		frame = mbs_read_ptr(ms, ms->ms_roff, sizeof(*frame), &err);
+		if (!frame)
+			break;
+
+		len = omf_pmf_len(frame);
+		csum = omf_pmf_csum(frame);
+
+		/* Zero padding after the last record */
+		if (len == 0 && csum == 0)
+			goto next;
+
+		len &= ~MBS_FRAME_REC;
+
+		if (!(omf_pmf_len(frame) & MBS_FRAME_REC) ||
+		    ms->ms_roff + mbs_framesz(len) > end) {
+			err = merr(EBADMSG);
+		} else {
+			data = mbs_read_ptr(ms, ms->ms_roff + sizeof(*frame),
+					    len, &err);
+			if (!data)
+				break;
+
+			if (csum != mbs_csum(seq, ms->ms_roff, data, len))
+				err = merr(EBADMSG);
+		}
+
+		if (err) {
+			mp_pr_err("mbstream segment %lu offset %lu bad frame",
+				  err, (ulong)seq, (ulong)ms->ms_roff);
+			break;
+		}
+
+		ms->ms_roff += mbs_framesz(len);
+
+		*datap = data;
+		*lenp = len;
+		break;
+
+next:
+		if (ms->ms_ridx >= ms->ms_segc)
+			break;
+
+		mbs_read_close(ms);
+		ms->ms_ridx++;
+		ms->ms_roff = 0;
+	}
+
+	mutex_unlock(&ms->ms_lock);
+
+	return err;
+}
+
+uint64_t
+mpool_mbstream_trunc(struct mpool_mbstream *ms, uint64_t seq)
+{
+	struct mbs_seg *seg;
+	merr_t          err = 0;
+	u32             n;
+
+	if (!ms)
+		return merr(EINVAL);
+
+	mutex_lock(&ms->ms_lock);
+
+	for (n = 0; n < ms->ms_segc; n++)
+		if (ms->ms_segv[n].sg_seq >= seq)
+			break;
+
+	if (n == 0)
+		goto out;
+
+	seq = n < ms->ms_segc ? ms->ms_segv[n].sg_seq : ms->ms_nextseq;
+
+	err = mbs_rec_append(ms, MBS_REC_TRUNC, seq, 0, true);
+	if (err)
+		goto out;
+
+	if (ms->ms_ridx < n) {
+		mbs_read_close(ms);
+		ms->ms_roff = 0;
+	}
+
+	for (seg = ms->ms_segv; seg < ms->ms_segv + n; seg++) {
+		err = mbs_seg_delete(ms, seg);
+		if (err)
+			mp_pr_err("mbstream segment %lu objid 0x%lx delete failed",
+				  err, (ulong)seg->sg_seq,
+				  (ulong)seg->sg_objid);
+	}
+
+	ms->ms_segc -= n;
+	memmove(ms->ms_segv, ms->ms_segv + n, ms->ms_segc * sizeof(*seg));
+
+	ms->ms_ridx = ms->ms_ridx >= n ? ms->ms_ridx - n : 0;
+
+	err = mbs_mdc_compact(ms, false);
+
+out:
+	mutex_unlock(&ms->ms_lock);
+
+	return err;
+}
+
+uint64_t
+mpool_mbstream_getprops(
+	struct mpool_mbstream          *ms,
+	struct mpool_mbstream_props    *props)
+{
+	if (!ms || !props)
+		return merr(EINVAL);
+
+	mutex_lock(&ms->ms_lock);
+	props->mbp_headseq = ms->ms_segc ? ms->ms_segv[0].sg_seq :
+		ms->ms_nextseq;
+	props->mbp_tailseq = ms->ms_nextseq;
+	props->mbp_rdseq = ms->ms_ridx < ms->ms_segc ?
+		ms->ms_segv[ms->ms_ridx].sg_seq : ms->ms_nextseq;
+	props->mbp_nsegs = ms->ms_segc;
+	props->mbp_segcap = ms->ms_segcap;
+	props->mbp_pending = ms->ms_active ? ms->ms_segoff + ms->ms_wlen :
+		ms->ms_hwm;
+	mutex_unlock(&ms->ms_lock);
+
+	return 0;
+}
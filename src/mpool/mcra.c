@@ -0,0 +1,237 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Adaptive mcache readahead.
+ *
+ * The kernel reads ahead of mcache faults by at most mp_ra_pages_max pages,
+ * whatever the access pattern, so scans stall on short windows while point
+ * lookups drag in pages nobody asked for.  This controller watches the
+ * pages handed out by mpool_mcache_getpages() and friends and:
+ *
+ *   - per mblock, recognizes sequential runs and issues MADV_WILLNEED ahead
+ *     of the reader, doubling the window each time the reader catches up
+ *     with it, from MCRA_WIN_MIN up to MCRA_WIN_MAX pages;
+ *
+ *   - per map, counts sequential versus random accesses over periods of
+ *     MCRA_PERIOD accesses, and switches the whole map to MADV_RANDOM when
+ *     nearly all of them were random, and back to MADV_NORMAL when runs
+ *     reappear.  Only done for maps created with the default advice, so
+ *     that an explicit caller advice is never overridden.
+ *
+ * Accesses are recorded without locks.  Concurrent readers of one mblock
+ * may perturb each other's run detection, which only affects how much is
+ * read ahead, never correctness.
+ */
+
+#include <util/platform.h>
+#include <util/alloc.h>
+#include <util/atomic.h>
+#include <util/minmax.h>
+#include <util/page.h>
+
+#include <mpool/mpool.h>
+#include <mpctl/imcra.h>
+
+#include <sys/mman.h>
+
+#define MCRA_SEQ_MIN            (3)     /* run length before reading ahead */
+#define MCRA_SEQ_GAP            (2)     /* forward skip still sequential */
+#define MCRA_WIN_MIN            (16)    /* pages */
+#define MCRA_WIN_MAX            (512)   /* pages */
+#define MCRA_PERIOD             (1024)  /* accesses */
+#define MCRA_RANDOM_PCT         (10)    /* sequential % to go random */
+#define MCRA_NORMAL_PCT         (40)    /* sequential % to go back */
+
+/**
+ * struct mcra_mb - per mblock run state
+ * @mm_next:   page expected next if the run continues
+ * @mm_raend:  end of the pages already read ahead
+ * @mm_run:    length of the current run
+ * @mm_win:    readahead window in pages
+ */
+struct mcra_mb {
+	atomic64_t  mm_next;
+	atomic64_t  mm_raend;
+	atomic_t    mm_run;
+	atomic_t    mm_win;
+};
+
+/**
+ * struct mcache_ra - per map readahead state
+ * @ra_base:    map base address
+ * @ra_bktpg:   map bucket size in pages
+ * @ra_mbidc:   number of mblocks in the map
+ * @ra_adapt:   map-wide MADV_RANDOM switching is enabled
+ * @ra_random:  map is advised MADV_RANDOM
+ * @ra_nacc:    accesses in the current period
+ * @ra_nseq:    sequential accesses in the current period
+ * @ra_stats:   lifetime statistics
+ * @ra_mbv:     per mblock state
+ */
+struct mcache_ra {
+	char               *ra_base;
+	size_t              ra_bktpg;
+	uint                ra_mbidc;
+	bool                ra_adapt;
+	atomic_t            ra_random;
+	atomic_t            ra_nacc;
+	atomic_t            ra_nseq;
+
+	atomic64_t          ra_seq;
+	atomic64_t          ra_rand;
+	atomic64_t          ra_ahead;
+	atomic64_t          ra_switches;
+
+	struct mcra_mb      ra_mbv[];
+};
+
+merr_t
+mcra_create(
+	void               *base,
+	size_t              bktsz,
+	uint                mbidc,
+	bool                adapt,
+	struct mcache_ra  **rap)
+{
+	struct mcache_ra   *ra;
+
+	*rap = NULL;
+
+	if (!base || bktsz < PAGE_SIZE || mbidc == 0)
+		return merr(EINVAL);
+
+	ra = calloc(1, sizeof(*ra) + mbidc * sizeof(ra->ra_mbv[0]));
+	if (!ra)
+		return merr(ENOMEM);
+
+	ra->ra_base = base;
+	ra->ra_bktpg = bktsz / PAGE_SIZE;
+	ra->ra_mbidc = mbidc;
+	ra->ra_adapt = adapt;
+
+	*rap = ra;
+
+	return 0;
+}
+
+void
+mcra_destroy(struct mcache_ra *ra)
+{
+	free(ra);
+}
+
+/**
+ * mcra_period() - Close an access period and re-advise the map if needed
+ */
+static void
+mcra_period(struct mcache_ra *ra, uint nseq)
+{
+	size_t  len = ra->ra_bktpg * ra->ra_mbidc * PAGE_SIZE;
+	uint    pct = nseq * 100 / MCRA_PERIOD;
+	int     random = atomic_read(&ra->ra_random);
+
+	if (!ra->ra_adapt)
+		return;
+
+	if (!random && pct < MCRA_RANDOM_PCT) {
+		if (atomic_cmpxchg(&ra->ra_random, 0, 1) == 0) {
+			madvise(ra->ra_base, len, MADV_RANDOM);
+			atomic64_inc(&ra->ra_switches);
+		}
+	} else if (random && pct >= MCRA_NORMAL_PCT) {
+		if (atomic_cmpxchg(&ra->ra_random, 1, 0) == 1) {
+			madvise(ra->ra_base, len, MADV_NORMAL);
+			atomic64_inc(&ra->ra_switches);
+		}
+	}
+}
+
+void
+mcra_access(
+	struct mcache_ra   *ra,
+	uint                mbidx,
+	size_t              pgnum,
+	size_t              pgcnt)
+{
+	struct mcra_mb *mm;
+	size_t          next, raend, start, end;
+	uint            nacc, nseq, win;
+	bool            seq;
+
+	if (!ra || mbidx >= ra->ra_mbidc || pgnum >= ra->ra_bktpg)
+		return;
+
+	pgcnt = clamp_t(size_t, pgcnt, 1, ra->ra_bktpg - pgnum);
+
+	mm = ra->ra_mbv + mbidx;
+	next = atomic64_read(&mm->mm_next);
+
+	seq = pgnum >= next && pgnum <= next + MCRA_SEQ_GAP;
+
+	atomic64_set(&mm->mm_next, pgnum + pgcnt);
+
+	if (!seq) {
+		atomic_set(&mm->mm_run, 0);
+		atomic_set(&mm->mm_win, 0);
+		atomic64_set(&mm->mm_raend, 0);
+		atomic64_inc(&ra->ra_rand);
+	} else {
+		atomic64_inc(&ra->ra_seq);
+		atomic_inc(&ra->ra_nseq);
+	}
+
+	nacc = atomic_inc_return(&ra->ra_nacc);
+	if (nacc == MCRA_PERIOD) {
+		nseq = atomic_read(&ra->ra_nseq);
+		atomic_set(&ra->ra_nseq, 0);
+		atomic_set(&ra->ra_nacc, 0);
+		mcra_period(ra, nseq);
+	}
+
+	if (!seq || atomic_inc_return(&mm->mm_run) < MCRA_SEQ_MIN)
+		return;
+
+	/* Read ahead once the reader is within half a window of the end
+	 * of what was already read ahead.
+	 */
+	win = atomic_read(&mm->mm_win);
+	raend = atomic64_read(&mm->mm_raend);
+
+	if (win > 0 && pgnum + pgcnt + win / 2 < raend)
+		return;
+
+	win = win ? min_t(uint, win * 2, MCRA_WIN_MAX) : MCRA_WIN_MIN;
+
+	start = max_t(size_t, raend, pgnum + pgcnt);
+	end = min_t(size_t, pgnum + pgcnt + win, ra->ra_bktpg);
+
+	atomic_set(&mm->mm_win, win);
+	atomic64_set(&mm->mm_raend, end);
+
+	if (start >= end)
+		return;
+
+	madvise(ra->ra_base + (mbidx * ra->ra_bktpg + start) * PAGE_SIZE,
+		(end - start) * PAGE_SIZE, MADV_WILLNEED);
+
+	atomic64_add(end - start, &ra->ra_ahead);
+}
+
+void
+mcra_stats(
+	struct mcache_ra               *ra,
+	struct mpool_mcache_ra_stats   *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	if (!ra)
+		return;
+
+	stats->mrs_seq = atomic64_read(&ra->ra_seq);
+	stats->mrs_rand = atomic64_read(&ra->ra_rand);
+	stats->mrs_ahead = atomic64_read(&ra->ra_ahead);
+	stats->mrs_switches = atomic64_read(&ra->ra_switches);
+	stats->mrs_random = atomic_read(&ra->ra_random);
+}
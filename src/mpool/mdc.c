@@ -667,6 +667,122 @@ mpool_mdc_cend(struct mpool_mdc *mdc)
 	return err;
 }
 
+/**
+ * mdc_cabandon() - Abandon a compaction into @tgth
+ *
+ * @mdc:  MDC handle, mdc_lock held
+ * @srch: mlog active before the compaction
+ * @tgth: compaction target
+ *
+ * The target is erased with a gen above the source's so that the source
+ * remains the active mlog on the next open.
+ */
+static void
+mdc_cabandon(
+	struct mpool_mdc   *mdc,
+	struct mpool_mlog  *srch,
+	struct mpool_mlog  *tgth)
+{
+	merr_t err;
+	u64    gensrc = 0;
+
+	mdc->mdc_alogh = srch;
+
+	err = mpool_mlog_gen(mdc->mdc_ds, srch, &gensrc);
+	if (!err)
+		err = mpool_mlog_erase(mdc->mdc_ds, tgth, gensrc + 1);
+	if (err)
+		mp_pr_err("mpool %s, mdc %p compaction abandon failed, mlog %p",
+			  err, mdc->mdc_mpname, mdc, tgth);
+}
+
+uint64_t
+mpool_mdc_compact(
+	struct mpool_mdc       *mdc,
+	mpool_mdc_snapshot_t   *snapshot,
+	void                   *arg)
+{
+	struct mpool       *ds;
+	struct mpool_mlog  *srch;
+	struct mpool_mlog  *tgth;
+
+	merr_t err, err2;
+	u64    gen = 0;
+	bool   empty = false;
+	bool   rw = false;
+
+	if (!mdc || !snapshot)
+		return merr(EINVAL);
+
+	err = mdc_acquire(mdc, rw);
+	if (err)
+		return err;
+
+	ds = mdc->mdc_ds;
+	srch = mdc->mdc_alogh;
+	tgth = (srch == mdc->mdc_logh1) ? mdc->mdc_logh2 : mdc->mdc_logh1;
+
+	/*
+	 * The target holds leftovers if an earlier compaction could not be
+	 * abandoned or finished cleanly, erase it first.
+	 */
+	err = mpool_mlog_empty(ds, tgth, &empty);
+	if (!err && !empty) {
+		err = mpool_mlog_gen(ds, srch, &gen);
+		if (!err)
+			err = mpool_mlog_erase(ds, tgth, gen + 1);
+	}
+	if (!err)
+		err = mpool_mlog_append_cstart(ds, tgth);
+	if (err) {
+		mdc_cabandon(mdc, srch, tgth);
+		mdc_release(mdc, rw);
+
+		mp_pr_err("mpool %s, mdc %p cstart failed, mlog %p",
+			  err, mdc->mdc_mpname, mdc, tgth);
+
+		return err;
+	}
+
+	mdc->mdc_alogh = tgth;
+	mdc_release(mdc, rw);
+
+	err = snapshot(arg);
+
+	err2 = mdc_acquire(mdc, rw);
+	if (err2)
+		return err ?: err2;
+
+	if (!err) {
+		err = mpool_mlog_append_cend(ds, tgth);
+		if (!err)
+			err = mpool_mlog_gen(ds, tgth, &gen);
+		if (err)
+			mp_pr_err("mpool %s, mdc %p cend failed, mlog %p",
+				  err, mdc->mdc_mpname, mdc, tgth);
+	}
+
+	if (err) {
+		mdc_cabandon(mdc, srch, tgth);
+		mdc_release(mdc, rw);
+
+		return err;
+	}
+
+	/*
+	 * The snapshot is complete.  If the source can't be erased, appends
+	 * stay on the target and the source is erased by the next compaction.
+	 */
+	err = mpool_mlog_erase(ds, srch, gen + 1);
+	if (err)
+		mp_pr_err("mpool %s, mdc %p cend failed, mlog %p",
+			  err, mdc->mdc_mpname, mdc, srch);
+
+	mdc_release(mdc, rw);
+
+	return err;
+}
+
 uint64_t
 mpool_mdc_close(struct mpool_mdc *mdc)
 {
@@ -0,0 +1,321 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Shared mlog tail cache.
+ *
+ * Opening an mlog validates its entire contents to rebuild the tail state
+ * (write offset, flush set IDs, compaction markers).  This cache lets a
+ * process publish that state in a file under the mpool rundir so that
+ * read-only openers in other processes can trust it instead of repeating
+ * the scan.
+ *
+ * The file is a fixed size, direct mapped table of slots hashed by objid.
+ * Each slot carries two write counters that every mlog writer on the host
+ * maintains around operations that may write media:
+ *
+ *   ms_wactive - writes in flight
+ *   ms_wver    - writes completed that changed media
+ *
+ * A tail is published along with the ms_wver sampled before it was
+ * validated, and only if no write started meanwhile.  It is trusted only
+ * while no write is in flight and ms_wver has not moved.  A writer that
+ * dies mid-write leaves ms_wactive elevated, which disables the slot until
+ * the rundir is recreated; the cache fails closed.  Publishers update a
+ * slot under a seqlock in ms_seq.
+ */
+
+#include <util/platform.h>
+#include <util/string.h>
+
+#include <mpcore/mlog.h>
+#include <mpctl/imlcache.h>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MLCACHE_MAGIC           ((u32)0x4d4c4331)       /* "MLC1" */
+#define MLCACHE_VERSION         (1)
+#define MLCACHE_NSLOTS          (4096)
+
+/**
+ * struct mlcache_hdr - cache file header
+ * @mh_magic:   MLCACHE_MAGIC, written last at initialization
+ * @mh_version: MLCACHE_VERSION
+ * @mh_nslots:  number of slots (power of 2)
+ * @mh_slotsz:  sizeof(struct mlcache_slot)
+ */
+struct mlcache_hdr {
+	u32     mh_magic;
+	u32     mh_version;
+	u32     mh_nslots;
+	u32     mh_slotsz;
+	u8      mh_rsvd[48];
+};
+
+/**
+ * struct mlcache_slot - cache slot, one cache line
+ * @ms_seq:     publisher seqlock, odd while an update is in progress
+ * @ms_wver:    writes that changed media of any mlog hashing to this slot
+ * @ms_wactive: writes in flight to any mlog hashing to this slot
+ * @ms_cstart:  see struct mlog_tail
+ * @ms_cend:    see struct mlog_tail
+ * @ms_objid:   mlog object ID, 0 if unused
+ * @ms_gen:     mlog generation
+ * @ms_pver:    ms_wver at which the tail was published
+ * @ms_wsoff:   see struct mlog_tail
+ * @ms_pfsetid: see struct mlog_tail
+ * @ms_cfsetid: see struct mlog_tail
+ */
+struct mlcache_slot {
+	u64     ms_seq;
+	u64     ms_wver;
+	u32     ms_wactive;
+	u8      ms_cstart;
+	u8      ms_cend;
+	u8      ms_rsvd[2];
+	u64     ms_objid;
+	u64     ms_gen;
+	u64     ms_pver;
+	s64     ms_wsoff;
+	u32     ms_pfsetid;
+	u32     ms_cfsetid;
+};
+
+struct mlcache {
+	void                   *mlc_base;
+	size_t                  mlc_len;
+	struct mlcache_slot    *mlc_slotv;
+	u32                     mlc_nslots;
+};
+
+static inline struct mlcache_slot *
+mlcache_slot(struct mlcache *mlc, u64 objid)
+{
+	u64 h = objid * 0x9e3779b97f4a7c15ull;
+
+	return mlc->mlc_slotv + ((h >> 32) & (mlc->mlc_nslots - 1));
+}
+
+struct mlcache *
+mlcache_open(const char *mpname)
+{
+	struct mlcache_hdr *hdr;
+	struct mlcache     *mlc;
+	struct stat         st;
+
+	char    path[PATH_MAX];
+	size_t  len;
+	void   *base;
+	int     fd, rc;
+
+	len = sizeof(*hdr) + MLCACHE_NSLOTS * sizeof(struct mlcache_slot);
+
+	snprintf(path, sizeof(path), "%s/%s", MPOOL_RUNDIR_ROOT, mpname);
+
+	rc = stat(path, &st);
+	if (rc || !S_ISDIR(st.st_mode))
+		return NULL;
+
+	strlcat(path, "/" MLCACHE_FILE, sizeof(path));
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, st.st_mode & 0666);
+	if (fd == -1)
+		return NULL;
+
+	base = MAP_FAILED;
+
+	/* Serialize initialization against other processes */
+	if (flock(fd, LOCK_EX))
+		goto errout;
+
+	if (fstat(fd, &st) || (st.st_size != 0 && st.st_size != len))
+		goto errout;
+
+	if (st.st_size == 0 && ftruncate(fd, len))
+		goto errout;
+
+	base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+		goto errout;
+
+	hdr = base;
+
+	if (hdr->mh_magic == 0) {
+		hdr->mh_version = MLCACHE_VERSION;
+		hdr->mh_nslots = MLCACHE_NSLOTS;
+		hdr->mh_slotsz = sizeof(struct mlcache_slot);
+		__atomic_store_n(&hdr->mh_magic, MLCACHE_MAGIC,
+				 __ATOMIC_RELEASE);
+	}
+
+	if (hdr->mh_magic != MLCACHE_MAGIC ||
+	    hdr->mh_version != MLCACHE_VERSION ||
+	    hdr->mh_nslots != MLCACHE_NSLOTS ||
+	    hdr->mh_slotsz != sizeof(struct mlcache_slot))
+		goto errout;
+
+	mlc = calloc(1, sizeof(*mlc));
+	if (!mlc)
+		goto errout;
+
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	mlc->mlc_base = base;
+	mlc->mlc_len = len;
+	mlc->mlc_slotv = (struct mlcache_slot *)(hdr + 1);
+	mlc->mlc_nslots = MLCACHE_NSLOTS;
+
+	return mlc;
+
+errout:
+	if (base != MAP_FAILED)
+		munmap(base, len);
+	close(fd);
+
+	return NULL;
+}
+
+void
+mlcache_close(struct mlcache *mlc)
+{
+	if (!mlc)
+		return;
+
+	munmap(mlc->mlc_base, mlc->mlc_len);
+	free(mlc);
+}
+
+bool
+mlcache_lookup(
+	struct mlcache     *mlc,
+	u64                 objid,
+	u64                 gen,
+	struct mlog_tail   *tail)
+{
+	struct mlcache_slot    *slot;
+	u64                     seq, wver;
+	u32                     wactive;
+	bool                    hit;
+
+	if (!mlc)
+		return false;
+
+	slot = mlcache_slot(mlc, objid);
+
+	seq = __atomic_load_n(&slot->ms_seq, __ATOMIC_ACQUIRE);
+	if (seq & 1)
+		return false;
+
+	hit = (slot->ms_objid == objid && slot->ms_gen == gen);
+
+	tail->mt_wsoff   = slot->ms_wsoff;
+	tail->mt_pfsetid = slot->ms_pfsetid;
+	tail->mt_cfsetid = slot->ms_cfsetid;
+	tail->mt_cstart  = slot->ms_cstart;
+	tail->mt_cend    = slot->ms_cend;
+
+	wactive = __atomic_load_n(&slot->ms_wactive, __ATOMIC_ACQUIRE);
+	wver = __atomic_load_n(&slot->ms_wver, __ATOMIC_ACQUIRE);
+
+	hit = hit && wactive == 0 && wver == slot->ms_pver;
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	if (__atomic_load_n(&slot->ms_seq, __ATOMIC_RELAXED) != seq)
+		hit = false;
+
+	tail->mt_valid = hit;
+
+	return hit;
+}
+
+u64
+mlcache_wver(
+	struct mlcache *mlc,
+	u64             objid)
+{
+	struct mlcache_slot *slot;
+
+	if (!mlc)
+		return MLCACHE_VER_BUSY;
+
+	slot = mlcache_slot(mlc, objid);
+
+	if (__atomic_load_n(&slot->ms_wactive, __ATOMIC_SEQ_CST))
+		return MLCACHE_VER_BUSY;
+
+	return __atomic_load_n(&slot->ms_wver, __ATOMIC_SEQ_CST);
+}
+
+void
+mlcache_publish(
+	struct mlcache             *mlc,
+	u64                         objid,
+	u64                         gen,
+	u64                         wver,
+	const struct mlog_tail     *tail)
+{
+	struct mlcache_slot    *slot;
+	u64                     seq;
+
+	if (!mlc || wver == MLCACHE_VER_BUSY || !tail->mt_valid)
+		return;
+
+	slot = mlcache_slot(mlc, objid);
+
+	seq = __atomic_load_n(&slot->ms_seq, __ATOMIC_RELAXED);
+	if (seq & 1)
+		return;
+
+	/* Another publisher holds the slot, let it win */
+	if (!__atomic_compare_exchange_n(&slot->ms_seq, &seq, seq + 1, false,
+					 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return;
+
+	if (__atomic_load_n(&slot->ms_wactive, __ATOMIC_SEQ_CST) == 0 &&
+	    __atomic_load_n(&slot->ms_wver, __ATOMIC_SEQ_CST) == wver) {
+		slot->ms_objid   = objid;
+		slot->ms_gen     = gen;
+		slot->ms_pver    = wver;
+		slot->ms_wsoff   = tail->mt_wsoff;
+		slot->ms_pfsetid = tail->mt_pfsetid;
+		slot->ms_cfsetid = tail->mt_cfsetid;
+		slot->ms_cstart  = tail->mt_cstart;
+		slot->ms_cend    = tail->mt_cend;
+	}
+
+	__atomic_store_n(&slot->ms_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void
+mlcache_wstart(
+	struct mlcache *mlc,
+	u64             objid)
+{
+	if (mlc)
+		__atomic_add_fetch(&mlcache_slot(mlc, objid)->ms_wactive, 1,
+				   __ATOMIC_SEQ_CST);
+}
+
+void
+mlcache_wend(
+	struct mlcache *mlc,
+	u64             objid,
+	bool            wrote)
+{
+	struct mlcache_slot *slot;
+
+	if (!mlc)
+		return;
+
+	slot = mlcache_slot(mlc, objid);
+
+	if (wrote)
+		__atomic_add_fetch(&slot->ms_wver, 1, __ATOMIC_SEQ_CST);
+	__atomic_sub_fetch(&slot->ms_wactive, 1, __ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,587 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Sparse key index over ordered mlogs.
+ *
+ * For mlogs whose records are appended in non-decreasing key order, the
+ * index maps the key of one record every "stride" log blocks to the position
+ * of that record.  Seeking to a key binary searches the index and then reads
+ * forward at most one stride's worth of records.
+ *
+ * Records appended through the handle are indexed as they are appended.
+ * Records appended elsewhere (another process, an earlier session) are
+ * indexed lazily by the next seek, starting from the high water mark.
+ * The index is saved under the mpool rundir on close and periodically, so
+ * a later session only has to index the tail appended since.
+ */
+
+#include <util/platform.h>
+#include <util/alloc.h>
+#include <util/string.h>
+#include <util/minmax.h>
+#include <util/omf.h>
+
+#include <mpctl/impool.h>
+#include <mpctl/imlkidx.h>
+#include <mpcore/mlog.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define MLKIDX_MAGIC            ((u32)0x4d4c4b31)       /* "MLK1" */
+#define MLKIDX_VERSION          (1)
+#define MLKIDX_ENTS_MIN         (64)
+#define MLKIDX_PERSIST_ENTS     (1024)
+#define MLKIDX_BUFSZ_MIN        (4096)
+
+/**
+ * struct mlkidx_hdr_omf - persisted index header
+ * @pkh_magic:   MLKIDX_MAGIC
+ * @pkh_version: MLKIDX_VERSION
+ * @pkh_stride:  stride in log blocks
+ * @pkh_entc:    number of entries that follow
+ * @pkh_gen:     mlog generation
+ * @pkh_hwsoff:  high water mark, log block offset
+ * @pkh_hwroff:  high water mark, offset within the log block
+ */
+struct mlkidx_hdr_omf {
+	__le32  pkh_magic;
+	__le32  pkh_version;
+	__le32  pkh_stride;
+	__le32  pkh_entc;
+	__le64  pkh_gen;
+	__le64  pkh_hwsoff;
+	__le32  pkh_hwroff;
+	__le32  pkh_rsvd;
+} __packed;
+
+OMF_SETGET(struct mlkidx_hdr_omf, pkh_magic, 32)
+OMF_SETGET(struct mlkidx_hdr_omf, pkh_version, 32)
+OMF_SETGET(struct mlkidx_hdr_omf, pkh_stride, 32)
+OMF_SETGET(struct mlkidx_hdr_omf, pkh_entc, 32)
+OMF_SETGET(struct mlkidx_hdr_omf, pkh_gen, 64)
+OMF_SETGET(struct mlkidx_hdr_omf, pkh_hwsoff, 64)
+OMF_SETGET(struct mlkidx_hdr_omf, pkh_hwroff, 32)
+
+/**
+ * struct mlkidx_ent_omf - persisted index entry
+ * @pke_key:  record key
+ * @pke_soff: record position, log block offset
+ * @pke_roff: record position, offset within the log block
+ */
+struct mlkidx_ent_omf {
+	__le64  pke_key;
+	__le64  pke_soff;
+	__le32  pke_roff;
+	__le32  pke_rsvd;
+} __packed;
+
+OMF_SETGET(struct mlkidx_ent_omf, pke_key, 64)
+OMF_SETGET(struct mlkidx_ent_omf, pke_soff, 64)
+OMF_SETGET(struct mlkidx_ent_omf, pke_roff, 32)
+
+struct mlkidx_ent {
+	u64                 ke_key;
+	struct mlog_rdpos   ke_pos;
+};
+
+/**
+ * struct mlog_kidx - sparse key index
+ * @kx_keyfn:     key extractor
+ * @kx_arg:       key extractor argument
+ * @kx_stride:    minimum distance in log blocks between entries
+ * @kx_gen:       mlog generation the entries refer to
+ * @kx_entv:      entries in key (and log) order
+ * @kx_entc:      number of entries
+ * @kx_entmax:    size of @kx_entv
+ * @kx_hwm:       position through which the log has been indexed
+ * @kx_lastkey:   key of the last record indexed
+ * @kx_dirty:     entries added since the index was last saved
+ * @kx_unordered: a record was found out of key order
+ * @kx_buf:       record buffer for lazy indexing and seeks
+ * @kx_bufsz:     size of @kx_buf
+ */
+struct mlog_kidx {
+	mpool_mlog_keyfn_t     *kx_keyfn;
+	void                   *kx_arg;
+	u32                     kx_stride;
+	u64                     kx_gen;
+
+	struct mlkidx_ent      *kx_entv;
+	u32                     kx_entc;
+	u32                     kx_entmax;
+
+	struct mlog_rdpos       kx_hwm;
+	u64                     kx_lastkey;
+	u32                     kx_dirty;
+	bool                    kx_unordered;
+
+	char                   *kx_buf;
+	size_t                  kx_bufsz;
+};
+
+static inline bool
+mlkidx_pos_eq(const struct mlog_rdpos *a, const struct mlog_rdpos *b)
+{
+	return a->lrp_soff == b->lrp_soff && a->lrp_roff == b->lrp_roff;
+}
+
+static void
+mlkidx_path(
+	struct mpool       *ds,
+	struct mpool_mlog  *mlh,
+	char               *path,
+	size_t              pathsz)
+{
+	snprintf(path, pathsz, "%s/%s/mlog-0x%lx.kidx", MPOOL_RUNDIR_ROOT,
+		 ds->ds_mpname, (ulong)mlh->ml_objid);
+}
+
+/**
+ * mlkidx_add() - Note a record at @pos with key @key
+ */
+static merr_t
+mlkidx_add(struct mlog_kidx *kx, const struct mlog_rdpos *pos, u64 key)
+{
+	struct mlkidx_ent  *ent;
+	u32                 entmax;
+
+	if (kx->kx_entc > 0 && key < kx->kx_lastkey)
+		kx->kx_unordered = true;
+
+	kx->kx_lastkey = key;
+
+	if (kx->kx_unordered)
+		return 0;
+
+	if (kx->kx_entc > 0) {
+		ent = kx->kx_entv + kx->kx_entc - 1;
+		if (pos->lrp_soff < ent->ke_pos.lrp_soff + kx->kx_stride)
+			return 0;
+	}
+
+	if (kx->kx_entc >= kx->kx_entmax) {
+		entmax = max_t(u32, MLKIDX_ENTS_MIN, kx->kx_entmax * 2);
+
+		ent = realloc(kx->kx_entv, entmax * sizeof(*ent));
+		if (!ent)
+			return merr(ENOMEM);
+
+		kx->kx_entv = ent;
+		kx->kx_entmax = entmax;
+	}
+
+	ent = kx->kx_entv + kx->kx_entc++;
+	ent->ke_key = key;
+	ent->ke_pos = *pos;
+
+	kx->kx_dirty++;
+
+	return 0;
+}
+
+/**
+ * mlkidx_load() - Load a saved copy of the index, if usable
+ */
+static void
+mlkidx_load(struct mpool *ds, struct mpool_mlog *mlh, struct mlog_kidx *kx)
+{
+	struct mlkidx_hdr_omf   hdr;
+	struct mlkidx_ent_omf   eomf;
+	struct mlog_rdpos       end, hwm;
+	struct mlkidx_ent      *ent;
+
+	char    path[PATH_MAX];
+	FILE   *fp;
+	merr_t  err;
+	u32     entc, i;
+
+	mlkidx_path(ds, mlh, path, sizeof(path));
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    omf_pkh_magic(&hdr) != MLKIDX_MAGIC ||
+	    omf_pkh_version(&hdr) != MLKIDX_VERSION ||
+	    omf_pkh_stride(&hdr) != kx->kx_stride ||
+	    omf_pkh_gen(&hdr) != kx->kx_gen)
+		goto out;
+
+	hwm.lrp_soff = omf_pkh_hwsoff(&hdr);
+	hwm.lrp_roff = omf_pkh_hwroff(&hdr);
+
+	/* The log is append only, the saved state cannot be past its end */
+	err = mlog_append_pos(mlh->ml_mpdesc, mlh->ml_mldesc, &end);
+	if (err || hwm.lrp_soff > end.lrp_soff ||
+	    (hwm.lrp_soff == end.lrp_soff && hwm.lrp_roff > end.lrp_roff))
+		goto out;
+
+	entc = omf_pkh_entc(&hdr);
+
+	ent = malloc(max_t(u32, entc, MLKIDX_ENTS_MIN) * sizeof(*ent));
+	if (!ent)
+		goto out;
+
+	for (i = 0; i < entc; i++) {
+		if (fread(&eomf, sizeof(eomf), 1, fp) != 1) {
+			free(ent);
+			goto out;
+		}
+
+		ent[i].ke_key = omf_pke_key(&eomf);
+		ent[i].ke_pos.lrp_soff = omf_pke_soff(&eomf);
+		ent[i].ke_pos.lrp_roff = omf_pke_roff(&eomf);
+	}
+
+	kx->kx_entv = ent;
+	kx->kx_entc = entc;
+	kx->kx_entmax = max_t(u32, entc, MLKIDX_ENTS_MIN);
+	kx->kx_hwm = hwm;
+	kx->kx_lastkey = entc > 0 ? ent[entc - 1].ke_key : 0;
+
+out:
+	fclose(fp);
+}
+
+void
+mlkidx_persist(
+	struct mpool       *ds,
+	struct mpool_mlog  *mlh,
+	struct mlog_kidx   *kx)
+{
+	struct mlkidx_hdr_omf   hdr;
+	struct mlkidx_ent_omf   eomf;
+	struct mlkidx_ent      *ent;
+
+	char    path[PATH_MAX];
+	char    tmp[PATH_MAX + 8];
+	FILE   *fp;
+	u32     i;
+
+	mlkidx_path(ds, mlh, path, sizeof(path));
+
+	if (kx->kx_unordered) {
+		remove(path);
+		return;
+	}
+
+	if (kx->kx_dirty == 0)
+		return;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	fp = fopen(tmp, "w");
+	if (!fp)
+		return;
+
+	memset(&hdr, 0, sizeof(hdr));
+	omf_set_pkh_magic(&hdr, MLKIDX_MAGIC);
+	omf_set_pkh_version(&hdr, MLKIDX_VERSION);
+	omf_set_pkh_stride(&hdr, kx->kx_stride);
+	omf_set_pkh_entc(&hdr, kx->kx_entc);
+	omf_set_pkh_gen(&hdr, kx->kx_gen);
+	omf_set_pkh_hwsoff(&hdr, kx->kx_hwm.lrp_soff);
+	omf_set_pkh_hwroff(&hdr, kx->kx_hwm.lrp_roff);
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		goto errout;
+
+	for (i = 0; i < kx->kx_entc; i++) {
+		ent = kx->kx_entv + i;
+
+		memset(&eomf, 0, sizeof(eomf));
+		omf_set_pke_key(&eomf, ent->ke_key);
+		omf_set_pke_soff(&eomf, ent->ke_pos.lrp_soff);
+		omf_set_pke_roff(&eomf, ent->ke_pos.lrp_roff);
+
+		if (fwrite(&eomf, sizeof(eomf), 1, fp) != 1)
+			goto errout;
+	}
+
+	if (fclose(fp) || rename(tmp, path)) {
+		remove(tmp);
+		return;
+	}
+
+	kx->kx_dirty = 0;
+
+	return;
+
+errout:
+	fclose(fp);
+	remove(tmp);
+}
+
+merr_t
+mlkidx_create(
+	struct mpool           *ds,
+	struct mpool_mlog      *mlh,
+	mpool_mlog_keyfn_t     *keyfn,
+	void                   *arg,
+	u32                     stride,
+	struct mlog_kidx      **kxp)
+{
+	struct mlog_kidx   *kx;
+	merr_t              err;
+
+	kx = calloc(1, sizeof(*kx));
+	if (!kx)
+		return merr(ENOMEM);
+
+	err = mlog_gen(mlh->ml_mpdesc, mlh->ml_mldesc, &kx->kx_gen);
+	if (err) {
+		free(kx);
+		return err;
+	}
+
+	kx->kx_keyfn = keyfn;
+	kx->kx_arg = arg;
+	kx->kx_stride = stride > 0 ? stride : MLKIDX_STRIDE_DFLT;
+
+	mlkidx_load(ds, mlh, kx);
+
+	*kxp = kx;
+
+	return 0;
+}
+
+void
+mlkidx_destroy(struct mlog_kidx *kx)
+{
+	if (!kx)
+		return;
+
+	free(kx->kx_buf);
+	free(kx->kx_entv);
+	free(kx);
+}
+
+void
+mlkidx_reset(
+	struct mlog_kidx   *kx,
+	u64                 gen)
+{
+	kx->kx_gen = gen;
+	kx->kx_entc = 0;
+	kx->kx_lastkey = 0;
+	kx->kx_unordered = false;
+	kx->kx_dirty = 1;
+	memset(&kx->kx_hwm, 0, sizeof(kx->kx_hwm));
+}
+
+void
+mlkidx_append(
+	struct mpool               *ds,
+	struct mpool_mlog          *mlh,
+	struct mlog_kidx           *kx,
+	const struct mlog_rdpos    *pos,
+	const struct iovec         *iov,
+	size_t                      len)
+{
+	merr_t err;
+
+	/* Leave records past a gap in the index to the next seek */
+	if (!mlkidx_pos_eq(&kx->kx_hwm, pos))
+		return;
+
+	if (len > 0) {
+		err = mlkidx_add(kx, pos, kx->kx_keyfn(iov, len, kx->kx_arg));
+		if (err)
+			return;
+	}
+
+	err = mlog_append_pos(mlh->ml_mpdesc, mlh->ml_mldesc, &kx->kx_hwm);
+	if (err)
+		memset(&kx->kx_hwm, 0xff, sizeof(kx->kx_hwm));
+
+	if (kx->kx_dirty >= MLKIDX_PERSIST_ENTS)
+		mlkidx_persist(ds, mlh, kx);
+}
+
+/**
+ * mlkidx_read() - Read the record at the read cursor into kx_buf
+ * @pos:   position of the record (output)
+ * @rdlen: record length (output)
+ * @eof:   true if there are no more records (output)
+ *
+ * Zero length records are skipped.
+ */
+static merr_t
+mlkidx_read(
+	struct mpool_mlog          *mlh,
+	struct mlog_kidx           *kx,
+	const struct mlog_rdpos    *end,
+	struct mlog_rdpos          *pos,
+	u64                        *rdlen,
+	bool                       *eof)
+{
+	struct mlog_rdpos   npos;
+	merr_t              err;
+	size_t              bufsz;
+	char               *buf;
+
+	*eof = false;
+
+	while (true) {
+		err = mlog_read_pos(mlh->ml_mpdesc, mlh->ml_mldesc, pos);
+		if (err)
+			return err;
+
+		if (mlkidx_pos_eq(pos, end)) {
+			*eof = true;
+			return 0;
+		}
+
+		err = mlog_read_data_next(mlh->ml_mpdesc, mlh->ml_mldesc,
+					  kx->kx_buf, kx->kx_bufsz, rdlen);
+		if (merr_errno(err) == EOVERFLOW) {
+			bufsz = max_t(size_t, *rdlen, MLKIDX_BUFSZ_MIN);
+
+			buf = realloc(kx->kx_buf, bufsz);
+			if (!buf)
+				return merr(ENOMEM);
+
+			kx->kx_buf = buf;
+			kx->kx_bufsz = bufsz;
+			continue;
+		}
+
+		if (err || *rdlen > 0)
+			return err;
+
+		err = mlog_read_pos(mlh->ml_mpdesc, mlh->ml_mldesc, &npos);
+		if (err)
+			return err;
+
+		if (mlkidx_pos_eq(&npos, end) || mlkidx_pos_eq(&npos, pos)) {
+			*eof = true;
+			return 0;
+		}
+	}
+}
+
+static inline u64
+mlkidx_key(struct mlog_kidx *kx, u64 len)
+{
+	struct iovec iov = {
+		.iov_base = kx->kx_buf,
+		.iov_len  = len,
+	};
+
+	return kx->kx_keyfn(&iov, len, kx->kx_arg);
+}
+
+/**
+ * mlkidx_catchup() - Index records between the high water mark and the end
+ */
+static merr_t
+mlkidx_catchup(struct mpool_mlog *mlh, struct mlog_kidx *kx)
+{
+	struct mlog_rdpos   end, pos;
+	merr_t              err;
+	u64                 gen, rdlen;
+	bool                eof;
+
+	err = mlog_gen(mlh->ml_mpdesc, mlh->ml_mldesc, &gen);
+	if (err)
+		return err;
+
+	if (gen != kx->kx_gen)
+		mlkidx_reset(kx, gen);
+
+	err = mlog_append_pos(mlh->ml_mpdesc, mlh->ml_mldesc, &end);
+	if (err)
+		return err;
+
+	if (mlkidx_pos_eq(&kx->kx_hwm, &end))
+		return 0;
+
+	/* A failed incremental update; start over */
+	if (kx->kx_hwm.lrp_soff < 0)
+		mlkidx_reset(kx, gen);
+
+	err = mlog_read_seek(mlh->ml_mpdesc, mlh->ml_mldesc, &kx->kx_hwm);
+	if (err)
+		return err;
+
+	while (true) {
+		err = mlkidx_read(mlh, kx, &end, &pos, &rdlen, &eof);
+		if (err || eof)
+			break;
+
+		err = mlkidx_add(kx, &pos, mlkidx_key(kx, rdlen));
+		if (err)
+			break;
+	}
+
+	if (!err)
+		kx->kx_hwm = end;
+
+	return err;
+}
+
+merr_t
+mlkidx_seek(
+	struct mpool       *ds,
+	struct mpool_mlog  *mlh,
+	struct mlog_kidx   *kx,
+	u64                 key)
+{
+	struct mlog_rdpos   end, pos;
+	merr_t              err;
+	u64                 rdlen;
+	u32                 lo, hi, mid;
+	bool                eof;
+
+	err = mlkidx_catchup(mlh, kx);
+	if (err)
+		return err;
+
+	if (kx->kx_unordered)
+		return merr(EINVAL);
+
+	/* Find the first entry with a key >= @key */
+	lo = 0;
+	hi = kx->kx_entc;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (kx->kx_entv[mid].ke_key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* Records before that entry may still have keys >= @key */
+	memset(&pos, 0, sizeof(pos));
+	if (lo > 0)
+		pos = kx->kx_entv[lo - 1].ke_pos;
+
+	err = mlog_read_seek(mlh->ml_mpdesc, mlh->ml_mldesc, &pos);
+	if (err)
+		return err;
+
+	err = mlog_append_pos(mlh->ml_mpdesc, mlh->ml_mldesc, &end);
+	if (err)
+		return err;
+
+	while (true) {
+		err = mlkidx_read(mlh, kx, &end, &pos, &rdlen, &eof);
+		if (err || eof)
+			break;
+
+		if (mlkidx_key(kx, rdlen) >= key) {
+			err = mlog_read_seek(mlh->ml_mpdesc, mlh->ml_mldesc,
+					     &pos);
+			break;
+		}
+	}
+
+	if (kx->kx_dirty >= MLKIDX_PERSIST_ENTS)
+		mlkidx_persist(ds, mlh, kx);
+
+	return err;
+}
@@ -333,6 +333,11 @@ static void mlog_stat_free(struct ecio_layout_descriptor *layout)
 	mlog_free_rbuf(lstat, 0, MLOG_NLPGMB(lstat) - 1);
 	mlog_free_abuf(lstat, 0, MLOG_NLPGMB(lstat) - 1);
 
+	if (lstat->lst_ritr) {
+		free(lstat->lst_ritr->lrr_wbuf);
+		kfree(lstat->lst_ritr);
+	}
+
 	kfree(lstat);
 	layout->eld_lstat = NULL;
 }
@@ -1188,6 +1193,17 @@ mlog_open(
 	struct mlog_descriptor  *mlh,
 	u8                       flags,
 	u64                     *gen)
+{
+	return mlog_open_tail(mp, mlh, flags, NULL, gen);
+}
+
+merr_t
+mlog_open_tail(
+	struct mpool_descriptor *mp,
+	struct mlog_descriptor  *mlh,
+	u8                       flags,
+	struct mlog_tail        *tail,
+	u64                     *gen)
 {
 	struct mlog_stat              *lstat = NULL;
 	struct ecio_layout_descriptor *layout;
@@ -1266,7 +1282,26 @@ mlog_open(
 	lempty = true;
 	lstat = (struct mlog_stat *)layout->eld_lstat;
 
-	err = mlog_read_and_validate(mp, layout, &lempty);
+	if (tail && tail->mt_valid) {
+		/* Trust state validated by an earlier opener */
+		lstat->lst_wsoff   = tail->mt_wsoff;
+		lstat->lst_pfsetid = tail->mt_pfsetid;
+		lstat->lst_cfsetid = tail->mt_cfsetid;
+		lstat->lst_cstart  = tail->mt_cstart;
+		lstat->lst_cend    = tail->mt_cend;
+		lempty = (tail->mt_pfsetid == 0);
+	} else {
+		err = mlog_read_and_validate(mp, layout, &lempty);
+		if (!err && tail) {
+			tail->mt_wsoff   = lstat->lst_wsoff;
+			tail->mt_pfsetid = lstat->lst_pfsetid;
+			tail->mt_cfsetid = lstat->lst_cfsetid;
+			tail->mt_cstart  = lstat->lst_cstart;
+			tail->mt_cend    = lstat->lst_cend;
+			tail->mt_valid   = true;
+		}
+	}
+
 	if (err) {
 		mlog_stat_free(layout);
 		pmd_obj_wrunlock(mp, layout);
@@ -1959,6 +1994,39 @@ mlog_len(struct mpool_descriptor *mp, struct mlog_descriptor *mlh, u64 *len)
 	return err;
 }
 
+/**
+ * mlog_dmax()
+ *
+ * Returns the largest data record that can currently be appended to the
+ * log, or -1 if the log is full.  Log must be open.
+ */
+merr_t
+mlog_dmax(struct mpool_descriptor *mp, struct mlog_descriptor *mlh, s64 *dmax)
+{
+	struct ecio_layout_descriptor *layout;
+	merr_t                         err = 0;
+
+	layout = mlog2layout(mlh);
+
+	if (!layout)
+		return merr(EINVAL);
+
+	pmd_obj_rdlock(mp, layout);
+
+	if (layout->eld_lstat)
+		*dmax = mlog_append_dmax(mp, layout);
+	else
+		err = merr(ENOENT);
+
+	pmd_obj_rdunlock(mp, layout);
+
+	if (err)
+		mp_pr_err("mpool %s, determining mlog 0x%lx append room, inconsistency: no mlog status",
+			  err, mp->pds_name, (ulong)layout->eld_objid);
+
+	return err;
+}
+
 /**
  * mlog_update_append_idx()
  *
@@ -3145,6 +3213,594 @@ mlog_seek_read_data_next(
 	return mlog_read_data_next_impl(mp, mlh, false, buf, buflen, rdlen);
 }
 
+/**
+ * mlog_append_pos()
+ *
+ * Return the position at which the next data record will be appended; a
+ * valid argument to mlog_read_seek().  Log must be open.
+ */
+merr_t
+mlog_append_pos(
+	struct mpool_descriptor *mp,
+	struct mlog_descriptor  *mlh,
+	struct mlog_rdpos       *pos)
+{
+	struct ecio_layout_descriptor *layout;
+	struct mlog_stat              *lstat;
+	merr_t                         err = 0;
+
+	layout = mlog2layout(mlh);
+	if (!layout)
+		return merr(EINVAL);
+
+	pmd_obj_rdlock(mp, layout);
+
+	lstat = (struct mlog_stat *)layout->eld_lstat;
+	if (lstat) {
+		pos->lrp_soff = lstat->lst_wsoff;
+		pos->lrp_roff = lstat->lst_aoff;
+	} else {
+		err = merr(ENOENT);
+	}
+
+	pmd_obj_rdunlock(mp, layout);
+
+	return err;
+}
+
+/**
+ * mlog_tail_get()
+ *
+ * Return the state of the flushed part of the log, which a flush changes
+ * and buffered appends do not.  Log must be open.
+ */
+merr_t
+mlog_tail_get(
+	struct mpool_descriptor *mp,
+	struct mlog_descriptor  *mlh,
+	struct mlog_tail        *tail)
+{
+	struct ecio_layout_descriptor *layout;
+	struct mlog_stat              *lstat;
+	merr_t                         err = 0;
+
+	layout = mlog2layout(mlh);
+	if (!layout)
+		return merr(EINVAL);
+
+	pmd_obj_rdlock(mp, layout);
+
+	lstat = (struct mlog_stat *)layout->eld_lstat;
+	if (lstat) {
+		tail->mt_wsoff   = lstat->lst_wsoff;
+		tail->mt_pfsetid = lstat->lst_pfsetid;
+		tail->mt_cfsetid = lstat->lst_cfsetid;
+		tail->mt_cstart  = lstat->lst_cstart;
+		tail->mt_cend    = lstat->lst_cend;
+		tail->mt_valid   = true;
+	} else {
+		err = merr(ENOENT);
+	}
+
+	pmd_obj_rdunlock(mp, layout);
+
+	return err;
+}
+
+/**
+ * mlog_read_pos()
+ *
+ * Return the position of the read iterator, which always lies between
+ * records.  Log must be open.
+ */
+merr_t
+mlog_read_pos(
+	struct mpool_descriptor *mp,
+	struct mlog_descriptor  *mlh,
+	struct mlog_rdpos       *pos)
+{
+	struct ecio_layout_descriptor *layout;
+	struct mlog_stat              *lstat;
+	merr_t                         err = 0;
+
+	layout = mlog2layout(mlh);
+	if (!layout)
+		return merr(EINVAL);
+
+	pmd_obj_rdlock(mp, layout);
+
+	lstat = (struct mlog_stat *)layout->eld_lstat;
+	if (!lstat) {
+		err = merr(ENOENT);
+	} else if (!lstat->lst_citr.lri_valid) {
+		err = merr(EINVAL);
+	} else {
+		pos->lrp_soff = lstat->lst_citr.lri_soff;
+		pos->lrp_roff = lstat->lst_citr.lri_roff;
+	}
+
+	pmd_obj_rdunlock(mp, layout);
+
+	return err;
+}
+
+/**
+ * mlog_read_seek()
+ *
+ * Position the read iterator at a position previously returned by
+ * mlog_append_pos() or mlog_read_pos() for the current generation of the
+ * log.  Log must be open.
+ */
+merr_t
+mlog_read_seek(
+	struct mpool_descriptor    *mp,
+	struct mlog_descriptor     *mlh,
+	const struct mlog_rdpos    *pos)
+{
+	struct ecio_layout_descriptor *layout;
+	struct mlog_stat              *lstat;
+	struct mlog_read_iter         *lri;
+	merr_t                         err = 0;
+
+	layout = mlog2layout(mlh);
+	if (!layout)
+		return merr(EINVAL);
+
+	pmd_obj_wrlock(mp, layout);
+
+	lstat = (struct mlog_stat *)layout->eld_lstat;
+
+	if (!lstat) {
+		err = merr(ENOENT);
+	} else if (pos->lrp_soff < 0 || pos->lrp_soff > lstat->lst_wsoff ||
+		   pos->lrp_roff > MLOG_SECSZ(lstat) ||
+		   (pos->lrp_soff == lstat->lst_wsoff &&
+		    pos->lrp_roff > lstat->lst_aoff)) {
+		err = merr(EINVAL);
+	} else {
+		lri = &lstat->lst_citr;
+
+		/* Invalidates the read buffer, so the first read hits media */
+		mlog_read_iter_init(layout, lstat, lri);
+		lri->lri_soff = pos->lrp_soff;
+		lri->lri_roff = pos->lrp_roff;
+	}
+
+	pmd_obj_wrunlock(mp, layout);
+
+	return err;
+}
+
+/**
+ * mlog_rev_block() - Return a log block for the reverse iterator
+ *
+ * Log blocks in the append buffer are served from there; all others from
+ * a window read from media that ends at @soff, so that walking backward
+ * costs one IO per MiB of log.
+ *
+ * Caller must hold the write lock on the layout
+ *
+ * @mp:     mpool descriptor
+ * @layout: layout descriptor
+ * @rit:    reverse iterator
+ * @soff:   log block offset
+ * @lbuf:   log block (output)
+ * @lbhlen: log block header length (output)
+ */
+static merr_t
+mlog_rev_block(
+	struct mpool_descriptor        *mp,
+	struct ecio_layout_descriptor  *layout,
+	struct mlog_rev_iter           *rit,
+	off_t                           soff,
+	char                          **lbuf,
+	u16                            *lbhlen)
+{
+	struct mlog_stat   *lstat;
+	struct iovec        iov;
+
+	merr_t err;
+	off_t  wsoff;
+	off_t  weoff;
+	size_t iolen;
+	u16    sectsz;
+	u16    nsecmb;
+	u16    abidx;
+	u8     nseclpg;
+	u8     asidx;
+	int    len;
+	bool   skip_ser = false;
+
+	lstat = (struct mlog_stat *)layout->eld_lstat;
+	mlog_extract_fsetparms(lstat, &sectsz, NULL, &nsecmb, &nseclpg);
+
+	if (lstat->lst_asoff > -1 && soff >= lstat->lst_asoff) {
+		abidx = (soff - lstat->lst_asoff) / nseclpg;
+		asidx = soff - ((nseclpg * abidx) + lstat->lst_asoff);
+
+		if (!lstat->lst_abuf[abidx])
+			return merr(EBUG);
+
+		*lbuf   = &lstat->lst_abuf[abidx][asidx * sectsz];
+		*lbhlen = OMF_LOGBLOCK_HDR_PACKLEN;
+
+		return 0;
+	}
+
+	if (soff < rit->lrr_wsoff || soff >= rit->lrr_weoff) {
+		/* Page-aligned window of at most 1 MiB ending at soff */
+		weoff = soff + 1;
+		wsoff = max_t(off_t, 0, weoff - nsecmb);
+		wsoff = ((wsoff + nseclpg - 1) / nseclpg) * nseclpg;
+
+		iolen = (weoff - wsoff) * sectsz;
+		if (FORCE_4KA(lstat))
+			iolen = (iolen + MLOG_LPGSZ(lstat) - 1) & PAGE_MASK;
+
+		if (layout->eld_flags & MLOG_OF_SKIP_SER)
+			skip_ser = true;
+
+		rit->lrr_wsoff = rit->lrr_weoff = -1;
+
+		iov.iov_base = rit->lrr_wbuf;
+		iov.iov_len  = iolen;
+
+		err = mlog_rw(mp, layout2mlog(layout), &iov, 1, wsoff * sectsz,
+			      MPOOL_OP_READ, skip_ser);
+		if (err) {
+			mp_pr_err("mpool %s, mlog 0x%lx, reverse read failed, wsoff: 0x%lx, iolen: %zu",
+				  err, mp->pds_name, (ulong)layout->eld_objid,
+				  wsoff, iolen);
+			return err;
+		}
+
+		rit->lrr_wsoff = wsoff;
+		rit->lrr_weoff = weoff;
+	}
+
+	*lbuf = rit->lrr_wbuf + (soff - rit->lrr_wsoff) * sectsz;
+
+	len = omf_logblock_header_len_le(*lbuf);
+	if (len < 0) {
+		err = merr(ENODATA);
+		mp_pr_err("mpool %s, mlog 0x%lx, getting header length failed, soff: 0x%lx",
+			  err, mp->pds_name, (ulong)layout->eld_objid, soff);
+		return err;
+	}
+
+	*lbhlen = len;
+
+	return 0;
+}
+
+/**
+ * mlog_rev_parse() - Collect the data record segments of log block @soff
+ *
+ * Records can only be parsed front to back, so the segments of a log block
+ * are collected in log order and then handed out from the end.  The log
+ * block at the write offset is parsed only up to the append offset.
+ *
+ * Caller must hold the write lock on the layout
+ */
+static merr_t
+mlog_rev_parse(
+	struct mpool_descriptor        *mp,
+	struct ecio_layout_descriptor  *layout,
+	struct mlog_rev_iter           *rit,
+	off_t                           soff)
+{
+	struct omf_logrec_descriptor    lrd;
+	struct mlog_stat               *lstat;
+	struct mlog_rev_rec            *rec;
+
+	merr_t err;
+	char  *lbuf;
+	u32    roff;
+	u32    doff;
+	u32    lim;
+	u16    lbhlen;
+
+	lstat = (struct mlog_stat *)layout->eld_lstat;
+
+	rit->lrr_soff = soff;
+	rit->lrr_recc = 0;
+
+	lim = MLOG_SECSZ(lstat);
+	if (soff == lstat->lst_wsoff)
+		lim = lstat->lst_aoff;
+
+	/* Nothing appended to the accumulating log block */
+	if (lim <= OMF_LOGBLOCK_HDR_PACKLEN)
+		return 0;
+
+	err = mlog_rev_block(mp, layout, rit, soff, &lbuf, &lbhlen);
+	if (err)
+		return err;
+
+	roff = lbhlen;
+
+	while (roff + OMF_LOGREC_DESC_PACKLEN <= lim) {
+		omf_logrec_desc_unpack_letoh(&lrd, &lbuf[roff]);
+
+		if (lrd.olr_rtype == OMF_LOGREC_EOLB)
+			break;
+
+		doff = roff + OMF_LOGREC_DESC_PACKLEN;
+		if (doff + lrd.olr_rlen > lim) {
+			err = merr(ENODATA);
+			mp_pr_err("mpool %s, mlog 0x%lx, log record overruns log block, soff: 0x%lx, roff: %u",
+				  err, mp->pds_name, (ulong)layout->eld_objid,
+				  soff, roff);
+			return err;
+		}
+
+		if (logrec_type_datarec(lrd.olr_rtype)) {
+			rec = &rit->lrr_recv[rit->lrr_recc++];
+
+			rec->rr_tlen  = lrd.olr_tlen;
+			rec->rr_doff  = doff;
+			rec->rr_rlen  = lrd.olr_rlen;
+			rec->rr_rtype = lrd.olr_rtype;
+		}
+
+		roff = doff + lrd.olr_rlen;
+	}
+
+	return 0;
+}
+
+/**
+ * mlog_rev_peek() - Return the last data record segment not yet consumed
+ *
+ * Walks back to earlier log blocks as needed; returns NULL in @recp once
+ * the start of the log is reached.
+ */
+static merr_t
+mlog_rev_peek(
+	struct mpool_descriptor        *mp,
+	struct ecio_layout_descriptor  *layout,
+	struct mlog_rev_iter           *rit,
+	struct mlog_rev_rec           **recp)
+{
+	merr_t err;
+
+	*recp = NULL;
+
+	while (rit->lrr_recc == 0) {
+		if (rit->lrr_soff <= 0) {
+			rit->lrr_soff = -1;
+			return 0;
+		}
+
+		err = mlog_rev_parse(mp, layout, rit, rit->lrr_soff - 1);
+		if (err)
+			return err;
+	}
+
+	*recp = &rit->lrr_recv[rit->lrr_recc - 1];
+
+	return 0;
+}
+
+/**
+ * mlog_rev_copy() - Copy out the data record ending with segment @rec
+ *
+ * Segments are consumed from the last to the first and placed at their
+ * final offsets in @buf, which must hold at least @rec->rr_tlen bytes.
+ */
+static merr_t
+mlog_rev_copy(
+	struct mpool_descriptor        *mp,
+	struct ecio_layout_descriptor  *layout,
+	struct mlog_rev_iter           *rit,
+	struct mlog_rev_rec            *rec,
+	char                           *buf)
+{
+	merr_t err;
+	char  *lbuf;
+	u32    bufoff;
+	u16    lbhlen;
+	u8     rtype;
+
+	bufoff = rec->rr_tlen;
+
+	while (true) {
+		if (rec->rr_rlen > bufoff)
+			break;
+
+		err = mlog_rev_block(mp, layout, rit, rit->lrr_soff,
+				     &lbuf, &lbhlen);
+		if (err)
+			return err;
+
+		bufoff -= rec->rr_rlen;
+		memcpy(&buf[bufoff], &lbuf[rec->rr_doff], rec->rr_rlen);
+
+		rtype = rec->rr_rtype;
+		--rit->lrr_recc;
+
+		if (rtype == OMF_LOGREC_DATAFULL || rtype == OMF_LOGREC_DATAFIRST)
+			return bufoff ? merr(ENODATA) : 0;
+
+		err = mlog_rev_peek(mp, layout, rit, &rec);
+		if (err)
+			return err;
+
+		if (!rec || rec->rr_rtype == OMF_LOGREC_DATAFULL ||
+		    rec->rr_rtype == OMF_LOGREC_DATALAST)
+			break;
+	}
+
+	err = merr(ENODATA);
+	mp_pr_err("mpool %s, mlog 0x%lx, inconsistent data record, soff: 0x%lx",
+		  err, mp->pds_name, (ulong)layout->eld_objid, rit->lrr_soff);
+
+	return err;
+}
+
+/**
+ * mlog_read_data_init_tail()
+ *
+ * Initialize the reverse iterator at the current end of log; records
+ * appended afterwards are not returned by it.  The reverse iterator is
+ * independent of the forward iterator.  Log must be open.
+ */
+merr_t
+mlog_read_data_init_tail(
+	struct mpool_descriptor *mp,
+	struct mlog_descriptor  *mlh)
+{
+	struct ecio_layout_descriptor *layout;
+	struct mlog_stat              *lstat;
+	struct mlog_rev_iter          *rit;
+	merr_t                         err = 0;
+	size_t                         sz;
+
+	layout = mlog2layout(mlh);
+	if (!layout)
+		return merr(EINVAL);
+
+	pmd_obj_wrlock(mp, layout);
+
+	lstat = (struct mlog_stat *)layout->eld_lstat;
+	if (!lstat) {
+		err = merr(ENOENT);
+		goto out;
+	}
+
+	rit = lstat->lst_ritr;
+	if (!rit) {
+		/* Enough segments for a log block of back-to-back markers */
+		sz = sizeof(*rit) + (MLOG_SECSZ(lstat) /
+				     OMF_LOGREC_DESC_PACKLEN) * sizeof(*rit->lrr_recv);
+
+		rit = kzalloc(sz, GFP_KERNEL);
+		if (!rit) {
+			err = merr(ENOMEM);
+			goto out;
+		}
+
+		rit->lrr_wbuf = aligned_alloc(PAGE_SIZE, MLOG_NSECMB(lstat) *
+					      MLOG_SECSZ(lstat));
+		if (!rit->lrr_wbuf) {
+			kfree(rit);
+			err = merr(ENOMEM);
+			goto out;
+		}
+
+		rit->lrr_recv = (struct mlog_rev_rec *)(rit + 1);
+		lstat->lst_ritr = rit;
+	}
+
+	rit->lrr_gen   = layout->eld_gen;
+	rit->lrr_wsoff = -1;
+	rit->lrr_weoff = -1;
+	rit->lrr_valid = 1;
+
+	err = mlog_rev_parse(mp, layout, rit, lstat->lst_wsoff);
+	if (err) {
+		rit->lrr_valid = 0;
+		mp_pr_err("mpool %s, mlog 0x%lx, reverse iterator init failed",
+			  err, mp->pds_name, (ulong)layout->eld_objid);
+	}
+
+out:
+	pmd_obj_wrunlock(mp, layout);
+
+	return err;
+}
+
+/**
+ * mlog_read_data_prev()
+ *
+ * Read the data record preceding the reverse iterator into buffer buf of
+ * length buflen bytes; log must be open; skips non-data records (markers)
+ * and a partial data record left at the end of the log by a failed append.
+ *
+ * Iterator must be re-init if returns any error except EOVERFLOW.
+ *
+ * Returns:
+ *   0 on success; merr_t with the following errno values on failure:
+ *   EOVERFLOW if buflen is insufficient to hold data record; can retry
+ *   errno otherwise
+ *
+ *   Bytes read on success in the ouput param rdlen (0 at start of log, or
+ *   for a zero-length data record)
+ */
+merr_t
+mlog_read_data_prev(
+	struct mpool_descriptor *mp,
+	struct mlog_descriptor  *mlh,
+	char                    *buf,
+	u64                      buflen,
+	u64                     *rdlen)
+{
+	struct ecio_layout_descriptor *layout;
+	struct mlog_stat              *lstat;
+	struct mlog_rev_iter          *rit;
+	struct mlog_rev_rec           *rec;
+	merr_t                         err = 0;
+	bool                           skip_ser = false;
+
+	layout = mlog2layout(mlh);
+	if (!layout)
+		return merr(EINVAL);
+
+	if (layout->eld_flags & MLOG_OF_SKIP_SER)
+		skip_ser = true;
+
+	if (!skip_ser)
+		pmd_obj_wrlock(mp, layout);
+
+	lstat = (struct mlog_stat *)layout->eld_lstat;
+	rit = lstat ? lstat->lst_ritr : NULL;
+
+	if (!lstat) {
+		err = merr(ENOENT);
+		goto out;
+	}
+
+	if (!rit || !rit->lrr_valid || rit->lrr_gen != layout->eld_gen) {
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	*rdlen = 0;
+
+	while (true) {
+		err = mlog_rev_peek(mp, layout, rit, &rec);
+		if (err || !rec)
+			break;
+
+		if (rec->rr_rtype == OMF_LOGREC_DATAFIRST ||
+		    rec->rr_rtype == OMF_LOGREC_DATAMID) {
+			--rit->lrr_recc;
+			continue;
+		}
+
+		if (buflen < rec->rr_tlen) {
+			*rdlen = rec->rr_tlen;
+			err = merr(EOVERFLOW);
+			break;
+		}
+
+		*rdlen = rec->rr_tlen;
+
+		err = mlog_rev_copy(mp, layout, rit, rec, buf);
+		break;
+	}
+
+	/* Iterator only remains valid if buffer too small */
+	if (err && merr_errno(err) != EOVERFLOW)
+		rit->lrr_valid = 0;
+
+out:
+	if (!skip_ser)
+		pmd_obj_wrunlock(mp, layout);
+
+	return err;
+}
+
 /**
  * mlog_append_dmax()
  *
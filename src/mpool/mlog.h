@@ -186,11 +186,50 @@ struct mlog_read_iter {
 	u8    lri_valid;
 };
 
+/*
+ * struct mlog_rev_rec - data record segment found by the reverse iterator
+ *
+ * @rr_tlen:  Total length of the data record
+ * @rr_doff:  Offset of the segment data in its log block
+ * @rr_rlen:  Length of the segment data
+ * @rr_rtype: Segment type (DATAFULL, DATAFIRST, DATAMID or DATALAST)
+ */
+struct mlog_rev_rec {
+	u32   rr_tlen;
+	u16   rr_doff;
+	u16   rr_rlen;
+	u8    rr_rtype;
+};
+
+/*
+ * struct mlog_rev_iter - Reverse (tail first) mlog read iterator
+ *
+ * @lrr_gen:   Log generation number at iterator initialization
+ * @lrr_soff:  Log block whose data segments are in lrr_recv, -1 if none left
+ * @lrr_recv:  Data segments of log block lrr_soff, in log order
+ * @lrr_recc:  Number of segments in lrr_recv not yet returned
+ * @lrr_wbuf:  Window of log blocks read from media, 1 MiB
+ * @lrr_wsoff: LB offset of the first log block in lrr_wbuf, -1 if empty
+ * @lrr_weoff: LB offset one past the last log block in lrr_wbuf
+ * @lrr_valid: 1 if iterator is valid; 0 otherwise
+ */
+struct mlog_rev_iter {
+	u64                  lrr_gen;
+	off_t                lrr_soff;
+	struct mlog_rev_rec *lrr_recv;
+	u16                  lrr_recc;
+	char                *lrr_wbuf;
+	off_t                lrr_wsoff;
+	off_t                lrr_weoff;
+	u8                   lrr_valid;
+};
+
 /**
  * struct mlog_stat - mlog open status (referenced by associated
  * struct ecio_layout_descriptor)
  *
  * @lst_citr:    Current mlog read iterator
+ * @lst_ritr:    Reverse read iterator, allocated on first use
  * @lst_mfp:     Mlog flush set parameters
  * @lst_abuf:    Append buffer, max 1 MiB size
  * @lst_rbuf:    Read buffer, max 1 MiB size - immutable
@@ -210,6 +249,7 @@ struct mlog_read_iter {
  */
 struct mlog_stat {
 	struct mlog_read_iter  lst_citr;
+	struct mlog_rev_iter  *lst_ritr;
 	struct mlog_fsetparms  lst_mfp;
 	char  **lst_abuf;
 	char  **lst_rbuf;
@@ -0,0 +1,879 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Spare mlog pool design pattern module.
+ *
+ * Rotating a log needs a committed, empty mlog.  Allocating one, or erasing
+ * and reopening a retired one, costs several ioctls and media writes on the
+ * caller's critical path.  A spare pool keeps a number of such mlogs ready
+ * and hands them out without any media I/O beyond one small MDC record.
+ * A background thread erases retired mlogs and allocates new ones to keep
+ * the pool at its target size.
+ *
+ * Pool membership is recorded in a caller supplied MDC:
+ *
+ *   ADD(objid)  - mlog joined the pool (allocated or retired)
+ *   TAKE(objid) - mlog left the pool
+ *
+ * Members are not known to be empty after a restart, so all of them are
+ * checked (and erased if need be) by the background thread again.
+ *
+ * The ADD of an mlog allocated for the pool is made durable before the
+ * mlog is committed.  A crash in between leaves an uncommitted mlog, which
+ * is aborted with the other uncommitted objects of a dead process, and a
+ * member that the background thread forgets once it finds the mlog gone.
+ *
+ * Records are appended, and the MDC compacted, under sp_mdclock rather than
+ * sp_lock, so that the members can be looked at during MDC I/O.  Members
+ * join or leave with both locks held and in the order of their records.
+ *
+ * Like mdc.c, this module is layered on the public mpool API.
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <util/alloc.h>
+#include <util/minmax.h>
+#include <util/mutex.h>
+#include <util/omf.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+#include "logging.h"
+
+#define MLSPARE_CAPTGT_DFLT             (8 * 1024 * 1024)
+#define MLSPARE_TARGET_DFLT             (4)
+#define MLSPARE_ENTS_MIN                (8)
+#define MLSPARE_RETRY_MS                (1000)
+#define MLSPARE_MDC_COMPACT_MIN         (1024 * 1024)
+#define MLSPARE_MDC_COMPACT_RATIO       (4)
+
+/*
+ * MDC record types
+ */
+enum mlspare_rec_type {
+	MLSPARE_REC_ADD  = 1,
+	MLSPARE_REC_TAKE = 2,
+};
+
+/**
+ * struct mlspare_rec_omf - spare pool MDC record
+ * @psr_type:  enum mlspare_rec_type
+ * @psr_objid: mlog object ID
+ */
+struct mlspare_rec_omf {
+	u8      psr_type;
+	u8      psr_rsvd[7];
+	__le64  psr_objid;
+} __packed;
+
+OMF_SETGET(struct mlspare_rec_omf, psr_type, 8)
+OMF_SETGET(struct mlspare_rec_omf, psr_objid, 64)
+
+/*
+ * Pool member states
+ */
+enum mlspare_state {
+	MLSPARE_DIRTY = 1,      /* not known to be empty */
+	MLSPARE_BUSY  = 2,      /* being checked or erased by the worker */
+	MLSPARE_READY = 3,      /* committed, closed and empty */
+	MLSPARE_BAD   = 4,      /* erase failed, retried at the next open */
+};
+
+/**
+ * struct mlspare_ent - pool member
+ * @se_objid: mlog object ID
+ * @se_mlh:   mlog handle holding one reference, or NULL
+ * @se_state: enum mlspare_state
+ */
+struct mlspare_ent {
+	u64                 se_objid;
+	struct mpool_mlog  *se_mlh;
+	u8                  se_state;
+};
+
+/**
+ * struct mpool_mlspare - spare mlog pool handle
+ * @sp_mdclock: serializes MDC I/O and changes to the set of members
+ * @sp_lock:    protects everything below, the set of members may also be
+ *              read under @sp_mdclock
+ * @sp_cv:      wakes up the worker
+ * @sp_mp:      mpool handle
+ * @sp_mdc:     MDC recording the pool members
+ * @sp_params:  tunables
+ * @sp_entv:    pool members, unordered
+ * @sp_entc:    number of pool members
+ * @sp_entmax:  size of @sp_entv
+ * @sp_nready:  number of READY members
+ * @sp_ndirty:  number of DIRTY members
+ * @sp_nbad:    number of BAD members
+ * @sp_nmiss:   requests served by an inline allocation
+ * @sp_snapsz:  MDC usage right after the last snapshot, under @sp_mdclock
+ * @sp_thread:  worker thread
+ * @sp_running: worker thread exists
+ * @sp_closing: worker should exit
+ */
+struct mpool_mlspare {
+	struct mutex                    sp_mdclock;
+	struct mutex                    sp_lock;
+	pthread_cond_t                  sp_cv;
+	struct mpool                   *sp_mp;
+	struct mpool_mdc               *sp_mdc;
+	struct mpool_mlspare_params     sp_params;
+
+	struct mlspare_ent             *sp_entv;
+	u32                             sp_entc;
+	u32                             sp_entmax;
+	u32                             sp_nready;
+	u32                             sp_ndirty;
+	u32                             sp_nbad;
+	u64                             sp_nmiss;
+
+	size_t                          sp_snapsz;
+
+	pthread_t                       sp_thread;
+	bool                            sp_running;
+	bool                            sp_closing;
+};
+
+static merr_t
+mlspare_rec_append(
+	struct mpool_mlspare   *sp,
+	enum mlspare_rec_type   type,
+	u64                     objid,
+	bool                    sync)
+{
+	struct mlspare_rec_omf rec;
+
+	memset(&rec, 0, sizeof(rec));
+	omf_set_psr_type(&rec, type);
+	omf_set_psr_objid(&rec, objid);
+
+	return mpool_mdc_append(sp->sp_mdc, &rec, sizeof(rec), sync);
+}
+
+static struct mlspare_ent *
+mlspare_find(struct mpool_mlspare *sp, u64 objid)
+{
+	u32 i;
+
+	for (i = 0; i < sp->sp_entc; i++)
+		if (sp->sp_entv[i].se_objid == objid)
+			return sp->sp_entv + i;
+
+	return NULL;
+}
+
+static struct mlspare_ent *
+mlspare_find_state(struct mpool_mlspare *sp, enum mlspare_state state)
+{
+	u32 i;
+
+	for (i = 0; i < sp->sp_entc; i++)
+		if (sp->sp_entv[i].se_state == state)
+			return sp->sp_entv + i;
+
+	return NULL;
+}
+
+static void
+mlspare_count(struct mpool_mlspare *sp, u8 state, int delta)
+{
+	switch (state) {
+	case MLSPARE_READY:
+		sp->sp_nready += delta;
+		break;
+
+	case MLSPARE_DIRTY:
+		sp->sp_ndirty += delta;
+		break;
+
+	case MLSPARE_BAD:
+		sp->sp_nbad += delta;
+		break;
+
+	default:
+		break;
+	}
+}
+
+/**
+ * mlspare_ent_reserve() - Make room for one more member
+ *
+ * Done before the ADD record is appended, so that a member recorded in
+ * the MDC can always be added.
+ */
+static merr_t
+mlspare_ent_reserve(struct mpool_mlspare *sp)
+{
+	struct mlspare_ent *entv;
+	u32                 entmax;
+
+	if (sp->sp_entc < sp->sp_entmax)
+		return 0;
+
+	entmax = max_t(u32, MLSPARE_ENTS_MIN, sp->sp_entmax * 2);
+
+	entv = kcalloc(entmax, sizeof(*entv), GFP_KERNEL);
+	if (!entv)
+		return merr(ENOMEM);
+
+	if (sp->sp_entv)
+		memcpy(entv, sp->sp_entv, sp->sp_entc * sizeof(*entv));
+	kfree(sp->sp_entv);
+
+	sp->sp_entv = entv;
+	sp->sp_entmax = entmax;
+
+	return 0;
+}
+
+static struct mlspare_ent *
+mlspare_ent_add(
+	struct mpool_mlspare   *sp,
+	u64                     objid,
+	struct mpool_mlog      *mlh,
+	enum mlspare_state      state)
+{
+	struct mlspare_ent *ent;
+
+	if (mlspare_ent_reserve(sp))
+		return NULL;
+
+	ent = sp->sp_entv + sp->sp_entc++;
+	ent->se_objid = objid;
+	ent->se_mlh = mlh;
+	ent->se_state = state;
+
+	mlspare_count(sp, state, 1);
+
+	return ent;
+}
+
+static void
+mlspare_ent_del(struct mpool_mlspare *sp, struct mlspare_ent *ent)
+{
+	mlspare_count(sp, ent->se_state, -1);
+
+	*ent = sp->sp_entv[--sp->sp_entc];
+}
+
+static void
+mlspare_ent_set(
+	struct mpool_mlspare   *sp,
+	struct mlspare_ent     *ent,
+	enum mlspare_state      state)
+{
+	mlspare_count(sp, ent->se_state, -1);
+	ent->se_state = state;
+	mlspare_count(sp, state, 1);
+}
+
+/* Called under sp_mdclock, which keeps the set of members stable */
+static merr_t
+mlspare_mdc_snapshot(void *arg)
+{
+	struct mpool_mlspare   *sp = arg;
+	merr_t                  err;
+	u32                     i;
+
+	for (i = 0; i < sp->sp_entc; i++) {
+		err = mlspare_rec_append(sp, MLSPARE_REC_ADD,
+					 sp->sp_entv[i].se_objid, false);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/* Called under sp_mdclock */
+static merr_t
+mlspare_mdc_compact(struct mpool_mlspare *sp)
+{
+	size_t  usage, snapsz;
+	merr_t  err;
+
+	err = mpool_mdc_usage(sp->sp_mdc, &usage);
+	if (err)
+		return err;
+
+	snapsz = sp->sp_entc * sizeof(struct mlspare_rec_omf);
+
+	if (usage < MLSPARE_MDC_COMPACT_MIN ||
+	    usage < MLSPARE_MDC_COMPACT_RATIO * max(snapsz, sp->sp_snapsz))
+		return 0;
+
+	err = mpool_mdc_compact(sp->sp_mdc, mlspare_mdc_snapshot, sp);
+	if (err)
+		return err;
+
+	err = mpool_mdc_usage(sp->sp_mdc, &sp->sp_snapsz);
+	if (err)
+		sp->sp_snapsz = snapsz;
+
+	return 0;
+}
+
+/**
+ * mlspare_join() - Make an mlog a pool member
+ * @gen: if not NULL, refuse an mlog erased since this generation
+ *
+ * Called without sp_lock.  On success the pool owns the reference held
+ * by @mlh.  No member leaves the pool while sp_mdclock is held, so an mlog
+ * that is not a member but was erased since @gen was handed out again.
+ */
+static merr_t
+mlspare_join(
+	struct mpool_mlspare   *sp,
+	u64                     objid,
+	struct mpool_mlog      *mlh,
+	enum mlspare_state      state,
+	const u64              *gen)
+{
+	struct mlog_props   props;
+	merr_t              err;
+
+	mutex_lock(&sp->sp_mdclock);
+
+	mutex_lock(&sp->sp_lock);
+	err = mlspare_find(sp, objid) ? merr(EEXIST) : mlspare_ent_reserve(sp);
+	mutex_unlock(&sp->sp_lock);
+
+	if (!err && gen) {
+		err = mpool_mlog_getprops(sp->sp_mp, mlh, &props);
+		if (!err && props.lpr_gen != *gen)
+			err = merr(ESTALE);
+	}
+
+	if (!err)
+		err = mlspare_rec_append(sp, MLSPARE_REC_ADD, objid, true);
+
+	if (!err) {
+		mutex_lock(&sp->sp_lock);
+		mlspare_ent_add(sp, objid, mlh, state);
+		pthread_cond_signal(&sp->sp_cv);
+		mutex_unlock(&sp->sp_lock);
+
+		mlspare_mdc_compact(sp);
+	}
+
+	mutex_unlock(&sp->sp_mdclock);
+
+	return err;
+}
+
+/**
+ * mlspare_forget() - Drop a BUSY member whose mlog is gone
+ *
+ * Called without sp_lock.
+ */
+static void
+mlspare_forget(struct mpool_mlspare *sp, u64 objid)
+{
+	struct mlspare_ent *ent;
+	struct mpool_mlog  *mlh;
+
+	mutex_lock(&sp->sp_mdclock);
+
+	mutex_lock(&sp->sp_lock);
+	ent = mlspare_find(sp, objid);
+	mlh = ent->se_mlh;
+	mlspare_ent_del(sp, ent);
+	mutex_unlock(&sp->sp_lock);
+
+	mlspare_rec_append(sp, MLSPARE_REC_TAKE, objid, false);
+
+	mutex_unlock(&sp->sp_mdclock);
+
+	if (mlh)
+		mpool_mlog_put(sp->sp_mp, mlh);
+}
+
+/**
+ * mlspare_alloc() - Allocate and commit an mlog for a caller
+ */
+static merr_t
+mlspare_alloc(
+	struct mpool_mlspare   *sp,
+	struct mlog_props      *props,
+	struct mpool_mlog     **mlh)
+{
+	struct mlog_capacity    cap;
+	merr_t                  err;
+
+	memset(&cap, 0, sizeof(cap));
+	cap.lcp_captgt = sp->sp_params.msp_captgt;
+
+	err = mpool_mlog_alloc(sp->sp_mp, &cap, sp->sp_params.msp_mclassp,
+			       props, mlh);
+	if (err)
+		return err;
+
+	err = mpool_mlog_commit(sp->sp_mp, *mlh);
+	if (err) {
+		mpool_mlog_abort(sp->sp_mp, *mlh);
+		*mlh = NULL;
+	}
+
+	return err;
+}
+
+/**
+ * mlspare_grow() - Allocate an mlog and add it to the pool
+ *
+ * Called without sp_lock.  The ADD record is made durable before the mlog
+ * is committed, see the top of this file.
+ */
+static merr_t
+mlspare_grow(struct mpool_mlspare *sp)
+{
+	struct mlog_capacity    cap;
+	struct mlog_props       props;
+	struct mpool_mlog      *mlh;
+	merr_t                  err;
+
+	memset(&cap, 0, sizeof(cap));
+	cap.lcp_captgt = sp->sp_params.msp_captgt;
+
+	err = mpool_mlog_alloc(sp->sp_mp, &cap, sp->sp_params.msp_mclassp,
+			       &props, &mlh);
+	if (err)
+		return err;
+
+	mutex_lock(&sp->sp_mdclock);
+
+	mutex_lock(&sp->sp_lock);
+	err = mlspare_ent_reserve(sp);
+	mutex_unlock(&sp->sp_lock);
+
+	if (!err)
+		err = mlspare_rec_append(sp, MLSPARE_REC_ADD, props.lpr_objid,
+					 true);
+	if (!err) {
+		err = mpool_mlog_commit(sp->sp_mp, mlh);
+		if (err)
+			mlspare_rec_append(sp, MLSPARE_REC_TAKE,
+					   props.lpr_objid, false);
+	}
+
+	if (!err) {
+		mutex_lock(&sp->sp_lock);
+		mlspare_ent_add(sp, props.lpr_objid, mlh, MLSPARE_READY);
+		mutex_unlock(&sp->sp_lock);
+
+		mlspare_mdc_compact(sp);
+	}
+
+	mutex_unlock(&sp->sp_mdclock);
+
+	if (err)
+		mpool_mlog_abort(sp->sp_mp, mlh);
+
+	return err;
+}
+
+/**
+ * mlspare_clean() - Make sure a pool member is empty
+ *
+ * Like mpool_mdc_open(), an mlog that fails to open because of an
+ * interrupted erase or compaction is simply erased again.
+ */
+static merr_t
+mlspare_clean(
+	struct mpool_mlspare   *sp,
+	u64                     objid,
+	struct mpool_mlog     **mlh)
+{
+	struct mlog_props   props;
+	merr_t              err, err2;
+	bool                empty = false;
+	u64                 gen;
+
+	if (!*mlh) {
+		err = mpool_mlog_find_get(sp->sp_mp, objid, &props, mlh);
+		if (err)
+			return err;
+
+		/* Allocated by a process that died before committing it */
+		if (!props.lpr_iscommitted)
+			return merr(ENOENT);
+	}
+
+	err = mpool_mlog_open(sp->sp_mp, *mlh, 0, &gen);
+	if (err) {
+		if (merr_errno(err) != EMSGSIZE && merr_errno(err) != EBUSY)
+			return err;
+
+		return mpool_mlog_erase(sp->sp_mp, *mlh, 0);
+	}
+
+	err = mpool_mlog_empty(sp->sp_mp, *mlh, &empty);
+	if (!err && !empty)
+		err = mpool_mlog_erase(sp->sp_mp, *mlh, 0);
+
+	err2 = mpool_mlog_close(sp->sp_mp, *mlh);
+
+	return err ?: err2;
+}
+
+static void
+mlspare_wait(struct mpool_mlspare *sp, u32 ms)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	pthread_cond_timedwait(&sp->sp_cv, &sp->sp_lock.pth_mutex, &ts);
+}
+
+/**
+ * mlspare_worker() - Erase retired members and keep the pool filled
+ *
+ * Erases and allocations are done without holding sp_lock.  A BUSY member
+ * cannot leave the pool, but it may move within sp_entv meanwhile, so it
+ * is looked up again by object ID afterwards.
+ */
+static void *
+mlspare_worker(void *arg)
+{
+	struct mpool_mlspare   *sp = arg;
+	struct mlspare_ent     *ent;
+	struct mpool_mlog      *mlh;
+	merr_t                  err;
+	u64                     objid;
+
+	mutex_lock(&sp->sp_lock);
+	while (!sp->sp_closing) {
+		ent = mlspare_find_state(sp, MLSPARE_DIRTY);
+		if (ent) {
+			mlspare_ent_set(sp, ent, MLSPARE_BUSY);
+			objid = ent->se_objid;
+			mlh = ent->se_mlh;
+			mutex_unlock(&sp->sp_lock);
+
+			err = mlspare_clean(sp, objid, &mlh);
+
+			mutex_lock(&sp->sp_lock);
+			ent = mlspare_find(sp, objid);
+			ent->se_mlh = mlh;
+
+			if (!err) {
+				mlspare_ent_set(sp, ent, MLSPARE_READY);
+				continue;
+			}
+
+			if (merr_errno(err) == ENOENT) {
+				/* Deleted behind our back, forget it */
+				mutex_unlock(&sp->sp_lock);
+				mlspare_forget(sp, objid);
+				mutex_lock(&sp->sp_lock);
+				continue;
+			}
+
+			mp_pr_err("spare mlog 0x%lx erase failed",
+				  err, (ulong)objid);
+			mlspare_ent_set(sp, ent, MLSPARE_BAD);
+			continue;
+		}
+
+		if (sp->sp_entc - sp->sp_nbad < sp->sp_params.msp_target) {
+			mutex_unlock(&sp->sp_lock);
+
+			err = mlspare_grow(sp);
+
+			mutex_lock(&sp->sp_lock);
+			if (err) {
+				mp_pr_err("spare mlog alloc failed", err);
+				mlspare_wait(sp, MLSPARE_RETRY_MS);
+			}
+			continue;
+		}
+
+		pthread_cond_wait(&sp->sp_cv, &sp->sp_lock.pth_mutex);
+	}
+	mutex_unlock(&sp->sp_lock);
+
+	return NULL;
+}
+
+/**
+ * mlspare_replay() - Rebuild the member list from the MDC
+ */
+static merr_t
+mlspare_replay(struct mpool_mlspare *sp)
+{
+	struct mlspare_rec_omf  rec;
+	struct mlspare_ent     *ent;
+	size_t                  rdlen;
+	merr_t                  err;
+	u64                     objid;
+
+	err = mpool_mdc_rewind(sp->sp_mdc);
+	if (err)
+		return err;
+
+	while (true) {
+		err = mpool_mdc_read(sp->sp_mdc, &rec, sizeof(rec), &rdlen);
+		if (err)
+			return err;
+
+		if (rdlen == 0)
+			break;
+
+		if (rdlen != sizeof(rec))
+			return merr(EBADMSG);
+
+		objid = omf_psr_objid(&rec);
+		ent = mlspare_find(sp, objid);
+
+		switch (omf_psr_type(&rec)) {
+		case MLSPARE_REC_ADD:
+			if (!ent && !mlspare_ent_add(sp, objid, NULL,
+						     MLSPARE_DIRTY))
+				return merr(ENOMEM);
+			break;
+
+		case MLSPARE_REC_TAKE:
+			if (ent)
+				mlspare_ent_del(sp, ent);
+			break;
+
+		default:
+			return merr(EBADMSG);
+		}
+	}
+
+	return 0;
+}
+
+static void
+mlspare_free(struct mpool_mlspare *sp)
+{
+	u32 i;
+
+	for (i = 0; i < sp->sp_entc; i++)
+		if (sp->sp_entv[i].se_mlh)
+			mpool_mlog_put(sp->sp_mp, sp->sp_entv[i].se_mlh);
+
+	pthread_cond_destroy(&sp->sp_cv);
+	mutex_destroy(&sp->sp_lock);
+	mutex_destroy(&sp->sp_mdclock);
+	kfree(sp->sp_entv);
+	kfree(sp);
+}
+
+uint64_t
+mpool_mlspare_open(
+	struct mpool                       *mp,
+	uint64_t                            logid1,
+	uint64_t                            logid2,
+	const struct mpool_mlspare_params  *params,
+	struct mpool_mlspare              **spp)
+{
+	struct mpool_mlspare   *sp;
+	merr_t                  err;
+
+	if (!mp || !spp)
+		return merr(EINVAL);
+
+	*spp = NULL;
+
+	sp = kzalloc(sizeof(*sp), GFP_KERNEL);
+	if (!sp)
+		return merr(ENOMEM);
+
+	mutex_init(&sp->sp_mdclock);
+	mutex_init(&sp->sp_lock);
+	pthread_cond_init(&sp->sp_cv, NULL);
+
+	sp->sp_mp = mp;
+
+	if (params) {
+		sp->sp_params = *params;
+	} else {
+		sp->sp_params.msp_mclassp = MP_MED_CAPACITY;
+	}
+
+	if (sp->sp_params.msp_captgt == 0)
+		sp->sp_params.msp_captgt = MLSPARE_CAPTGT_DFLT;
+	if (sp->sp_params.msp_target == 0)
+		sp->sp_params.msp_target = MLSPARE_TARGET_DFLT;
+
+	err = mpool_mdc_open(mp, logid1, logid2, 0, &sp->sp_mdc);
+	if (err)
+		goto errout;
+
+	err = mlspare_replay(sp);
+	if (err) {
+		mp_pr_err("mlspare logid 0x%lx 0x%lx replay failed",
+			  err, (ulong)logid1, (ulong)logid2);
+		goto errout;
+	}
+
+	if (pthread_create(&sp->sp_thread, NULL, mlspare_worker, sp)) {
+		err = merr(EAGAIN);
+		goto errout;
+	}
+	sp->sp_running = true;
+
+	*spp = sp;
+
+	return 0;
+
+errout:
+	if (sp->sp_mdc)
+		mpool_mdc_close(sp->sp_mdc);
+	mlspare_free(sp);
+
+	return err;
+}
+
+uint64_t
+mpool_mlspare_close(struct mpool_mlspare *sp)
+{
+	merr_t err;
+
+	if (!sp)
+		return merr(EINVAL);
+
+	mutex_lock(&sp->sp_lock);
+	sp->sp_closing = true;
+	pthread_cond_signal(&sp->sp_cv);
+	mutex_unlock(&sp->sp_lock);
+
+	if (sp->sp_running)
+		pthread_join(sp->sp_thread, NULL);
+
+	err = mpool_mdc_close(sp->sp_mdc);
+
+	mlspare_free(sp);
+
+	return err;
+}
+
+uint64_t
+mpool_mlspare_get(
+	struct mpool_mlspare   *sp,
+	struct mlog_props      *props,
+	struct mpool_mlog     **mlh)
+{
+	struct mlspare_ent *ent;
+	merr_t              err;
+	u64                 objid;
+
+	if (!sp || !props || !mlh)
+		return merr(EINVAL);
+
+	*mlh = NULL;
+
+	/* Only gets take READY members, so ours stays READY meanwhile */
+	mutex_lock(&sp->sp_mdclock);
+
+	mutex_lock(&sp->sp_lock);
+	ent = mlspare_find_state(sp, MLSPARE_READY);
+	if (!ent) {
+		sp->sp_nmiss++;
+		pthread_cond_signal(&sp->sp_cv);
+		mutex_unlock(&sp->sp_lock);
+		mutex_unlock(&sp->sp_mdclock);
+
+		return mlspare_alloc(sp, props, mlh);
+	}
+	objid = ent->se_objid;
+	mutex_unlock(&sp->sp_lock);
+
+	/* The TAKE must be durable before the caller can record the mlog */
+	err = mlspare_rec_append(sp, MLSPARE_REC_TAKE, objid, true);
+	if (!err) {
+		mutex_lock(&sp->sp_lock);
+		ent = mlspare_find(sp, objid);
+		*mlh = ent->se_mlh;
+		mlspare_ent_del(sp, ent);
+		pthread_cond_signal(&sp->sp_cv);
+		mutex_unlock(&sp->sp_lock);
+
+		mlspare_mdc_compact(sp);
+	}
+
+	mutex_unlock(&sp->sp_mdclock);
+
+	if (err)
+		return err;
+
+	err = mpool_mlog_getprops(sp->sp_mp, *mlh, props);
+	if (err)
+		mp_pr_err("spare mlog 0x%lx getprops failed",
+			  err, (ulong)objid);
+
+	return err;
+}
+
+uint64_t
+mpool_mlspare_retire(
+	struct mpool_mlspare   *sp,
+	struct mpool_mlog      *mlh)
+{
+	struct mlog_props   props;
+	merr_t              err;
+
+	if (!sp || !mlh)
+		return merr(EINVAL);
+
+	err = mpool_mlog_getprops(sp->sp_mp, mlh, &props);
+	if (err)
+		return err;
+
+	return mlspare_join(sp, props.lpr_objid, mlh, MLSPARE_DIRTY, NULL);
+}
+
+uint64_t
+mpool_mlspare_reclaim(
+	struct mpool_mlspare   *sp,
+	struct mpool_mlog      *mlh,
+	uint64_t                gen)
+{
+	struct mlog_props   props;
+	merr_t              err;
+
+	if (!sp || !mlh)
+		return merr(EINVAL);
+
+	err = mpool_mlog_getprops(sp->sp_mp, mlh, &props);
+	if (err)
+		return err;
+
+	return mlspare_join(sp, props.lpr_objid, mlh, MLSPARE_DIRTY, &gen);
+}
+
+uint64_t
+mpool_mlspare_getprops(
+	struct mpool_mlspare           *sp,
+	struct mpool_mlspare_props     *props)
+{
+	if (!sp || !props)
+		return merr(EINVAL);
+
+	memset(props, 0, sizeof(*props));
+
+	mutex_lock(&sp->sp_lock);
+	props->msp_nready = sp->sp_nready;
+	props->msp_ndirty = sp->sp_ndirty + (sp->sp_entc - sp->sp_nready -
+					     sp->sp_ndirty - sp->sp_nbad);
+	props->msp_nbad = sp->sp_nbad;
+	props->msp_nmiss = sp->sp_nmiss;
+	mutex_unlock(&sp->sp_lock);
+
+	return 0;
+}
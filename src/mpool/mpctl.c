@@ -13,11 +13,16 @@
 #include <util/valgrind.h>
 #include <util/printbuf.h>
 #include <util/page.h>
+#include <util/mutex.h>
 
 #include <mpctl/impool.h>
 #include <mpctl/imlog.h>
 #include <mpctl/imblock.h>
 #include <mpctl/imdc.h>
+#include <mpctl/imlcache.h>
+#include <mpctl/imlkidx.h>
+#include <mpctl/imcra.h>
+#include <mpctl/iintent.h>
 
 #include "discover.h"
 
@@ -51,6 +56,8 @@ struct mpool_mcache_map {
 	int     mh_dsfd;
 	off_t   mh_offset;
 	size_t  mh_len;
+
+	struct mcache_ra *mh_ra; /* adaptive readahead, NULL if disabled */
 };
 
 struct devrpt_tab {
@@ -1147,6 +1154,18 @@ mpool_devprops_get(
 	return err;
 }
 
+uint64_t
+mpool_devtune_get(
+	const char             *devname,
+	struct mpool_devtune   *applied,
+	struct mpool_devtune   *saved)
+{
+	if (!devname)
+		return merr(EINVAL);
+
+	return sysfs_pd_tune_get(devname, applied, saved);
+}
+
 uint64_t
 mpool_activate(
 	const char             *mpname,
@@ -1158,6 +1177,8 @@ mpool_activate(
 	struct imp_entry   *entry;
 
 	char   **dpaths;
+	bool    *tuned;
+	bool     profile;
 	int      fd, i;
 	merr_t   err;
 	int      entry_cnt;
@@ -1189,12 +1210,27 @@ mpool_activate(
 		return err;
 	}
 
-	/* Turn off write throttling on the PDs */
-	for (i = 0; i < entry_cnt; i++) {
-		err = sysfs_pd_disable_wbt(entry[i].mp_path);
-		if (err)
-			goto errout;
+	/*
+	 * Turn off write throttling on the PDs, and apply the rest of their
+	 * block queue tuning profiles only if asked to.  Tuning is best
+	 * effort: a PD that cannot be tuned is activated with its current
+	 * queue settings.
+	 */
+	profile = flags & (1u << MP_FLAGS_DEVTUNE);
+	flags &= ~(1u << MP_FLAGS_DEVTUNE);
+
+	tuned = calloc(entry_cnt, sizeof(*tuned));
+	for (i = 0; tuned && i < entry_cnt; i++) {
+		err = sysfs_pd_tune(entry[i].mp_path, profile);
+		if (err) {
+			mpool_elog(MPOOL_WARNING
+				   "mpool %s activate, unable to tune device %s @@e",
+				   err, mpname, entry[i].mp_path);
+			continue;
+		}
+		tuned[i] = true;
 	}
+	err = 0;
 
 	/*
 	 * If that fail for a device, this device is removed from the devices
@@ -1241,6 +1277,12 @@ mpool_activate(
 		mpool_rundir_create(entry->mp_name);
 
 errout:
+	/* Activation failed, restore the queue settings */
+	for (i = 0; err && tuned && i < entry_cnt; i++)
+		if (tuned[i])
+			sysfs_pd_untune(entry[i].mp_path);
+
+	free(tuned);
 	if (mp.mp_pd_prop)
 		free(mp.mp_pd_prop);
 	free(entry);
@@ -1258,7 +1300,7 @@ mpool_deactivate(
 {
 	struct mpioc_mpool  mp;
 	struct imp_entry   *entry;
-	int                 fd;
+	int                 fd, i;
 	merr_t              err;
 	int                 entry_cnt;
 	char              **dpaths;
@@ -1301,7 +1343,13 @@ mpool_deactivate(
 			mpool_devrpt(ei, MPCTL_RC_NOTACTIVATED, -1, NULL);
 	}
 
+	/* Restore the queue settings the PDs had before activation */
+	for (i = 0; !err && i < entry_cnt; i++)
+		sysfs_pd_untune(entry[i].mp_path);
+
 	close(fd);
+	free(entry);
+	free(dpaths);
 
 	return err;
 }
@@ -1497,17 +1545,152 @@ mpool_open(
 
 	ds->ds_magic = MPC_DS_MAGIC;
 	mutex_init(&ds->ds_lock);
+	pthread_cond_init(&ds->ds_iobuf_cv, NULL);
 	ds->ds_flags = flags;
 	strlcpy(ds->ds_mpname, mp_name, sizeof(ds->ds_mpname));
 
 	ds->ds_maxmem_asyncio[DS_DEFAULT_THQ] = MAX_MEM_DEFAULT_ASYNCIO_DS;
 	ds->ds_maxmem_asyncio[DS_INGEST_THQ]  = MAX_MEM_INGEST_ASYNCIO_DS;
 
+	ds->ds_mlcache = mlcache_open(mp_name);
+
+	/*
+	 * Journal our uncommitted objects, and reclaim in the background what
+	 * crashed writers left uncommitted.
+	 */
+	if (flags & (O_RDWR | O_WRONLY)) {
+		ds->ds_intent = intent_jnl_open(ds);
+		ds->ds_reclaim = intent_reclaim_start(ds);
+	}
+
 	*dsp = ds;
 
 	return 0;
 }
 
+/**
+ * mb_send_map_get() - Get an mcache map of mblock @mbh for a send
+ *
+ * Maps are kept in ds_sendmap for later sends of the same mblock, so that
+ * a send rarely pays for creating a map (and its read-ahead controller).
+ * The least recently used idle map is replaced when all slots are taken;
+ * if none is idle, the new map is not kept.
+ */
+static merr_t
+mb_send_map_get(
+	struct mpool               *ds,
+	u64                         mbh,
+	struct mpool_mcache_map   **mapp)
+{
+	struct mpool_mcache_map    *map, *old = NULL;
+	struct mp_sendmap          *sm, *victim = NULL;
+	merr_t                      err;
+	int                         i;
+
+	mutex_lock(&ds->ds_lock);
+	ds->ds_sendclk++;
+	for (i = 0; i < MAX_SEND_MAPS; i++) {
+		sm = ds->ds_sendmap + i;
+		if (sm->sm_map && sm->sm_mbh == mbh) {
+			sm->sm_refcnt++;
+			sm->sm_used = ds->ds_sendclk;
+			*mapp = sm->sm_map;
+			mutex_unlock(&ds->ds_lock);
+			return 0;
+		}
+	}
+	mutex_unlock(&ds->ds_lock);
+
+	err = mpool_mcache_mmap(ds, 1, &mbh, MPC_VMA_COLD, &map);
+	if (err)
+		return err;
+
+	mutex_lock(&ds->ds_lock);
+	for (i = 0; i < MAX_SEND_MAPS; i++) {
+		sm = ds->ds_sendmap + i;
+		if (!sm->sm_map) {
+			victim = sm;
+			break;
+		}
+
+		if (sm->sm_refcnt == 0 &&
+		    (!victim || sm->sm_used < victim->sm_used))
+			victim = sm;
+	}
+
+	if (victim) {
+		old = victim->sm_map;
+		victim->sm_mbh = mbh;
+		victim->sm_map = map;
+		victim->sm_refcnt = 1;
+		victim->sm_used = ds->ds_sendclk;
+	}
+	mutex_unlock(&ds->ds_lock);
+
+	mpool_mcache_munmap(old);
+
+	*mapp = map;
+
+	return 0;
+}
+
+static void
+mb_send_map_put(
+	struct mpool               *ds,
+	struct mpool_mcache_map    *map)
+{
+	struct mp_sendmap  *sm;
+	int                 i;
+
+	mutex_lock(&ds->ds_lock);
+	for (i = 0; i < MAX_SEND_MAPS; i++) {
+		sm = ds->ds_sendmap + i;
+		if (sm->sm_map != map)
+			continue;
+
+		/* Kept unless its mblock was deleted meanwhile */
+		if (--sm->sm_refcnt > 0 || sm->sm_mbh)
+			map = NULL;
+		else
+			sm->sm_map = NULL;
+		break;
+	}
+	mutex_unlock(&ds->ds_lock);
+
+	mpool_mcache_munmap(map);
+}
+
+/**
+ * mb_send_map_drop() - Stop keeping maps of mblock @mbh, or of all mblocks
+ * if @mbh is 0
+ *
+ * A map still in use by a send is unmapped by its last mb_send_map_put().
+ */
+static void
+mb_send_map_drop(struct mpool *ds, u64 mbh)
+{
+	struct mpool_mcache_map    *mapv[MAX_SEND_MAPS];
+	struct mp_sendmap          *sm;
+	int                         i, mapc = 0;
+
+	mutex_lock(&ds->ds_lock);
+	for (i = 0; i < MAX_SEND_MAPS; i++) {
+		sm = ds->ds_sendmap + i;
+		if (!sm->sm_map || (mbh && sm->sm_mbh != mbh))
+			continue;
+
+		sm->sm_mbh = 0;
+		if (sm->sm_refcnt == 0) {
+			mapv[mapc++] = sm->sm_map;
+			sm->sm_map = NULL;
+		}
+	}
+	mutex_unlock(&ds->ds_lock);
+
+	for (i = 0; i < mapc; i++)
+		mpool_mcache_munmap(mapv[i]);
+}
+
 uint64_t
 mpool_close(struct mpool *ds)
 {
@@ -1530,10 +1713,22 @@ mpool_close(struct mpool *ds)
 
 	ds->ds_magic = MPC_NO_MAGIC;
 
+	intent_reclaim_stop(ds->ds_reclaim);
+	ds->ds_reclaim = NULL;
+
+	mlcache_close(ds->ds_mlcache);
+	ds->ds_mlcache = NULL;
+
+	intent_jnl_close(ds->ds_intent);
+	ds->ds_intent = NULL;
+
+	mb_send_map_drop(ds, 0);
+
 	close(ds->ds_fd);
 	ds->ds_fd = -1;
 
 	ds_release(ds);
+	pthread_cond_destroy(&ds->ds_iobuf_cv);
 	free(ds);
 
 	return 0;
@@ -1835,6 +2030,8 @@ mlog_free_handle(
 	if (!mlh)
 		return;
 
+	mlkidx_destroy(mlh->ml_kidx);
+
 	mlog_user_desc_free(mlh->ml_mldesc);
 
 	mpool_user_desc_free(mlh->ml_mpdesc);
@@ -1891,6 +2088,62 @@ mlog_release(
 	mutex_unlock(&mlh->ml_lock);
 }
 
+/**
+ * mlog_wstart() - Invalidate shared tail state ahead of a possible write
+ *
+ * @ds:   dataset handle
+ * @mlh:  mlog handle
+ * @tail: flushed tail before the write (output), NULL if the write
+ *        always changes media
+ */
+static inline
+void
+mlog_wstart(
+	struct mpool       *ds,
+	struct mpool_mlog  *mlh,
+	struct mlog_tail   *tail)
+{
+	mlcache_wstart(ds->ds_mlcache, mlh->ml_objid);
+
+	if (!tail)
+		return;
+
+	memset(tail, 0, sizeof(*tail));
+	if (ds->ds_mlcache)
+		mlog_tail_get(mlh->ml_mpdesc, mlh->ml_mldesc, tail);
+}
+
+/**
+ * mlog_wend() - Pair of mlog_wstart()
+ *
+ * @ds:   dataset handle
+ * @mlh:  mlog handle
+ * @tail: tail sampled by mlog_wstart(), or NULL
+ *
+ * Shared tail state is invalidated only if the flushed tail moved, so
+ * appends that stay buffered leave it alone.
+ */
+static inline
+void
+mlog_wend(
+	struct mpool       *ds,
+	struct mpool_mlog  *mlh,
+	struct mlog_tail   *tail)
+{
+	struct mlog_tail    now;
+	bool                wrote = true;
+
+	if (tail && tail->mt_valid &&
+	    !mlog_tail_get(mlh->ml_mpdesc, mlh->ml_mldesc, &now))
+		wrote = now.mt_wsoff != tail->mt_wsoff ||
+			now.mt_pfsetid != tail->mt_pfsetid ||
+			now.mt_cfsetid != tail->mt_cfsetid ||
+			now.mt_cstart != tail->mt_cstart ||
+			now.mt_cend != tail->mt_cend;
+
+	mlcache_wend(ds->ds_mlcache, mlh->ml_objid, wrote);
+}
+
 /**
  * mlog_invalidate() - Invalidates mlog handle by resetting the magic
  *
@@ -1975,6 +2228,8 @@ mpool_mlog_alloc(
 		return err;
 	}
 
+	intent_jnl_add(ds->ds_intent, objid, INTENT_MLOG);
+
 	if (props)
 		*props = ml.ml_props.lpx_props;
 
@@ -2017,6 +2272,8 @@ mpool_mlog_realloc(
 		return err;
 	}
 
+	intent_jnl_add(ds->ds_intent, objid, INTENT_MLOG);
+
 	if (props)
 		*props = ml.ml_props.lpx_props;
 
@@ -2046,9 +2303,11 @@ mpool_mlog_commit(
 		return err;
 
 	err = mpool_ioctl(ds->ds_fd, MPIOC_MLOG_COMMIT, &mi);
-	if (!err)
+	if (!err) {
+		intent_jnl_del(ds->ds_intent, mi.mi_objid);
 		err = mlog_user_desc_set(mlh->ml_mpdesc, mlh->ml_mldesc,
 					 mi.mi_gen, mi.mi_state);
+	}
 
 	mlog_release(mlh, rw);
 
@@ -2097,6 +2356,8 @@ mpool_mlog_abort(
 		return err;
 	}
 
+	intent_jnl_del(ds->ds_intent, mi.mi_objid);
+
 	mlog_hmap_put_locked(ds, mlh, &do_free);
 	assert(do_free == true);
 
@@ -2152,6 +2413,8 @@ mpool_mlog_delete(
 		return err;
 	}
 
+	intent_jnl_del(ds->ds_intent, mi.mi_objid);
+
 	mlog_hmap_put_locked(ds, mlh, &do_free);
 	assert(do_free == true);
 
@@ -2174,9 +2437,12 @@ mpool_mlog_open(
 {
 	struct mpioc_mlog       ml;
 	struct mlog_props_ex   *px;
+	struct mlog_tail        tail;
 
 	merr_t  err;
 	bool    rw = false;
+	u64     wver = MLCACHE_VER_BUSY;
+	u8      rdonly;
 
 	if (!ds || !mlh || !gen)
 		return merr(EINVAL);
@@ -2198,13 +2464,26 @@ mpool_mlog_open(
 	if (err)
 		goto errout;
 
+	rdonly = flags & MLOG_OF_RDONLY;
 	flags &= MLOG_OF_SKIP_SER | MLOG_OF_COMPACT_SEM;
 
-	err = mlog_open(mlh->ml_mpdesc, mlh->ml_mldesc, flags, gen);
+	/*
+	 * Read-only openers may trust tail state validated by another
+	 * process; anyone who validates offers the result to the others.
+	 */
+	memset(&tail, 0, sizeof(tail));
+	if (!rdonly || !mlcache_lookup(ds->ds_mlcache, mlh->ml_objid,
+				       px->lpx_props.lpr_gen, &tail))
+		wver = mlcache_wver(ds->ds_mlcache, mlh->ml_objid);
+
+	err = mlog_open_tail(mlh->ml_mpdesc, mlh->ml_mldesc, flags, &tail,
+			     gen);
 	if (err)
 		goto errout;
 
-	mlh->ml_flags = flags;
+	mlcache_publish(ds->ds_mlcache, mlh->ml_objid, *gen, wver, &tail);
+
+	mlh->ml_flags = flags | rdonly;
 
 errout:
 	mlog_release(mlh, rw);
@@ -2227,7 +2506,12 @@ mpool_mlog_close(
 	if (err)
 		return err;
 
+	if (mlh->ml_kidx)
+		mlkidx_persist(ds, mlh, mlh->ml_kidx);
+
+	mlog_wstart(ds, mlh, NULL);
 	err = mlog_close(mlh->ml_mpdesc, mlh->ml_mldesc);
+	mlog_wend(ds, mlh, NULL);
 	if (err)
 		goto exit;
 
@@ -2369,8 +2653,10 @@ mpool_mlog_append_data(
 	size_t              len,
 	int                 sync)
 {
-	merr_t err;
-	bool   rw = true;
+	struct mlog_rdpos   pos;
+	struct mlog_tail    tail;
+	merr_t              err;
+	bool                rw = true;
 
 	if (!ds || !mlh || !data)
 		return merr(EINVAL);
@@ -2382,11 +2668,33 @@ mpool_mlog_append_data(
 	if (err)
 		return err;
 
+	if (mlh->ml_flags & MLOG_OF_RDONLY) {
+		err = merr(EPERM);
+		goto exit;
+	}
+
+	if (mlh->ml_kidx) {
+		err = mlog_append_pos(mlh->ml_mpdesc, mlh->ml_mldesc, &pos);
+		if (err)
+			goto exit;
+	}
+
+	mlog_wstart(ds, mlh, &tail);
 	err = mlog_append_data(mlh->ml_mpdesc, mlh->ml_mldesc, data,
 			       len, sync);
+	mlog_wend(ds, mlh, &tail);
 	if (err)
 		goto exit;
 
+	if (mlh->ml_kidx) {
+		struct iovec iov = {
+			.iov_base = data,
+			.iov_len  = len,
+		};
+
+		mlkidx_append(ds, mlh, mlh->ml_kidx, &pos, &iov, len);
+	}
+
 exit:
 	mlog_release(mlh, rw);
 
@@ -2401,8 +2709,10 @@ mpool_mlog_append_datav(
 	size_t              len,
 	int                 sync)
 {
-	merr_t err;
-	bool   rw = true;
+	struct mlog_rdpos   pos;
+	struct mlog_tail    tail;
+	merr_t              err;
+	bool                rw = true;
 
 	if (!ds || !mlh || !iov)
 		return merr(EINVAL);
@@ -2414,11 +2724,27 @@ mpool_mlog_append_datav(
 	if (err)
 		return err;
 
+	if (mlh->ml_flags & MLOG_OF_RDONLY) {
+		err = merr(EPERM);
+		goto exit;
+	}
+
+	if (mlh->ml_kidx) {
+		err = mlog_append_pos(mlh->ml_mpdesc, mlh->ml_mldesc, &pos);
+		if (err)
+			goto exit;
+	}
+
+	mlog_wstart(ds, mlh, &tail);
 	err = mlog_append_datav(mlh->ml_mpdesc, mlh->ml_mldesc, iov,
 				len, sync);
+	mlog_wend(ds, mlh, &tail);
 	if (err)
 		goto exit;
 
+	if (mlh->ml_kidx)
+		mlkidx_append(ds, mlh, mlh->ml_kidx, &pos, iov, len);
+
 exit:
 	mlog_release(mlh, rw);
 
@@ -2510,13 +2836,62 @@ exit:
 }
 
 uint64_t
-mpool_mlog_flush(
+mpool_mlog_read_data_init_tail(
 	struct mpool       *ds,
 	struct mpool_mlog  *mlh)
 {
 	merr_t err;
 	bool   rw = false;
 
+	if (!ds || !mlh)
+		return merr(EINVAL);
+
+	err = mlog_acquire(mlh, rw);
+	if (err)
+		return err;
+
+	err = mlog_read_data_init_tail(mlh->ml_mpdesc, mlh->ml_mldesc);
+
+	mlog_release(mlh, rw);
+
+	return err;
+}
+
+uint64_t
+mpool_mlog_read_data_prev(
+	struct mpool       *ds,
+	struct mpool_mlog  *mlh,
+	void               *data,
+	size_t              len,
+	size_t             *rdlen)
+{
+	merr_t err;
+	bool   rw = false;
+
+	if (!ds || !mlh || !rdlen)
+		return merr(EINVAL);
+
+	err = mlog_acquire(mlh, rw);
+	if (err)
+		return err;
+
+	err = mlog_read_data_prev(mlh->ml_mpdesc, mlh->ml_mldesc, data,
+				  len, rdlen);
+
+	mlog_release(mlh, rw);
+
+	return err;
+}
+
+uint64_t
+mpool_mlog_flush(
+	struct mpool       *ds,
+	struct mpool_mlog  *mlh)
+{
+	struct mlog_tail    tail;
+	merr_t              err;
+	bool                rw = false;
+
 	if (!ds || !mlh)
 		return merr(EINVAL);
 
@@ -2527,7 +2902,9 @@ mpool_mlog_flush(
 	if (err)
 		return err;
 
+	mlog_wstart(ds, mlh, &tail);
 	err = mlog_flush(mlh->ml_mpdesc, mlh->ml_mldesc);
+	mlog_wend(ds, mlh, &tail);
 	if (err)
 		goto exit;
 
@@ -2563,6 +2940,29 @@ exit:
 	return err;
 }
 
+merr_t
+mpool_mlog_append_dmax(
+	struct mpool       *ds,
+	struct mpool_mlog  *mlh,
+	s64                *dmax)
+{
+	merr_t err;
+	bool   rw = false;
+
+	if (!ds || !mlh || !dmax)
+		return merr(EINVAL);
+
+	err = mlog_acquire(mlh, rw);
+	if (err)
+		return err;
+
+	err = mlog_dmax(mlh->ml_mpdesc, mlh->ml_mldesc, dmax);
+
+	mlog_release(mlh, rw);
+
+	return err;
+}
+
 uint64_t
 mpool_mlog_empty(
 	struct mpool       *ds,
@@ -2611,6 +3011,73 @@ mpool_mlog_getprops(
 	return 0;
 }
 
+uint64_t
+mpool_mlog_keyidx_enable(
+	struct mpool           *ds,
+	struct mpool_mlog      *mlh,
+	mpool_mlog_keyfn_t     *keyfn,
+	void                   *arg,
+	uint32_t                stride)
+{
+	struct mlog_kidx   *kx = NULL;
+	merr_t              err;
+	bool                rw = true;
+
+	if (!ds || !mlh)
+		return merr(EINVAL);
+
+	err = mlog_acquire(mlh, rw);
+	if (err)
+		return err;
+
+	if (keyfn) {
+		err = mlkidx_create(ds, mlh, keyfn, arg, stride, &kx);
+		if (err)
+			goto exit;
+	}
+
+	if (mlh->ml_kidx) {
+		mlkidx_persist(ds, mlh, mlh->ml_kidx);
+		mlkidx_destroy(mlh->ml_kidx);
+	}
+
+	mlh->ml_kidx = kx;
+
+exit:
+	mlog_release(mlh, rw);
+
+	return err;
+}
+
+uint64_t
+mpool_mlog_seek_key(
+	struct mpool       *ds,
+	struct mpool_mlog  *mlh,
+	uint64_t            key)
+{
+	merr_t err;
+	bool   rw = true;
+
+	if (!ds || !mlh)
+		return merr(EINVAL);
+
+	err = mlog_acquire(mlh, rw);
+	if (err)
+		return err;
+
+	if (!mlh->ml_kidx) {
+		err = merr(EINVAL);
+		goto exit;
+	}
+
+	err = mlkidx_seek(ds, mlh, mlh->ml_kidx, key);
+
+exit:
+	mlog_release(mlh, rw);
+
+	return err;
+}
+
 uint64_t
 mpool_mlog_erase(
 	struct mpool       *ds,
@@ -2636,7 +3103,14 @@ mpool_mlog_erase(
 	if (err)
 		return err;
 
+	if (mlh->ml_flags & MLOG_OF_RDONLY) {
+		err = merr(EPERM);
+		goto exit;
+	}
+
+	mlog_wstart(ds, mlh, NULL);
 	err = mpool_ioctl(ds->ds_fd, MPIOC_MLOG_ERASE, &mi);
+	mlog_wend(ds, mlh, NULL);
 	if (err)
 		goto exit;
 
@@ -2649,6 +3123,9 @@ mpool_mlog_erase(
 	if (err)
 		goto exit;
 
+	if (mlh->ml_kidx)
+		mlkidx_reset(mlh->ml_kidx, mi.mi_gen);
+
 exit:
 	mlog_release(mlh, rw);
 
@@ -2693,8 +3170,9 @@ mpool_mlog_append_cstart(
 	struct mpool       *ds,
 	struct mpool_mlog  *mlh)
 {
-	merr_t err;
-	bool   rw = false;
+	struct mlog_tail    tail;
+	merr_t              err;
+	bool                rw = false;
 
 	if (!ds || !mlh)
 		return merr(EINVAL);
@@ -2706,11 +3184,10 @@ mpool_mlog_append_cstart(
 	if (err)
 		return err;
 
+	mlog_wstart(ds, mlh, &tail);
 	err = mlog_append_cstart(mlh->ml_mpdesc, mlh->ml_mldesc);
-	if (err)
-		goto exit;
+	mlog_wend(ds, mlh, &tail);
 
-exit:
 	mlog_release(mlh, rw);
 
 	return err;
@@ -2721,8 +3198,9 @@ mpool_mlog_append_cend(
 	struct mpool       *ds,
 	struct mpool_mlog  *mlh)
 {
-	merr_t err;
-	bool   rw = false;
+	struct mlog_tail    tail;
+	merr_t              err;
+	bool                rw = false;
 
 	if (!ds || !mlh)
 		return merr(EINVAL);
@@ -2734,11 +3212,10 @@ mpool_mlog_append_cend(
 	if (err)
 		return err;
 
+	mlog_wstart(ds, mlh, &tail);
 	err = mlog_append_cend(mlh->ml_mpdesc, mlh->ml_mldesc);
-	if (err)
-		goto exit;
+	mlog_wend(ds, mlh, &tail);
 
-exit:
 	mlog_release(mlh, rw);
 
 	return err;
@@ -2858,6 +3335,8 @@ mpool_mblock_alloc(
 
 	*mbh = mb.mb_objid;
 
+	intent_jnl_add(ds->ds_intent, mb.mb_objid, INTENT_MBLOCK);
+
 	if (props)
 		*props = mb.mb_props.mbx_props;
 
@@ -2915,11 +3394,16 @@ mpool_mblock_commit(
 	uint64_t        mbh)
 {
 	struct mpioc_mblock_id  mi = { .mi_objid = mbh };
+	merr_t                  err;
 
 	if (!ds)
 		return merr(EINVAL);
 
-	return mpool_ioctl(ds->ds_fd, MPIOC_MB_COMMIT, &mi);
+	err = mpool_ioctl(ds->ds_fd, MPIOC_MB_COMMIT, &mi);
+	if (!err)
+		intent_jnl_del(ds->ds_intent, mbh);
+
+	return err;
 }
 
 uint64_t
@@ -2928,11 +3412,16 @@ mpool_mblock_abort(
 	uint64_t        mbh)
 {
 	struct mpioc_mblock_id  mi = { .mi_objid = mbh };
+	merr_t                  err;
 
 	if (!ds)
 		return merr(EINVAL);
 
-	return mpool_ioctl(ds->ds_fd, MPIOC_MB_ABORT, &mi);
+	err = mpool_ioctl(ds->ds_fd, MPIOC_MB_ABORT, &mi);
+	if (!err)
+		intent_jnl_del(ds->ds_intent, mbh);
+
+	return err;
 }
 
 uint64_t
@@ -2941,11 +3430,18 @@ mpool_mblock_delete(
 	uint64_t        mbh)
 {
 	struct mpioc_mblock_id  mi = { .mi_objid = mbh };
+	merr_t                  err;
 
 	if (!ds)
 		return merr(EINVAL);
 
-	return mpool_ioctl(ds->ds_fd, MPIOC_MB_DELETE, &mi);
+	mb_send_map_drop(ds, mbh);
+
+	err = mpool_ioctl(ds->ds_fd, MPIOC_MB_DELETE, &mi);
+	if (!err)
+		intent_jnl_del(ds->ds_intent, mbh);
+
+	return err;
 }
 
 uint64_t
@@ -3000,6 +3496,215 @@ mpool_mblock_write(
 	return mpool_ioctl(ds->ds_fd, MPIOC_MB_WRITE, &mbrw);
 }
 
+/**
+ * mp_iobuf_put() - Release a buffer from mp_iobuf_get()
+ * @ds:   mpool handle
+ * @pool: pool the buffer came from, may be NULL
+ * @buf:  buffer, may be NULL
+ * @len:  buffer length
+ */
+static void
+mp_iobuf_put(
+	struct mpool               *ds,
+	struct mpool_iobuf_pool    *pool,
+	void                       *buf,
+	size_t                      len)
+{
+	if (!pool) {
+		free(buf);
+		return;
+	}
+
+	if (buf)
+		mpool_iobuf_free(pool, buf, len);
+
+	mutex_lock(&ds->ds_lock);
+	if (--ds->ds_iobuf_users == 0)
+		pthread_cond_broadcast(&ds->ds_iobuf_cv);
+	mutex_unlock(&ds->ds_lock);
+}
+
+/**
+ * mp_iobuf_get() - Get a page aligned bounce buffer for mblock I/O
+ * @ds:    mpool handle
+ * @len:   buffer length
+ * @poolp: pool the buffer came from, NULL if allocated (output)
+ *
+ * Buffers come from the I/O buffer pool attached to @ds, if any, which
+ * mpool_iobuf_pool_destroy() does not free before they are put back.
+ */
+static void *
+mp_iobuf_get(
+	struct mpool               *ds,
+	size_t                      len,
+	struct mpool_iobuf_pool   **poolp)
+{
+	void   *buf;
+
+	mutex_lock(&ds->ds_lock);
+	*poolp = ds->ds_iobuf;
+	if (*poolp)
+		ds->ds_iobuf_users++;
+	mutex_unlock(&ds->ds_lock);
+
+	if (!*poolp)
+		return aligned_alloc(PAGE_SIZE, len);
+
+	if (mpool_iobuf_alloc(*poolp, len, &buf)) {
+		mp_iobuf_put(ds, *poolp, NULL, len);
+		return NULL;
+	}
+
+	return buf;
+}
+
+/*
+ * Source range mapped or read per mblock write by
+ * mpool_mblock_write_from_fd().
+ */
+#define MB_WRFD_CHUNK   (8u << 20)
+
+static merr_t
+mb_wrfd_read(
+	int         fd,
+	bool        seekable,
+	void       *buf,
+	size_t      len,
+	off_t       off)
+{
+	ssize_t cc;
+
+	while (len > 0) {
+		cc = seekable ? pread(fd, buf, len, off) : read(fd, buf, len);
+		if (cc == -1) {
+			if (errno == EINTR)
+				continue;
+			return merr(errno);
+		}
+
+		if (cc == 0)
+			return merr(ENODATA);
+
+		buf += cc;
+		len -= cc;
+		off += cc;
+	}
+
+	return 0;
+}
+
+uint64_t
+mpool_mblock_write_from_fd(
+	struct mpool       *ds,
+	uint64_t            mbh,
+	int                 fd,
+	off_t               off,
+	size_t              len)
+{
+	struct mpool_iobuf_pool    *pool = NULL;
+	struct iovec                iov;
+	struct stat                 st;
+
+	size_t  chunk, tail, buflen = 0;
+	merr_t  err = 0;
+	bool    seekable, mapped;
+	char   *buf = NULL;
+	void   *map;
+
+	if (!ds || !mbh || fd < 0 || off < 0)
+		return merr(EINVAL);
+
+	if (fstat(fd, &st))
+		return merr(errno);
+
+	/* Mapping past EOF would fault instead of failing the read */
+	if (S_ISREG(st.st_mode) && off + len > st.st_size)
+		return merr(ENODATA);
+
+	seekable = S_ISREG(st.st_mode) || S_ISBLK(st.st_mode);
+	mapped = S_ISREG(st.st_mode) && !(off & (PAGE_SIZE - 1));
+
+	tail = len & (PAGE_SIZE - 1);
+	len -= tail;
+
+	while (len > 0) {
+		chunk = min_t(size_t, len, MB_WRFD_CHUNK);
+
+		/* Have the kernel read ahead the next chunk while this one
+		 * is being written.
+		 */
+		if (seekable && len > chunk)
+			posix_fadvise(fd, off + chunk,
+				      min_t(size_t, len - chunk, MB_WRFD_CHUNK),
+				      POSIX_FADV_WILLNEED);
+
+		map = MAP_FAILED;
+		if (mapped) {
+			map = mmap(NULL, chunk, PROT_READ, MAP_SHARED, fd, off);
+			if (map == MAP_FAILED)
+				mapped = false;
+		}
+
+		if (map != MAP_FAILED) {
+			iov.iov_base = map;
+			iov.iov_len = chunk;
+
+			err = mpool_mblock_write(ds, mbh, &iov, 1);
+
+			munmap(map, chunk);
+		} else {
+			if (!buf) {
+				buflen = MB_WRFD_CHUNK;
+				buf = mp_iobuf_get(ds, buflen, &pool);
+				if (!buf) {
+					err = merr(ENOMEM);
+					break;
+				}
+			}
+
+			err = mb_wrfd_read(fd, seekable, buf, chunk, off);
+			if (err)
+				break;
+
+			iov.iov_base = buf;
+			iov.iov_len = chunk;
+
+			err = mpool_mblock_write(ds, mbh, &iov, 1);
+		}
+
+		if (err)
+			break;
+
+		off += chunk;
+		len -= chunk;
+	}
+
+	if (!err && tail > 0) {
+		if (!buf) {
+			buflen = PAGE_SIZE;
+			buf = mp_iobuf_get(ds, buflen, &pool);
+		}
+		if (!buf) {
+			err = merr(ENOMEM);
+		} else {
+			memset(buf + tail, 0, PAGE_SIZE - tail);
+
+			err = mb_wrfd_read(fd, seekable, buf, tail, off);
+			if (!err) {
+				iov.iov_base = buf;
+				iov.iov_len = PAGE_SIZE;
+
+				err = mpool_mblock_write(ds, mbh, &iov, 1);
+			}
+		}
+	}
+
+	if (buf)
+		mp_iobuf_put(ds, pool, buf, buflen);
+
+	return err;
+}
+
 uint64_t
 mpool_mblock_asyncio_flush(
 	struct mpool           *ds,
@@ -3066,6 +3771,165 @@ mpool_mblock_read(
 	return mpool_ioctl(ds->ds_fd, MPIOC_MB_READ, &mbrw);
 }
 
+/*
+ * Bounce buffers of mpool_mblock_send() for mpools without an attached
+ * I/O buffer pool, kept for reuse by later sends that cannot map the
+ * mblock.  The cache is bounded at MB_SEND_BUFMAX buffers and lives as
+ * long as the process.
+ */
+#define MB_SEND_BUFSZ   (1u << 20)
+#define MB_SEND_BUFMAX  (4)
+
+static DEFINE_MUTEX(mb_send_lock);
+static void *mb_send_bufv[MB_SEND_BUFMAX];
+static int   mb_send_bufc;
+
+static void *
+mb_send_buf_get(struct mpool *ds, struct mpool_iobuf_pool **poolp)
+{
+	void *buf = NULL;
+	bool  attached;
+
+	mutex_lock(&ds->ds_lock);
+	attached = ds->ds_iobuf;
+	mutex_unlock(&ds->ds_lock);
+
+	/* A pool detached meanwhile yields a plain buffer, cached on put */
+	if (attached)
+		return mp_iobuf_get(ds, MB_SEND_BUFSZ, poolp);
+
+	*poolp = NULL;
+
+	mutex_lock(&mb_send_lock);
+	if (mb_send_bufc > 0)
+		buf = mb_send_bufv[--mb_send_bufc];
+	mutex_unlock(&mb_send_lock);
+
+	return buf ?: aligned_alloc(PAGE_SIZE, MB_SEND_BUFSZ);
+}
+
+static void
+mb_send_buf_put(
+	struct mpool               *ds,
+	struct mpool_iobuf_pool    *pool,
+	void                       *buf)
+{
+	if (pool) {
+		mp_iobuf_put(ds, pool, buf, MB_SEND_BUFSZ);
+		return;
+	}
+
+	mutex_lock(&mb_send_lock);
+	if (mb_send_bufc < MB_SEND_BUFMAX) {
+		mb_send_bufv[mb_send_bufc++] = buf;
+		buf = NULL;
+	}
+	mutex_unlock(&mb_send_lock);
+
+	free(buf);
+}
+
+static merr_t
+mb_send_write(
+	int             fd,
+	const char     *buf,
+	size_t          len)
+{
+	ssize_t cc;
+
+	while (len > 0) {
+		cc = write(fd, buf, len);
+		if (cc == -1) {
+			if (errno == EINTR)
+				continue;
+			return merr(errno);
+		}
+
+		buf += cc;
+		len -= cc;
+	}
+
+	return 0;
+}
+
+uint64_t
+mpool_mblock_send(
+	struct mpool       *ds,
+	uint64_t            mbh,
+	size_t              off,
+	size_t              len,
+	int                 fd)
+{
+	struct mpool_mcache_map    *map;
+	struct mpool_iobuf_pool    *pool;
+	struct mblock_props         props;
+	struct iovec                iov;
+
+	size_t  skip, cc;
+	merr_t  err;
+	char   *buf;
+
+	if (!ds || !mbh || fd < 0)
+		return merr(EINVAL);
+
+	err = mpool_mblock_getprops(ds, mbh, &props);
+	if (err)
+		return err;
+
+	if (!props.mpr_iscommitted || off > props.mpr_write_len ||
+	    len > props.mpr_write_len - off)
+		return merr(EINVAL);
+
+	if (len == 0)
+		return 0;
+
+	/*
+	 * Pages are written from the map rather than spliced: a pipe or a
+	 * socket could still reference spliced pages after we return, when
+	 * the map or the mblock may be gone.
+	 */
+	err = mb_send_map_get(ds, mbh, &map);
+	if (!err) {
+		buf = mpool_mcache_getbase(map, 0);
+
+		err = mb_send_write(fd, buf + off, len);
+
+		mb_send_map_put(ds, map);
+
+		return err;
+	}
+
+	/* No mcache map, read through a bounce buffer */
+	buf = mb_send_buf_get(ds, &pool);
+	if (!buf)
+		return merr(ENOMEM);
+
+	while (len > 0) {
+		skip = off & (PAGE_SIZE - 1);
+
+		iov.iov_base = buf;
+		iov.iov_len = min_t(size_t, MB_SEND_BUFSZ,
+				    ALIGN(skip + len, PAGE_SIZE));
+
+		err = mpool_mblock_read(ds, mbh, &iov, 1, off - skip);
+		if (err)
+			break;
+
+		cc = min_t(size_t, iov.iov_len - skip, len);
+
+		err = mb_send_write(fd, buf + skip, cc);
+		if (err)
+			break;
+
+		off += cc;
+		len -= cc;
+	}
+
+	mb_send_buf_put(ds, pool, buf);
+
+	return err;
+}
+
 uint64_t
 mpool_mcache_mmap(
 	struct mpool               *ds,
@@ -3116,6 +3980,20 @@ mpool_mcache_mmap(
 		return err;
 	}
 
+	/*
+	 * Pinned maps are fully resident, there is nothing to adapt.  Only
+	 * maps left at the default advice are switched to MADV_RANDOM.
+	 */
+	if (advice != MPC_VMA_PINNED) {
+		err = mcra_create(map->mh_addr, map->mh_bktsz, map->mh_mbidc,
+				  advice == MPC_VMA_COLD, &map->mh_ra);
+		if (err) {
+			munmap(map->mh_addr, map->mh_len);
+			free(map);
+			return err;
+		}
+	}
+
 	*mapp = map;
 
 	return 0;
@@ -3134,6 +4012,7 @@ mpool_mcache_munmap(
 	if (rc)
 		return merr(errno);
 
+	mcra_destroy(map->mh_ra);
 	free(map);
 
 	return 0;
@@ -3300,8 +4179,10 @@ mpool_mcache_getpages(
 	 */
 	addr = (char *)map->mh_addr + (mbidx * map->mh_bktsz);
 
-	for (i = 0; i < pagec; i++)
+	for (i = 0; i < pagec; i++) {
 		addrv[i] = addr + pagenumv[i] * PAGE_SIZE;
+		mcra_access(map->mh_ra, mbidx, pagenumv[i], 1);
+	}
 
 	return 0;
 }
@@ -3328,11 +4209,43 @@ mpool_mcache_getpagesv(
 
 		addrv[i] = (char *)map->mh_addr + (pagenumv[i] * PAGE_SIZE) +
 			(mbnumv[i] * map->mh_bktsz);
+		mcra_access(map->mh_ra, mbnumv[i], pagenumv[i], 1);
 	}
 
 	return 0;
 }
 
+void
+mpool_mcache_access(
+	struct mpool_mcache_map    *map,
+	uint                        mbidx,
+	size_t                      offset,
+	size_t                      length)
+{
+	size_t pgnum;
+
+	if (!map || length == 0)
+		return;
+
+	pgnum = offset / PAGE_SIZE;
+
+	mcra_access(map->mh_ra, mbidx, pgnum,
+		    (offset + length - 1) / PAGE_SIZE - pgnum + 1);
+}
+
+uint64_t
+mpool_mcache_ra_stats(
+	struct mpool_mcache_map        *map,
+	struct mpool_mcache_ra_stats   *stats)
+{
+	if (!map || !stats)
+		return merr(EINVAL);
+
+	mcra_stats(map->mh_ra, stats);
+
+	return 0;
+}
+
 struct pd_prop *
 mp_get_dev_prop(
 	int dcnt,
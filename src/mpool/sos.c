@@ -0,0 +1,1377 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Small object store design pattern module.
+ *
+ * Packs many small, keyed objects into large mblocks ("segments") and keeps
+ * the key -> (segment, offset, length) index persistent in an MDC.  Segments
+ * are filled in memory and written to the active mblock in large page-aligned
+ * chunks; a segment is committed (sealed) when full or on mpool_sos_sync().
+ * Only objects in sealed segments survive a restart.
+ *
+ * Overwrites and deletes leave garbage behind in sealed segments.  A
+ * background compactor relocates the live objects of segments whose garbage
+ * ratio exceeds a threshold and then deletes the old mblocks.  It reads the
+ * objects without the handle lock and takes it only to re-put each batch,
+ * skipping objects that were overwritten or deleted meanwhile.  The MDC is
+ * periodically compacted by writing a snapshot of the segment table and
+ * index between a cstart/cend pair.
+ *
+ * Like mdc.c, this module is layered entirely on the public mpool API.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include <util/alloc.h>
+#include <util/page.h>
+#include <util/minmax.h>
+#include <util/mutex.h>
+#include <util/omf.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+#include "logging.h"
+
+#define SOS_OBJ_MAGIC           ((u32)0x534f5331)       /* "SOS1" */
+#define SOS_OBJ_ALIGN           (8)
+#define SOS_WCHUNK              (1024 * 1024)
+#define SOS_SEGSZ_MAX           (1ull << 31)
+#define SOS_RELOC_BATCH         (4 * 1024 * 1024)
+#define SOS_IDX_MIN             (1u << 10)
+#define SOS_SEG_MIN             (16)
+#define SOS_SEG_INVALID         ((u32)-1)
+#define SOS_COMPACT_BATCH       (4)
+#define SOS_MDC_COMPACT_MIN     (1024 * 1024)
+#define SOS_MDC_COMPACT_RATIO   (4)
+
+#define SOS_GARBAGE_PCT_DFLT    (50)
+#define SOS_COMPACT_MS_DFLT     (1000)
+
+/*
+ * MDC record types
+ */
+enum sos_rec_type {
+	SOS_REC_SEGOPEN = 1,
+	SOS_REC_SEGSEAL = 2,
+	SOS_REC_SEGFREE = 3,
+	SOS_REC_PUT     = 4,
+	SOS_REC_DEL     = 5,
+};
+
+/**
+ * struct sos_rec_omf - small object store MDC record
+ * @psr_type: enum sos_rec_type
+ * @psr_seg:  segment table index
+ * @psr_key:  object key (PUT, DEL) or mblock ID (SEGOPEN)
+ * @psr_off:  object offset in segment (PUT) or segment length (SEGSEAL)
+ * @psr_len:  object length (PUT)
+ */
+struct sos_rec_omf {
+	u8      psr_type;
+	u8      psr_rsvd[3];
+	__le32  psr_seg;
+	__le64  psr_key;
+	__le32  psr_off;
+	__le32  psr_len;
+} __packed;
+
+OMF_SETGET(struct sos_rec_omf, psr_type, 8)
+OMF_SETGET(struct sos_rec_omf, psr_seg, 32)
+OMF_SETGET(struct sos_rec_omf, psr_key, 64)
+OMF_SETGET(struct sos_rec_omf, psr_off, 32)
+OMF_SETGET(struct sos_rec_omf, psr_len, 32)
+
+/**
+ * struct sos_objhdr_omf - header prepended to each object in a segment
+ * @psh_magic: SOS_OBJ_MAGIC
+ * @psh_len:   object length, excluding header and padding
+ * @psh_key:   object key
+ */
+struct sos_objhdr_omf {
+	__le32  psh_magic;
+	__le32  psh_len;
+	__le64  psh_key;
+} __packed;
+
+OMF_SETGET(struct sos_objhdr_omf, psh_magic, 32)
+OMF_SETGET(struct sos_objhdr_omf, psh_len, 32)
+OMF_SETGET(struct sos_objhdr_omf, psh_key, 64)
+
+enum sos_seg_state {
+	SOS_SEG_FREE = 0,
+	SOS_SEG_ACTIVE,
+	SOS_SEG_SEALED,
+};
+
+/**
+ * struct sos_seg - segment table entry
+ * @sg_mbid:    mblock ID
+ * @sg_used:    bytes consumed in the segment
+ * @sg_live:    bytes consumed by live objects
+ * @sg_readers: number of in-flight reads
+ * @sg_state:   enum sos_seg_state
+ * @sg_rmbid:   mblock ID of the incarnation being replayed
+ */
+struct sos_seg {
+	u64     sg_mbid;
+	u64     sg_rmbid;
+	u32     sg_used;
+	u32     sg_live;
+	u32     sg_readers;
+	u8      sg_state;
+};
+
+enum sos_ent_state {
+	SOS_ENT_EMPTY = 0,
+	SOS_ENT_USED,
+	SOS_ENT_TOMB,
+};
+
+/**
+ * struct sos_ent - index entry (open addressing, linear probing)
+ */
+struct sos_ent {
+	u64     se_key;
+	u32     se_seg;
+	u32     se_off;
+	u32     se_len;
+	u8      se_state;
+};
+
+/**
+ * struct sos_reloc - live object of a compaction victim
+ * @sr_key: object key
+ * @sr_seg: victim segment index
+ * @sr_off: object offset in the victim
+ * @sr_len: object length
+ * @sr_buf: offset of the object data in the relocation buffer
+ */
+struct sos_reloc {
+	u64     sr_key;
+	u32     sr_seg;
+	u32     sr_off;
+	u32     sr_len;
+	size_t  sr_buf;
+};
+
+/**
+ * struct mpool_sos - small object store handle
+ * @sos_clock:    serializes compaction passes, taken before @sos_lock
+ * @sos_rlock:    protects @sos_rbuf
+ * @sos_rbuf:     read bounce buffer, SOS_WCHUNK bytes
+ * @sos_lock:     protects everything below
+ * @sos_cv:       compactor wakeup
+ * @sos_mp:       mpool handle
+ * @sos_mdc:      MDC holding the index
+ * @sos_params:   tunables
+ * @sos_segsz:    segment (mblock) size in bytes
+ * @sos_segv:     segment table
+ * @sos_segc:     segment table size
+ * @sos_aseg:     active segment index, SOS_SEG_INVALID if none
+ * @sos_abuf:     in-memory image of the active segment
+ * @sos_awoff:    bytes of the active segment already written to media
+ * @sos_idxv:     index hash table
+ * @sos_idxsz:    index hash table size (power of 2)
+ * @sos_idxcnt:   number of USED index entries
+ * @sos_idxtomb:  number of TOMB index entries
+ * @sos_snapsz:   MDC usage right after the last snapshot
+ * @sos_thread:   compactor thread
+ * @sos_running:  compactor thread exists
+ * @sos_closing:  compactor should exit
+ */
+struct mpool_sos {
+	struct mutex            sos_clock;
+	struct mutex            sos_rlock;
+	char                   *sos_rbuf;
+
+	struct mutex            sos_lock;
+	pthread_cond_t          sos_cv;
+	struct mpool           *sos_mp;
+	struct mpool_mdc       *sos_mdc;
+	struct mpool_sos_params sos_params;
+	u64                     sos_segsz;
+
+	struct sos_seg         *sos_segv;
+	u32                     sos_segc;
+	u32                     sos_aseg;
+	char                   *sos_abuf;
+	u32                     sos_awoff;
+
+	struct sos_ent         *sos_idxv;
+	u32                     sos_idxsz;
+	u32                     sos_idxcnt;
+	u32                     sos_idxtomb;
+
+	size_t                  sos_snapsz;
+
+	pthread_t               sos_thread;
+	bool                    sos_running;
+	bool                    sos_closing;
+};
+
+static inline u32
+sos_objsz(u32 len)
+{
+	return ALIGN(sizeof(struct sos_objhdr_omf) + len, SOS_OBJ_ALIGN);
+}
+
+static inline u64
+sos_hash(u64 key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdull;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ull;
+	key ^= key >> 33;
+
+	return key;
+}
+
+static struct sos_ent *
+sos_idx_find(struct mpool_sos *sos, u64 key)
+{
+	struct sos_ent *ent;
+	u32             mask, i;
+
+	mask = sos->sos_idxsz - 1;
+
+	for (i = sos_hash(key) & mask; ; i = (i + 1) & mask) {
+		ent = sos->sos_idxv + i;
+
+		if (ent->se_state == SOS_ENT_EMPTY)
+			return NULL;
+
+		if (ent->se_state == SOS_ENT_USED && ent->se_key == key)
+			return ent;
+	}
+}
+
+static struct sos_ent *
+sos_idx_slot(struct sos_ent *idxv, u32 idxsz, u64 key)
+{
+	u32 mask, i;
+
+	mask = idxsz - 1;
+
+	for (i = sos_hash(key) & mask; ; i = (i + 1) & mask)
+		if (idxv[i].se_state != SOS_ENT_USED)
+			return idxv + i;
+}
+
+/**
+ * sos_idx_resize() - Rehash the index, dropping tombstones
+ * @sos:   sos handle
+ * @idxsz: new table size (power of 2)
+ */
+static merr_t
+sos_idx_resize(struct mpool_sos *sos, u32 idxsz)
+{
+	struct sos_ent *idxv, *ent;
+	u32             i;
+
+	idxv = kcalloc(idxsz, sizeof(*idxv), GFP_KERNEL);
+	if (!idxv)
+		return merr(ENOMEM);
+
+	for (i = 0; i < sos->sos_idxsz; i++) {
+		if (sos->sos_idxv[i].se_state != SOS_ENT_USED)
+			continue;
+
+		ent = sos_idx_slot(idxv, idxsz, sos->sos_idxv[i].se_key);
+		*ent = sos->sos_idxv[i];
+	}
+
+	kfree(sos->sos_idxv);
+
+	sos->sos_idxv = idxv;
+	sos->sos_idxsz = idxsz;
+	sos->sos_idxtomb = 0;
+
+	return 0;
+}
+
+static void
+sos_idx_remove(struct mpool_sos *sos, struct sos_ent *ent)
+{
+	struct sos_seg *seg = sos->sos_segv + ent->se_seg;
+
+	seg->sg_live -= sos_objsz(ent->se_len);
+
+	ent->se_state = SOS_ENT_TOMB;
+	sos->sos_idxcnt--;
+	sos->sos_idxtomb++;
+}
+
+/**
+ * sos_idx_insert() - Insert or replace an index entry
+ *
+ * Accounts the object as live in its segment, and the replaced object
+ * (if any) as garbage in the segment that holds it.
+ */
+static merr_t
+sos_idx_insert(struct mpool_sos *sos, u64 key, u32 segidx, u32 off, u32 len)
+{
+	struct sos_ent *ent;
+	merr_t          err;
+
+	ent = sos_idx_find(sos, key);
+	if (ent) {
+		sos->sos_segv[ent->se_seg].sg_live -= sos_objsz(ent->se_len);
+		goto update;
+	}
+
+	if ((sos->sos_idxcnt + sos->sos_idxtomb + 1) * 4 >= sos->sos_idxsz * 3) {
+		u32 idxsz = sos->sos_idxsz;
+
+		if ((sos->sos_idxcnt + 1) * 2 >= idxsz)
+			idxsz *= 2;
+
+		err = sos_idx_resize(sos, idxsz);
+		if (err)
+			return err;
+	}
+
+	ent = sos_idx_slot(sos->sos_idxv, sos->sos_idxsz, key);
+	if (ent->se_state == SOS_ENT_TOMB)
+		sos->sos_idxtomb--;
+
+	ent->se_key = key;
+	ent->se_state = SOS_ENT_USED;
+	sos->sos_idxcnt++;
+
+update:
+	ent->se_seg = segidx;
+	ent->se_off = off;
+	ent->se_len = len;
+
+	sos->sos_segv[segidx].sg_live += sos_objsz(len);
+
+	return 0;
+}
+
+/**
+ * sos_seg_get() - Return the segment table entry for segidx, growing the
+ *                 table as needed
+ */
+static struct sos_seg *
+sos_seg_get(struct mpool_sos *sos, u32 segidx)
+{
+	struct sos_seg *segv;
+	u32             segc;
+
+	if (segidx < sos->sos_segc)
+		return sos->sos_segv + segidx;
+
+	if (segidx == SOS_SEG_INVALID)
+		return NULL;
+
+	segc = max_t(u32, sos->sos_segc * 2, SOS_SEG_MIN);
+	while (segc <= segidx)
+		segc *= 2;
+
+	segv = realloc(sos->sos_segv, segc * sizeof(*segv));
+	if (!segv)
+		return NULL;
+
+	memset(segv + sos->sos_segc, 0,
+	       (segc - sos->sos_segc) * sizeof(*segv));
+
+	sos->sos_segv = segv;
+	sos->sos_segc = segc;
+
+	return sos->sos_segv + segidx;
+}
+
+static merr_t
+sos_rec_append(
+	struct mpool_sos   *sos,
+	enum sos_rec_type   type,
+	u32                 segidx,
+	u64                 key,
+	u32                 off,
+	u32                 len,
+	bool                sync)
+{
+	struct sos_rec_omf rec;
+
+	memset(&rec, 0, sizeof(rec));
+	omf_set_psr_type(&rec, type);
+	omf_set_psr_seg(&rec, segidx);
+	omf_set_psr_key(&rec, key);
+	omf_set_psr_off(&rec, off);
+	omf_set_psr_len(&rec, len);
+
+	return mpool_mdc_append(sos->sos_mdc, &rec, sizeof(rec), sync);
+}
+
+/**
+ * sos_seg_open() - Allocate an mblock and make it the active segment
+ */
+static merr_t
+sos_seg_open(struct mpool_sos *sos)
+{
+	struct sos_seg *seg = NULL;
+	merr_t          err;
+	u64             mbid;
+	u32             i;
+
+	for (i = 0; i < sos->sos_segc; i++) {
+		if (sos->sos_segv[i].sg_state == SOS_SEG_FREE) {
+			seg = sos->sos_segv + i;
+			break;
+		}
+	}
+
+	if (!seg) {
+		seg = sos_seg_get(sos, sos->sos_segc);
+		if (!seg)
+			return merr(ENOMEM);
+	}
+
+	err = mpool_mblock_alloc(sos->sos_mp, sos->sos_params.sp_mclassp,
+				 false, &mbid, NULL);
+	if (err)
+		return err;
+
+	err = sos_rec_append(sos, SOS_REC_SEGOPEN, i, mbid, 0, 0, false);
+	if (err) {
+		mpool_mblock_abort(sos->sos_mp, mbid);
+		return err;
+	}
+
+	seg->sg_mbid = mbid;
+	seg->sg_used = 0;
+	seg->sg_live = 0;
+	seg->sg_readers = 0;
+	seg->sg_state = SOS_SEG_ACTIVE;
+
+	sos->sos_aseg = i;
+	sos->sos_awoff = 0;
+
+	return 0;
+}
+
+/**
+ * sos_seg_write() - Write buffered active segment data to its mblock
+ * @sos:   sos handle
+ * @final: write everything, padding the tail to a page boundary
+ *
+ * Without @final only whole SOS_WCHUNK sized chunks are written.
+ */
+static merr_t
+sos_seg_write(struct mpool_sos *sos, bool final)
+{
+	struct sos_seg *seg = sos->sos_segv + sos->sos_aseg;
+	struct iovec    iov;
+	merr_t          err;
+	u32             end;
+
+	end = seg->sg_used;
+	if (final) {
+		end = ALIGN(end, PAGE_SIZE);
+		memset(sos->sos_abuf + seg->sg_used, 0, end - seg->sg_used);
+	} else {
+		end -= (end - sos->sos_awoff) % SOS_WCHUNK;
+	}
+
+	while (sos->sos_awoff < end) {
+		iov.iov_base = sos->sos_abuf + sos->sos_awoff;
+		iov.iov_len = min_t(u32, end - sos->sos_awoff, SOS_WCHUNK);
+
+		err = mpool_mblock_write(sos->sos_mp, seg->sg_mbid, &iov, 1);
+		if (err)
+			return err;
+
+		sos->sos_awoff += iov.iov_len;
+	}
+
+	return 0;
+}
+
+/**
+ * sos_seg_seal() - Flush and commit the active segment
+ *
+ * An empty active segment is simply released.  The SEGSEAL record is
+ * appended synchronously, so on return all objects in the segment are
+ * durable.
+ */
+static merr_t
+sos_seg_seal(struct mpool_sos *sos)
+{
+	struct sos_seg *seg;
+	merr_t          err;
+	u32             segidx;
+
+	segidx = sos->sos_aseg;
+	if (segidx == SOS_SEG_INVALID)
+		return 0;
+
+	seg = sos->sos_segv + segidx;
+
+	if (seg->sg_used == 0) {
+		err = sos_rec_append(sos, SOS_REC_SEGFREE, segidx, 0, 0, 0,
+				     false);
+		if (err)
+			return err;
+
+		mpool_mblock_abort(sos->sos_mp, seg->sg_mbid);
+		seg->sg_state = SOS_SEG_FREE;
+		sos->sos_aseg = SOS_SEG_INVALID;
+
+		return 0;
+	}
+
+	err = sos_seg_write(sos, true);
+	if (err)
+		return err;
+
+	err = mpool_mblock_commit(sos->sos_mp, seg->sg_mbid);
+	if (err)
+		return err;
+
+	err = sos_rec_append(sos, SOS_REC_SEGSEAL, segidx, 0, seg->sg_used,
+			     0, true);
+	if (err)
+		return err;
+
+	seg->sg_state = SOS_SEG_SEALED;
+	sos->sos_aseg = SOS_SEG_INVALID;
+
+	return 0;
+}
+
+/**
+ * sos_put_locked() - Append an object to the active segment
+ */
+static merr_t
+sos_put_locked(struct mpool_sos *sos, u64 key, const void *data, u32 len)
+{
+	struct sos_objhdr_omf  *hdr;
+	struct sos_seg         *seg;
+	merr_t                  err;
+	u32                     objsz, off;
+
+	objsz = sos_objsz(len);
+
+	if (sos->sos_aseg != SOS_SEG_INVALID) {
+		seg = sos->sos_segv + sos->sos_aseg;
+
+		if (seg->sg_used + objsz > sos->sos_segsz) {
+			err = sos_seg_seal(sos);
+			if (err)
+				return err;
+		}
+	}
+
+	if (sos->sos_aseg == SOS_SEG_INVALID) {
+		err = sos_seg_open(sos);
+		if (err)
+			return err;
+	}
+
+	seg = sos->sos_segv + sos->sos_aseg;
+	off = seg->sg_used;
+
+	err = sos_rec_append(sos, SOS_REC_PUT, sos->sos_aseg, key, off, len,
+			     false);
+	if (err)
+		return err;
+
+	err = sos_idx_insert(sos, key, sos->sos_aseg, off, len);
+	if (err)
+		return err;
+
+	hdr = (void *)(sos->sos_abuf + off);
+	omf_set_psh_magic(hdr, SOS_OBJ_MAGIC);
+	omf_set_psh_len(hdr, len);
+	omf_set_psh_key(hdr, key);
+	memcpy(hdr + 1, data, len);
+	memset((char *)(hdr + 1) + len, 0, objsz - sizeof(*hdr) - len);
+
+	seg->sg_used += objsz;
+
+	return sos_seg_write(sos, false);
+}
+
+/**
+ * sos_rbuf_get() - Get a page aligned bounce buffer of @sz bytes
+ *
+ * The per-handle buffer serves one reader at a time.  Concurrent readers,
+ * and reads larger than the buffer, allocate their own.
+ */
+static char *
+sos_rbuf_get(struct mpool_sos *sos, size_t sz)
+{
+	if (sz <= SOS_WCHUNK && mutex_trylock(&sos->sos_rlock))
+		return sos->sos_rbuf;
+
+	return aligned_alloc(PAGE_SIZE, sz);
+}
+
+static void
+sos_rbuf_put(struct mpool_sos *sos, char *rbuf)
+{
+	if (rbuf == sos->sos_rbuf)
+		mutex_unlock(&sos->sos_rlock);
+	else
+		free(rbuf);
+}
+
+/**
+ * sos_obj_read() - Read an object from a sealed segment
+ *
+ * mblock reads must be page aligned, so read the enclosing page range into
+ * a bounce buffer and verify the object header before copying out.
+ */
+static merr_t
+sos_obj_read(
+	struct mpool_sos   *sos,
+	u64                 mbid,
+	u64                 key,
+	u32                 off,
+	u32                 len,
+	void               *buf)
+{
+	struct sos_objhdr_omf  *hdr;
+	struct iovec            iov;
+	merr_t                  err;
+	size_t                  start, end;
+	char                   *rbuf;
+
+	start = off & PAGE_MASK;
+	end = ALIGN(off + sizeof(*hdr) + len, PAGE_SIZE);
+
+	rbuf = sos_rbuf_get(sos, end - start);
+	if (!rbuf)
+		return merr(ENOMEM);
+
+	iov.iov_base = rbuf;
+	iov.iov_len = end - start;
+
+	err = mpool_mblock_read(sos->sos_mp, mbid, &iov, 1, start);
+	if (err)
+		goto errout;
+
+	hdr = (void *)(rbuf + off - start);
+
+	if (omf_psh_magic(hdr) != SOS_OBJ_MAGIC || omf_psh_key(hdr) != key ||
+	    omf_psh_len(hdr) != len) {
+		err = merr(ENODATA);
+		mp_pr_err("sos mblock 0x%lx off %u key 0x%lx: bad object header",
+			  err, (ulong)mbid, off, (ulong)key);
+		goto errout;
+	}
+
+	memcpy(buf, hdr + 1, len);
+
+errout:
+	sos_rbuf_put(sos, rbuf);
+
+	return err;
+}
+
+/**
+ * sos_mdc_snapshot() - Append the records describing the current state
+ */
+static merr_t
+sos_mdc_snapshot(void *arg)
+{
+	struct mpool_sos   *sos = arg;
+	struct sos_seg     *seg;
+	struct sos_ent     *ent;
+	merr_t              err;
+	u32                 i;
+
+	for (i = 0; i < sos->sos_segc; i++) {
+		seg = sos->sos_segv + i;
+		if (seg->sg_state == SOS_SEG_FREE)
+			continue;
+
+		err = sos_rec_append(sos, SOS_REC_SEGOPEN, i, seg->sg_mbid,
+				     0, 0, false);
+		if (!err && seg->sg_state == SOS_SEG_SEALED)
+			err = sos_rec_append(sos, SOS_REC_SEGSEAL, i, 0,
+					     seg->sg_used, 0, false);
+		if (err)
+			return err;
+	}
+
+	for (i = 0; i < sos->sos_idxsz; i++) {
+		ent = sos->sos_idxv + i;
+		if (ent->se_state != SOS_ENT_USED)
+			continue;
+
+		err = sos_rec_append(sos, SOS_REC_PUT, ent->se_seg,
+				     ent->se_key, ent->se_off, ent->se_len,
+				     false);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/**
+ * sos_mdc_compact() - Rewrite the MDC as a snapshot of the current state
+ *
+ * Only done when the MDC has grown well beyond the size of a snapshot.
+ */
+static merr_t
+sos_mdc_compact(struct mpool_sos *sos)
+{
+	size_t  usage, snapsz;
+	merr_t  err;
+
+	err = mpool_mdc_usage(sos->sos_mdc, &usage);
+	if (err)
+		return err;
+
+	snapsz = (sos->sos_segc * 2 + sos->sos_idxcnt) *
+		sizeof(struct sos_rec_omf);
+
+	if (usage < SOS_MDC_COMPACT_MIN ||
+	    usage < SOS_MDC_COMPACT_RATIO * max(snapsz, sos->sos_snapsz))
+		return 0;
+
+	err = mpool_mdc_compact(sos->sos_mdc, sos_mdc_snapshot, sos);
+	if (err)
+		return err;
+
+	err = mpool_mdc_usage(sos->sos_mdc, &sos->sos_snapsz);
+	if (err)
+		sos->sos_snapsz = snapsz;
+
+	return 0;
+}
+
+/**
+ * sos_compact_victims() - Pick segments to compact and list their objects
+ *
+ * Return: number of victims; the caller frees *@relocvp
+ */
+static u32
+sos_compact_victims(
+	struct mpool_sos   *sos,
+	u32                *victimv,
+	struct sos_reloc  **relocvp,
+	u32                *relocc,
+	merr_t             *errp)
+{
+	struct sos_reloc   *relocv = NULL, *r;
+	struct sos_seg     *seg;
+	struct sos_ent     *ent;
+	u32                 victimc = 0, relocmax = 0;
+	u32                 pct, i, j;
+
+	pct = sos->sos_params.sp_garbage_pct;
+	*relocc = 0;
+
+	for (i = 0; i < sos->sos_segc && victimc < SOS_COMPACT_BATCH; i++) {
+		seg = sos->sos_segv + i;
+
+		if (seg->sg_state != SOS_SEG_SEALED)
+			continue;
+
+		if ((u64)(seg->sg_used - seg->sg_live) * 100 <
+		    (u64)seg->sg_used * pct)
+			continue;
+
+		victimv[victimc++] = i;
+	}
+
+	for (i = 0; i < sos->sos_idxsz; i++) {
+		ent = sos->sos_idxv + i;
+		if (ent->se_state != SOS_ENT_USED)
+			continue;
+
+		for (j = 0; j < victimc; j++)
+			if (ent->se_seg == victimv[j])
+				break;
+
+		if (j == victimc)
+			continue;
+
+		if (*relocc == relocmax) {
+			relocmax = max_t(u32, relocmax * 2, 64);
+
+			r = realloc(relocv, relocmax * sizeof(*r));
+			if (!r) {
+				free(relocv);
+				*errp = merr(ENOMEM);
+				return 0;
+			}
+
+			relocv = r;
+		}
+
+		r = relocv + (*relocc)++;
+		r->sr_key = ent->se_key;
+		r->sr_seg = ent->se_seg;
+		r->sr_off = ent->se_off;
+		r->sr_len = ent->se_len;
+	}
+
+	*relocvp = relocv;
+
+	return victimc;
+}
+
+/**
+ * sos_compact() - One compaction pass
+ *
+ * Relocates live objects out of up to SOS_COMPACT_BATCH sealed segments whose
+ * garbage ratio is at least sp_garbage_pct, then frees those segments.
+ *
+ * Objects are read in batches of about SOS_RELOC_BATCH bytes without
+ * sos_lock, which is then taken to put each batch.  An object is only put
+ * if the index still points at the copy that was read.  A victim that is
+ * still being read by a get, or whose objects could not all be relocated,
+ * is left for a later pass.
+ */
+static merr_t
+sos_compact(struct mpool_sos *sos)
+{
+	struct sos_reloc   *relocv = NULL, *r;
+	struct sos_seg     *seg;
+	struct sos_ent     *ent;
+	u32                 victimv[SOS_COMPACT_BATCH];
+	u64                 mbidv[SOS_COMPACT_BATCH];
+	u32                 victimc, relocc = 0;
+	u32                 i, j, k;
+	size_t              bufsz = 0, boff;
+	merr_t              err = 0;
+	char               *buf = NULL;
+
+	mutex_lock(&sos->sos_clock);
+	mutex_lock(&sos->sos_lock);
+
+	victimc = sos_compact_victims(sos, victimv, &relocv, &relocc, &err);
+	if (victimc == 0) {
+		if (!err)
+			err = sos_mdc_compact(sos);
+		goto out;
+	}
+
+	for (i = 0; i < victimc; i++)
+		mbidv[i] = sos->sos_segv[victimv[i]].sg_mbid;
+
+	mutex_unlock(&sos->sos_lock);
+
+	for (i = 0; i < relocc; i = j) {
+		boff = 0;
+
+		for (j = i; j < relocc; j++) {
+			r = relocv + j;
+
+			if (j > i && boff + r->sr_len > SOS_RELOC_BATCH)
+				break;
+
+			if (!buf || boff + r->sr_len > bufsz) {
+				char *nbuf;
+
+				bufsz = max_t(size_t, boff + r->sr_len,
+					      SOS_RELOC_BATCH);
+
+				nbuf = realloc(buf, bufsz);
+				if (!nbuf) {
+					err = merr(ENOMEM);
+					goto errout;
+				}
+
+				buf = nbuf;
+			}
+
+			for (k = 0; victimv[k] != r->sr_seg; k++)
+				;
+
+			/* Victims are not freed while this pass runs */
+			err = sos_obj_read(sos, mbidv[k], r->sr_key, r->sr_off,
+					   r->sr_len, buf + boff);
+			if (err)
+				goto errout;
+
+			r->sr_buf = boff;
+			boff += r->sr_len;
+		}
+
+		mutex_lock(&sos->sos_lock);
+
+		for (k = i; k < j && !err; k++) {
+			r = relocv + k;
+
+			ent = sos_idx_find(sos, r->sr_key);
+			if (!ent || ent->se_seg != r->sr_seg ||
+			    ent->se_off != r->sr_off)
+				continue;
+
+			err = sos_put_locked(sos, r->sr_key, buf + r->sr_buf,
+					     r->sr_len);
+		}
+
+		mutex_unlock(&sos->sos_lock);
+
+		if (err)
+			goto errout;
+	}
+
+errout:
+	mutex_lock(&sos->sos_lock);
+
+	if (err)
+		goto out;
+
+	/* The relocated objects must be durable before the victims go */
+	err = sos_seg_seal(sos);
+	if (err)
+		goto out;
+
+	for (i = 0; i < victimc; i++) {
+		seg = sos->sos_segv + victimv[i];
+
+		if (seg->sg_live > 0 || seg->sg_readers > 0)
+			continue;
+
+		err = sos_rec_append(sos, SOS_REC_SEGFREE, victimv[i], 0, 0, 0,
+				     true);
+		if (err)
+			goto out;
+
+		err = mpool_mblock_delete(sos->sos_mp, seg->sg_mbid);
+		if (err)
+			mp_pr_err("sos mblock 0x%lx delete failed",
+				  err, (ulong)seg->sg_mbid);
+
+		seg->sg_state = SOS_SEG_FREE;
+	}
+
+	err = sos_mdc_compact(sos);
+
+out:
+	mutex_unlock(&sos->sos_lock);
+	mutex_unlock(&sos->sos_clock);
+
+	free(relocv);
+	free(buf);
+
+	return err;
+}
+
+static void *
+sos_compactor(void *arg)
+{
+	struct mpool_sos   *sos = arg;
+	struct timespec     ts;
+	merr_t              err;
+	u32                 ms;
+
+	ms = sos->sos_params.sp_compact_ms;
+
+	mutex_lock(&sos->sos_lock);
+	while (!sos->sos_closing) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += ms / 1000;
+		ts.tv_nsec += (ms % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+
+		pthread_cond_timedwait(&sos->sos_cv,
+				       &sos->sos_lock.pth_mutex, &ts);
+		if (sos->sos_closing)
+			break;
+
+		mutex_unlock(&sos->sos_lock);
+
+		err = sos_compact(sos);
+		if (err)
+			mp_pr_err("sos compaction failed", err);
+
+		mutex_lock(&sos->sos_lock);
+	}
+	mutex_unlock(&sos->sos_lock);
+
+	return NULL;
+}
+
+/**
+ * sos_replay() - Rebuild the segment table and index from the MDC
+ *
+ * Two passes: the first learns the final state of each segment slot, the
+ * second applies PUT/DEL records that refer to the final, sealed incarnation
+ * of a slot.  Segments that were never sealed are aborted; their objects
+ * are lost.
+ */
+static merr_t
+sos_replay(struct mpool_sos *sos)
+{
+	struct sos_rec_omf  rec;
+	struct sos_seg     *seg;
+	struct sos_ent     *ent;
+	size_t              rdlen;
+	merr_t              err;
+	u32                 pass, segidx, i;
+
+	for (pass = 0; pass < 2; pass++) {
+		err = mpool_mdc_rewind(sos->sos_mdc);
+		if (err)
+			return err;
+
+		while (true) {
+			err = mpool_mdc_read(sos->sos_mdc, &rec, sizeof(rec),
+					     &rdlen);
+			if (err)
+				return err;
+
+			if (rdlen == 0)
+				break;
+
+			if (rdlen != sizeof(rec))
+				return merr(EBADMSG);
+
+			segidx = omf_psr_seg(&rec);
+			seg = NULL;
+
+			if (omf_psr_type(&rec) != SOS_REC_DEL) {
+				seg = sos_seg_get(sos, segidx);
+				if (!seg)
+					return merr(ENOMEM);
+			}
+
+			switch (omf_psr_type(&rec)) {
+			case SOS_REC_SEGOPEN:
+				if (pass > 0) {
+					seg->sg_rmbid = omf_psr_key(&rec);
+					break;
+				}
+				memset(seg, 0, sizeof(*seg));
+				seg->sg_mbid = omf_psr_key(&rec);
+				seg->sg_state = SOS_SEG_ACTIVE;
+				break;
+
+			case SOS_REC_SEGSEAL:
+				if (pass > 0)
+					break;
+				seg->sg_used = omf_psr_off(&rec);
+				seg->sg_state = SOS_SEG_SEALED;
+				break;
+
+			case SOS_REC_SEGFREE:
+				if (pass == 0)
+					seg->sg_state = SOS_SEG_FREE;
+				break;
+
+			case SOS_REC_PUT:
+				/* Skip objects in earlier incarnations of the slot */
+				if (pass == 0 || seg->sg_state != SOS_SEG_SEALED ||
+				    seg->sg_rmbid != seg->sg_mbid)
+					break;
+				err = sos_idx_insert(sos, omf_psr_key(&rec),
+						     segidx, omf_psr_off(&rec),
+						     omf_psr_len(&rec));
+				if (err)
+					return err;
+				break;
+
+			case SOS_REC_DEL:
+				if (pass == 0)
+					break;
+				ent = sos_idx_find(sos, omf_psr_key(&rec));
+				if (ent)
+					sos_idx_remove(sos, ent);
+				break;
+
+			default:
+				return merr(EBADMSG);
+			}
+		}
+	}
+
+	for (i = 0; i < sos->sos_segc; i++) {
+		seg = sos->sos_segv + i;
+
+		if (seg->sg_state != SOS_SEG_ACTIVE)
+			continue;
+
+		/* Partially written segment from a prior session */
+		mpool_mblock_abort(sos->sos_mp, seg->sg_mbid);
+		seg->sg_state = SOS_SEG_FREE;
+	}
+
+	return 0;
+}
+
+uint64_t
+mpool_sos_open(
+	struct mpool                   *mp,
+	uint64_t                        logid1,
+	uint64_t                        logid2,
+	const struct mpool_sos_params  *params,
+	struct mpool_sos              **sosp)
+{
+	struct mpool_mclass_props   mcp;
+	struct mpool_sos           *sos;
+	merr_t                      err;
+
+	if (!mp || !sosp)
+		return merr(EINVAL);
+
+	*sosp = NULL;
+
+	sos = kzalloc(sizeof(*sos), GFP_KERNEL);
+	if (!sos)
+		return merr(ENOMEM);
+
+	mutex_init(&sos->sos_clock);
+	mutex_init(&sos->sos_rlock);
+	mutex_init(&sos->sos_lock);
+	pthread_cond_init(&sos->sos_cv, NULL);
+
+	sos->sos_mp = mp;
+	sos->sos_aseg = SOS_SEG_INVALID;
+
+	if (params) {
+		sos->sos_params = *params;
+	} else {
+		sos->sos_params.sp_mclassp = MP_MED_CAPACITY;
+		sos->sos_params.sp_garbage_pct = SOS_GARBAGE_PCT_DFLT;
+		sos->sos_params.sp_compact_ms = SOS_COMPACT_MS_DFLT;
+	}
+
+	if (sos->sos_params.sp_garbage_pct > 100) {
+		err = merr(EINVAL);
+		goto errout;
+	}
+
+	err = mpool_mclass_get(mp, sos->sos_params.sp_mclassp, &mcp);
+	if (err)
+		goto errout;
+
+	/* Object offsets and lengths are recorded in 32 bits */
+	sos->sos_segsz = min_t(u64, (u64)mcp.mc_mblocksz << 20, SOS_SEGSZ_MAX);
+
+	sos->sos_abuf = aligned_alloc(PAGE_SIZE, sos->sos_segsz);
+	sos->sos_rbuf = aligned_alloc(PAGE_SIZE, SOS_WCHUNK);
+	sos->sos_idxv = kcalloc(SOS_IDX_MIN, sizeof(*sos->sos_idxv),
+				GFP_KERNEL);
+	if (!sos->sos_abuf || !sos->sos_rbuf || !sos->sos_idxv) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	sos->sos_idxsz = SOS_IDX_MIN;
+
+	err = mpool_mdc_open(mp, logid1, logid2, 0, &sos->sos_mdc);
+	if (err)
+		goto errout;
+
+	err = sos_replay(sos);
+	if (err) {
+		mp_pr_err("sos logid 0x%lx 0x%lx replay failed",
+			  err, (ulong)logid1, (ulong)logid2);
+		goto errout;
+	}
+
+	if (sos->sos_params.sp_compact_ms > 0) {
+		if (pthread_create(&sos->sos_thread, NULL, sos_compactor, sos)) {
+			err = merr(EAGAIN);
+			goto errout;
+		}
+		sos->sos_running = true;
+	}
+
+	*sosp = sos;
+
+	return 0;
+
+errout:
+	if (sos->sos_mdc)
+		mpool_mdc_close(sos->sos_mdc);
+	pthread_cond_destroy(&sos->sos_cv);
+	mutex_destroy(&sos->sos_lock);
+	mutex_destroy(&sos->sos_rlock);
+	mutex_destroy(&sos->sos_clock);
+	kfree(sos->sos_idxv);
+	kfree(sos->sos_segv);
+	free(sos->sos_abuf);
+	free(sos->sos_rbuf);
+	kfree(sos);
+
+	return err;
+}
+
+uint64_t
+mpool_sos_close(struct mpool_sos *sos)
+{
+	merr_t err, err2;
+
+	if (!sos)
+		return merr(EINVAL);
+
+	mutex_lock(&sos->sos_lock);
+	sos->sos_closing = true;
+	pthread_cond_signal(&sos->sos_cv);
+	mutex_unlock(&sos->sos_lock);
+
+	if (sos->sos_running)
+		pthread_join(sos->sos_thread, NULL);
+
+	err = sos_seg_seal(sos);
+
+	err2 = mpool_mdc_close(sos->sos_mdc);
+	if (!err)
+		err = err2;
+
+	pthread_cond_destroy(&sos->sos_cv);
+	mutex_destroy(&sos->sos_lock);
+	mutex_destroy(&sos->sos_rlock);
+	mutex_destroy(&sos->sos_clock);
+	kfree(sos->sos_idxv);
+	kfree(sos->sos_segv);
+	free(sos->sos_abuf);
+	free(sos->sos_rbuf);
+	kfree(sos);
+
+	return err;
+}
+
+uint64_t
+mpool_sos_put(
+	struct mpool_sos   *sos,
+	uint64_t            key,
+	const void         *data,
+	size_t              len)
+{
+	merr_t err;
+
+	if (!sos || (!data && len > 0))
+		return merr(EINVAL);
+
+	if (len >= sos->sos_segsz || sos_objsz(len) > sos->sos_segsz)
+		return merr(EFBIG);
+
+	mutex_lock(&sos->sos_lock);
+	err = sos_put_locked(sos, key, data, len);
+	mutex_unlock(&sos->sos_lock);
+
+	return err;
+}
+
+uint64_t
+mpool_sos_get(
+	struct mpool_sos   *sos,
+	uint64_t            key,
+	void               *buf,
+	size_t              bufsz,
+	size_t             *len)
+{
+	struct sos_ent *ent;
+	struct sos_seg *seg;
+	merr_t          err;
+	u32             segidx;
+	u32             off;
+	u64             mbid;
+
+	if (!sos || !len || (!buf && bufsz > 0))
+		return merr(EINVAL);
+
+	mutex_lock(&sos->sos_lock);
+	ent = sos_idx_find(sos, key);
+	if (!ent) {
+		mutex_unlock(&sos->sos_lock);
+		return merr(ENOENT);
+	}
+
+	*len = ent->se_len;
+	if (bufsz < ent->se_len) {
+		mutex_unlock(&sos->sos_lock);
+		return merr(EOVERFLOW);
+	}
+
+	off = ent->se_off;
+	segidx = ent->se_seg;
+	seg = sos->sos_segv + segidx;
+
+	if (seg->sg_state == SOS_SEG_ACTIVE) {
+		memcpy(buf, sos->sos_abuf + off + sizeof(struct sos_objhdr_omf),
+		       *len);
+		mutex_unlock(&sos->sos_lock);
+		return 0;
+	}
+
+	/*
+	 * Pin the segment so the compactor won't free it under us.  A put
+	 * may grow (realloc) sos_segv while the lock is dropped, so only
+	 * the segment index survives across the read.
+	 */
+	mbid = seg->sg_mbid;
+	seg->sg_readers++;
+	mutex_unlock(&sos->sos_lock);
+
+	err = sos_obj_read(sos, mbid, key, off, *len, buf);
+
+	mutex_lock(&sos->sos_lock);
+	sos->sos_segv[segidx].sg_readers--;
+	mutex_unlock(&sos->sos_lock);
+
+	return err;
+}
+
+uint64_t
+mpool_sos_delete(struct mpool_sos *sos, uint64_t key)
+{
+	struct sos_ent *ent;
+	merr_t          err;
+
+	if (!sos)
+		return merr(EINVAL);
+
+	mutex_lock(&sos->sos_lock);
+	ent = sos_idx_find(sos, key);
+	if (!ent) {
+		mutex_unlock(&sos->sos_lock);
+		return merr(ENOENT);
+	}
+
+	err = sos_rec_append(sos, SOS_REC_DEL, SOS_SEG_INVALID, key, 0, 0,
+			     false);
+	if (!err)
+		sos_idx_remove(sos, ent);
+	mutex_unlock(&sos->sos_lock);
+
+	return err;
+}
+
+uint64_t
+mpool_sos_sync(struct mpool_sos *sos)
+{
+	merr_t err;
+
+	if (!sos)
+		return merr(EINVAL);
+
+	mutex_lock(&sos->sos_lock);
+	if (sos->sos_aseg != SOS_SEG_INVALID)
+		err = sos_seg_seal(sos);
+	else
+		err = mpool_mdc_sync(sos->sos_mdc);
+	mutex_unlock(&sos->sos_lock);
+
+	return err;
+}
+
+uint64_t
+mpool_sos_compact(struct mpool_sos *sos)
+{
+	if (!sos)
+		return merr(EINVAL);
+
+	return sos_compact(sos);
+}
@@ -0,0 +1,1512 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Sorted table design pattern module.
+ *
+ * A sorted table is an immutable, sorted set of key/value records built
+ * from a sorted stream and laid out in one or more mblocks:
+ *
+ *   mblock 0 .. N-2:  [block][block]...[block]
+ *   mblock N-1:       [block]...[block][fence index][bloom][pad][trailer]
+ *
+ * Data blocks are a whole number of pages and never straddle mblocks.
+ * Records in a block are grouped into restart groups, each starting on a
+ * cache line boundary with a full key, later keys in the group being
+ * prefix compressed against their predecessor:
+ *
+ *   group:   rec, rec, ..., zero pad to a cache line
+ *   rec:     varint shared, varint unshared, varint vlen, key suffix, value
+ *   block:   group, ..., group, zero pad, restart[] (le16), footer
+ *
+ * where restart[] holds the group offsets in cache lines and the footer
+ * sits at the very end of the block's last page.
+ *
+ * The fence index has one entry per data block giving its location and a
+ * separator key: the shortest prefix of the block's successor's first key
+ * that still sorts after the block's last key.  The optional bloom filter
+ * is split in cache line sized buckets so that a negative lookup touches
+ * a single line.
+ *
+ * Readers map the table with mcache and search the index, bloom filter and
+ * data blocks in place; values are returned as pointers into the map.
+ *
+ * Like mdc.c, this module is layered entirely on the public mpool API.
+ */
+
+#include <string.h>
+#include <sys/uio.h>
+
+#include <util/alloc.h>
+#include <util/atomic.h>
+#include <util/page.h>
+#include <util/minmax.h>
+#include <util/omf.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+#include "logging.h"
+
+#define SST_MAGIC               ((u32)0x53535431)       /* "SST1" */
+#define SST_VERSION             (1)
+#define SST_CLSZ                (64)
+#define SST_BLKSZ_DFLT          (PAGE_SIZE)
+#define SST_BLKSZ_MAX           (1024 * 1024)
+#define SST_RESTART_DFLT        (16)
+#define SST_BLOOM_BITS_MAX      (32)
+#define SST_BLOOM_BUCKET_BITS   (SST_CLSZ * 8)
+#define SST_KEYLEN_MAX          (1024)
+#define SST_VALLEN_MAX          (1024 * 1024)
+#define SST_WBUFSZ              (1024 * 1024)
+
+#define SST_HASH_SEED           (0x9e3779b97f4a7c15ull)
+#define SST_HASH_MUL            (0xc6a4a7935bd1e995ull)
+
+/**
+ * struct sst_blk_omf - data block footer
+ * @pbf_end:  end of the last restart group
+ * @pbf_nrst: number of restart groups
+ */
+struct sst_blk_omf {
+	__le32  pbf_end;
+	__le32  pbf_nrst;
+} __packed;
+
+OMF_SETGET(struct sst_blk_omf, pbf_end, 32)
+OMF_SETGET(struct sst_blk_omf, pbf_nrst, 32)
+
+/**
+ * struct sst_fence_omf - fence index entry
+ * @pfe_koff:  offset of the separator key from the start of the index
+ * @pfe_klen:  separator key length, 0 for the last block
+ * @pfe_mbidx: index of the mblock holding the block
+ * @pfe_pgoff: page offset of the block in its mblock
+ * @pfe_npg:   block length in pages
+ */
+struct sst_fence_omf {
+	__le32  pfe_koff;
+	__le16  pfe_klen;
+	__le16  pfe_mbidx;
+	__le32  pfe_pgoff;
+	__le32  pfe_npg;
+} __packed;
+
+OMF_SETGET(struct sst_fence_omf, pfe_koff, 32)
+OMF_SETGET(struct sst_fence_omf, pfe_klen, 16)
+OMF_SETGET(struct sst_fence_omf, pfe_mbidx, 16)
+OMF_SETGET(struct sst_fence_omf, pfe_pgoff, 32)
+OMF_SETGET(struct sst_fence_omf, pfe_npg, 32)
+
+/**
+ * struct sst_trailer_omf - sorted table trailer
+ * @pst_magic:    SST_MAGIC
+ * @pst_version:  SST_VERSION
+ * @pst_nrecs:    number of records
+ * @pst_nblks:    number of data blocks (and fence entries)
+ * @pst_nmblks:   number of mblocks in the table
+ * @pst_idxoff:   byte offset of the fence index in the last mblock
+ * @pst_idxlen:   length of the fence index including keys
+ * @pst_bloomoff: byte offset of the bloom filter in the last mblock
+ * @pst_nbkts:    number of bloom buckets, 0 if there is no filter
+ * @pst_bloomk:   number of bloom probes per key
+ */
+struct sst_trailer_omf {
+	__le32  pst_magic;
+	__le32  pst_version;
+	__le64  pst_nrecs;
+	__le32  pst_nblks;
+	__le32  pst_nmblks;
+	__le64  pst_idxoff;
+	__le32  pst_idxlen;
+	__le32  pst_rsvd;
+	__le64  pst_bloomoff;
+	__le32  pst_nbkts;
+	__le32  pst_bloomk;
+} __packed;
+
+OMF_SETGET(struct sst_trailer_omf, pst_magic, 32)
+OMF_SETGET(struct sst_trailer_omf, pst_version, 32)
+OMF_SETGET(struct sst_trailer_omf, pst_nrecs, 64)
+OMF_SETGET(struct sst_trailer_omf, pst_nblks, 32)
+OMF_SETGET(struct sst_trailer_omf, pst_nmblks, 32)
+OMF_SETGET(struct sst_trailer_omf, pst_idxoff, 64)
+OMF_SETGET(struct sst_trailer_omf, pst_idxlen, 32)
+OMF_SETGET(struct sst_trailer_omf, pst_bloomoff, 64)
+OMF_SETGET(struct sst_trailer_omf, pst_nbkts, 32)
+OMF_SETGET(struct sst_trailer_omf, pst_bloomk, 32)
+
+struct sst_fence {
+	u32     sf_koff;
+	u16     sf_klen;
+	u16     sf_mbidx;
+	u32     sf_pgoff;
+	u32     sf_npg;
+};
+
+/**
+ * struct mpool_sst_wr - sorted table builder
+ * @sw_mp:       mpool handle
+ * @sw_mclassp:  media class of the table's mblocks
+ * @sw_blksz:    target data block size
+ * @sw_restart:  records per restart group
+ * @sw_bloombits: bloom filter bits per key, 0 for no filter
+ * @sw_mbidv:    mblocks of the table, the last one being written
+ * @sw_mbidc:    number of mblocks in sw_mbidv
+ * @sw_mbidmax:  capacity of sw_mbidv
+ * @sw_committed: number of leading mblocks already committed
+ * @sw_mbcap:    mblock capacity
+ * @sw_mboff:    bytes written to the current mblock (incl. sw_wbuf)
+ * @sw_wbuf:     page-aligned write buffer
+ * @sw_wlen:     bytes in sw_wbuf
+ * @sw_blk:      page-aligned data block being built
+ * @sw_blkcap:   capacity of sw_blk
+ * @sw_blkoff:   bytes used in sw_blk
+ * @sw_rstv:     restart offsets of the block being built, in cache lines
+ * @sw_nrst:     number of restart groups in the block
+ * @sw_grpn:     records in the current restart group
+ * @sw_key:      last key added
+ * @sw_klen:     length of sw_key
+ * @sw_fencev:   fence entries
+ * @sw_fencec:   number of fence entries
+ * @sw_fencemax: capacity of sw_fencev
+ * @sw_fkeys:    fence separator keys
+ * @sw_fklen:    bytes in sw_fkeys
+ * @sw_fkmax:    capacity of sw_fkeys
+ * @sw_hashv:    key hashes for the bloom filter
+ * @sw_hashmax:  capacity of sw_hashv
+ * @sw_nrecs:    records added
+ */
+struct mpool_sst_wr {
+	struct mpool       *sw_mp;
+	u8                  sw_mclassp;
+	u32                 sw_blksz;
+	u32                 sw_restart;
+	u32                 sw_bloombits;
+
+	u64                *sw_mbidv;
+	u32                 sw_mbidc;
+	u32                 sw_mbidmax;
+	u32                 sw_committed;
+	u64                 sw_mbcap;
+	u64                 sw_mboff;
+
+	char               *sw_wbuf;
+	size_t              sw_wlen;
+
+	char               *sw_blk;
+	size_t              sw_blkcap;
+	size_t              sw_blkoff;
+	u16                *sw_rstv;
+	u32                 sw_nrst;
+	u32                 sw_grpn;
+
+	char                sw_key[SST_KEYLEN_MAX];
+	size_t              sw_klen;
+
+	struct sst_fence   *sw_fencev;
+	u32                 sw_fencec;
+	u32                 sw_fencemax;
+	char               *sw_fkeys;
+	size_t              sw_fklen;
+	size_t              sw_fkmax;
+
+	u64                *sw_hashv;
+	u64                 sw_hashmax;
+	u64                 sw_nrecs;
+};
+
+/**
+ * struct mpool_sst - sorted table reader
+ * @st_map:     mcache map of the table's mblocks
+ * @st_basev:   base address of each mapped mblock
+ * @st_mbidc:   number of mblocks
+ * @st_nrecs:   number of records
+ * @st_nblks:   number of data blocks
+ * @st_fencev:  fence index (in the map)
+ * @st_idx:     start of the fence index, base of the separator keys
+ * @st_idxlen:  fence index length
+ * @st_bloom:   bloom filter (in the map), NULL if there is none
+ * @st_nbkts:   number of bloom buckets
+ * @st_bloomk:  bloom probes per key
+ * @st_gets:    lookups
+ * @st_bloomneg: lookups answered by the bloom filter
+ */
+struct mpool_sst {
+	struct mpool_mcache_map        *st_map;
+	char                          **st_basev;
+	u32                             st_mbidc;
+	u64                             st_nrecs;
+	u32                             st_nblks;
+	const struct sst_fence_omf     *st_fencev;
+	const char                     *st_idx;
+	u32                             st_idxlen;
+	const u8                       *st_bloom;
+	u32                             st_nbkts;
+	u32                             st_bloomk;
+	atomic64_t                      st_gets;
+	atomic64_t                      st_bloomneg;
+};
+
+/**
+ * struct mpool_sst_iter - sorted table iterator
+ * @si_sst:   reader handle
+ * @si_blk:   current data block
+ * @si_bend:  end of the current restart group
+ * @si_pos:   next record in the current block
+ * @si_bidx:  index of the current data block
+ * @si_grp:   index of the current restart group
+ * @si_nrst:  restart groups in the current block
+ * @si_rstv:  restart array of the current block
+ * @si_end:   end of the last restart group of the current block
+ * @si_pend:  si_key/si_val hold a record not yet returned
+ * @si_val:   value of the pending record
+ * @si_vlen:  length of si_val
+ * @si_klen:  length of si_key
+ * @si_key:   current key, rebuilt from its prefix compressed form
+ */
+struct mpool_sst_iter {
+	struct mpool_sst   *si_sst;
+	const u8           *si_blk;
+	const u8           *si_bend;
+	const u8           *si_pos;
+	u32                 si_bidx;
+	u32                 si_grp;
+	u32                 si_nrst;
+	const __le16       *si_rstv;
+	u32                 si_end;
+	bool                si_pend;
+	const void         *si_val;
+	size_t              si_vlen;
+	size_t              si_klen;
+	char                si_key[SST_KEYLEN_MAX];
+};
+
+static inline u8 *
+sst_putv(u8 *p, u32 v)
+{
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+
+	return p;
+}
+
+static inline const u8 *
+sst_getv(const u8 *p, const u8 *end, u32 *vp)
+{
+	u32 v = 0;
+	int shift;
+
+	for (shift = 0; shift < 32 && p < end; shift += 7) {
+		u8 b = *p++;
+
+		v |= (u32)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			*vp = v;
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+static inline size_t
+sst_vlen(u32 v)
+{
+	size_t n = 1;
+
+	while (v >= 0x80) {
+		v >>= 7;
+		n++;
+	}
+
+	return n;
+}
+
+static inline int
+sst_keycmp(const void *k1, size_t l1, const void *k2, size_t l2)
+{
+	int rc = memcmp(k1, k2, min_t(size_t, l1, l2));
+
+	return rc ?: (l1 < l2 ? -1 : (l1 > l2));
+}
+
+static u64
+sst_hash(const void *key, size_t len)
+{
+	const u8   *p = key;
+	u64         h = SST_HASH_SEED ^ (len * SST_HASH_MUL);
+	u64         k;
+
+	while (len >= 8) {
+		memcpy(&k, p, sizeof(k));
+		k *= SST_HASH_MUL;
+		k ^= k >> 47;
+		h = (h ^ k * SST_HASH_MUL) * SST_HASH_MUL;
+		p += 8;
+		len -= 8;
+	}
+
+	k = 0;
+	memcpy(&k, p, len);
+	h = (h ^ k) * SST_HASH_MUL;
+
+	h ^= h >> 47;
+	h *= SST_HASH_MUL;
+	h ^= h >> 47;
+
+	return h;
+}
+
+/**
+ * sst_bloom_bucket() - Select the bloom bucket of a key hash
+ *
+ * The high half of the hash picks the bucket, the low half drives the
+ * double hashed probes within it.
+ */
+static inline u32
+sst_bloom_bucket(u64 h, u32 nbkts)
+{
+	return ((h >> 32) * nbkts) >> 32;
+}
+
+static void
+sst_bloom_add(u8 *bkt, u64 h, u32 k)
+{
+	u32 h2 = h, delta = (h2 >> 17) | (h2 << 15);
+	u32 bit;
+
+	while (k-- > 0) {
+		bit = h2 % SST_BLOOM_BUCKET_BITS;
+		bkt[bit / 8] |= 1u << (bit % 8);
+		h2 += delta;
+	}
+}
+
+static bool
+sst_bloom_test(const u8 *bkt, u64 h, u32 k)
+{
+	u32 h2 = h, delta = (h2 >> 17) | (h2 << 15);
+	u32 bit;
+
+	while (k-- > 0) {
+		bit = h2 % SST_BLOOM_BUCKET_BITS;
+		if (!(bkt[bit / 8] & (1u << (bit % 8))))
+			return false;
+		h2 += delta;
+	}
+
+	return true;
+}
+
+/*
+ * Builder
+ */
+
+static merr_t
+sst_wr_flush(struct mpool_sst_wr *wr)
+{
+	struct iovec    iov;
+	merr_t          err;
+
+	if (wr->sw_wlen == 0)
+		return 0;
+
+	iov.iov_base = wr->sw_wbuf;
+	iov.iov_len = wr->sw_wlen;
+
+	err = mpool_mblock_write(wr->sw_mp, wr->sw_mbidv[wr->sw_mbidc - 1],
+				 &iov, 1);
+	if (err)
+		return err;
+
+	wr->sw_wlen = 0;
+
+	return 0;
+}
+
+/**
+ * sst_wr_mblock() - Commit the current mblock and allocate the next one
+ */
+static merr_t
+sst_wr_mblock(struct mpool_sst_wr *wr)
+{
+	struct mblock_props     props;
+	merr_t                  err;
+	u64                     mbid;
+
+	if (wr->sw_mbidc > 0) {
+		err = sst_wr_flush(wr);
+		if (!err)
+			err = mpool_mblock_commit(wr->sw_mp,
+						  wr->sw_mbidv[wr->sw_mbidc - 1]);
+		if (err)
+			return err;
+
+		wr->sw_committed = wr->sw_mbidc;
+	}
+
+	if (wr->sw_mbidc >= U16_MAX)
+		return merr(EFBIG);
+
+	if (wr->sw_mbidc == wr->sw_mbidmax) {
+		u32     mbidmax = max_t(u32, wr->sw_mbidmax * 2, 8);
+		u64    *mbidv;
+
+		mbidv = realloc(wr->sw_mbidv, mbidmax * sizeof(*mbidv));
+		if (!mbidv)
+			return merr(ENOMEM);
+
+		wr->sw_mbidv = mbidv;
+		wr->sw_mbidmax = mbidmax;
+	}
+
+	err = mpool_mblock_alloc(wr->sw_mp, wr->sw_mclassp, false, &mbid,
+				 &props);
+	if (err)
+		return err;
+
+	wr->sw_mbidv[wr->sw_mbidc++] = mbid;
+	wr->sw_mbcap = props.mpr_alloc_cap;
+	wr->sw_mboff = 0;
+
+	return 0;
+}
+
+/**
+ * sst_wr_put() - Append page-aligned data to the current mblock
+ */
+static merr_t
+sst_wr_put(struct mpool_sst_wr *wr, const char *data, size_t len)
+{
+	struct iovec    iov;
+	merr_t          err;
+	size_t          cc;
+
+	if (len > SST_WBUFSZ) {
+		err = sst_wr_flush(wr);
+		if (err)
+			return err;
+
+		iov.iov_base = (void *)data;
+		iov.iov_len = len;
+
+		err = mpool_mblock_write(wr->sw_mp,
+					 wr->sw_mbidv[wr->sw_mbidc - 1],
+					 &iov, 1);
+		if (!err)
+			wr->sw_mboff += len;
+
+		return err;
+	}
+
+	while (len > 0) {
+		cc = min_t(size_t, len, SST_WBUFSZ - wr->sw_wlen);
+
+		memcpy(wr->sw_wbuf + wr->sw_wlen, data, cc);
+		wr->sw_wlen += cc;
+		wr->sw_mboff += cc;
+		data += cc;
+		len -= cc;
+
+		if (wr->sw_wlen == SST_WBUFSZ) {
+			err = sst_wr_flush(wr);
+			if (err)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
+static merr_t
+sst_wr_fkey(struct mpool_sst_wr *wr, const char *key, size_t klen)
+{
+	struct sst_fence *fence = wr->sw_fencev + wr->sw_fencec - 1;
+
+	if (wr->sw_fklen + klen > wr->sw_fkmax) {
+		size_t  fkmax = max_t(size_t, wr->sw_fkmax * 2, 4096);
+		char   *fkeys;
+
+		while (fkmax < wr->sw_fklen + klen)
+			fkmax *= 2;
+
+		fkeys = realloc(wr->sw_fkeys, fkmax);
+		if (!fkeys)
+			return merr(ENOMEM);
+
+		wr->sw_fkeys = fkeys;
+		wr->sw_fkmax = fkmax;
+	}
+
+	memcpy(wr->sw_fkeys + wr->sw_fklen, key, klen);
+	fence->sf_koff = wr->sw_fklen;
+	fence->sf_klen = klen;
+	wr->sw_fklen += klen;
+
+	return 0;
+}
+
+/**
+ * sst_wr_blkfinish() - Seal the data block being built and write it out
+ *
+ * The block's fence entry gets its separator key when the first record
+ * of the next block is added.
+ */
+static merr_t
+sst_wr_blkfinish(struct mpool_sst_wr *wr)
+{
+	struct sst_blk_omf *ftr;
+	struct sst_fence   *fence;
+	merr_t              err;
+	size_t              blklen, rstoff;
+	__le16             *rstv;
+	u32                 i;
+
+	if (wr->sw_nrst == 0)
+		return 0;
+
+	blklen = ALIGN(wr->sw_blkoff + wr->sw_nrst * sizeof(*rstv) +
+		       sizeof(*ftr), PAGE_SIZE);
+	blklen = max_t(size_t, blklen, wr->sw_blksz);
+
+	memset(wr->sw_blk + wr->sw_blkoff, 0, blklen - wr->sw_blkoff);
+
+	ftr = (void *)(wr->sw_blk + blklen - sizeof(*ftr));
+	omf_set_pbf_end(ftr, wr->sw_blkoff);
+	omf_set_pbf_nrst(ftr, wr->sw_nrst);
+
+	rstoff = blklen - sizeof(*ftr) - wr->sw_nrst * sizeof(*rstv);
+	rstv = (void *)(wr->sw_blk + rstoff);
+	for (i = 0; i < wr->sw_nrst; i++)
+		rstv[i] = cpu_to_le16(wr->sw_rstv[i]);
+
+	if (wr->sw_mboff + blklen > wr->sw_mbcap) {
+		err = sst_wr_mblock(wr);
+		if (err)
+			return err;
+
+		if (blklen > wr->sw_mbcap)
+			return merr(EFBIG);
+	}
+
+	if (wr->sw_fencec == wr->sw_fencemax) {
+		u32 fencemax = max_t(u32, wr->sw_fencemax * 2, 256);
+
+		fence = realloc(wr->sw_fencev, fencemax * sizeof(*fence));
+		if (!fence)
+			return merr(ENOMEM);
+
+		wr->sw_fencev = fence;
+		wr->sw_fencemax = fencemax;
+	}
+
+	fence = wr->sw_fencev + wr->sw_fencec++;
+	fence->sf_koff = 0;
+	fence->sf_klen = 0;
+	fence->sf_mbidx = wr->sw_mbidc - 1;
+	fence->sf_pgoff = wr->sw_mboff / PAGE_SIZE;
+	fence->sf_npg = blklen / PAGE_SIZE;
+
+	err = sst_wr_put(wr, wr->sw_blk, blklen);
+	if (err)
+		return err;
+
+	wr->sw_blkoff = 0;
+	wr->sw_nrst = 0;
+	wr->sw_grpn = 0;
+
+	return 0;
+}
+
+static void
+sst_wr_free(struct mpool_sst_wr *wr)
+{
+	free(wr->sw_wbuf);
+	free(wr->sw_blk);
+	free(wr->sw_rstv);
+	free(wr->sw_mbidv);
+	free(wr->sw_fencev);
+	free(wr->sw_fkeys);
+	free(wr->sw_hashv);
+	kfree(wr);
+}
+
+uint64_t
+mpool_sst_create(
+	struct mpool                   *mp,
+	const struct mpool_sst_params  *params,
+	struct mpool_sst_wr           **wrp)
+{
+	struct mpool_sst_wr    *wr;
+	merr_t                  err;
+	u32                     blksz, restart, bloombits;
+	size_t                  rstmax;
+
+	if (!mp || !wrp)
+		return merr(EINVAL);
+
+	blksz = params ? params->sp_blksz : 0;
+	restart = params ? params->sp_restart : 0;
+	bloombits = params ? params->sp_bloom_bits : 0;
+
+	if (blksz == 0)
+		blksz = SST_BLKSZ_DFLT;
+	if (restart == 0)
+		restart = SST_RESTART_DFLT;
+
+	if (blksz > SST_BLKSZ_MAX || !PAGE_ALIGNED(blksz) ||
+	    bloombits > SST_BLOOM_BITS_MAX)
+		return merr(EINVAL);
+
+	wr = kzalloc(sizeof(*wr), GFP_KERNEL);
+	if (!wr)
+		return merr(ENOMEM);
+
+	wr->sw_mp = mp;
+	wr->sw_mclassp = params ? params->sp_mclassp : MP_MED_CAPACITY;
+	wr->sw_blksz = blksz;
+	wr->sw_restart = restart;
+	wr->sw_bloombits = bloombits;
+
+	/* A block must also hold any single record on its own */
+	wr->sw_blkcap = max_t(size_t, blksz,
+			      ALIGN(SST_KEYLEN_MAX + SST_VALLEN_MAX +
+				    SST_CLSZ * 2, PAGE_SIZE));
+	rstmax = wr->sw_blkcap / SST_CLSZ;
+
+	wr->sw_wbuf = aligned_alloc(PAGE_SIZE, SST_WBUFSZ);
+	wr->sw_blk = aligned_alloc(PAGE_SIZE, wr->sw_blkcap);
+	wr->sw_rstv = malloc(rstmax * sizeof(*wr->sw_rstv));
+	if (!wr->sw_wbuf || !wr->sw_blk || !wr->sw_rstv) {
+		sst_wr_free(wr);
+		return merr(ENOMEM);
+	}
+
+	err = sst_wr_mblock(wr);
+	if (err) {
+		sst_wr_free(wr);
+		return err;
+	}
+
+	*wrp = wr;
+
+	return 0;
+}
+
+uint64_t
+mpool_sst_add(
+	struct mpool_sst_wr    *wr,
+	const void             *key,
+	size_t                  klen,
+	const void             *val,
+	size_t                  vlen)
+{
+	merr_t  err;
+	size_t  shared, recsz, need, off;
+	bool    newgrp;
+	u8     *p;
+
+	if (!wr || !key || klen == 0 || klen > SST_KEYLEN_MAX ||
+	    (!val && vlen > 0) || vlen > SST_VALLEN_MAX)
+		return merr(EINVAL);
+
+	if (wr->sw_nrecs > 0 &&
+	    sst_keycmp(wr->sw_key, wr->sw_klen, key, klen) >= 0)
+		return merr(EINVAL);
+
+	if (wr->sw_bloombits > 0) {
+		if (wr->sw_nrecs == wr->sw_hashmax) {
+			u64     hashmax = max_t(u64, wr->sw_hashmax * 2, 1024);
+			u64    *hashv;
+
+			hashv = realloc(wr->sw_hashv, hashmax * sizeof(*hashv));
+			if (!hashv)
+				return merr(ENOMEM);
+
+			wr->sw_hashv = hashv;
+			wr->sw_hashmax = hashmax;
+		}
+	}
+
+again:
+	newgrp = wr->sw_nrst == 0 || wr->sw_grpn >= wr->sw_restart;
+
+	shared = 0;
+	if (!newgrp) {
+		size_t max = min_t(size_t, klen, wr->sw_klen);
+
+		while (shared < max && wr->sw_key[shared] == ((char *)key)[shared])
+			shared++;
+	}
+
+	recsz = sst_vlen(shared) + sst_vlen(klen - shared) + sst_vlen(vlen) +
+		(klen - shared) + vlen;
+
+	off = newgrp ? ALIGN(wr->sw_blkoff, SST_CLSZ) : wr->sw_blkoff;
+	need = off + recsz + (wr->sw_nrst + newgrp) * sizeof(__le16) +
+		sizeof(struct sst_blk_omf);
+
+	if (need > wr->sw_blksz && wr->sw_nrst > 0) {
+		err = sst_wr_blkfinish(wr);
+		if (err)
+			return err;
+
+		goto again;
+	}
+
+	/* First record of a block: give the previous block its separator */
+	if (wr->sw_nrst == 0 && wr->sw_fencec > 0) {
+		size_t cpl = 0, max = min_t(size_t, klen, wr->sw_klen);
+
+		while (cpl < max && wr->sw_key[cpl] == ((char *)key)[cpl])
+			cpl++;
+
+		err = sst_wr_fkey(wr, key, cpl + 1);
+		if (err)
+			return err;
+	}
+
+	if (newgrp) {
+		memset(wr->sw_blk + wr->sw_blkoff, 0, off - wr->sw_blkoff);
+		wr->sw_rstv[wr->sw_nrst++] = off / SST_CLSZ;
+		wr->sw_grpn = 0;
+	}
+
+	p = (u8 *)wr->sw_blk + off;
+	p = sst_putv(p, shared);
+	p = sst_putv(p, klen - shared);
+	p = sst_putv(p, vlen);
+	memcpy(p, (char *)key + shared, klen - shared);
+	p += klen - shared;
+	if (vlen > 0)
+		memcpy(p, val, vlen);
+	p += vlen;
+
+	wr->sw_blkoff = (char *)p - wr->sw_blk;
+	wr->sw_grpn++;
+
+	memcpy(wr->sw_key, key, klen);
+	wr->sw_klen = klen;
+
+	if (wr->sw_bloombits > 0)
+		wr->sw_hashv[wr->sw_nrecs] = sst_hash(key, klen);
+	wr->sw_nrecs++;
+
+	return 0;
+}
+
+uint64_t
+mpool_sst_commit(
+	struct mpool_sst_wr    *wr,
+	uint64_t              **mbidvp,
+	uint32_t               *mbidcp)
+{
+	struct sst_trailer_omf *trl;
+	struct sst_fence_omf   *fomf;
+	merr_t                  err;
+	size_t                  idxlen, bloomoff, metalen;
+	u32                     nbkts = 0, bloomk = 0, i;
+	u64                     idxoff, *mbidv;
+	char                   *meta;
+
+	if (!wr || !mbidvp || !mbidcp)
+		return merr(EINVAL);
+
+	if (wr->sw_nrecs == 0)
+		return merr(ENODATA);
+
+	err = sst_wr_blkfinish(wr);
+	if (err)
+		return err;
+
+	if (wr->sw_bloombits > 0) {
+		u64 nbits = wr->sw_nrecs * wr->sw_bloombits;
+
+		nbkts = (nbits + SST_BLOOM_BUCKET_BITS - 1) /
+			SST_BLOOM_BUCKET_BITS;
+		bloomk = clamp_t(u32, wr->sw_bloombits * 69 / 100, 1, 16);
+	}
+
+	idxlen = wr->sw_fencec * sizeof(*fomf) + wr->sw_fklen;
+	bloomoff = ALIGN(idxlen, SST_CLSZ);
+	metalen = ALIGN(bloomoff + (size_t)nbkts * SST_CLSZ + sizeof(*trl),
+			PAGE_SIZE);
+
+	/* The index, filter and trailer must share the last mblock */
+	if (wr->sw_mboff + metalen > wr->sw_mbcap) {
+		err = sst_wr_mblock(wr);
+		if (err)
+			return err;
+
+		if (metalen > wr->sw_mbcap)
+			return merr(EFBIG);
+	}
+
+	meta = aligned_alloc(PAGE_SIZE, metalen);
+	mbidv = malloc(wr->sw_mbidc * sizeof(*mbidv));
+	if (!meta || !mbidv) {
+		free(meta);
+		free(mbidv);
+		return merr(ENOMEM);
+	}
+
+	memset(meta, 0, metalen);
+
+	fomf = (void *)meta;
+	for (i = 0; i < wr->sw_fencec; i++, fomf++) {
+		struct sst_fence *fence = wr->sw_fencev + i;
+
+		omf_set_pfe_koff(fomf, wr->sw_fencec * sizeof(*fomf) +
+				 fence->sf_koff);
+		omf_set_pfe_klen(fomf, fence->sf_klen);
+		omf_set_pfe_mbidx(fomf, fence->sf_mbidx);
+		omf_set_pfe_pgoff(fomf, fence->sf_pgoff);
+		omf_set_pfe_npg(fomf, fence->sf_npg);
+	}
+	if (wr->sw_fklen > 0)
+		memcpy(fomf, wr->sw_fkeys, wr->sw_fklen);
+
+	for (i = 0; nbkts > 0 && i < wr->sw_nrecs; i++) {
+		u64 h = wr->sw_hashv[i];
+		u8 *bkt = (u8 *)meta + bloomoff +
+			(size_t)sst_bloom_bucket(h, nbkts) * SST_CLSZ;
+
+		sst_bloom_add(bkt, h, bloomk);
+	}
+
+	idxoff = wr->sw_mboff;
+
+	trl = (void *)(meta + metalen - sizeof(*trl));
+	omf_set_pst_magic(trl, SST_MAGIC);
+	omf_set_pst_version(trl, SST_VERSION);
+	omf_set_pst_nrecs(trl, wr->sw_nrecs);
+	omf_set_pst_nblks(trl, wr->sw_fencec);
+	omf_set_pst_nmblks(trl, wr->sw_mbidc);
+	omf_set_pst_idxoff(trl, idxoff);
+	omf_set_pst_idxlen(trl, idxlen);
+	omf_set_pst_bloomoff(trl, nbkts ? idxoff + bloomoff : 0);
+	omf_set_pst_nbkts(trl, nbkts);
+	omf_set_pst_bloomk(trl, bloomk);
+
+	err = sst_wr_put(wr, meta, metalen);
+	if (!err)
+		err = sst_wr_flush(wr);
+	if (!err)
+		err = mpool_mblock_commit(wr->sw_mp,
+					  wr->sw_mbidv[wr->sw_mbidc - 1]);
+	free(meta);
+
+	if (err) {
+		free(mbidv);
+		return err;
+	}
+
+	memcpy(mbidv, wr->sw_mbidv, wr->sw_mbidc * sizeof(*mbidv));
+	*mbidvp = mbidv;
+	*mbidcp = wr->sw_mbidc;
+
+	sst_wr_free(wr);
+
+	return 0;
+}
+
+uint64_t
+mpool_sst_abort(
+	struct mpool_sst_wr    *wr)
+{
+	merr_t  err = 0, err2;
+	u32     i;
+
+	if (!wr)
+		return merr(EINVAL);
+
+	for (i = 0; i < wr->sw_mbidc; i++) {
+		if (i < wr->sw_committed)
+			err2 = mpool_mblock_delete(wr->sw_mp, wr->sw_mbidv[i]);
+		else
+			err2 = mpool_mblock_abort(wr->sw_mp, wr->sw_mbidv[i]);
+
+		if (err2 && !err)
+			err = err2;
+	}
+
+	sst_wr_free(wr);
+
+	return err;
+}
+
+/*
+ * Reader
+ */
+
+uint64_t
+mpool_sst_open(
+	struct mpool           *mp,
+	uint32_t                mbidc,
+	uint64_t               *mbidv,
+	enum mpc_vma_advice     advice,
+	struct mpool_sst      **sstp)
+{
+	const struct sst_trailer_omf   *trl;
+	const struct sst_fence_omf     *fomf;
+	struct mblock_props             props;
+	struct mpool_sst               *sst;
+	merr_t                          err;
+	u64                             idxoff, bloomoff, wlen;
+	u32                             i, mbidx, nbkts;
+
+	if (!mp || !mbidv || mbidc == 0 || !sstp)
+		return merr(EINVAL);
+
+	err = mpool_mblock_getprops(mp, mbidv[mbidc - 1], &props);
+	if (err)
+		return err;
+
+	wlen = props.mpr_write_len;
+	if (!props.mpr_iscommitted || wlen < PAGE_SIZE || !PAGE_ALIGNED(wlen))
+		return merr(EINVAL);
+
+	sst = kzalloc(sizeof(*sst), GFP_KERNEL);
+	if (!sst)
+		return merr(ENOMEM);
+
+	sst->st_mbidc = mbidc;
+	atomic64_set(&sst->st_gets, 0);
+	atomic64_set(&sst->st_bloomneg, 0);
+
+	sst->st_basev = calloc(mbidc, sizeof(*sst->st_basev));
+	if (!sst->st_basev) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	err = mpool_mcache_mmap(mp, mbidc, mbidv, advice, &sst->st_map);
+	if (err)
+		goto errout;
+
+	/* Searches run in place, so each mblock must be mapped contiguously */
+	for (i = 0; i < mbidc; i++) {
+		sst->st_basev[i] = mpool_mcache_getbase(sst->st_map, i);
+		if (!sst->st_basev[i]) {
+			err = merr(EOPNOTSUPP);
+			goto errout;
+		}
+	}
+
+	trl = (void *)(sst->st_basev[mbidc - 1] + wlen - sizeof(*trl));
+
+	if (omf_pst_magic(trl) != SST_MAGIC ||
+	    omf_pst_version(trl) != SST_VERSION ||
+	    omf_pst_nmblks(trl) != mbidc) {
+		err = merr(EBADMSG);
+		goto errout;
+	}
+
+	sst->st_nrecs = omf_pst_nrecs(trl);
+	sst->st_nblks = omf_pst_nblks(trl);
+	sst->st_idxlen = omf_pst_idxlen(trl);
+	sst->st_bloomk = omf_pst_bloomk(trl);
+	nbkts = omf_pst_nbkts(trl);
+	idxoff = omf_pst_idxoff(trl);
+	bloomoff = omf_pst_bloomoff(trl);
+
+	if (sst->st_nblks == 0 || idxoff + sst->st_idxlen > wlen ||
+	    (u64)sst->st_nblks * sizeof(*fomf) > sst->st_idxlen ||
+	    (nbkts > 0 && (bloomoff % SST_CLSZ ||
+			   bloomoff + (u64)nbkts * SST_CLSZ > wlen))) {
+		err = merr(EBADMSG);
+		goto errout;
+	}
+
+	sst->st_idx = sst->st_basev[mbidc - 1] + idxoff;
+	sst->st_fencev = (const void *)sst->st_idx;
+
+	if (nbkts > 0) {
+		sst->st_bloom = (u8 *)sst->st_basev[mbidc - 1] + bloomoff;
+		sst->st_nbkts = nbkts;
+	}
+
+	/* Validate the index once so that searches need not */
+	for (i = 0; i < sst->st_nblks; i++) {
+		fomf = sst->st_fencev + i;
+		mbidx = omf_pfe_mbidx(fomf);
+
+		if (mbidx >= mbidc || omf_pfe_npg(fomf) == 0 ||
+		    (u64)omf_pfe_koff(fomf) + omf_pfe_klen(fomf) >
+		    sst->st_idxlen ||
+		    (omf_pfe_klen(fomf) == 0) != (i == sst->st_nblks - 1)) {
+			err = merr(EBADMSG);
+			goto errout;
+		}
+	}
+
+	/* Blocks in the last mblock must end before the fence index */
+	for (mbidx = 0; mbidx < mbidc; mbidx++) {
+		if (mbidx < mbidc - 1) {
+			err = mpool_mblock_getprops(mp, mbidv[mbidx], &props);
+			if (err)
+				goto errout;
+
+			wlen = props.mpr_write_len;
+		} else {
+			wlen = idxoff;
+		}
+
+		for (i = 0; i < sst->st_nblks; i++) {
+			fomf = sst->st_fencev + i;
+
+			if (omf_pfe_mbidx(fomf) == mbidx &&
+			    ((u64)omf_pfe_pgoff(fomf) + omf_pfe_npg(fomf)) *
+			    PAGE_SIZE > wlen) {
+				err = merr(EBADMSG);
+				goto errout;
+			}
+		}
+	}
+
+	*sstp = sst;
+
+	return 0;
+
+errout:
+	if (sst->st_map)
+		mpool_mcache_munmap(sst->st_map);
+	free(sst->st_basev);
+	kfree(sst);
+
+	return err;
+}
+
+uint64_t
+mpool_sst_close(
+	struct mpool_sst   *sst)
+{
+	merr_t err;
+
+	if (!sst)
+		return merr(EINVAL);
+
+	err = mpool_mcache_munmap(sst->st_map);
+
+	free(sst->st_basev);
+	kfree(sst);
+
+	return err;
+}
+
+/**
+ * sst_fence_search() - Find the data block that may hold a key
+ *
+ * Returns the first block whose separator sorts after the key, the last
+ * block having no separator.
+ */
+static u32
+sst_fence_search(struct mpool_sst *sst, const void *key, size_t klen)
+{
+	const struct sst_fence_omf *fomf;
+	u32                         lo = 0, hi = sst->st_nblks - 1, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		fomf = sst->st_fencev + mid;
+
+		if (sst_keycmp(key, klen, sst->st_idx + omf_pfe_koff(fomf),
+			       omf_pfe_klen(fomf)) < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return lo;
+}
+
+/**
+ * sst_blk_get() - Get the address of a data block through mcache
+ *
+ * Fetching the first page through mpool_mcache_getpagesv() lets the map's
+ * readahead follow block accesses; the rest of the block is contiguous.
+ *
+ * Return: the block, or NULL if it cannot be read or its footer or restart
+ * offsets point outside of it
+ */
+static const u8 *
+sst_blk_get(
+	struct mpool_sst   *sst,
+	u32                 bidx,
+	u32                *nrstp,
+	const __le16      **rstvp,
+	u32                *endp)
+{
+	const struct sst_fence_omf *fomf = sst->st_fencev + bidx;
+	const struct sst_blk_omf   *ftr;
+	const __le16               *rstv;
+	size_t                      pgoff, blklen;
+	void                       *page;
+	uint                        mbidx;
+	u32                         nrst, end, off, prev, i;
+	merr_t                      err;
+
+	mbidx = omf_pfe_mbidx(fomf);
+	pgoff = omf_pfe_pgoff(fomf);
+	blklen = (size_t)omf_pfe_npg(fomf) * PAGE_SIZE;
+
+	err = mpool_mcache_getpagesv(sst->st_map, 1, &mbidx, &pgoff, &page);
+	if (err)
+		return NULL;
+
+	if (blklen > PAGE_SIZE)
+		mpool_mcache_access(sst->st_map, mbidx, (pgoff + 1) * PAGE_SIZE,
+				    blklen - PAGE_SIZE);
+
+	ftr = (const void *)((u8 *)page + blklen - sizeof(*ftr));
+	nrst = omf_pbf_nrst(ftr);
+	end = omf_pbf_end(ftr);
+
+	if (nrst == 0 || end + nrst * sizeof(__le16) + sizeof(*ftr) > blklen)
+		return NULL;
+
+	/* Groups must start in order within the records of the block */
+	rstv = (const __le16 *)ftr - nrst;
+
+	for (i = 0, prev = 0; i < nrst; i++, prev = off) {
+		off = le16_to_cpu(rstv[i]) * SST_CLSZ;
+		if (off < prev || off >= end)
+			return NULL;
+	}
+
+	*nrstp = nrst;
+	*rstvp = rstv;
+	*endp = end;
+
+	return page;
+}
+
+/**
+ * sst_rec_next() - Decode the record at @p into @kbuf
+ *
+ * Return: the next record, or NULL at the end of the group
+ */
+static const u8 *
+sst_rec_next(
+	const u8       *p,
+	const u8       *end,
+	char           *kbuf,
+	size_t         *klenp,
+	const void    **valp,
+	size_t         *vlenp)
+{
+	u32 shared, unshared, vlen;
+
+	if (p >= end)
+		return NULL;
+
+	p = sst_getv(p, end, &shared);
+	if (p)
+		p = sst_getv(p, end, &unshared);
+	if (p)
+		p = sst_getv(p, end, &vlen);
+
+	/* Zero padding decodes as an empty suffix */
+	if (!p || unshared == 0 || shared > *klenp ||
+	    shared + unshared > SST_KEYLEN_MAX || unshared + vlen > end - p)
+		return NULL;
+
+	memcpy(kbuf + shared, p, unshared);
+	*klenp = shared + unshared;
+	*valp = p + unshared;
+	*vlenp = vlen;
+
+	return p + unshared + vlen;
+}
+
+static inline const u8 *
+sst_grp_end(const u8 *blk, const __le16 *rstv, u32 nrst, u32 end, u32 grp)
+{
+	return blk + (grp + 1 < nrst ? le16_to_cpu(rstv[grp + 1]) * SST_CLSZ :
+		      end);
+}
+
+/**
+ * sst_rst_search() - Find the last restart group whose first key is <= key
+ *
+ * Each probe touches a single cache line.
+ *
+ * Return: group index, or -1 if the block is malformed
+ */
+static int
+sst_rst_search(
+	const u8           *blk,
+	const __le16       *rstv,
+	u32                 nrst,
+	u32                 end,
+	const void         *key,
+	size_t              klen)
+{
+	const void *val;
+	const u8   *p;
+	char        kbuf[SST_KEYLEN_MAX];
+	size_t      kblen, vlen;
+	u32         lo = 0, hi = nrst, mid;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		kblen = 0;
+
+		p = sst_rec_next(blk + le16_to_cpu(rstv[mid]) * SST_CLSZ,
+				 blk + end, kbuf, &kblen, &val, &vlen);
+		if (!p)
+			return -1;
+
+		if (sst_keycmp(kbuf, kblen, key, klen) <= 0)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+uint64_t
+mpool_sst_get(
+	struct mpool_sst   *sst,
+	const void         *key,
+	size_t              klen,
+	const void        **valp,
+	size_t             *vlenp)
+{
+	const __le16   *rstv;
+	const u8       *blk, *p, *gend;
+	const void     *val;
+	char            kbuf[SST_KEYLEN_MAX];
+	size_t          kblen, vlen;
+	u32             nrst, end, bidx;
+	int             grp, rc;
+
+	if (!sst || !key || klen == 0 || klen > SST_KEYLEN_MAX || !valp ||
+	    !vlenp)
+		return merr(EINVAL);
+
+	atomic64_inc(&sst->st_gets);
+
+	if (sst->st_bloom) {
+		u64 h = sst_hash(key, klen);
+		u32 bkt = sst_bloom_bucket(h, sst->st_nbkts);
+
+		if (!sst_bloom_test(sst->st_bloom + (size_t)bkt * SST_CLSZ,
+				    h, sst->st_bloomk)) {
+			atomic64_inc(&sst->st_bloomneg);
+			return merr(ENOENT);
+		}
+	}
+
+	bidx = sst_fence_search(sst, key, klen);
+
+	blk = sst_blk_get(sst, bidx, &nrst, &rstv, &end);
+	if (!blk)
+		return merr(EBADMSG);
+
+	grp = sst_rst_search(blk, rstv, nrst, end, key, klen);
+	if (grp < 0)
+		return merr(EBADMSG);
+
+	p = blk + le16_to_cpu(rstv[grp]) * SST_CLSZ;
+	gend = sst_grp_end(blk, rstv, nrst, end, grp);
+	kblen = 0;
+
+	while ((p = sst_rec_next(p, gend, kbuf, &kblen, &val, &vlen))) {
+		rc = sst_keycmp(kbuf, kblen, key, klen);
+		if (rc == 0) {
+			*valp = val;
+			*vlenp = vlen;
+			return 0;
+		}
+
+		if (rc > 0)
+			break;
+	}
+
+	return merr(ENOENT);
+}
+
+/**
+ * sst_iter_blk() - Position an iterator at the start of a data block
+ */
+static merr_t
+sst_iter_blk(struct mpool_sst_iter *it, u32 bidx)
+{
+	it->si_bidx = bidx;
+	it->si_blk = NULL;
+
+	if (bidx >= it->si_sst->st_nblks)
+		return 0;
+
+	it->si_blk = sst_blk_get(it->si_sst, bidx, &it->si_nrst, &it->si_rstv,
+				 &it->si_end);
+	if (!it->si_blk)
+		return merr(EBADMSG);
+
+	it->si_grp = 0;
+	it->si_pos = it->si_blk;
+	it->si_bend = sst_grp_end(it->si_blk, it->si_rstv, it->si_nrst,
+				  it->si_end, 0);
+	it->si_klen = 0;
+
+	return 0;
+}
+
+uint64_t
+mpool_sst_iter_next(
+	struct mpool_sst_iter  *it,
+	const void            **keyp,
+	size_t                 *klenp,
+	const void            **valp,
+	size_t                 *vlenp,
+	bool                   *eofp)
+{
+	const u8   *p;
+	merr_t      err;
+
+	if (!it || !keyp || !klenp || !valp || !vlenp || !eofp)
+		return merr(EINVAL);
+
+	if (it->si_pend) {
+		it->si_pend = false;
+		*keyp = it->si_key;
+		*klenp = it->si_klen;
+		*valp = it->si_val;
+		*vlenp = it->si_vlen;
+		*eofp = false;
+		return 0;
+	}
+
+	while (it->si_blk) {
+		p = sst_rec_next(it->si_pos, it->si_bend, it->si_key,
+				 &it->si_klen, valp, vlenp);
+		if (p) {
+			it->si_pos = p;
+			*keyp = it->si_key;
+			*klenp = it->si_klen;
+			*eofp = false;
+			return 0;
+		}
+
+		if (++it->si_grp < it->si_nrst) {
+			it->si_pos = it->si_blk +
+				le16_to_cpu(it->si_rstv[it->si_grp]) * SST_CLSZ;
+			it->si_bend = sst_grp_end(it->si_blk, it->si_rstv,
+						  it->si_nrst, it->si_end,
+						  it->si_grp);
+			it->si_klen = 0;
+			continue;
+		}
+
+		err = sst_iter_blk(it, it->si_bidx + 1);
+		if (err)
+			return err;
+	}
+
+	*eofp = true;
+
+	return 0;
+}
+
+uint64_t
+mpool_sst_iter_create(
+	struct mpool_sst           *sst,
+	const void                 *seek,
+	size_t                      seeklen,
+	struct mpool_sst_iter     **itp)
+{
+	struct mpool_sst_iter  *it;
+	merr_t                  err;
+	const void             *key;
+	size_t                  klen;
+	bool                    eof;
+	int                     grp;
+
+	if (!sst || !itp || seeklen > SST_KEYLEN_MAX || (!seek && seeklen))
+		return merr(EINVAL);
+
+	it = kzalloc(sizeof(*it), GFP_KERNEL);
+	if (!it)
+		return merr(ENOMEM);
+
+	it->si_sst = sst;
+
+	err = sst_iter_blk(it, seeklen ? sst_fence_search(sst, seek,
+							  seeklen) : 0);
+	if (err || seeklen == 0)
+		goto out;
+
+	grp = sst_rst_search(it->si_blk, it->si_rstv, it->si_nrst,
+			     it->si_end, seek, seeklen);
+	if (grp < 0) {
+		err = merr(EBADMSG);
+		goto out;
+	}
+
+	it->si_grp = grp;
+	it->si_pos = it->si_blk + le16_to_cpu(it->si_rstv[grp]) * SST_CLSZ;
+	it->si_bend = sst_grp_end(it->si_blk, it->si_rstv, it->si_nrst,
+				  it->si_end, grp);
+
+	/* Skip the records that sort before the seek key, and hold on to
+	 * the first one that does not for the first mpool_sst_iter_next().
+	 */
+	do {
+		err = mpool_sst_iter_next(it, &key, &klen, &it->si_val,
+					  &it->si_vlen, &eof);
+		if (err || eof)
+			goto out;
+	} while (sst_keycmp(key, klen, seek, seeklen) < 0);
+
+	it->si_pend = true;
+
+out:
+	if (err) {
+		kfree(it);
+		return err;
+	}
+
+	*itp = it;
+
+	return 0;
+}
+
+uint64_t
+mpool_sst_iter_destroy(
+	struct mpool_sst_iter  *it)
+{
+	if (!it)
+		return merr(EINVAL);
+
+	kfree(it);
+
+	return 0;
+}
+
+uint64_t
+mpool_sst_getprops(
+	struct mpool_sst           *sst,
+	struct mpool_sst_props     *props)
+{
+	if (!sst || !props)
+		return merr(EINVAL);
+
+	memset(props, 0, sizeof(*props));
+
+	props->ssp_nrecs = sst->st_nrecs;
+	props->ssp_nblocks = sst->st_nblks;
+	props->ssp_nmblocks = sst->st_mbidc;
+	props->ssp_idxlen = sst->st_idxlen;
+	props->ssp_bloomlen = sst->st_nbkts * SST_CLSZ;
+	props->ssp_gets = atomic64_read(&sst->st_gets);
+	props->ssp_bloom_negatives = atomic64_read(&sst->st_bloomneg);
+
+	return 0;
+}
@@ -0,0 +1,782 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Striped mblock design pattern module.
+ *
+ * A stripe group is a set of mpools opened together.  A striped mblock is
+ * a set of real mblocks, one per member mpool, presented as a single logical
+ * object whose address space is laid out round-robin across the members in
+ * units of sg_unitsz bytes.  Reads and writes are split per member and issued
+ * concurrently by a pool of I/O threads owned by the stripe group.
+ *
+ * Layered on the public mblock API; does not assume any knowledge of the
+ * mblock implementation.
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#ifndef IOV_MAX
+#ifdef __IOV_MAX
+#define IOV_MAX __IOV_MAX
+#else
+#define IOV_MAX 1024
+#endif
+#endif
+
+#include <util/alloc.h>
+#include <util/page.h>
+#include <util/minmax.h>
+#include <util/mutex.h>
+#include <util/list.h>
+
+#include <mpool/mpool.h>
+
+#include "mpool_err.h"
+#include "logging.h"
+
+#define STRIPE_UNITSZ_DFLT      (1024 * 1024)
+
+/**
+ * struct mpool_stripe_grp - stripe group
+ * @sg_mpv:    member mpool handles
+ * @sg_mpc:    number of members (stripe width)
+ * @sg_unitsz: stripe unit size in bytes
+ * @sg_lock:   protects @sg_ioq, @sg_stop and the pending counts of the
+ *             queued I/Os
+ * @sg_iocv:   wakes up the I/O threads
+ * @sg_donecv: signaled when the last queued member I/O of a request is done
+ * @sg_ioq:    member I/Os waiting for an I/O thread
+ * @sg_tidv:   I/O threads, one per member but the first
+ * @sg_tidc:   number of I/O threads running
+ * @sg_stop:   I/O threads should exit
+ */
+struct mpool_stripe_grp {
+	struct mpool       *sg_mpv[MPOOL_STRIPE_WIDTH_MAX];
+	u32                 sg_mpc;
+	u32                 sg_unitsz;
+
+	struct mutex        sg_lock;
+	pthread_cond_t      sg_iocv;
+	pthread_cond_t      sg_donecv;
+	struct list_head    sg_ioq;
+	pthread_t           sg_tidv[MPOOL_STRIPE_WIDTH_MAX];
+	u32                 sg_tidc;
+	bool                sg_stop;
+};
+
+/**
+ * struct mpool_stripe - striped mblock handle
+ * @st_lock:      serializes writes, commit, abort and delete
+ * @st_grp:       stripe group
+ * @st_mbidv:     member mblock IDs, indexed like sg_mpv[]
+ * @st_len:       logical bytes written
+ * @st_committed: all members have been committed
+ * @st_dead:      a partial commit failed and the members were destroyed
+ */
+struct mpool_stripe {
+	struct mutex                st_lock;
+	struct mpool_stripe_grp    *st_grp;
+	u64                         st_mbidv[MPOOL_STRIPE_WIDTH_MAX];
+	u64                         st_len;
+	bool                        st_committed;
+	bool                        st_dead;
+};
+
+/**
+ * struct stripe_io - per-member portion of a striped read or write
+ * @sio_link:    link on sg_ioq
+ * @sio_pending: queued member I/Os of the request not yet done
+ */
+struct stripe_io {
+	struct mpool       *sio_mp;
+	u64                 sio_mbid;
+	struct iovec       *sio_iov;
+	int                 sio_iovc;
+	size_t              sio_off;
+	bool                sio_read;
+	merr_t              sio_err;
+	struct list_head    sio_link;
+	u32                *sio_pending;
+};
+
+/**
+ * stripe_member_len() - Bytes held by member @idx for a logical length @len
+ */
+static u64
+stripe_member_len(struct mpool_stripe_grp *grp, u64 len, u32 idx)
+{
+	u64 rowsz, rows, rem;
+
+	rowsz = (u64)grp->sg_unitsz * grp->sg_mpc;
+	rows = len / rowsz;
+	rem = len % rowsz;
+
+	rem = (rem > (u64)idx * grp->sg_unitsz) ?
+		min_t(u64, rem - (u64)idx * grp->sg_unitsz, grp->sg_unitsz) : 0;
+
+	return rows * grp->sg_unitsz + rem;
+}
+
+/**
+ * stripe_split() - Split a logical iovec into per-member iovecs
+ * @grp:   stripe group
+ * @iov:   logical iovec
+ * @iovc:  logical iovec count
+ * @loff:  logical offset of iov[0]
+ * @siov:  per-member I/O descriptors (output)
+ *
+ * Each member's share of a contiguous logical range is itself contiguous
+ * in the member mblock, so one offset per member suffices.
+ */
+static void
+stripe_split(
+	struct mpool_stripe_grp    *grp,
+	const struct iovec         *iov,
+	int                         iovc,
+	u64                         loff,
+	struct stripe_io           *siov)
+{
+	struct stripe_io   *sio;
+	size_t              done, chunk, inunit;
+	u64                 unit;
+	int                 i;
+
+	for (i = 0; i < iovc; i++) {
+		for (done = 0; done < iov[i].iov_len; done += chunk) {
+			unit = loff / grp->sg_unitsz;
+			inunit = loff % grp->sg_unitsz;
+			chunk = min_t(size_t, iov[i].iov_len - done,
+				      grp->sg_unitsz - inunit);
+
+			sio = siov + (unit % grp->sg_mpc);
+			if (sio->sio_iovc == 0)
+				sio->sio_off = (unit / grp->sg_mpc) *
+					grp->sg_unitsz + inunit;
+
+			sio->sio_iov[sio->sio_iovc].iov_base =
+				(char *)iov[i].iov_base + done;
+			sio->sio_iov[sio->sio_iovc].iov_len = chunk;
+			sio->sio_iovc++;
+
+			loff += chunk;
+		}
+	}
+}
+
+static void
+stripe_io_run(struct stripe_io *sio)
+{
+	struct iovec       *iov = sio->sio_iov;
+	size_t              off = sio->sio_off;
+	merr_t              err = 0;
+	int                 left, cnt, i;
+
+	for (left = sio->sio_iovc; left > 0 && !err; left -= cnt) {
+		cnt = min_t(int, left, IOV_MAX);
+
+		if (sio->sio_read)
+			err = mpool_mblock_read(sio->sio_mp, sio->sio_mbid,
+						iov, cnt, off);
+		else
+			err = mpool_mblock_write(sio->sio_mp, sio->sio_mbid,
+						 iov, cnt);
+
+		for (i = 0; i < cnt; i++)
+			off += iov[i].iov_len;
+		iov += cnt;
+	}
+
+	sio->sio_err = err;
+}
+
+/**
+ * stripe_worker() - Issue queued member I/Os until the group is closed
+ */
+static void *
+stripe_worker(void *arg)
+{
+	struct mpool_stripe_grp    *grp = arg;
+	struct stripe_io           *sio;
+
+	mutex_lock(&grp->sg_lock);
+	while (true) {
+		sio = list_first_entry_or_null(&grp->sg_ioq, struct stripe_io,
+					       sio_link);
+		if (!sio) {
+			if (grp->sg_stop)
+				break;
+
+			pthread_cond_wait(&grp->sg_iocv,
+					  &grp->sg_lock.pth_mutex);
+			continue;
+		}
+
+		list_del(&sio->sio_link);
+		mutex_unlock(&grp->sg_lock);
+
+		stripe_io_run(sio);
+
+		/* The submitter may free @sio as soon as it sees zero */
+		mutex_lock(&grp->sg_lock);
+		if (--*sio->sio_pending == 0)
+			pthread_cond_broadcast(&grp->sg_donecv);
+	}
+	mutex_unlock(&grp->sg_lock);
+
+	return NULL;
+}
+
+/**
+ * stripe_io() - Issue a striped read or write
+ *
+ * Member I/Os run concurrently, the first one in the caller's thread and
+ * the others on the group's I/O threads.
+ */
+static merr_t
+stripe_io(
+	struct mpool_stripe    *st,
+	const struct iovec     *iov,
+	int                     iovc,
+	u64                     loff,
+	u64                     len,
+	bool                    read)
+{
+	struct mpool_stripe_grp    *grp = st->st_grp;
+	struct stripe_io           *siov, *sio, *first = NULL;
+	struct iovec               *iobuf;
+	merr_t                      err = 0;
+	size_t                      iomax;
+	u32                         i, pending = 0;
+
+	iomax = iovc + len / grp->sg_unitsz + 1;
+
+	siov = kcalloc(grp->sg_mpc, sizeof(*siov), GFP_KERNEL);
+	iobuf = kcalloc(grp->sg_mpc * iomax, sizeof(*iobuf), GFP_KERNEL);
+	if (!siov || !iobuf) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	for (i = 0; i < grp->sg_mpc; i++) {
+		siov[i].sio_mp = grp->sg_mpv[i];
+		siov[i].sio_mbid = st->st_mbidv[i];
+		siov[i].sio_iov = iobuf + i * iomax;
+		siov[i].sio_read = read;
+	}
+
+	stripe_split(grp, iov, iovc, loff, siov);
+
+	mutex_lock(&grp->sg_lock);
+	for (i = 0; i < grp->sg_mpc; i++) {
+		sio = siov + i;
+		if (sio->sio_iovc == 0)
+			continue;
+
+		if (!first) {
+			first = sio;
+			continue;
+		}
+
+		sio->sio_pending = &pending;
+		list_add_tail(&sio->sio_link, &grp->sg_ioq);
+		pending++;
+	}
+
+	if (pending > 0)
+		pthread_cond_broadcast(&grp->sg_iocv);
+	mutex_unlock(&grp->sg_lock);
+
+	if (first)
+		stripe_io_run(first);
+
+	mutex_lock(&grp->sg_lock);
+	while (pending > 0)
+		pthread_cond_wait(&grp->sg_donecv, &grp->sg_lock.pth_mutex);
+	mutex_unlock(&grp->sg_lock);
+
+	for (i = 0; i < grp->sg_mpc; i++) {
+		if (siov[i].sio_err && !err) {
+			err = siov[i].sio_err;
+			mp_pr_err("stripe %s member %u mblock 0x%lx failed",
+				  err, read ? "read" : "write", i,
+				  (ulong)siov[i].sio_mbid);
+		}
+	}
+
+errout:
+	kfree(iobuf);
+	kfree(siov);
+
+	return err;
+}
+
+static merr_t
+stripe_iov_len(const struct iovec *iov, int iovc, u64 *lenp)
+{
+	u64 len = 0;
+	int i;
+
+	if (!iov || iovc <= 0)
+		return merr(EINVAL);
+
+	/* Member I/Os are cut from the iovecs, so each must be aligned */
+	for (i = 0; i < iovc; i++) {
+		if (!PAGE_ALIGNED(iov[i].iov_base) ||
+		    !PAGE_ALIGNED(iov[i].iov_len))
+			return merr(EINVAL);
+
+		len += iov[i].iov_len;
+	}
+
+	*lenp = len;
+
+	return 0;
+}
+
+/**
+ * stripe_grp_free() - Stop the I/O threads and close the member mpools
+ */
+static merr_t
+stripe_grp_free(struct mpool_stripe_grp *grp)
+{
+	merr_t  err = 0, err2;
+	u32     i;
+
+	mutex_lock(&grp->sg_lock);
+	grp->sg_stop = true;
+	pthread_cond_broadcast(&grp->sg_iocv);
+	mutex_unlock(&grp->sg_lock);
+
+	for (i = 0; i < grp->sg_tidc; i++)
+		pthread_join(grp->sg_tidv[i], NULL);
+
+	for (i = 0; i < grp->sg_mpc; i++) {
+		err2 = mpool_close(grp->sg_mpv[i]);
+		if (err2 && !err)
+			err = err2;
+	}
+
+	pthread_cond_destroy(&grp->sg_donecv);
+	pthread_cond_destroy(&grp->sg_iocv);
+	mutex_destroy(&grp->sg_lock);
+	kfree(grp);
+
+	return err;
+}
+
+uint64_t
+mpool_stripe_grp_open(
+	const char                    **mpnamev,
+	uint32_t                        mpc,
+	uint32_t                        flags,
+	uint32_t                        unitsz,
+	struct mpool_stripe_grp       **grpp,
+	struct mpool_devrpt            *ei)
+{
+	struct mpool_stripe_grp    *grp;
+	merr_t                      err = 0;
+	u32                         i;
+
+	if (!mpnamev || !grpp || mpc == 0 || mpc > MPOOL_STRIPE_WIDTH_MAX)
+		return merr(EINVAL);
+
+	if (unitsz == 0)
+		unitsz = STRIPE_UNITSZ_DFLT;
+
+	if (!PAGE_ALIGNED(unitsz))
+		return merr(EINVAL);
+
+	grp = kzalloc(sizeof(*grp), GFP_KERNEL);
+	if (!grp)
+		return merr(ENOMEM);
+
+	for (i = 0; i < mpc; i++) {
+		err = mpool_open(mpnamev[i], flags, &grp->sg_mpv[i], ei);
+		if (err) {
+			mp_pr_err("stripe group member %s open failed",
+				  err, mpnamev[i]);
+			break;
+		}
+	}
+
+	if (err) {
+		while (i-- > 0)
+			mpool_close(grp->sg_mpv[i]);
+		kfree(grp);
+		return err;
+	}
+
+	grp->sg_mpc = mpc;
+	grp->sg_unitsz = unitsz;
+
+	mutex_init(&grp->sg_lock);
+	pthread_cond_init(&grp->sg_iocv, NULL);
+	pthread_cond_init(&grp->sg_donecv, NULL);
+	INIT_LIST_HEAD(&grp->sg_ioq);
+
+	for (i = 1; i < mpc; i++) {
+		if (pthread_create(&grp->sg_tidv[grp->sg_tidc], NULL,
+				   stripe_worker, grp)) {
+			err = merr(EAGAIN);
+			mp_pr_err("stripe group I/O thread create failed", err);
+			stripe_grp_free(grp);
+			return err;
+		}
+		grp->sg_tidc++;
+	}
+
+	*grpp = grp;
+
+	return 0;
+}
+
+uint64_t
+mpool_stripe_grp_close(
+	struct mpool_stripe_grp    *grp)
+{
+	if (!grp)
+		return merr(EINVAL);
+
+	return stripe_grp_free(grp);
+}
+
+uint64_t
+mpool_stripe_grp_mpool(
+	struct mpool_stripe_grp    *grp,
+	uint32_t                    idx,
+	struct mpool              **mpp)
+{
+	if (!grp || !mpp || idx >= grp->sg_mpc)
+		return merr(EINVAL);
+
+	*mpp = grp->sg_mpv[idx];
+
+	return 0;
+}
+
+static struct mpool_stripe *
+stripe_new(struct mpool_stripe_grp *grp)
+{
+	struct mpool_stripe *st;
+
+	st = kzalloc(sizeof(*st), GFP_KERNEL);
+	if (!st)
+		return NULL;
+
+	mutex_init(&st->st_lock);
+	st->st_grp = grp;
+
+	return st;
+}
+
+static void
+stripe_free(struct mpool_stripe *st)
+{
+	mutex_destroy(&st->st_lock);
+	kfree(st);
+}
+
+uint64_t
+mpool_stripe_alloc(
+	struct mpool_stripe_grp    *grp,
+	enum mp_media_classp        mclassp,
+	struct mpool_stripe       **stp)
+{
+	struct mpool_stripe    *st;
+	merr_t                  err = 0;
+	u32                     i;
+
+	if (!grp || !stp)
+		return merr(EINVAL);
+
+	st = stripe_new(grp);
+	if (!st)
+		return merr(ENOMEM);
+
+	for (i = 0; i < grp->sg_mpc; i++) {
+		err = mpool_mblock_alloc(grp->sg_mpv[i], mclassp, false,
+					 &st->st_mbidv[i], NULL);
+		if (err)
+			break;
+	}
+
+	if (err) {
+		while (i-- > 0)
+			mpool_mblock_abort(grp->sg_mpv[i], st->st_mbidv[i]);
+		stripe_free(st);
+		return err;
+	}
+
+	*stp = st;
+
+	return 0;
+}
+
+uint64_t
+mpool_stripe_find(
+	struct mpool_stripe_grp    *grp,
+	const uint64_t             *objidv,
+	uint32_t                    objidc,
+	struct mpool_stripe       **stp)
+{
+	struct mpool_stripe    *st;
+	struct mblock_props     props;
+	merr_t                  err = 0;
+	u64                     mlenv[MPOOL_STRIPE_WIDTH_MAX];
+	u32                     i;
+	bool                    committed = true;
+
+	if (!grp || !objidv || !stp || objidc != grp->sg_mpc)
+		return merr(EINVAL);
+
+	st = stripe_new(grp);
+	if (!st)
+		return merr(ENOMEM);
+
+	for (i = 0; i < grp->sg_mpc; i++) {
+		err = mpool_mblock_find(grp->sg_mpv[i], objidv[i],
+					&st->st_mbidv[i], &props);
+		if (err)
+			goto errout;
+
+		mlenv[i] = props.mpr_write_len;
+		st->st_len += props.mpr_write_len;
+		committed = committed && props.mpr_iscommitted;
+	}
+
+	/* Member lengths must agree with the round-robin layout */
+	for (i = 0; i < grp->sg_mpc; i++) {
+		if (mlenv[i] != stripe_member_len(grp, st->st_len, i)) {
+			err = merr(EINVAL);
+			mp_pr_err("stripe member %u objid 0x%lx len %lu "
+				  "inconsistent with stripe len %lu",
+				  err, i, (ulong)objidv[i], (ulong)mlenv[i],
+				  (ulong)st->st_len);
+			goto errout;
+		}
+	}
+
+	st->st_committed = committed;
+
+	*stp = st;
+
+	return 0;
+
+errout:
+	stripe_free(st);
+
+	return err;
+}
+
+uint64_t
+mpool_stripe_objids(
+	struct mpool_stripe    *st,
+	uint64_t               *objidv,
+	uint32_t                objidc)
+{
+	if (!st || !objidv || objidc < st->st_grp->sg_mpc)
+		return merr(EINVAL);
+
+	memcpy(objidv, st->st_mbidv, st->st_grp->sg_mpc * sizeof(*objidv));
+
+	return 0;
+}
+
+uint64_t
+mpool_stripe_getprops(
+	struct mpool_stripe            *st,
+	struct mpool_stripe_props      *props)
+{
+	if (!st || !props)
+		return merr(EINVAL);
+
+	memset(props, 0, sizeof(*props));
+
+	mutex_lock(&st->st_lock);
+	props->stp_width = st->st_grp->sg_mpc;
+	props->stp_unitsz = st->st_grp->sg_unitsz;
+	props->stp_len = st->st_len;
+	props->stp_committed = st->st_committed;
+	mutex_unlock(&st->st_lock);
+
+	return 0;
+}
+
+uint64_t
+mpool_stripe_write(
+	struct mpool_stripe    *st,
+	const struct iovec     *iov,
+	int                     iovc)
+{
+	merr_t  err;
+	u64     len;
+
+	if (!st)
+		return merr(EINVAL);
+
+	err = stripe_iov_len(iov, iovc, &len);
+	if (err)
+		return err;
+
+	mutex_lock(&st->st_lock);
+	if (st->st_committed || st->st_dead) {
+		mutex_unlock(&st->st_lock);
+		return merr(EINVAL);
+	}
+
+	err = stripe_io(st, iov, iovc, st->st_len, len, false);
+	if (!err)
+		st->st_len += len;
+	mutex_unlock(&st->st_lock);
+
+	return err;
+}
+
+uint64_t
+mpool_stripe_read(
+	struct mpool_stripe    *st,
+	const struct iovec     *iov,
+	int                     iovc,
+	uint64_t                offset)
+{
+	merr_t  err;
+	u64     len;
+	bool    valid;
+
+	if (!st || !PAGE_ALIGNED(offset))
+		return merr(EINVAL);
+
+	err = stripe_iov_len(iov, iovc, &len);
+	if (err)
+		return err;
+
+	/* Committed members never change, so reads need not hold st_lock */
+	mutex_lock(&st->st_lock);
+	valid = st->st_committed && offset + len <= st->st_len;
+	mutex_unlock(&st->st_lock);
+
+	if (!valid)
+		return merr(EINVAL);
+
+	return stripe_io(st, iov, iovc, offset, len, true);
+}
+
+uint64_t
+mpool_stripe_commit(
+	struct mpool_stripe    *st)
+{
+	struct mpool_stripe_grp    *grp;
+	merr_t                      err = 0;
+	u32                         i, j;
+
+	if (!st)
+		return merr(EINVAL);
+
+	grp = st->st_grp;
+
+	mutex_lock(&st->st_lock);
+	if (st->st_committed || st->st_dead) {
+		mutex_unlock(&st->st_lock);
+		return st->st_dead ? merr(EINVAL) : 0;
+	}
+
+	for (i = 0; i < grp->sg_mpc; i++) {
+		err = mpool_mblock_commit(grp->sg_mpv[i], st->st_mbidv[i]);
+		if (err)
+			break;
+	}
+
+	if (err) {
+		/*
+		 * Commit is all or nothing from the caller's point of view:
+		 * destroy the members that made it and abort the rest.  This
+		 * does not hold across a crash, see mpool_stripe_commit().
+		 */
+		mp_pr_err("stripe member %u mblock 0x%lx commit failed",
+			  err, i, (ulong)st->st_mbidv[i]);
+
+		for (j = 0; j < grp->sg_mpc; j++) {
+			if (j < i)
+				mpool_mblock_delete(grp->sg_mpv[j],
+						    st->st_mbidv[j]);
+			else
+				mpool_mblock_abort(grp->sg_mpv[j],
+						   st->st_mbidv[j]);
+		}
+
+		st->st_dead = true;
+	} else {
+		st->st_committed = true;
+	}
+	mutex_unlock(&st->st_lock);
+
+	return err;
+}
+
+uint64_t
+mpool_stripe_abort(
+	struct mpool_stripe    *st)
+{
+	struct mpool_stripe_grp    *grp;
+	merr_t                      err = 0, err2;
+	u32                         i;
+
+	if (!st || st->st_committed)
+		return merr(EINVAL);
+
+	grp = st->st_grp;
+
+	if (!st->st_dead) {
+		for (i = 0; i < grp->sg_mpc; i++) {
+			err2 = mpool_mblock_abort(grp->sg_mpv[i],
+						  st->st_mbidv[i]);
+			if (err2 && !err)
+				err = err2;
+		}
+	}
+
+	stripe_free(st);
+
+	return err;
+}
+
+uint64_t
+mpool_stripe_delete(
+	struct mpool_stripe    *st)
+{
+	struct mpool_stripe_grp    *grp;
+	merr_t                      err = 0, err2;
+	u32                         i;
+
+	if (!st || !st->st_committed)
+		return merr(EINVAL);
+
+	grp = st->st_grp;
+
+	/* Keep going on error so that as many members as possible are freed */
+	for (i = 0; i < grp->sg_mpc; i++) {
+		err2 = mpool_mblock_delete(grp->sg_mpv[i], st->st_mbidv[i]);
+		if (err2 && !err)
+			err = err2;
+	}
+
+	stripe_free(st);
+
+	return err;
+}
+
+uint64_t
+mpool_stripe_put(
+	struct mpool_stripe    *st)
+{
+	if (!st)
+		return merr(EINVAL);
+
+	stripe_free(st);
+
+	return 0;
+}
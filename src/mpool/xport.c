@@ -0,0 +1,1748 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Export/import design pattern module.
+ *
+ * Streams the objects named in a catalog into a portable archive, and
+ * recreates them from one, possibly in another mpool.  The kernel offers
+ * no way to enumerate the objects of an mpool, so the catalog defines what
+ * is exported.  The archive is a sequence of self-contained objects:
+ *
+ *   [hdr][obj 0][obj 1]...[obj N-1][end]
+ *
+ *   obj = [obj hdr][name][meta][chunk 0][chunk 1]...[empty chunk]
+ *
+ * Object data is cut into chunks of up to chunksz bytes, each optionally
+ * compressed with the compressed mblock codec, and ends with an empty
+ * chunk.  mblock data is stored as is; mlog data is stored as a stream of
+ * length prefixed records, whose length is only known once it was read.
+ *
+ * Export runs several readers, each reading an object with large I/Os.  A
+ * reader buffers up to XPORT_BUFCHUNKS chunks of its object and, past
+ * that, takes the archive over and streams the rest of the object, so
+ * objects appear in no particular order but are never interleaved.
+ * Import parses the archive sequentially and streams each object to one
+ * of several writers, at most XPORT_BUFCHUNKS chunks ahead of it.  The
+ * writers record the objects in the catalog in batches.
+ *
+ * Like mdc.c, this module is layered on the public mpool API, plus the
+ * compaction markers of imlog.h to carry MDC mlogs across.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <util/alloc.h>
+#include <util/page.h>
+#include <util/minmax.h>
+#include <util/mutex.h>
+#include <util/omf.h>
+
+#include <mpool/mpool.h>
+#include <mpctl/icmb.h>
+#include <mpctl/imlog.h>
+
+#include "mpool_err.h"
+#include "logging.h"
+
+#define XPORT_MAGIC             ((u32)0x4d505831)       /* "MPX1" */
+#define XPORT_OBJ_MAGIC         ((u32)0x4d50584f)       /* "MPXO" */
+#define XPORT_VERSION           (2)
+#define XPORT_THREADS_DFLT      (4)
+#define XPORT_THREADS_MAX       (64)
+#define XPORT_CHUNKSZ_DFLT      (1024 * 1024)
+#define XPORT_CHUNKSZ_MIN       (64 * 1024)
+#define XPORT_CHUNKSZ_MAX       (16 * 1024 * 1024)
+#define XPORT_BATCH_DFLT        (64)
+#define XPORT_BATCH_MAX         (1024)
+#define XPORT_RECSZ_DFLT        (64 * 1024)
+#define XPORT_BUFCHUNKS         (4)
+
+#define XPORT_AF_COMPRESS       (0x1)   /* archive flags */
+#define XPORT_OF_CSEM           (0x1)   /* object flags */
+
+enum xport_obj_type {
+	XPORT_OBJ_END    = 0,
+	XPORT_OBJ_MBLOCK = 1,
+	XPORT_OBJ_MLOG   = 2,
+};
+
+/**
+ * struct xport_hdr_omf - archive header
+ * @pxh_magic:   XPORT_MAGIC
+ * @pxh_version: XPORT_VERSION
+ * @pxh_chunksz: maximum uncompressed chunk size
+ * @pxh_flags:   XPORT_AF_*
+ */
+struct xport_hdr_omf {
+	__le32  pxh_magic;
+	__le32  pxh_version;
+	__le32  pxh_chunksz;
+	__le32  pxh_flags;
+} __packed;
+
+OMF_SETGET(struct xport_hdr_omf, pxh_magic, 32)
+OMF_SETGET(struct xport_hdr_omf, pxh_version, 32)
+OMF_SETGET(struct xport_hdr_omf, pxh_chunksz, 32)
+OMF_SETGET(struct xport_hdr_omf, pxh_flags, 32)
+
+/**
+ * struct xport_obj_omf - object header, followed by name and metadata
+ * @pxo_magic:   XPORT_OBJ_MAGIC
+ * @pxo_type:    enum xport_obj_type
+ * @pxo_flags:   XPORT_OF_*
+ * @pxo_mclassp: media class
+ * @pxo_namelen: name length, without the NUL
+ * @pxo_metalen: metadata length
+ * @pxo_objid:   object ID (object count for XPORT_OBJ_END)
+ * @pxo_cap:     allocated capacity
+ * @pxo_rawlen:  uncompressed data length of an mblock, 0 for an mlog
+ */
+struct xport_obj_omf {
+	__le32  pxo_magic;
+	u8      pxo_type;
+	u8      pxo_flags;
+	u8      pxo_mclassp;
+	u8      pxo_rsvd1;
+	__le16  pxo_namelen;
+	__le16  pxo_metalen;
+	__le32  pxo_rsvd2;
+	__le64  pxo_objid;
+	__le64  pxo_cap;
+	__le64  pxo_rawlen;
+} __packed;
+
+OMF_SETGET(struct xport_obj_omf, pxo_magic, 32)
+OMF_SETGET(struct xport_obj_omf, pxo_type, 8)
+OMF_SETGET(struct xport_obj_omf, pxo_flags, 8)
+OMF_SETGET(struct xport_obj_omf, pxo_mclassp, 8)
+OMF_SETGET(struct xport_obj_omf, pxo_namelen, 16)
+OMF_SETGET(struct xport_obj_omf, pxo_metalen, 16)
+OMF_SETGET(struct xport_obj_omf, pxo_objid, 64)
+OMF_SETGET(struct xport_obj_omf, pxo_cap, 64)
+OMF_SETGET(struct xport_obj_omf, pxo_rawlen, 64)
+
+/**
+ * struct xport_chunk_omf - chunk header
+ * @pxc_rawlen: uncompressed length, 0 for the chunk ending an object
+ * @pxc_len:    stored length, equal to @pxc_rawlen if stored uncompressed
+ */
+struct xport_chunk_omf {
+	__le32  pxc_rawlen;
+	__le32  pxc_len;
+} __packed;
+
+OMF_SETGET(struct xport_chunk_omf, pxc_rawlen, 32)
+OMF_SETGET(struct xport_chunk_omf, pxc_len, 32)
+
+/**
+ * struct xport_buf - growable byte buffer
+ */
+struct xport_buf {
+	char   *xb_data;
+	size_t  xb_len;
+	size_t  xb_cap;
+};
+
+static merr_t
+xport_buf_reserve(struct xport_buf *xb, size_t len)
+{
+	size_t  cap;
+	char   *data;
+
+	if (xb->xb_len + len <= xb->xb_cap)
+		return 0;
+
+	cap = max_t(size_t, xb->xb_cap * 2, xb->xb_len + len);
+
+	data = realloc(xb->xb_data, cap);
+	if (!data)
+		return merr(ENOMEM);
+
+	xb->xb_data = data;
+	xb->xb_cap = cap;
+
+	return 0;
+}
+
+static merr_t
+xport_buf_append(struct xport_buf *xb, const void *data, size_t len)
+{
+	merr_t err;
+
+	err = xport_buf_reserve(xb, len);
+	if (err)
+		return err;
+
+	memcpy(xb->xb_data + xb->xb_len, data, len);
+	xb->xb_len += len;
+
+	return 0;
+}
+
+static merr_t
+xport_read(int fd, void *buf, size_t len)
+{
+	ssize_t cc;
+
+	while (len > 0) {
+		cc = read(fd, buf, len);
+		if (cc == -1) {
+			if (errno == EINTR)
+				continue;
+			return merr(errno);
+		}
+
+		/* Truncated archive */
+		if (cc == 0)
+			return merr(EBADMSG);
+
+		buf = (char *)buf + cc;
+		len -= cc;
+	}
+
+	return 0;
+}
+
+static merr_t
+xport_write(int fd, const void *buf, size_t len)
+{
+	ssize_t cc;
+
+	while (len > 0) {
+		cc = write(fd, buf, len);
+		if (cc == -1) {
+			if (errno == EINTR)
+				continue;
+			return merr(errno);
+		}
+
+		buf = (const char *)buf + cc;
+		len -= cc;
+	}
+
+	return 0;
+}
+
+static void
+xport_params_init(
+	struct mpool_xport_params          *dst,
+	const struct mpool_xport_params    *params)
+{
+	memset(dst, 0, sizeof(*dst));
+	if (params)
+		*dst = *params;
+
+	if (dst->xp_threads == 0)
+		dst->xp_threads = XPORT_THREADS_DFLT;
+	if (dst->xp_chunksz == 0)
+		dst->xp_chunksz = XPORT_CHUNKSZ_DFLT;
+	if (dst->xp_batch == 0)
+		dst->xp_batch = XPORT_BATCH_DFLT;
+
+	dst->xp_threads = min_t(u32, dst->xp_threads, XPORT_THREADS_MAX);
+	dst->xp_batch = min_t(u32, dst->xp_batch, XPORT_BATCH_MAX);
+}
+
+static bool
+xport_params_valid(const struct mpool_xport_params *params)
+{
+	return params->xp_chunksz >= XPORT_CHUNKSZ_MIN &&
+		params->xp_chunksz <= XPORT_CHUNKSZ_MAX &&
+		(params->xp_chunksz & (PAGE_SIZE - 1)) == 0;
+}
+
+/*
+ * Export
+ */
+
+/**
+ * struct xport_ent - catalog entry to export
+ */
+struct xport_ent {
+	char   *xe_name;
+	void   *xe_meta;
+	u64     xe_objid;
+	u32     xe_metalen;
+};
+
+
+/**
+ * struct xport_exp - export context
+ * @xx_lock:   protects everything below
+ * @xx_cv:     signaled when the archive is released or on error
+ * @xx_mp:     mpool handle
+ * @xx_fd:     archive file descriptor
+ * @xx_params: tunables
+ * @xx_owner:  reader streaming an object to the archive, if any
+ * @xx_entv:   objects to export
+ * @xx_entc:   number of objects to export
+ * @xx_entmax: size of @xx_entv
+ * @xx_next:   next object to export
+ * @xx_err:    first error
+ * @xx_stats:  statistics
+ */
+struct xport_exp {
+	struct mutex                xx_lock;
+	pthread_cond_t              xx_cv;
+	struct mpool               *xx_mp;
+	int                         xx_fd;
+	struct mpool_xport_params   xx_params;
+	struct xport_exp_wr        *xx_owner;
+
+	struct xport_ent           *xx_entv;
+	u32                         xx_entc;
+	u32                         xx_entmax;
+	u32                         xx_next;
+
+	merr_t                      xx_err;
+	struct mpool_xport_stats    xx_stats;
+};
+
+/**
+ * struct xport_exp_wr - per reader state
+ * @xw_xx:    export context
+ * @xw_ob:    archive image of the current object not yet written
+ * @xw_rbuf:  chunk assembly buffer, page aligned
+ * @xw_rlen:  bytes in @xw_rbuf
+ * @xw_cbuf:  compression output buffer
+ * @xw_recv:  mlog record buffer
+ * @xw_recsz: size of @xw_recv
+ * @xw_arlen: archive bytes of the current object
+ * @xw_len:   data bytes of the current object
+ * @xw_type:  enum xport_obj_type of the current object
+ * @xw_tid:   thread ID
+ */
+struct xport_exp_wr {
+	struct xport_exp   *xw_xx;
+	struct xport_buf    xw_ob;
+	char               *xw_rbuf;
+	size_t              xw_rlen;
+	char               *xw_cbuf;
+	char               *xw_recv;
+	size_t              xw_recsz;
+	u64                 xw_arlen;
+	u64                 xw_len;
+	u8                  xw_type;
+	pthread_t           xw_tid;
+};
+
+static int
+xport_exp_collect(
+	void       *arg,
+	const char *name,
+	uint64_t    objid,
+	const void *meta,
+	size_t      metalen)
+{
+	struct xport_exp   *xx = arg;
+	struct xport_ent   *ent;
+	u32                 entmax;
+
+	if (xx->xx_entc >= xx->xx_entmax) {
+		entmax = max_t(u32, 64, xx->xx_entmax * 2);
+
+		ent = realloc(xx->xx_entv, entmax * sizeof(*ent));
+		if (!ent)
+			goto nomem;
+
+		xx->xx_entv = ent;
+		xx->xx_entmax = entmax;
+	}
+
+	ent = xx->xx_entv + xx->xx_entc;
+	ent->xe_name = strdup(name);
+	ent->xe_meta = metalen ? malloc(metalen) : NULL;
+	if (!ent->xe_name || (metalen && !ent->xe_meta)) {
+		free(ent->xe_name);
+		free(ent->xe_meta);
+		goto nomem;
+	}
+
+	memcpy(ent->xe_meta, meta, metalen);
+	ent->xe_objid = objid;
+	ent->xe_metalen = metalen;
+	xx->xx_entc++;
+
+	return 0;
+
+nomem:
+	xx->xx_err = merr(ENOMEM);
+
+	return 1;
+}
+
+/**
+ * xport_exp_flush() - Write out the buffered part of the current object
+ *
+ * The reader takes the archive over, if it did not already, and keeps it
+ * until its object is complete.
+ */
+static merr_t
+xport_exp_flush(struct xport_exp_wr *xw)
+{
+	struct xport_exp   *xx = xw->xw_xx;
+	merr_t              err;
+
+	mutex_lock(&xx->xx_lock);
+	while (xx->xx_owner && xx->xx_owner != xw && !xx->xx_err)
+		pthread_cond_wait(&xx->xx_cv, &xx->xx_lock.pth_mutex);
+
+	err = xx->xx_err;
+	if (!err)
+		xx->xx_owner = xw;
+	mutex_unlock(&xx->xx_lock);
+
+	if (!err)
+		err = xport_write(xx->xx_fd, xw->xw_ob.xb_data,
+				  xw->xw_ob.xb_len);
+
+	xw->xw_arlen += xw->xw_ob.xb_len;
+	xw->xw_ob.xb_len = 0;
+
+	return err;
+}
+
+/**
+ * xport_exp_emit() - Append to the archive image of the current object
+ */
+static merr_t
+xport_exp_emit(struct xport_exp_wr *xw, const void *data, size_t len)
+{
+	size_t  chunksz = xw->xw_xx->xx_params.xp_chunksz;
+	merr_t  err;
+
+	err = xport_buf_append(&xw->xw_ob, data, len);
+	if (err)
+		return err;
+
+	if (xw->xw_ob.xb_len >= XPORT_BUFCHUNKS * chunksz)
+		return xport_exp_flush(xw);
+
+	return 0;
+}
+
+/**
+ * xport_exp_chunk() - Append the chunk assembled in xw_rbuf to the object
+ */
+static merr_t
+xport_exp_chunk(struct xport_exp_wr *xw)
+{
+	struct xport_chunk_omf  ch;
+	const void             *data = xw->xw_rbuf;
+	size_t                  len = xw->xw_rlen;
+	size_t                  clen = 0;
+	merr_t                  err;
+
+	if (len == 0)
+		return 0;
+
+	if (xw->xw_xx->xx_params.xp_compress)
+		clen = cmb_lz_compress(xw->xw_rbuf, len, xw->xw_cbuf, len);
+
+	if (clen > 0 && clen < len) {
+		data = xw->xw_cbuf;
+		len = clen;
+	}
+
+	omf_set_pxc_rawlen(&ch, xw->xw_rlen);
+	omf_set_pxc_len(&ch, len);
+
+	err = xport_exp_emit(xw, &ch, sizeof(ch));
+	if (!err)
+		err = xport_exp_emit(xw, data, len);
+
+	xw->xw_len += xw->xw_rlen;
+	xw->xw_rlen = 0;
+
+	return err;
+}
+
+/**
+ * xport_exp_stream() - Append bytes to the object data, chunk by chunk
+ */
+static merr_t
+xport_exp_stream(struct xport_exp_wr *xw, const void *data, size_t len)
+{
+	size_t  chunksz = xw->xw_xx->xx_params.xp_chunksz;
+	size_t  cc;
+	merr_t  err;
+
+	while (len > 0) {
+		cc = min_t(size_t, len, chunksz - xw->xw_rlen);
+
+		memcpy(xw->xw_rbuf + xw->xw_rlen, data, cc);
+		xw->xw_rlen += cc;
+		data = (const char *)data + cc;
+		len -= cc;
+
+		if (xw->xw_rlen == chunksz) {
+			err = xport_exp_chunk(xw);
+			if (err)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * xport_exp_begin() - Start the archive image of an object with its
+ * header, name and metadata
+ */
+static merr_t
+xport_exp_begin(
+	struct xport_exp_wr    *xw,
+	struct xport_ent       *ent,
+	struct xport_obj_omf   *oh)
+{
+	size_t  namelen = strlen(ent->xe_name);
+	merr_t  err;
+
+	omf_set_pxo_magic(oh, XPORT_OBJ_MAGIC);
+	omf_set_pxo_namelen(oh, namelen);
+	omf_set_pxo_metalen(oh, ent->xe_metalen);
+	omf_set_pxo_objid(oh, ent->xe_objid);
+
+	xw->xw_type = omf_pxo_type(oh);
+
+	err = xport_exp_emit(xw, oh, sizeof(*oh));
+	if (!err)
+		err = xport_exp_emit(xw, ent->xe_name, namelen);
+	if (!err)
+		err = xport_exp_emit(xw, ent->xe_meta, ent->xe_metalen);
+
+	return err;
+}
+
+static merr_t
+xport_exp_mblock(
+	struct xport_exp_wr        *xw,
+	struct xport_ent           *ent,
+	u64                         mbh,
+	const struct mblock_props  *props)
+{
+	struct mpool           *mp = xw->xw_xx->xx_mp;
+	size_t                  chunksz = xw->xw_xx->xx_params.xp_chunksz;
+	struct xport_obj_omf    oh;
+	struct iovec            iov;
+	merr_t                  err;
+	u64                     off;
+
+	if (!props->mpr_iscommitted)
+		return merr(EINVAL);
+
+	memset(&oh, 0, sizeof(oh));
+	omf_set_pxo_type(&oh, XPORT_OBJ_MBLOCK);
+	omf_set_pxo_mclassp(&oh, props->mpr_mclassp);
+	omf_set_pxo_cap(&oh, props->mpr_alloc_cap);
+	omf_set_pxo_rawlen(&oh, props->mpr_write_len);
+
+	err = xport_exp_begin(xw, ent, &oh);
+	if (err)
+		return err;
+
+	for (off = 0; off < props->mpr_write_len; off += iov.iov_len) {
+		iov.iov_base = xw->xw_rbuf;
+		iov.iov_len = min_t(size_t, chunksz,
+				    props->mpr_write_len - off);
+
+		err = mpool_mblock_read(mp, mbh, &iov, 1, off);
+		if (err)
+			return err;
+
+		xw->xw_rlen = iov.iov_len;
+
+		err = xport_exp_chunk(xw);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/**
+ * xport_exp_mlog() - Export the data records of an mlog
+ *
+ * An mlog holding compaction markers only opens with MLOG_OF_COMPACT_SEM,
+ * which is how MDC mlogs are recognized.
+ */
+static merr_t
+xport_exp_mlog(struct xport_exp_wr *xw, struct xport_ent *ent)
+{
+	struct mpool           *mp = xw->xw_xx->xx_mp;
+	struct xport_obj_omf    oh;
+	struct mlog_props       props;
+	struct mpool_mlog      *mlh;
+	__le32                  reclen;
+	merr_t                  err, err2;
+	size_t                  rdlen;
+	u64                     gen;
+	char                   *recv;
+	u8                      flags = 0;
+
+	err = mpool_mlog_find_get(mp, ent->xe_objid, &props, &mlh);
+	if (err)
+		return err;
+
+	if (!props.lpr_iscommitted) {
+		mpool_mlog_put(mp, mlh);
+		return merr(EINVAL);
+	}
+
+	err = mpool_mlog_open(mp, mlh, 0, &gen);
+	if (merr_errno(err) == ENODATA) {
+		flags |= XPORT_OF_CSEM;
+		err = mpool_mlog_open(mp, mlh, MLOG_OF_COMPACT_SEM, &gen);
+	}
+	if (err) {
+		mpool_mlog_put(mp, mlh);
+		return err;
+	}
+
+	memset(&oh, 0, sizeof(oh));
+	omf_set_pxo_type(&oh, XPORT_OBJ_MLOG);
+	omf_set_pxo_flags(&oh, flags);
+	omf_set_pxo_mclassp(&oh, props.lpr_mclassp);
+	omf_set_pxo_cap(&oh, props.lpr_alloc_cap);
+
+	err = xport_exp_begin(xw, ent, &oh);
+	if (!err)
+		err = mpool_mlog_read_data_init(mp, mlh);
+
+	while (!err) {
+		err = mpool_mlog_read_data_next(mp, mlh, xw->xw_recv,
+						xw->xw_recsz, &rdlen);
+		if (merr_errno(err) == EOVERFLOW) {
+			recv = realloc(xw->xw_recv, rdlen);
+			if (!recv) {
+				err = merr(ENOMEM);
+				break;
+			}
+
+			xw->xw_recv = recv;
+			xw->xw_recsz = rdlen;
+			err = 0;
+			continue;
+		}
+
+		if (err || rdlen == 0)
+			break;
+
+		reclen = cpu_to_le32(rdlen);
+
+		err = xport_exp_stream(xw, &reclen, sizeof(reclen));
+		if (!err)
+			err = xport_exp_stream(xw, xw->xw_recv, rdlen);
+	}
+
+	if (!err)
+		err = xport_exp_chunk(xw);
+
+	err2 = mpool_mlog_close(mp, mlh);
+	if (!err)
+		err = err2;
+
+	mpool_mlog_put(mp, mlh);
+
+	return err;
+}
+
+/**
+ * xport_exp_obj() - Write one object to the archive
+ *
+ * Leaves the end of the object, at least, buffered in xw_ob.
+ */
+static merr_t
+xport_exp_obj(struct xport_exp_wr *xw, struct xport_ent *ent)
+{
+	struct xport_chunk_omf  ch;
+	struct mblock_props     props;
+	merr_t                  err;
+	u64                     mbh;
+
+	xw->xw_ob.xb_len = 0;
+	xw->xw_rlen = 0;
+	xw->xw_arlen = 0;
+	xw->xw_len = 0;
+
+	/* Anything that is not an mblock must be an mlog */
+	err = mpool_mblock_find(xw->xw_xx->xx_mp, ent->xe_objid, &mbh, &props);
+	if (!err)
+		err = xport_exp_mblock(xw, ent, mbh, &props);
+	else
+		err = xport_exp_mlog(xw, ent);
+
+	if (!err) {
+		memset(&ch, 0, sizeof(ch));
+		err = xport_buf_append(&xw->xw_ob, &ch, sizeof(ch));
+	}
+
+	if (err)
+		mp_pr_err("export %s objid 0x%lx failed",
+			  err, ent->xe_name, (ulong)ent->xe_objid);
+
+	return err;
+}
+
+static void *
+xport_exp_worker(void *arg)
+{
+	struct xport_exp_wr    *xw = arg;
+	struct xport_exp       *xx = xw->xw_xx;
+	struct xport_ent       *ent;
+	merr_t                  err;
+
+	while (true) {
+		mutex_lock(&xx->xx_lock);
+		if (xx->xx_err || xx->xx_next >= xx->xx_entc) {
+			mutex_unlock(&xx->xx_lock);
+			break;
+		}
+		ent = xx->xx_entv + xx->xx_next++;
+		mutex_unlock(&xx->xx_lock);
+
+		err = xport_exp_obj(xw, ent);
+		if (!err)
+			err = xport_exp_flush(xw);
+
+		mutex_lock(&xx->xx_lock);
+		if (xx->xx_owner == xw)
+			xx->xx_owner = NULL;
+
+		if (!err) {
+			if (xw->xw_type == XPORT_OBJ_MBLOCK)
+				xx->xx_stats.xs_mblocks++;
+			else
+				xx->xx_stats.xs_mlogs++;
+			xx->xx_stats.xs_rawbytes += xw->xw_len;
+			xx->xx_stats.xs_arbytes += xw->xw_arlen;
+		} else if (!xx->xx_err) {
+			xx->xx_err = err;
+		}
+		pthread_cond_broadcast(&xx->xx_cv);
+		mutex_unlock(&xx->xx_lock);
+	}
+
+	return NULL;
+}
+
+uint64_t
+mpool_export(
+	struct mpool                       *mp,
+	struct mpool_catalog               *cat,
+	int                                 fd,
+	const struct mpool_xport_params    *params,
+	struct mpool_xport_stats           *stats)
+{
+	struct xport_exp_wr    *xwv;
+	struct xport_hdr_omf    hdr;
+	struct xport_obj_omf    end;
+	struct xport_exp        xx;
+	merr_t                  err;
+	u32                     i, nthreads;
+
+	if (!mp || !cat || fd < 0)
+		return merr(EINVAL);
+
+	memset(&xx, 0, sizeof(xx));
+	mutex_init(&xx.xx_lock);
+	pthread_cond_init(&xx.xx_cv, NULL);
+	xx.xx_mp = mp;
+	xx.xx_fd = fd;
+	xport_params_init(&xx.xx_params, params);
+
+	if (!xport_params_valid(&xx.xx_params)) {
+		err = merr(EINVAL);
+		goto errout;
+	}
+
+	err = mpool_catalog_foreach(cat, xport_exp_collect, &xx);
+	if (!err)
+		err = xx.xx_err;
+	if (err)
+		goto errout;
+
+	memset(&hdr, 0, sizeof(hdr));
+	omf_set_pxh_magic(&hdr, XPORT_MAGIC);
+	omf_set_pxh_version(&hdr, XPORT_VERSION);
+	omf_set_pxh_chunksz(&hdr, xx.xx_params.xp_chunksz);
+	omf_set_pxh_flags(&hdr,
+			  xx.xx_params.xp_compress ? XPORT_AF_COMPRESS : 0);
+
+	err = xport_write(fd, &hdr, sizeof(hdr));
+	if (err)
+		goto errout;
+
+	xx.xx_stats.xs_arbytes = sizeof(hdr);
+
+	nthreads = clamp_t(u32, xx.xx_entc, 1, xx.xx_params.xp_threads);
+
+	xwv = kcalloc(nthreads, sizeof(*xwv), GFP_KERNEL);
+	if (!xwv) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		struct xport_exp_wr *xw = xwv + i;
+
+		xw->xw_xx = &xx;
+		xw->xw_recsz = XPORT_RECSZ_DFLT;
+		xw->xw_rbuf = aligned_alloc(PAGE_SIZE, xx.xx_params.xp_chunksz);
+		xw->xw_cbuf = malloc(xx.xx_params.xp_chunksz);
+		xw->xw_recv = malloc(xw->xw_recsz);
+		if (!xw->xw_rbuf || !xw->xw_cbuf || !xw->xw_recv) {
+			err = merr(ENOMEM);
+			nthreads = i + 1;
+			break;
+		}
+	}
+
+	/* The caller acts as reader 0 */
+	for (i = 1; !err && i < nthreads; i++) {
+		if (pthread_create(&xwv[i].xw_tid, NULL, xport_exp_worker,
+				   xwv + i))
+			break;
+	}
+
+	if (!err) {
+		xport_exp_worker(xwv);
+
+		while (--i > 0)
+			pthread_join(xwv[i].xw_tid, NULL);
+
+		err = xx.xx_err;
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		free(xwv[i].xw_ob.xb_data);
+		free(xwv[i].xw_rbuf);
+		free(xwv[i].xw_cbuf);
+		free(xwv[i].xw_recv);
+	}
+	kfree(xwv);
+
+	if (err)
+		goto errout;
+
+	memset(&end, 0, sizeof(end));
+	omf_set_pxo_magic(&end, XPORT_OBJ_MAGIC);
+	omf_set_pxo_type(&end, XPORT_OBJ_END);
+	omf_set_pxo_objid(&end, xx.xx_entc);
+
+	err = xport_write(fd, &end, sizeof(end));
+	if (err)
+		goto errout;
+
+	xx.xx_stats.xs_arbytes += sizeof(end);
+
+	if (stats)
+		*stats = xx.xx_stats;
+
+errout:
+	for (i = 0; i < xx.xx_entc; i++) {
+		free(xx.xx_entv[i].xe_name);
+		free(xx.xx_entv[i].xe_meta);
+	}
+	free(xx.xx_entv);
+	pthread_cond_destroy(&xx.xx_cv);
+	mutex_destroy(&xx.xx_lock);
+
+	return err;
+}
+
+/*
+ * Import
+ */
+
+/**
+ * struct xport_chunk - uncompressed chunk handed from the reader to a writer
+ * @xc_next: next chunk of the object, or next free chunk
+ * @xc_data: data, page aligned
+ * @xc_len:  length of @xc_data
+ */
+struct xport_chunk {
+	struct xport_chunk *xc_next;
+	char               *xc_data;
+	u32                 xc_len;
+};
+
+/**
+ * struct xport_job - object handed from the archive reader to a writer
+ * @xj_next:    next job in the queue or batch
+ * @xj_name:    NUL terminated name
+ * @xj_meta:    metadata
+ * @xj_chead:   queued chunks, oldest first
+ * @xj_ctail:   last queued chunk
+ * @xj_nchunks: number of queued chunks
+ * @xj_eod:     every chunk of the object was queued
+ * @xj_objid:   exported object ID
+ * @xj_newid:   imported object ID
+ * @xj_cap:     exported allocated capacity
+ * @xj_rawlen:  exported data length of an mblock
+ * @xj_len:     data length queued so far
+ * @xj_metalen: length of @xj_meta
+ * @xj_type:    enum xport_obj_type
+ * @xj_flags:   XPORT_OF_*
+ * @xj_mclassp: media class
+ *
+ * The chunk queue and @xj_eod are protected by xi_lock.
+ */
+struct xport_job {
+	struct xport_job   *xj_next;
+	char               *xj_name;
+	void               *xj_meta;
+	struct xport_chunk *xj_chead;
+	struct xport_chunk *xj_ctail;
+	u32                 xj_nchunks;
+	bool                xj_eod;
+	u64                 xj_objid;
+	u64                 xj_newid;
+	u64                 xj_cap;
+	u64                 xj_rawlen;
+	u64                 xj_len;
+	u32                 xj_metalen;
+	u8                  xj_type;
+	u8                  xj_flags;
+	u8                  xj_mclassp;
+};
+
+/**
+ * struct xport_imp - import context
+ * @xi_lock:    protects everything below but @xi_flushlock
+ * @xi_cv:      signaled when the queue or a job's chunks change
+ * @xi_flushlock: serializes catalog updates and callbacks
+ * @xi_mp:      mpool handle
+ * @xi_cat:     catalog to record the objects in
+ * @xi_params:  tunables
+ * @xi_cb:      mapping callback
+ * @xi_cbarg:   argument of @xi_cb
+ * @xi_qhead:   queued jobs, oldest first
+ * @xi_qtail:   last queued job
+ * @xi_qlen:    number of queued jobs
+ * @xi_eof:     no more jobs will be queued
+ * @xi_cfree:   chunks written out, for the reader to reuse
+ * @xi_batch:   imported objects not yet recorded in the catalog
+ * @xi_nbatch:  number of jobs in @xi_batch
+ * @xi_emptyv:  imported empty mlogs
+ * @xi_emptyc:  number of entries in @xi_emptyv
+ * @xi_emptymax: size of @xi_emptyv
+ * @xi_maxgen:  highest generation of the imported MDC mlogs
+ * @xi_err:     first error
+ * @xi_stats:   statistics
+ */
+struct xport_imp {
+	struct mutex                xi_lock;
+	pthread_cond_t              xi_cv;
+	struct mutex                xi_flushlock;
+	struct mpool               *xi_mp;
+	struct mpool_catalog       *xi_cat;
+	struct mpool_xport_params   xi_params;
+	mpool_xport_map_cb_t       *xi_cb;
+	void                       *xi_cbarg;
+
+	struct xport_job           *xi_qhead;
+	struct xport_job           *xi_qtail;
+	u32                         xi_qlen;
+	bool                        xi_eof;
+	struct xport_chunk         *xi_cfree;
+
+	struct xport_job           *xi_batch;
+	u32                         xi_nbatch;
+
+	u64                        *xi_emptyv;
+	u32                         xi_emptyc;
+	u32                         xi_emptymax;
+	u64                         xi_maxgen;
+
+	merr_t                      xi_err;
+	struct mpool_xport_stats    xi_stats;
+};
+
+static void
+xport_chunk_free(struct xport_chunk *xc)
+{
+	struct xport_chunk *next;
+
+	for (; xc; xc = next) {
+		next = xc->xc_next;
+		free(xc->xc_data);
+		free(xc);
+	}
+}
+
+static void
+xport_job_free(struct xport_job *job)
+{
+	if (!job)
+		return;
+
+	xport_chunk_free(job->xj_chead);
+	free(job);
+}
+
+static void
+xport_imp_seterr(struct xport_imp *xi, merr_t err)
+{
+	if (!xi->xi_err)
+		xi->xi_err = err;
+
+	pthread_cond_broadcast(&xi->xi_cv);
+}
+
+/**
+ * xport_imp_delete() - Delete an imported object that could not be recorded
+ */
+static void
+xport_imp_delete(struct xport_imp *xi, struct xport_job *job)
+{
+	struct mlog_props   props;
+	struct mpool_mlog  *mlh;
+	u64                 mbh;
+
+	if (job->xj_type == XPORT_OBJ_MBLOCK) {
+		if (!mpool_mblock_find(xi->xi_mp, job->xj_newid, &mbh, NULL))
+			mpool_mblock_delete(xi->xi_mp, mbh);
+		return;
+	}
+
+	if (!mpool_mlog_find_get(xi->xi_mp, job->xj_newid, &props, &mlh))
+		if (mpool_mlog_delete(xi->xi_mp, mlh))
+			mpool_mlog_put(xi->xi_mp, mlh);
+}
+
+/**
+ * xport_imp_flush() - Record a batch of imported objects in the catalog
+ *
+ * Called without xi_lock, as the batch was detached from the context.  The
+ * objects of a batch that cannot be recorded are deleted.
+ */
+static merr_t
+xport_imp_flush(struct xport_imp *xi, struct xport_job *batch)
+{
+	struct mpool_catalog_op    *opv;
+	struct xport_job           *job;
+	merr_t                      err;
+	u32                         n;
+
+	if (!batch)
+		return 0;
+
+	for (job = batch, n = 0; job; job = job->xj_next)
+		n++;
+
+	mutex_lock(&xi->xi_flushlock);
+	opv = kcalloc(n, sizeof(*opv), GFP_KERNEL);
+	if (!opv) {
+		err = merr(ENOMEM);
+	} else {
+		for (job = batch, n = 0; job; job = job->xj_next, n++) {
+			opv[n].cop_type = MPOOL_CATALOG_PUT;
+			opv[n].cop_name = job->xj_name;
+			opv[n].cop_meta = job->xj_meta;
+			opv[n].cop_metalen = job->xj_metalen;
+			opv[n].cop_objid = job->xj_newid;
+		}
+
+		err = mpool_catalog_update(xi->xi_cat, opv, n);
+		kfree(opv);
+	}
+
+	while ((job = batch)) {
+		batch = job->xj_next;
+
+		if (err)
+			xport_imp_delete(xi, job);
+		else if (xi->xi_cb)
+			xi->xi_cb(xi->xi_cbarg, job->xj_name, job->xj_objid,
+				  job->xj_newid);
+
+		xport_job_free(job);
+	}
+	mutex_unlock(&xi->xi_flushlock);
+
+	return err;
+}
+
+/**
+ * xport_imp_next() - Wait for the next chunk of an object
+ * @xi:  import context
+ * @job: object
+ * @xcp: chunk done with (input), next chunk or NULL at the end of the
+ *       data (output)
+ */
+static merr_t
+xport_imp_next(
+	struct xport_imp       *xi,
+	struct xport_job       *job,
+	struct xport_chunk    **xcp)
+{
+	struct xport_chunk *xc = *xcp;
+	merr_t              err;
+
+	mutex_lock(&xi->xi_lock);
+	if (xc) {
+		xc->xc_next = xi->xi_cfree;
+		xi->xi_cfree = xc;
+	}
+
+	while (!job->xj_chead && !job->xj_eod && !xi->xi_err)
+		pthread_cond_wait(&xi->xi_cv, &xi->xi_lock.pth_mutex);
+
+	err = xi->xi_err;
+	xc = err ? NULL : job->xj_chead;
+	if (xc) {
+		job->xj_chead = xc->xc_next;
+		if (!job->xj_chead)
+			job->xj_ctail = NULL;
+		job->xj_nchunks--;
+		pthread_cond_broadcast(&xi->xi_cv);
+	}
+	mutex_unlock(&xi->xi_lock);
+
+	*xcp = xc;
+
+	return err;
+}
+
+static merr_t
+xport_imp_mblock(struct xport_imp *xi, struct xport_job *job)
+{
+	struct mpool       *mp = xi->xi_mp;
+	struct xport_chunk *xc = NULL;
+	struct mblock_props props;
+	struct iovec        iov;
+	merr_t              err;
+	u64                 mbh;
+
+	err = mpool_mblock_alloc(mp, job->xj_mclassp, false, &mbh, &props);
+	if (err)
+		return err;
+
+	while (true) {
+		err = xport_imp_next(xi, job, &xc);
+		if (err || !xc)
+			break;
+
+		iov.iov_base = xc->xc_data;
+		iov.iov_len = xc->xc_len;
+
+		err = mpool_mblock_write(mp, mbh, &iov, 1);
+		if (err)
+			break;
+	}
+
+	if (!err)
+		err = mpool_mblock_commit(mp, mbh);
+	if (err) {
+		mpool_mblock_abort(mp, mbh);
+		return err;
+	}
+
+	job->xj_newid = props.mpr_objid;
+
+	return 0;
+}
+
+/**
+ * xport_imp_records() - Append the complete records of an mlog's data
+ * @rb: data not yet appended (input and output)
+ */
+static merr_t
+xport_imp_records(
+	struct mpool       *mp,
+	struct mpool_mlog  *mlh,
+	struct xport_buf   *rb)
+{
+	size_t  off = 0;
+	merr_t  err = 0;
+	u32     len;
+
+	while (rb->xb_len - off >= sizeof(len)) {
+		len = le32_to_cpu(*(__le32 *)(rb->xb_data + off));
+		if (len > rb->xb_len - off - sizeof(len))
+			break;
+
+		off += sizeof(len);
+
+		err = mpool_mlog_append_data(mp, mlh, rb->xb_data + off, len,
+					     0);
+		if (err)
+			break;
+
+		off += len;
+	}
+
+	memmove(rb->xb_data, rb->xb_data + off, rb->xb_len - off);
+	rb->xb_len -= off;
+
+	return err;
+}
+
+/**
+ * xport_imp_mlog() - Import an mlog
+ * @rb: buffer for records cut across chunks
+ *
+ * The mlog of an MDC always gets its compaction markers, even without
+ * records, so that mpool_mdc_open() takes it as the active one of its
+ * pair.  Only mlogs without markers and records count as empty.
+ */
+static merr_t
+xport_imp_mlog(
+	struct xport_imp   *xi,
+	struct xport_job   *job,
+	struct xport_buf   *rb)
+{
+	struct mpool           *mp = xi->xi_mp;
+	struct xport_chunk     *xc = NULL;
+	struct mlog_capacity    cap;
+	struct mlog_props       props;
+	struct mpool_mlog      *mlh;
+	merr_t                  err, err2;
+	bool                    csem;
+	u64                     gen;
+	u8                      flags;
+
+	csem = job->xj_flags & XPORT_OF_CSEM;
+	flags = csem ? MLOG_OF_COMPACT_SEM : 0;
+
+	memset(&cap, 0, sizeof(cap));
+	cap.lcp_captgt = job->xj_cap;
+
+	err = mpool_mlog_alloc(mp, &cap, job->xj_mclassp, &props, &mlh);
+	if (err)
+		return err;
+
+	err = mpool_mlog_commit(mp, mlh);
+	if (err) {
+		mpool_mlog_abort(mp, mlh);
+		return err;
+	}
+
+	err = mpool_mlog_open(mp, mlh, flags, &gen);
+	if (err)
+		goto errout;
+
+	if (csem)
+		err = mpool_mlog_append_cstart(mp, mlh);
+
+	rb->xb_len = 0;
+
+	while (!err) {
+		err = xport_imp_next(xi, job, &xc);
+		if (err || !xc)
+			break;
+
+		err = xport_buf_append(rb, xc->xc_data, xc->xc_len);
+		if (!err)
+			err = xport_imp_records(mp, mlh, rb);
+	}
+
+	/* A record cut short */
+	if (!err && rb->xb_len > 0)
+		err = merr(EBADMSG);
+
+	if (!err && csem)
+		err = mpool_mlog_append_cend(mp, mlh);
+
+	err2 = mpool_mlog_close(mp, mlh);
+	if (!err)
+		err = err2;
+	if (err)
+		goto errout;
+
+	mpool_mlog_put(mp, mlh);
+
+	job->xj_newid = props.lpr_objid;
+
+	mutex_lock(&xi->xi_lock);
+	if (csem)
+		xi->xi_maxgen = max(xi->xi_maxgen, gen);
+
+	if (!csem && job->xj_len == 0) {
+		if (xi->xi_emptyc >= xi->xi_emptymax) {
+			u32  emptymax = max_t(u32, 64, xi->xi_emptymax * 2);
+			u64 *emptyv;
+
+			emptyv = realloc(xi->xi_emptyv,
+					 emptymax * sizeof(*emptyv));
+			if (emptyv) {
+				xi->xi_emptyv = emptyv;
+				xi->xi_emptymax = emptymax;
+			}
+		}
+
+		if (xi->xi_emptyc < xi->xi_emptymax)
+			xi->xi_emptyv[xi->xi_emptyc++] = job->xj_newid;
+	}
+	mutex_unlock(&xi->xi_lock);
+
+	return 0;
+
+errout:
+	if (mpool_mlog_delete(mp, mlh))
+		mpool_mlog_put(mp, mlh);
+
+	return err;
+}
+
+/**
+ * xport_imp_fixgen() - Order the generations of imported MDC mlog pairs
+ *
+ * mpool_mdc_open() takes the mlog with the lower generation of a pair as
+ * the active one.  Freshly allocated mlogs carry no such order, so erase
+ * the empty ones to move them past every imported MDC mlog.  Each gets its
+ * own generation, so that even an MDC that was never opened, whose mlogs
+ * are both empty, does not come back as a pair of equal generations.
+ */
+static merr_t
+xport_imp_fixgen(struct xport_imp *xi)
+{
+	struct mlog_props   props;
+	struct mpool_mlog  *mlh;
+	merr_t              err;
+	u32                 i;
+
+	for (i = 0; i < xi->xi_emptyc; i++) {
+		err = mpool_mlog_find_get(xi->xi_mp, xi->xi_emptyv[i], &props,
+					  &mlh);
+		if (err)
+			return err;
+
+		err = mpool_mlog_erase(xi->xi_mp, mlh, xi->xi_maxgen + 1 + i);
+
+		mpool_mlog_put(xi->xi_mp, mlh);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+static void *
+xport_imp_worker(void *arg)
+{
+	struct xport_imp   *xi = arg;
+	struct xport_job   *job, *batch;
+	struct xport_buf    rb = { };
+	merr_t              err;
+
+	while (true) {
+		mutex_lock(&xi->xi_lock);
+		while (!xi->xi_qhead && !xi->xi_eof && !xi->xi_err)
+			pthread_cond_wait(&xi->xi_cv, &xi->xi_lock.pth_mutex);
+
+		job = xi->xi_err ? NULL : xi->xi_qhead;
+		if (!job) {
+			mutex_unlock(&xi->xi_lock);
+			break;
+		}
+
+		xi->xi_qhead = job->xj_next;
+		if (!xi->xi_qhead)
+			xi->xi_qtail = NULL;
+		xi->xi_qlen--;
+		pthread_cond_broadcast(&xi->xi_cv);
+		mutex_unlock(&xi->xi_lock);
+
+		if (job->xj_type == XPORT_OBJ_MBLOCK)
+			err = xport_imp_mblock(xi, job);
+		else
+			err = xport_imp_mlog(xi, job, &rb);
+
+		batch = NULL;
+
+		mutex_lock(&xi->xi_lock);
+		if (err) {
+			/* Not the first to fail, or the reader did */
+			if (!xi->xi_err)
+				mp_pr_err("import %s objid 0x%lx failed", err,
+					  job->xj_name, (ulong)job->xj_objid);
+			xport_imp_seterr(xi, err);
+			xport_job_free(job);
+			mutex_unlock(&xi->xi_lock);
+			break;
+		}
+
+		if (job->xj_type == XPORT_OBJ_MBLOCK)
+			xi->xi_stats.xs_mblocks++;
+		else
+			xi->xi_stats.xs_mlogs++;
+		xi->xi_stats.xs_rawbytes += job->xj_len;
+
+		job->xj_next = xi->xi_batch;
+		xi->xi_batch = job;
+
+		if (++xi->xi_nbatch >= xi->xi_params.xp_batch) {
+			batch = xi->xi_batch;
+			xi->xi_batch = NULL;
+			xi->xi_nbatch = 0;
+		}
+		mutex_unlock(&xi->xi_lock);
+
+		err = xport_imp_flush(xi, batch);
+		if (err) {
+			mutex_lock(&xi->xi_lock);
+			xport_imp_seterr(xi, err);
+			mutex_unlock(&xi->xi_lock);
+		}
+	}
+
+	free(rb.xb_data);
+
+	return NULL;
+}
+
+/**
+ * xport_imp_read() - Read the next object header of the archive
+ * @xi:   import context
+ * @fd:   archive file descriptor
+ * @jobp: job (output), NULL at the end of the archive
+ * @nobj: objects read so far
+ */
+static merr_t
+xport_imp_read(
+	struct xport_imp   *xi,
+	int                 fd,
+	struct xport_job  **jobp,
+	u64                 nobj)
+{
+	struct xport_obj_omf    oh;
+	struct xport_job       *job;
+	size_t                  namelen, metalen;
+	merr_t                  err;
+	char                   *mem;
+
+	*jobp = NULL;
+
+	err = xport_read(fd, &oh, sizeof(oh));
+	if (err)
+		return err;
+
+	xi->xi_stats.xs_arbytes += sizeof(oh);
+
+	if (omf_pxo_magic(&oh) != XPORT_OBJ_MAGIC)
+		return merr(EBADMSG);
+
+	if (omf_pxo_type(&oh) == XPORT_OBJ_END)
+		return omf_pxo_objid(&oh) == nobj ? 0 : merr(EBADMSG);
+
+	if (omf_pxo_type(&oh) != XPORT_OBJ_MBLOCK &&
+	    omf_pxo_type(&oh) != XPORT_OBJ_MLOG)
+		return merr(EBADMSG);
+
+	namelen = omf_pxo_namelen(&oh);
+	metalen = omf_pxo_metalen(&oh);
+
+	if (namelen == 0 || namelen > MPOOL_CATALOG_NAME_MAX ||
+	    metalen > MPOOL_CATALOG_META_MAX)
+		return merr(EBADMSG);
+
+	/* Name and metadata share one allocation with the job */
+	job = calloc(1, sizeof(*job) + namelen + 1 + metalen);
+	if (!job)
+		return merr(ENOMEM);
+
+	mem = (char *)(job + 1);
+	job->xj_name = mem;
+	job->xj_meta = mem + namelen + 1;
+	job->xj_objid = omf_pxo_objid(&oh);
+	job->xj_cap = omf_pxo_cap(&oh);
+	job->xj_rawlen = omf_pxo_rawlen(&oh);
+	job->xj_metalen = metalen;
+	job->xj_type = omf_pxo_type(&oh);
+	job->xj_flags = omf_pxo_flags(&oh);
+	job->xj_mclassp = omf_pxo_mclassp(&oh);
+
+	err = xport_read(fd, mem, namelen + metalen);
+	if (err)
+		goto errout;
+
+	memmove(job->xj_meta, mem + namelen, metalen);
+	job->xj_name[namelen] = '\0';
+
+	xi->xi_stats.xs_arbytes += namelen + metalen;
+
+	if (job->xj_rawlen > job->xj_cap && job->xj_type == XPORT_OBJ_MBLOCK) {
+		err = merr(EBADMSG);
+		goto errout;
+	}
+
+	*jobp = job;
+
+	return 0;
+
+errout:
+	xport_job_free(job);
+
+	return err;
+}
+
+/**
+ * xport_imp_data() - Read the chunks of an object and queue them to the
+ * writer of its job
+ * @xi:     import context
+ * @fd:     archive file descriptor
+ * @cbuf:   buffer for one stored chunk
+ * @job:    queued job of the object
+ * @rawlen: data length the job expects, U64_MAX if not known
+ *
+ * Once queued, a job is only touched under xi_lock and until an error is
+ * set, after which a writer may free it.
+ */
+static merr_t
+xport_imp_data(
+	struct xport_imp   *xi,
+	int                 fd,
+	char               *cbuf,
+	struct xport_job   *job,
+	u64                 rawlen)
+{
+	size_t                  chunksz = xi->xi_params.xp_chunksz;
+	struct xport_chunk_omf  ch;
+	struct xport_chunk     *xc;
+	u32                     clen, len;
+	ssize_t                 cc;
+	merr_t                  err;
+	u64                     off;
+
+	for (off = 0; true; off += clen) {
+		err = xport_read(fd, &ch, sizeof(ch));
+		if (err)
+			return err;
+
+		clen = omf_pxc_rawlen(&ch);
+		len = omf_pxc_len(&ch);
+
+		xi->xi_stats.xs_arbytes += sizeof(ch) + len;
+
+		if (clen == 0 && len == 0)
+			break;
+
+		if (clen == 0 || clen > chunksz || len > clen ||
+		    clen > rawlen - off)
+			return merr(EBADMSG);
+
+		mutex_lock(&xi->xi_lock);
+		xc = xi->xi_cfree;
+		if (xc)
+			xi->xi_cfree = xc->xc_next;
+		mutex_unlock(&xi->xi_lock);
+
+		if (!xc) {
+			xc = calloc(1, sizeof(*xc));
+			if (!xc)
+				return merr(ENOMEM);
+
+			xc->xc_data = aligned_alloc(PAGE_SIZE, chunksz);
+			if (!xc->xc_data) {
+				free(xc);
+				return merr(ENOMEM);
+			}
+		}
+
+		xc->xc_next = NULL;
+		xc->xc_len = clen;
+
+		if (len == clen) {
+			err = xport_read(fd, xc->xc_data, len);
+		} else {
+			err = xport_read(fd, cbuf, len);
+			if (!err) {
+				cc = cmb_lz_decompress(cbuf, len, xc->xc_data,
+						       clen);
+				if (cc != clen)
+					err = merr(EBADMSG);
+			}
+		}
+
+		mutex_lock(&xi->xi_lock);
+		while (!err && !xi->xi_err &&
+		       job->xj_nchunks >= XPORT_BUFCHUNKS)
+			pthread_cond_wait(&xi->xi_cv, &xi->xi_lock.pth_mutex);
+
+		err = err ?: xi->xi_err;
+		if (!err) {
+			if (job->xj_ctail)
+				job->xj_ctail->xc_next = xc;
+			else
+				job->xj_chead = xc;
+			job->xj_ctail = xc;
+			job->xj_nchunks++;
+			job->xj_len += clen;
+			pthread_cond_broadcast(&xi->xi_cv);
+		} else {
+			xc->xc_next = xi->xi_cfree;
+			xi->xi_cfree = xc;
+		}
+		mutex_unlock(&xi->xi_lock);
+
+		if (err)
+			return err;
+	}
+
+	/* An mblock comes back whole */
+	if (rawlen != U64_MAX && off != rawlen)
+		return merr(EBADMSG);
+
+	mutex_lock(&xi->xi_lock);
+	err = xi->xi_err;
+	if (!err) {
+		job->xj_eod = true;
+		pthread_cond_broadcast(&xi->xi_cv);
+	}
+	mutex_unlock(&xi->xi_lock);
+
+	return err;
+}
+
+uint64_t
+mpool_import(
+	struct mpool                       *mp,
+	struct mpool_catalog               *cat,
+	int                                 fd,
+	const struct mpool_xport_params    *params,
+	mpool_xport_map_cb_t               *cb,
+	void                               *arg,
+	struct mpool_xport_stats           *stats)
+{
+	struct xport_hdr_omf    hdr;
+	struct xport_job       *job;
+	struct xport_imp        xi;
+	pthread_t              *tidv;
+	merr_t                  err, err2;
+	char                   *cbuf = NULL;
+	u32                     i, nthreads;
+	u64                     nobj, rawlen;
+
+	if (!mp || !cat || fd < 0)
+		return merr(EINVAL);
+
+	memset(&xi, 0, sizeof(xi));
+	mutex_init(&xi.xi_lock);
+	mutex_init(&xi.xi_flushlock);
+	pthread_cond_init(&xi.xi_cv, NULL);
+	xi.xi_mp = mp;
+	xi.xi_cat = cat;
+	xi.xi_cb = cb;
+	xi.xi_cbarg = arg;
+	xport_params_init(&xi.xi_params, params);
+
+	tidv = kcalloc(xi.xi_params.xp_threads, sizeof(*tidv), GFP_KERNEL);
+	if (!tidv) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	err = xport_read(fd, &hdr, sizeof(hdr));
+	if (err)
+		goto errout;
+
+	xi.xi_stats.xs_arbytes = sizeof(hdr);
+
+	if (omf_pxh_magic(&hdr) != XPORT_MAGIC ||
+	    omf_pxh_version(&hdr) != XPORT_VERSION) {
+		err = merr(EBADMSG);
+		goto errout;
+	}
+
+	/* Write with the chunk size the archive was made with */
+	xi.xi_params.xp_chunksz = omf_pxh_chunksz(&hdr);
+	if (!xport_params_valid(&xi.xi_params)) {
+		err = merr(EBADMSG);
+		goto errout;
+	}
+
+	cbuf = malloc(xi.xi_params.xp_chunksz);
+	if (!cbuf) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	for (nthreads = 0; nthreads < xi.xi_params.xp_threads; nthreads++)
+		if (pthread_create(tidv + nthreads, NULL, xport_imp_worker,
+				   &xi))
+			break;
+
+	if (nthreads == 0) {
+		err = merr(EAGAIN);
+		goto errout;
+	}
+
+	for (nobj = 0; true; nobj++) {
+		err = xport_imp_read(&xi, fd, &job, nobj);
+		if (err || !job)
+			break;
+
+		rawlen = job->xj_type == XPORT_OBJ_MBLOCK ?
+			job->xj_rawlen : U64_MAX;
+
+		mutex_lock(&xi.xi_lock);
+		while (xi.xi_qlen >= 2 * nthreads && !xi.xi_err)
+			pthread_cond_wait(&xi.xi_cv, &xi.xi_lock.pth_mutex);
+
+		err = xi.xi_err;
+		if (!err) {
+			if (xi.xi_qtail)
+				xi.xi_qtail->xj_next = job;
+			else
+				xi.xi_qhead = job;
+			xi.xi_qtail = job;
+			xi.xi_qlen++;
+			pthread_cond_broadcast(&xi.xi_cv);
+		}
+		mutex_unlock(&xi.xi_lock);
+
+		if (err) {
+			xport_job_free(job);
+			break;
+		}
+
+		err = xport_imp_data(&xi, fd, cbuf, job, rawlen);
+		if (err)
+			break;
+	}
+
+	mutex_lock(&xi.xi_lock);
+	if (err)
+		xport_imp_seterr(&xi, err);
+	xi.xi_eof = true;
+	pthread_cond_broadcast(&xi.xi_cv);
+	mutex_unlock(&xi.xi_lock);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(tidv[i], NULL);
+
+	/* Jobs never picked up after an error */
+	while ((job = xi.xi_qhead)) {
+		xi.xi_qhead = job->xj_next;
+		xport_job_free(job);
+	}
+
+	/* Objects already imported are recorded even after an error */
+	err = xi.xi_err;
+	err2 = xport_imp_flush(&xi, xi.xi_batch);
+	if (!err)
+		err = err2;
+
+	if (!err)
+		err = xport_imp_fixgen(&xi);
+
+	if (!err && stats)
+		*stats = xi.xi_stats;
+
+errout:
+	xport_chunk_free(xi.xi_cfree);
+	free(cbuf);
+	free(xi.xi_emptyv);
+	kfree(tidv);
+	pthread_cond_destroy(&xi.xi_cv);
+	mutex_destroy(&xi.xi_flushlock);
+	mutex_destroy(&xi.xi_lock);
+
+	return err;
+}
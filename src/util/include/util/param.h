@@ -46,6 +46,7 @@ struct xoption {
  * times they were given on the command line.
  */
 struct common_opts {
+	int     co_active;      /* -A, --active             */
 	int     co_activate;    /* -a, --activate           */
 	int     co_discard;     /* -D, --discard            */
 	int     co_deactivate;  /* -d, --deactivate         */
@@ -55,9 +56,11 @@ struct common_opts {
 	int     co_log;         /* -L, --log                */
 	int     co_noresolve;   /* -N, --noresolve          */
 	int     co_dry_run;     /* -n, --dry_run            */
+	int     co_pairs;       /* -P, --pairs              */
 	int     co_nosuffix;    /* -p, --nosuffix           */
 	int     co_resize;      /* -r, --resize             */
 	int     co_mutest;      /* -T, --micron_test_only   */
+	int     co_tune;        /* -t, --tune               */
 	int     co_verbose;     /* -v, --verbose            */
 	int     co_yaml;        /* -Y, --yaml               */
 	FILE   *co_fp;          /* stdout / stderr based on opt_help */
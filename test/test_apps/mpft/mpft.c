@@ -13,6 +13,19 @@
 #include "mpft_mblock.h"
 #include "mpft_mdc.h"
 #include "mpft_ds.h"
+#include "mpft_mproc.h"
+#include "mpft_sos.h"
+#include "mpft_dedup.h"
+#include "mpft_chlog.h"
+#include "mpft_catalog.h"
+#include "mpft_mlspare.h"
+#include "mpft_sst.h"
+#include "mpft_mbstream.h"
+#include "mpft_intent.h"
+#include "mpft_xport.h"
+#include "mpft_stripe.h"
+#include "mpft_cmb.h"
+#include "mpft_mcache.h"
 
 #include <stdarg.h>
 #include <sysexits.h>
@@ -41,6 +54,19 @@ static struct group_s *m_group[] = {
 	&mpft_mlog,
 	&mpft_mdc,
 	&mpft_ds,
+	&mpft_mproc,
+	&mpft_sos,
+	&mpft_dedup,
+	&mpft_chlog,
+	&mpft_catalog,
+	&mpft_mlspare,
+	&mpft_sst,
+	&mpft_mbstream,
+	&mpft_intent,
+	&mpft_xport,
+	&mpft_stripe,
+	&mpft_cmb,
+	&mpft_mcache,
 	NULL
 };
 
@@ -502,6 +528,198 @@ pattern_compare(
 	return 0;
 }
 
+mpool_err_t
+mpft_mdc_create(
+	struct mpool   *ds,
+	size_t          captgt,
+	u64            *oid1,
+	u64            *oid2)
+{
+	struct mdc_capacity capreq;
+	mpool_err_t         err;
+
+	memset(&capreq, 0, sizeof(capreq));
+	capreq.mdt_captgt = captgt;
+
+	err = mpool_mdc_alloc(ds, oid1, oid2, MP_MED_CAPACITY, &capreq, NULL);
+	if (err)
+		return err;
+
+	err = mpool_mdc_commit(ds, *oid1, *oid2);
+	if (err)
+		mpool_mdc_destroy(ds, *oid1, *oid2);
+
+	return err;
+}
+
+void
+mpft_err(
+	const char     *test,
+	const char     *what,
+	mpool_err_t     err)
+{
+	char errbuf[256];
+
+	fprintf(stderr, "%s: %s: %s\n", test, what,
+		mpool_strinfo(err, errbuf, sizeof(errbuf)));
+}
+
+mpool_err_t
+mpft_mdc_start(
+	const char         *test,
+	int                 argc,
+	char              **argv,
+	struct param_inst  *params,
+	const char         *mpname,
+	size_t              captgt,
+	struct mpool      **ds,
+	u64                *oid)
+{
+	mpool_err_t err;
+	int         next_arg = 0;
+
+	err = process_params(argc, argv, params, &next_arg, 0);
+	if (err) {
+		fprintf(stderr, "%s: process_params failed\n", test);
+		return err;
+	}
+
+	if (mpname[0] == 0) {
+		fprintf(stderr, "%s: mpool (mp=<mpool>) must be specified\n",
+			test);
+		return merr(EINVAL);
+	}
+
+	err = mpool_open(mpname, O_RDWR, ds, NULL);
+	if (err) {
+		mpft_err(test, "mpool_open", err);
+		return err;
+	}
+
+	err = mpft_mdc_create(*ds, captgt, &oid[0], &oid[1]);
+	if (err) {
+		mpft_err(test, "mdc create", err);
+		mpool_close(*ds);
+	}
+
+	return err;
+}
+
+void
+mpft_mdc_finish(
+	struct mpool   *ds,
+	u64            *oid)
+{
+	mpool_mdc_destroy(ds, oid[0], oid[1]);
+	mpool_close(ds);
+}
+
+mpool_err_t
+mpft_mdc_usage(
+	struct mpool   *ds,
+	u64            *oid,
+	size_t         *usage)
+{
+	struct mpool_mdc   *mdc;
+	mpool_err_t         err;
+
+	err = mpool_mdc_open(ds, oid[0], oid[1], 0, &mdc);
+	if (err)
+		return err;
+
+	err = mpool_mdc_usage(mdc, usage);
+	mpool_mdc_close(mdc);
+
+	return err;
+}
+
+mpool_err_t
+mpft_child_start(
+	mpft_child_func_t  *func,
+	void               *arg,
+	pid_t              *pid,
+	int                *fd)
+{
+	mpool_err_t err;
+	int         pfd[2];
+
+	if (pipe(pfd))
+		return merr(errno);
+
+	fflush(NULL);
+
+	*pid = fork();
+	if (*pid == -1) {
+		err = merr(errno);
+		close(pfd[0]);
+		close(pfd[1]);
+		return err;
+	}
+
+	if (*pid == 0) {
+		close(pfd[0]);
+		err = func(arg, pfd[1]);
+		_exit(err ? 1 : 0);
+	}
+
+	close(pfd[1]);
+	*fd = pfd[0];
+
+	return 0;
+}
+
+mpool_err_t
+mpft_child_wait(
+	const char *test,
+	pid_t       pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status)) {
+		fprintf(stderr, "%s: child failed\n", test);
+		return merr(ECHILD);
+	}
+
+	return 0;
+}
+
+mpool_err_t
+mpft_crash(
+	const char         *test,
+	mpft_child_func_t  *func,
+	mpft_report_func_t *report,
+	void               *arg,
+	size_t              msgsz)
+{
+	mpool_err_t err;
+	pid_t       pid;
+	char        msg[64];
+	int         fd;
+
+	if (msgsz > sizeof(msg))
+		return merr(EINVAL);
+
+	err = mpft_child_start(func, arg, &pid, &fd);
+	if (err)
+		return err;
+
+	while (msgsz > 0 && read(fd, msg, msgsz) == msgsz)
+		report(arg, msg);
+	close(fd);
+
+	return mpft_child_wait(test, pid);
+}
+
+mpool_err_t
+mpft_report(
+	int         fd,
+	const void *msg,
+	size_t      msgsz)
+{
+	return write(fd, msg, msgsz) == msgsz ? 0 : merr(EIO);
+}
+
 #define LOG_MSG_SIZE 1024
 void
 log_command_line(
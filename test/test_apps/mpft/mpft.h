@@ -6,8 +6,12 @@
 #ifndef MPOOL_MPFT_H
 #define MPOOL_MPFT_H
 
+#include <sys/types.h>
+
 #include <mpool/mpool.h>
 
+struct param_inst;
+
 typedef mpool_err_t (test_func_t)(int argc, char **argv);
 typedef void   (help_func_t)(void);
 
@@ -53,4 +57,118 @@ pattern_compare(
 mpool_err_t
 mpft_launch_actor(char *actor, ...);
 
+/**
+ * mpft_mdc_create() - Allocate and commit an MDC for a test
+ * @ds:     mpool handle
+ * @captgt: capacity target of each mlog
+ * @oid1:   MDC OID 1 (output)
+ * @oid2:   MDC OID 2 (output)
+ */
+mpool_err_t
+mpft_mdc_create(
+	struct mpool   *ds,
+	size_t          captgt,
+	uint64_t       *oid1,
+	uint64_t       *oid2);
+
+/**
+ * mpft_err() - Report a failed step of a test
+ * @test: test name
+ * @what: step that failed
+ * @err:  error
+ */
+void
+mpft_err(
+	const char     *test,
+	const char     *what,
+	mpool_err_t     err);
+
+/**
+ * mpft_mdc_start() - Parse a test's parameters, open its mpool and create
+ * an MDC for it
+ * @test:   test name
+ * @params: parameter table, which sets @mpname
+ * @mpname: mpool name
+ * @captgt: capacity target of each MDC mlog
+ * @ds:     mpool handle (output)
+ * @oid:    MDC OIDs (output)
+ */
+mpool_err_t
+mpft_mdc_start(
+	const char         *test,
+	int                 argc,
+	char              **argv,
+	struct param_inst  *params,
+	const char         *mpname,
+	size_t              captgt,
+	struct mpool      **ds,
+	uint64_t           *oid);
+
+/**
+ * mpft_mdc_finish() - Destroy a test's MDC and close its mpool
+ */
+void
+mpft_mdc_finish(
+	struct mpool   *ds,
+	uint64_t       *oid);
+
+/**
+ * mpft_mdc_usage() - Return the usage of a closed MDC
+ */
+mpool_err_t
+mpft_mdc_usage(
+	struct mpool   *ds,
+	uint64_t       *oid,
+	size_t         *usage);
+
+/*
+ * Crash tests run their workload in a child process that exits without
+ * closing anything, and report their progress to the parent over a pipe.
+ */
+typedef mpool_err_t (mpft_child_func_t)(void *arg, int fd);
+typedef void (mpft_report_func_t)(void *arg, const void *msg);
+
+/**
+ * mpft_child_start() - Fork a child that runs @func and exits
+ * @func: child body, called with the write end of the report pipe
+ * @pid:  child pid (output)
+ * @fd:   read end of the report pipe (output)
+ */
+mpool_err_t
+mpft_child_start(
+	mpft_child_func_t  *func,
+	void               *arg,
+	pid_t              *pid,
+	int                *fd);
+
+/**
+ * mpft_child_wait() - Reap a child, which must have exited with success
+ */
+mpool_err_t
+mpft_child_wait(
+	const char *test,
+	pid_t       pid);
+
+/**
+ * mpft_crash() - Run @func in a child and wait for it to exit
+ * @report: called with each @msgsz byte report the child sends
+ * @msgsz:  report size, at most 64 bytes, or 0 if the child sends none
+ */
+mpool_err_t
+mpft_crash(
+	const char         *test,
+	mpft_child_func_t  *func,
+	mpft_report_func_t *report,
+	void               *arg,
+	size_t              msgsz);
+
+/**
+ * mpft_report() - Send a report from a child to its parent
+ */
+mpool_err_t
+mpft_report(
+	int         fd,
+	const void *msg,
+	size_t      msgsz);
+
 #endif /* MPOOL_MPFT_H */
@@ -0,0 +1,720 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/platform.h>
+#include <util/param.h>
+#include <mpool/mpool.h>
+
+#include "mpft.h"
+#include "mpft_catalog.h"
+
+#define merr(_errnum)   (_errnum)
+
+#define CAT_MDC_CAPTGT  (2 * 1024 * 1024)
+#define CAT_BATCH       (8)
+#define CAT_KEYDIGITS   (8)
+
+/*
+ * Name "k" is the key in CAT_KEYDIGITS decimal digits, padded to between
+ * CAT_KEYDIGITS and MPOOL_CATALOG_NAME_MAX characters.
+ */
+char cat_mpool[MPOOL_NAME_LEN_MAX];
+u32  cat_names = 1024;
+u32  cat_rounds = 16;
+u32  cat_meta = 128;
+
+static
+struct param_inst cat_params[] = {
+	PARAM_INST_STRING(cat_mpool, sizeof(cat_mpool), "mp", "mpool"),
+	PARAM_INST_U32(cat_names, "names", "number of names"),
+	PARAM_INST_U32(cat_rounds, "rounds", "number of update rounds"),
+	PARAM_INST_U32(cat_meta, "meta", "maximum metadata length"),
+	PARAM_INST_END
+};
+
+/**
+ * struct cat_test - state shared by the steps of a catalog test
+ * @ct_test: test name
+ * @ct_ds:   mpool handle
+ * @ct_cat:  catalog handle
+ * @ct_oid:  MDC OIDs
+ * @ct_verv: version of each name, 0 if absent
+ * @ct_name: name buffers, one per op of a batch, with room for an
+ *           overlong name
+ * @ct_meta: metadata buffers, one per op of a batch
+ * @ct_buf:  metadata read buffer
+ */
+struct cat_test {
+	const char             *ct_test;
+	struct mpool           *ct_ds;
+	struct mpool_catalog   *ct_cat;
+	u64                     ct_oid[2];
+	u32                    *ct_verv;
+	char                    ct_name[CAT_BATCH][MPOOL_CATALOG_NAME_MAX + 2];
+	char                    ct_meta[CAT_BATCH][MPOOL_CATALOG_META_MAX];
+	char                    ct_buf[MPOOL_CATALOG_META_MAX];
+};
+
+static
+void
+cat_name(
+	char   *buf,
+	u32     key)
+{
+	size_t len = CAT_KEYDIGITS +
+		(key * 7) % (MPOOL_CATALOG_NAME_MAX - CAT_KEYDIGITS + 1);
+
+	snprintf(buf, CAT_KEYDIGITS + 1, "%0*u", CAT_KEYDIGITS, key);
+	memset(buf + CAT_KEYDIGITS, 'a' + key % 26, len - CAT_KEYDIGITS);
+	buf[len] = '\0';
+}
+
+static
+u64
+cat_objid(
+	u32     key,
+	u32     ver)
+{
+	return ((u64)key << 32) | ver;
+}
+
+static
+size_t
+cat_meta_len(
+	u32     key,
+	u32     ver)
+{
+	return (key * 13 + ver * 5) % (cat_meta + 1);
+}
+
+static
+void
+cat_meta_fill(
+	char   *buf,
+	u32     key,
+	u32     ver)
+{
+	size_t len = cat_meta_len(key, ver);
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (char)(key * 31 + ver * 7 + i);
+}
+
+/**
+ * cat_op_init() - Set up op "i" of a batch to put or delete name "key"
+ * @ver: version to put, 0 to delete
+ */
+static
+void
+cat_op_init(
+	struct cat_test            *t,
+	struct mpool_catalog_op    *op,
+	int                         i,
+	u32                         key,
+	u32                         ver)
+{
+	memset(op, 0, sizeof(*op));
+
+	cat_name(t->ct_name[i], key);
+	op->cop_name = t->ct_name[i];
+
+	if (ver == 0) {
+		op->cop_type = MPOOL_CATALOG_DEL;
+		return;
+	}
+
+	cat_meta_fill(t->ct_meta[i], key, ver);
+	op->cop_type = MPOOL_CATALOG_PUT;
+	op->cop_objid = cat_objid(key, ver);
+	op->cop_meta = t->ct_meta[i];
+	op->cop_metalen = cat_meta_len(key, ver);
+}
+
+/**
+ * cat_round() - Apply one round of updates and track them in the model
+ * @t:   test state, NULL to only update the model
+ * @ver: version of this round, starting at 1
+ *
+ * Names are updated in batches of CAT_BATCH ops; every fifth name (offset
+ * by the round) is deleted instead of put.  Odd rounds use single puts
+ * and deletes instead of batches.
+ */
+static
+mpool_err_t
+cat_round(
+	struct cat_test    *t,
+	u32                *verv,
+	u32                 ver)
+{
+	struct mpool_catalog_op opv[CAT_BATCH];
+	mpool_err_t             err = 0;
+	u32                     key, v, opc = 0;
+
+	for (key = 0; key < cat_names; key++) {
+		v = (key + ver) % 5 == 0 ? 0 : ver;
+
+		if (t && ver % 2) {
+			cat_name(t->ct_name[0], key);
+			cat_meta_fill(t->ct_meta[0], key, v);
+
+			if (v)
+				err = mpool_catalog_put(t->ct_cat,
+					t->ct_name[0], cat_objid(key, v),
+					t->ct_meta[0], cat_meta_len(key, v));
+			else if (verv[key])
+				err = mpool_catalog_delete(t->ct_cat,
+							   t->ct_name[0]);
+			if (err)
+				return err;
+		} else if (t) {
+			cat_op_init(t, opv + opc, opc, key, v);
+
+			if (++opc == CAT_BATCH || key + 1 == cat_names) {
+				err = mpool_catalog_update(t->ct_cat, opv, opc);
+				if (err)
+					return err;
+				opc = 0;
+			}
+		}
+
+		verv[key] = v;
+	}
+
+	return 0;
+}
+
+/**
+ * struct cat_walk - foreach callback state
+ */
+struct cat_walk {
+	struct cat_test    *cw_t;
+	u32                 cw_count;
+	u32                 cw_bad;
+};
+
+static
+int
+cat_walk_cb(
+	void           *arg,
+	const char     *name,
+	u64             objid,
+	const void     *meta,
+	size_t          metalen)
+{
+	struct cat_walk    *w = arg;
+	struct cat_test    *t = w->cw_t;
+	u32                 key, ver;
+
+	w->cw_count++;
+
+	key = strtoul(name, NULL, 10);
+	ver = key < cat_names ? t->ct_verv[key] : 0;
+
+	cat_name(t->ct_name[0], key);
+	cat_meta_fill(t->ct_meta[0], key, ver);
+
+	if (ver == 0 || strcmp(name, t->ct_name[0]) ||
+	    objid != cat_objid(key, ver) ||
+	    metalen != cat_meta_len(key, ver) ||
+	    memcmp(meta, t->ct_meta[0], metalen)) {
+		if (w->cw_bad++ < 8)
+			fprintf(stderr, "%s: foreach: unexpected %.16s... "
+				"objid 0x%lx\n", t->ct_test, name,
+				(ulong)objid);
+	}
+
+	return 0;
+}
+
+/**
+ * cat_verify() - Check the catalog against the model, by name and by
+ * iteration
+ */
+static
+int
+cat_verify(
+	struct cat_test    *t)
+{
+	struct mpool_catalog_props  props;
+	struct cat_walk             w;
+	mpool_err_t                 err;
+	size_t                      metalen;
+	u64                         objid;
+	u32                         key, count = 0;
+	int                         bad = 0;
+
+	for (key = 0; key < cat_names; key++) {
+		u32 ver = t->ct_verv[key];
+
+		cat_name(t->ct_name[0], key);
+
+		err = mpool_catalog_get(t->ct_cat, t->ct_name[0], &objid,
+					t->ct_buf, sizeof(t->ct_buf), &metalen);
+		if (ver == 0) {
+			if (mpool_errno(err) != ENOENT && bad++ < 8)
+				fprintf(stderr, "%s: name %u: deleted name "
+					"found\n", t->ct_test, key);
+			continue;
+		}
+
+		count++;
+		cat_meta_fill(t->ct_meta[0], key, ver);
+
+		if (err || objid != cat_objid(key, ver) ||
+		    metalen != cat_meta_len(key, ver) ||
+		    memcmp(t->ct_buf, t->ct_meta[0], metalen)) {
+			if (bad++ < 8)
+				fprintf(stderr, "%s: name %u: err %d objid "
+					"0x%lx, expected version %u\n",
+					t->ct_test, key, mpool_errno(err),
+					(ulong)objid, ver);
+		}
+	}
+
+	memset(&w, 0, sizeof(w));
+	w.cw_t = t;
+
+	err = mpool_catalog_foreach(t->ct_cat, cat_walk_cb, &w);
+	if (!err)
+		err = mpool_catalog_getprops(t->ct_cat, &props);
+	if (err || w.cw_bad || w.cw_count != count ||
+	    props.cgp_count != count) {
+		fprintf(stderr, "%s: foreach: err %d, %u bad, %u names, "
+			"expected %u\n", t->ct_test, mpool_errno(err),
+			w.cw_bad, w.cw_count, count);
+		bad++;
+	}
+
+	if (bad)
+		fprintf(stderr, "%s: catalog does not match\n", t->ct_test);
+
+	return bad;
+}
+
+static
+mpool_err_t
+cat_reopen(
+	struct cat_test    *t)
+{
+	mpool_err_t err;
+
+	err = mpool_catalog_close(t->ct_cat);
+	t->ct_cat = NULL;
+	if (err) {
+		mpft_err(t->ct_test, "mpool_catalog_close", err);
+		return err;
+	}
+
+	err = mpool_catalog_open(t->ct_ds, t->ct_oid[0], t->ct_oid[1],
+				 &t->ct_cat);
+	if (err)
+		mpft_err(t->ct_test, "mpool_catalog_open (replay)", err);
+
+	return err;
+}
+
+/**
+ * cat_start() - Parse parameters, open the mpool, create the catalog MDC
+ * and open the catalog
+ */
+static
+mpool_err_t
+cat_start(
+	struct cat_test   **tp,
+	int                 argc,
+	char              **argv)
+{
+	struct cat_test    *t;
+	mpool_err_t         err;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return merr(ENOMEM);
+
+	t->ct_test = argv[0];
+
+	err = mpft_mdc_start(t->ct_test, argc, argv, cat_params, cat_mpool,
+			     CAT_MDC_CAPTGT, &t->ct_ds, t->ct_oid);
+	if (err) {
+		free(t);
+		return err;
+	}
+
+	if (cat_names == 0 || cat_rounds == 0 ||
+	    cat_meta > MPOOL_CATALOG_META_MAX) {
+		fprintf(stderr, "%s: names and rounds must be non-zero, "
+			"meta at most %u\n", t->ct_test,
+			MPOOL_CATALOG_META_MAX);
+		err = merr(EINVAL);
+		goto errout;
+	}
+
+	t->ct_verv = calloc(cat_names, sizeof(*t->ct_verv));
+	if (!t->ct_verv) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	err = mpool_catalog_open(t->ct_ds, t->ct_oid[0], t->ct_oid[1],
+				 &t->ct_cat);
+	if (!err) {
+		*tp = t;
+		return 0;
+	}
+
+	mpft_err(t->ct_test, "mpool_catalog_open", err);
+errout:
+	mpft_mdc_finish(t->ct_ds, t->ct_oid);
+	free(t->ct_verv);
+	free(t);
+
+	return err;
+}
+
+static
+void
+cat_finish(
+	struct cat_test    *t)
+{
+	if (t->ct_cat)
+		mpool_catalog_close(t->ct_cat);
+
+	mpft_mdc_finish(t->ct_ds, t->ct_oid);
+
+	free(t->ct_verv);
+	free(t);
+}
+
+/**
+ *
+ * Replay
+ *
+ */
+
+/**
+ * The replay test applies rounds of puts, deletes and batched updates,
+ * and checks lookups, iteration and the name count against a model
+ * before and after the catalog is replayed from its MDC.  It also covers
+ * the error paths, including that a batch with one invalid op is not
+ * applied at all.
+ */
+static
+void
+cat_correctness_replay_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft catalog.correctness.replay [options]\n");
+	show_default_params(cat_params, 0);
+}
+
+static
+mpool_err_t
+cat_correctness_replay(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_catalog_op opv[CAT_BATCH];
+	struct cat_test        *t;
+	mpool_err_t             err;
+	size_t                  metalen;
+	u32                     r, key;
+
+	err = cat_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	for (r = 1; r <= cat_rounds && !err; r++)
+		err = cat_round(t, t->ct_verv, r);
+	if (err) {
+		mpft_err(t->ct_test, "update", err);
+		goto out;
+	}
+
+	if (cat_verify(t)) {
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	/* Error paths */
+	for (key = 0; key < cat_names; key++)
+		if (t->ct_verv[key] == 0)
+			break;
+
+	if (key < cat_names) {
+		cat_name(t->ct_name[0], key);
+
+		err = mpool_catalog_delete(t->ct_cat, t->ct_name[0]);
+		if (mpool_errno(err) != ENOENT) {
+			fprintf(stderr, "%s: delete of missing name: %d\n",
+				t->ct_test, mpool_errno(err));
+			err = merr(EINVAL);
+			goto out;
+		}
+	}
+
+	for (key = 0; key < cat_names; key++)
+		if (cat_meta_len(key, t->ct_verv[key]) > 1 && t->ct_verv[key])
+			break;
+
+	if (key < cat_names) {
+		cat_name(t->ct_name[0], key);
+
+		err = mpool_catalog_get(t->ct_cat, t->ct_name[0], NULL,
+					t->ct_buf, 1, &metalen);
+		if (mpool_errno(err) != EOVERFLOW ||
+		    metalen != cat_meta_len(key, t->ct_verv[key])) {
+			fprintf(stderr, "%s: short get: %d metalen %zu\n",
+				t->ct_test, mpool_errno(err), metalen);
+			err = merr(EINVAL);
+			goto out;
+		}
+	}
+
+	/* A batch whose last op has an overlong name changes nothing */
+	for (key = 0; key < CAT_BATCH - 1; key++)
+		cat_op_init(t, opv + key, key, key, r + 1);
+
+	memset(t->ct_name[key], 'x', MPOOL_CATALOG_NAME_MAX + 1);
+	t->ct_name[key][MPOOL_CATALOG_NAME_MAX + 1] = '\0';
+	opv[key].cop_type = MPOOL_CATALOG_PUT;
+	opv[key].cop_name = t->ct_name[key];
+
+	err = mpool_catalog_update(t->ct_cat, opv, CAT_BATCH);
+	if (mpool_errno(err) != EINVAL) {
+		fprintf(stderr, "%s: invalid batch: %d\n",
+			t->ct_test, mpool_errno(err));
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	err = mpool_catalog_put(t->ct_cat, t->ct_name[0], 1, t->ct_meta[0],
+				MPOOL_CATALOG_META_MAX + 1);
+	if (mpool_errno(err) != EINVAL) {
+		fprintf(stderr, "%s: oversized metadata: %d\n",
+			t->ct_test, mpool_errno(err));
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	if (cat_verify(t)) {
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	err = cat_reopen(t);
+	if (!err && cat_verify(t))
+		err = merr(EINVAL);
+
+	/* The replayed catalog must take further updates */
+	if (!err)
+		err = cat_round(t, t->ct_verv, r);
+	if (!err)
+		err = cat_reopen(t);
+	if (!err && cat_verify(t))
+		err = merr(EINVAL);
+
+out:
+	cat_finish(t);
+
+	return err;
+}
+
+/**
+ *
+ * Compaction
+ *
+ */
+
+/**
+ * The compaction test keeps updating names until the catalog has
+ * compacted its MDC at least twice, which shows up as a drop in the MDC
+ * usage, verifying the catalog after each compaction and after a replay
+ * of the compacted MDC.
+ */
+static
+void
+cat_correctness_compaction_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft catalog.correctness.compaction [options]\n");
+	show_default_params(cat_params, 0);
+}
+
+static
+mpool_err_t
+cat_correctness_compaction(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_catalog_props  props;
+	struct cat_test            *t;
+	mpool_err_t                 err;
+	u64                         usage = 0;
+	u32                         r, compactions = 0;
+
+	err = cat_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	for (r = 1; compactions < 2; r++) {
+		if (r > cat_rounds * 64) {
+			fprintf(stderr, "%s: no MDC compaction after %u "
+				"rounds\n", t->ct_test, r - 1);
+			err = merr(EINVAL);
+			goto out;
+		}
+
+		err = cat_round(t, t->ct_verv, r);
+		if (!err)
+			err = mpool_catalog_getprops(t->ct_cat, &props);
+		if (err) {
+			mpft_err(t->ct_test, "update", err);
+			goto out;
+		}
+
+		if (props.cgp_usage < usage) {
+			compactions++;
+
+			if (cat_verify(t) || cat_reopen(t) || cat_verify(t)) {
+				err = merr(EINVAL);
+				goto out;
+			}
+		}
+
+		usage = props.cgp_usage;
+	}
+
+out:
+	cat_finish(t);
+
+	return err;
+}
+
+/**
+ *
+ * Crash
+ *
+ */
+
+/**
+ * Every update is durable on return.  The crash test forks a child that
+ * opens its own mpool handle, applies rounds of updates and exits
+ * without closing the catalog.  The parent reopens the catalog, which
+ * must match the child's updates exactly, and keeps updating it.
+ */
+static
+void
+cat_correctness_crash_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft catalog.correctness.crash [options]\n");
+	show_default_params(cat_params, 0);
+}
+
+static
+mpool_err_t
+cat_crash_child(
+	void   *arg,
+	int     fd)
+{
+	struct cat_test    *t = arg;
+	mpool_err_t         err;
+	u32                 r;
+
+	err = mpool_open(cat_mpool, O_RDWR, &t->ct_ds, NULL);
+	if (!err)
+		err = mpool_catalog_open(t->ct_ds, t->ct_oid[0], t->ct_oid[1],
+					 &t->ct_cat);
+
+	for (r = 1; r <= cat_rounds && !err; r++)
+		err = cat_round(t, t->ct_verv, r);
+
+	return err;
+}
+
+static
+mpool_err_t
+cat_correctness_crash(
+	int     argc,
+	char  **argv)
+{
+	struct cat_test    *t;
+	mpool_err_t         err;
+	u32                 r;
+
+	err = cat_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	/* The child opens its own handle */
+	mpool_catalog_close(t->ct_cat);
+	t->ct_cat = NULL;
+
+	err = mpft_crash(t->ct_test, cat_crash_child, NULL, t, 0);
+	if (err)
+		goto out;
+
+	for (r = 1; r <= cat_rounds; r++)
+		cat_round(NULL, t->ct_verv, r);
+
+	err = mpool_catalog_open(t->ct_ds, t->ct_oid[0], t->ct_oid[1],
+				 &t->ct_cat);
+	if (err) {
+		mpft_err(t->ct_test, "mpool_catalog_open (recovery)", err);
+		goto out;
+	}
+
+	if (cat_verify(t)) {
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	err = cat_round(t, t->ct_verv, r);
+	if (!err)
+		err = cat_reopen(t);
+	if (!err && cat_verify(t))
+		err = merr(EINVAL);
+
+out:
+	cat_finish(t);
+
+	return err;
+}
+
+struct test_s cat_tests[] = {
+	{ "replay", MPFT_TEST_TYPE_CORRECTNESS, cat_correctness_replay,
+		cat_correctness_replay_help },
+	{ "compaction", MPFT_TEST_TYPE_CORRECTNESS, cat_correctness_compaction,
+		cat_correctness_compaction_help },
+	{ "crash", MPFT_TEST_TYPE_CORRECTNESS, cat_correctness_crash,
+		cat_correctness_crash_help },
+	{ NULL, MPFT_TEST_TYPE_INVALID, NULL, NULL },
+};
+
+void
+cat_help(void)
+{
+	int i = 0;
+
+	fprintf(co.co_fp,
+		"\ncatalog tests validate the behavior of the object catalog\n");
+
+	fprintf(co.co_fp, "Available tests include:\n");
+	while (cat_tests[i].test_name) {
+		fprintf(co.co_fp, "\t%s\n", cat_tests[i].test_name);
+		i++;
+	}
+}
+
+struct group_s mpft_catalog = {
+	.group_name = "catalog",
+	.group_test = cat_tests,
+	.group_help = cat_help,
+};
@@ -0,0 +1,921 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/platform.h>
+#include <util/minmax.h>
+#include <util/param.h>
+#include <mpool/mpool.h>
+
+#include "mpft.h"
+#include "mpft_chlog.h"
+
+#define merr(_errnum)   (_errnum)
+
+#define CH_MDC_CAPTGT   (1024 * 1024)
+#define CH_REC_MAX      (4096)
+#define CH_REC_HDRSZ    (2 * sizeof(u32))
+#define CH_ID_RECOVERED (1u << 30)
+#define CH_SP_TARGET    (2)
+#define CH_SP_WAIT_MS   (60 * 1000)
+
+/*
+ * Small links make the chain roll over many times.
+ *
+ * The tests truncate everything but the active link when done.  The
+ * active link and its spare stay allocated, there being no interface to
+ * destroy a chained log.  So do the members of a spare pool.
+ */
+char ch_mpool[MPOOL_NAME_LEN_MAX];
+u32  ch_records = 4096;
+u32  ch_captgt = 1024 * 1024;
+
+static
+struct param_inst ch_params[] = {
+	PARAM_INST_STRING(ch_mpool, sizeof(ch_mpool), "mp", "mpool"),
+	PARAM_INST_U32(ch_records, "records", "number of records"),
+	PARAM_INST_U32_SIZE(ch_captgt, "captgt", "link capacity target"),
+	PARAM_INST_END
+};
+
+/**
+ * struct ch_test - state shared by the steps of a chlog test
+ * @ct_test:  test name
+ * @ct_ds:    mpool handle
+ * @ct_ch:    chained log handle
+ * @ct_oid:   MDC OIDs
+ * @ct_sp:    spare pool of the chain, or NULL
+ * @ct_spoid: MDC OIDs of @ct_sp
+ * @ct_buf:   record buffer
+ * @ct_rbuf:  read buffer
+ */
+struct ch_test {
+	const char             *ct_test;
+	struct mpool           *ct_ds;
+	struct mpool_chlog     *ct_ch;
+	u64                     ct_oid[2];
+	struct mpool_mlspare   *ct_sp;
+	u64                     ct_spoid[2];
+	char                   *ct_buf;
+	char                   *ct_rbuf;
+};
+
+/**
+ * ch_rec_len() - Length of record "id"
+ *
+ * Each record starts with its id and length, so a reader can tell which
+ * record it got.
+ */
+static
+size_t
+ch_rec_len(
+	u32     id)
+{
+	return CH_REC_HDRSZ + (id * 97) % (CH_REC_MAX - CH_REC_HDRSZ);
+}
+
+static
+void
+ch_rec_fill(
+	char   *buf,
+	u32     id)
+{
+	u32    hdr[2];
+	size_t i;
+
+	hdr[0] = id;
+	hdr[1] = ch_rec_len(id);
+	memcpy(buf, hdr, sizeof(hdr));
+
+	for (i = CH_REC_HDRSZ; i < hdr[1]; i++)
+		buf[i] = (char)(id * 7 + i);
+}
+
+static
+mpool_err_t
+ch_chlog_open(
+	struct ch_test *t)
+{
+	struct mpool_chlog_params params;
+
+	memset(&params, 0, sizeof(params));
+	params.chp_captgt = ch_captgt;
+	params.chp_mclassp = MP_MED_CAPACITY;
+	params.chp_spares = t->ct_sp;
+
+	return mpool_chlog_open(t->ct_ds, t->ct_oid[0], t->ct_oid[1],
+				&params, &t->ct_ch);
+}
+
+/**
+ * ch_append() - Append records [first, last)
+ * @syncint: sync every syncint-th record, 0 for never
+ */
+static
+mpool_err_t
+ch_append(
+	struct ch_test *t,
+	u32             first,
+	u32             last,
+	u32             syncint)
+{
+	mpool_err_t err;
+	u32         id;
+
+	for (id = first; id < last; id++) {
+		ch_rec_fill(t->ct_buf, id);
+
+		err = mpool_chlog_append(t->ct_ch, t->ct_buf, ch_rec_len(id),
+					 syncint && id % syncint == 0);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/**
+ * ch_read() - Read the next record and check that it is intact
+ * @id: record id (output)
+ *
+ * Return: ENODATA at the end of the chain.
+ */
+static
+mpool_err_t
+ch_read(
+	struct ch_test *t,
+	u32            *id)
+{
+	mpool_err_t err;
+	size_t      rdlen;
+	u32         hdr[2];
+
+	err = mpool_chlog_read_next(t->ct_ch, t->ct_rbuf, CH_REC_MAX, &rdlen);
+	if (err)
+		return err;
+
+	if (rdlen == 0)
+		return merr(ENODATA);
+
+	if (rdlen < CH_REC_HDRSZ)
+		return merr(EBADMSG);
+
+	memcpy(hdr, t->ct_rbuf, sizeof(hdr));
+	ch_rec_fill(t->ct_buf, hdr[0]);
+
+	if (rdlen != hdr[1] || rdlen != ch_rec_len(hdr[0]) ||
+	    memcmp(t->ct_rbuf, t->ct_buf, rdlen)) {
+		fprintf(stderr, "%s: record %u corrupt, length %zu\n",
+			t->ct_test, hdr[0], rdlen);
+		return merr(EBADMSG);
+	}
+
+	*id = hdr[0];
+
+	return 0;
+}
+
+/**
+ * ch_expect() - Read records [first, last) from the reader's position
+ */
+static
+mpool_err_t
+ch_expect(
+	struct ch_test *t,
+	u32             first,
+	u32             last)
+{
+	mpool_err_t err;
+	u32         id, expect;
+
+	for (expect = first; expect < last; expect++) {
+		err = ch_read(t, &id);
+		if (err) {
+			fprintf(stderr, "%s: reading record %u: %d\n",
+				t->ct_test, expect, mpool_errno(err));
+			return err;
+		}
+
+		if (id != expect) {
+			fprintf(stderr, "%s: got record %u, expected %u\n",
+				t->ct_test, id, expect);
+			return merr(EBADMSG);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * ch_end() - Check that the reader is at the end of the chain
+ */
+static
+mpool_err_t
+ch_end(
+	struct ch_test *t)
+{
+	mpool_err_t err;
+	u32         id;
+
+	err = ch_read(t, &id);
+	if (mpool_errno(err) != ENODATA) {
+		fprintf(stderr, "%s: record %u past the end of the chain\n",
+			t->ct_test, id);
+		return err ?: merr(EBADMSG);
+	}
+
+	return 0;
+}
+
+/**
+ * ch_verify() - Read the whole chain, expecting records [first, last)
+ */
+static
+mpool_err_t
+ch_verify(
+	struct ch_test *t,
+	u32             first,
+	u32             last)
+{
+	mpool_err_t err;
+
+	err = mpool_chlog_read_init(t->ct_ch);
+	if (!err)
+		err = ch_expect(t, first, last);
+	if (!err)
+		err = ch_end(t);
+
+	return err;
+}
+
+/**
+ * ch_first() - Id of the first record in the chain, by reading it
+ */
+static
+mpool_err_t
+ch_first(
+	struct ch_test *t,
+	u32            *id)
+{
+	mpool_err_t err;
+
+	err = mpool_chlog_read_init(t->ct_ch);
+	if (!err)
+		err = ch_read(t, id);
+
+	return err;
+}
+
+/**
+ * ch_reopen() - Close and reopen the chained log, replaying its MDC
+ */
+static
+mpool_err_t
+ch_reopen(
+	struct ch_test *t)
+{
+	mpool_err_t err;
+
+	err = mpool_chlog_close(t->ct_ch);
+	t->ct_ch = NULL;
+	if (err) {
+		mpft_err(t->ct_test, "mpool_chlog_close", err);
+		return err;
+	}
+
+	err = ch_chlog_open(t);
+	if (err)
+		mpft_err(t->ct_test, "mpool_chlog_open (replay)", err);
+
+	return err;
+}
+
+/**
+ * ch_start() - Parse parameters, open the mpool and create the chain MDC
+ */
+static
+mpool_err_t
+ch_start(
+	struct ch_test *t,
+	int             argc,
+	char          **argv)
+{
+	mpool_err_t err;
+
+	memset(t, 0, sizeof(*t));
+	t->ct_test = argv[0];
+
+	err = mpft_mdc_start(t->ct_test, argc, argv, ch_params, ch_mpool,
+			     CH_MDC_CAPTGT, &t->ct_ds, t->ct_oid);
+	if (err)
+		return err;
+
+	if (ch_records < 4 || ch_records >= CH_ID_RECOVERED) {
+		fprintf(stderr, "%s: records must be in [4, %u)\n",
+			t->ct_test, CH_ID_RECOVERED);
+		err = merr(EINVAL);
+		goto errout;
+	}
+
+	t->ct_buf = malloc(CH_REC_MAX);
+	t->ct_rbuf = malloc(CH_REC_MAX);
+	if (!t->ct_buf || !t->ct_rbuf) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	err = ch_chlog_open(t);
+	if (!err)
+		return 0;
+
+	mpft_err(t->ct_test, "mpool_chlog_open", err);
+errout:
+	mpft_mdc_finish(t->ct_ds, t->ct_oid);
+	free(t->ct_buf);
+	free(t->ct_rbuf);
+
+	return err;
+}
+
+/**
+ * ch_finish() - Truncate the chain, destroy its MDC and close the mpool
+ */
+static
+void
+ch_finish(
+	struct ch_test *t)
+{
+	mpool_err_t err = 0;
+
+	if (!t->ct_ch)
+		err = ch_chlog_open(t);
+	if (!err)
+		err = mpool_chlog_trunc(t->ct_ch, U64_MAX);
+	if (err)
+		mpft_err(t->ct_test, "cleanup", err);
+
+	if (t->ct_ch)
+		mpool_chlog_close(t->ct_ch);
+
+	if (t->ct_sp) {
+		mpool_mlspare_close(t->ct_sp);
+		mpool_mdc_destroy(t->ct_ds, t->ct_spoid[0], t->ct_spoid[1]);
+	}
+
+	mpft_mdc_finish(t->ct_ds, t->ct_oid);
+
+	free(t->ct_buf);
+	free(t->ct_rbuf);
+}
+
+/**
+ *
+ * Replay
+ *
+ */
+
+/**
+ * The replay test appends enough records to roll over many links, reads
+ * them back across the links before and after the chain is replayed from
+ * its MDC, and keeps appending after the replay.  It also covers the
+ * EOVERFLOW and EFBIG error paths.
+ */
+static
+void
+ch_correctness_replay_help(void)
+{
+	fprintf(co.co_fp, "\nusage: mpft chlog.correctness.replay [options]\n");
+	show_default_params(ch_params, 0);
+}
+
+static
+mpool_err_t
+ch_correctness_replay(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_chlog_props    props, props2;
+	struct ch_test              t;
+	mpool_err_t                 err;
+	size_t                      rdlen;
+	char                       *big;
+	u32                         id, half;
+
+	err = ch_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	half = ch_records / 2;
+
+	err = ch_append(&t, 0, half, 64);
+	if (err) {
+		mpft_err(t.ct_test, "append", err);
+		goto out;
+	}
+
+	err = ch_verify(&t, 0, half);
+	if (err)
+		goto out;
+
+	/* A short buffer fails with EOVERFLOW, the record can be reread */
+	err = ch_first(&t, &id);
+	if (!err) {
+		err = mpool_chlog_read_next(t.ct_ch, t.ct_rbuf, CH_REC_HDRSZ,
+					    &rdlen);
+		if (mpool_errno(err) == EOVERFLOW && rdlen == ch_rec_len(1))
+			err = ch_read(&t, &id);
+		else
+			err = err ?: merr(EBADMSG);
+	}
+	if (!err && id != 1)
+		err = merr(EBADMSG);
+	if (err) {
+		fprintf(stderr, "%s: short read: %d\n",
+			t.ct_test, mpool_errno(err));
+		goto out;
+	}
+
+	/* A record larger than a link fails with EFBIG */
+	big = calloc(1, (size_t)ch_captgt * 2);
+	if (!big) {
+		err = merr(ENOMEM);
+		goto out;
+	}
+
+	err = mpool_chlog_append(t.ct_ch, big, (size_t)ch_captgt * 2, false);
+	free(big);
+	if (mpool_errno(err) != EFBIG) {
+		fprintf(stderr, "%s: oversized append: %d\n",
+			t.ct_test, mpool_errno(err));
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	err = mpool_chlog_getprops(t.ct_ch, &props);
+	if (!err)
+		err = ch_reopen(&t);
+	if (!err)
+		err = mpool_chlog_getprops(t.ct_ch, &props2);
+	if (err)
+		goto out;
+
+	if (props.clp_nlinks < 2 ||
+	    props2.clp_headseq != props.clp_headseq ||
+	    props2.clp_tailseq != props.clp_tailseq) {
+		fprintf(stderr, "%s: links %u head %lu tail %lu, after replay "
+			"head %lu tail %lu\n", t.ct_test, props.clp_nlinks,
+			(ulong)props.clp_headseq, (ulong)props.clp_tailseq,
+			(ulong)props2.clp_headseq, (ulong)props2.clp_tailseq);
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	err = ch_verify(&t, 0, half);
+	if (err)
+		goto out;
+
+	err = ch_append(&t, half, ch_records, 64);
+	if (err) {
+		mpft_err(t.ct_test, "append after replay", err);
+		goto out;
+	}
+
+	err = ch_verify(&t, 0, ch_records);
+	if (!err)
+		err = ch_reopen(&t);
+	if (!err)
+		err = ch_verify(&t, 0, ch_records);
+
+out:
+	ch_finish(&t);
+
+	return err;
+}
+
+/**
+ *
+ * Trunc
+ *
+ */
+
+/**
+ * The trunc test interleaves appends with truncation of all but the
+ * newest links, and checks that readers restart at the new head and that
+ * a replay honors the truncation records.  The MDC gains one record per
+ * link, so it stays well below its compaction threshold here; MDC
+ * compaction of a chain only matters for chains of many thousands of
+ * links.
+ */
+static
+void
+ch_correctness_trunc_help(void)
+{
+	fprintf(co.co_fp, "\nusage: mpft chlog.correctness.trunc [options]\n");
+	show_default_params(ch_params, 0);
+}
+
+static
+mpool_err_t
+ch_correctness_trunc(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_chlog_props    props;
+	struct ch_test              t;
+	mpool_err_t                 err;
+	u32                         first = 0, id, step, last;
+
+	err = ch_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	step = ch_records / 8 ?: 1;
+
+	for (last = 0; last < ch_records; last += step) {
+		err = ch_append(&t, last, min_t(u32, last + step, ch_records),
+				0);
+		if (err) {
+			mpft_err(t.ct_test, "append", err);
+			goto out;
+		}
+
+		err = mpool_chlog_getprops(t.ct_ch, &props);
+		if (err)
+			goto out;
+
+		/* Park the reader on the head, truncation must move it */
+		err = ch_first(&t, &id);
+		if (!err && props.clp_tailseq > props.clp_headseq)
+			err = mpool_chlog_trunc(t.ct_ch, props.clp_tailseq);
+		if (!err)
+			err = mpool_chlog_getprops(t.ct_ch, &props);
+		if (err) {
+			mpft_err(t.ct_test, "trunc", err);
+			goto out;
+		}
+
+		if (props.clp_nlinks != 1 ||
+		    props.clp_rdseq != props.clp_headseq) {
+			fprintf(stderr, "%s: %u links, reader on %lu, head "
+				"%lu after trunc\n", t.ct_test,
+				props.clp_nlinks, (ulong)props.clp_rdseq,
+				(ulong)props.clp_headseq);
+			err = merr(EINVAL);
+			goto out;
+		}
+
+		/* What is left is a suffix of what was appended */
+		err = ch_first(&t, &first);
+		if (mpool_errno(err) == ENODATA)
+			first = min_t(u32, last + step, ch_records);
+		else if (err)
+			goto out;
+
+		err = ch_verify(&t, first, min_t(u32, last + step, ch_records));
+		if (err)
+			goto out;
+	}
+
+	err = ch_reopen(&t);
+	if (!err)
+		err = ch_verify(&t, first, ch_records);
+
+out:
+	ch_finish(&t);
+
+	return err;
+}
+
+/**
+ *
+ * Crash
+ *
+ */
+
+/**
+ * The crash test forks a child that opens its own mpool handle, appends
+ * records with periodic syncs and exits without closing or flushing.  The
+ * parent reopens the chain and must read back an intact prefix that
+ * includes every synced record, then append and read past it.
+ */
+static
+void
+ch_correctness_crash_help(void)
+{
+	fprintf(co.co_fp, "\nusage: mpft chlog.correctness.crash [options]\n");
+	show_default_params(ch_params, 0);
+}
+
+static
+mpool_err_t
+ch_crash_child(
+	void   *arg,
+	int     fd)
+{
+	struct ch_test *t = arg;
+	mpool_err_t     err;
+
+	err = mpool_open(ch_mpool, O_RDWR, &t->ct_ds, NULL);
+	if (!err)
+		err = ch_chlog_open(t);
+	if (!err)
+		err = ch_append(t, 0, ch_records / 2 + 1, ch_records / 2);
+	if (!err)
+		err = ch_append(t, ch_records / 2 + 1, ch_records, 0);
+
+	return err;
+}
+
+static
+mpool_err_t
+ch_correctness_crash(
+	int     argc,
+	char  **argv)
+{
+	struct ch_test  t;
+	mpool_err_t     err;
+	u32             id, n;
+
+	err = ch_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	/* The child opens its own handle */
+	mpool_chlog_close(t.ct_ch);
+	t.ct_ch = NULL;
+
+	err = mpft_crash(t.ct_test, ch_crash_child, NULL, &t, 0);
+	if (err)
+		goto out;
+
+	err = ch_chlog_open(&t);
+	if (err) {
+		mpft_err(t.ct_test, "mpool_chlog_open (recovery)", err);
+		goto out;
+	}
+
+	/* Count the recovered records, which must be in order */
+	err = mpool_chlog_read_init(t.ct_ch);
+	for (n = 0; !err; n++) {
+		err = ch_read(&t, &id);
+		if (!err && id != n) {
+			fprintf(stderr, "%s: got record %u, expected %u\n",
+				t.ct_test, id, n);
+			err = merr(EBADMSG);
+		}
+	}
+
+	if (mpool_errno(err) != ENODATA)
+		goto out;
+
+	if (--n <= ch_records / 2) {
+		fprintf(stderr, "%s: %u records recovered, %u were synced\n",
+			t.ct_test, n, ch_records / 2 + 1);
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	/* Appends after recovery follow the recovered prefix */
+	err = ch_append(&t, CH_ID_RECOVERED, CH_ID_RECOVERED + 16, 0);
+	if (err) {
+		mpft_err(t.ct_test, "append after recovery", err);
+		goto out;
+	}
+
+	err = ch_reopen(&t);
+	if (err)
+		goto out;
+
+	err = mpool_chlog_read_init(t.ct_ch);
+	if (!err)
+		err = ch_expect(&t, 0, n);
+	if (!err)
+		err = ch_expect(&t, CH_ID_RECOVERED, CH_ID_RECOVERED + 16);
+	if (!err)
+		err = ch_end(&t);
+
+out:
+	ch_finish(&t);
+
+	return err;
+}
+
+/**
+ *
+ * Spares
+ *
+ */
+
+/**
+ * ch_sp_members() - Wait for the spare pool to erase its retired members
+ * @members: number of pool members (output)
+ */
+static
+mpool_err_t
+ch_sp_members(
+	struct ch_test *t,
+	u32            *members)
+{
+	struct mpool_mlspare_props  props;
+	mpool_err_t                 err;
+	u32                         ms;
+
+	for (ms = 0; ms < CH_SP_WAIT_MS; ms++) {
+		err = mpool_mlspare_getprops(t->ct_sp, &props);
+		if (err) {
+			mpft_err(t->ct_test, "mpool_mlspare_getprops", err);
+			return err;
+		}
+
+		if (props.msp_nbad) {
+			fprintf(stderr, "%s: %u spares failed to erase\n",
+				t->ct_test, props.msp_nbad);
+			return merr(EIO);
+		}
+
+		if (props.msp_ndirty == 0 &&
+		    props.msp_nready >= CH_SP_TARGET) {
+			*members = props.msp_nready;
+			return 0;
+		}
+
+		usleep(1000);
+	}
+
+	fprintf(stderr, "%s: pool not filled: %u ready %u dirty\n",
+		t->ct_test, props.msp_nready, props.msp_ndirty);
+
+	return merr(ETIMEDOUT);
+}
+
+/**
+ * ch_sp_trunc() - Truncate the chain to its active link, which must hand
+ * every dropped link back to the spare pool
+ */
+static
+mpool_err_t
+ch_sp_trunc(
+	struct ch_test *t)
+{
+	struct mpool_chlog_props    props;
+	mpool_err_t                 err;
+	u32                         before, after;
+
+	err = mpool_chlog_getprops(t->ct_ch, &props);
+	if (!err)
+		err = ch_sp_members(t, &before);
+	if (!err)
+		err = mpool_chlog_trunc(t->ct_ch, props.clp_tailseq);
+	if (!err)
+		err = ch_sp_members(t, &after);
+	if (err) {
+		mpft_err(t->ct_test, "trunc", err);
+		return err;
+	}
+
+	if (props.clp_nlinks < 2 || after != before + props.clp_nlinks - 1) {
+		fprintf(stderr, "%s: %u links dropped, pool went from %u to "
+			"%u members\n", t->ct_test, props.clp_nlinks - 1,
+			before, after);
+		return merr(EINVAL);
+	}
+
+	return 0;
+}
+
+/**
+ * The spares test runs a chain on a spare pool.  Truncation must retire
+ * the dropped links to the pool, and new links reuse them once erased.
+ * Each replay visits the truncation records again; their links are pool
+ * members or, having been reused, links of the chain again, and neither
+ * may be retired a second time.
+ */
+static
+void
+ch_correctness_spares_help(void)
+{
+	fprintf(co.co_fp, "\nusage: mpft chlog.correctness.spares [options]\n");
+	show_default_params(ch_params, 0);
+}
+
+static
+mpool_err_t
+ch_correctness_spares(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_mlspare_params prm;
+	struct ch_test              t;
+	mpool_err_t                 err;
+	u32                         id, half, before, after;
+
+	err = ch_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	half = ch_records / 2;
+
+	mpool_chlog_close(t.ct_ch);
+	t.ct_ch = NULL;
+
+	err = mpft_mdc_create(t.ct_ds, CH_MDC_CAPTGT, &t.ct_spoid[0],
+			      &t.ct_spoid[1]);
+	if (err) {
+		mpft_err(t.ct_test, "mpft_mdc_create", err);
+		goto out;
+	}
+
+	memset(&prm, 0, sizeof(prm));
+	prm.msp_captgt = ch_captgt;
+	prm.msp_target = CH_SP_TARGET;
+	prm.msp_mclassp = MP_MED_CAPACITY;
+
+	err = mpool_mlspare_open(t.ct_ds, t.ct_spoid[0], t.ct_spoid[1], &prm,
+				 &t.ct_sp);
+	if (err) {
+		mpft_err(t.ct_test, "mpool_mlspare_open", err);
+		mpool_mdc_destroy(t.ct_ds, t.ct_spoid[0], t.ct_spoid[1]);
+		goto out;
+	}
+
+	err = ch_chlog_open(&t);
+	if (err) {
+		mpft_err(t.ct_test, "mpool_chlog_open", err);
+		goto out;
+	}
+
+	err = ch_append(&t, 0, half, 64);
+	if (!err)
+		err = ch_sp_trunc(&t);
+	if (err)
+		goto out;
+
+	/* Takes the retired links again */
+	err = ch_append(&t, half, ch_records, 64);
+	if (!err)
+		err = ch_sp_trunc(&t);
+	if (err)
+		goto out;
+
+	err = ch_sp_members(&t, &before);
+	if (!err)
+		err = ch_reopen(&t);
+	if (!err)
+		err = ch_sp_members(&t, &after);
+	if (err)
+		goto out;
+
+	if (after != before) {
+		fprintf(stderr, "%s: replay changed the pool from %u to %u "
+			"members\n", t.ct_test, before, after);
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	err = ch_first(&t, &id);
+	if (!err)
+		err = ch_verify(&t, id, ch_records);
+
+out:
+	ch_finish(&t);
+
+	return err;
+}
+
+struct test_s ch_tests[] = {
+	{ "replay", MPFT_TEST_TYPE_CORRECTNESS, ch_correctness_replay,
+		ch_correctness_replay_help },
+	{ "trunc", MPFT_TEST_TYPE_CORRECTNESS, ch_correctness_trunc,
+		ch_correctness_trunc_help },
+	{ "crash", MPFT_TEST_TYPE_CORRECTNESS, ch_correctness_crash,
+		ch_correctness_crash_help },
+	{ "spares", MPFT_TEST_TYPE_CORRECTNESS, ch_correctness_spares,
+		ch_correctness_spares_help },
+	{ NULL, MPFT_TEST_TYPE_INVALID, NULL, NULL },
+};
+
+void
+ch_help(void)
+{
+	int i = 0;
+
+	fprintf(co.co_fp,
+		"\nchlog tests validate the behavior of chained logs\n");
+
+	fprintf(co.co_fp, "Available tests include:\n");
+	while (ch_tests[i].test_name) {
+		fprintf(co.co_fp, "\t%s\n", ch_tests[i].test_name);
+		i++;
+	}
+}
+
+struct group_s mpft_chlog = {
+	.group_name = "chlog",
+	.group_test = ch_tests,
+	.group_help = ch_help,
+};
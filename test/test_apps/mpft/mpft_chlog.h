@@ -0,0 +1,13 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_CHLOG_MPFT_H
+#define MPOOL_CHLOG_MPFT_H
+
+#include "mpft.h"
+
+extern struct group_s mpft_chlog;
+
+#endif /* MPOOL_CHLOG_MPFT_H */
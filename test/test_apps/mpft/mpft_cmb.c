@@ -0,0 +1,529 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/platform.h>
+#include <util/compiler.h>
+#include <util/minmax.h>
+#include <util/param.h>
+#include <mpool/mpool.h>
+#include <mpctl/icmb.h>
+
+#include "mpft.h"
+#include "mpft_cmb.h"
+
+#define merr(_errnum)   (_errnum)
+
+#define CM_CODEC_MAX    (256 * 1024)
+#define CM_READS        (512)
+
+/*
+ * The stream written to a compressed mblock alternates between text-like
+ * data that compresses well and runs of pseudo-random bytes that do not,
+ * so that both compressed and raw frames are exercised.
+ */
+char cm_mpool[MPOOL_NAME_LEN_MAX];
+u64  cm_len = 16 * 1024 * 1024;
+u32  cm_framesz = 64 * 1024;
+u32  cm_threads = 4;
+u32  cm_cache = 8;
+
+static
+struct param_inst cm_params[] = {
+	PARAM_INST_STRING(cm_mpool, sizeof(cm_mpool), "mp", "mpool"),
+	PARAM_INST_U64_SIZE(cm_len, "len", "uncompressed stream length"),
+	PARAM_INST_U32(cm_framesz, "framesz", "uncompressed frame size"),
+	PARAM_INST_U32(cm_threads, "threads", "compression threads"),
+	PARAM_INST_U32(cm_cache, "cache", "cached frames per reader"),
+	PARAM_INST_END
+};
+
+/**
+ * struct cm_test - state shared by the steps of a cmb test
+ * @ct_test: test name
+ * @ct_ds:   mpool handle, NULL for the codec test
+ * @ct_buf:  expected stream, cm_len bytes, or CM_CODEC_MAX for the codec
+ *           test
+ * @ct_rbuf: read buffer of the same size
+ */
+struct cm_test {
+	const char     *ct_test;
+	struct mpool   *ct_ds;
+	char           *ct_buf;
+	char           *ct_rbuf;
+};
+
+static
+u64
+cm_rand(
+	u64    *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+
+	return *state;
+}
+
+/**
+ * cm_fill() - Fill @buf with compressible runs, alternating with random
+ * runs if @mixed
+ */
+static
+void
+cm_fill(
+	char   *buf,
+	size_t  len,
+	u64     seed,
+	bool    mixed)
+{
+	static const char  *words[] = {
+		"mblock ", "mlog ", "mpool ", "frame ", "index ", "commit ",
+		"read ", "write ", "cache ", "stream ",
+	};
+	size_t              off = 0, run, cc;
+	u64                 state = seed | 1;
+	const char         *w;
+
+	while (off < len) {
+		run = min_t(size_t, len - off, 1 + cm_rand(&state) % 100000);
+
+		if (mixed && cm_rand(&state) % 4 == 0) {
+			for (cc = 0; cc < run; cc++)
+				buf[off + cc] = cm_rand(&state);
+			off += run;
+			continue;
+		}
+
+		while (run > 0) {
+			w = words[cm_rand(&state) % NELEM(words)];
+			cc = min_t(size_t, run, strlen(w));
+			memcpy(buf + off, w, cc);
+			off += cc;
+			run -= cc;
+		}
+	}
+}
+
+/**
+ * cm_start() - Parse parameters, build the stream and open the mpool
+ */
+static
+mpool_err_t
+cm_start(
+	struct cm_test *t,
+	int             argc,
+	char          **argv,
+	bool            open)
+{
+	mpool_err_t err;
+	size_t      len;
+	int         next_arg = 0;
+
+	memset(t, 0, sizeof(*t));
+	t->ct_test = argv[0];
+
+	err = process_params(argc, argv, cm_params, &next_arg, 0);
+	if (err) {
+		fprintf(stderr, "%s: process_params failed\n", t->ct_test);
+		return err;
+	}
+
+	if (open && cm_mpool[0] == 0) {
+		fprintf(stderr, "%s: mpool (mp=<mpool>) must be specified\n",
+			t->ct_test);
+		return merr(EINVAL);
+	}
+
+	if (open && (cm_len == 0 || cm_framesz == 0)) {
+		fprintf(stderr, "%s: len and framesz must not be 0\n",
+			t->ct_test);
+		return merr(EINVAL);
+	}
+
+	len = open ? cm_len : CM_CODEC_MAX;
+
+	t->ct_buf = malloc(len);
+	t->ct_rbuf = malloc(len);
+	if (!t->ct_buf || !t->ct_rbuf) {
+		free(t->ct_buf);
+		free(t->ct_rbuf);
+		return merr(ENOMEM);
+	}
+
+	cm_fill(t->ct_buf, len, len, open);
+
+	if (!open)
+		return 0;
+
+	err = mpool_open(cm_mpool, O_RDWR, &t->ct_ds, NULL);
+	if (err) {
+		mpft_err(t->ct_test, "mpool_open", err);
+		free(t->ct_buf);
+		free(t->ct_rbuf);
+	}
+
+	return err;
+}
+
+static
+void
+cm_finish(
+	struct cm_test *t)
+{
+	if (t->ct_ds)
+		mpool_close(t->ct_ds);
+	free(t->ct_buf);
+	free(t->ct_rbuf);
+}
+
+/**
+ *
+ * Codec
+ *
+ */
+
+/**
+ * Frames are compressed with a small in-tree LZ codec.  The codec test
+ * round trips inputs of many lengths, both compressible and not, checks
+ * that incompressible input is refused rather than expanded, and that
+ * truncated, corrupted or hostile input is rejected or decoded short
+ * without reading or writing out of bounds.
+ */
+static
+void
+cm_correctness_codec_help(void)
+{
+	fprintf(co.co_fp, "\nusage: mpft cmb.correctness.codec [options]\n");
+	show_default_params(cm_params, 0);
+}
+
+/**
+ * cm_roundtrip() - Compress and decompress @len bytes at @src
+ * @packed: compressed output (output)
+ *
+ * Return: compressed length, 0 if the input did not shrink, or -1 if
+ * the round trip failed
+ */
+static
+ssize_t
+cm_roundtrip(
+	struct cm_test *t,
+	const char     *src,
+	size_t          len,
+	char           *packed)
+{
+	ssize_t csz, dsz;
+
+	csz = cmb_lz_compress(src, len, packed, len > 0 ? len - 1 : 0);
+	if (csz == 0)
+		return 0;
+
+	dsz = cmb_lz_decompress(packed, csz, t->ct_rbuf, len);
+	if (dsz != len || memcmp(t->ct_rbuf, src, len)) {
+		fprintf(stderr, "%s: %zu bytes: round trip returned %ld\n",
+			t->ct_test, len, (long)dsz);
+		return -1;
+	}
+
+	/* Exactly the original length must fit */
+	if (len > 0 && cmb_lz_decompress(packed, csz, t->ct_rbuf,
+					 len - 1) != -1) {
+		fprintf(stderr, "%s: %zu bytes: decoded into a short buffer\n",
+			t->ct_test, len);
+		return -1;
+	}
+
+	return csz;
+}
+
+static
+mpool_err_t
+cm_correctness_codec(
+	int     argc,
+	char  **argv)
+{
+	static const u8 badoff[] = { 0x10, 'x', 0x02, 0x00 };
+	static const u8 badlit[] = { 0xf0, 0xff, 0xff };
+	struct cm_test  t;
+	mpool_err_t     err;
+	ssize_t         csz, dsz;
+	size_t          len, i;
+	char           *packed, *rnd;
+	u64             state = 42;
+	int             bad = 0;
+
+	err = cm_start(&t, argc, argv, false);
+	if (err)
+		return err;
+
+	packed = malloc(CM_CODEC_MAX);
+	rnd = malloc(CM_CODEC_MAX);
+	if (!packed || !rnd) {
+		err = merr(ENOMEM);
+		goto out;
+	}
+
+	for (i = 0; i < CM_CODEC_MAX; i++)
+		rnd[i] = cm_rand(&state);
+
+	for (len = 0; len <= CM_CODEC_MAX && !bad; len = len * 2 + 7) {
+		/* Compressible input must shrink, and round trip */
+		csz = cm_roundtrip(&t, t.ct_buf, len, packed);
+		if (csz < 0 || (len >= 4096 && csz == 0)) {
+			fprintf(stderr, "%s: %zu compressible bytes: %ld\n",
+				t.ct_test, len, (long)csz);
+			bad++;
+		}
+
+		/* Incompressible input must be refused, not expanded */
+		csz = cm_roundtrip(&t, rnd, len, packed);
+		if (csz < 0 || (len >= 64 && csz != 0)) {
+			fprintf(stderr, "%s: %zu random bytes: %ld\n",
+				t.ct_test, len, (long)csz);
+			bad++;
+		}
+	}
+
+	/* A run compresses through overlapping matches */
+	memset(t.ct_buf, 'r', CM_CODEC_MAX);
+	csz = cm_roundtrip(&t, t.ct_buf, CM_CODEC_MAX, packed);
+	if (csz <= 0 || csz > CM_CODEC_MAX / 64) {
+		fprintf(stderr, "%s: run compressed to %ld\n", t.ct_test,
+			(long)csz);
+		bad++;
+	}
+
+	cm_fill(t.ct_buf, CM_CODEC_MAX, 7, true);
+	csz = cm_roundtrip(&t, t.ct_buf, CM_CODEC_MAX, packed);
+	if (csz <= 0) {
+		bad++;
+		goto out;
+	}
+
+	/* Every truncation decodes short or not at all */
+	for (i = 0; i < csz && !bad; i++) {
+		dsz = cmb_lz_decompress(packed, i, t.ct_rbuf, CM_CODEC_MAX);
+		if (dsz >= CM_CODEC_MAX ||
+		    (dsz > 0 && memcmp(t.ct_rbuf, t.ct_buf, dsz))) {
+			fprintf(stderr, "%s: truncated to %zu of %ld bytes: "
+				"decoded %ld\n", t.ct_test, i, (long)csz,
+				(long)dsz);
+			bad++;
+		}
+	}
+
+	/* Corrupted input stays within the output buffer */
+	for (i = 0; i < 4096; i++) {
+		packed[cm_rand(&state) % csz] ^= 1 << (i % 8);
+
+		dsz = cmb_lz_decompress(packed, csz, t.ct_rbuf, CM_CODEC_MAX);
+		if (dsz > CM_CODEC_MAX) {
+			fprintf(stderr, "%s: corrupt input decoded %ld\n",
+				t.ct_test, (long)dsz);
+			bad++;
+			break;
+		}
+	}
+
+	/* A match before the start of the output, literals past the input */
+	if (cmb_lz_decompress(badoff, sizeof(badoff), t.ct_rbuf,
+			      CM_CODEC_MAX) != -1 ||
+	    cmb_lz_decompress(badlit, sizeof(badlit), t.ct_rbuf,
+			      CM_CODEC_MAX) != -1) {
+		fprintf(stderr, "%s: malformed input accepted\n", t.ct_test);
+		bad++;
+	}
+
+out:
+	if (!err && bad)
+		err = merr(EINVAL);
+
+	free(rnd);
+	free(packed);
+	cm_finish(&t);
+
+	return err;
+}
+
+/**
+ *
+ * I/O
+ *
+ */
+
+/**
+ * Compressed mblocks are written through a writer that compresses frames
+ * on its own threads, and read at any offset.  The io test writes the
+ * stream in pieces of varying size, checks the stored length against
+ * the raw length, reads the whole stream back and then reads ranges at
+ * random offsets, including ranges crossing frames and the end of the
+ * stream, and checks that the frame cache is hit on rereads.
+ */
+static
+void
+cm_correctness_io_help(void)
+{
+	fprintf(co.co_fp, "\nusage: mpft cmb.correctness.io [options]\n");
+	show_default_params(cm_params, 0);
+}
+
+/**
+ * cm_read() - Read a range and check it against the stream
+ */
+static
+int
+cm_read(
+	struct cm_test     *t,
+	struct mpool_cmb   *cmb,
+	u64                 off,
+	size_t              len)
+{
+	mpool_err_t err;
+	size_t      rdlen, exp;
+
+	exp = off < cm_len ? min_t(u64, len, cm_len - off) : 0;
+
+	err = mpool_cmb_read(cmb, t->ct_rbuf, len, off, &rdlen);
+	if (err || rdlen != exp || memcmp(t->ct_rbuf, t->ct_buf + off, exp)) {
+		fprintf(stderr, "%s: read %zu at %lu: err %d, %zu bytes, "
+			"expected %zu\n", t->ct_test, len, (ulong)off,
+			mpool_errno(err), rdlen, exp);
+		return 1;
+	}
+
+	return 0;
+}
+
+static
+mpool_err_t
+cm_correctness_io(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_cmb_params params;
+	struct mpool_cmb_props  props;
+	struct mpool_cmb_wr    *wr;
+	struct mpool_cmb       *cmb = NULL;
+	struct cm_test          t;
+	mpool_err_t             err;
+	size_t                  off, cc;
+	u64                     mbid, state = 7, misses;
+	u32                     i;
+	int                     bad = 0;
+
+	err = cm_start(&t, argc, argv, true);
+	if (err)
+		return err;
+
+	params.cp_framesz = cm_framesz;
+	params.cp_threads = cm_threads;
+
+	err = mpool_cmb_alloc(t.ct_ds, MP_MED_CAPACITY, &params, &wr);
+	if (err) {
+		mpft_err(t.ct_test, "mpool_cmb_alloc", err);
+		goto out;
+	}
+
+	for (off = 0; off < cm_len && !err; off += cc) {
+		cc = min_t(size_t, cm_len - off, 1 + cm_rand(&state) % 300000);
+
+		err = mpool_cmb_write(wr, t.ct_buf + off, cc);
+	}
+	if (!err)
+		err = mpool_cmb_commit(wr, &mbid);
+	if (err) {
+		mpft_err(t.ct_test, "mpool_cmb_write", err);
+		mpool_cmb_abort(wr);
+		goto out;
+	}
+
+	err = mpool_cmb_open(t.ct_ds, mbid, cm_cache, &cmb);
+	if (err) {
+		mpft_err(t.ct_test, "mpool_cmb_open", err);
+		goto errout;
+	}
+
+	err = mpool_cmb_getprops(cmb, &props);
+	if (err || props.cmp_rawlen != cm_len ||
+	    props.cmp_nframes != (cm_len + cm_framesz - 1) / cm_framesz ||
+	    props.cmp_storedlen >= cm_len) {
+		fprintf(stderr, "%s: props: err %d, rawlen %lu stored %lu "
+			"frames %u\n", t.ct_test, mpool_errno(err),
+			(ulong)props.cmp_rawlen, (ulong)props.cmp_storedlen,
+			props.cmp_nframes);
+		bad++;
+		goto errout;
+	}
+
+	bad += cm_read(&t, cmb, 0, cm_len);
+
+	for (i = 0; i < CM_READS && !bad; i++) {
+		off = cm_rand(&state) % (cm_len + cm_framesz);
+		cc = cm_rand(&state) % (cm_framesz * 3);
+
+		bad += cm_read(&t, cmb, off, cc);
+	}
+
+	/* The same small read again is served from the frame cache */
+	if (!bad) {
+		bad += cm_read(&t, cmb, cm_len / 2, 1);
+		mpool_cmb_getprops(cmb, &props);
+		misses = props.cmp_cache_misses;
+
+		bad += cm_read(&t, cmb, cm_len / 2, 1);
+		mpool_cmb_getprops(cmb, &props);
+
+		if (props.cmp_cache_misses != misses) {
+			fprintf(stderr, "%s: reread missed the cache\n",
+				t.ct_test);
+			bad++;
+		}
+	}
+
+errout:
+	if (cmb)
+		mpool_cmb_close(cmb);
+	mpool_mblock_delete(t.ct_ds, mbid);
+out:
+	if (!err && bad)
+		err = merr(EINVAL);
+
+	cm_finish(&t);
+
+	return err;
+}
+
+struct test_s cm_tests[] = {
+	{ "codec", MPFT_TEST_TYPE_CORRECTNESS, cm_correctness_codec,
+		cm_correctness_codec_help },
+	{ "io", MPFT_TEST_TYPE_CORRECTNESS, cm_correctness_io,
+		cm_correctness_io_help },
+	{ NULL, MPFT_TEST_TYPE_INVALID, NULL, NULL },
+};
+
+void
+cm_help(void)
+{
+	int i = 0;
+
+	fprintf(co.co_fp,
+		"\ncmb tests validate the behavior of compressed mblocks\n");
+
+	fprintf(co.co_fp, "Available tests include:\n");
+	while (cm_tests[i].test_name) {
+		fprintf(co.co_fp, "\t%s\n", cm_tests[i].test_name);
+		i++;
+	}
+}
+
+struct group_s mpft_cmb = {
+	.group_name = "cmb",
+	.group_test = cm_tests,
+	.group_help = cm_help,
+};
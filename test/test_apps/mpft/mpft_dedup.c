@@ -0,0 +1,758 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <util/platform.h>
+#include <util/page.h>
+#include <util/param.h>
+#include <mpool/mpool.h>
+
+#include "mpft.h"
+#include "mpft_dedup.h"
+
+#define merr(_errnum)   (_errnum)
+
+#define DD_MDC_CAPTGT   (4 * 1024 * 1024)
+#define DD_PAGES_MAX    (4)
+#define DD_CYCLES       (32)
+
+/*
+ * Content "c" is 1 to DD_PAGES_MAX pages long, so with the default stage
+ * size some writers stay staged in memory while others spill to an mblock.
+ */
+char dd_mpool[MPOOL_NAME_LEN_MAX];
+u32  dd_contents = 32;
+u32  dd_rounds = 16;
+u32  dd_stage = 2;
+
+static
+struct param_inst dd_params[] = {
+	PARAM_INST_STRING(dd_mpool, sizeof(dd_mpool), "mp", "mpool"),
+	PARAM_INST_U32(dd_contents, "contents", "number of distinct contents"),
+	PARAM_INST_U32(dd_rounds, "rounds", "number of update rounds"),
+	PARAM_INST_U32(dd_stage, "stage", "writer stage size in pages"),
+	PARAM_INST_END
+};
+
+/**
+ * struct dd_test - state shared by the steps of a dedup test
+ * @dt_test:   test name
+ * @dt_ds:     mpool handle
+ * @dt_dd:     dedup handle
+ * @dt_oid:    MDC OIDs
+ * @dt_mbidv:  mblock ID of each content
+ * @dt_refv:   expected reference count of each content, 0 if deleted
+ * @dt_buf:    content buffer
+ * @dt_rbuf:   read buffer
+ */
+struct dd_test {
+	const char         *dt_test;
+	struct mpool       *dt_ds;
+	struct mpool_dedup *dt_dd;
+	u64                 dt_oid[2];
+	u64                *dt_mbidv;
+	u32                *dt_refv;
+	char               *dt_buf;
+	char               *dt_rbuf;
+};
+
+static
+size_t
+dd_content_len(
+	u32     c)
+{
+	return (1 + c % DD_PAGES_MAX) * PAGE_SIZE;
+}
+
+static
+void
+dd_content_fill(
+	char   *buf,
+	u32     c)
+{
+	size_t len = dd_content_len(c);
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (char)(c * 13 + i / PAGE_SIZE * 7 + i);
+}
+
+static
+mpool_err_t
+dd_dedup_open(
+	struct dd_test *t)
+{
+	struct mpool_dedup_params params;
+
+	memset(&params, 0, sizeof(params));
+	params.dp_stagesz = dd_stage * PAGE_SIZE;
+
+	return mpool_dedup_open(t->dt_ds, t->dt_oid[0], t->dt_oid[1],
+				&params, &t->dt_dd);
+}
+
+/**
+ * dd_commit() - Write the content of length "len" in dt_buf through a dedup
+ * writer and commit it
+ *
+ * The content is written one page at a time.
+ */
+static
+mpool_err_t
+dd_commit(
+	struct dd_test *t,
+	size_t          len,
+	u64            *mbid)
+{
+	struct mpool_dedup_wr  *wr;
+	struct iovec            iov;
+	mpool_err_t             err;
+	size_t                  off;
+
+	err = mpool_dedup_alloc(t->dt_dd, MP_MED_CAPACITY, &wr);
+	if (err)
+		return err;
+
+	for (off = 0; off < len; off += PAGE_SIZE) {
+		iov.iov_base = t->dt_buf + off;
+		iov.iov_len = PAGE_SIZE;
+
+		err = mpool_dedup_write(wr, &iov, 1);
+		if (err)
+			break;
+	}
+
+	if (!err)
+		err = mpool_dedup_commit(wr, mbid);
+	if (err)
+		mpool_dedup_abort(wr);
+
+	return err;
+}
+
+/**
+ * dd_ref() - Take a reference on content "c", sharing its mblock
+ *
+ * The first reference commits the content.  Later ones commit it again
+ * through a writer, which must return the existing mblock, or take the
+ * reference with mpool_dedup_addref() if "addref" is set.
+ */
+static
+mpool_err_t
+dd_ref(
+	struct dd_test *t,
+	u32             c,
+	bool            addref)
+{
+	mpool_err_t err;
+	u64         mbid;
+
+	if (t->dt_refv[c] > 0 && addref) {
+		err = mpool_dedup_addref(t->dt_dd, t->dt_mbidv[c]);
+		if (!err)
+			t->dt_refv[c]++;
+		return err;
+	}
+
+	dd_content_fill(t->dt_buf, c);
+
+	err = dd_commit(t, dd_content_len(c), &mbid);
+	if (err)
+		return err;
+
+	if (t->dt_refv[c] > 0 && mbid != t->dt_mbidv[c]) {
+		fprintf(stderr, "%s: content %u: duplicate got mblock 0x%lx, "
+			"expected 0x%lx\n", t->dt_test, c, (ulong)mbid,
+			(ulong)t->dt_mbidv[c]);
+		return merr(EEXIST);
+	}
+
+	t->dt_mbidv[c] = mbid;
+	t->dt_refv[c]++;
+
+	return 0;
+}
+
+static
+mpool_err_t
+dd_unref(
+	struct dd_test *t,
+	u32             c)
+{
+	mpool_err_t err;
+
+	err = mpool_dedup_delete(t->dt_dd, t->dt_mbidv[c]);
+	if (!err)
+		t->dt_refv[c]--;
+
+	return err;
+}
+
+/**
+ * dd_verify() - Check reference counts and contents against the model
+ */
+static
+int
+dd_verify(
+	struct dd_test *t)
+{
+	struct iovec    iov;
+	mpool_err_t     err;
+	u32             c, refcnt = 0;
+	int             bad = 0;
+
+	for (c = 0; c < dd_contents; c++) {
+		if (t->dt_mbidv[c] == 0)
+			continue;
+
+		err = mpool_dedup_refcnt(t->dt_dd, t->dt_mbidv[c], &refcnt);
+		if (t->dt_refv[c] == 0) {
+			if (mpool_errno(err) != ENOENT) {
+				fprintf(stderr, "%s: content %u: deleted "
+					"mblock still indexed\n", t->dt_test, c);
+				bad++;
+			}
+			continue;
+		}
+
+		if (err || refcnt != t->dt_refv[c]) {
+			fprintf(stderr, "%s: content %u: refcnt %u (err %d), "
+				"expected %u\n", t->dt_test, c, refcnt,
+				mpool_errno(err), t->dt_refv[c]);
+			bad++;
+			continue;
+		}
+
+		iov.iov_base = t->dt_rbuf;
+		iov.iov_len = dd_content_len(c);
+
+		err = mpool_mblock_read(t->dt_ds, t->dt_mbidv[c], &iov, 1, 0);
+		dd_content_fill(t->dt_buf, c);
+		if (err || memcmp(t->dt_rbuf, t->dt_buf, iov.iov_len)) {
+			fprintf(stderr, "%s: content %u: mblock 0x%lx "
+				"mismatch (err %d)\n", t->dt_test, c,
+				(ulong)t->dt_mbidv[c], mpool_errno(err));
+			bad++;
+		}
+	}
+
+	return bad;
+}
+
+/**
+ * dd_start() - Parse parameters, open the mpool and create the dedup MDC
+ */
+static
+mpool_err_t
+dd_start(
+	struct dd_test *t,
+	int             argc,
+	char          **argv)
+{
+	mpool_err_t err;
+	size_t      bufsz = DD_PAGES_MAX * PAGE_SIZE;
+
+	memset(t, 0, sizeof(*t));
+	t->dt_test = argv[0];
+
+	err = mpft_mdc_start(t->dt_test, argc, argv, dd_params, dd_mpool,
+			     DD_MDC_CAPTGT, &t->dt_ds, t->dt_oid);
+	if (err)
+		return err;
+
+	if (dd_contents == 0 || dd_rounds == 0 || dd_stage == 0) {
+		fprintf(stderr, "%s: contents, rounds and stage must be "
+			"non-zero\n", t->dt_test);
+		err = merr(EINVAL);
+		goto errout;
+	}
+
+	t->dt_mbidv = calloc(dd_contents, sizeof(*t->dt_mbidv));
+	t->dt_refv = calloc(dd_contents, sizeof(*t->dt_refv));
+	if (posix_memalign((void **)&t->dt_buf, PAGE_SIZE, bufsz) ||
+	    posix_memalign((void **)&t->dt_rbuf, PAGE_SIZE, bufsz) ||
+	    !t->dt_mbidv || !t->dt_refv) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	err = dd_dedup_open(t);
+	if (!err)
+		return 0;
+
+	mpft_err(t->dt_test, "mpool_dedup_open", err);
+errout:
+	mpft_mdc_finish(t->dt_ds, t->dt_oid);
+	free(t->dt_mbidv);
+	free(t->dt_refv);
+	free(t->dt_buf);
+	free(t->dt_rbuf);
+
+	return err;
+}
+
+/**
+ * dd_finish() - Drop all references so that the mblocks are deleted, then
+ * destroy the MDC and close the mpool
+ */
+static
+void
+dd_finish(
+	struct dd_test *t)
+{
+	mpool_err_t err = 0;
+	u32         c;
+
+	if (!t->dt_dd)
+		err = dd_dedup_open(t);
+
+	for (c = 0; c < dd_contents && !err; c++)
+		while (t->dt_refv[c] > 0 && !err)
+			err = dd_unref(t, c);
+
+	if (err)
+		mpft_err(t->dt_test, "cleanup", err);
+
+	if (t->dt_dd)
+		mpool_dedup_close(t->dt_dd);
+
+	mpft_mdc_finish(t->dt_ds, t->dt_oid);
+
+	free(t->dt_mbidv);
+	free(t->dt_refv);
+	free(t->dt_buf);
+	free(t->dt_rbuf);
+}
+
+/**
+ * dd_reopen() - Close and reopen the dedup layer, replaying its MDC
+ */
+static
+mpool_err_t
+dd_reopen(
+	struct dd_test *t)
+{
+	mpool_err_t err;
+
+	err = mpool_dedup_close(t->dt_dd);
+	t->dt_dd = NULL;
+	if (err) {
+		mpft_err(t->dt_test, "mpool_dedup_close", err);
+		return err;
+	}
+
+	err = dd_dedup_open(t);
+	if (err)
+		mpft_err(t->dt_test, "mpool_dedup_open (replay)", err);
+
+	return err;
+}
+
+/**
+ *
+ * Replay
+ *
+ */
+
+/**
+ * The replay test takes references on each content by committing it
+ * again and with mpool_dedup_addref(), drops every reference on some of
+ * them, and checks that reference counts and mblock contents match
+ * before and after the index is replayed from the MDC.  Content that
+ * differs from an indexed content only in its last byte must not be
+ * deduplicated.  It also covers the documented error paths.
+ */
+static
+void
+dd_correctness_replay_help(void)
+{
+	fprintf(co.co_fp, "\nusage: mpft dedup.correctness.replay [options]\n");
+	show_default_params(dd_params, 0);
+}
+
+static
+mpool_err_t
+dd_correctness_replay(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_dedup_wr  *wr;
+	struct dd_test          t;
+	struct iovec            iov;
+	mpool_err_t             err;
+	size_t                  len;
+	u32                     c, refcnt;
+	u64                     mbid;
+
+	err = dd_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	for (c = 0; c < dd_contents && !err; c++) {
+		err = dd_ref(&t, c, false);
+		if (!err)
+			err = dd_ref(&t, c, false);
+		if (!err && c % 3 == 0)
+			err = dd_ref(&t, c, true);
+		while (!err && c % 5 == 0 && t.dt_refv[c] > 0)
+			err = dd_unref(&t, c);
+	}
+
+	if (err) {
+		mpft_err(t.dt_test, "update", err);
+		goto out;
+	}
+
+	if (dd_verify(&t)) {
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	/* A near duplicate gets an mblock of its own */
+	for (c = 0; c < dd_contents && !err; c++) {
+		if (t.dt_refv[c] == 0)
+			continue;
+
+		len = dd_content_len(c);
+		dd_content_fill(t.dt_buf, c);
+		t.dt_buf[len - 1] ^= 0x5a;
+
+		err = dd_commit(&t, len, &mbid);
+		if (err)
+			break;
+
+		if (mbid == t.dt_mbidv[c]) {
+			fprintf(stderr, "%s: content %u: near duplicate "
+				"shares mblock 0x%lx\n", t.dt_test, c,
+				(ulong)mbid);
+			err = merr(EEXIST);
+			break;
+		}
+
+		err = mpool_dedup_delete(t.dt_dd, mbid);
+	}
+
+	if (err) {
+		mpft_err(t.dt_test, "near duplicate", err);
+		goto out;
+	}
+
+	/* Error paths: unknown mblock, unaligned write, aborted writer */
+	err = mpool_dedup_addref(t.dt_dd, t.dt_mbidv[0]);
+	if (mpool_errno(err) == ENOENT)
+		err = mpool_dedup_delete(t.dt_dd, t.dt_mbidv[0]);
+	if (mpool_errno(err) == ENOENT)
+		err = mpool_dedup_refcnt(t.dt_dd, t.dt_mbidv[0], &refcnt);
+	if (mpool_errno(err) != ENOENT) {
+		fprintf(stderr, "%s: deleted mblock: %d\n",
+			t.dt_test, mpool_errno(err));
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	err = mpool_dedup_alloc(t.dt_dd, MP_MED_CAPACITY, &wr);
+	if (err) {
+		mpft_err(t.dt_test, "mpool_dedup_alloc", err);
+		goto out;
+	}
+
+	dd_content_fill(t.dt_buf, dd_contents);
+	iov.iov_base = t.dt_buf;
+	iov.iov_len = PAGE_SIZE / 2;
+
+	err = mpool_dedup_write(wr, &iov, 1);
+	if (mpool_errno(err) != EINVAL) {
+		fprintf(stderr, "%s: unaligned write: %d\n",
+			t.dt_test, mpool_errno(err));
+		mpool_dedup_abort(wr);
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	/* Spill the writer to an mblock before aborting it */
+	iov.iov_len = PAGE_SIZE;
+	err = 0;
+
+	for (c = 0; c <= dd_stage && !err; c++)
+		err = mpool_dedup_write(wr, &iov, 1);
+	if (!err)
+		err = mpool_dedup_abort(wr);
+	else
+		mpool_dedup_abort(wr);
+	if (err) {
+		mpft_err(t.dt_test, "aborted writer", err);
+		goto out;
+	}
+
+	err = dd_reopen(&t);
+	if (err)
+		goto out;
+
+	if (dd_verify(&t)) {
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	/* Replayed fingerprints must still deduplicate */
+	for (c = 0; c < dd_contents && !err; c++)
+		err = dd_ref(&t, c, false);
+	if (err)
+		mpft_err(t.dt_test, "update after replay", err);
+	else if (dd_verify(&t))
+		err = merr(EINVAL);
+
+out:
+	dd_finish(&t);
+
+	return err;
+}
+
+/**
+ *
+ * Compaction
+ *
+ */
+
+/**
+ * Every reference count change appends a record to the MDC.  The
+ * compaction test churns references until the MDC outgrows its
+ * compaction threshold, periodically deleting contents outright and
+ * recommitting them, then checks that the compacted MDC replays to the
+ * same reference counts.
+ */
+static
+void
+dd_correctness_compaction_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft dedup.correctness.compaction [options]\n");
+	show_default_params(dd_params, 0);
+}
+
+static
+mpool_err_t
+dd_correctness_compaction(
+	int     argc,
+	char  **argv)
+{
+	struct dd_test  t;
+	mpool_err_t     err;
+	u32             r, c, i;
+
+	err = dd_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	for (r = 0; r < dd_rounds && !err; r++) {
+		for (c = 0; c < dd_contents && !err; c++) {
+			err = dd_ref(&t, c, false);
+
+			for (i = 0; i < DD_CYCLES && !err; i++) {
+				err = dd_ref(&t, c, true);
+				if (!err)
+					err = dd_unref(&t, c);
+			}
+
+			/* Delete outright now and then */
+			while (!err && (c + r) % 7 == 0 && t.dt_refv[c] > 0)
+				err = dd_unref(&t, c);
+		}
+
+		if (err) {
+			mpft_err(t.dt_test, "update", err);
+			break;
+		}
+
+		if (r % 4 == 3 && dd_verify(&t))
+			err = merr(EINVAL);
+	}
+
+	if (err)
+		goto out;
+
+	err = dd_reopen(&t);
+	if (!err && dd_verify(&t))
+		err = merr(EINVAL);
+
+out:
+	dd_finish(&t);
+
+	return err;
+}
+
+/**
+ *
+ * Crash
+ *
+ */
+
+/**
+ * The crash test forks a child that opens its own mpool handle, takes
+ * and drops references, and exits without closing anything while some
+ * writers still hold staged or spilled content.  The parent reopens the
+ * dedup layer and learns each mblock ID by committing the content again,
+ * which must share the child's mblock with the child's reference count
+ * plus one.
+ */
+static
+void
+dd_correctness_crash_help(void)
+{
+	fprintf(co.co_fp, "\nusage: mpft dedup.correctness.crash [options]\n");
+	show_default_params(dd_params, 0);
+}
+
+/**
+ * dd_crash_model() - References the crash child leaves on content "c"
+ */
+static
+u32
+dd_crash_model(
+	u32     c)
+{
+	return c % 5 == 0 ? 0 : 1 + c % 3;
+}
+
+static
+mpool_err_t
+dd_crash_child(
+	void   *arg,
+	int     fd)
+{
+	struct mpool_dedup_wr  *wr;
+	struct dd_test         *t = arg;
+	struct iovec            iov;
+	mpool_err_t             err;
+	u32                     c;
+
+	err = mpool_open(dd_mpool, O_RDWR, &t->dt_ds, NULL);
+	if (!err)
+		err = dd_dedup_open(t);
+
+	for (c = 0; c < dd_contents && !err; c++) {
+		err = dd_ref(t, c, false);
+		while (!err && t->dt_refv[c] < 1 + c % 3)
+			err = dd_ref(t, c, c % 2);
+		while (!err && t->dt_refv[c] > dd_crash_model(c))
+			err = dd_unref(t, c);
+	}
+
+	/* Leave a staged and a spilled writer behind */
+	dd_content_fill(t->dt_buf, dd_contents);
+	iov.iov_base = t->dt_buf;
+	iov.iov_len = PAGE_SIZE;
+
+	if (!err)
+		err = mpool_dedup_alloc(t->dt_dd, MP_MED_CAPACITY, &wr);
+	if (!err)
+		err = mpool_dedup_write(wr, &iov, 1);
+
+	if (!err)
+		err = mpool_dedup_alloc(t->dt_dd, MP_MED_CAPACITY, &wr);
+	for (c = 0; c <= dd_stage && !err; c++)
+		err = mpool_dedup_write(wr, &iov, 1);
+
+	return err;
+}
+
+static
+mpool_err_t
+dd_correctness_crash(
+	int     argc,
+	char  **argv)
+{
+	struct dd_test  t;
+	mpool_err_t     err;
+	u32             c, refcnt = 0;
+
+	err = dd_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	/* The child opens its own handle */
+	mpool_dedup_close(t.dt_dd);
+	t.dt_dd = NULL;
+
+	err = mpft_crash(t.dt_test, dd_crash_child, NULL, &t, 0);
+	if (err)
+		goto out;
+
+	err = dd_dedup_open(&t);
+	if (err) {
+		mpft_err(t.dt_test, "mpool_dedup_open (recovery)", err);
+		goto out;
+	}
+
+	for (c = 0; c < dd_contents; c++) {
+		dd_content_fill(t.dt_buf, c);
+
+		err = dd_commit(&t, dd_content_len(c), &t.dt_mbidv[c]);
+		if (err) {
+			mpft_err(t.dt_test, "commit after recovery", err);
+			goto out;
+		}
+
+		t.dt_refv[c] = 1;
+
+		err = mpool_dedup_refcnt(t.dt_dd, t.dt_mbidv[c], &refcnt);
+		if (!err)
+			t.dt_refv[c] = refcnt;
+		if (err || refcnt != dd_crash_model(c) + 1) {
+			fprintf(stderr, "%s: content %u: refcnt %u (err %d), "
+				"expected %u\n", t.dt_test, c, refcnt,
+				mpool_errno(err), dd_crash_model(c) + 1);
+			err = merr(EINVAL);
+			goto out;
+		}
+	}
+
+	if (dd_verify(&t))
+		err = merr(EINVAL);
+	else
+		err = dd_reopen(&t);
+
+	if (!err && dd_verify(&t))
+		err = merr(EINVAL);
+
+out:
+	dd_finish(&t);
+
+	return err;
+}
+
+struct test_s dd_tests[] = {
+	{ "replay", MPFT_TEST_TYPE_CORRECTNESS, dd_correctness_replay,
+		dd_correctness_replay_help },
+	{ "compaction", MPFT_TEST_TYPE_CORRECTNESS, dd_correctness_compaction,
+		dd_correctness_compaction_help },
+	{ "crash", MPFT_TEST_TYPE_CORRECTNESS, dd_correctness_crash,
+		dd_correctness_crash_help },
+	{ NULL, MPFT_TEST_TYPE_INVALID, NULL, NULL },
+};
+
+void
+dd_help(void)
+{
+	int i = 0;
+
+	fprintf(co.co_fp,
+		"\ndedup tests validate the behavior of the dedup layer\n");
+
+	fprintf(co.co_fp, "Available tests include:\n");
+	while (dd_tests[i].test_name) {
+		fprintf(co.co_fp, "\t%s\n", dd_tests[i].test_name);
+		i++;
+	}
+}
+
+struct group_s mpft_dedup = {
+	.group_name = "dedup",
+	.group_test = dd_tests,
+	.group_help = dd_help,
+};
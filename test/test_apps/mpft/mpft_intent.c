@@ -0,0 +1,783 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <util/platform.h>
+#include <util/param.h>
+#include <mpool/mpool.h>
+
+#include "mpft.h"
+#include "mpft_intent.h"
+
+#define merr(_errnum)   (_errnum)
+
+#define IN_MLOG_CAPTGT  (1024 * 1024)
+#define IN_WAIT_MS      (60 * 1000)
+#define IN_CANARIES     (16)
+
+/*
+ * The fate of object "i" is i % 4, see enum in_fate, and every fourth group of four is an mlog, the
+ * rest are mblocks.
+ */
+char in_mpool[MPOOL_NAME_LEN_MAX];
+u32  in_objs = 2048;
+
+static
+struct param_inst in_params[] = {
+	PARAM_INST_STRING(in_mpool, sizeof(in_mpool), "mp", "mpool"),
+	PARAM_INST_U32(in_objs, "objs", "objects allocated per test"),
+	PARAM_INST_END
+};
+
+/*
+ * What becomes of an object after it is allocated
+ */
+enum in_fate {
+	IN_COMMIT = 0,  /* committed, must survive reclamation */
+	IN_ORPHAN = 1,  /* left uncommitted, must be reclaimed */
+	IN_ABORT  = 2,  /* aborted by its owner */
+	IN_DELETE = 3,  /* committed and deleted by its owner */
+};
+
+/**
+ * struct in_obj - object allocated by a test
+ * @io_objid: object ID, 0 if not allocated
+ * @io_mlh:   mlog handle, in the process that allocated the mlog
+ * @io_fate:  enum in_fate, IN_ORPHAN until the object is resolved
+ */
+struct in_obj {
+	u64                 io_objid;
+	struct mpool_mlog  *io_mlh;
+	u32                 io_fate;
+};
+
+/**
+ * struct in_msg - object state reported by a child
+ */
+struct in_msg {
+	u64     im_objid;
+	u32     im_idx;
+	u32     im_fate;
+};
+
+/**
+ * struct in_test - state shared by the steps of an intent test
+ * @it_test: test name
+ * @it_ds:   mpool handle, NULL while closed
+ * @it_objv: objects
+ * @it_objc: number of objects
+ */
+struct in_test {
+	const char     *it_test;
+	struct mpool   *it_ds;
+	struct in_obj  *it_objv;
+	u32             it_objc;
+};
+
+static inline
+bool
+in_is_mlog(
+	u32 i)
+{
+	return (i / 4) % 4 == 3;
+}
+
+static
+mpool_err_t
+in_open(
+	struct in_test *t)
+{
+	mpool_err_t err;
+
+	err = mpool_open(in_mpool, O_RDWR, &t->it_ds, NULL);
+	if (err)
+		mpft_err(t->it_test, "mpool_open", err);
+
+	return err;
+}
+
+/**
+ * in_close() - Close the mpool, putting the handles of the mlogs still
+ * held, which leaves the uncommitted ones orphaned
+ */
+static
+mpool_err_t
+in_close(
+	struct in_test *t)
+{
+	mpool_err_t err;
+	u32         i;
+
+	for (i = 0; i < t->it_objc; i++) {
+		if (t->it_objv[i].io_mlh)
+			mpool_mlog_put(t->it_ds, t->it_objv[i].io_mlh);
+		t->it_objv[i].io_mlh = NULL;
+	}
+
+	err = mpool_close(t->it_ds);
+	t->it_ds = NULL;
+	if (err)
+		mpft_err(t->it_test, "mpool_close", err);
+
+	return err;
+}
+
+/**
+ * in_alloc() - Allocate object "i", which is left uncommitted
+ */
+static
+mpool_err_t
+in_alloc(
+	struct in_test *t,
+	u32             i)
+{
+	struct mlog_capacity    capreq = { .lcp_captgt = IN_MLOG_CAPTGT };
+	struct mblock_props     mbprops;
+	struct mlog_props       mlprops;
+	struct in_obj          *obj = t->it_objv + i;
+	mpool_err_t             err;
+
+	obj->io_fate = IN_ORPHAN;
+
+	if (in_is_mlog(i)) {
+		err = mpool_mlog_alloc(t->it_ds, &capreq, MP_MED_CAPACITY,
+				       &mlprops, &obj->io_mlh);
+		obj->io_objid = err ? 0 : mlprops.lpr_objid;
+	} else {
+		err = mpool_mblock_alloc(t->it_ds, MP_MED_CAPACITY, false,
+					 &obj->io_objid, &mbprops);
+	}
+
+	if (err)
+		fprintf(stderr, "%s: alloc object %u: %d\n",
+			t->it_test, i, mpool_errno(err));
+
+	return err;
+}
+
+/**
+ * in_resolve() - Commit, abort or delete object "i" according to its fate
+ */
+static
+mpool_err_t
+in_resolve(
+	struct in_test *t,
+	u32             i)
+{
+	struct in_obj  *obj = t->it_objv + i;
+	mpool_err_t     err = 0;
+	u32             fate = i % 4;
+
+	if (in_is_mlog(i)) {
+		if (fate == IN_COMMIT || fate == IN_DELETE)
+			err = mpool_mlog_commit(t->it_ds, obj->io_mlh);
+		if (!err && fate == IN_ABORT)
+			err = mpool_mlog_abort(t->it_ds, obj->io_mlh);
+		if (!err && fate == IN_DELETE)
+			err = mpool_mlog_delete(t->it_ds, obj->io_mlh);
+		if (!err && (fate == IN_ABORT || fate == IN_DELETE))
+			obj->io_mlh = NULL;
+	} else {
+		if (fate == IN_COMMIT || fate == IN_DELETE)
+			err = mpool_mblock_commit(t->it_ds, obj->io_objid);
+		if (!err && fate == IN_ABORT)
+			err = mpool_mblock_abort(t->it_ds, obj->io_objid);
+		if (!err && fate == IN_DELETE)
+			err = mpool_mblock_delete(t->it_ds, obj->io_objid);
+	}
+
+	if (err) {
+		fprintf(stderr, "%s: resolve object %u: %d\n",
+			t->it_test, i, mpool_errno(err));
+		return err;
+	}
+
+	obj->io_fate = fate;
+
+	return 0;
+}
+
+/**
+ * in_lookup() - Find out whether object "i" exists and is committed
+ */
+static
+mpool_err_t
+in_lookup(
+	struct in_test *t,
+	u32             i,
+	bool           *exists,
+	bool           *committed)
+{
+	struct mblock_props mbprops;
+	struct mlog_props   mlprops;
+	struct mpool_mlog  *mlh;
+	mpool_err_t         err;
+	u64                 mbh;
+
+	*exists = false;
+	*committed = false;
+
+	if (in_is_mlog(i)) {
+		err = mpool_mlog_find_get(t->it_ds, t->it_objv[i].io_objid,
+					  &mlprops, &mlh);
+		if (!err) {
+			*committed = mlprops.lpr_iscommitted;
+			mpool_mlog_put(t->it_ds, mlh);
+		}
+	} else {
+		err = mpool_mblock_find(t->it_ds, t->it_objv[i].io_objid,
+					&mbh, &mbprops);
+		if (!err)
+			*committed = mbprops.mpr_iscommitted;
+	}
+
+	if (mpool_errno(err) == ENOENT)
+		return 0;
+
+	*exists = !err;
+
+	return err;
+}
+
+/**
+ * in_wait() - Wait for the objects in [first, last) that must not survive
+ * to be gone, then check that the others are there and committed
+ *
+ * Orphans are reclaimed in the background after mpool_open().
+ */
+static
+mpool_err_t
+in_wait(
+	struct in_test *t,
+	u32             first,
+	u32             last)
+{
+	mpool_err_t err;
+	bool        exists, committed;
+	u32         ms, i, left = 0;
+
+	for (ms = 0; ms < IN_WAIT_MS; ms++) {
+		for (i = first, left = 0; i < last; i++) {
+			if (t->it_objv[i].io_fate == IN_COMMIT)
+				continue;
+
+			err = in_lookup(t, i, &exists, &committed);
+			if (err) {
+				mpft_err(t->it_test, "lookup", err);
+				return err;
+			}
+
+			if (exists && committed) {
+				fprintf(stderr, "%s: object %u fate %u "
+					"committed\n", t->it_test, i,
+					t->it_objv[i].io_fate);
+				return merr(EINVAL);
+			}
+
+			left += exists;
+		}
+
+		if (left == 0)
+			break;
+
+		usleep(1000);
+	}
+
+	if (left) {
+		fprintf(stderr, "%s: %u orphans not reclaimed\n",
+			t->it_test, left);
+		return merr(ETIMEDOUT);
+	}
+
+	for (i = first; i < last; i++) {
+		if (t->it_objv[i].io_fate != IN_COMMIT)
+			continue;
+
+		err = in_lookup(t, i, &exists, &committed);
+		if (err || !exists || !committed) {
+			fprintf(stderr, "%s: committed object %u: err %d, %s\n",
+				t->it_test, i, mpool_errno(err),
+				exists ? "uncommitted" : "gone");
+			return err ?: merr(ENOENT);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * in_report() - Report the state of object "i" to the parent
+ */
+static
+mpool_err_t
+in_report(
+	struct in_test *t,
+	u32             i,
+	int             fd)
+{
+	struct in_msg msg = {
+		.im_objid = t->it_objv[i].io_objid,
+		.im_idx = i,
+		.im_fate = t->it_objv[i].io_fate,
+	};
+
+	return mpft_report(fd, &msg, sizeof(msg));
+}
+
+/**
+ * in_record() - Record an object state reported by a child
+ */
+static
+void
+in_record(
+	void       *arg,
+	const void *msgp)
+{
+	struct in_test         *t = arg;
+	const struct in_msg    *msg = msgp;
+
+	if (msg->im_idx >= t->it_objc)
+		return;
+
+	t->it_objv[msg->im_idx].io_objid = msg->im_objid;
+	t->it_objv[msg->im_idx].io_fate = msg->im_fate;
+}
+
+/**
+ * in_start() - Parse parameters and set up the object table
+ *
+ * The mpool is not opened, as opening it is what reclaims the orphans.
+ */
+static
+mpool_err_t
+in_start(
+	struct in_test *t,
+	int             argc,
+	char          **argv)
+{
+	mpool_err_t err;
+	int         next_arg = 0;
+
+	memset(t, 0, sizeof(*t));
+	t->it_test = argv[0];
+
+	err = process_params(argc, argv, in_params, &next_arg, 0);
+	if (err) {
+		fprintf(stderr, "%s: process_params failed\n", t->it_test);
+		return err;
+	}
+
+	if (in_mpool[0] == 0) {
+		fprintf(stderr, "%s: mpool (mp=<mpool>) must be specified\n",
+			t->it_test);
+		return merr(EINVAL);
+	}
+
+	if (in_objs < 16) {
+		fprintf(stderr, "%s: objs must be at least 16\n", t->it_test);
+		return merr(EINVAL);
+	}
+
+	t->it_objc = in_objs + IN_CANARIES;
+	t->it_objv = calloc(t->it_objc, sizeof(*t->it_objv));
+	if (!t->it_objv)
+		return merr(ENOMEM);
+
+	return 0;
+}
+
+/**
+ * in_finish() - Delete the objects that survived and close the mpool
+ */
+static
+void
+in_finish(
+	struct in_test *t)
+{
+	struct mlog_props   props;
+	struct mpool_mlog  *mlh;
+	u32                 i;
+
+	if (!t->it_objv)
+		return;
+
+	if (t->it_ds || !mpool_open(in_mpool, O_RDWR, &t->it_ds, NULL)) {
+		for (i = 0; i < t->it_objc; i++) {
+			if (!t->it_objv[i].io_objid ||
+			    t->it_objv[i].io_fate != IN_COMMIT)
+				continue;
+
+			if (!in_is_mlog(i)) {
+				mpool_mblock_delete(t->it_ds,
+						    t->it_objv[i].io_objid);
+				continue;
+			}
+
+			mlh = t->it_objv[i].io_mlh;
+			if (!mlh && mpool_mlog_find_get(t->it_ds,
+							t->it_objv[i].io_objid,
+							&props, &mlh))
+				continue;
+
+			if (mpool_mlog_delete(t->it_ds, mlh))
+				mpool_mlog_put(t->it_ds, mlh);
+			t->it_objv[i].io_mlh = NULL;
+		}
+
+		in_close(t);
+	}
+
+	free(t->it_objv);
+}
+
+/**
+ *
+ * Crash
+ *
+ */
+
+/**
+ * The crash test forks a child that opens the mpool, allocates all its
+ * objects, which grows its intent journal, then commits, aborts or
+ * deletes most of them and exits without closing anything.  The child
+ * reports each object as allocated and as resolved.  The
+ * next open must reclaim every object the child left uncommitted and
+ * leave the committed ones alone.
+ */
+static
+void
+in_correctness_crash_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft intent.correctness.crash [options]\n");
+	show_default_params(in_params, 0);
+}
+
+static
+mpool_err_t
+in_crash_child(
+	void   *arg,
+	int     fd)
+{
+	struct in_test *t = arg;
+	mpool_err_t     err;
+	u32             i;
+
+	err = in_open(t);
+
+	for (i = 0; i < in_objs && !err; i++) {
+		err = in_alloc(t, i);
+		if (!err)
+			err = in_report(t, i, fd);
+	}
+
+	/* The last objects stay orphaned whatever their fate */
+	for (i = 0; i < in_objs * 3 / 4 && !err; i++) {
+		err = in_resolve(t, i);
+		if (!err)
+			err = in_report(t, i, fd);
+	}
+
+	return err;
+}
+
+static
+mpool_err_t
+in_correctness_crash(
+	int     argc,
+	char  **argv)
+{
+	struct in_test  t;
+	mpool_err_t     err;
+
+	err = in_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	err = mpft_crash(t.it_test, in_crash_child, in_record, &t,
+			 sizeof(struct in_msg));
+	if (!err)
+		err = in_open(&t);
+	if (!err)
+		err = in_wait(&t, 0, in_objs);
+	if (err)
+		goto out;
+
+	/* Nothing more to reclaim, and nothing committed is lost */
+	err = in_close(&t);
+	if (!err)
+		err = in_open(&t);
+	if (!err)
+		err = in_wait(&t, 0, in_objs);
+
+out:
+	in_finish(&t);
+
+	return err;
+}
+
+/**
+ *
+ * Close
+ *
+ */
+
+/**
+ * The close test allocates and resolves objects as the crash test does,
+ * but closes its mpool handle instead of crashing.  Objects left
+ * uncommitted by a closed handle are orphans even though their process
+ * lives on, and must be reclaimed by the next open.
+ */
+static
+void
+in_correctness_close_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft intent.correctness.close [options]\n");
+	show_default_params(in_params, 0);
+}
+
+static
+mpool_err_t
+in_correctness_close(
+	int     argc,
+	char  **argv)
+{
+	struct in_test  t;
+	mpool_err_t     err;
+	u32             i;
+
+	err = in_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	err = in_open(&t);
+	if (err)
+		goto out;
+
+	/* Resolve as we go, so that journal slots are reused */
+	for (i = 0; i < in_objs && !err; i++) {
+		err = in_alloc(&t, i);
+		if (!err && i >= 8 && i < in_objs * 3 / 4)
+			err = in_resolve(&t, i - 8);
+	}
+	if (err)
+		goto out;
+
+	err = in_close(&t);
+	if (!err)
+		err = in_open(&t);
+	if (!err)
+		err = in_wait(&t, 0, in_objs);
+
+out:
+	in_finish(&t);
+
+	return err;
+}
+
+/**
+ *
+ * Live
+ *
+ */
+
+/**
+ * The live test forks a child that allocates objects and keeps its mpool
+ * handle open.  The parent then opens the mpool, which reclaims a few
+ * canary orphans the parent left behind, and must not touch the objects
+ * of the live child: once the canaries are gone, the child's objects must
+ * still be there and the child must be able to commit them.
+ */
+static
+void
+in_correctness_live_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft intent.correctness.live [options]\n");
+	show_default_params(in_params, 0);
+}
+
+/**
+ * struct in_live - the live test and the pipe its child waits on
+ */
+struct in_live {
+	struct in_test *il_t;
+	int             il_gofd[2];
+};
+
+static
+mpool_err_t
+in_live_child(
+	void   *arg,
+	int     fd)
+{
+	struct in_live *l = arg;
+	struct in_test *t = l->il_t;
+	mpool_err_t     err;
+	char            go;
+	u32             i;
+
+	close(l->il_gofd[1]);
+
+	err = in_open(t);
+
+	for (i = 0; i < in_objs && !err; i++) {
+		err = in_alloc(t, i);
+		if (!err)
+			err = in_report(t, i, fd);
+	}
+
+	close(fd);
+
+	if (!err && read(l->il_gofd[0], &go, 1) != 1)
+		err = merr(EIO);
+
+	/* Every object must still be ours to resolve */
+	for (i = 0; i < in_objs && !err; i++)
+		err = in_resolve(t, i);
+
+	if (!err)
+		err = in_close(t);
+
+	return err;
+}
+
+static
+mpool_err_t
+in_correctness_live(
+	int     argc,
+	char  **argv)
+{
+	struct in_test  t;
+	struct in_live  l;
+	struct in_msg   msg;
+	mpool_err_t     err, err2;
+	pid_t           pid;
+	bool            exists, committed;
+	u32             i, n;
+	int             fd;
+
+	err = in_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	l.il_t = &t;
+	if (pipe(l.il_gofd)) {
+		err = merr(errno);
+		goto out;
+	}
+
+	err = mpft_child_start(in_live_child, &l, &pid, &fd);
+	close(l.il_gofd[0]);
+	if (err) {
+		close(l.il_gofd[1]);
+		goto out;
+	}
+
+	/* The child has allocated everything once it closes the pipe */
+	for (n = 0; n < in_objs; n++) {
+		if (read(fd, &msg, sizeof(msg)) != sizeof(msg))
+			break;
+		in_record(&t, &msg);
+	}
+	close(fd);
+
+	if (n != in_objs) {
+		fprintf(stderr, "%s: child allocated %u objects\n",
+			t.it_test, n);
+		err = merr(ECHILD);
+		goto release;
+	}
+
+	/* Leave canary orphans behind a closed handle */
+	err = in_open(&t);
+	for (i = in_objs; i < t.it_objc && !err; i++) {
+		err = in_alloc(&t, i);
+		if (!err && i % 4 == IN_COMMIT)
+			err = in_resolve(&t, i);
+	}
+	if (!err)
+		err = in_close(&t);
+	if (err)
+		goto release;
+
+	err = in_open(&t);
+	if (!err)
+		err = in_wait(&t, in_objs, t.it_objc);
+	if (err)
+		goto release;
+
+	for (i = 0; i < in_objs; i++) {
+		err = in_lookup(&t, i, &exists, &committed);
+		if (err || !exists || committed) {
+			fprintf(stderr, "%s: live object %u: err %d, %s\n",
+				t.it_test, i, mpool_errno(err),
+				exists ? "committed" : "gone");
+			err = err ?: merr(EINVAL);
+			break;
+		}
+	}
+
+release:
+	if (write(l.il_gofd[1], "g", 1) != 1 && !err)
+		err = merr(EIO);
+	close(l.il_gofd[1]);
+
+	err2 = mpft_child_wait(t.it_test, pid);
+	err = err ?: err2;
+	if (err)
+		goto out;
+
+	for (i = 0; i < in_objs; i++)
+		t.it_objv[i].io_fate = i % 4;
+
+	/* The child's orphans are reclaimed once its handle is closed */
+	err = in_close(&t);
+	if (!err)
+		err = in_open(&t);
+	if (!err)
+		err = in_wait(&t, 0, t.it_objc);
+
+out:
+	in_finish(&t);
+
+	return err;
+}
+
+struct test_s in_tests[] = {
+	{ "crash", MPFT_TEST_TYPE_CORRECTNESS, in_correctness_crash,
+		in_correctness_crash_help },
+	{ "close", MPFT_TEST_TYPE_CORRECTNESS, in_correctness_close,
+		in_correctness_close_help },
+	{ "live", MPFT_TEST_TYPE_CORRECTNESS, in_correctness_live,
+		in_correctness_live_help },
+	{ NULL, MPFT_TEST_TYPE_INVALID, NULL, NULL },
+};
+
+void
+in_help(void)
+{
+	int i = 0;
+
+	fprintf(co.co_fp,
+		"\nintent tests validate orphaned object reclamation\n");
+
+	fprintf(co.co_fp, "Available tests include:\n");
+	while (in_tests[i].test_name) {
+		fprintf(co.co_fp, "\t%s\n", in_tests[i].test_name);
+		i++;
+	}
+}
+
+struct group_s mpft_intent = {
+	.group_name = "intent",
+	.group_test = in_tests,
+	.group_help = in_help,
+};
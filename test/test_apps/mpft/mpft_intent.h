@@ -0,0 +1,13 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_INTENT_MPFT_H
+#define MPOOL_INTENT_MPFT_H
+
+#include "mpft.h"
+
+extern struct group_s mpft_intent;
+
+#endif /* MPOOL_INTENT_MPFT_H */
@@ -47,10 +47,24 @@
  *
  *     Description: perf_seq_reads follows the same steps as perf_seq_writes,
  *       but adds a loop reading back all of the mblocks.
+ *
+ * * send - verify mpool_mblock_send() over a socketpair
+ *   - required parameters:
+ *     - mpool (mp)
+ *   - options:
+ *     - pages per mblock (pages), default: 64
+ *
+ *     Description: Write two mblocks with a known pattern, then send
+ *       aligned, unaligned and whole ranges of both, interleaved and
+ *       repeatedly so that kept maps are reused, into one end of a
+ *       socketpair and compare what arrives at the other end.  One mblock
+ *       is then deleted: sending it must fail while the other one still
+ *       sends correctly.
  */
 
 #include <stdio.h>
 #include <pthread.h>
+#include <sys/socket.h>
 
 #include <util/platform.h>
 #include <util/parse_num.h>
@@ -902,11 +916,536 @@ perf_seq_reads(
 
 }
 
+/**
+ *
+ * Send
+ *
+ */
+
+static char send_mpool[MPOOL_NAME_LEN_MAX];
+static u32  send_pages = 64;
+
+static
+struct param_inst send_params[] = {
+	PARAM_INST_STRING(send_mpool, sizeof(send_mpool), "mp", "mpool"),
+	PARAM_INST_U32(send_pages, "pages", "pages per mblock"),
+	PARAM_INST_END
+};
+
+static
+void
+send_help(void)
+{
+	fprintf(co.co_fp, "\nusage: mpft mblock.correctness.send [options]\n");
+	fprintf(co.co_fp, "e.g.: mpft mblock.correctness.send mp=mp1\n");
+	fprintf(co.co_fp,
+		"\nmblock.correctness.send sends ranges of two mblocks "
+		"over a socketpair and verifies what is received\n");
+
+	show_default_params(send_params, 0);
+}
+
+static inline
+u8
+send_pattern(int which, size_t off)
+{
+	return (u8)((off * 7 + (off >> 12)) ^ (which ? 0xa5 : 0x3c));
+}
+
+struct send_reader_args {
+	int     sr_fd;
+	size_t  sr_len;
+	u8     *sr_buf;
+	int     sr_err;
+};
+
+static
+void *
+send_reader(void *arg)
+{
+	struct send_reader_args    *sr = arg;
+	size_t                      got = 0;
+	ssize_t                     cc;
+
+	while (got < sr->sr_len) {
+		cc = read(sr->sr_fd, sr->sr_buf + got, sr->sr_len - got);
+		if (cc <= 0) {
+			sr->sr_err = cc ? errno : EPIPE;
+			break;
+		}
+		got += cc;
+	}
+
+	return NULL;
+}
+
+/* Send [off, off + len) of mblock mbh and verify it arrives intact */
+static
+mpool_err_t
+send_check(
+	struct mpool   *ds,
+	int            *sv,
+	u64             mbh,
+	int             which,
+	size_t          off,
+	size_t          len,
+	u8             *rbuf)
+{
+	struct send_reader_args     sr = { };
+	mpool_err_t                 err;
+	pthread_t                   tid;
+	size_t                      i;
+	int                         rc;
+
+	sr.sr_fd = sv[1];
+	sr.sr_len = len;
+	sr.sr_buf = rbuf;
+
+	/* Read concurrently, the range can exceed the socket buffer */
+	rc = pthread_create(&tid, NULL, send_reader, &sr);
+	if (rc)
+		return merr(rc);
+
+	err = mpool_mblock_send(ds, mbh, off, len, sv[0]);
+	if (err)
+		shutdown(sv[0], SHUT_WR);
+
+	pthread_join(tid, NULL);
+	if (err)
+		return err;
+
+	if (sr.sr_err) {
+		fprintf(stderr, "%s: short read at %zu+%zu: %s\n",
+			__func__, off, len, strerror(sr.sr_err));
+		return merr(sr.sr_err);
+	}
+
+	for (i = 0; i < len; i++) {
+		if (rbuf[i] != send_pattern(which, off + i)) {
+			fprintf(stderr,
+				"%s: mblock %d differs at %zu in %zu+%zu\n",
+				__func__, which, off + i, off, len);
+			return merr(EIO);
+		}
+	}
+
+	return 0;
+}
+
+static
+mpool_err_t
+send_test(
+	int     argc,
+	char  **argv)
+{
+	struct mpool   *ds = NULL;
+	struct iovec    iov;
+	mpool_err_t     err;
+
+	size_t  ranges[][2] = {
+		{ 0, PAGE_SIZE }, { 1, 1 }, { 100, 5000 },
+		{ PAGE_SIZE - 3, 7 }, { 3 * PAGE_SIZE + 17, 2 * PAGE_SIZE },
+		{ 0, 0 },
+	};
+	size_t  mblen, off, len;
+	char   *test_name = argv[0];
+	u64     mbh[2] = { };
+	u8     *wbuf = NULL, *rbuf = NULL;
+	int     sv[2] = { -1, -1 };
+	int     next_arg = 0;
+	int     i, j, n, rc;
+
+	err = process_params(argc, argv, send_params, &next_arg, 0);
+	if (err) {
+		fprintf(stderr, "%s: Error processing parameters\n", test_name);
+		return err;
+	}
+
+	if (!send_mpool[0]) {
+		fprintf(stderr, "%s: mpool (mp=<mpool>) must be specified\n",
+			test_name);
+		return merr(EINVAL);
+	}
+
+	if (send_pages < 8) {
+		fprintf(stderr, "%s: pages must be at least 8\n", test_name);
+		return merr(EINVAL);
+	}
+
+	mblen = send_pages * PAGE_SIZE;
+
+	/* The last range covers the whole mblock */
+	ranges[NELEM(ranges) - 1][1] = mblen;
+
+	rc = posix_memalign((void **)&wbuf, PAGE_SIZE, mblen);
+	if (rc)
+		return merr(rc);
+
+	rbuf = malloc(mblen);
+	if (!rbuf) {
+		err = merr(ENOMEM);
+		goto out;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+		err = merr(errno);
+		mpft_err(test_name, "socketpair", err);
+		goto out;
+	}
+
+	err = mpool_open(send_mpool, O_RDWR, &ds, NULL);
+	if (err) {
+		mpft_err(test_name, "mpool_open", err);
+		goto out;
+	}
+
+	for (i = 0; i < 2; i++) {
+		for (off = 0; off < mblen; off++)
+			wbuf[off] = send_pattern(i, off);
+
+		err = mpool_mblock_alloc(ds, MP_MED_CAPACITY, false,
+					 &mbh[i], NULL);
+		if (err) {
+			mpft_err(test_name, "mpool_mblock_alloc", err);
+			goto out;
+		}
+
+		iov.iov_base = wbuf;
+		iov.iov_len = mblen;
+
+		err = mpool_mblock_write(ds, mbh[i], &iov, 1);
+		if (!err)
+			err = mpool_mblock_commit(ds, mbh[i]);
+		if (err) {
+			mpft_err(test_name, "mpool_mblock_write/commit", err);
+			goto out;
+		}
+	}
+
+	/* A range past the end of the mblock must be refused */
+	err = mpool_mblock_send(ds, mbh[0], mblen - 1, 2, sv[0]);
+	if (mpool_errno(err) != EINVAL) {
+		fprintf(stderr, "%s: send past the end returned %d\n",
+			test_name, mpool_errno(err));
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	/* Interleave the mblocks and repeat each range to reuse the maps */
+	for (n = 0; n < 3; n++) {
+		for (j = 0; j < NELEM(ranges); j++) {
+			for (i = 0; i < 2; i++) {
+				err = send_check(ds, sv, mbh[i], i,
+						 ranges[j][0], ranges[j][1],
+						 rbuf);
+				if (err) {
+					mpft_err(test_name, "send", err);
+					goto out;
+				}
+			}
+		}
+	}
+
+	err = mpool_mblock_delete(ds, mbh[1]);
+	if (err) {
+		mpft_err(test_name, "mpool_mblock_delete", err);
+		goto out;
+	}
+
+	len = 1;
+	err = mpool_mblock_send(ds, mbh[1], 0, len, sv[0]);
+	mbh[1] = 0;
+	if (!err) {
+		fprintf(stderr, "%s: send of a deleted mblock succeeded\n",
+			test_name);
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	for (j = 0; j < NELEM(ranges); j++) {
+		err = send_check(ds, sv, mbh[0], 0, ranges[j][0], ranges[j][1],
+				 rbuf);
+		if (err) {
+			mpft_err(test_name, "send after delete", err);
+			goto out;
+		}
+	}
+
+out:
+	for (i = 0; i < 2; i++)
+		if (ds && mbh[i])
+			mpool_mblock_delete(ds, mbh[i]);
+
+	if (ds)
+		mpool_close(ds);
+
+	if (sv[0] >= 0) {
+		close(sv[0]);
+		close(sv[1]);
+	}
+
+	free(rbuf);
+	free(wbuf);
+
+	return err;
+}
+
+/**
+ *
+ * Fromfd
+ *
+ */
+
+static char fromfd_mpool[MPOOL_NAME_LEN_MAX];
+static u32  fromfd_pages = 2304;
+
+static
+struct param_inst fromfd_params[] = {
+	PARAM_INST_STRING(fromfd_mpool, sizeof(fromfd_mpool), "mp", "mpool"),
+	PARAM_INST_U32(fromfd_pages, "pages", "pages in the source file"),
+	PARAM_INST_END
+};
+
+static
+void
+fromfd_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft mblock.correctness.fromfd [options]\n");
+	fprintf(co.co_fp, "e.g.: mpft mblock.correctness.fromfd mp=mp1\n");
+	fprintf(co.co_fp,
+		"\nmblock.correctness.fromfd writes ranges of a file and of "
+		"a pipe to mblocks and verifies what is read back; the "
+		"default size spans two write chunks\n");
+
+	show_default_params(fromfd_params, 0);
+}
+
+/*
+ * Write [off, off + len) of fd to a new mblock, commit it and verify that
+ * it reads back as the source pattern followed by zeroes up to a page
+ */
+static
+mpool_err_t
+fromfd_check(
+	struct mpool   *ds,
+	int             fd,
+	size_t          off,
+	size_t          len,
+	u8             *rbuf)
+{
+	struct mblock_props     props;
+	struct iovec            iov;
+	mpool_err_t             err;
+	size_t                  i, wlen;
+	u64                     mbh;
+
+	err = mpool_mblock_alloc(ds, MP_MED_CAPACITY, false, &mbh, NULL);
+	if (err)
+		return err;
+
+	err = mpool_mblock_write_from_fd(ds, mbh, fd, off, len);
+	if (err) {
+		mpool_mblock_abort(ds, mbh);
+		return err;
+	}
+
+	err = mpool_mblock_commit(ds, mbh);
+	if (err) {
+		mpool_mblock_abort(ds, mbh);
+		return err;
+	}
+
+	wlen = ALIGN(len, PAGE_SIZE);
+
+	err = mpool_mblock_getprops(ds, mbh, &props);
+	if (!err && props.mpr_write_len != wlen) {
+		fprintf(stderr, "%s: %zu+%zu wrote %u bytes, expected %zu\n",
+			__func__, off, len, props.mpr_write_len, wlen);
+		err = merr(EIO);
+	}
+	if (err)
+		goto out;
+
+	memset(rbuf, 0xff, wlen);
+	iov.iov_base = rbuf;
+	iov.iov_len = wlen;
+
+	err = mpool_mblock_read(ds, mbh, &iov, 1, 0);
+	if (err)
+		goto out;
+
+	for (i = 0; i < wlen; i++) {
+		if (rbuf[i] != (i < len ? send_pattern(0, off + i) : 0)) {
+			fprintf(stderr, "%s: %zu+%zu differs at %zu\n",
+				__func__, off, len, i);
+			err = merr(EIO);
+			break;
+		}
+	}
+
+out:
+	mpool_mblock_delete(ds, mbh);
+
+	return err;
+}
+
+static
+mpool_err_t
+fromfd_test(
+	int     argc,
+	char  **argv)
+{
+	struct mpool   *ds = NULL;
+	mpool_err_t     err;
+
+	size_t  ranges[][2] = {
+		{ 0, 0 },                               /* mapped */
+		{ PAGE_SIZE, 0 },                       /* mapped, padded */
+		{ 17, 0 },                              /* bounced, padded */
+		{ 3 * PAGE_SIZE, PAGE_SIZE - 1 },       /* tail only */
+		{ 0, 20 },                              /* tail at EOF */
+	};
+	char    path[] = "/tmp/mpft-fromfd-XXXXXX";
+	char   *test_name = argv[0];
+	size_t  flen, off, len;
+	u8     *wbuf = NULL, *rbuf = NULL;
+	int     pfd[2] = { -1, -1 };
+	int     fd = -1;
+	int     next_arg = 0;
+	int     i;
+
+	err = process_params(argc, argv, fromfd_params, &next_arg, 0);
+	if (err) {
+		fprintf(stderr, "%s: Error processing parameters\n", test_name);
+		return err;
+	}
+
+	if (!fromfd_mpool[0]) {
+		fprintf(stderr, "%s: mpool (mp=<mpool>) must be specified\n",
+			test_name);
+		return merr(EINVAL);
+	}
+
+	if (fromfd_pages < 8) {
+		fprintf(stderr, "%s: pages must be at least 8\n", test_name);
+		return merr(EINVAL);
+	}
+
+	/* The file ends with a partial page */
+	flen = fromfd_pages * PAGE_SIZE + 123;
+
+	ranges[0][1] = flen - 123;
+	ranges[1][1] = flen - PAGE_SIZE;
+	ranges[2][1] = flen / 2 + 5;
+	ranges[4][0] = flen - 20;
+
+	wbuf = malloc(flen);
+	rbuf = malloc(flen + PAGE_SIZE);
+	if (!wbuf || !rbuf) {
+		err = merr(ENOMEM);
+		goto out;
+	}
+
+	for (off = 0; off < flen; off++)
+		wbuf[off] = send_pattern(0, off);
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		err = merr(errno);
+		mpft_err(test_name, "mkstemp", err);
+		goto out;
+	}
+	unlink(path);
+
+	if (write(fd, wbuf, flen) != flen) {
+		err = merr(EIO);
+		mpft_err(test_name, "write", err);
+		goto out;
+	}
+
+	err = mpool_open(fromfd_mpool, O_RDWR, &ds, NULL);
+	if (err) {
+		mpft_err(test_name, "mpool_open", err);
+		goto out;
+	}
+
+	for (i = 0; i < NELEM(ranges); i++) {
+		err = fromfd_check(ds, fd, ranges[i][0], ranges[i][1], rbuf);
+		if (err) {
+			mpft_err(test_name, "write from file", err);
+			goto out;
+		}
+	}
+
+	/* A range past the end of the file must be refused */
+	err = fromfd_check(ds, fd, flen - 20, 21, rbuf);
+	if (mpool_errno(err) != ENODATA) {
+		fprintf(stderr, "%s: write past EOF returned %d\n",
+			test_name, mpool_errno(err));
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	/* A pipe is not seekable; it is read from its start */
+	len = 3 * PAGE_SIZE + 1000;
+
+	if (pipe(pfd)) {
+		err = merr(errno);
+		mpft_err(test_name, "pipe", err);
+		goto out;
+	}
+
+	/* Fits in the pipe buffer, so the write does not block */
+	if (write(pfd[1], wbuf, len) != len) {
+		err = merr(EIO);
+		mpft_err(test_name, "write to pipe", err);
+		goto out;
+	}
+	close(pfd[1]);
+	pfd[1] = -1;
+
+	err = fromfd_check(ds, pfd[0], 0, len, rbuf);
+	if (err) {
+		mpft_err(test_name, "write from pipe", err);
+		goto out;
+	}
+
+	/* The pipe is drained and its write end closed */
+	err = fromfd_check(ds, pfd[0], 0, PAGE_SIZE, rbuf);
+	if (mpool_errno(err) != ENODATA) {
+		fprintf(stderr, "%s: write from a closed pipe returned %d\n",
+			test_name, mpool_errno(err));
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	err = 0;
+
+out:
+	if (ds)
+		mpool_close(ds);
+
+	for (i = 0; i < 2; i++)
+		if (pfd[i] >= 0)
+			close(pfd[i]);
+
+	if (fd >= 0)
+		close(fd);
+
+	free(rbuf);
+	free(wbuf);
+
+	return err;
+}
+
 struct test_s mblock_tests[] = {
 	{ "seq_writes",  MPFT_TEST_TYPE_PERF, perf_seq_writes,
 		perf_seq_writes_help },
 	{ "seq_reads",  MPFT_TEST_TYPE_PERF, perf_seq_reads,
 		perf_seq_reads_help },
+	{ "send",  MPFT_TEST_TYPE_CORRECTNESS, send_test, send_help },
+	{ "fromfd",  MPFT_TEST_TYPE_CORRECTNESS, fromfd_test, fromfd_help },
 	{ NULL,  MPFT_TEST_TYPE_INVALID, NULL, NULL },
 };
 
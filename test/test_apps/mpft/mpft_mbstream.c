@@ -0,0 +1,897 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/platform.h>
+#include <util/param.h>
+#include <mpool/mpool.h>
+
+#include "mpft.h"
+#include "mpft_mbstream.h"
+
+#define merr(_errnum)   (_errnum)
+
+#define BS_MDC_CAPTGT   (8 * 1024 * 1024)
+#define BS_MDC_USAGE_MAX (BS_MDC_CAPTGT / 2)
+#define BS_HDRLEN       (sizeof(u64))
+#define BS_FRAMELEN     (16)
+#define BS_SEGS_MIN     (4)
+#define BS_CHUNKS_MAX   (256)
+
+/*
+ * Record "n" starts with
+ * its number, followed by a number of bytes that depends on "n" and is
+ * below "maxlen", so that a reader can tell which record it got and
+ * check it against the expected one.
+ */
+char bs_mpool[MPOOL_NAME_LEN_MAX];
+u32  bs_recs = 1024;
+u32  bs_maxlen = 4096;
+u32  bs_syncint = 8;
+u32  bs_wbufsz = 1024 * 1024;
+u64  bs_segsz = 4 * 1024 * 1024;
+
+static
+struct param_inst bs_params[] = {
+	PARAM_INST_STRING(bs_mpool, sizeof(bs_mpool), "mp", "mpool"),
+	PARAM_INST_U32(bs_recs, "recs", "records appended per pass"),
+	PARAM_INST_U32(bs_maxlen, "maxlen", "maximum record length"),
+	PARAM_INST_U32(bs_syncint, "syncint", "records per sync"),
+	PARAM_INST_U32(bs_wbufsz, "wbufsz", "stream write buffer size"),
+	PARAM_INST_U64_SIZE(bs_segsz, "segsz", "stream segment size cap"),
+	PARAM_INST_END
+};
+
+/**
+ * struct bs_test - state shared by the steps of an mbstream test
+ * @bs_test:    test name
+ * @bs_ds:      mpool handle
+ * @bs_ms:      stream handle, NULL while closed
+ * @bs_oid:     MDC OIDs
+ * @bs_prm:     stream parameters
+ * @bs_head:    number of the first record in the stream
+ * @bs_durable: number of the first record that is not durable
+ * @bs_next:    number of the next record to append
+ * @bs_buf:     record buffer
+ */
+struct bs_test {
+	const char                     *bs_test;
+	struct mpool                   *bs_ds;
+	struct mpool_mbstream          *bs_ms;
+	u64                             bs_oid[2];
+	struct mpool_mbstream_params    bs_prm;
+	u64                             bs_head;
+	u64                             bs_durable;
+	u64                             bs_next;
+	char                           *bs_buf;
+};
+
+/**
+ * bs_rec() - Build record "n" in the record buffer and return its length
+ */
+static
+size_t
+bs_rec(
+	struct bs_test *t,
+	u64             n)
+{
+	size_t  len, i;
+
+	len = BS_HDRLEN + (n * 2654435761ULL) % bs_maxlen;
+
+	memcpy(t->bs_buf, &n, BS_HDRLEN);
+	for (i = BS_HDRLEN; i < len; i++)
+		t->bs_buf[i] = (char)(n * 31 + i);
+
+	return len;
+}
+
+static
+mpool_err_t
+bs_open(
+	struct bs_test *t)
+{
+	mpool_err_t err;
+
+	err = mpool_mbstream_open(t->bs_ds, t->bs_oid[0], t->bs_oid[1],
+				  &t->bs_prm, &t->bs_ms);
+	if (err)
+		mpft_err(t->bs_test, "mpool_mbstream_open", err);
+
+	return err;
+}
+
+/**
+ * bs_close() - Close the stream, which seals and thereby makes durable
+ * every record appended
+ */
+static
+mpool_err_t
+bs_close(
+	struct bs_test *t)
+{
+	mpool_err_t err;
+
+	err = mpool_mbstream_close(t->bs_ms);
+	t->bs_ms = NULL;
+	if (err) {
+		mpft_err(t->bs_test, "mpool_mbstream_close", err);
+		return err;
+	}
+
+	t->bs_durable = t->bs_next;
+
+	return 0;
+}
+
+static
+mpool_err_t
+bs_sync(
+	struct bs_test *t)
+{
+	mpool_err_t err;
+
+	err = mpool_mbstream_sync(t->bs_ms);
+	if (err) {
+		mpft_err(t->bs_test, "mpool_mbstream_sync", err);
+		return err;
+	}
+
+	t->bs_durable = t->bs_next;
+
+	return 0;
+}
+
+/**
+ * bs_append() - Append "count" records, syncing after every "syncint"-th
+ * record of the stream if "sync" is set
+ */
+static
+mpool_err_t
+bs_append(
+	struct bs_test *t,
+	u32             count,
+	bool            sync)
+{
+	mpool_err_t err;
+	size_t      len;
+	bool        now;
+	u32         i;
+
+	for (i = 0; i < count; i++) {
+		len = bs_rec(t, t->bs_next);
+		now = sync && (t->bs_next + 1) % bs_syncint == 0;
+
+		err = mpool_mbstream_append(t->bs_ms, t->bs_buf, len, now);
+		if (err) {
+			fprintf(stderr, "%s: append record %lu: %d\n",
+				t->bs_test, (ulong)t->bs_next,
+				mpool_errno(err));
+			return err;
+		}
+
+		t->bs_next++;
+		if (now)
+			t->bs_durable = t->bs_next;
+	}
+
+	return 0;
+}
+
+/**
+ * bs_read() - Read from the reader's position to the end of the stream
+ * @next:   number of the record expected next (input and output)
+ * @cut:    segment sequence number
+ * @cutrec: number of the first record read from segment "cut" or later,
+ *          unchanged if none (output), or NULL
+ */
+static
+mpool_err_t
+bs_read(
+	struct bs_test *t,
+	u64            *next,
+	u64             cut,
+	u64            *cutrec)
+{
+	struct mpool_mbstream_props props;
+	const void                 *data;
+	mpool_err_t                 err;
+	size_t                      len, want;
+
+	while (true) {
+		err = mpool_mbstream_read_next(t->bs_ms, &data, &len);
+		if (err) {
+			fprintf(stderr, "%s: read record %lu: %d\n",
+				t->bs_test, (ulong)*next, mpool_errno(err));
+			return err;
+		}
+
+		if (!data)
+			return 0;
+
+		want = bs_rec(t, *next);
+		if (len != want || memcmp(data, t->bs_buf, len)) {
+			fprintf(stderr, "%s: record %lu: bad length %lu or "
+				"data, expected %lu\n", t->bs_test,
+				(ulong)*next, (ulong)len, (ulong)want);
+			return merr(EINVAL);
+		}
+
+		if (cutrec && *cutrec == U64_MAX) {
+			err = mpool_mbstream_getprops(t->bs_ms, &props);
+			if (err)
+				return err;
+
+			if (props.mbp_rdseq >= cut)
+				*cutrec = *next;
+		}
+
+		++*next;
+	}
+}
+
+/**
+ * bs_verify() - Read the whole stream, which must hold exactly the records
+ * from the head up to the first one not durable
+ * @cut:    segment sequence number
+ * @cutrec: number of the first record in segment "cut" or later (output),
+ *          or NULL
+ */
+static
+mpool_err_t
+bs_verify(
+	struct bs_test *t,
+	u64             cut,
+	u64            *cutrec)
+{
+	mpool_err_t err;
+	u64         next = t->bs_head;
+
+	if (cutrec)
+		*cutrec = U64_MAX;
+
+	err = mpool_mbstream_read_init(t->bs_ms);
+	if (err) {
+		mpft_err(t->bs_test, "mpool_mbstream_read_init", err);
+		return err;
+	}
+
+	err = bs_read(t, &next, cut, cutrec);
+	if (err)
+		return err;
+
+	if (next != t->bs_durable) {
+		fprintf(stderr, "%s: stream ends at record %lu, expected "
+			"%lu\n", t->bs_test, (ulong)next,
+			(ulong)t->bs_durable);
+		return merr(EINVAL);
+	}
+
+	if (cutrec && *cutrec == U64_MAX)
+		*cutrec = next;
+
+	return 0;
+}
+
+/**
+ * bs_trunc() - Truncate the stream below segment "seq" and check that it
+ * then starts with the first record of that segment
+ */
+static
+mpool_err_t
+bs_trunc(
+	struct bs_test *t,
+	u64             seq)
+{
+	mpool_err_t err;
+	u64         head;
+
+	err = bs_verify(t, seq, &head);
+	if (err)
+		return err;
+
+	err = mpool_mbstream_trunc(t->bs_ms, seq);
+	if (err) {
+		mpft_err(t->bs_test, "mpool_mbstream_trunc", err);
+		return err;
+	}
+
+	t->bs_head = head;
+
+	return bs_verify(t, 0, NULL);
+}
+
+/**
+ * bs_reopen() - Close and replay the stream, which must come back with
+ * every record
+ * @usage: MDC usage while the stream is closed (output), or NULL
+ */
+static
+mpool_err_t
+bs_reopen(
+	struct bs_test *t,
+	size_t         *usage)
+{
+	struct mpool_mbstream_props props;
+	mpool_err_t                 err;
+
+	err = bs_close(t);
+	if (err)
+		return err;
+
+	if (usage) {
+		err = mpft_mdc_usage(t->bs_ds, t->bs_oid, usage);
+		if (err) {
+			mpft_err(t->bs_test, "mdc usage", err);
+			return err;
+		}
+	}
+
+	err = bs_open(t);
+	if (!err)
+		err = mpool_mbstream_getprops(t->bs_ms, &props);
+	if (err)
+		return err;
+
+	/* Nothing is left journaled once the stream was closed */
+	if (props.mbp_pending) {
+		fprintf(stderr, "%s: %lu bytes pending after replay\n",
+			t->bs_test, (ulong)props.mbp_pending);
+		return merr(EINVAL);
+	}
+
+	return bs_verify(t, 0, NULL);
+}
+
+/**
+ * bs_start() - Parse parameters, open the mpool, create the stream MDC and
+ * open the stream
+ */
+static
+mpool_err_t
+bs_start(
+	struct bs_test *t,
+	int             argc,
+	char          **argv)
+{
+	mpool_err_t err;
+
+	memset(t, 0, sizeof(*t));
+	t->bs_test = argv[0];
+
+	err = mpft_mdc_start(t->bs_test, argc, argv, bs_params, bs_mpool,
+			     BS_MDC_CAPTGT, &t->bs_ds, t->bs_oid);
+	if (err)
+		return err;
+
+	if (bs_recs < bs_syncint || bs_syncint == 0 || bs_maxlen == 0 ||
+	    bs_segsz < 4 * (BS_FRAMELEN + BS_HDRLEN + bs_maxlen)) {
+		fprintf(stderr, "%s: syncint must be 1 to recs, maxlen "
+			"non-zero and segsz at least four records\n",
+			t->bs_test);
+		err = merr(EINVAL);
+		goto errout;
+	}
+
+	t->bs_prm.msp_segsz = bs_segsz;
+	t->bs_prm.msp_wbufsz = bs_wbufsz;
+	t->bs_prm.msp_mclassp = MP_MED_CAPACITY;
+
+	t->bs_buf = malloc(BS_HDRLEN + bs_maxlen);
+	if (!t->bs_buf) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	err = bs_open(t);
+	if (!err)
+		return 0;
+
+	free(t->bs_buf);
+errout:
+	mpft_mdc_finish(t->bs_ds, t->bs_oid);
+
+	return err;
+}
+
+/**
+ * bs_finish() - Delete every segment of the stream and destroy its MDC
+ *
+ * Closing seals records that were only journaled, e.g., by a crashed
+ * process, so the second pass truncates that last segment.
+ */
+static
+void
+bs_finish(
+	struct bs_test *t)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (!t->bs_ms &&
+		    mpool_mbstream_open(t->bs_ds, t->bs_oid[0], t->bs_oid[1],
+					&t->bs_prm, &t->bs_ms))
+			break;
+
+		mpool_mbstream_trunc(t->bs_ms, U64_MAX);
+		mpool_mbstream_close(t->bs_ms);
+		t->bs_ms = NULL;
+	}
+
+	mpft_mdc_finish(t->bs_ds, t->bs_oid);
+	free(t->bs_buf);
+}
+
+/**
+ *
+ * Replay
+ *
+ */
+
+/**
+ * The replay test appends records while a reader follows the stream
+ * across segment seals, checks that only synced records are visible,
+ * and that the stream comes back intact when replayed from its MDC after
+ * truncations, including a truncation under the reader and one of every
+ * segment.  It also covers the error paths.
+ */
+static
+void
+bs_correctness_replay_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft mbstream.correctness.replay [options]\n");
+	show_default_params(bs_params, 0);
+}
+
+static
+mpool_err_t
+bs_correctness_replay(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_mbstream_params    prm;
+	struct mpool_mbstream_props     props;
+	struct mpool_mbstream          *ms;
+	struct bs_test                  t;
+	const void                     *data;
+	mpool_err_t                     err;
+	size_t                          len;
+	char                           *big = NULL;
+	u64                             rdnext, head;
+	u32                             i;
+
+	err = bs_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	prm = t.bs_prm;
+	prm.msp_wbufsz += 1;
+
+	if (mpool_errno(mpool_mbstream_append(NULL, t.bs_buf, 1, false)) !=
+	    EINVAL ||
+	    mpool_errno(mpool_mbstream_append(t.bs_ms, NULL, 1, false)) !=
+	    EINVAL ||
+	    mpool_errno(mpool_mbstream_read_next(t.bs_ms, NULL, &len)) !=
+	    EINVAL ||
+	    mpool_errno(mpool_mbstream_getprops(t.bs_ms, NULL)) != EINVAL ||
+	    mpool_errno(mpool_mbstream_trunc(NULL, 0)) != EINVAL ||
+	    mpool_errno(mpool_mbstream_open(t.bs_ds, t.bs_oid[0],
+					    t.bs_oid[1], &prm, &ms)) !=
+	    EINVAL) {
+		fprintf(stderr, "%s: bad argument accepted\n", t.bs_test);
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	/* A new stream is empty, and buffered records are not visible */
+	err = bs_verify(&t, 0, NULL);
+	if (!err)
+		err = bs_append(&t, 4, false);
+	if (!err)
+		err = bs_verify(&t, 0, NULL);
+	if (!err)
+		err = bs_sync(&t);
+	if (!err)
+		err = bs_verify(&t, 0, NULL);
+	if (err)
+		goto out;
+
+	/* Follow the stream, also across seals of the segment being read */
+	err = mpool_mbstream_read_init(t.bs_ms);
+	if (err)
+		goto out;
+
+	rdnext = t.bs_head;
+
+	for (i = 0; !err; i++) {
+		err = bs_append(&t, 1, true);
+		if (err || i % 16)
+			continue;
+
+		err = bs_read(&t, &rdnext, 0, NULL);
+		if (err)
+			break;
+
+		if (rdnext < t.bs_durable) {
+			fprintf(stderr, "%s: reader stopped at record %lu, "
+				"%lu synced\n", t.bs_test, (ulong)rdnext,
+				(ulong)t.bs_durable);
+			err = merr(EINVAL);
+			break;
+		}
+
+		err = mpool_mbstream_getprops(t.bs_ms, &props);
+		if (!err && i >= bs_recs && props.mbp_nsegs >= BS_SEGS_MIN)
+			break;
+	}
+	if (!err)
+		err = bs_sync(&t);
+	if (err)
+		goto out;
+
+	/* A record must fit in an empty segment */
+	big = malloc(props.mbp_segcap);
+	if (!big) {
+		err = merr(ENOMEM);
+		goto out;
+	}
+
+	memset(big, 0, props.mbp_segcap);
+
+	err = mpool_mbstream_append(t.bs_ms, big, props.mbp_segcap, true);
+	if (mpool_errno(err) != EFBIG) {
+		fprintf(stderr, "%s: oversized record: %d\n",
+			t.bs_test, mpool_errno(err));
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	err = bs_verify(&t, 0, NULL);
+	if (!err)
+		err = bs_reopen(&t, NULL);
+	if (!err)
+		err = mpool_mbstream_getprops(t.bs_ms, &props);
+	if (err)
+		goto out;
+
+	/* Truncating below the head is a no-op */
+	err = mpool_mbstream_trunc(t.bs_ms, props.mbp_headseq);
+	if (!err)
+		err = bs_verify(&t, 0, NULL);
+	if (err)
+		goto out;
+
+	/* A reader on a deleted segment restarts at the new head */
+	err = bs_verify(&t, props.mbp_headseq + 2, &head);
+	if (!err)
+		err = mpool_mbstream_read_init(t.bs_ms);
+	if (!err)
+		err = mpool_mbstream_read_next(t.bs_ms, &data, &len);
+	if (!err)
+		err = mpool_mbstream_trunc(t.bs_ms, props.mbp_headseq + 2);
+	if (err) {
+		mpft_err(t.bs_test, "trunc under reader", err);
+		goto out;
+	}
+
+	t.bs_head = head;
+	rdnext = head;
+
+	err = bs_read(&t, &rdnext, 0, NULL);
+	if (err)
+		goto out;
+
+	if (rdnext != t.bs_durable) {
+		fprintf(stderr, "%s: reader ends at record %lu after trunc\n",
+			t.bs_test, (ulong)rdnext);
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	err = bs_reopen(&t, NULL);
+	if (!err)
+		err = mpool_mbstream_getprops(t.bs_ms, &props);
+	if (!err)
+		err = bs_trunc(&t, props.mbp_headseq + 1);
+	if (!err)
+		err = bs_reopen(&t, NULL);
+	if (err)
+		goto out;
+
+	/* Truncate every segment, the stream goes on after the last record */
+	err = bs_trunc(&t, U64_MAX);
+	if (!err)
+		err = mpool_mbstream_getprops(t.bs_ms, &props);
+	if (err)
+		goto out;
+
+	if (props.mbp_nsegs || t.bs_head != t.bs_next) {
+		fprintf(stderr, "%s: %lu segments left after trunc\n",
+			t.bs_test, (ulong)props.mbp_nsegs);
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	err = bs_reopen(&t, NULL);
+	if (!err)
+		err = bs_append(&t, bs_recs, true);
+	if (!err)
+		err = bs_reopen(&t, NULL);
+
+out:
+	free(big);
+	bs_finish(&t);
+
+	return err;
+}
+
+/**
+ *
+ * Compaction
+ *
+ */
+
+/**
+ * The compaction test appends and syncs records, journaling them in the
+ * MDC, and truncates all but the last segments, until the stream has
+ * compacted its MDC at least twice, which shows up as a drop in the MDC
+ * usage.  The MDC must stay well below its capacity, i.e., the stream must
+ * not wait for it to fill up, and the stream must be replayed correctly
+ * from each compacted MDC.
+ */
+static
+void
+bs_correctness_compaction_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft mbstream.correctness.compaction [options]\n");
+	show_default_params(bs_params, 0);
+}
+
+static
+mpool_err_t
+bs_correctness_compaction(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_mbstream_props props;
+	struct bs_test              t;
+	mpool_err_t                 err;
+	size_t                      usage, prev = 0;
+	u32                         chunk, compactions = 0;
+
+	err = bs_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	for (chunk = 0; compactions < 2; chunk++) {
+		if (chunk == BS_CHUNKS_MAX) {
+			fprintf(stderr, "%s: no MDC compaction after %u "
+				"records\n", t.bs_test, chunk * bs_recs);
+			err = merr(EINVAL);
+			goto out;
+		}
+
+		err = bs_append(&t, bs_recs, true);
+		if (!err)
+			err = bs_sync(&t);
+		if (!err)
+			err = mpool_mbstream_getprops(t.bs_ms, &props);
+		if (err)
+			goto out;
+
+		/* Truncate with records of the open segment journaled */
+		if (props.mbp_nsegs > 2) {
+			err = bs_trunc(&t, props.mbp_tailseq - 2);
+			if (err)
+				goto out;
+		}
+
+		err = bs_reopen(&t, &usage);
+		if (err)
+			goto out;
+
+		if (usage > BS_MDC_USAGE_MAX) {
+			fprintf(stderr, "%s: MDC usage %lu not compacted\n",
+				t.bs_test, (ulong)usage);
+			err = merr(EINVAL);
+			goto out;
+		}
+
+		if (usage < prev)
+			compactions++;
+		prev = usage;
+	}
+
+	err = bs_append(&t, bs_recs, true);
+	if (!err)
+		err = bs_reopen(&t, NULL);
+
+out:
+	bs_finish(&t);
+
+	return err;
+}
+
+/**
+ *
+ * Crash
+ *
+ */
+
+/**
+ * The crash test forks a child that opens its own mpool handle and stream,
+ * appends and syncs records and truncates the stream, reporting the head
+ * and the durable records.  It ends with synced records that
+ * are only journaled in the MDC, appends records it does not sync and
+ * exits without closing anything.  The segment those went to is never
+ * committed, so recovery must do without it.  After recovery the parent
+ * expects the stream to hold exactly the records last reported, and to go
+ * on from there.
+ */
+static
+void
+bs_correctness_crash_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft mbstream.correctness.crash [options]\n");
+	show_default_params(bs_params, 0);
+}
+
+static
+mpool_err_t
+bs_crash_send(
+	struct bs_test *t,
+	int             fd)
+{
+	u64 msg[2] = { t->bs_head, t->bs_durable };
+
+	return mpft_report(fd, msg, sizeof(msg));
+}
+
+static
+void
+bs_crash_report(
+	void       *arg,
+	const void *msgp)
+{
+	struct bs_test *t = arg;
+	const u64      *msg = msgp;
+
+	t->bs_head = msg[0];
+	t->bs_durable = msg[1];
+}
+
+static
+mpool_err_t
+bs_crash_child(
+	void   *arg,
+	int     fd)
+{
+	struct bs_test             *t = arg;
+	struct mpool_mbstream_props props;
+	mpool_err_t                 err;
+	u32                         i;
+
+	err = mpool_open(bs_mpool, O_RDWR, &t->bs_ds, NULL);
+	if (!err)
+		err = bs_open(t);
+
+	for (i = 0; i < 4 && !err; i++) {
+		err = bs_append(t, bs_recs, true);
+		if (!err)
+			err = bs_sync(t);
+		if (!err)
+			err = bs_crash_send(t, fd);
+		if (!err)
+			err = mpool_mbstream_getprops(t->bs_ms, &props);
+		if (!err && props.mbp_nsegs > 1)
+			err = bs_trunc(t, props.mbp_tailseq - 1);
+		if (!err)
+			err = bs_crash_send(t, fd);
+	}
+
+	/* Leave synced records journaled in the open segment */
+	for (i = 0; i < bs_recs && !err; i++) {
+		err = bs_append(t, 1, false);
+		if (!err)
+			err = bs_sync(t);
+		if (!err)
+			err = mpool_mbstream_getprops(t->bs_ms, &props);
+		if (err || props.mbp_pending > 0)
+			break;
+	}
+	if (!err)
+		err = bs_crash_send(t, fd);
+
+	/* Leave records that are buffered or written but not durable */
+	for (i = 0; i < bs_recs && !err; i++) {
+		err = mpool_mbstream_getprops(t->bs_ms, &props);
+		if (err || props.mbp_pending + BS_FRAMELEN + BS_HDRLEN +
+		    bs_maxlen > props.mbp_segcap)
+			break;
+
+		err = bs_append(t, 1, false);
+	}
+
+	return err;
+}
+
+static
+mpool_err_t
+bs_correctness_crash(
+	int     argc,
+	char  **argv)
+{
+	struct bs_test  t;
+	mpool_err_t     err;
+
+	err = bs_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	/* The child opens its own handles */
+	err = bs_close(&t);
+	if (!err)
+		err = mpft_crash(t.bs_test, bs_crash_child, bs_crash_report, &t,
+				 2 * sizeof(u64));
+	if (err)
+		goto out;
+
+	/* Records the child did not sync are gone, their numbers reused */
+	t.bs_next = t.bs_durable;
+
+	err = bs_open(&t);
+	if (!err)
+		err = bs_verify(&t, 0, NULL);
+	if (!err)
+		err = bs_append(&t, bs_recs, true);
+	if (!err)
+		err = bs_sync(&t);
+	if (!err)
+		err = bs_verify(&t, 0, NULL);
+	if (!err)
+		err = bs_reopen(&t, NULL);
+
+out:
+	bs_finish(&t);
+
+	return err;
+}
+
+struct test_s bs_tests[] = {
+	{ "replay", MPFT_TEST_TYPE_CORRECTNESS, bs_correctness_replay,
+		bs_correctness_replay_help },
+	{ "compaction", MPFT_TEST_TYPE_CORRECTNESS, bs_correctness_compaction,
+		bs_correctness_compaction_help },
+	{ "crash", MPFT_TEST_TYPE_CORRECTNESS, bs_correctness_crash,
+		bs_correctness_crash_help },
+	{ NULL, MPFT_TEST_TYPE_INVALID, NULL, NULL },
+};
+
+void
+bs_help(void)
+{
+	int i = 0;
+
+	fprintf(co.co_fp,
+		"\nmbstream tests validate the behavior of mblock streams\n");
+
+	fprintf(co.co_fp, "Available tests include:\n");
+	while (bs_tests[i].test_name) {
+		fprintf(co.co_fp, "\t%s\n", bs_tests[i].test_name);
+		i++;
+	}
+}
+
+struct group_s mpft_mbstream = {
+	.group_name = "mbstream",
+	.group_test = bs_tests,
+	.group_help = bs_help,
+};
@@ -0,0 +1,406 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/platform.h>
+#include <util/page.h>
+#include <util/param.h>
+#include <mpool/mpool.h>
+
+#include "mpft.h"
+#include "mpft_mcache.h"
+
+#define merr(_errnum)   (_errnum)
+
+#define MC_MBLOCKS      (2)
+
+/*
+ * Each phase of the readahead test makes enough accesses to span several
+ * of the periods over which a map's access pattern is judged.
+ */
+char mc_mpool[MPOOL_NAME_LEN_MAX];
+u32  mc_pages = 1024;
+u32  mc_accesses = 4096;
+
+static
+struct param_inst mc_params[] = {
+	PARAM_INST_STRING(mc_mpool, sizeof(mc_mpool), "mp", "mpool"),
+	PARAM_INST_U32(mc_pages, "pages", "pages per mblock"),
+	PARAM_INST_U32(mc_accesses, "accesses", "page accesses per phase"),
+	PARAM_INST_END
+};
+
+/**
+ * struct mc_test - state shared by the steps of an mcache test
+ * @mt_test:  test name
+ * @mt_ds:    mpool handle
+ * @mt_mbidv: mblocks, each page of which starts with its mc_tag()
+ * @mt_rand:  random number state
+ */
+struct mc_test {
+	const char     *mt_test;
+	struct mpool   *mt_ds;
+	u64             mt_mbidv[MC_MBLOCKS];
+	u64             mt_rand;
+};
+
+static inline
+u64
+mc_tag(
+	uint    mbidx,
+	size_t  pgnum)
+{
+	return ((u64)mbidx << 32) | pgnum;
+}
+
+static
+u64
+mc_rand(
+	struct mc_test *t)
+{
+	t->mt_rand ^= t->mt_rand << 13;
+	t->mt_rand ^= t->mt_rand >> 7;
+	t->mt_rand ^= t->mt_rand << 17;
+
+	return t->mt_rand;
+}
+
+/**
+ * mc_start() - Parse parameters, open the mpool and write the mblocks
+ */
+static
+mpool_err_t
+mc_start(
+	struct mc_test *t,
+	int             argc,
+	char          **argv)
+{
+	struct iovec    iov;
+	mpool_err_t     err;
+	size_t          pg;
+	char           *buf = NULL;
+	int             next_arg = 0;
+	int             i, rc;
+
+	memset(t, 0, sizeof(*t));
+	t->mt_test = argv[0];
+	t->mt_rand = 42;
+
+	err = process_params(argc, argv, mc_params, &next_arg, 0);
+	if (err) {
+		fprintf(stderr, "%s: process_params failed\n", t->mt_test);
+		return err;
+	}
+
+	if (mc_mpool[0] == 0) {
+		fprintf(stderr, "%s: mpool (mp=<mpool>) must be specified\n",
+			t->mt_test);
+		return merr(EINVAL);
+	}
+
+	if (mc_pages < 64) {
+		fprintf(stderr, "%s: pages must be at least 64\n", t->mt_test);
+		return merr(EINVAL);
+	}
+
+	rc = posix_memalign((void **)&buf, PAGE_SIZE, mc_pages * PAGE_SIZE);
+	if (rc)
+		return merr(rc);
+
+	err = mpool_open(mc_mpool, O_RDWR, &t->mt_ds, NULL);
+	if (err) {
+		mpft_err(t->mt_test, "mpool_open", err);
+		goto out;
+	}
+
+	memset(buf, 0, mc_pages * PAGE_SIZE);
+
+	for (i = 0; i < MC_MBLOCKS; i++) {
+		for (pg = 0; pg < mc_pages; pg++)
+			*(u64 *)(buf + pg * PAGE_SIZE) = mc_tag(i, pg);
+
+		err = mpool_mblock_alloc(t->mt_ds, MP_MED_CAPACITY, false,
+					 &t->mt_mbidv[i], NULL);
+		if (err) {
+			mpft_err(t->mt_test, "mpool_mblock_alloc", err);
+			goto out;
+		}
+
+		iov.iov_base = buf;
+		iov.iov_len = mc_pages * PAGE_SIZE;
+
+		err = mpool_mblock_write(t->mt_ds, t->mt_mbidv[i], &iov, 1);
+		if (!err)
+			err = mpool_mblock_commit(t->mt_ds, t->mt_mbidv[i]);
+		if (err) {
+			mpft_err(t->mt_test, "mpool_mblock_write/commit", err);
+			goto out;
+		}
+	}
+
+out:
+	free(buf);
+
+	return err;
+}
+
+static
+void
+mc_finish(
+	struct mc_test *t)
+{
+	int i;
+
+	for (i = 0; i < MC_MBLOCKS; i++)
+		if (t->mt_ds && t->mt_mbidv[i])
+			mpool_mblock_delete(t->mt_ds, t->mt_mbidv[i]);
+
+	if (t->mt_ds)
+		mpool_close(t->mt_ds);
+}
+
+/**
+ *
+ * Readahead
+ *
+ */
+
+/**
+ * Mcache maps adapt their readahead to how they are accessed.  The
+ * readahead test drives maps with sequential and random phases, through
+ * both mpool_mcache_getpages() and mpool_mcache_access(), and checks the
+ * statistics after each phase:
+ *
+ *   - a sequential scan reads ahead and never switches the map;
+ *   - a map with the default advice, MPC_VMA_COLD, switches to MADV_RANDOM
+ *     once accesses are mostly random, and back once they are sequential;
+ *   - a map with an explicit advice still reads ahead of scans, but keeps
+ *     the advice of its caller;
+ *   - an MPC_VMA_PINNED map does not adapt at all.
+ *
+ * Every page accessed is checked to hold its own tag.
+ */
+static
+void
+mc_correctness_readahead_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft mcache.correctness.readahead [options]\n");
+	show_default_params(mc_params, 0);
+}
+
+/**
+ * mc_phase() - Access mc_accesses pages of @map, sequentially cycling
+ * through the mblocks or at random, through getpages or getbase
+ */
+static
+mpool_err_t
+mc_phase(
+	struct mc_test             *t,
+	struct mpool_mcache_map    *map,
+	bool                        seq,
+	bool                        base)
+{
+	mpool_err_t err;
+	size_t      pgnum;
+	void       *addr;
+	uint        mbidx;
+	u32         i;
+
+	for (i = 0; i < mc_accesses; i++) {
+		if (seq) {
+			mbidx = (i / mc_pages) % MC_MBLOCKS;
+			pgnum = i % mc_pages;
+		} else {
+			mbidx = mc_rand(t) % MC_MBLOCKS;
+			pgnum = mc_rand(t) % mc_pages;
+		}
+
+		if (base) {
+			addr = mpool_mcache_getbase(map, mbidx);
+			if (!addr)
+				return merr(EINVAL);
+
+			addr = (char *)addr + pgnum * PAGE_SIZE;
+			mpool_mcache_access(map, mbidx, pgnum * PAGE_SIZE,
+					    sizeof(u64));
+		} else {
+			err = mpool_mcache_getpages(map, 1, mbidx, &pgnum,
+						    &addr);
+			if (err) {
+				mpft_err(t->mt_test, "getpages", err);
+				return err;
+			}
+		}
+
+		if (*(u64 *)addr != mc_tag(mbidx, pgnum)) {
+			fprintf(stderr, "%s: mblock %u page %zu: tag 0x%lx\n",
+				t->mt_test, mbidx, pgnum, (ulong)*(u64 *)addr);
+			return merr(EIO);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * mc_expect() - Check the statistics of @map after phase @what
+ * @ahead:    pages must have been read ahead
+ * @random:   expected mrs_random
+ * @switches: expected mrs_switches
+ */
+static
+mpool_err_t
+mc_expect(
+	struct mc_test                 *t,
+	struct mpool_mcache_map        *map,
+	const char                     *what,
+	bool                            ahead,
+	u32                             random,
+	u64                             switches)
+{
+	struct mpool_mcache_ra_stats    stats;
+	mpool_err_t                     err;
+
+	err = mpool_mcache_ra_stats(map, &stats);
+	if (err) {
+		mpft_err(t->mt_test, "mpool_mcache_ra_stats", err);
+		return err;
+	}
+
+	if ((ahead && stats.mrs_ahead == 0) || stats.mrs_random != random ||
+	    stats.mrs_switches != switches) {
+		fprintf(stderr, "%s: %s: seq %lu rand %lu ahead %lu "
+			"switches %lu random %u, expected %s, switches %lu "
+			"random %u\n", t->mt_test, what,
+			(ulong)stats.mrs_seq, (ulong)stats.mrs_rand,
+			(ulong)stats.mrs_ahead, (ulong)stats.mrs_switches,
+			stats.mrs_random, ahead ? "readahead" : "any",
+			(ulong)switches, random);
+		return merr(EINVAL);
+	}
+
+	return 0;
+}
+
+static
+mpool_err_t
+mc_correctness_readahead(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_mcache_ra_stats    stats;
+	struct mpool_mcache_map        *map = NULL;
+	struct mc_test                  t;
+	mpool_err_t                     err;
+
+	err = mc_start(&t, argc, argv);
+	if (err)
+		goto out;
+
+	/* Default advice: the map follows the access pattern */
+	err = mpool_mcache_mmap(t.mt_ds, MC_MBLOCKS, t.mt_mbidv, MPC_VMA_COLD,
+				&map);
+	if (err) {
+		mpft_err(t.mt_test, "mpool_mcache_mmap", err);
+		goto out;
+	}
+
+	err = mc_phase(&t, map, true, false);
+	if (!err)
+		err = mc_expect(&t, map, "cold scan", true, 0, 0);
+	if (!err)
+		err = mc_phase(&t, map, false, false);
+	if (!err)
+		err = mc_expect(&t, map, "cold random", true, 1, 1);
+	if (!err)
+		err = mc_phase(&t, map, true, true);
+	if (!err)
+		err = mc_expect(&t, map, "cold scan via base", true, 0, 2);
+	if (err)
+		goto out;
+
+	mpool_mcache_munmap(map);
+	map = NULL;
+
+	/* Explicit advice: reads ahead of scans, never switches */
+	err = mpool_mcache_mmap(t.mt_ds, MC_MBLOCKS, t.mt_mbidv, MPC_VMA_WARM,
+				&map);
+	if (err) {
+		mpft_err(t.mt_test, "mpool_mcache_mmap", err);
+		goto out;
+	}
+
+	err = mc_phase(&t, map, false, true);
+	if (!err)
+		err = mc_expect(&t, map, "warm random", false, 0, 0);
+	if (!err)
+		err = mc_phase(&t, map, true, false);
+	if (!err)
+		err = mc_expect(&t, map, "warm scan", true, 0, 0);
+	if (err)
+		goto out;
+
+	mpool_mcache_munmap(map);
+	map = NULL;
+
+	/* Pinned: nothing to adapt */
+	err = mpool_mcache_mmap(t.mt_ds, MC_MBLOCKS, t.mt_mbidv,
+				MPC_VMA_PINNED, &map);
+	if (err) {
+		mpft_err(t.mt_test, "mpool_mcache_mmap", err);
+		goto out;
+	}
+
+	err = mc_phase(&t, map, true, false);
+	if (!err)
+		err = mc_phase(&t, map, false, true);
+	if (!err)
+		err = mpool_mcache_ra_stats(map, &stats);
+	if (!err && (stats.mrs_seq || stats.mrs_rand || stats.mrs_ahead)) {
+		fprintf(stderr, "%s: pinned map adapted: seq %lu rand %lu "
+			"ahead %lu\n", t.mt_test, (ulong)stats.mrs_seq,
+			(ulong)stats.mrs_rand, (ulong)stats.mrs_ahead);
+		err = merr(EINVAL);
+	}
+
+out:
+	if (map)
+		mpool_mcache_munmap(map);
+
+	mc_finish(&t);
+
+	return err;
+}
+
+struct test_s mc_tests[] = {
+	{ "readahead", MPFT_TEST_TYPE_CORRECTNESS, mc_correctness_readahead,
+		mc_correctness_readahead_help },
+	{ NULL, MPFT_TEST_TYPE_INVALID, NULL, NULL },
+};
+
+void
+mc_help(void)
+{
+	int i = 0;
+
+	fprintf(co.co_fp,
+		"\nmcache tests validate the behavior of mcache maps\n");
+
+	fprintf(co.co_fp, "Available tests include:\n");
+	while (mc_tests[i].test_name) {
+		fprintf(co.co_fp, "\t%s\n", mc_tests[i].test_name);
+		i++;
+	}
+}
+
+struct group_s mpft_mcache = {
+	.group_name = "mcache",
+	.group_test = mc_tests,
+	.group_help = mc_help,
+};
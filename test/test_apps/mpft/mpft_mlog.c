@@ -48,6 +48,10 @@
  *
  *     Description: perf_seq_reads follows the same steps as perf_seq_writes,
  *       but adds a loop reading back all of the records.
+ *
+ * * reverse - read an mlog backward with the reverse read cursor
+ *   - required parameters:
+ *     - mpool (mp)
  */
 
 #include <stdio.h>
@@ -56,6 +60,7 @@
 #include <util/platform.h>
 #include <util/parse_num.h>
 #include <util/param.h>
+#include <util/minmax.h>
 #include <mpool/mpool.h>
 
 #include "mpft.h"
@@ -1838,6 +1843,1145 @@ close_ds:
 	return original_err;
 }
 
+/**
+ *
+ * Reverse - Backward scan with the reverse read cursor
+ *
+ */
+
+/**
+ * The reverse test reads an mlog from the newest record to the oldest.
+ *
+ * Steps:
+ * 1. Open the DS
+ * 2. Allocate, commit and open an mlog
+ * 3. Append records of varying length, some spanning log blocks
+ * 4. Read the first record with the forward cursor
+ * 5. Init the reverse cursor and append one more record
+ * 6. Read the newest record into a short buffer, expect EOVERFLOW
+ * 7. Read/Verify all records backward, the late append is not seen
+ * 8. Verify the forward cursor is where step 4 left it
+ * 9. Re-init the reverse cursor, the late append is now the newest
+ * 10. Cleanup
+ */
+
+#define REV_CNT     600
+#define REV_LENMAX  9000
+
+char mlog_correctness_reverse_mpool[MPOOL_NAME_LEN_MAX];
+
+static
+struct param_inst mlog_correctness_reverse_params[] = {
+	PARAM_INST_STRING(mlog_mclassp_str,
+		sizeof(mlog_mclassp_str), "mc", "media class"),
+	PARAM_INST_STRING(mlog_correctness_reverse_mpool,
+		sizeof(mlog_correctness_reverse_mpool), "mp", "mpool"),
+	PARAM_INST_END
+};
+
+static
+void
+mlog_correctness_reverse_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft mlog.correctness.reverse [options]\n");
+
+	show_default_params(mlog_correctness_reverse_params, 0);
+}
+
+static inline
+size_t
+rev_len(int i)
+{
+	return 1 + (i * 977) % REV_LENMAX;
+}
+
+static
+void
+rev_fill(
+	char   *buf,
+	int     i)
+{
+	size_t  j;
+
+	for (j = 0; j < rev_len(i); j++)
+		buf[j] = (char)(i * 31 + j);
+}
+
+static
+int
+rev_verify(
+	char   *buf,
+	size_t  read_len,
+	int     i)
+{
+	size_t  j;
+
+	if (read_len != rev_len(i)) {
+		fprintf(stderr, "record %d: expect len %zu got %zu\n",
+			i, rev_len(i), read_len);
+		return 1;
+	}
+
+	for (j = 0; j < read_len; j++) {
+		if (buf[j] != (char)(i * 31 + j)) {
+			fprintf(stderr, "record %d: mismatch at byte %zu\n",
+				i, j);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+mpool_err_t
+mlog_correctness_reverse(
+	int     argc,
+	char  **argv)
+{
+	mpool_err_t err = 0, original_err = 0;
+	char  *mpool;
+	char  *test = argv[0];
+	int    next_arg = 0;
+	char   errbuf[ERROR_BUFFER_SIZE];
+	char  *buf = NULL;
+	u64    gen;
+	int    i;
+	size_t read_len;
+
+	struct mpool           *ds;
+	struct mpool_mlog      *mlog1;
+	struct mlog_capacity    capreq;
+	struct mlog_props       props;
+
+	show_args(argc, argv);
+	err = process_params(argc, argv,
+		mlog_correctness_reverse_params, &next_arg, 0);
+	if (err != 0) {
+		printf("%s process_params returned an error\n", __func__);
+		return err;
+	}
+
+	/* advance the arg pointer once for the "verb" */
+	next_arg++;
+
+	mpool = mlog_correctness_reverse_mpool;
+	mlog_mclassp = mclassp_str2enum(mlog_mclassp_str);
+
+	if (mpool[0] == 0) {
+		fprintf(stderr,
+			"%s.%d: mpool (mp=<mpool>) must be specified\n",
+			__func__, __LINE__);
+		return merr(EINVAL);
+	}
+
+	buf = malloc(REV_LENMAX);
+	if (!buf)
+		return merr(ENOMEM);
+
+	/* 1. Open the DS */
+	err = mpool_open(mpool, O_RDWR, &ds, NULL);
+	if (err) {
+		original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to open the dataset: %s\n",
+			__func__, __LINE__, errbuf);
+		goto free_buf;
+	}
+
+	capreq.lcp_captgt = 8 * 1024 * 1024;   /* Room for REV_CNT records */
+	capreq.lcp_spare  = false;
+
+	/* 2. Allocate, commit and open an mlog */
+	err = mpool_mlog_alloc(ds, &capreq, mlog_mclassp, &props, &mlog1);
+	if (err) {
+		original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to create mlog: %s\n",
+			__func__, __LINE__, errbuf);
+		goto close_ds;
+	}
+
+	err = mpool_mlog_commit(ds, mlog1);
+	if (err) {
+		original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to commit mlog: %s\n",
+			__func__, __LINE__, errbuf);
+		(void) mpool_mlog_abort(ds, mlog1);
+		goto close_ds;
+	}
+
+	err = mpool_mlog_open(ds, mlog1, oflags, &gen);
+	if (err) {
+		original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to open mlog: %s\n",
+			__func__, __LINE__, errbuf);
+		goto destroy_mlog;
+	}
+
+	/* 3. Append records, async except every 64th */
+	for (i = 0; i < REV_CNT; i++) {
+		rev_fill(buf, i);
+
+		err = mpool_mlog_append_data(ds, mlog1, buf, rev_len(i),
+					     (i % 64) == 0);
+		if (err) {
+			original_err = err;
+			mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+			fprintf(stderr, "%s.%d: Unable to append to mlog: %s\n",
+				__func__, __LINE__, errbuf);
+			goto close_mlog;
+		}
+	}
+
+	/* 4. Read the first record with the forward cursor */
+	err = mpool_mlog_read_data_init(ds, mlog1);
+	if (!err)
+		err = mpool_mlog_read_data_next(ds, mlog1, buf, REV_LENMAX,
+						&read_len);
+	if (err || rev_verify(buf, read_len, 0)) {
+		original_err = err ?: merr(EBUG);
+		fprintf(stderr, "%s.%d: forward read failed\n",
+			__func__, __LINE__);
+		goto close_mlog;
+	}
+
+	/* 5. Init the reverse cursor, then append a record it must not see */
+	err = mpool_mlog_read_data_init_tail(ds, mlog1);
+	if (err) {
+		original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to init reverse read: %s\n",
+			__func__, __LINE__, errbuf);
+		goto close_mlog;
+	}
+
+	rev_fill(buf, REV_CNT);
+	err = mpool_mlog_append_data(ds, mlog1, buf, rev_len(REV_CNT), true);
+	if (err) {
+		original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to append to mlog: %s\n",
+			__func__, __LINE__, errbuf);
+		goto close_mlog;
+	}
+
+	/* 6. A short buffer fails with the needed length, cursor unmoved */
+	i = REV_CNT - 1;
+	err = mpool_mlog_read_data_prev(ds, mlog1, buf, rev_len(i) - 1,
+					&read_len);
+	if (mpool_errno(err) != EOVERFLOW || read_len != rev_len(i)) {
+		original_err = err ?: merr(EBUG);
+		fprintf(stderr, "%s.%d: expected EOVERFLOW and len %zu, "
+			"got %d and len %zu\n", __func__, __LINE__,
+			rev_len(i), mpool_errno(err), read_len);
+		goto close_mlog;
+	}
+
+	/* 7. Read/Verify all records backward */
+	for (i = REV_CNT - 1; i >= 0; i--) {
+		err = mpool_mlog_read_data_prev(ds, mlog1, buf, REV_LENMAX,
+						&read_len);
+		if (err) {
+			original_err = err;
+			mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+			fprintf(stderr, "%s.%d: Unable to read record %d: %s\n",
+				__func__, __LINE__, i, errbuf);
+			goto close_mlog;
+		}
+
+		if (rev_verify(buf, read_len, i)) {
+			original_err = merr(EBUG);
+			fprintf(stderr, "%s.%d: %s: verify failed\n",
+				__func__, __LINE__, test);
+			goto close_mlog;
+		}
+	}
+
+	err = mpool_mlog_read_data_prev(ds, mlog1, buf, REV_LENMAX,
+					&read_len);
+	if (err || read_len) {
+		original_err = err ?: merr(EBUG);
+		fprintf(stderr, "%s.%d: expected start of log, got len %zu\n",
+			__func__, __LINE__, read_len);
+		goto close_mlog;
+	}
+
+	/* 8. The forward cursor is independent of the reverse one */
+	err = mpool_mlog_read_data_next(ds, mlog1, buf, REV_LENMAX,
+					&read_len);
+	if (err || rev_verify(buf, read_len, 1)) {
+		original_err = err ?: merr(EBUG);
+		fprintf(stderr, "%s.%d: forward cursor moved\n",
+			__func__, __LINE__);
+		goto close_mlog;
+	}
+
+	/* 9. Re-init, the record appended in step 5 is now the newest */
+	err = mpool_mlog_read_data_init_tail(ds, mlog1);
+	if (!err)
+		err = mpool_mlog_read_data_prev(ds, mlog1, buf, REV_LENMAX,
+						&read_len);
+	if (err || rev_verify(buf, read_len, REV_CNT)) {
+		original_err = err ?: merr(EBUG);
+		fprintf(stderr, "%s.%d: late append not seen after re-init\n",
+			__func__, __LINE__);
+		goto close_mlog;
+	}
+
+	/* 10. Cleanup */
+close_mlog:
+	err = mpool_mlog_close(ds, mlog1);
+	if (err) {
+		original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to close mlog: %s\n",
+			__func__, __LINE__, errbuf);
+	}
+
+destroy_mlog:
+	/* This automatically drops the alloc reference */
+	err = mpool_mlog_delete(ds, mlog1);
+	if (err) {
+		if (!original_err)
+			original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to delete mlog: %s\n",
+			__func__, __LINE__, errbuf);
+	}
+
+close_ds:
+	err = mpool_close(ds);
+	if (err) {
+		if (!original_err)
+			original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to close dataset: %s\n",
+			__func__, __LINE__, errbuf);
+	}
+
+free_buf:
+	free(buf);
+
+	return original_err;
+}
+
+/**
+ *
+ * Tailcache - Read-only opens in other processes
+ *
+ */
+
+/**
+ * The tailcache test opens an mlog read-only in child processes.  Such an
+ * open may trust the tail state that another process validated and
+ * published in the mpool's shared mlog tail cache, so each child checks
+ * that the newest record is the last one the writer appended; a stale tail
+ * would hide it from the reverse read cursor.
+ *
+ * Steps:
+ * 1. Open the DS, allocate and commit an mlog
+ * 2. Open the mlog, append records and close it
+ * 3. Verify read-only in a child, which validates and publishes the tail
+ * 4. Verify read-only in a second child, which may trust that tail, and
+ *    must see the same generation and length
+ * 5. Reopen, append more and verify in a child while the writer still has
+ *    the mlog open, the appends invalidated the published tail
+ * 6. Close, erase, append and verify in a child, the erase bumped the
+ *    generation and the old records are gone
+ * 7. Cleanup
+ */
+
+#define TC_CNT      200
+#define TC_SYNC     16
+
+char mlog_correctness_tailcache_mpool[MPOOL_NAME_LEN_MAX];
+
+static
+struct param_inst mlog_correctness_tailcache_params[] = {
+	PARAM_INST_STRING(mlog_mclassp_str,
+		sizeof(mlog_mclassp_str), "mc", "media class"),
+	PARAM_INST_STRING(mlog_correctness_tailcache_mpool,
+		sizeof(mlog_correctness_tailcache_mpool), "mp", "mpool"),
+	PARAM_INST_END
+};
+
+static
+void
+mlog_correctness_tailcache_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft mlog.correctness.tailcache [options]\n");
+
+	show_default_params(mlog_correctness_tailcache_params, 0);
+}
+
+/**
+ * struct tc_msg - what a child saw of the mlog
+ * @tm_gen: generation
+ * @tm_len: length
+ */
+struct tc_msg {
+	u64     tm_gen;
+	size_t  tm_len;
+};
+
+/**
+ * struct tc_log - the mlog a child verifies
+ * @tc_objid: mlog object ID
+ * @tc_first: first record the mlog must hold
+ * @tc_last:  one past the last record the mlog must hold
+ * @tc_msg:   what the last child saw
+ */
+struct tc_log {
+	u64             tc_objid;
+	int             tc_first;
+	int             tc_last;
+	struct tc_msg   tc_msg;
+};
+
+static
+void
+tc_record(
+	void       *arg,
+	const void *msg)
+{
+	struct tc_log *tc = arg;
+
+	memcpy(&tc->tc_msg, msg, sizeof(tc->tc_msg));
+}
+
+/**
+ * tc_child() - Open the mlog read-only in a new mpool handle, verify its
+ * records forward and its newest record backward, and report what it saw
+ */
+static
+mpool_err_t
+tc_child(
+	void   *arg,
+	int     fd)
+{
+	struct tc_log      *tc = arg;
+	struct mpool       *ds;
+	struct mpool_mlog  *mlh;
+	struct mlog_props   props;
+	struct tc_msg       msg;
+	mpool_err_t         err;
+	size_t              read_len;
+	char               *buf;
+	char                c = 0;
+	int                 i;
+
+	buf = malloc(REV_LENMAX);
+	if (!buf)
+		return merr(ENOMEM);
+
+	err = mpool_open(mlog_correctness_tailcache_mpool, O_RDWR, &ds, NULL);
+	if (err) {
+		mpft_err(__func__, "mpool_open", err);
+		goto free_buf;
+	}
+
+	err = mpool_mlog_find_get(ds, tc->tc_objid, &props, &mlh);
+	if (err) {
+		mpft_err(__func__, "mpool_mlog_find_get", err);
+		goto close_ds;
+	}
+
+	err = mpool_mlog_open(ds, mlh, MLOG_OF_RDONLY, &msg.tm_gen);
+	if (!err)
+		err = mpool_mlog_len(ds, mlh, &msg.tm_len);
+	if (err) {
+		mpft_err(__func__, "mpool_mlog_open", err);
+		goto put_mlog;
+	}
+
+	/* A read-only handle rejects appends */
+	err = mpool_mlog_append_data(ds, mlh, &c, 1, true);
+	if (mpool_errno(err) != EPERM) {
+		fprintf(stderr, "%s: append expected EPERM, got %d\n",
+			__func__, mpool_errno(err));
+		err = err ?: merr(EBUG);
+		goto close_mlog;
+	}
+
+	err = mpool_mlog_read_data_init(ds, mlh);
+	for (i = tc->tc_first; i < tc->tc_last && !err; i++) {
+		err = mpool_mlog_read_data_next(ds, mlh, buf, REV_LENMAX,
+						&read_len);
+		if (!err && rev_verify(buf, read_len, i))
+			err = merr(EBUG);
+	}
+	if (!err)
+		err = mpool_mlog_read_data_next(ds, mlh, buf, REV_LENMAX,
+						&read_len);
+	if (err || read_len) {
+		fprintf(stderr, "%s: forward read of records %d-%d failed\n",
+			__func__, tc->tc_first, tc->tc_last - 1);
+		err = err ?: merr(EBUG);
+		goto close_mlog;
+	}
+
+	/* The reverse cursor starts at the tail this open trusted */
+	err = mpool_mlog_read_data_init_tail(ds, mlh);
+	if (!err)
+		err = mpool_mlog_read_data_prev(ds, mlh, buf, REV_LENMAX,
+						&read_len);
+	if (err || rev_verify(buf, read_len, tc->tc_last - 1)) {
+		fprintf(stderr, "%s: newest record is not %d\n",
+			__func__, tc->tc_last - 1);
+		err = err ?: merr(EBUG);
+		goto close_mlog;
+	}
+
+	err = mpft_report(fd, &msg, sizeof(msg));
+
+close_mlog:
+	if (mpool_mlog_close(ds, mlh) && !err)
+		err = merr(EBUG);
+
+put_mlog:
+	mpool_mlog_put(ds, mlh);
+
+close_ds:
+	if (mpool_close(ds) && !err)
+		err = merr(EBUG);
+
+free_buf:
+	free(buf);
+
+	return err;
+}
+
+/**
+ * tc_append() - Open the mlog and append records [@first, @last), syncing
+ * every TC_SYNC records and the last one
+ */
+static
+mpool_err_t
+tc_append(
+	struct mpool       *ds,
+	struct mpool_mlog  *mlh,
+	char               *buf,
+	int                 first,
+	int                 last)
+{
+	mpool_err_t err;
+	u64         gen;
+	int         i;
+
+	err = mpool_mlog_open(ds, mlh, oflags, &gen);
+	if (err) {
+		mpft_err(__func__, "mpool_mlog_open", err);
+		return err;
+	}
+
+	for (i = first; i < last; i++) {
+		rev_fill(buf, i);
+
+		err = mpool_mlog_append_data(ds, mlh, buf, rev_len(i),
+				(i % TC_SYNC) == 0 || i == last - 1);
+		if (err) {
+			mpft_err(__func__, "mpool_mlog_append_data", err);
+			(void)mpool_mlog_close(ds, mlh);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+mpool_err_t
+mlog_correctness_tailcache(
+	int     argc,
+	char  **argv)
+{
+	mpool_err_t err = 0, original_err = 0;
+	char  *mpool;
+	char  *test = argv[0];
+	int    next_arg = 0;
+	char   errbuf[ERROR_BUFFER_SIZE];
+	char  *buf = NULL;
+
+	struct mpool           *ds;
+	struct mpool_mlog      *mlog1;
+	struct mlog_capacity    capreq;
+	struct mlog_props       props;
+	struct tc_log           tc;
+	struct tc_msg           first;
+
+	show_args(argc, argv);
+	err = process_params(argc, argv,
+		mlog_correctness_tailcache_params, &next_arg, 0);
+	if (err != 0) {
+		printf("%s process_params returned an error\n", __func__);
+		return err;
+	}
+
+	/* advance the arg pointer once for the "verb" */
+	next_arg++;
+
+	mpool = mlog_correctness_tailcache_mpool;
+	mlog_mclassp = mclassp_str2enum(mlog_mclassp_str);
+
+	if (mpool[0] == 0) {
+		fprintf(stderr,
+			"%s.%d: mpool (mp=<mpool>) must be specified\n",
+			__func__, __LINE__);
+		return merr(EINVAL);
+	}
+
+	buf = malloc(REV_LENMAX);
+	if (!buf)
+		return merr(ENOMEM);
+
+	/* 1. Open the DS, allocate and commit an mlog */
+	err = mpool_open(mpool, O_RDWR, &ds, NULL);
+	if (err) {
+		original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to open the dataset: %s\n",
+			__func__, __LINE__, errbuf);
+		goto free_buf;
+	}
+
+	capreq.lcp_captgt = 8 * 1024 * 1024;   /* Room for 2 * TC_CNT records */
+	capreq.lcp_spare  = false;
+
+	err = mpool_mlog_alloc(ds, &capreq, mlog_mclassp, &props, &mlog1);
+	if (err) {
+		original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to create mlog: %s\n",
+			__func__, __LINE__, errbuf);
+		goto close_ds;
+	}
+
+	err = mpool_mlog_commit(ds, mlog1);
+	if (err) {
+		original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to commit mlog: %s\n",
+			__func__, __LINE__, errbuf);
+		(void) mpool_mlog_abort(ds, mlog1);
+		goto close_ds;
+	}
+
+	memset(&tc, 0, sizeof(tc));
+	tc.tc_objid = props.lpr_objid;
+
+	/* 2. Open the mlog, append records and close it */
+	err = tc_append(ds, mlog1, buf, 0, TC_CNT);
+	if (!err)
+		err = mpool_mlog_close(ds, mlog1);
+	if (err) {
+		original_err = err;
+		goto destroy_mlog;
+	}
+
+	/* 3. Verify in a child, which validates and publishes the tail */
+	tc.tc_last = TC_CNT;
+	err = mpft_crash(test, tc_child, tc_record, &tc, sizeof(tc.tc_msg));
+	if (err) {
+		original_err = err;
+		goto destroy_mlog;
+	}
+	first = tc.tc_msg;
+
+	/* 4. A second child may trust that tail, it must see the same log */
+	err = mpft_crash(test, tc_child, tc_record, &tc, sizeof(tc.tc_msg));
+	if (!err && (tc.tc_msg.tm_gen != first.tm_gen ||
+		     tc.tc_msg.tm_len != first.tm_len)) {
+		fprintf(stderr, "%s.%d: expected gen %lu len %zu, "
+			"got gen %lu len %zu\n", __func__, __LINE__,
+			(ulong)first.tm_gen, first.tm_len,
+			(ulong)tc.tc_msg.tm_gen, tc.tc_msg.tm_len);
+		err = merr(EBUG);
+	}
+	if (err) {
+		original_err = err;
+		goto destroy_mlog;
+	}
+
+	/* 5. Append more, verify while the writer still has the mlog open */
+	err = tc_append(ds, mlog1, buf, TC_CNT, 2 * TC_CNT);
+	if (err) {
+		original_err = err;
+		goto destroy_mlog;
+	}
+
+	tc.tc_last = 2 * TC_CNT;
+	err = mpft_crash(test, tc_child, tc_record, &tc, sizeof(tc.tc_msg));
+	if (!err && tc.tc_msg.tm_len <= first.tm_len) {
+		fprintf(stderr, "%s.%d: length %zu did not grow from %zu\n",
+			__func__, __LINE__, tc.tc_msg.tm_len, first.tm_len);
+		err = merr(EBUG);
+	}
+	if (err) {
+		original_err = err;
+		(void)mpool_mlog_close(ds, mlog1);
+		goto destroy_mlog;
+	}
+
+	/* 6. Close, erase, append and verify */
+	err = mpool_mlog_close(ds, mlog1);
+	if (err) {
+		original_err = err;
+		goto destroy_mlog;
+	}
+
+	err = mpool_mlog_open(ds, mlog1, oflags, &first.tm_gen);
+	if (!err)
+		err = mpool_mlog_erase(ds, mlog1, 0);
+	if (!err)
+		err = mpool_mlog_close(ds, mlog1);
+	if (!err)
+		err = tc_append(ds, mlog1, buf, 0, TC_SYNC);
+	if (!err)
+		err = mpool_mlog_close(ds, mlog1);
+	if (err) {
+		original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to erase mlog: %s\n",
+			__func__, __LINE__, errbuf);
+		goto destroy_mlog;
+	}
+
+	tc.tc_last = TC_SYNC;
+	err = mpft_crash(test, tc_child, tc_record, &tc, sizeof(tc.tc_msg));
+	if (!err && tc.tc_msg.tm_gen <= first.tm_gen) {
+		fprintf(stderr, "%s.%d: gen %lu did not move past %lu\n",
+			__func__, __LINE__, (ulong)tc.tc_msg.tm_gen,
+			(ulong)first.tm_gen);
+		err = merr(EBUG);
+	}
+	if (err)
+		original_err = err;
+
+	/* 7. Cleanup */
+destroy_mlog:
+	/* This automatically drops the alloc reference */
+	err = mpool_mlog_delete(ds, mlog1);
+	if (err) {
+		if (!original_err)
+			original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to delete mlog: %s\n",
+			__func__, __LINE__, errbuf);
+	}
+
+close_ds:
+	err = mpool_close(ds);
+	if (err) {
+		if (!original_err)
+			original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to close dataset: %s\n",
+			__func__, __LINE__, errbuf);
+	}
+
+free_buf:
+	free(buf);
+
+	return original_err;
+}
+
+/**
+ *
+ * Keyidx - Seek by key with a sparse key index
+ *
+ */
+
+/**
+ * The keyidx test seeks an ordered mlog by key.  Record i has key
+ * 2 * (i / 2), so keys come in duplicate pairs and odd keys fall between
+ * records.  Records vary in length and many span log blocks, and the index
+ * has an entry every log block, so seeking every key lands on and around
+ * every index entry.
+ *
+ * Steps:
+ * 1. Open the DS, allocate, commit and open an mlog
+ * 2. Seek without an index, expect EINVAL
+ * 3. Enable the index, append records, which are indexed as appended
+ * 4. Seek every key and verify the record found and the one after it
+ * 5. Disable the index, which saves it, close, reopen and append more
+ *    records without it
+ * 6. Enable the index, which reloads the saved index and lazily indexes
+ *    the new records, then seek every key again
+ * 7. Append a record out of key order, expect the seek to fail
+ * 8. Cleanup
+ */
+
+#define KI_CNT      400
+#define KI_LENMAX   6000
+
+char mlog_correctness_keyidx_mpool[MPOOL_NAME_LEN_MAX];
+
+static
+struct param_inst mlog_correctness_keyidx_params[] = {
+	PARAM_INST_STRING(mlog_mclassp_str,
+		sizeof(mlog_mclassp_str), "mc", "media class"),
+	PARAM_INST_STRING(mlog_correctness_keyidx_mpool,
+		sizeof(mlog_correctness_keyidx_mpool), "mp", "mpool"),
+	PARAM_INST_END
+};
+
+static
+void
+mlog_correctness_keyidx_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft mlog.correctness.keyidx [options]\n");
+
+	show_default_params(mlog_correctness_keyidx_params, 0);
+}
+
+static inline
+size_t
+ki_len(int i)
+{
+	return sizeof(u64) + (i * 1237) % KI_LENMAX;
+}
+
+static inline
+u64
+ki_key(int i)
+{
+	return 2 * (i / 2);
+}
+
+static
+void
+ki_fill(
+	char   *buf,
+	int     i,
+	u64     key)
+{
+	size_t  j;
+
+	memcpy(buf, &key, sizeof(key));
+	for (j = sizeof(key); j < ki_len(i); j++)
+		buf[j] = (char)(i * 31 + j);
+}
+
+static
+int
+ki_verify(
+	char   *buf,
+	size_t  read_len,
+	int     i)
+{
+	size_t  j;
+	u64     key;
+
+	memcpy(&key, buf, sizeof(key));
+	if (read_len != ki_len(i) || key != ki_key(i)) {
+		fprintf(stderr, "record %d: expect len %zu key %lu, "
+			"got len %zu key %lu\n", i, ki_len(i),
+			(ulong)ki_key(i), read_len, (ulong)key);
+		return 1;
+	}
+
+	for (j = sizeof(key); j < read_len; j++) {
+		if (buf[j] != (char)(i * 31 + j)) {
+			fprintf(stderr, "record %d: mismatch at byte %zu\n",
+				i, j);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Keys are the first 8 bytes of a record, which may span iovecs */
+static
+uint64_t
+ki_keyfn(
+	const struct iovec *iov,
+	size_t              len,
+	void               *arg)
+{
+	u64     key = 0;
+	size_t  off = 0, cc;
+
+	while (off < sizeof(key) && off < len) {
+		cc = min_t(size_t, sizeof(key) - off, iov->iov_len);
+		memcpy((char *)&key + off, iov->iov_base, cc);
+		off += cc;
+		iov++;
+	}
+
+	return key;
+}
+
+static
+mpool_err_t
+ki_append(
+	struct mpool       *ds,
+	struct mpool_mlog  *mlh,
+	char               *buf,
+	int                 first,
+	int                 last)
+{
+	mpool_err_t err;
+	int         i;
+
+	for (i = first; i < last; i++) {
+		ki_fill(buf, i, ki_key(i));
+
+		err = mpool_mlog_append_data(ds, mlh, buf, ki_len(i),
+					     (i % 32) == 0);
+		if (err) {
+			mpft_err(__func__, "mpool_mlog_append_data", err);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * ki_seek_all() - Seek every key up to past the last of @cnt records, and
+ * verify the first record with a key >= the one sought and its successor
+ */
+static
+mpool_err_t
+ki_seek_all(
+	struct mpool       *ds,
+	struct mpool_mlog  *mlh,
+	char               *buf,
+	int                 cnt)
+{
+	mpool_err_t err;
+	size_t      read_len;
+	u64         key;
+	int         i, j;
+
+	for (key = 0; key <= ki_key(cnt - 1) + 1; key++) {
+		err = mpool_mlog_seek_key(ds, mlh, key);
+		if (err) {
+			mpft_err(__func__, "mpool_mlog_seek_key", err);
+			return err;
+		}
+
+		/* The first record of the pair holding the next even key */
+		i = (key + 1) & ~1ul;
+
+		for (j = i; j < i + 2; j++) {
+			err = mpool_mlog_read_data_next(ds, mlh, buf,
+							KI_LENMAX + sizeof(u64),
+							&read_len);
+			if (err) {
+				mpft_err(__func__, "read_data_next", err);
+				return err;
+			}
+
+			if (j >= cnt ? read_len != 0 :
+			    ki_verify(buf, read_len, j)) {
+				fprintf(stderr, "%s: seek to key %lu: "
+					"record %d is wrong\n", __func__,
+					(ulong)key, j);
+				return merr(EBUG);
+			}
+		}
+	}
+
+	return 0;
+}
+
+mpool_err_t
+mlog_correctness_keyidx(
+	int     argc,
+	char  **argv)
+{
+	mpool_err_t err = 0, original_err = 0;
+	char  *mpool;
+	int    next_arg = 0;
+	char   errbuf[ERROR_BUFFER_SIZE];
+	char  *buf = NULL;
+	u64    gen;
+
+	struct mpool           *ds;
+	struct mpool_mlog      *mlog1;
+	struct mlog_capacity    capreq;
+	struct mlog_props       props;
+
+	show_args(argc, argv);
+	err = process_params(argc, argv,
+		mlog_correctness_keyidx_params, &next_arg, 0);
+	if (err != 0) {
+		printf("%s process_params returned an error\n", __func__);
+		return err;
+	}
+
+	/* advance the arg pointer once for the "verb" */
+	next_arg++;
+
+	mpool = mlog_correctness_keyidx_mpool;
+	mlog_mclassp = mclassp_str2enum(mlog_mclassp_str);
+
+	if (mpool[0] == 0) {
+		fprintf(stderr,
+			"%s.%d: mpool (mp=<mpool>) must be specified\n",
+			__func__, __LINE__);
+		return merr(EINVAL);
+	}
+
+	buf = malloc(KI_LENMAX + sizeof(u64));
+	if (!buf)
+		return merr(ENOMEM);
+
+	/* 1. Open the DS, allocate, commit and open an mlog */
+	err = mpool_open(mpool, O_RDWR, &ds, NULL);
+	if (err) {
+		original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to open the dataset: %s\n",
+			__func__, __LINE__, errbuf);
+		goto free_buf;
+	}
+
+	capreq.lcp_captgt = 8 * 1024 * 1024;   /* Room for 2 * KI_CNT records */
+	capreq.lcp_spare  = false;
+
+	err = mpool_mlog_alloc(ds, &capreq, mlog_mclassp, &props, &mlog1);
+	if (err) {
+		original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to create mlog: %s\n",
+			__func__, __LINE__, errbuf);
+		goto close_ds;
+	}
+
+	err = mpool_mlog_commit(ds, mlog1);
+	if (err) {
+		original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to commit mlog: %s\n",
+			__func__, __LINE__, errbuf);
+		(void) mpool_mlog_abort(ds, mlog1);
+		goto close_ds;
+	}
+
+	err = mpool_mlog_open(ds, mlog1, oflags, &gen);
+	if (err) {
+		original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to open mlog: %s\n",
+			__func__, __LINE__, errbuf);
+		goto destroy_mlog;
+	}
+
+	/* 2. There is nothing to seek with yet */
+	err = mpool_mlog_seek_key(ds, mlog1, 0);
+	if (mpool_errno(err) != EINVAL) {
+		original_err = err ?: merr(EBUG);
+		fprintf(stderr, "%s.%d: seek without index: expected EINVAL, "
+			"got %d\n", __func__, __LINE__, mpool_errno(err));
+		goto close_mlog;
+	}
+
+	/* 3. Index every log block, and append */
+	err = mpool_mlog_keyidx_enable(ds, mlog1, ki_keyfn, NULL, 1);
+	if (!err)
+		err = ki_append(ds, mlog1, buf, 0, KI_CNT);
+	if (err) {
+		original_err = err;
+		goto close_mlog;
+	}
+
+	/* 4. Seek every key */
+	err = ki_seek_all(ds, mlog1, buf, KI_CNT);
+	if (err) {
+		original_err = err;
+		goto close_mlog;
+	}
+
+	/* 5. Save the index, then append without it */
+	err = mpool_mlog_keyidx_enable(ds, mlog1, NULL, NULL, 0);
+	if (err) {
+		original_err = err;
+		goto close_mlog;
+	}
+
+	err = mpool_mlog_close(ds, mlog1);
+	if (!err)
+		err = mpool_mlog_open(ds, mlog1, oflags, &gen);
+	if (err) {
+		original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to reopen mlog: %s\n",
+			__func__, __LINE__, errbuf);
+		goto destroy_mlog;
+	}
+
+	err = ki_append(ds, mlog1, buf, KI_CNT, 2 * KI_CNT);
+	if (err) {
+		original_err = err;
+		goto close_mlog;
+	}
+
+	/* 6. Reload the saved index, the seeks index the rest lazily */
+	err = mpool_mlog_keyidx_enable(ds, mlog1, ki_keyfn, NULL, 1);
+	if (!err)
+		err = ki_seek_all(ds, mlog1, buf, 2 * KI_CNT);
+	if (err) {
+		original_err = err;
+		goto close_mlog;
+	}
+
+	/* 7. A key out of order disables the index */
+	ki_fill(buf, 2 * KI_CNT, 0);
+	err = mpool_mlog_append_data(ds, mlog1, buf, ki_len(2 * KI_CNT), 1);
+	if (!err)
+		err = mpool_mlog_seek_key(ds, mlog1, 0);
+	if (mpool_errno(err) != EINVAL) {
+		original_err = err ?: merr(EBUG);
+		fprintf(stderr, "%s.%d: unordered seek: expected EINVAL, "
+			"got %d\n", __func__, __LINE__, mpool_errno(err));
+		goto close_mlog;
+	}
+
+	/* 8. Cleanup */
+close_mlog:
+	err = mpool_mlog_close(ds, mlog1);
+	if (err) {
+		if (!original_err)
+			original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to close mlog: %s\n",
+			__func__, __LINE__, errbuf);
+	}
+
+destroy_mlog:
+	/* This automatically drops the alloc reference */
+	err = mpool_mlog_delete(ds, mlog1);
+	if (err) {
+		if (!original_err)
+			original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to delete mlog: %s\n",
+			__func__, __LINE__, errbuf);
+	}
+
+close_ds:
+	err = mpool_close(ds);
+	if (err) {
+		if (!original_err)
+			original_err = err;
+		mpool_strinfo(err, errbuf, ERROR_BUFFER_SIZE);
+		fprintf(stderr, "%s.%d: Unable to close dataset: %s\n",
+			__func__, __LINE__, errbuf);
+	}
+
+free_buf:
+	free(buf);
+
+	return original_err;
+}
+
 struct test_s mlog_tests[] = {
 	{ "seq_writes",  MPFT_TEST_TYPE_PERF, perf_seq_writes,
 		perf_seq_writes_help },
@@ -1849,6 +2993,12 @@ struct test_s mlog_tests[] = {
 		mlog_correctness_basicio_help },
 	{ "recovery", MPFT_TEST_TYPE_CORRECTNESS, mlog_correctness_recovery,
 		mlog_correctness_recovery_help },
+	{ "reverse", MPFT_TEST_TYPE_CORRECTNESS, mlog_correctness_reverse,
+		mlog_correctness_reverse_help },
+	{ "tailcache", MPFT_TEST_TYPE_CORRECTNESS, mlog_correctness_tailcache,
+		mlog_correctness_tailcache_help },
+	{ "keyidx", MPFT_TEST_TYPE_CORRECTNESS, mlog_correctness_keyidx,
+		mlog_correctness_keyidx_help },
 	{ NULL,  MPFT_TEST_TYPE_INVALID, NULL, NULL },
 };
 
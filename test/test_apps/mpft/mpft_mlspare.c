@@ -0,0 +1,818 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/platform.h>
+#include <util/param.h>
+#include <mpool/mpool.h>
+
+#include "mpft.h"
+#include "mpft_mlspare.h"
+
+#define merr(_errnum)   (_errnum)
+
+#define SP_MDC_CAPTGT   (4 * 1024 * 1024)
+#define SP_RECLEN       (512)
+#define SP_RECS         (4)
+#define SP_WAIT_MS      (60 * 1000)
+#define SP_KEPT_MAX     (64)
+#define SP_RETIRED      (1ULL << 63)
+
+/*
+ * The pool members of a test are leaked when it finishes: they are not
+ * known outside the pool, and the pool has no call to hand them all back.
+ */
+char sp_mpool[MPOOL_NAME_LEN_MAX];
+u32  sp_target = 4;
+u32  sp_cycles = 1024;
+u64  sp_captgt = 1024 * 1024;
+
+static
+struct param_inst sp_params[] = {
+	PARAM_INST_STRING(sp_mpool, sizeof(sp_mpool), "mp", "mpool"),
+	PARAM_INST_U32(sp_target, "target", "number of ready spares"),
+	PARAM_INST_U32(sp_cycles, "cycles", "get/retire cycles per check"),
+	PARAM_INST_U64_SIZE(sp_captgt, "captgt", "spare mlog capacity"),
+	PARAM_INST_END
+};
+
+/**
+ * struct sp_test - state shared by the steps of an mlspare test
+ * @st_test:  test name
+ * @st_ds:    mpool handle
+ * @st_sp:    spare pool handle, NULL while closed
+ * @st_oid:   MDC OIDs
+ * @st_prm:   spare pool parameters
+ * @st_keptc: number of mlogs taken from the pool and kept
+ * @st_kept:  object IDs of the kept mlogs, which hold data
+ * @st_buf:   record buffer
+ */
+struct sp_test {
+	const char                     *st_test;
+	struct mpool                   *st_ds;
+	struct mpool_mlspare           *st_sp;
+	u64                             st_oid[2];
+	struct mpool_mlspare_params     st_prm;
+	u32                             st_keptc;
+	u64                             st_kept[SP_KEPT_MAX];
+	char                            st_buf[SP_RECLEN];
+};
+
+static
+mpool_err_t
+sp_open(
+	struct sp_test *t)
+{
+	mpool_err_t err;
+
+	err = mpool_mlspare_open(t->st_ds, t->st_oid[0], t->st_oid[1],
+				 &t->st_prm, &t->st_sp);
+	if (err)
+		mpft_err(t->st_test, "mpool_mlspare_open", err);
+
+	return err;
+}
+
+static
+mpool_err_t
+sp_close(
+	struct sp_test *t)
+{
+	mpool_err_t err;
+
+	err = mpool_mlspare_close(t->st_sp);
+	t->st_sp = NULL;
+	if (err)
+		mpft_err(t->st_test, "mpool_mlspare_close", err);
+
+	return err;
+}
+
+/**
+ * sp_wait() - Wait for the worker to clean every member and fill the pool
+ * @members: number of pool members (output)
+ *
+ * Once this returns the worker is idle until the next get or retire.
+ */
+static
+mpool_err_t
+sp_wait(
+	struct sp_test *t,
+	u32            *members)
+{
+	struct mpool_mlspare_props  props;
+	mpool_err_t                 err;
+	u32                         ms;
+
+	for (ms = 0; ms < SP_WAIT_MS; ms++) {
+		err = mpool_mlspare_getprops(t->st_sp, &props);
+		if (err) {
+			mpft_err(t->st_test, "mpool_mlspare_getprops", err);
+			return err;
+		}
+
+		if (props.msp_nbad) {
+			fprintf(stderr, "%s: %u spares failed to erase\n",
+				t->st_test, props.msp_nbad);
+			return merr(EIO);
+		}
+
+		if (props.msp_ndirty == 0 && props.msp_nready >= sp_target) {
+			*members = props.msp_nready;
+			return 0;
+		}
+
+		usleep(1000);
+	}
+
+	fprintf(stderr, "%s: pool not filled: %u ready %u dirty\n",
+		t->st_test, props.msp_nready, props.msp_ndirty);
+
+	return merr(ETIMEDOUT);
+}
+
+/**
+ * sp_fill() - Append SP_RECS records to a closed mlog
+ */
+static
+mpool_err_t
+sp_fill(
+	struct sp_test     *t,
+	struct mpool_mlog  *mlh,
+	u64                 objid)
+{
+	mpool_err_t err, err2;
+	u64         gen;
+	int         i;
+
+	err = mpool_mlog_open(t->st_ds, mlh, 0, &gen);
+	if (err)
+		return err;
+
+	for (i = 0; i < SP_RECS && !err; i++) {
+		memset(t->st_buf, (int)(objid + i), sizeof(t->st_buf));
+		err = mpool_mlog_append_data(t->st_ds, mlh, t->st_buf,
+					     sizeof(t->st_buf),
+					     i + 1 == SP_RECS);
+	}
+
+	err2 = mpool_mlog_close(t->st_ds, mlh);
+
+	return err ?: err2;
+}
+
+/**
+ * sp_empty() - Find out whether a committed mlog is empty
+ */
+static
+mpool_err_t
+sp_empty(
+	struct sp_test     *t,
+	struct mpool_mlog  *mlh,
+	bool               *empty)
+{
+	mpool_err_t err, err2;
+	u64         gen;
+
+	err = mpool_mlog_open(t->st_ds, mlh, 0, &gen);
+	if (err)
+		return err;
+
+	err = mpool_mlog_empty(t->st_ds, mlh, empty);
+	err2 = mpool_mlog_close(t->st_ds, mlh);
+
+	return err ?: err2;
+}
+
+/**
+ * sp_check() - Check that mlog "objid" exists and is empty or not
+ *
+ * Must not be used on a pool member unless the worker is idle.
+ */
+static
+int
+sp_check(
+	struct sp_test *t,
+	u64             objid,
+	bool            want_empty)
+{
+	struct mlog_props   props;
+	struct mpool_mlog  *mlh;
+	mpool_err_t         err;
+	bool                empty = false;
+
+	err = mpool_mlog_find_get(t->st_ds, objid, &props, &mlh);
+	if (!err) {
+		err = sp_empty(t, mlh, &empty);
+		mpool_mlog_put(t->st_ds, mlh);
+	}
+
+	if (err || empty != want_empty) {
+		fprintf(stderr, "%s: mlog 0x%lx: err %d, %s, expected %s\n",
+			t->st_test, (ulong)objid, mpool_errno(err),
+			empty ? "empty" : "not empty",
+			want_empty ? "empty" : "not empty");
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * sp_take() - Get an mlog from the pool, which must be committed and empty
+ * and must not be one of the kept mlogs
+ */
+static
+mpool_err_t
+sp_take(
+	struct sp_test     *t,
+	struct mpool_mlog **mlh,
+	u64                *objid)
+{
+	struct mlog_props   props;
+	mpool_err_t         err;
+	bool                empty = false;
+	u32                 i;
+
+	err = mpool_mlspare_get(t->st_sp, &props, mlh);
+	if (err) {
+		mpft_err(t->st_test, "mpool_mlspare_get", err);
+		return err;
+	}
+
+	*objid = props.lpr_objid;
+
+	for (i = 0; i < t->st_keptc; i++) {
+		if (t->st_kept[i] == *objid) {
+			fprintf(stderr, "%s: kept mlog 0x%lx handed out\n",
+				t->st_test, (ulong)*objid);
+			return merr(EEXIST);
+		}
+	}
+
+	err = sp_empty(t, *mlh, &empty);
+	if (!err && !empty) {
+		fprintf(stderr, "%s: spare mlog 0x%lx not empty\n",
+			t->st_test, (ulong)*objid);
+		err = merr(ENOTEMPTY);
+	}
+
+	return err;
+}
+
+/**
+ * sp_keep() - Record that an mlog taken from the pool, filled and closed,
+ * stays with the test
+ */
+static
+mpool_err_t
+sp_keep(
+	struct sp_test     *t,
+	struct mpool_mlog  *mlh,
+	u64                 objid)
+{
+	if (t->st_keptc == SP_KEPT_MAX)
+		return merr(ENOSPC);
+
+	t->st_kept[t->st_keptc++] = objid;
+	mpool_mlog_put(t->st_ds, mlh);
+
+	return 0;
+}
+
+/**
+ * sp_verify_kept() - Check that the pool left every kept mlog alone
+ */
+static
+int
+sp_verify_kept(
+	struct sp_test *t)
+{
+	int bad = 0;
+	u32 i;
+
+	for (i = 0; i < t->st_keptc; i++)
+		bad += sp_check(t, t->st_kept[i], false);
+
+	return bad;
+}
+
+/**
+ * sp_reopen() - Close and replay the pool, which must come back with the
+ * same members
+ * @usage: MDC usage while the pool is closed (output), or NULL
+ */
+static
+mpool_err_t
+sp_reopen(
+	struct sp_test *t,
+	size_t         *usage)
+{
+	mpool_err_t err;
+	u32         before, after;
+
+	err = sp_wait(t, &before);
+	if (!err)
+		err = sp_close(t);
+	if (err)
+		return err;
+
+	if (usage) {
+		err = mpft_mdc_usage(t->st_ds, t->st_oid, usage);
+		if (err) {
+			mpft_err(t->st_test, "mdc usage", err);
+			return err;
+		}
+	}
+
+	err = sp_open(t);
+	if (!err)
+		err = sp_wait(t, &after);
+	if (err)
+		return err;
+
+	if (after != before) {
+		fprintf(stderr, "%s: %u members after replay, expected %u\n",
+			t->st_test, after, before);
+		return merr(EINVAL);
+	}
+
+	return sp_verify_kept(t) ? merr(EINVAL) : 0;
+}
+
+/**
+ * sp_start() - Parse parameters, open the mpool, create the pool MDC and
+ * open the pool
+ */
+static
+mpool_err_t
+sp_start(
+	struct sp_test *t,
+	int             argc,
+	char          **argv)
+{
+	mpool_err_t err;
+
+	memset(t, 0, sizeof(*t));
+	t->st_test = argv[0];
+
+	err = mpft_mdc_start(t->st_test, argc, argv, sp_params, sp_mpool,
+			     SP_MDC_CAPTGT, &t->st_ds, t->st_oid);
+	if (err)
+		return err;
+
+	if (sp_target == 0 || sp_target * 2 > SP_KEPT_MAX ||
+	    sp_cycles == 0 || sp_captgt == 0) {
+		fprintf(stderr, "%s: target must be 1 to %u, cycles and "
+			"captgt non-zero\n", t->st_test, SP_KEPT_MAX / 2);
+		mpft_mdc_finish(t->st_ds, t->st_oid);
+		return merr(EINVAL);
+	}
+
+	t->st_prm.msp_captgt = sp_captgt;
+	t->st_prm.msp_target = sp_target;
+	t->st_prm.msp_mclassp = MP_MED_CAPACITY;
+
+	err = sp_open(t);
+	if (err)
+		mpft_mdc_finish(t->st_ds, t->st_oid);
+
+	return err;
+}
+
+static
+void
+sp_finish(
+	struct sp_test *t)
+{
+	struct mlog_props   props;
+	struct mpool_mlog  *mlh;
+	u32                 i;
+
+	if (t->st_sp)
+		mpool_mlspare_close(t->st_sp);
+
+	for (i = 0; i < t->st_keptc; i++) {
+		if (mpool_mlog_find_get(t->st_ds, t->st_kept[i], &props, &mlh))
+			continue;
+
+		if (mpool_mlog_delete(t->st_ds, mlh))
+			mpool_mlog_put(t->st_ds, mlh);
+	}
+
+	mpft_mdc_finish(t->st_ds, t->st_oid);
+}
+
+/**
+ *
+ * Replay
+ *
+ */
+
+/**
+ * The replay test takes more mlogs than the pool holds, fills them, keeps
+ * half and retires the rest.  Retired mlogs must be erased and kept mlogs
+ * left alone, also after the members are replayed from the MDC.  It also
+ * covers the error paths.
+ */
+static
+void
+sp_correctness_replay_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft mlspare.correctness.replay [options]\n");
+	show_default_params(sp_params, 0);
+}
+
+static
+mpool_err_t
+sp_correctness_replay(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_mlog  *mlhv[SP_KEPT_MAX];
+	struct mlog_props   props;
+	struct sp_test      t;
+	mpool_err_t         err;
+	u64                 objidv[SP_KEPT_MAX];
+	u32                 i, j, n, members;
+
+	err = sp_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	if (mpool_errno(mpool_mlspare_get(t.st_sp, NULL, &mlhv[0])) != EINVAL ||
+	    mpool_errno(mpool_mlspare_retire(t.st_sp, NULL)) != EINVAL ||
+	    mpool_errno(mpool_mlspare_getprops(t.st_sp, NULL)) != EINVAL) {
+		fprintf(stderr, "%s: NULL argument accepted\n", t.st_test);
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	err = sp_wait(&t, &members);
+	if (err)
+		goto out;
+
+	/* Take more than the pool holds, some come from inline allocation */
+	n = sp_target * 2;
+
+	for (i = 0; i < n; i++) {
+		err = sp_take(&t, &mlhv[i], &objidv[i]);
+		if (!err)
+			err = sp_fill(&t, mlhv[i], objidv[i]);
+		if (err)
+			goto out;
+
+		for (j = 0; j < i; j++) {
+			if (objidv[j] == objidv[i]) {
+				fprintf(stderr, "%s: mlog 0x%lx handed out "
+					"twice\n", t.st_test, (ulong)objidv[i]);
+				err = merr(EEXIST);
+				goto out;
+			}
+		}
+	}
+
+	for (i = 0; i < n && !err; i++) {
+		if (i % 2)
+			err = sp_keep(&t, mlhv[i], objidv[i]);
+		else
+			err = mpool_mlspare_retire(t.st_sp, mlhv[i]);
+	}
+	if (err) {
+		mpft_err(t.st_test, "retire", err);
+		goto out;
+	}
+
+	/* The pool owns a retired mlog, which it must not take twice */
+	err = mpool_mlog_find_get(t.st_ds, objidv[0], &props, &mlhv[0]);
+	if (!err) {
+		err = mpool_mlspare_retire(t.st_sp, mlhv[0]);
+		if (mpool_errno(err) == EEXIST)
+			err = 0;
+		else
+			fprintf(stderr, "%s: second retire: %d\n",
+				t.st_test, mpool_errno(err));
+		mpool_mlog_put(t.st_ds, mlhv[0]);
+	}
+	if (err)
+		goto out;
+
+	err = sp_wait(&t, &members);
+	if (err)
+		goto out;
+
+	for (i = 0; i < n; i++) {
+		if (sp_check(&t, objidv[i], i % 2 == 0)) {
+			err = merr(EINVAL);
+			goto out;
+		}
+	}
+
+	err = sp_reopen(&t, NULL);
+
+	/* Empty the pool through the replayed handle and refill it */
+	for (i = 0; i < n && !err; i++) {
+		err = sp_take(&t, &mlhv[i], &objidv[i]);
+		if (!err)
+			err = mpool_mlspare_retire(t.st_sp, mlhv[i]);
+	}
+	if (!err)
+		err = sp_reopen(&t, NULL);
+
+out:
+	sp_finish(&t);
+
+	return err;
+}
+
+/**
+ *
+ * Compaction
+ *
+ */
+
+/**
+ * The compaction test cycles mlogs through the pool until the pool has
+ * compacted its MDC at least twice, which shows up as a drop in the MDC
+ * usage.  Every mlog handed out must be empty, and the members must be
+ * replayed correctly from each compacted MDC.  Mlogs are taken a pool's
+ * worth at a time, and the pool refilled in between, so that gets do not
+ * fall back to allocating mlogs that would then grow the pool.
+ */
+static
+void
+sp_correctness_compaction_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft mlspare.correctness.compaction [options]\n");
+	show_default_params(sp_params, 0);
+}
+
+static
+mpool_err_t
+sp_correctness_compaction(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_mlog  *mlhv[SP_KEPT_MAX];
+	struct sp_test      t;
+	mpool_err_t         err;
+	size_t              usage, prev = 0;
+	u64                 objid;
+	u32                 i, j, chunk, members, compactions = 0;
+
+	err = sp_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	for (chunk = 0; compactions < 2; chunk++) {
+		if (chunk == 256) {
+			fprintf(stderr, "%s: no MDC compaction after %u "
+				"cycles\n", t.st_test, chunk * sp_cycles);
+			err = merr(EINVAL);
+			goto out;
+		}
+
+		for (i = 0; i < sp_cycles; i += sp_target) {
+			for (j = 0; j < sp_target && !err; j++) {
+				err = sp_take(&t, &mlhv[j], &objid);
+				if (!err)
+					err = sp_fill(&t, mlhv[j], objid);
+			}
+
+			while (j-- > 0)
+				mpool_mlspare_retire(t.st_sp, mlhv[j]);
+
+			if (!err)
+				err = sp_wait(&t, &members);
+			if (err) {
+				mpft_err(t.st_test, "cycle", err);
+				goto out;
+			}
+		}
+
+		err = sp_reopen(&t, &usage);
+		if (err)
+			goto out;
+
+		if (usage < prev)
+			compactions++;
+		prev = usage;
+	}
+
+	err = sp_reopen(&t, NULL);
+
+out:
+	sp_finish(&t);
+
+	return err;
+}
+
+/**
+ *
+ * Crash
+ *
+ */
+
+/**
+ * The crash test forks a child that opens its own mpool handle and pool,
+ * takes and fills mlogs, keeps some and retires the rest, and exits
+ * without closing anything.  The child reports each completed step over
+ * a pipe.  After recovery the parent expects the pool to erase the mlogs
+ * last retired, to leave the kept ones alone and never to hand them out.
+ */
+static
+void
+sp_correctness_crash_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft mlspare.correctness.crash [options]\n");
+	show_default_params(sp_params, 0);
+}
+
+/**
+ * struct sp_crash - what the crash test learns from its child
+ * @sc_t:    test
+ * @sc_retv: mlogs the child retired last
+ * @sc_retc: number of entries in @sc_retv
+ */
+struct sp_crash {
+	struct sp_test *sc_t;
+	u64             sc_retv[SP_KEPT_MAX * 2];
+	u32             sc_retc;
+};
+
+static
+mpool_err_t
+sp_crash_child(
+	void   *arg,
+	int     fd)
+{
+	struct sp_crash    *c = arg;
+	struct sp_test     *t = c->sc_t;
+	struct mpool_mlog  *mlh;
+	mpool_err_t         err;
+	u64                 objid, msg;
+	u32                 i, members, kept = 0;
+
+	err = mpool_open(sp_mpool, O_RDWR, &t->st_ds, NULL);
+	if (!err)
+		err = sp_open(t);
+
+	/* Take only ready spares, so that every mlog went through the pool */
+	for (i = 0; !err && kept < sp_target * 2; i++) {
+		err = sp_wait(t, &members);
+		if (!err)
+			err = sp_take(t, &mlh, &objid);
+		if (!err)
+			err = sp_fill(t, mlh, objid);
+		if (err)
+			break;
+
+		if (i % 3 == 2) {
+			err = sp_keep(t, mlh, objid);
+			kept++;
+			msg = objid;
+		} else {
+			err = mpool_mlspare_retire(t->st_sp, mlh);
+			msg = objid | SP_RETIRED;
+		}
+
+		if (!err)
+			err = mpft_report(fd, &msg, sizeof(msg));
+	}
+
+	return err;
+}
+
+/**
+ * sp_crash_report() - Track the mlogs the child kept and last retired
+ *
+ * A retired mlog may be taken and kept again later on.
+ */
+static
+void
+sp_crash_report(
+	void       *arg,
+	const void *msgp)
+{
+	struct sp_crash    *c = arg;
+	struct sp_test     *t = c->sc_t;
+	u64                 msg = *(const u64 *)msgp;
+	u64                 objid = msg & ~SP_RETIRED;
+	u32                 j;
+
+	for (j = 0; j < c->sc_retc && c->sc_retv[j] != objid; j++)
+		;
+	if (j < c->sc_retc)
+		c->sc_retv[j] = c->sc_retv[--c->sc_retc];
+
+	if (!(msg & SP_RETIRED))
+		t->st_kept[t->st_keptc++] = objid;
+	else if (c->sc_retc < SP_KEPT_MAX * 2)
+		c->sc_retv[c->sc_retc++] = objid;
+}
+
+static
+mpool_err_t
+sp_correctness_crash(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_mlog  *mlh;
+	struct sp_crash     c;
+	struct sp_test      t;
+	mpool_err_t         err;
+	u64                 objid;
+	u32                 i, members;
+
+	err = sp_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	memset(&c, 0, sizeof(c));
+	c.sc_t = &t;
+
+	/* The child opens its own handles */
+	err = sp_wait(&t, &members);
+	if (!err)
+		err = sp_close(&t);
+	if (err)
+		goto out;
+
+	err = mpft_crash(t.st_test, sp_crash_child, sp_crash_report, &c,
+			 sizeof(u64));
+	if (err)
+		goto out;
+
+	err = sp_open(&t);
+	if (!err)
+		err = sp_wait(&t, &members);
+	if (err)
+		goto out;
+
+	if (sp_verify_kept(&t)) {
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	for (i = 0; i < c.sc_retc; i++) {
+		if (sp_check(&t, c.sc_retv[i], true)) {
+			err = merr(EINVAL);
+			goto out;
+		}
+	}
+
+	/* Cycle the whole pool through the recovered handle */
+	for (i = 0; i < members + c.sc_retc && !err; i++) {
+		err = sp_take(&t, &mlh, &objid);
+		if (!err)
+			err = sp_fill(&t, mlh, objid);
+		if (!err)
+			err = mpool_mlspare_retire(t.st_sp, mlh);
+	}
+	if (!err)
+		err = sp_reopen(&t, NULL);
+
+out:
+	sp_finish(&t);
+
+	return err;
+}
+
+struct test_s sp_tests[] = {
+	{ "replay", MPFT_TEST_TYPE_CORRECTNESS, sp_correctness_replay,
+		sp_correctness_replay_help },
+	{ "compaction", MPFT_TEST_TYPE_CORRECTNESS, sp_correctness_compaction,
+		sp_correctness_compaction_help },
+	{ "crash", MPFT_TEST_TYPE_CORRECTNESS, sp_correctness_crash,
+		sp_correctness_crash_help },
+	{ NULL, MPFT_TEST_TYPE_INVALID, NULL, NULL },
+};
+
+void
+sp_help(void)
+{
+	int i = 0;
+
+	fprintf(co.co_fp,
+		"\nmlspare tests validate the behavior of spare mlog pools\n");
+
+	fprintf(co.co_fp, "Available tests include:\n");
+	while (sp_tests[i].test_name) {
+		fprintf(co.co_fp, "\t%s\n", sp_tests[i].test_name);
+		i++;
+	}
+}
+
+struct group_s mpft_mlspare = {
+	.group_name = "mlspare",
+	.group_test = sp_tests,
+	.group_help = sp_help,
+};
@@ -0,0 +1,615 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+/**
+ * This file implements multi-process tests that are to be run in the mpft
+ * (MPool Functional Test) framework.
+ *
+ * Available tests:
+ * * scale - measure how a workload scales with the number of processes
+ *   - required parameters:
+ *     - mpool (mp)
+ *   - options:
+ *     - workload (wl), one of mblock, mlog or mcache, default: mblock
+ *     - process count (procs), default: 1
+ *     - operations per process (ops), default: 1000
+ *     - record size (rs), default: 4K
+ *
+ *     Description: Fork procs processes.  Each opens the mpool on its own,
+ *       so that it has its own mpool handle, file descriptor and mlog map,
+ *       and sets up its workload.  All processes then start together at a
+ *       process-shared start line and run ops operations each:
+ *
+ *       mblock - alloc, write rs bytes and commit an mblock
+ *       mlog   - append a record of rs bytes to a private mlog, synchronously
+ *       mcache - look up and touch a random page of a private mcache map
+ *
+ *       Each process records its throughput and a histogram of operation
+ *       latencies in memory shared with the parent, which reports the
+ *       aggregate throughput and latency percentiles across processes.
+ *       Running the test with increasing procs shows how contention on the
+ *       control device and in the kernel scales with the process count.
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <util/platform.h>
+#include <util/parse_num.h>
+#include <util/page.h>
+#include <util/minmax.h>
+#include <util/param.h>
+#include <mpool/mpool.h>
+
+#include "mpft.h"
+
+#define merr(_errnum)   (_errnum)
+
+#define MPROC_PROCS_MAX         (256)
+#define MPROC_MLOG_CAP          (64 << 20)
+
+/*
+ * Log-linear latency histogram in nanoseconds: values below 8 have their
+ * own bucket, above that each power of two is split into 8 buckets.
+ */
+#define MPROC_HIST_SUB          (8)
+#define MPROC_HIST_SHIFT        (3)
+#define MPROC_HIST_BKTS         (MPROC_HIST_SUB * 62)
+
+static char   mproc_scale_mpool[MPOOL_NAME_LEN_MAX];
+static char   mproc_scale_wl[16] = "mblock";
+static u32    mproc_scale_procs = 1;
+static u32    mproc_scale_ops = 1000;
+static u32    mproc_scale_rs = 4096;
+
+static
+struct param_inst mproc_scale_params[] = {
+	PARAM_INST_STRING(mproc_scale_mpool,
+		sizeof(mproc_scale_mpool), "mp", "mpool"),
+	PARAM_INST_STRING(mproc_scale_wl,
+		sizeof(mproc_scale_wl), "wl", "workload: mblock, mlog, mcache"),
+	PARAM_INST_U32(mproc_scale_procs, "procs", "number of processes"),
+	PARAM_INST_U32(mproc_scale_ops, "ops", "operations per process"),
+	PARAM_INST_U32_SIZE(mproc_scale_rs, "rs", "record size"),
+	PARAM_INST_END
+};
+
+enum mproc_wl {
+	MPROC_WL_MBLOCK,
+	MPROC_WL_MLOG,
+	MPROC_WL_MCACHE,
+};
+
+/**
+ * struct mproc_result - what a process reports, in shared memory
+ * @mr_err:   error, 0 on success
+ * @mr_ops:   operations completed
+ * @mr_bytes: bytes transferred
+ * @mr_nsec:  time from the start barrier to the last operation
+ * @mr_hist:  operation latency histogram
+ */
+struct mproc_result {
+	mpool_err_t mr_err;
+	u64         mr_ops;
+	u64         mr_bytes;
+	u64         mr_nsec;
+	u64         mr_hist[MPROC_HIST_BKTS];
+};
+
+/**
+ * struct mproc_shared - memory shared by the parent and its children
+ * @ms_lock:  protects @ms_ready and @ms_start
+ * @ms_cv:    signaled when @ms_ready or @ms_start changes
+ * @ms_ready: children done with their setup
+ * @ms_start: 0 until the parent releases the children, then 1 to run or
+ *            -1 to abort
+ * @ms_resv:  per process results
+ *
+ * The start line works like a barrier whose count the parent learns
+ * once it is done forking, so that it can release and abort the children
+ * it did start if a fork fails.
+ */
+struct mproc_shared {
+	pthread_mutex_t      ms_lock;
+	pthread_cond_t       ms_cv;
+	u32                  ms_ready;
+	int                  ms_start;
+	struct mproc_result  ms_resv[];
+};
+
+static
+void
+mproc_scale_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft mproc.perf.scale [options]\n");
+	fprintf(co.co_fp,
+		"e.g.: mpft mproc.perf.scale mp=mp1 wl=mlog procs=8\n");
+	fprintf(co.co_fp,
+		"\nmproc.perf.scale runs the same workload (wl) in several "
+		"processes (procs) and reports aggregate throughput and "
+		"latency percentiles\n");
+
+	show_default_params(mproc_scale_params, 0);
+}
+
+static inline
+u64
+mproc_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+static
+uint
+mproc_hist_idx(
+	u64 nsec)
+{
+	uint shift;
+
+	if (nsec < MPROC_HIST_SUB)
+		return nsec;
+
+	shift = 63 - __builtin_clzl(nsec) - MPROC_HIST_SHIFT;
+
+	return min_t(uint, (shift + 1) * MPROC_HIST_SUB +
+		     ((nsec >> shift) & (MPROC_HIST_SUB - 1)),
+		     MPROC_HIST_BKTS - 1);
+}
+
+/* Upper bound of the values counted in a bucket */
+static
+u64
+mproc_hist_val(
+	uint idx)
+{
+	uint shift;
+
+	if (idx < MPROC_HIST_SUB)
+		return idx;
+
+	shift = idx / MPROC_HIST_SUB - 1;
+
+	return ((u64)(MPROC_HIST_SUB + idx % MPROC_HIST_SUB + 1) << shift) - 1;
+}
+
+static
+u64
+mproc_hist_pct(
+	const u64  *hist,
+	u64         count,
+	double      pct)
+{
+	u64  want, seen = 0;
+	uint i;
+
+	want = count * pct / 100;
+	if (want == 0)
+		want = 1;
+
+	for (i = 0; i < MPROC_HIST_BKTS; i++) {
+		seen += hist[i];
+		if (seen >= want)
+			return mproc_hist_val(i);
+	}
+
+	return mproc_hist_val(MPROC_HIST_BKTS - 1);
+}
+
+/**
+ * mproc_start_wait() - Wait at the start line in a child
+ *
+ * Return: true to run, false to abort
+ */
+static
+bool
+mproc_start_wait(
+	struct mproc_shared    *sh)
+{
+	int start;
+
+	pthread_mutex_lock(&sh->ms_lock);
+	sh->ms_ready++;
+	pthread_cond_broadcast(&sh->ms_cv);
+
+	while (!sh->ms_start)
+		pthread_cond_wait(&sh->ms_cv, &sh->ms_lock);
+	start = sh->ms_start;
+	pthread_mutex_unlock(&sh->ms_lock);
+
+	return start > 0;
+}
+
+/**
+ * mproc_start() - Release the children from the start line
+ * @sh:      shared memory
+ * @started: number of children
+ * @run:     whether the children run or abort
+ */
+static
+void
+mproc_start(
+	struct mproc_shared    *sh,
+	u32                     started,
+	bool                    run)
+{
+	pthread_mutex_lock(&sh->ms_lock);
+	while (sh->ms_ready < started)
+		pthread_cond_wait(&sh->ms_cv, &sh->ms_lock);
+
+	sh->ms_start = run ? 1 : -1;
+	pthread_cond_broadcast(&sh->ms_cv);
+	pthread_mutex_unlock(&sh->ms_lock);
+}
+
+/**
+ * mproc_worker() - Body of a child process
+ *
+ * Set up, wait at the start line with everybody else, run, report.  The
+ * setup and teardown are not timed.  If the parent aborts the run, only
+ * the teardown is done.
+ */
+static
+mpool_err_t
+mproc_worker(
+	struct mproc_shared    *sh,
+	struct mproc_result    *res,
+	enum mproc_wl           wl)
+{
+	struct mpool_mcache_map    *map = NULL;
+	struct mlog_capacity        cap;
+	struct mblock_props         mbprops;
+	struct mlog_props           lprops;
+	struct mpool_mlog          *mlh = NULL;
+	struct mpool               *ds = NULL;
+	struct iovec                iov;
+
+	mpool_err_t err, err2;
+	u64    *mbidv = NULL;
+	u64     start, t0, t1, gen, mbid = 0;
+	size_t  npages = 0, pgnum;
+	char   *buf = NULL;
+	void   *page;
+	u32     i;
+	int     rc;
+
+	err = mpool_open(mproc_scale_mpool, O_RDWR, &ds, NULL);
+	if (err)
+		goto start;
+
+	rc = posix_memalign((void **)&buf, PAGE_SIZE, mproc_scale_rs);
+	if (rc) {
+		err = merr(rc);
+		goto start;
+	}
+	memset(buf, 42, mproc_scale_rs);
+
+	iov.iov_base = buf;
+	iov.iov_len = mproc_scale_rs;
+
+	if (wl == MPROC_WL_MBLOCK) {
+		mbidv = calloc(mproc_scale_ops, sizeof(*mbidv));
+		if (!mbidv)
+			err = merr(ENOMEM);
+
+	} else if (wl == MPROC_WL_MLOG) {
+		memset(&cap, 0, sizeof(cap));
+		cap.lcp_captgt = MPROC_MLOG_CAP;
+
+		err = mpool_mlog_alloc(ds, &cap, MP_MED_CAPACITY, &lprops,
+				       &mlh);
+		if (!err) {
+			err = mpool_mlog_commit(ds, mlh);
+			if (err) {
+				mpool_mlog_abort(ds, mlh);
+				mlh = NULL;
+			}
+		}
+		if (!err)
+			err = mpool_mlog_open(ds, mlh, 0, &gen);
+
+	} else {
+		err = mpool_mblock_alloc(ds, MP_MED_CAPACITY, false, &mbid,
+					 &mbprops);
+		if (!err) {
+			/* Fill the mblock one record at a time */
+			npages = mbprops.mpr_alloc_cap / mproc_scale_rs;
+			for (i = 0; !err && i < npages; i++)
+				err = mpool_mblock_write(ds, mbid, &iov, 1);
+			if (!err)
+				err = mpool_mblock_commit(ds, mbid);
+			if (!err)
+				err = mpool_mcache_mmap(ds, 1, &mbid,
+							MPC_VMA_COLD, &map);
+			npages = npages * mproc_scale_rs / PAGE_SIZE;
+		}
+	}
+
+start:
+	/* Everybody gets to the start line, failed or not */
+	if (!mproc_start_wait(sh) && !err)
+		err = merr(ECANCELED);
+
+	if (err)
+		goto errout;
+
+	srand(getpid());
+
+	start = mproc_now();
+
+	for (i = 0; i < mproc_scale_ops; i++) {
+		t0 = mproc_now();
+
+		switch (wl) {
+		case MPROC_WL_MBLOCK:
+			err = mpool_mblock_alloc(ds, MP_MED_CAPACITY, false,
+						 &mbidv[i], &mbprops);
+			if (err)
+				break;
+
+			err = mpool_mblock_write(ds, mbidv[i], &iov, 1);
+			if (!err)
+				err = mpool_mblock_commit(ds, mbidv[i]);
+			if (err) {
+				mpool_mblock_abort(ds, mbidv[i]);
+				mbidv[i] = 0;
+			}
+			break;
+
+		case MPROC_WL_MLOG:
+			err = mpool_mlog_append_data(ds, mlh, buf,
+						     mproc_scale_rs, 1);
+			if (mpool_errno(err) == EFBIG) {
+				/* Full, start over */
+				err = mpool_mlog_erase(ds, mlh, 0);
+				if (!err)
+					err = mpool_mlog_append_data(
+						ds, mlh, buf,
+						mproc_scale_rs, 1);
+			}
+			break;
+
+		case MPROC_WL_MCACHE:
+			pgnum = rand() % npages;
+			err = mpool_mcache_getpages(map, 1, 0, &pgnum, &page);
+			if (!err && *(volatile char *)page != 42)
+				err = merr(EIO);
+			break;
+		}
+
+		if (err)
+			break;
+
+		t1 = mproc_now();
+		res->mr_hist[mproc_hist_idx(t1 - t0)]++;
+		res->mr_ops++;
+		res->mr_nsec = t1 - start;
+	}
+
+	res->mr_bytes = res->mr_ops *
+		(wl == MPROC_WL_MCACHE ? PAGE_SIZE : mproc_scale_rs);
+
+errout:
+	if (mbidv) {
+		for (i = 0; i < mproc_scale_ops; i++) {
+			if (mbidv[i])
+				mpool_mblock_delete(ds, mbidv[i]);
+		}
+		free(mbidv);
+	}
+
+	if (mlh) {
+		mpool_mlog_close(ds, mlh);
+		if (mpool_mlog_delete(ds, mlh))
+			mpool_mlog_put(ds, mlh);
+	}
+
+	if (map)
+		mpool_mcache_munmap(map);
+	if (mbid)
+		mpool_mblock_delete(ds, mbid);
+
+	free(buf);
+
+	if (ds) {
+		err2 = mpool_close(ds);
+		if (!err)
+			err = err2;
+	}
+
+	return err;
+}
+
+static
+mpool_err_t
+mproc_scale(
+	int     argc,
+	char  **argv)
+{
+	pthread_mutexattr_t     mattr;
+	pthread_condattr_t      cattr;
+	struct mproc_shared    *sh;
+	struct mproc_result    *res;
+	enum mproc_wl           wl;
+
+	mpool_err_t err = 0;
+	char   *test_name = argv[0];
+	char    err_str[256];
+	int     next_arg = 0;
+	pid_t  *pidv;
+	size_t  shsz;
+	u64    *hist;
+	u64     ops = 0, bytes = 0, nsec = 0;
+	u64     minops = U64_MAX, maxops = 0;
+	u32     procs, started, i, j;
+	int     status;
+
+	err = process_params(argc, argv, mproc_scale_params, &next_arg, 0);
+	if (err != 0) {
+		printf("%s process_params returned an error\n", test_name);
+		return err;
+	}
+
+	if (mproc_scale_mpool[0] == 0) {
+		fprintf(stderr, "%s: mpool (mp=<mpool>) must be specified\n",
+			test_name);
+		return merr(EINVAL);
+	}
+
+	if (!strcmp(mproc_scale_wl, "mblock")) {
+		wl = MPROC_WL_MBLOCK;
+	} else if (!strcmp(mproc_scale_wl, "mlog")) {
+		wl = MPROC_WL_MLOG;
+	} else if (!strcmp(mproc_scale_wl, "mcache")) {
+		wl = MPROC_WL_MCACHE;
+	} else {
+		fprintf(stderr, "%s: unknown workload %s\n",
+			test_name, mproc_scale_wl);
+		return merr(EINVAL);
+	}
+
+	procs = mproc_scale_procs;
+	if (procs < 1 || procs > MPROC_PROCS_MAX || mproc_scale_ops < 1 ||
+	    mproc_scale_rs < PAGE_SIZE || mproc_scale_rs % PAGE_SIZE) {
+		fprintf(stderr,
+			"%s: procs must be 1..%d, ops at least 1, and rs a "
+			"multiple of %lu\n",
+			test_name, MPROC_PROCS_MAX, PAGE_SIZE);
+		return merr(EINVAL);
+	}
+
+	shsz = sizeof(*sh) + procs * sizeof(sh->ms_resv[0]);
+
+	sh = mmap(NULL, shsz, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (sh == MAP_FAILED)
+		return merr(errno);
+
+	pidv = calloc(procs, sizeof(*pidv));
+	hist = calloc(MPROC_HIST_BKTS, sizeof(*hist));
+	if (!pidv || !hist) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+	pthread_mutex_init(&sh->ms_lock, &mattr);
+	pthread_mutexattr_destroy(&mattr);
+
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+	pthread_cond_init(&sh->ms_cv, &cattr);
+	pthread_condattr_destroy(&cattr);
+
+	fflush(stdout);
+	fflush(stderr);
+
+	for (started = 0; started < procs; started++) {
+		pidv[started] = fork();
+		if (pidv[started] == -1) {
+			err = merr(errno);
+			break;
+		}
+
+		if (pidv[started] == 0) {
+			res = sh->ms_resv + started;
+			res->mr_err = mproc_worker(sh, res, wl);
+			_exit(res->mr_err ? 1 : 0);
+		}
+	}
+
+	/* If a process failed to start, have the others clean up and exit */
+	if (started < procs)
+		fprintf(stderr, "%s: only %u of %u processes started\n",
+			test_name, started, procs);
+
+	mproc_start(sh, started, started == procs);
+
+	for (i = 0; i < started; i++) {
+		waitpid(pidv[i], &status, 0);
+
+		res = sh->ms_resv + i;
+		if (!err && !(WIFEXITED(status) && !WEXITSTATUS(status))) {
+			err = res->mr_err ?: merr(EIO);
+			fprintf(stderr, "%s: process %u failed: %s\n",
+				test_name, i,
+				mpool_strinfo(err, err_str, sizeof(err_str)));
+		}
+	}
+
+	pthread_cond_destroy(&sh->ms_cv);
+	pthread_mutex_destroy(&sh->ms_lock);
+
+	if (err)
+		goto errout;
+
+	for (i = 0; i < procs; i++) {
+		res = sh->ms_resv + i;
+
+		ops += res->mr_ops;
+		bytes += res->mr_bytes;
+		nsec = max_t(u64, nsec, res->mr_nsec);
+		minops = min_t(u64, minops, res->mr_ops * 1000000000ul /
+			       max_t(u64, res->mr_nsec, 1));
+		maxops = max_t(u64, maxops, res->mr_ops * 1000000000ul /
+			       max_t(u64, res->mr_nsec, 1));
+
+		for (j = 0; j < MPROC_HIST_BKTS; j++)
+			hist[j] += res->mr_hist[j];
+	}
+
+	nsec = max_t(u64, nsec, 1);
+
+	printf("%s: %s, %u processes, %lu ops, %lu bytes in %lu usecs\n",
+	       test_name, mproc_scale_wl, procs, (ulong)ops, (ulong)bytes,
+	       (ulong)(nsec / 1000));
+	printf("%s: aggregate %lu ops/s, %4.2f MB/s; "
+	       "per process %lu..%lu ops/s\n",
+	       test_name, (ulong)(ops * 1000000000ul / nsec),
+	       (double)bytes * 1000 / nsec, (ulong)minops, (ulong)maxops);
+	printf("%s: latency usecs p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f "
+	       "max %.1f\n", test_name,
+	       mproc_hist_pct(hist, ops, 50) / 1000.0,
+	       mproc_hist_pct(hist, ops, 90) / 1000.0,
+	       mproc_hist_pct(hist, ops, 99) / 1000.0,
+	       mproc_hist_pct(hist, ops, 99.9) / 1000.0,
+	       mproc_hist_pct(hist, ops, 100) / 1000.0);
+
+errout:
+	free(hist);
+	free(pidv);
+	munmap(sh, shsz);
+
+	return err;
+}
+
+struct test_s mproc_tests[] = {
+	{ "scale",  MPFT_TEST_TYPE_PERF, mproc_scale, mproc_scale_help },
+	{ NULL,  MPFT_TEST_TYPE_INVALID, NULL, NULL },
+};
+
+void
+mproc_help(void)
+{
+	fprintf(co.co_fp,
+		"\nmproc tests measure how workloads scale across processes\n");
+}
+
+struct group_s mpft_mproc = {
+	.group_name = "mproc",
+	.group_test = mproc_tests,
+	.group_help = mproc_help,
+};
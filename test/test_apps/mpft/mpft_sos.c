@@ -0,0 +1,824 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <util/platform.h>
+#include <util/param.h>
+#include <mpool/mpool.h>
+
+#include "mpft.h"
+#include "mpft_sos.h"
+#include "mpft_thread.h"
+
+#define merr(_errnum)   (_errnum)
+
+#define SOS_MDC_CAPTGT  (4 * 1024 * 1024)
+#define SOS_OBJ_MAX     (2048)
+
+/* Enough sealed segments to grow the segment table a few times */
+#define SOS_RACE_SEGS   (256)
+
+char sos_mpool[MPOOL_NAME_LEN_MAX];
+u32  sos_keys = 1024;
+u32  sos_rounds = 16;
+u32  sos_readers = 4;
+
+static
+struct param_inst sos_params[] = {
+	PARAM_INST_STRING(sos_mpool, sizeof(sos_mpool), "mp", "mpool"),
+	PARAM_INST_U32(sos_keys, "keys", "number of object keys"),
+	PARAM_INST_U32(sos_rounds, "rounds", "number of update rounds"),
+	PARAM_INST_U32(sos_readers, "readers", "number of reader threads"),
+	PARAM_INST_END
+};
+
+static const struct mpool_sos_params sos_test_params = {
+	.sp_mclassp     = MP_MED_CAPACITY,
+	.sp_garbage_pct = 25,
+	.sp_compact_ms  = 0,
+};
+
+/**
+ * struct sos_test - state of one sos test
+ * @st_test: test name
+ * @st_ds:   mpool handle
+ * @st_oid:  store MDC
+ * @st_buf:  object buffer and expected object buffer
+ * @st_verv: model, the current version of each key, 0 if deleted, and a
+ *           second copy for the crash test's unsynced versions
+ */
+struct sos_test {
+	const char     *st_test;
+	struct mpool   *st_ds;
+	u64             st_oid[2];
+	char           *st_buf;
+	u32            *st_verv;
+};
+
+/**
+ * sos_obj_len() - Length of version "ver" of object "key"
+ */
+static
+size_t
+sos_obj_len(
+	u64     key,
+	u32     ver)
+{
+	return (key * 131 + ver * 17) % SOS_OBJ_MAX;
+}
+
+static
+void
+sos_obj_fill(
+	char   *buf,
+	u64     key,
+	u32     ver,
+	size_t  len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (char)(key * 31 + ver * 7 + i);
+}
+
+/**
+ * sos_obj_put() - Put version "ver" of object "key"
+ */
+static
+mpool_err_t
+sos_obj_put(
+	struct mpool_sos   *sos,
+	u64                 key,
+	u32                 ver,
+	char               *buf)
+{
+	size_t len = sos_obj_len(key, ver);
+
+	sos_obj_fill(buf, key, ver, len);
+
+	return mpool_sos_put(sos, key, buf, len);
+}
+
+/**
+ * sos_obj_check() - Verify that object "key" holds version "ver"
+ *
+ * Version 0 means the object must not exist.
+ */
+static
+bool
+sos_obj_check(
+	struct mpool_sos   *sos,
+	u64                 key,
+	u32                 ver,
+	char               *buf,
+	char               *expect)
+{
+	mpool_err_t err;
+	size_t      len, elen;
+
+	err = mpool_sos_get(sos, key, buf, SOS_OBJ_MAX, &len);
+	if (ver == 0)
+		return mpool_errno(err) == ENOENT;
+
+	if (err)
+		return false;
+
+	elen = sos_obj_len(key, ver);
+	sos_obj_fill(expect, key, ver, elen);
+
+	return len == elen && !memcmp(buf, expect, len);
+}
+
+/**
+ * sos_verify() - Verify the contents of the store against the model
+ * @verlo: oldest acceptable version of each key
+ * @verhi: newest acceptable version of each key
+ *
+ * A key passes if it holds either @verlo or @verhi, which lets the crash
+ * test accept updates that may or may not have been made durable.
+ */
+static
+int
+sos_verify(
+	const char         *test,
+	struct mpool_sos   *sos,
+	const u32          *verlo,
+	const u32          *verhi,
+	char               *buf)
+{
+	char *expect = buf + SOS_OBJ_MAX;
+	int   bad = 0;
+	u32   i;
+
+	for (i = 0; i < sos_keys; i++) {
+		if (sos_obj_check(sos, i, verlo[i], buf, expect))
+			continue;
+		if (verhi != verlo &&
+		    sos_obj_check(sos, i, verhi[i], buf, expect))
+			continue;
+
+		if (bad++ < 8)
+			fprintf(stderr, "%s: key %u: expected version %u\n",
+				test, i, verlo[i]);
+	}
+
+	if (bad)
+		fprintf(stderr, "%s: %d of %u keys wrong\n",
+			test, bad, sos_keys);
+
+	return bad;
+}
+
+/**
+ * sos_reopen() - Close the store and replay it from its MDC, which must
+ * bring back the model
+ */
+static
+mpool_err_t
+sos_reopen(
+	struct sos_test    *t,
+	struct mpool_sos  **sos)
+{
+	mpool_err_t err;
+
+	err = mpool_sos_close(*sos);
+	*sos = NULL;
+	if (err) {
+		mpft_err(t->st_test, "mpool_sos_close", err);
+		return err;
+	}
+
+	err = mpool_sos_open(t->st_ds, t->st_oid[0], t->st_oid[1],
+			     &sos_test_params, sos);
+	if (err) {
+		mpft_err(t->st_test, "mpool_sos_open (replay)", err);
+		return err;
+	}
+
+	if (sos_verify(t->st_test, *sos, t->st_verv, t->st_verv, t->st_buf))
+		return merr(EINVAL);
+
+	return 0;
+}
+
+/**
+ * sos_start() - Parse parameters, open the mpool and create the store MDC
+ */
+static
+mpool_err_t
+sos_start(
+	struct sos_test    *t,
+	int                 argc,
+	char              **argv)
+{
+	mpool_err_t err;
+
+	memset(t, 0, sizeof(*t));
+	t->st_test = argv[0];
+
+	err = mpft_mdc_start(t->st_test, argc, argv, sos_params, sos_mpool,
+			     SOS_MDC_CAPTGT, &t->st_ds, t->st_oid);
+	if (err)
+		return err;
+
+	if (sos_keys == 0 || sos_rounds == 0) {
+		fprintf(stderr, "%s: keys and rounds must be non-zero\n",
+			t->st_test);
+		mpft_mdc_finish(t->st_ds, t->st_oid);
+		return merr(EINVAL);
+	}
+
+	t->st_buf = malloc(2 * SOS_OBJ_MAX);
+	t->st_verv = calloc(2 * sos_keys, sizeof(*t->st_verv));
+	if (!t->st_buf || !t->st_verv) {
+		free(t->st_buf);
+		free(t->st_verv);
+		mpft_mdc_finish(t->st_ds, t->st_oid);
+		return merr(ENOMEM);
+	}
+
+	return 0;
+}
+
+/**
+ * sos_finish() - Empty the store so that its segments are freed, then
+ * destroy its MDC and close the mpool
+ */
+static
+void
+sos_finish(
+	struct sos_test    *t)
+{
+	struct mpool_sos   *sos;
+	mpool_err_t         err;
+	u32                 i;
+
+	err = mpool_sos_open(t->st_ds, t->st_oid[0], t->st_oid[1],
+			     &sos_test_params, &sos);
+	if (!err) {
+		for (i = 0; i < sos_keys + SOS_RACE_SEGS && !err; i++) {
+			err = mpool_sos_delete(sos, i);
+			if (mpool_errno(err) == ENOENT)
+				err = 0;
+		}
+		if (!err)
+			err = mpool_sos_sync(sos);
+		/* Each pass frees a few segments, one per segment is plenty */
+		for (i = 0; i < sos_rounds * 4 + SOS_RACE_SEGS && !err; i++)
+			err = mpool_sos_compact(sos);
+		if (err)
+			mpft_err(t->st_test, "cleanup", err);
+
+		mpool_sos_close(sos);
+	}
+
+	mpft_mdc_finish(t->st_ds, t->st_oid);
+
+	free(t->st_buf);
+	free(t->st_verv);
+}
+
+/**
+ * sos_update() - Run one round of puts and deletes against the model
+ * @sos: store, or NULL to only update the model
+ *
+ * Every key is overwritten with version "round + 1", except that every
+ * seventh key (offset by the round) is deleted instead.  Deleting a key
+ * that does not exist must fail with ENOENT.
+ */
+static
+mpool_err_t
+sos_update(
+	struct mpool_sos   *sos,
+	u32                 round,
+	u32                *verv,
+	char               *buf)
+{
+	mpool_err_t err;
+	u32         i;
+
+	for (i = 0; i < sos_keys; i++) {
+		if ((i + round) % 7 == 0) {
+			err = sos ? mpool_sos_delete(sos, i) : 0;
+			if (!verv[i] && sos) {
+				if (mpool_errno(err) != ENOENT)
+					return err ?: merr(EEXIST);
+				err = 0;
+			}
+			if (err)
+				return err;
+
+			verv[i] = 0;
+			continue;
+		}
+
+		err = sos ? sos_obj_put(sos, i, round + 1, buf) : 0;
+		if (err)
+			return err;
+
+		verv[i] = round + 1;
+	}
+
+	return 0;
+}
+
+/**
+ *
+ * Replay
+ *
+ */
+
+/**
+ * The replay test checks that the index is rebuilt from the MDC:
+ * objects survive close and reopen with their latest contents, deleted
+ * objects stay deleted, and the get error paths behave as documented.
+ */
+static
+void
+sos_correctness_replay_help(void)
+{
+	fprintf(co.co_fp, "\nusage: mpft sos.correctness.replay [options]\n");
+	show_default_params(sos_params, 0);
+}
+
+static
+mpool_err_t
+sos_correctness_replay(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_sos   *sos = NULL;
+	struct sos_test     t;
+	mpool_err_t         err;
+	size_t              len;
+	u32                 r, key;
+
+	err = sos_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	err = mpool_sos_open(t.st_ds, t.st_oid[0], t.st_oid[1],
+			     &sos_test_params, &sos);
+	if (err) {
+		mpft_err(t.st_test, "mpool_sos_open", err);
+		goto out;
+	}
+
+	for (r = 0; r < sos_rounds && !err; r++) {
+		err = sos_update(sos, r, t.st_verv, t.st_buf);
+		if (!err && r % 4 == 3)
+			err = mpool_sos_sync(sos);
+	}
+
+	if (err) {
+		mpft_err(t.st_test, "update", err);
+		goto out;
+	}
+
+	if (sos_verify(t.st_test, sos, t.st_verv, t.st_verv, t.st_buf)) {
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	/* Error paths: missing key, short buffer, oversized object */
+	err = mpool_sos_get(sos, sos_keys, t.st_buf, SOS_OBJ_MAX, &len);
+	if (mpool_errno(err) != ENOENT) {
+		fprintf(stderr, "%s: get of missing key: %d\n",
+			t.st_test, mpool_errno(err));
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	for (key = 0; key < sos_keys; key++)
+		if (t.st_verv[key] && sos_obj_len(key, t.st_verv[key]) > 1)
+			break;
+
+	if (key < sos_keys) {
+		err = mpool_sos_get(sos, key, t.st_buf, 1, &len);
+		if (mpool_errno(err) != EOVERFLOW ||
+		    len != sos_obj_len(key, t.st_verv[key])) {
+			fprintf(stderr, "%s: short get: %d len %zu\n",
+				t.st_test, mpool_errno(err), len);
+			err = merr(EINVAL);
+			goto out;
+		}
+	}
+
+	err = mpool_sos_put(sos, sos_keys, t.st_buf, (size_t)1 << 40);
+	if (mpool_errno(err) != EFBIG) {
+		fprintf(stderr, "%s: oversized put: %d\n",
+			t.st_test, mpool_errno(err));
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	err = sos_reopen(&t, &sos);
+
+out:
+	if (sos)
+		mpool_sos_close(sos);
+	sos_finish(&t);
+
+	return err;
+}
+
+/**
+ *
+ * Compaction
+ *
+ */
+
+/**
+ * The compaction test overwrites every object many times, compacting
+ * sealed segments along the way, so that live objects are relocated out
+ * of their segments.  Each put appends a record to the MDC, so with
+ * enough rounds the MDC is rewritten from a snapshot as well.  The store
+ * is verified as it goes and again after a reopen, which replays the
+ * relocations from the compacted MDC.
+ */
+static
+void
+sos_correctness_compaction_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft sos.correctness.compaction [options]\n");
+	show_default_params(sos_params, 0);
+}
+
+static
+mpool_err_t
+sos_correctness_compaction(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_sos   *sos = NULL;
+	struct sos_test     t;
+	mpool_err_t         err;
+	u32                 r;
+
+	err = sos_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	err = mpool_sos_open(t.st_ds, t.st_oid[0], t.st_oid[1],
+			     &sos_test_params, &sos);
+	if (err) {
+		mpft_err(t.st_test, "mpool_sos_open", err);
+		goto out;
+	}
+
+	for (r = 0; r < sos_rounds * 4; r++) {
+		err = sos_update(sos, r, t.st_verv, t.st_buf);
+		if (!err)
+			err = mpool_sos_sync(sos);
+		if (!err && r % 2 == 1)
+			err = mpool_sos_compact(sos);
+		if (err) {
+			mpft_err(t.st_test, "update/compact", err);
+			goto out;
+		}
+
+		if (r % 8 == 7 && sos_verify(t.st_test, sos, t.st_verv,
+					     t.st_verv, t.st_buf)) {
+			err = merr(EINVAL);
+			goto out;
+		}
+	}
+
+	err = sos_reopen(&t, &sos);
+
+out:
+	if (sos)
+		mpool_sos_close(sos);
+	sos_finish(&t);
+
+	return err;
+}
+
+/**
+ *
+ * Race
+ *
+ */
+
+/**
+ * The race test reads sealed objects from several threads while another
+ * thread seals a new segment with every put, which grows the segment table
+ * many times under the readers.  Every read must return the right object,
+ * and once the store is emptied compaction must be able to free every
+ * segment the readers pinned.
+ */
+static
+void
+sos_correctness_race_help(void)
+{
+	fprintf(co.co_fp, "\nusage: mpft sos.correctness.race [options]\n");
+	show_default_params(sos_params, 0);
+}
+
+/**
+ * struct sos_race - shared state of the race test threads
+ * @sr_sos:  store
+ * @sr_ver:  version of the keys the readers read
+ * @sr_done: set once the writer is done
+ * @sr_errv: error of each thread
+ */
+struct sos_race {
+	struct mpool_sos   *sr_sos;
+	u32                 sr_ver;
+	atomic_t            sr_done;
+	mpool_err_t        *sr_errv;
+};
+
+static
+void *
+sos_race_thread(
+	void   *arg)
+{
+	struct mpft_thread_args    *targs = arg;
+	struct sos_race            *race = targs->arg;
+	mpool_err_t                 err = 0;
+	char                        buf[2 * SOS_OBJ_MAX];
+	u32                         i;
+
+	mpft_thread_wait_for_start(targs);
+
+	if (targs->instance == 0) {
+		/* Each put lands in a segment of its own */
+		for (i = 0; i < SOS_RACE_SEGS && !err; i++) {
+			err = sos_obj_put(race->sr_sos, sos_keys + i, 1, buf);
+			if (!err)
+				err = mpool_sos_sync(race->sr_sos);
+		}
+		atomic_set(&race->sr_done, 1);
+	} else {
+		for (i = 0; !atomic_read(&race->sr_done); i++) {
+			if (!sos_obj_check(race->sr_sos, i % sos_keys,
+					   race->sr_ver, buf,
+					   buf + SOS_OBJ_MAX)) {
+				err = merr(EINVAL);
+				break;
+			}
+		}
+	}
+
+	race->sr_errv[targs->instance] = err;
+
+	return NULL;
+}
+
+static
+mpool_err_t
+sos_correctness_race(
+	int     argc,
+	char  **argv)
+{
+	struct mpft_thread_resp    *tresp = NULL;
+	struct mpft_thread_args    *targs = NULL;
+	struct sos_race             race;
+	struct mpool_sos           *sos = NULL;
+	struct sos_test             t;
+	struct mp_usage             usage;
+	struct mp_props             props;
+	mpool_err_t                 err;
+	u32                         i, tc, mbcnt;
+
+	err = sos_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	tc = sos_readers + 1;
+
+	memset(&race, 0, sizeof(race));
+	race.sr_ver = 1;
+	race.sr_errv = calloc(tc, sizeof(*race.sr_errv));
+	targs = calloc(tc, sizeof(*targs));
+	tresp = calloc(tc, sizeof(*tresp));
+	if (!race.sr_errv || !targs || !tresp) {
+		err = merr(ENOMEM);
+		goto out;
+	}
+
+	err = mpool_props_get(t.st_ds, &props, &usage);
+	if (!err) {
+		mbcnt = usage.mpu_mblock_cnt;
+		err = mpool_sos_open(t.st_ds, t.st_oid[0], t.st_oid[1],
+				     &sos_test_params, &sos);
+	}
+	if (err) {
+		mpft_err(t.st_test, "mpool_sos_open", err);
+		goto out;
+	}
+
+	/* Seal every key the readers read */
+	for (i = 0; i < sos_keys && !err; i++) {
+		err = sos_obj_put(sos, i, race.sr_ver, t.st_buf);
+		t.st_verv[i] = race.sr_ver;
+	}
+	if (!err)
+		err = mpool_sos_sync(sos);
+	if (err) {
+		mpft_err(t.st_test, "put", err);
+		goto out;
+	}
+
+	race.sr_sos = sos;
+	for (i = 0; i < tc; i++)
+		targs[i].arg = &race;
+
+	err = mpft_thread(tc, sos_race_thread, targs, tresp);
+	for (i = 0; i < tc && !err; i++) {
+		err = race.sr_errv[i];
+		if (err)
+			fprintf(stderr, "%s: %s thread %u failed: %d\n",
+				t.st_test, i ? "reader" : "writer", i,
+				mpool_errno(err));
+	}
+	if (err)
+		goto out;
+
+	/* No segment may be left pinned by a reader */
+	for (i = 0; i < sos_keys + SOS_RACE_SEGS && !err; i++) {
+		err = mpool_sos_delete(sos, i);
+		if (i < sos_keys)
+			t.st_verv[i] = 0;
+	}
+	if (!err)
+		err = mpool_sos_sync(sos);
+	for (i = 0; i < SOS_RACE_SEGS && !err; i++)
+		err = mpool_sos_compact(sos);
+	if (!err)
+		err = mpool_props_get(t.st_ds, &props, &usage);
+	if (err) {
+		mpft_err(t.st_test, "delete/compact", err);
+		goto out;
+	}
+
+	if (usage.mpu_mblock_cnt > mbcnt) {
+		fprintf(stderr, "%s: %u segments left after compaction\n",
+			t.st_test, usage.mpu_mblock_cnt - mbcnt);
+		err = merr(EBUSY);
+		goto out;
+	}
+
+	err = sos_reopen(&t, &sos);
+
+out:
+	if (sos)
+		mpool_sos_close(sos);
+	sos_finish(&t);
+
+	free(race.sr_errv);
+	free(targs);
+	free(tresp);
+
+	return err;
+}
+
+/**
+ *
+ * Crash
+ *
+ */
+
+/**
+ * The crash test forks a child that opens its own mpool handle, makes
+ * one round of updates durable, applies a second round without syncing
+ * and exits without closing anything.  The parent then reopens the store:
+ * every key must hold either its synced or its unsynced version, and the
+ * recovered store must accept and persist new updates.
+ */
+static
+void
+sos_correctness_crash_help(void)
+{
+	fprintf(co.co_fp, "\nusage: mpft sos.correctness.crash [options]\n");
+	show_default_params(sos_params, 0);
+}
+
+static
+mpool_err_t
+sos_crash_child(
+	void   *arg,
+	int     fd)
+{
+	struct sos_test    *t = arg;
+	struct mpool_sos   *sos;
+	mpool_err_t         err;
+	u32                *verv = t->st_verv;
+	u32                 r;
+
+	err = mpool_open(sos_mpool, O_RDWR, &t->st_ds, NULL);
+	if (!err)
+		err = mpool_sos_open(t->st_ds, t->st_oid[0], t->st_oid[1],
+				     &sos_test_params, &sos);
+
+	for (r = 0; r < sos_rounds - 1 && !err; r++)
+		err = sos_update(sos, r, verv, t->st_buf);
+	if (!err)
+		err = mpool_sos_sync(sos);
+	if (!err) {
+		memcpy(verv + sos_keys, verv, sos_keys * sizeof(*verv));
+		err = sos_update(sos, r, verv + sos_keys, t->st_buf);
+	}
+
+	return err;
+}
+
+static
+mpool_err_t
+sos_correctness_crash(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_sos   *sos = NULL;
+	struct sos_test     t;
+	mpool_err_t         err;
+	u32                 r, i;
+
+	err = sos_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	err = mpft_crash(t.st_test, sos_crash_child, NULL, &t, 0);
+	if (err)
+		goto out;
+
+	/* Rebuild the child's model: synced versions, then unsynced ones */
+	for (r = 0; r < sos_rounds - 1; r++)
+		sos_update(NULL, r, t.st_verv, NULL);
+
+	memcpy(t.st_verv + sos_keys, t.st_verv, sos_keys * sizeof(u32));
+	sos_update(NULL, r, t.st_verv + sos_keys, NULL);
+
+	err = mpool_sos_open(t.st_ds, t.st_oid[0], t.st_oid[1],
+			     &sos_test_params, &sos);
+	if (err) {
+		mpft_err(t.st_test, "mpool_sos_open (recovery)", err);
+		goto out;
+	}
+
+	if (sos_verify(t.st_test, sos, t.st_verv, t.st_verv + sos_keys,
+		       t.st_buf)) {
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	/* The recovered store must accept and persist new updates */
+	for (i = 0; i < sos_keys && !err; i++) {
+		err = sos_obj_put(sos, i, sos_rounds + 1, t.st_buf);
+		t.st_verv[i] = sos_rounds + 1;
+	}
+	if (err) {
+		mpft_err(t.st_test, "update after recovery", err);
+		goto out;
+	}
+
+	err = sos_reopen(&t, &sos);
+
+out:
+	if (sos)
+		mpool_sos_close(sos);
+	sos_finish(&t);
+
+	return err;
+}
+
+struct test_s sos_tests[] = {
+	{ "replay", MPFT_TEST_TYPE_CORRECTNESS, sos_correctness_replay,
+		sos_correctness_replay_help },
+	{ "compaction", MPFT_TEST_TYPE_CORRECTNESS, sos_correctness_compaction,
+		sos_correctness_compaction_help },
+	{ "race", MPFT_TEST_TYPE_CORRECTNESS, sos_correctness_race,
+		sos_correctness_race_help },
+	{ "crash", MPFT_TEST_TYPE_CORRECTNESS, sos_correctness_crash,
+		sos_correctness_crash_help },
+	{ NULL, MPFT_TEST_TYPE_INVALID, NULL, NULL },
+};
+
+void
+sos_help(void)
+{
+	int i = 0;
+
+	fprintf(co.co_fp,
+		"\nsos tests validate the behavior of the small object store\n");
+
+	fprintf(co.co_fp, "Available tests include:\n");
+	while (sos_tests[i].test_name) {
+		fprintf(co.co_fp, "\t%s\n", sos_tests[i].test_name);
+		i++;
+	}
+}
+
+struct group_s mpft_sos = {
+	.group_name = "sos",
+	.group_test = sos_tests,
+	.group_help = sos_help,
+};
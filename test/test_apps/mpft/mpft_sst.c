@@ -0,0 +1,1121 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+
+#include <util/platform.h>
+#include <util/page.h>
+#include <util/minmax.h>
+#include <util/param.h>
+#include <mpool/mpool.h>
+
+#include "mpft.h"
+#include "mpft_sst.h"
+
+#define merr(_errnum)   (_errnum)
+
+#define TS_DIGITS       (10)
+#define TS_KEYLEN_MAX   (1024)
+#define TS_VALLEN_MAX   (1024 * 1024)
+#define TS_BIGVAL       (200 * 1024)
+#define TS_BIGVAL_INTVL (4096)
+#define TS_SEEKS        (64)
+
+/*
+ * Just enough of the on-media layout to corrupt a table: the trailer
+ * ends the last mblock, and fence entries are 16 bytes with the block
+ * length in pages last.
+ */
+#define TS_TRAILER_LEN  (56)
+#define TS_TRL_NBLKS    (16)
+#define TS_TRL_IDXOFF   (24)
+#define TS_FENCE_LEN    (16)
+#define TS_FENCE_PGOFF  (8)
+#define TS_FENCE_NPG    (12)
+#define TS_COPYSZ       (1024 * 1024)
+
+/*
+ * Record "u" has key 2 * u in
+ * TS_DIGITS decimal digits followed by a suffix of varying length, so
+ * that keys 2 * u + 1 fall between records and are never present.  Its
+ * value depends on "u" and on the generation of the table it was added
+ * to; every TS_BIGVAL_INTVL-th value is larger than a default data block.
+ */
+char ts_mpool[MPOOL_NAME_LEN_MAX];
+u32  ts_records = 65536;
+u32  ts_valmax = 512;
+u32  ts_bloom = 10;
+
+static
+struct param_inst ts_params[] = {
+	PARAM_INST_STRING(ts_mpool, sizeof(ts_mpool), "mp", "mpool"),
+	PARAM_INST_U32(ts_records, "records", "number of records"),
+	PARAM_INST_U32(ts_valmax, "valmax", "maximum small value length"),
+	PARAM_INST_U32(ts_bloom, "bloom", "bloom filter bits per key"),
+	PARAM_INST_END
+};
+
+/*
+ * Table contents, by generation of each record
+ */
+enum ts_kind {
+	TS_OLD    = 1,  /* records u % 3 != 2, generation 1 */
+	TS_NEW    = 2,  /* records u % 3 != 0, generation 2 */
+	TS_MERGED = 3,  /* TS_NEW over TS_OLD */
+};
+
+/**
+ * struct ts_table - a sorted table and its expected contents
+ * @tb_kind:  enum ts_kind
+ * @tb_mbidc: number of mblocks
+ * @tb_mbidv: mblock IDs, NULL if the table was not committed
+ * @tb_sst:   reader handle, NULL while closed
+ */
+struct ts_table {
+	enum ts_kind        tb_kind;
+	u32                 tb_mbidc;
+	u64                *tb_mbidv;
+	struct mpool_sst   *tb_sst;
+};
+
+/**
+ * struct ts_test - state shared by the steps of an sst test
+ * @tt_test: test name
+ * @tt_ds:   mpool handle
+ * @tt_key:  key buffer
+ * @tt_val:  value buffer, large enough for any value
+ */
+struct ts_test {
+	const char     *tt_test;
+	struct mpool   *tt_ds;
+	char            tt_key[TS_KEYLEN_MAX];
+	char           *tt_val;
+};
+
+static
+u32
+ts_gen(
+	enum ts_kind    kind,
+	u32             u)
+{
+	switch (kind) {
+	case TS_OLD:
+		return u % 3 != 2 ? 1 : 0;
+
+	case TS_NEW:
+		return u % 3 != 0 ? 2 : 0;
+
+	case TS_MERGED:
+		return u % 3 == 0 ? 1 : 2;
+	}
+
+	return 0;
+}
+
+/**
+ * ts_key() - Format the key of record "u", or the missing key after it
+ */
+static
+size_t
+ts_key(
+	char   *buf,
+	u32     u,
+	bool    missing)
+{
+	size_t len;
+
+	snprintf(buf, TS_DIGITS + 1, "%0*lu", TS_DIGITS,
+		 (ulong)u * 2 + missing);
+
+	len = u % 97 == 0 ? TS_KEYLEN_MAX - TS_DIGITS : u % 7;
+	memset(buf + TS_DIGITS, 'k', len);
+
+	return TS_DIGITS + len;
+}
+
+static
+size_t
+ts_val(
+	char   *buf,
+	u32     u,
+	u32     gen)
+{
+	size_t len, i;
+
+	len = (u * 131 + gen * 17) % (ts_valmax + 1);
+	if (u % TS_BIGVAL_INTVL == TS_BIGVAL_INTVL - 1)
+		len = TS_BIGVAL;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (char)(u * 7 + gen + i);
+
+	return len;
+}
+
+static
+void
+ts_table_delete(
+	struct ts_test     *t,
+	struct ts_table    *tb)
+{
+	u32 i;
+
+	if (tb->tb_sst)
+		mpool_sst_close(tb->tb_sst);
+	tb->tb_sst = NULL;
+
+	for (i = 0; i < tb->tb_mbidc; i++)
+		mpool_mblock_delete(t->tt_ds, tb->tb_mbidv[i]);
+
+	free(tb->tb_mbidv);
+	tb->tb_mbidv = NULL;
+	tb->tb_mbidc = 0;
+}
+
+/**
+ * ts_build() - Build and commit a table of "kind" from the record model
+ */
+static
+mpool_err_t
+ts_build(
+	struct ts_test                 *t,
+	struct ts_table                *tb,
+	enum ts_kind                    kind,
+	const struct mpool_sst_params  *params)
+{
+	struct mpool_sst_wr    *wr;
+	mpool_err_t             err;
+	size_t                  klen, vlen;
+	u32                     u, gen;
+
+	memset(tb, 0, sizeof(*tb));
+	tb->tb_kind = kind;
+
+	err = mpool_sst_create(t->tt_ds, params, &wr);
+	if (err) {
+		mpft_err(t->tt_test, "mpool_sst_create", err);
+		return err;
+	}
+
+	for (u = 0; u < ts_records; u++) {
+		gen = ts_gen(kind, u);
+		if (!gen)
+			continue;
+
+		klen = ts_key(t->tt_key, u, false);
+		vlen = ts_val(t->tt_val, u, gen);
+
+		err = mpool_sst_add(wr, t->tt_key, klen, t->tt_val, vlen);
+		if (err) {
+			mpft_err(t->tt_test, "mpool_sst_add", err);
+			mpool_sst_abort(wr);
+			return err;
+		}
+	}
+
+	err = mpool_sst_commit(wr, &tb->tb_mbidv, &tb->tb_mbidc);
+	if (err) {
+		mpft_err(t->tt_test, "mpool_sst_commit", err);
+		mpool_sst_abort(wr);
+	}
+
+	return err;
+}
+
+static
+mpool_err_t
+ts_open(
+	struct ts_test     *t,
+	struct ts_table    *tb)
+{
+	mpool_err_t err;
+
+	err = mpool_sst_open(t->tt_ds, tb->tb_mbidc, tb->tb_mbidv,
+			     MPC_VMA_WARM, &tb->tb_sst);
+	if (err)
+		mpft_err(t->tt_test, "mpool_sst_open", err);
+
+	return err;
+}
+
+/**
+ * ts_expect() - Check a record returned by a reader against the model
+ */
+static
+int
+ts_expect(
+	struct ts_test *t,
+	const char     *what,
+	u32             u,
+	u32             gen,
+	const void     *val,
+	size_t          vlen)
+{
+	size_t len = ts_val(t->tt_val, u, gen);
+
+	if (vlen == len && !memcmp(val, t->tt_val, len))
+		return 0;
+
+	fprintf(stderr, "%s: %s: record %u: value length %zu, expected %zu\n",
+		t->tt_test, what, u, vlen, len);
+
+	return 1;
+}
+
+/**
+ * ts_verify_iter() - Iterate from the record at or after "u" to the end
+ * @missing: seek to the missing key after record "u" instead
+ */
+static
+int
+ts_verify_iter(
+	struct ts_test     *t,
+	struct ts_table    *tb,
+	u32                 u,
+	bool                missing)
+{
+	struct mpool_sst_iter  *it;
+	const void             *key, *val;
+	mpool_err_t             err;
+	size_t                  klen, vlen, seeklen = 0;
+	bool                    eof = false;
+	char                    seek[TS_KEYLEN_MAX];
+	int                     bad = 0;
+
+	if (u > 0 || missing)
+		seeklen = ts_key(seek, u, missing);
+	if (missing)
+		u++;
+
+	err = mpool_sst_iter_create(tb->tb_sst, seeklen ? seek : NULL,
+				    seeklen, &it);
+	if (err) {
+		mpft_err(t->tt_test, "mpool_sst_iter_create", err);
+		return 1;
+	}
+
+	while (!bad) {
+		err = mpool_sst_iter_next(it, &key, &klen, &val, &vlen, &eof);
+		if (err || eof)
+			break;
+
+		while (u < ts_records && !ts_gen(tb->tb_kind, u))
+			u++;
+
+		if (u == ts_records) {
+			fprintf(stderr, "%s: iterator: extra record\n",
+				t->tt_test);
+			bad++;
+			break;
+		}
+
+		if (klen != ts_key(t->tt_key, u, false) ||
+		    memcmp(key, t->tt_key, klen)) {
+			fprintf(stderr, "%s: iterator: wrong key, expected "
+				"record %u\n", t->tt_test, u);
+			bad++;
+			break;
+		}
+
+		bad += ts_expect(t, "iterator", u, ts_gen(tb->tb_kind, u),
+				 val, vlen);
+		u++;
+	}
+
+	while (u < ts_records && !ts_gen(tb->tb_kind, u))
+		u++;
+
+	if (!bad && (err || u != ts_records)) {
+		fprintf(stderr, "%s: iterator: err %d, ended before record "
+			"%u\n", t->tt_test, mpool_errno(err), u);
+		bad++;
+	}
+
+	mpool_sst_iter_destroy(it);
+
+	return bad;
+}
+
+/**
+ * ts_verify() - Check a table against its model by point lookups of
+ * every record and every missing key, and by iteration
+ */
+static
+int
+ts_verify(
+	struct ts_test     *t,
+	struct ts_table    *tb)
+{
+	struct mpool_sst_props  props;
+	const void             *val;
+	mpool_err_t             err;
+	size_t                  klen, vlen;
+	u32                     u, gen, nrecs = 0;
+	int                     bad = 0;
+
+	for (u = 0; u < ts_records && bad < 8; u++) {
+		gen = ts_gen(tb->tb_kind, u);
+		klen = ts_key(t->tt_key, u, false);
+
+		err = mpool_sst_get(tb->tb_sst, t->tt_key, klen, &val, &vlen);
+		if (gen == 0) {
+			if (mpool_errno(err) != ENOENT) {
+				fprintf(stderr, "%s: get: absent record %u: "
+					"%d\n", t->tt_test, u,
+					mpool_errno(err));
+				bad++;
+			}
+		} else if (err) {
+			fprintf(stderr, "%s: get: record %u: %d\n",
+				t->tt_test, u, mpool_errno(err));
+			bad++;
+		} else {
+			bad += ts_expect(t, "get", u, gen, val, vlen);
+			nrecs++;
+		}
+
+		klen = ts_key(t->tt_key, u, true);
+
+		err = mpool_sst_get(tb->tb_sst, t->tt_key, klen, &val, &vlen);
+		if (mpool_errno(err) != ENOENT) {
+			fprintf(stderr, "%s: get: missing key after record "
+				"%u: %d\n", t->tt_test, u, mpool_errno(err));
+			bad++;
+		}
+	}
+
+	bad += ts_verify_iter(t, tb, 0, false);
+
+	for (u = 0; u < TS_SEEKS && !bad; u++)
+		bad += ts_verify_iter(t, tb, (u * 7919) % ts_records, u % 2);
+
+	err = mpool_sst_getprops(tb->tb_sst, &props);
+	if (!bad && (err || props.ssp_nrecs != nrecs ||
+		     props.ssp_nmblocks != tb->tb_mbidc)) {
+		fprintf(stderr, "%s: props: err %d, %lu records in %u "
+			"mblocks, expected %u in %u\n", t->tt_test,
+			mpool_errno(err), (ulong)props.ssp_nrecs,
+			props.ssp_nmblocks, nrecs, tb->tb_mbidc);
+		bad++;
+	}
+
+	if (bad)
+		fprintf(stderr, "%s: table does not match\n", t->tt_test);
+
+	return bad;
+}
+
+/**
+ * ts_reopen() - Close a table and map it again from its mblocks alone
+ */
+static
+int
+ts_reopen(
+	struct ts_test     *t,
+	struct ts_table    *tb)
+{
+	mpool_sst_close(tb->tb_sst);
+	tb->tb_sst = NULL;
+
+	if (ts_open(t, tb))
+		return 1;
+
+	return ts_verify(t, tb);
+}
+
+/**
+ * ts_start() - Parse parameters and open the mpool
+ */
+static
+mpool_err_t
+ts_start(
+	struct ts_test *t,
+	int             argc,
+	char          **argv)
+{
+	mpool_err_t err;
+	int         next_arg = 0;
+
+	memset(t, 0, sizeof(*t));
+	t->tt_test = argv[0];
+
+	err = process_params(argc, argv, ts_params, &next_arg, 0);
+	if (err) {
+		fprintf(stderr, "%s: process_params failed\n", t->tt_test);
+		return err;
+	}
+
+	if (ts_mpool[0] == 0) {
+		fprintf(stderr, "%s: mpool (mp=<mpool>) must be specified\n",
+			t->tt_test);
+		return merr(EINVAL);
+	}
+
+	if (ts_records < 3 || ts_valmax > TS_BIGVAL || ts_bloom > 32) {
+		fprintf(stderr, "%s: records must be at least 3, valmax at "
+			"most %u, bloom at most 32\n", t->tt_test, TS_BIGVAL);
+		return merr(EINVAL);
+	}
+
+	t->tt_val = malloc(TS_VALLEN_MAX + 1);
+	if (!t->tt_val)
+		return merr(ENOMEM);
+
+	err = mpool_open(ts_mpool, O_RDWR, &t->tt_ds, NULL);
+	if (err) {
+		mpft_err(t->tt_test, "mpool_open", err);
+		free(t->tt_val);
+	}
+
+	return err;
+}
+
+static
+void
+ts_finish(
+	struct ts_test *t)
+{
+	mpool_close(t->tt_ds);
+	free(t->tt_val);
+}
+
+/**
+ *
+ * Lookup
+ *
+ */
+
+/**
+ * A table's reader is rebuilt from its mblocks alone.  The lookup test
+ * builds a table with a bloom filter, checks lookups of every record and
+ * of the keys in between, full and seeking iteration, and the table
+ * properties, and does so again after remapping the table.  It also
+ * covers the error paths of the builder and the reader.
+ */
+static
+void
+ts_correctness_lookup_help(void)
+{
+	fprintf(co.co_fp, "\nusage: mpft sst.correctness.lookup [options]\n");
+	show_default_params(ts_params, 0);
+}
+
+/**
+ * ts_errors() - Check that invalid arguments and records are rejected
+ * without spoiling the builder
+ */
+static
+mpool_err_t
+ts_errors(
+	struct ts_test *t)
+{
+	struct mpool_sst_params     params;
+	struct mpool_sst_wr        *wr;
+	mpool_err_t                 err;
+	u64                        *mbidv;
+	u32                         mbidc;
+	size_t                      klen;
+	int                         bad = 0;
+
+	memset(&params, 0, sizeof(params));
+	params.sp_blksz = 4096 + 512;
+	params.sp_mclassp = MP_MED_CAPACITY;
+	bad += mpool_errno(mpool_sst_create(t->tt_ds, &params, &wr)) != EINVAL;
+
+	params.sp_blksz = 0;
+	params.sp_bloom_bits = 33;
+	bad += mpool_errno(mpool_sst_create(t->tt_ds, &params, &wr)) != EINVAL;
+
+	if (bad) {
+		fprintf(stderr, "%s: invalid parameters accepted\n",
+			t->tt_test);
+		return merr(EINVAL);
+	}
+
+	err = mpool_sst_create(t->tt_ds, NULL, &wr);
+	if (err) {
+		mpft_err(t->tt_test, "mpool_sst_create", err);
+		return err;
+	}
+
+	err = mpool_sst_commit(wr, &mbidv, &mbidc);
+	bad += mpool_errno(err) != ENODATA;
+
+	klen = ts_key(t->tt_key, 1, false);
+	err = mpool_sst_add(wr, t->tt_key, klen, t->tt_val, 1);
+	bad += !!err;
+
+	bad += mpool_errno(mpool_sst_add(wr, t->tt_key, klen,
+					 t->tt_val, 1)) != EINVAL;
+	bad += mpool_errno(mpool_sst_add(wr, t->tt_key,
+					 ts_key(t->tt_key, 0, false),
+					 t->tt_val, 1)) != EINVAL;
+	bad += mpool_errno(mpool_sst_add(wr, t->tt_key, 0,
+					 t->tt_val, 1)) != EINVAL;
+
+	memset(t->tt_key, 'z', sizeof(t->tt_key));
+	bad += mpool_errno(mpool_sst_add(wr, t->tt_key, TS_KEYLEN_MAX + 1,
+					 t->tt_val, 1)) != EINVAL;
+	bad += mpool_errno(mpool_sst_add(wr, t->tt_key, TS_KEYLEN_MAX,
+					 t->tt_val, TS_VALLEN_MAX + 1)) != EINVAL;
+
+	/* The builder still takes the largest record after its errors */
+	err = mpool_sst_add(wr, t->tt_key, TS_KEYLEN_MAX, t->tt_val,
+			    TS_VALLEN_MAX);
+	bad += !!err;
+
+	mpool_sst_abort(wr);
+
+	if (bad) {
+		fprintf(stderr, "%s: builder: %d unexpected results\n",
+			t->tt_test, bad);
+		return merr(EINVAL);
+	}
+
+	return 0;
+}
+
+/**
+ * ts_malformed() - Check that a table whose last data block overlaps
+ * its fence index does not open
+ *
+ * The last mblock is copied into a new mblock with the length of the
+ * last block stretched into the index, which stays within the mblock.
+ */
+static
+int
+ts_malformed(
+	struct ts_test     *t,
+	struct ts_table    *tb)
+{
+	struct mblock_props props;
+	struct mpool_sst   *sst;
+	struct iovec        iov;
+	mpool_err_t         err;
+	u64                 mbh, off, idxoff, *mbidv = NULL;
+	u32                 nblks, pgoff, npg, le;
+	char               *buf = NULL, *fence;
+	int                 bad = 1;
+
+	err = mpool_mblock_getprops(t->tt_ds, tb->tb_mbidv[tb->tb_mbidc - 1],
+				    &props);
+	if (err) {
+		mpft_err(t->tt_test, "mpool_mblock_getprops", err);
+		return 1;
+	}
+
+	mbidv = calloc(tb->tb_mbidc, sizeof(*mbidv));
+	if (!mbidv || posix_memalign((void **)&buf, PAGE_SIZE,
+				     props.mpr_write_len)) {
+		free(mbidv);
+		return 1;
+	}
+
+	for (off = 0; off < props.mpr_write_len; off += iov.iov_len) {
+		iov.iov_base = buf + off;
+		iov.iov_len = min_t(u64, TS_COPYSZ,
+				    props.mpr_write_len - off);
+
+		err = mpool_mblock_read(t->tt_ds,
+					tb->tb_mbidv[tb->tb_mbidc - 1],
+					&iov, 1, off);
+		if (err) {
+			mpft_err(t->tt_test, "mpool_mblock_read", err);
+			goto out;
+		}
+	}
+
+	fence = buf + props.mpr_write_len - TS_TRAILER_LEN;
+	memcpy(&le, fence + TS_TRL_NBLKS, sizeof(le));
+	nblks = le32toh(le);
+	memcpy(&idxoff, fence + TS_TRL_IDXOFF, sizeof(idxoff));
+	idxoff = le64toh(idxoff);
+
+	/* The last block is always in the last mblock */
+	fence = buf + idxoff + (u64)(nblks - 1) * TS_FENCE_LEN;
+	memcpy(&le, fence + TS_FENCE_PGOFF, sizeof(le));
+	pgoff = le32toh(le);
+
+	npg = idxoff / PAGE_SIZE - pgoff + 1;
+	le = htole32(npg);
+	memcpy(fence + TS_FENCE_NPG, &le, sizeof(le));
+
+	err = mpool_mblock_alloc(t->tt_ds, MP_MED_CAPACITY, false, &mbh,
+				 NULL);
+	if (err) {
+		mpft_err(t->tt_test, "mpool_mblock_alloc", err);
+		goto out;
+	}
+
+	for (off = 0; off < props.mpr_write_len && !err; off += iov.iov_len) {
+		iov.iov_base = buf + off;
+		iov.iov_len = min_t(u64, TS_COPYSZ,
+				    props.mpr_write_len - off);
+
+		err = mpool_mblock_write(t->tt_ds, mbh, &iov, 1);
+	}
+	if (!err)
+		err = mpool_mblock_commit(t->tt_ds, mbh);
+	if (err) {
+		mpft_err(t->tt_test, "mpool_mblock_write", err);
+		mpool_mblock_abort(t->tt_ds, mbh);
+		goto out;
+	}
+
+	memcpy(mbidv, tb->tb_mbidv, tb->tb_mbidc * sizeof(*mbidv));
+	mbidv[tb->tb_mbidc - 1] = mbh;
+
+	err = mpool_sst_open(t->tt_ds, tb->tb_mbidc, mbidv, MPC_VMA_WARM,
+			     &sst);
+	if (mpool_errno(err) == EBADMSG) {
+		bad = 0;
+	} else {
+		fprintf(stderr, "%s: table with a block over its index: "
+			"open %d\n", t->tt_test, mpool_errno(err));
+		if (!err)
+			mpool_sst_close(sst);
+	}
+
+	mpool_mblock_delete(t->tt_ds, mbh);
+out:
+	free(buf);
+	free(mbidv);
+
+	return bad;
+}
+
+static
+mpool_err_t
+ts_correctness_lookup(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_sst_params params;
+	struct ts_table         tb;
+	struct mpool_sst_props  props;
+	struct mpool_sst       *sst;
+	struct ts_test          t;
+	const void             *val;
+	mpool_err_t             err;
+	size_t                  vlen;
+	u64                    *mbidv;
+
+	err = ts_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	err = ts_errors(&t);
+	if (err)
+		goto out;
+
+	memset(&params, 0, sizeof(params));
+	params.sp_bloom_bits = ts_bloom;
+	params.sp_mclassp = MP_MED_CAPACITY;
+
+	err = ts_build(&t, &tb, TS_OLD, &params);
+	if (err)
+		goto out;
+
+	err = ts_open(&t, &tb);
+	if (err || ts_verify(&t, &tb) || ts_reopen(&t, &tb)) {
+		err = err ?: merr(EINVAL);
+		goto errout;
+	}
+
+	/* Every missing key was looked up; most must have hit the filter */
+	err = mpool_sst_getprops(tb.tb_sst, &props);
+	if (!err && ts_bloom > 0 &&
+	    props.ssp_bloom_negatives < ts_records / 2) {
+		fprintf(stderr, "%s: %lu bloom negatives in %lu gets\n",
+			t.tt_test, (ulong)props.ssp_bloom_negatives,
+			(ulong)props.ssp_gets);
+		err = merr(EINVAL);
+	}
+	if (err)
+		goto errout;
+
+	if (mpool_errno(mpool_sst_get(tb.tb_sst, t.tt_key, 0, &val,
+				      &vlen)) != EINVAL) {
+		fprintf(stderr, "%s: get of an empty key accepted\n",
+			t.tt_test);
+		err = merr(EINVAL);
+		goto errout;
+	}
+
+	/* A table must not open without its last mblock, or with others */
+	mbidv = calloc(tb.tb_mbidc + 1, sizeof(*mbidv));
+	if (!mbidv) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	memcpy(mbidv, tb.tb_mbidv, tb.tb_mbidc * sizeof(*mbidv));
+	mbidv[tb.tb_mbidc] = mbidv[tb.tb_mbidc - 1];
+
+	if ((tb.tb_mbidc > 1 &&
+	     !mpool_sst_open(t.tt_ds, tb.tb_mbidc - 1, mbidv, MPC_VMA_WARM,
+			     &sst)) ||
+	    !mpool_sst_open(t.tt_ds, tb.tb_mbidc + 1, mbidv, MPC_VMA_WARM,
+			    &sst)) {
+		fprintf(stderr, "%s: table opened with wrong mblocks\n",
+			t.tt_test);
+		mpool_sst_close(sst);
+		err = merr(EINVAL);
+	}
+
+	free(mbidv);
+
+	if (!err && ts_malformed(&t, &tb))
+		err = merr(EINVAL);
+
+errout:
+	ts_table_delete(&t, &tb);
+out:
+	ts_finish(&t);
+
+	return err;
+}
+
+/**
+ *
+ * Merge
+ *
+ */
+
+/**
+ * Tables are immutable, so they are compacted by merging them into a new
+ * table.  The merge test merges an old and a new table with overlapping
+ * records through two iterators, built with different block sizes,
+ * restart intervals and filters, and checks the merged table before and
+ * after deleting its inputs.
+ */
+static
+void
+ts_correctness_merge_help(void)
+{
+	fprintf(co.co_fp, "\nusage: mpft sst.correctness.merge [options]\n");
+	show_default_params(ts_params, 0);
+}
+
+/**
+ * ts_merge() - Merge two tables into a new one, "newer" winning on
+ * equal keys
+ */
+static
+mpool_err_t
+ts_merge(
+	struct ts_test                 *t,
+	struct ts_table                *older,
+	struct ts_table                *newer,
+	struct ts_table                *out,
+	const struct mpool_sst_params  *params)
+{
+	struct mpool_sst_iter  *itv[2] = { NULL, NULL };
+	struct mpool_sst_wr    *wr = NULL;
+	const void             *keyv[2], *valv[2];
+	mpool_err_t             err;
+	size_t                  klenv[2], vlenv[2];
+	bool                    eofv[2];
+	int                     i, rc;
+
+	memset(out, 0, sizeof(*out));
+	out->tb_kind = TS_MERGED;
+
+	err = mpool_sst_iter_create(older->tb_sst, NULL, 0, &itv[0]);
+	if (!err)
+		err = mpool_sst_iter_create(newer->tb_sst, NULL, 0, &itv[1]);
+	if (!err)
+		err = mpool_sst_create(t->tt_ds, params, &wr);
+
+	for (i = 0; i < 2 && !err; i++)
+		err = mpool_sst_iter_next(itv[i], &keyv[i], &klenv[i],
+					  &valv[i], &vlenv[i], &eofv[i]);
+
+	while (!err && !(eofv[0] && eofv[1])) {
+		if (eofv[0] || eofv[1]) {
+			rc = eofv[0] ? 1 : -1;
+		} else {
+			rc = memcmp(keyv[0], keyv[1],
+				    min_t(size_t, klenv[0], klenv[1]));
+			if (rc == 0)
+				rc = klenv[0] < klenv[1] ? -1 :
+					klenv[0] > klenv[1];
+		}
+
+		i = rc < 0 ? 0 : 1;
+
+		err = mpool_sst_add(wr, keyv[i], klenv[i], valv[i], vlenv[i]);
+
+		if (!err && rc >= 0)
+			err = mpool_sst_iter_next(itv[1], &keyv[1], &klenv[1],
+						  &valv[1], &vlenv[1],
+						  &eofv[1]);
+		if (!err && rc <= 0)
+			err = mpool_sst_iter_next(itv[0], &keyv[0], &klenv[0],
+						  &valv[0], &vlenv[0],
+						  &eofv[0]);
+	}
+
+	if (!err)
+		err = mpool_sst_commit(wr, &out->tb_mbidv, &out->tb_mbidc);
+	if (err) {
+		mpft_err(t->tt_test, "merge", err);
+		if (wr)
+			mpool_sst_abort(wr);
+	}
+
+	for (i = 0; i < 2; i++)
+		if (itv[i])
+			mpool_sst_iter_destroy(itv[i]);
+
+	return err;
+}
+
+static
+mpool_err_t
+ts_correctness_merge(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_sst_params paramv[3];
+	struct ts_table         older, newer, merged;
+	struct ts_test          t;
+	mpool_err_t             err;
+
+	err = ts_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	memset(&older, 0, sizeof(older));
+	memset(&newer, 0, sizeof(newer));
+	memset(&merged, 0, sizeof(merged));
+	memset(paramv, 0, sizeof(paramv));
+
+	paramv[0].sp_mclassp = MP_MED_CAPACITY;
+
+	paramv[1].sp_blksz = 64 * 1024;
+	paramv[1].sp_restart = 1;
+	paramv[1].sp_mclassp = MP_MED_CAPACITY;
+
+	paramv[2].sp_blksz = 16 * 1024;
+	paramv[2].sp_restart = 64;
+	paramv[2].sp_bloom_bits = ts_bloom;
+	paramv[2].sp_mclassp = MP_MED_CAPACITY;
+
+	err = ts_build(&t, &older, TS_OLD, &paramv[0]);
+	if (!err)
+		err = ts_build(&t, &newer, TS_NEW, &paramv[1]);
+	if (!err)
+		err = ts_open(&t, &older);
+	if (!err)
+		err = ts_open(&t, &newer);
+	if (err)
+		goto out;
+
+	if (ts_verify(&t, &older) || ts_verify(&t, &newer)) {
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	err = ts_merge(&t, &older, &newer, &merged, &paramv[2]);
+	if (!err)
+		err = ts_open(&t, &merged);
+	if (err)
+		goto out;
+
+	if (ts_verify(&t, &merged)) {
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	ts_table_delete(&t, &older);
+	ts_table_delete(&t, &newer);
+
+	if (ts_reopen(&t, &merged))
+		err = merr(EINVAL);
+
+out:
+	ts_table_delete(&t, &merged);
+	ts_table_delete(&t, &newer);
+	ts_table_delete(&t, &older);
+	ts_finish(&t);
+
+	return err;
+}
+
+/**
+ *
+ * Crash
+ *
+ */
+
+/**
+ * The crash test forks a child that opens its own mpool handle, builds
+ * and commits a table, reports its mblock IDs to the parent, and exits
+ * in the middle of building a second table.  The committed
+ * table must be intact in the parent, which then merges it with a table
+ * of its own.  The full mblocks of the second table, which a builder
+ * commits as it moves on to the next one, are leaked.
+ */
+static
+void
+ts_correctness_crash_help(void)
+{
+	fprintf(co.co_fp, "\nusage: mpft sst.correctness.crash [options]\n");
+	show_default_params(ts_params, 0);
+}
+
+/**
+ * struct ts_crash - the crash test and the table its child commits
+ */
+struct ts_crash {
+	struct ts_test     *tc_t;
+	struct ts_table     tc_tb;
+};
+
+static
+mpool_err_t
+ts_crash_child(
+	void   *arg,
+	int     fd)
+{
+	struct ts_crash        *c = arg;
+	struct ts_test         *t = c->tc_t;
+	struct mpool_sst_wr    *wr;
+	struct ts_table         tb;
+	mpool_err_t             err;
+	size_t                  klen, vlen;
+	u32                     u;
+
+	err = mpool_open(ts_mpool, O_RDWR, &t->tt_ds, NULL);
+	if (!err)
+		err = ts_build(t, &tb, TS_OLD, NULL);
+
+	for (u = 0; !err && u < tb.tb_mbidc; u++)
+		err = mpft_report(fd, &tb.tb_mbidv[u], sizeof(u64));
+
+	/* Die with a second table half built */
+	if (!err)
+		err = mpool_sst_create(t->tt_ds, NULL, &wr);
+
+	for (u = 0; u < ts_records / 2 && !err; u++) {
+		klen = ts_key(t->tt_key, u, false);
+		vlen = ts_val(t->tt_val, u, 2);
+		err = mpool_sst_add(wr, t->tt_key, klen, t->tt_val, vlen);
+	}
+
+	return err;
+}
+
+static
+void
+ts_crash_report(
+	void       *arg,
+	const void *msg)
+{
+	struct ts_crash    *c = arg;
+	struct ts_table    *tb = &c->tc_tb;
+	u64                *mbidv;
+
+	mbidv = realloc(tb->tb_mbidv, (tb->tb_mbidc + 1) * sizeof(*mbidv));
+	if (!mbidv)
+		return;
+
+	mbidv[tb->tb_mbidc++] = *(const u64 *)msg;
+	tb->tb_mbidv = mbidv;
+}
+
+static
+mpool_err_t
+ts_correctness_crash(
+	int     argc,
+	char  **argv)
+{
+	struct ts_table     newer, merged;
+	struct ts_table    *older;
+	struct ts_crash     c;
+	struct ts_test      t;
+	mpool_err_t         err;
+
+	err = ts_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	memset(&c, 0, sizeof(c));
+	memset(&newer, 0, sizeof(newer));
+	memset(&merged, 0, sizeof(merged));
+
+	c.tc_t = &t;
+	older = &c.tc_tb;
+	older->tb_kind = TS_OLD;
+
+	err = mpft_crash(t.tt_test, ts_crash_child, ts_crash_report, &c,
+			 sizeof(u64));
+	if (!err && older->tb_mbidc == 0)
+		err = merr(ECHILD);
+	if (err)
+		goto out;
+
+	err = ts_open(&t, older);
+	if (err)
+		goto out;
+
+	if (ts_verify(&t, older)) {
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	err = ts_build(&t, &newer, TS_NEW, NULL);
+	if (!err)
+		err = ts_open(&t, &newer);
+	if (!err)
+		err = ts_merge(&t, older, &newer, &merged, NULL);
+	if (!err)
+		err = ts_open(&t, &merged);
+	if (!err && ts_verify(&t, &merged))
+		err = merr(EINVAL);
+
+out:
+	ts_table_delete(&t, &merged);
+	ts_table_delete(&t, &newer);
+	ts_table_delete(&t, older);
+	ts_finish(&t);
+
+	return err;
+}
+
+struct test_s ts_tests[] = {
+	{ "lookup", MPFT_TEST_TYPE_CORRECTNESS, ts_correctness_lookup,
+		ts_correctness_lookup_help },
+	{ "merge", MPFT_TEST_TYPE_CORRECTNESS, ts_correctness_merge,
+		ts_correctness_merge_help },
+	{ "crash", MPFT_TEST_TYPE_CORRECTNESS, ts_correctness_crash,
+		ts_correctness_crash_help },
+	{ NULL, MPFT_TEST_TYPE_INVALID, NULL, NULL },
+};
+
+void
+ts_help(void)
+{
+	int i = 0;
+
+	fprintf(co.co_fp,
+		"\nsst tests validate the behavior of sorted tables\n");
+
+	fprintf(co.co_fp, "Available tests include:\n");
+	while (ts_tests[i].test_name) {
+		fprintf(co.co_fp, "\t%s\n", ts_tests[i].test_name);
+		i++;
+	}
+}
+
+struct group_s mpft_sst = {
+	.group_name = "sst",
+	.group_test = ts_tests,
+	.group_help = ts_help,
+};
@@ -0,0 +1,13 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_SST_MPFT_H
+#define MPOOL_SST_MPFT_H
+
+#include "mpft.h"
+
+extern struct group_s mpft_sst;
+
+#endif /* MPOOL_SST_MPFT_H */
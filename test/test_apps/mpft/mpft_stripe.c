@@ -0,0 +1,469 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <util/platform.h>
+#include <util/page.h>
+#include <util/minmax.h>
+#include <util/param.h>
+#include <mpool/mpool.h>
+
+#include "mpft.h"
+#include "mpft_stripe.h"
+
+#define merr(_errnum)   (_errnum)
+
+#define SG_IOVMAX       (4)
+#define SG_NAMES_MAX    (MPOOL_STRIPE_WIDTH_MAX * (MPOOL_NAME_LEN_MAX + 1))
+
+/*
+ * The members of a stripe group are given as a comma separated list of
+ * mpool names, in layout order.
+ */
+char sg_mpools[SG_NAMES_MAX];
+u32  sg_unitsz = 64 * 1024;
+u64  sg_len = 8 * 1024 * 1024;
+
+static
+struct param_inst sg_params[] = {
+	PARAM_INST_STRING(sg_mpools, sizeof(sg_mpools), "mp",
+			  "comma separated member mpools"),
+	PARAM_INST_U32(sg_unitsz, "unitsz", "stripe unit size"),
+	PARAM_INST_U64_SIZE(sg_len, "len", "striped mblock length"),
+	PARAM_INST_END
+};
+
+/**
+ * struct sg_test - state shared by the steps of a stripe test
+ * @gt_test:  test name
+ * @gt_grp:   stripe group handle
+ * @gt_mpc:   stripe width
+ * @gt_buf:   expected contents of the striped mblock
+ * @gt_rbuf:  read buffer
+ */
+struct sg_test {
+	const char                 *gt_test;
+	struct mpool_stripe_grp    *gt_grp;
+	u32                         gt_mpc;
+	char                       *gt_buf;
+	char                       *gt_rbuf;
+};
+
+/**
+ * sg_iov() - Cut @len bytes at @buf into up to SG_IOVMAX page aligned
+ * pieces of varying length, so that they straddle stripe units
+ */
+static
+int
+sg_iov(
+	struct iovec   *iov,
+	char           *buf,
+	size_t          len,
+	u32             seed)
+{
+	size_t  npg = len / PAGE_SIZE, cc;
+	int     iovc = 0;
+
+	while (npg > 0) {
+		cc = iovc < SG_IOVMAX - 1 ? 1 + (seed * 7 + iovc * 3) % npg :
+			npg;
+
+		iov[iovc].iov_base = buf;
+		iov[iovc].iov_len = cc * PAGE_SIZE;
+		iovc++;
+
+		buf += cc * PAGE_SIZE;
+		npg -= cc;
+	}
+
+	return iovc;
+}
+
+/**
+ * sg_member_len() - Bytes expected in member @idx for a logical @len
+ */
+static
+u64
+sg_member_len(
+	u64     len,
+	u32     mpc,
+	u32     idx)
+{
+	u64 rowsz = (u64)sg_unitsz * mpc, rem = len % rowsz;
+	u64 skip = (u64)idx * sg_unitsz;
+
+	return (len / rowsz) * sg_unitsz +
+		(rem > skip ? min_t(u64, rem - skip, sg_unitsz) : 0);
+}
+
+/**
+ * sg_write() - Write the expected contents in pieces of varying size
+ */
+static
+mpool_err_t
+sg_write(
+	struct sg_test         *t,
+	struct mpool_stripe    *st)
+{
+	struct iovec    iov[SG_IOVMAX];
+	mpool_err_t     err = 0;
+	size_t          off, cc;
+	u32             i;
+
+	for (off = 0, i = 0; off < sg_len && !err; off += cc, i++) {
+		cc = min_t(size_t, sg_len - off,
+			   (1 + i % 5) * (sg_unitsz / 2 + PAGE_SIZE));
+		cc &= ~(size_t)(PAGE_SIZE - 1);
+
+		err = mpool_stripe_write(st, iov,
+					 sg_iov(iov, t->gt_buf + off, cc, i));
+		if (err)
+			mpft_err(t->gt_test, "mpool_stripe_write", err);
+	}
+
+	return err;
+}
+
+/**
+ * sg_verify() - Check the length of every member and read the striped
+ * mblock back in pieces of varying size and offset
+ */
+static
+int
+sg_verify(
+	struct sg_test         *t,
+	struct mpool_stripe    *st)
+{
+	struct mpool_stripe_props   props;
+	struct mblock_props         mbprops;
+	struct iovec                iov[SG_IOVMAX];
+	struct mpool               *mp;
+	mpool_err_t                 err;
+	u64                         objidv[MPOOL_STRIPE_WIDTH_MAX], mbh;
+	size_t                      off, cc;
+	u32                         i;
+
+	err = mpool_stripe_getprops(st, &props);
+	if (err || props.stp_len != sg_len || !props.stp_committed ||
+	    props.stp_width != t->gt_mpc || props.stp_unitsz != sg_unitsz) {
+		fprintf(stderr, "%s: props: err %d, len %lu committed %u "
+			"width %u\n", t->gt_test, mpool_errno(err),
+			(ulong)props.stp_len, props.stp_committed,
+			props.stp_width);
+		return 1;
+	}
+
+	err = mpool_stripe_objids(st, objidv, MPOOL_STRIPE_WIDTH_MAX);
+	for (i = 0; i < t->gt_mpc && !err; i++) {
+		err = mpool_stripe_grp_mpool(t->gt_grp, i, &mp);
+		if (!err)
+			err = mpool_mblock_find(mp, objidv[i], &mbh, &mbprops);
+		if (!err && (!mbprops.mpr_iscommitted ||
+			     mbprops.mpr_write_len !=
+			     sg_member_len(sg_len, t->gt_mpc, i))) {
+			fprintf(stderr, "%s: member %u: len %lu, expected "
+				"%lu\n", t->gt_test, i,
+				(ulong)mbprops.mpr_write_len,
+				(ulong)sg_member_len(sg_len, t->gt_mpc, i));
+			return 1;
+		}
+	}
+	if (err) {
+		mpft_err(t->gt_test, "member lookup", err);
+		return 1;
+	}
+
+	for (off = 0, i = 3; off < sg_len; off += cc, i++) {
+		cc = min_t(size_t, sg_len - off,
+			   (1 + i % 7) * (sg_unitsz / 3 + PAGE_SIZE));
+		cc &= ~(size_t)(PAGE_SIZE - 1);
+
+		memset(t->gt_rbuf, 0xa5, cc);
+
+		err = mpool_stripe_read(st, iov,
+					sg_iov(iov, t->gt_rbuf, cc, i), off);
+		if (err) {
+			mpft_err(t->gt_test, "mpool_stripe_read", err);
+			return 1;
+		}
+
+		if (memcmp(t->gt_rbuf, t->gt_buf + off, cc)) {
+			fprintf(stderr, "%s: read at %zu length %zu "
+				"miscompares\n", t->gt_test, off, cc);
+			return 1;
+		}
+	}
+
+	/* Reads must stay within what was written */
+	iov[0].iov_base = t->gt_rbuf;
+	iov[0].iov_len = PAGE_SIZE;
+
+	if (mpool_errno(mpool_stripe_read(st, iov, 1, sg_len)) != EINVAL) {
+		fprintf(stderr, "%s: read past the end accepted\n",
+			t->gt_test);
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * sg_errors() - Check that misaligned iovecs and reads of an uncommitted
+ * striped mblock are rejected without spoiling it
+ */
+static
+int
+sg_errors(
+	struct sg_test         *t,
+	struct mpool_stripe    *st)
+{
+	struct iovec    iov[2];
+	int             bad = 0;
+
+	/* Aligned total length, misaligned base */
+	iov[0].iov_base = t->gt_buf + PAGE_SIZE / 2;
+	iov[0].iov_len = PAGE_SIZE;
+	bad += mpool_errno(mpool_stripe_write(st, iov, 1)) != EINVAL;
+
+	/* Aligned total length, misaligned pieces */
+	iov[0].iov_base = t->gt_buf;
+	iov[0].iov_len = PAGE_SIZE / 2;
+	iov[1].iov_base = t->gt_buf + PAGE_SIZE / 2;
+	iov[1].iov_len = PAGE_SIZE / 2;
+	bad += mpool_errno(mpool_stripe_write(st, iov, 2)) != EINVAL;
+
+	iov[0].iov_len = PAGE_SIZE;
+	bad += mpool_errno(mpool_stripe_read(st, iov, 1, 0)) != EINVAL;
+
+	if (bad)
+		fprintf(stderr, "%s: %d invalid requests accepted\n",
+			t->gt_test, bad);
+
+	return bad;
+}
+
+/**
+ * sg_start() - Parse parameters and open the stripe group
+ */
+static
+mpool_err_t
+sg_start(
+	struct sg_test *t,
+	int             argc,
+	char          **argv)
+{
+	const char     *namev[MPOOL_STRIPE_WIDTH_MAX];
+	mpool_err_t     err;
+	size_t          i;
+	char           *name, *saveptr = NULL;
+	int             next_arg = 0;
+
+	memset(t, 0, sizeof(*t));
+	t->gt_test = argv[0];
+
+	err = process_params(argc, argv, sg_params, &next_arg, 0);
+	if (err) {
+		fprintf(stderr, "%s: process_params failed\n", t->gt_test);
+		return err;
+	}
+
+	for (name = strtok_r(sg_mpools, ",", &saveptr); name;
+	     name = strtok_r(NULL, ",", &saveptr)) {
+		if (t->gt_mpc == MPOOL_STRIPE_WIDTH_MAX) {
+			t->gt_mpc++;
+			break;
+		}
+		namev[t->gt_mpc++] = name;
+	}
+
+	if (t->gt_mpc == 0 || t->gt_mpc > MPOOL_STRIPE_WIDTH_MAX) {
+		fprintf(stderr, "%s: 1 to %u mpools (mp=<mpool>[,<mpool>...]) "
+			"must be specified\n", t->gt_test,
+			MPOOL_STRIPE_WIDTH_MAX);
+		return merr(EINVAL);
+	}
+
+	if (sg_unitsz == 0 || sg_unitsz % PAGE_SIZE ||
+	    sg_len < PAGE_SIZE || sg_len % PAGE_SIZE) {
+		fprintf(stderr, "%s: unitsz and len must be multiples of "
+			"the page size\n", t->gt_test);
+		return merr(EINVAL);
+	}
+
+	t->gt_buf = aligned_alloc(PAGE_SIZE, sg_len);
+	t->gt_rbuf = aligned_alloc(PAGE_SIZE, sg_len);
+	if (!t->gt_buf || !t->gt_rbuf) {
+		free(t->gt_buf);
+		free(t->gt_rbuf);
+		return merr(ENOMEM);
+	}
+
+	for (i = 0; i < sg_len / sizeof(u64); i++)
+		((u64 *)t->gt_buf)[i] = i * 0x9e3779b97f4a7c15ull;
+
+	err = mpool_stripe_grp_open(namev, t->gt_mpc, O_RDWR, sg_unitsz,
+				    &t->gt_grp, NULL);
+	if (err) {
+		mpft_err(t->gt_test, "mpool_stripe_grp_open", err);
+		free(t->gt_buf);
+		free(t->gt_rbuf);
+	}
+
+	return err;
+}
+
+static
+void
+sg_finish(
+	struct sg_test *t)
+{
+	mpool_stripe_grp_close(t->gt_grp);
+	free(t->gt_buf);
+	free(t->gt_rbuf);
+}
+
+/**
+ *
+ * I/O
+ *
+ */
+
+/**
+ * Striped mblocks are split by stripe unit into one mblock per member.
+ * The io test writes a striped mblock through iovecs that straddle
+ * stripe units, checks that misaligned iovecs are rejected, and after
+ * commit checks the member lengths and reads it back through differently
+ * cut iovecs, both from the writer's handle and after finding it again
+ * by its member IDs.  An aborted striped mblock must not be found.
+ */
+static
+void
+sg_correctness_io_help(void)
+{
+	fprintf(co.co_fp, "\nusage: mpft stripe.correctness.io [options]\n");
+	show_default_params(sg_params, 0);
+}
+
+static
+mpool_err_t
+sg_correctness_io(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_stripe    *st = NULL;
+	struct sg_test          t;
+	mpool_err_t             err;
+	u64                     objidv[MPOOL_STRIPE_WIDTH_MAX];
+
+	err = sg_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	err = mpool_stripe_alloc(t.gt_grp, MP_MED_CAPACITY, &st);
+	if (err) {
+		mpft_err(t.gt_test, "mpool_stripe_alloc", err);
+		goto out;
+	}
+
+	if (sg_errors(&t, st) || sg_write(&t, st)) {
+		mpool_stripe_abort(st);
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	err = mpool_stripe_commit(st);
+	if (err) {
+		mpft_err(t.gt_test, "mpool_stripe_commit", err);
+		mpool_stripe_abort(st);
+		goto out;
+	}
+
+	if (sg_verify(&t, st)) {
+		err = merr(EINVAL);
+		goto errout;
+	}
+
+	err = mpool_stripe_objids(st, objidv, MPOOL_STRIPE_WIDTH_MAX);
+	if (!err)
+		err = mpool_stripe_put(st);
+	st = NULL;
+	if (!err)
+		err = mpool_stripe_find(t.gt_grp, objidv, t.gt_mpc, &st);
+	if (err) {
+		mpft_err(t.gt_test, "mpool_stripe_find", err);
+		goto out;
+	}
+
+	if (sg_verify(&t, st)) {
+		err = merr(EINVAL);
+		goto errout;
+	}
+
+	err = mpool_stripe_delete(st);
+	st = NULL;
+	if (err) {
+		mpft_err(t.gt_test, "mpool_stripe_delete", err);
+		goto out;
+	}
+
+	/* An aborted striped mblock leaves nothing to find */
+	err = mpool_stripe_alloc(t.gt_grp, MP_MED_CAPACITY, &st);
+	if (!err)
+		err = sg_write(&t, st);
+	if (!err)
+		err = mpool_stripe_objids(st, objidv, MPOOL_STRIPE_WIDTH_MAX);
+	if (st)
+		mpool_stripe_abort(st);
+	st = NULL;
+	if (err)
+		goto out;
+
+	if (!mpool_stripe_find(t.gt_grp, objidv, t.gt_mpc, &st)) {
+		fprintf(stderr, "%s: aborted striped mblock found\n",
+			t.gt_test);
+		mpool_stripe_put(st);
+		err = merr(EINVAL);
+	}
+	st = NULL;
+
+errout:
+	if (st)
+		mpool_stripe_delete(st);
+out:
+	sg_finish(&t);
+
+	return err;
+}
+
+struct test_s sg_tests[] = {
+	{ "io", MPFT_TEST_TYPE_CORRECTNESS, sg_correctness_io,
+		sg_correctness_io_help },
+	{ NULL, MPFT_TEST_TYPE_INVALID, NULL, NULL },
+};
+
+void
+sg_help(void)
+{
+	int i = 0;
+
+	fprintf(co.co_fp,
+		"\nstripe tests validate the behavior of striped mblocks\n");
+
+	fprintf(co.co_fp, "Available tests include:\n");
+	while (sg_tests[i].test_name) {
+		fprintf(co.co_fp, "\t%s\n", sg_tests[i].test_name);
+		i++;
+	}
+}
+
+struct group_s mpft_stripe = {
+	.group_name = "stripe",
+	.group_test = sg_tests,
+	.group_help = sg_help,
+};
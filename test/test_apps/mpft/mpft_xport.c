@@ -0,0 +1,966 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <util/platform.h>
+#include <util/param.h>
+#include <util/page.h>
+#include <util/minmax.h>
+#include <mpool/mpool.h>
+
+#include "mpft.h"
+#include "mpft_xport.h"
+
+#define merr(_errnum)   (_errnum)
+
+#define XP_MDC_CAPTGT   (4 * 1024 * 1024)
+#define XP_MLOG_CAPTGT  (16 * 1024 * 1024)
+#define XP_MDC_RECS     (32)
+#define XP_NAMELEN      (32)
+
+/*
+ * Object "i" of a test is named after its type and "i", and its data is a
+ * function of "i", so that the imported copy can be checked against it.
+ * mlog records straddle the archive chunks.
+ */
+char xp_mpool[MPOOL_NAME_LEN_MAX];
+u32  xp_mblocks = 16;
+u64  xp_mbmax = 1024 * 1024;
+u32  xp_mlogs = 4;
+u32  xp_recs = 64;
+u32  xp_chunksz = 64 * 1024;
+u32  xp_threads = 4;
+
+static
+struct param_inst xp_params[] = {
+	PARAM_INST_STRING(xp_mpool, sizeof(xp_mpool), "mp", "mpool"),
+	PARAM_INST_U32(xp_mblocks, "mblocks", "mblocks exported"),
+	PARAM_INST_U64_SIZE(xp_mbmax, "mbmax", "maximum mblock length"),
+	PARAM_INST_U32(xp_mlogs, "mlogs", "mlogs with records exported"),
+	PARAM_INST_U32(xp_recs, "recs", "records per mlog"),
+	PARAM_INST_U32_SIZE(xp_chunksz, "chunksz", "archive chunk size"),
+	PARAM_INST_U32(xp_threads, "threads", "export and import threads"),
+	PARAM_INST_END
+};
+
+enum xp_type {
+	XP_MBLOCK,
+	XP_MLOG,
+	XP_MDC,         /* first mlog of an MDC, the second one follows */
+	XP_MDC2,
+};
+
+/**
+ * struct xp_obj - exported object
+ * @xo_name:  catalog name
+ * @xo_type:  enum xp_type
+ * @xo_objid: object ID in the exporting catalog
+ * @xo_newid: object ID reported by the import callback
+ * @xo_recs:  number of records of an mlog or MDC
+ * @xo_maps:  import callbacks for the object
+ */
+struct xp_obj {
+	char    xo_name[XP_NAMELEN];
+	u32     xo_type;
+	u64     xo_objid;
+	u64     xo_newid;
+	u32     xo_recs;
+	u32     xo_maps;
+};
+
+/**
+ * struct xp_test - state shared by the steps of an xport test
+ * @xt_test: test name
+ * @xt_ds:   mpool handle
+ * @xt_cat:  exporting catalog, then importing catalog
+ * @xt_oid:  MDC OIDs of the exporting and the importing catalog
+ * @xt_objv: objects
+ * @xt_objc: number of objects
+ * @xt_fd:   archive file descriptor
+ * @xt_buf:  data buffer, page aligned
+ * @xt_rbuf: read buffer, page aligned
+ */
+struct xp_test {
+	const char             *xt_test;
+	struct mpool           *xt_ds;
+	struct mpool_catalog   *xt_cat;
+	u64                     xt_oid[2][2];
+	struct xp_obj          *xt_objv;
+	u32                     xt_objc;
+	int                     xt_fd;
+	char                   *xt_buf;
+	char                   *xt_rbuf;
+};
+
+static
+void
+xp_fill(
+	char   *buf,
+	size_t  len,
+	u32     i,
+	u32     rec)
+{
+	size_t off;
+
+	for (off = 0; off < len; off++)
+		buf[off] = (char)(i * 131 + rec * 31 + off / 7);
+}
+
+static
+size_t
+xp_mblock_len(
+	u32 i)
+{
+	return PAGE_SIZE * (1 + (i * 37) % (xp_mbmax / PAGE_SIZE));
+}
+
+/**
+ * xp_rec_len() - Length of record "rec" of mlog "i", up to twice the chunk
+ * size
+ */
+static
+size_t
+xp_rec_len(
+	u32 i,
+	u32 rec)
+{
+	return 1 + (i * 7919 + rec * 104729) % (2 * xp_chunksz);
+}
+
+static
+mpool_err_t
+xp_mblock_create(
+	struct xp_test *t,
+	struct xp_obj  *obj,
+	u32             i)
+{
+	struct mblock_props props;
+	struct iovec        iov;
+	mpool_err_t         err;
+	u64                 mbh;
+
+	err = mpool_mblock_alloc(t->xt_ds, MP_MED_CAPACITY, false, &mbh,
+				 &props);
+	if (err)
+		return err;
+
+	iov.iov_base = t->xt_buf;
+	iov.iov_len = xp_mblock_len(i);
+	xp_fill(t->xt_buf, iov.iov_len, i, 0);
+
+	err = mpool_mblock_write(t->xt_ds, mbh, &iov, 1);
+	if (!err)
+		err = mpool_mblock_commit(t->xt_ds, mbh);
+	if (err) {
+		mpool_mblock_abort(t->xt_ds, mbh);
+		return err;
+	}
+
+	obj->xo_objid = props.mpr_objid;
+
+	return 0;
+}
+
+static
+mpool_err_t
+xp_mlog_create(
+	struct xp_test *t,
+	struct xp_obj  *obj,
+	u32             i)
+{
+	struct mlog_capacity    cap;
+	struct mlog_props       props;
+	struct mpool_mlog      *mlh;
+	mpool_err_t             err;
+	size_t                  len;
+	u64                     gen;
+	u32                     rec;
+
+	memset(&cap, 0, sizeof(cap));
+	cap.lcp_captgt = XP_MLOG_CAPTGT;
+
+	err = mpool_mlog_alloc(t->xt_ds, &cap, MP_MED_CAPACITY, &props, &mlh);
+	if (err)
+		return err;
+
+	err = mpool_mlog_commit(t->xt_ds, mlh);
+	if (err) {
+		mpool_mlog_abort(t->xt_ds, mlh);
+		return err;
+	}
+
+	obj->xo_objid = props.lpr_objid;
+
+	err = mpool_mlog_open(t->xt_ds, mlh, 0, &gen);
+
+	for (rec = 0; rec < obj->xo_recs && !err; rec++) {
+		len = xp_rec_len(i, rec);
+		xp_fill(t->xt_buf, len, i, rec);
+		err = mpool_mlog_append_data(t->xt_ds, mlh, t->xt_buf, len, 0);
+	}
+
+	if (!err)
+		err = mpool_mlog_close(t->xt_ds, mlh);
+
+	mpool_mlog_put(t->xt_ds, mlh);
+
+	return err;
+}
+
+/**
+ * xp_mdc_create() - Create an MDC, which an open leaves with compaction
+ * markers, and append records to it
+ */
+static
+mpool_err_t
+xp_mdc_create(
+	struct xp_test *t,
+	struct xp_obj  *obj,
+	u32             i)
+{
+	struct mpool_mdc   *mdc;
+	mpool_err_t         err;
+	u32                 rec;
+
+	err = mpft_mdc_create(t->xt_ds, XP_MDC_CAPTGT, &obj[0].xo_objid,
+			      &obj[1].xo_objid);
+	if (err)
+		return err;
+
+	err = mpool_mdc_open(t->xt_ds, obj[0].xo_objid, obj[1].xo_objid, 0,
+			     &mdc);
+	if (err) {
+		mpool_mdc_destroy(t->xt_ds, obj[0].xo_objid, obj[1].xo_objid);
+		return err;
+	}
+
+	for (rec = 0; rec < obj->xo_recs && !err; rec++) {
+		xp_fill(t->xt_buf, sizeof(u64) + rec, i, rec);
+		err = mpool_mdc_append(mdc, t->xt_buf, sizeof(u64) + rec,
+				       rec + 1 == obj->xo_recs);
+	}
+
+	mpool_mdc_close(mdc);
+
+	return err;
+}
+
+/**
+ * xp_obj_delete() - Delete an object
+ * @objid: its object ID in the catalog at hand
+ */
+static
+void
+xp_obj_delete(
+	struct xp_test *t,
+	struct xp_obj  *obj,
+	u64             objid)
+{
+	struct mlog_props   props;
+	struct mpool_mlog  *mlh;
+	u64                 mbh;
+
+	if (obj->xo_type == XP_MBLOCK) {
+		if (!mpool_mblock_find(t->xt_ds, objid, &mbh, NULL))
+			mpool_mblock_delete(t->xt_ds, mbh);
+		return;
+	}
+
+	if (mpool_mlog_find_get(t->xt_ds, objid, &props, &mlh))
+		return;
+
+	if (mpool_mlog_delete(t->xt_ds, mlh))
+		mpool_mlog_put(t->xt_ds, mlh);
+}
+
+/**
+ * xp_objid() - Look up the ID of object "i" in the catalog at hand, and
+ * check its metadata
+ */
+static
+mpool_err_t
+xp_objid(
+	struct xp_test *t,
+	u32             i,
+	u64            *objid)
+{
+	mpool_err_t err;
+	size_t      metalen;
+	u32         meta;
+
+	err = mpool_catalog_get(t->xt_cat, t->xt_objv[i].xo_name, objid,
+				&meta, sizeof(meta), &metalen);
+	if (err)
+		return err;
+
+	if (metalen != sizeof(meta) || meta != i) {
+		fprintf(stderr, "%s: %s: bad metadata\n",
+			t->xt_test, t->xt_objv[i].xo_name);
+		return merr(EINVAL);
+	}
+
+	return 0;
+}
+
+static
+mpool_err_t
+xp_mblock_verify(
+	struct xp_test *t,
+	u32             i,
+	u64             objid)
+{
+	struct mblock_props props;
+	struct iovec        iov;
+	mpool_err_t         err;
+	size_t              len = xp_mblock_len(i);
+	u64                 mbh;
+
+	err = mpool_mblock_find(t->xt_ds, objid, &mbh, &props);
+	if (err)
+		return err;
+
+	if (props.mpr_write_len != len)
+		return merr(EINVAL);
+
+	iov.iov_base = t->xt_rbuf;
+	iov.iov_len = len;
+
+	err = mpool_mblock_read(t->xt_ds, mbh, &iov, 1, 0);
+	if (err)
+		return err;
+
+	xp_fill(t->xt_buf, len, i, 0);
+
+	return memcmp(t->xt_buf, t->xt_rbuf, len) ? merr(EINVAL) : 0;
+}
+
+static
+mpool_err_t
+xp_mlog_verify(
+	struct xp_test *t,
+	u32             i,
+	u64             objid)
+{
+	struct mlog_props   props;
+	struct mpool_mlog  *mlh;
+	mpool_err_t         err;
+	size_t              len, rdlen;
+	u64                 gen;
+	u32                 rec;
+
+	err = mpool_mlog_find_get(t->xt_ds, objid, &props, &mlh);
+	if (err)
+		return err;
+
+	err = mpool_mlog_open(t->xt_ds, mlh, 0, &gen);
+	if (err) {
+		mpool_mlog_put(t->xt_ds, mlh);
+		return err;
+	}
+
+	err = mpool_mlog_read_data_init(t->xt_ds, mlh);
+
+	for (rec = 0; !err; rec++) {
+		err = mpool_mlog_read_data_next(t->xt_ds, mlh, t->xt_rbuf,
+						2 * xp_chunksz, &rdlen);
+		if (err || rdlen == 0)
+			break;
+
+		len = xp_rec_len(i, rec);
+		xp_fill(t->xt_buf, len, i, rec);
+
+		if (rec >= t->xt_objv[i].xo_recs || rdlen != len ||
+		    memcmp(t->xt_buf, t->xt_rbuf, len))
+			err = merr(EINVAL);
+	}
+
+	if (!err && rec != t->xt_objv[i].xo_recs)
+		err = merr(ENODATA);
+
+	mpool_mlog_close(t->xt_ds, mlh);
+	mpool_mlog_put(t->xt_ds, mlh);
+
+	return err;
+}
+
+/**
+ * xp_mdc_verify() - Open an MDC from its imported mlogs and read it back
+ *
+ * An MDC without records must open, too: its active mlog holds nothing
+ * but compaction markers.
+ */
+static
+mpool_err_t
+xp_mdc_verify(
+	struct xp_test *t,
+	u32             i,
+	u64             objid1,
+	u64             objid2)
+{
+	struct mpool_mdc   *mdc;
+	mpool_err_t         err;
+	size_t              rdlen;
+	u32                 rec;
+
+	err = mpool_mdc_open(t->xt_ds, objid1, objid2, 0, &mdc);
+	if (err)
+		return err;
+
+	for (rec = 0; !err; rec++) {
+		err = mpool_mdc_read(mdc, t->xt_rbuf, xp_chunksz, &rdlen);
+		if (err || rdlen == 0)
+			break;
+
+		xp_fill(t->xt_buf, sizeof(u64) + rec, i, rec);
+
+		if (rec >= t->xt_objv[i].xo_recs ||
+		    rdlen != sizeof(u64) + rec ||
+		    memcmp(t->xt_buf, t->xt_rbuf, rdlen))
+			err = merr(EINVAL);
+	}
+
+	if (!err && rec != t->xt_objv[i].xo_recs)
+		err = merr(ENODATA);
+
+	mpool_mdc_close(mdc);
+
+	return err;
+}
+
+/**
+ * xp_verify() - Check every object recorded in the importing catalog
+ * @all: every object must be recorded
+ * @nrecorded: number of objects recorded (output), or NULL
+ */
+static
+mpool_err_t
+xp_verify(
+	struct xp_test *t,
+	bool            all,
+	u32            *nrecorded)
+{
+	struct xp_obj  *obj;
+	mpool_err_t     err = 0;
+	u64             objid, objid2;
+	u32             i, n = 0;
+
+	for (i = 0; i < t->xt_objc && !err; i++) {
+		obj = t->xt_objv + i;
+
+		err = xp_objid(t, i, &objid);
+		if (mpool_errno(err) == ENOENT && !all) {
+			err = 0;
+			continue;
+		}
+		if (err)
+			break;
+
+		if (all && (obj->xo_maps != 1 || obj->xo_newid != objid)) {
+			fprintf(stderr, "%s: %s: mapped %u times\n",
+				t->xt_test, obj->xo_name, obj->xo_maps);
+			err = merr(EINVAL);
+			break;
+		}
+
+		n++;
+
+		switch (obj->xo_type) {
+		case XP_MBLOCK:
+			err = xp_mblock_verify(t, i, objid);
+			break;
+
+		case XP_MLOG:
+			err = xp_mlog_verify(t, i, objid);
+			break;
+
+		case XP_MDC:
+			err = xp_objid(t, i + 1, &objid2);
+			if (!err)
+				err = xp_mdc_verify(t, i, objid, objid2);
+			break;
+
+		default:
+			break;
+		}
+
+		if (err)
+			fprintf(stderr, "%s: %s: bad import, errno %d\n",
+				t->xt_test, obj->xo_name, mpool_errno(err));
+	}
+
+	if (nrecorded)
+		*nrecorded = n;
+
+	return err;
+}
+
+static
+void
+xp_map_cb(
+	void       *arg,
+	const char *name,
+	uint64_t    oldid,
+	uint64_t    newid)
+{
+	struct xp_test *t = arg;
+	u32             i;
+
+	for (i = 0; i < t->xt_objc; i++) {
+		if (!strcmp(name, t->xt_objv[i].xo_name) &&
+		    t->xt_objv[i].xo_objid == oldid) {
+			t->xt_objv[i].xo_newid = newid;
+			t->xt_objv[i].xo_maps++;
+			return;
+		}
+	}
+
+	fprintf(stderr, "%s: unknown object %s 0x%lx mapped\n",
+		t->xt_test, name, (ulong)oldid);
+}
+
+/**
+ * xp_delete_all() - Delete the objects of the catalog at hand, and their
+ * names
+ */
+static
+void
+xp_delete_all(
+	struct xp_test *t)
+{
+	u64 objid;
+	u32 i;
+
+	for (i = 0; i < t->xt_objc; i++) {
+		if (xp_objid(t, i, &objid))
+			continue;
+
+		xp_obj_delete(t, t->xt_objv + i, objid);
+		mpool_catalog_delete(t->xt_cat, t->xt_objv[i].xo_name);
+	}
+}
+
+/**
+ * xp_cat_open() - Switch to catalog "c", 0 exporting, 1 importing
+ */
+static
+mpool_err_t
+xp_cat_open(
+	struct xp_test *t,
+	int             c)
+{
+	mpool_err_t err;
+
+	if (t->xt_cat)
+		mpool_catalog_close(t->xt_cat);
+
+	err = mpool_catalog_open(t->xt_ds, t->xt_oid[c][0], t->xt_oid[c][1],
+				 &t->xt_cat);
+	if (err) {
+		mpft_err(t->xt_test, "catalog open", err);
+		t->xt_cat = NULL;
+	}
+
+	return err;
+}
+
+/**
+ * xp_create() - Create object "i" and record it in the catalog at hand
+ */
+static
+mpool_err_t
+xp_create(
+	struct xp_test *t,
+	u32             i)
+{
+	struct xp_obj  *obj = t->xt_objv + i;
+	mpool_err_t     err;
+
+	switch (obj->xo_type) {
+	case XP_MBLOCK:
+		err = xp_mblock_create(t, obj, i);
+		break;
+
+	case XP_MLOG:
+		err = xp_mlog_create(t, obj, i);
+		break;
+
+	case XP_MDC:
+		err = xp_mdc_create(t, obj, i);
+		break;
+
+	default:
+		err = 0;
+		break;
+	}
+
+	if (!err)
+		err = mpool_catalog_put(t->xt_cat, obj->xo_name, obj->xo_objid,
+					&i, sizeof(i));
+	if (err)
+		mpft_err(t->xt_test, obj->xo_name, err);
+
+	return err;
+}
+
+static
+void
+xp_finish(
+	struct xp_test *t)
+{
+	int c;
+
+	if (t->xt_objv) {
+		for (c = 1; c >= 0; c--)
+			if (!xp_cat_open(t, c))
+				xp_delete_all(t);
+	}
+
+	if (t->xt_cat)
+		mpool_catalog_close(t->xt_cat);
+
+	if (t->xt_fd != -1)
+		close(t->xt_fd);
+
+	free(t->xt_objv);
+	free(t->xt_buf);
+	free(t->xt_rbuf);
+
+	mpool_mdc_destroy(t->xt_ds, t->xt_oid[1][0], t->xt_oid[1][1]);
+	mpft_mdc_finish(t->xt_ds, t->xt_oid[0]);
+}
+
+/**
+ * xp_start() - Parse parameters, open the mpool, create both catalogs and
+ * the objects to export, and record them in the exporting one
+ *
+ * Objects 0 and 1 are an MDC with records, 2 and 3 one without, 4 an
+ * empty mlog, followed by the mlogs and the mblocks.
+ */
+static
+mpool_err_t
+xp_start(
+	struct xp_test *t,
+	int             argc,
+	char          **argv)
+{
+	struct xp_obj  *obj;
+	mpool_err_t     err;
+	size_t          bufsz;
+	FILE           *fp;
+	u32             i;
+
+	memset(t, 0, sizeof(*t));
+	t->xt_test = argv[0];
+	t->xt_fd = -1;
+
+	err = mpft_mdc_start(t->xt_test, argc, argv, xp_params, xp_mpool,
+			     XP_MDC_CAPTGT, &t->xt_ds, t->xt_oid[0]);
+	if (err)
+		return err;
+
+	if (xp_mbmax < PAGE_SIZE || xp_mbmax % PAGE_SIZE || xp_chunksz == 0) {
+		fprintf(stderr, "%s: mbmax must be a non-zero multiple of "
+			"the page size, chunksz non-zero\n", t->xt_test);
+		mpft_mdc_finish(t->xt_ds, t->xt_oid[0]);
+		return merr(EINVAL);
+	}
+
+	err = mpft_mdc_create(t->xt_ds, XP_MDC_CAPTGT, &t->xt_oid[1][0],
+			      &t->xt_oid[1][1]);
+	if (err) {
+		mpft_err(t->xt_test, "mdc create", err);
+		mpft_mdc_finish(t->xt_ds, t->xt_oid[0]);
+		return err;
+	}
+
+	bufsz = max_t(size_t, xp_mbmax, 2 * xp_chunksz);
+
+	t->xt_objc = 5 + xp_mlogs + xp_mblocks;
+	t->xt_objv = calloc(t->xt_objc, sizeof(*t->xt_objv));
+	t->xt_buf = aligned_alloc(PAGE_SIZE, bufsz);
+	t->xt_rbuf = aligned_alloc(PAGE_SIZE, bufsz);
+
+	fp = tmpfile();
+	if (fp) {
+		t->xt_fd = dup(fileno(fp));
+		fclose(fp);
+	}
+
+	if (!t->xt_objv || !t->xt_buf || !t->xt_rbuf || t->xt_fd == -1) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	for (i = 0; i < t->xt_objc; i++) {
+		obj = t->xt_objv + i;
+
+		if (i < 4) {
+			obj->xo_type = i % 2 ? XP_MDC2 : XP_MDC;
+			obj->xo_recs = i < 2 ? XP_MDC_RECS : 0;
+			snprintf(obj->xo_name, XP_NAMELEN, "mdc.%u.%u",
+				 i / 2, i % 2);
+		} else if (i < 5 + xp_mlogs) {
+			obj->xo_type = XP_MLOG;
+			obj->xo_recs = i > 4 ? xp_recs : 0;
+			snprintf(obj->xo_name, XP_NAMELEN, "mlog.%u", i);
+		} else {
+			obj->xo_type = XP_MBLOCK;
+			snprintf(obj->xo_name, XP_NAMELEN, "mblock.%u", i);
+		}
+	}
+
+	err = xp_cat_open(t, 0);
+
+	for (i = 0; i < t->xt_objc && !err; i++)
+		err = xp_create(t, i);
+
+	if (!err)
+		return 0;
+
+errout:
+	xp_finish(t);
+
+	return err;
+}
+
+/**
+ * xp_export() - Export the exporting catalog to the archive file
+ */
+static
+mpool_err_t
+xp_export(
+	struct xp_test                 *t,
+	struct mpool_xport_params      *params,
+	struct mpool_xport_stats       *stats)
+{
+	mpool_err_t err;
+
+	err = xp_cat_open(t, 0);
+	if (err)
+		return err;
+
+	if (ftruncate(t->xt_fd, 0) || lseek(t->xt_fd, 0, SEEK_SET))
+		return merr(errno);
+
+	err = mpool_export(t->xt_ds, t->xt_cat, t->xt_fd, params, stats);
+	if (err) {
+		mpft_err(t->xt_test, "export", err);
+		return err;
+	}
+
+	if (stats->xs_mblocks != xp_mblocks ||
+	    stats->xs_mlogs != t->xt_objc - xp_mblocks) {
+		fprintf(stderr, "%s: exported %lu mblocks and %lu mlogs\n",
+			t->xt_test, (ulong)stats->xs_mblocks,
+			(ulong)stats->xs_mlogs);
+		return merr(EINVAL);
+	}
+
+	if (lseek(t->xt_fd, 0, SEEK_SET))
+		return merr(errno);
+
+	return xp_cat_open(t, 1);
+}
+
+/**
+ *
+ * Round trip
+ *
+ */
+
+/**
+ * The round trip test exports mblocks, mlogs whose records straddle the
+ * archive chunks, an empty mlog, an MDC with records and one without, and
+ * imports them into another catalog of the same mpool, with compression
+ * off and on.  The imported objects must have the data and metadata of
+ * the exported ones, each must be reported once to the mapping callback,
+ * and both MDCs must open from their imported mlogs.
+ */
+static
+void
+xp_correctness_roundtrip_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft xport.correctness.roundtrip [options]\n");
+	show_default_params(xp_params, 0);
+}
+
+static
+mpool_err_t
+xp_correctness_roundtrip(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_xport_params   params;
+	struct mpool_xport_stats    xstats, istats;
+	struct xp_test              t;
+	mpool_err_t                 err;
+	u32                         i, pass;
+
+	err = xp_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	memset(&params, 0, sizeof(params));
+	params.xp_threads = xp_threads;
+	params.xp_chunksz = xp_chunksz;
+	params.xp_batch = 4;
+
+	for (pass = 0; pass < 2 && !err; pass++) {
+		params.xp_compress = pass;
+
+		err = xp_export(&t, &params, &xstats);
+		if (err)
+			break;
+
+		for (i = 0; i < t.xt_objc; i++)
+			t.xt_objv[i].xo_maps = 0;
+
+		err = mpool_import(t.xt_ds, t.xt_cat, t.xt_fd, &params,
+				   xp_map_cb, &t, &istats);
+		if (err) {
+			mpft_err(t.xt_test, "import", err);
+			break;
+		}
+
+		if (memcmp(&xstats, &istats, sizeof(xstats))) {
+			fprintf(stderr, "%s: import stats differ from export\n",
+				t.xt_test);
+			err = merr(EINVAL);
+			break;
+		}
+
+		err = xp_verify(&t, true, NULL);
+
+		xp_delete_all(&t);
+	}
+
+	xp_finish(&t);
+
+	return err;
+}
+
+/**
+ *
+ * Truncated
+ *
+ */
+
+/**
+ * The truncated test imports the first half of an archive.  The import
+ * must fail, the objects it recorded in the catalog must be complete, and
+ * once they are deleted, no object may be left behind by the ones it was
+ * importing when the archive ended.
+ */
+static
+void
+xp_correctness_truncated_help(void)
+{
+	fprintf(co.co_fp,
+		"\nusage: mpft xport.correctness.truncated [options]\n");
+	show_default_params(xp_params, 0);
+}
+
+static
+mpool_err_t
+xp_correctness_truncated(
+	int     argc,
+	char  **argv)
+{
+	struct mpool_xport_params   params;
+	struct mpool_xport_stats    stats;
+	struct xp_test              t;
+	struct mp_usage             usage[2];
+	struct mp_props             props;
+	mpool_err_t                 err;
+	u32                         n;
+
+	err = xp_start(&t, argc, argv);
+	if (err)
+		return err;
+
+	memset(&params, 0, sizeof(params));
+	params.xp_threads = xp_threads;
+	params.xp_chunksz = xp_chunksz;
+	params.xp_batch = 1;
+
+	err = xp_export(&t, &params, &stats);
+	if (!err)
+		err = mpool_props_get(t.xt_ds, &props, &usage[0]);
+	if (err)
+		goto out;
+
+	if (ftruncate(t.xt_fd, stats.xs_arbytes / 2)) {
+		err = merr(errno);
+		goto out;
+	}
+
+	err = mpool_import(t.xt_ds, t.xt_cat, t.xt_fd, &params, NULL, NULL,
+			   NULL);
+	if (mpool_errno(err) != EBADMSG) {
+		fprintf(stderr, "%s: truncated import: errno %d\n",
+			t.xt_test, mpool_errno(err));
+		err = merr(EINVAL);
+		goto out;
+	}
+
+	err = xp_verify(&t, false, &n);
+	if (err)
+		goto out;
+
+	xp_delete_all(&t);
+
+	err = mpool_props_get(t.xt_ds, &props, &usage[1]);
+	if (err)
+		goto out;
+
+	if (usage[1].mpu_mblock_cnt != usage[0].mpu_mblock_cnt ||
+	    usage[1].mpu_mlog_cnt != usage[0].mpu_mlog_cnt) {
+		fprintf(stderr, "%s: %u of %u objects imported, "
+			"%u mblocks and %u mlogs left behind\n",
+			t.xt_test, n, t.xt_objc,
+			usage[1].mpu_mblock_cnt - usage[0].mpu_mblock_cnt,
+			usage[1].mpu_mlog_cnt - usage[0].mpu_mlog_cnt);
+		err = merr(EINVAL);
+	}
+
+out:
+	xp_finish(&t);
+
+	return err;
+}
+
+struct test_s xp_tests[] = {
+	{ "roundtrip", MPFT_TEST_TYPE_CORRECTNESS, xp_correctness_roundtrip,
+		xp_correctness_roundtrip_help },
+	{ "truncated", MPFT_TEST_TYPE_CORRECTNESS, xp_correctness_truncated,
+		xp_correctness_truncated_help },
+	{ NULL, MPFT_TEST_TYPE_INVALID, NULL, NULL },
+};
+
+void
+xp_help(void)
+{
+	int i = 0;
+
+	fprintf(co.co_fp,
+		"\nxport tests validate pool export and import\n");
+
+	fprintf(co.co_fp, "Available tests include:\n");
+	while (xp_tests[i].test_name) {
+		fprintf(co.co_fp, "\t%s\n", xp_tests[i].test_name);
+		i++;
+	}
+}
+
+struct group_s mpft_xport = {
+	.group_name = "xport",
+	.group_test = xp_tests,
+	.group_help = xp_help,
+};